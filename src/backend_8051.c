@@ -28,8 +28,12 @@
  *  │  CJNE A, #imm, rel  0xB4, imm8, rel8       3 bytes                │
  *  │  JNZ  rel           0x70, rel8              2 bytes                │
  *  │  JZ   rel           0x60, rel8              2 bytes                │
+ *  │  JC   rel           0x40, rel8              2 bytes                │
+ *  │  JNC  rel           0x50, rel8              2 bytes                │
  *  │  SJMP rel           0x80, rel8              2 bytes                │
+ *  │  AJMP addr11        a10-a8:00001, lo8       2 bytes  (same 2 KB)   │
  *  │  LJMP addr16        0x02, hi8, lo8          3 bytes                │
+ *  │  ACALL addr11       a10-a8:10001, lo8       2 bytes  (same 2 KB)   │
  *  │  LCALL addr16       0x12, hi8, lo8          3 bytes                │
  *  │  RET                0x22                   1 byte                  │
  *  │  NOP                0x00                   1 byte                  │
@@ -64,36 +68,37 @@ static const uint8_t REG_DIRECT_ADDR[8] = {
 /* =========================================================================
  *  Error helpers
  * ========================================================================= */
-static void backend_error(const Instruction *inst, const char *msg)
+static void backend_error(UaDiag *diag, const Instruction *inst,
+                          const char *msg)
 {
-    fprintf(stderr,
-            "\n"
-            "  UA 8051 Backend Error\n"
-            "  ----------------------\n"
-            "  Line %d, Column %d: %s\n\n",
-            inst->line, inst->column, msg);
-    exit(1);
+    diag_printf(diag,
+                "\n"
+                "  UA 8051 Backend Error\n"
+                "  ----------------------\n"
+                "  %s, Line %d, Column %d: %s\n\n",
+                inst->file, inst->line, inst->column, msg);
+    diag_fatal(diag);
 }
 
-static void validate_register(const Instruction *inst, int reg)
+static void validate_register(UaDiag *diag, const Instruction *inst, int reg)
 {
     if (reg < 0 || reg > 7) {
         char msg[256];
         snprintf(msg, sizeof(msg),
                  "register R%d is not available on the 8051 "
                  "(only R0-R7 supported)", reg);
-        backend_error(inst, msg);
+        backend_error(diag, inst, msg);
     }
 }
 
-static void validate_imm8(const Instruction *inst, int64_t val)
+static void validate_imm8(UaDiag *diag, const Instruction *inst, int64_t val)
 {
     if (val < -128 || val > 255) {
         char msg[256];
         snprintf(msg, sizeof(msg),
                  "immediate value %lld out of 8-bit range (-128..255)",
                  (long long)val);
-        backend_error(inst, msg);
+        backend_error(diag, inst, msg);
     }
 }
 
@@ -157,34 +162,115 @@ static int i8051_buftab_has(const I8051BufTable *bt, const char *name) {
 #define emit(buf, byte)  emit_byte(buf, byte)
 
 /* =========================================================================
- *  Symbol Table helpers
+ *  Shift lowering
+ * =========================================================================
+ *  The 8051 only rotates, so a logical shift of A by a constant n is a
+ *  rotation followed by ANL with the bits that must be zero.  A rotation
+ *  by k is k RLs, 8-k RRs, or SWAP (a rotation by 4) plus |k-4| of them,
+ *  whichever is shortest.  A single bit is cheaper as ADD A,ACC (left)
+ *  or CLR C; RRC A (right).  Every candidate is costed and the smallest
+ *  is kept, then the fastest:
+ *
+ *    n    SHL                    SHR
+ *    1    ADD A,ACC      2B 1c   CLR C; RRC A     2B 2c
+ *    2    ADD A,ACC x2   4B 2c   RR; RR; ANL      4B 3c
+ *    3    SWAP; RR; ANL  4B 3c   SWAP; RL; ANL    4B 3c
+ *    4    SWAP; ANL      3B 2c   SWAP; ANL        3B 2c
+ *    5    SWAP; RL; ANL  4B 3c   SWAP; RR; ANL    4B 3c
+ *    6    RR; RR; ANL    4B 3c   RL; RL; ANL      4B 3c
+ *    7    RR; ANL        3B 2c   RL; ANL          3B 2c
+ *    8+   CLR A  (and no MOV A,Rd)
+ *
+ *  A count in a register runs a DJNZ loop on B, so Rs is left intact:
+ *
+ *    MOV  B, Rs          88+s F0    2 bytes
+ *    MOV  A, Rd          E8+d       1
+ *    INC  B              05 F0      2    (count 0 = no iteration)
+ *    SJMP test           80 02      2
+ *  loop:
+ *    ADD  A, ACC         25 E0      2    (SHR: CLR C; RRC A  C3 13)
+ *  test:
+ *    DJNZ B, loop        D5 F0 FB   3
+ *    MOV  Rd, A          F8+d       1    = 13 bytes, 3-4 cycles per bit
  * ========================================================================= */
-static void symtab_init(SymbolTable *st)
+#define I8051_SHIFT_MAX    8     /* longest constant-shift body, in bytes   */
+#define I8051_SHIFT_LOOP  13     /* register-count shift, in bytes          */
+
+/* Machine cycles of a body built from the opcodes below */
+static int i8051_body_cycles(const uint8_t *seq, int len)
 {
-    st->count = 0;
+    int cyc = 0;
+    for (int i = 0; i < len; i++) {
+        cyc++;
+        if (seq[i] == 0x25 || seq[i] == 0x54) i++;  /* 2-byte, 1 cycle */
+    }
+    return cyc;
 }
 
-static void symtab_add(SymbolTable *st, const char *name, int address)
+/* Append a rotation of A left by `k` (0..7) to seq; returns the length */
+static int i8051_rotate_seq(int k, uint8_t *seq)
 {
-    if (st->count >= MAX_SYMBOLS) {
-        fprintf(stderr, "UA 8051: symbol table overflow (max %d)\n",
-                MAX_SYMBOLS);
-        exit(1);
+    int len = 0, d;
+    int swap = (k > 4 ? k - 4 : 4 - k) + 1;
+    if (k <= 8 - k && k <= swap) {
+        while (len < k) seq[len++] = 0x23;                  /* RL A */
+    } else if (8 - k <= swap) {
+        while (len < 8 - k) seq[len++] = 0x03;              /* RR A */
+    } else {
+        seq[len++] = 0xC4;                                  /* SWAP A */
+        for (d = 4; d < k; d++) seq[len++] = 0x23;
+        for (d = k; d < 4; d++) seq[len++] = 0x03;
     }
-    strncpy(st->entries[st->count].name, name, UA_MAX_LABEL_LEN - 1);
-    st->entries[st->count].name[UA_MAX_LABEL_LEN - 1] = '\0';
-    st->entries[st->count].address = address;
-    st->count++;
+    return len;
 }
 
-static int symtab_lookup(const SymbolTable *st, const char *name)
+/*
+ * i8051_shift_imm_seq()
+ *   Body that shifts A logically by `n` bits (left if `left`), without
+ *   the MOV A,Rd / MOV Rd,A around it.  Writes at most I8051_SHIFT_MAX
+ *   bytes to `seq` and returns the count.
+ */
+static int i8051_shift_imm_seq(int left, int64_t n, uint8_t *seq)
 {
-    for (int i = 0; i < st->count; i++) {
-        if (strcmp(st->entries[i].name, name) == 0) {
-            return st->entries[i].address;
+    if (n <= 0) return 0;
+    if (n >= 8) {
+        seq[0] = 0xE4;                                      /* CLR A */
+        return 1;
+    }
+
+    uint8_t alt[I8051_SHIFT_MAX];
+    int len = 0, alt_len = 0;
+
+    /* Rotation + mask */
+    len = i8051_rotate_seq(left ? (int)n : 8 - (int)n, seq);
+    seq[len++] = 0x54;                                      /* ANL A,#m */
+    seq[len++] = (uint8_t)(left ? 0xFF << n : 0xFF >> n);
+
+    /* One bit at a time (only ever competitive for n <= 2) */
+    if (n <= 2) {
+        for (int k = 0; k < (int)n; k++) {
+            if (left) { alt[alt_len++] = 0x25; alt[alt_len++] = 0xE0; }
+            else      { alt[alt_len++] = 0xC3; alt[alt_len++] = 0x13; }
+        }
+        if (alt_len < len ||
+            (alt_len == len &&
+             i8051_body_cycles(alt, alt_len) < i8051_body_cycles(seq, len))) {
+            memcpy(seq, alt, (size_t)alt_len);
+            len = alt_len;
         }
     }
-    return -1;  /* not found */
+    return len;
+}
+
+/* Bytes of SHL / SHR Rd, Rs|#n */
+static int i8051_shift_size(const Instruction *inst)
+{
+    uint8_t seq[I8051_SHIFT_MAX];
+    if (inst->operands[1].type != OPERAND_IMMEDIATE)
+        return I8051_SHIFT_LOOP;
+    int64_t n = inst->operands[1].data.imm;
+    int body = i8051_shift_imm_seq(inst->opcode == OP_SHL, n, seq);
+    return (n >= 8 ? 1 : 2) + body;
 }
 
 /* =========================================================================
@@ -209,16 +295,25 @@ static int symtab_lookup(const SymbolTable *st, const char *name)
  *    XOR   Rd, Rs         -> MOV A,Rd; XRL A,Rs; MOV Rd,A  = 3 bytes
  *    XOR   Rd, #imm       -> MOV A,Rd; XRL A,#imm; MOV Rd,A = 4 bytes
  *    NOT   Rd             -> MOV A,Rd; CPL A; MOV Rd,A     = 3 bytes
- *    SHL   Rd, #n         -> n × { MOV A,Rd; RL A; MOV Rd,A }  (unrolled, or via loop)
- *                            Simplified: MOV A,Rd; (RL A)*n; MOV Rd,A = 2+n bytes
- *    SHR   Rd, #n         -> MOV A,Rd; (RR A)*n; MOV Rd,A = 2+n bytes
+ *    SHL   Rd, #n         -> MOV A,Rd; <shift>; MOV Rd,A   = 2-6 bytes
+ *    SHR   Rd, #n            (see "Shift lowering"; n >= 8: CLR A; MOV Rd,A)
+ *    SHL   Rd, Rs         -> DJNZ loop on B                = 13 bytes
+ *    SHR   Rd, Rs
  *    CMP   Ra, #imm       -> CJNE A, #imm, +0  (3 bytes: set carry flag)
  *                            Full: MOV A,Ra; CJNE A,#imm,$+3 = 4 bytes
  *    CMP   Ra, Rb         -> MOV A,Ra; CLR C; SUBB A,Rb   = 4 bytes (flags only)
- *    JMP   label          -> LJMP addr16                   = 3 bytes
+ *    JMP   label          -> SJMP rel / AJMP addr11        = 2 bytes
+ *                            (far: LJMP addr16             = 3 bytes)
  *    JZ    label          -> JZ rel                        = 2 bytes
+ *                            (far: JNZ $+5; LJMP addr16    = 5 bytes)
  *    JNZ   label          -> JNZ rel                       = 2 bytes
- *    CALL  label          -> LCALL addr16                  = 3 bytes
+ *                            (far: JZ $+5; LJMP addr16     = 5 bytes)
+ *    JL    label          -> JC rel                        = 2 bytes
+ *                            (far: JNC $+5; LJMP addr16    = 5 bytes)
+ *    JG    label          -> JC $+4; JNZ rel               = 4 bytes
+ *                            (far: JC $+7; JZ $+5; LJMP    = 7 bytes)
+ *    CALL  label          -> ACALL addr11                  = 2 bytes
+ *                            (far: LCALL addr16            = 3 bytes)
  *    RET                  -> RET                           = 1 byte
  *    PUSH  Rs             -> PUSH direct                   = 2 bytes
  *    POP   Rd             -> POP  direct                   = 2 bytes
@@ -230,7 +325,8 @@ static int symtab_lookup(const SymbolTable *st, const char *name)
  *    DIV   Rd, #imm       -> MOV B,#imm; MOV A,Rd; DIV AB; MOV Rd,A = 6 bytes
  * ========================================================================= */
 
-static int instruction_size_8051(const Instruction *inst)
+static int instruction_size_8051(const Instruction *inst, int is_short,
+                                 UaDiag *diag)
 {
     if (inst->is_label) return 0;   /* labels emit no bytes */
 
@@ -284,19 +380,9 @@ static int instruction_size_8051(const Instruction *inst)
         case OP_NOT:   /* MOV A,Rd; CPL A; MOV Rd,A */
             return 3;
 
-        case OP_SHL:
-            if (inst->operands[1].type == OPERAND_IMMEDIATE) {
-                imm = inst->operands[1].data.imm;
-                return 2 + (int)imm;   /* MOV A,Rd; (RL A)*n; MOV Rd,A */
-            }
-            return 3;  /* fallback for reg: treat like 1 shift */
-
+        case OP_SHL:   /* MOV A,Rd; <shift>; MOV Rd,A, or a DJNZ loop */
         case OP_SHR:
-            if (inst->operands[1].type == OPERAND_IMMEDIATE) {
-                imm = inst->operands[1].data.imm;
-                return 2 + (int)imm;
-            }
-            return 3;
+            return i8051_shift_size(inst);
 
         case OP_CMP:
             if (inst->operands[1].type == OPERAND_REGISTER)
@@ -304,23 +390,19 @@ static int instruction_size_8051(const Instruction *inst)
             else
                 return 4;   /* MOV A,Ra; CJNE A,#imm,$+3 */
 
-        case OP_JMP:   /* LJMP addr16 */
-            return 3;
-
-        case OP_JZ:    /* JZ rel */
-            return 2;
-
-        case OP_JNZ:   /* JNZ rel */
-            return 2;
+        case OP_JMP:   /* SJMP rel / AJMP addr11, or LJMP addr16 */
+            return is_short ? 2 : 3;
 
-        case OP_JL:    /* JC rel */
-            return 2;
+        case OP_JZ:    /* JZ rel, or JNZ skip + LJMP */
+        case OP_JNZ:   /* JNZ rel, or JZ skip + LJMP */
+        case OP_JL:    /* JC rel, or JNC skip + LJMP */
+            return is_short ? 2 : 5;
 
-        case OP_JG:    /* JC skip + JZ skip + SJMP target */
-            return 6;
+        case OP_JG:    /* JC skip + JNZ rel, or JC skip + JZ skip + LJMP */
+            return is_short ? 4 : 7;
 
-        case OP_CALL:  /* LCALL addr16 */
-            return 3;
+        case OP_CALL:  /* ACALL addr11, or LCALL addr16 */
+            return is_short ? 2 : 3;
 
         case OP_RET:   /* RET */
             return 1;
@@ -388,7 +470,7 @@ static int instruction_size_8051(const Instruction *inst)
         case OP_STOREB:
             return 2;       /* MOV A, Rs; MOV @Ri, A  (same as STORE) */
         case OP_SYS:
-            backend_error(inst,
+            backend_error(diag, inst,
                 "SYS is not supported on the 8051 (baremetal, no OS)");
             return 0;
 
@@ -410,19 +492,153 @@ static int instruction_size_8051(const Instruction *inst)
 
         default:
             (void)rd; (void)rs; (void)imm;
-            backend_error(inst, "unsupported opcode for 8051 backend");
+            backend_error(diag, inst, "unsupported opcode for 8051 backend");
             return 0;  /* unreachable */
     }
 }
 
+/* =========================================================================
+ *  Branch relaxation
+ * =========================================================================
+ *  Same scheme as the x86 back-ends: size every JMP / CALL / conditional
+ *  jump in its long form, shrink each one whose target is in reach of the
+ *  2-byte form, and repeat until nothing changes.  A branch that @ORG
+ *  later pushes out of reach is pinned to the long form, so the loop
+ *  always ends.
+ *
+ *  The 2-byte forms reach:
+ *    JMP             SJMP: -128..+127 of the next instruction, or
+ *                    AJMP: anywhere in the same 2 KB page
+ *    CALL            ACALL: anywhere in the same 2 KB page
+ *    JZ / JNZ / JL   -128..+127 of the next instruction
+ *    JG              -128..+127 of the end of its 4-byte sequence
+ *
+ *  The long forms reach the whole 64 KB code space; a far conditional
+ *  jump becomes the inverted condition skipping over an LJMP.
+ * ========================================================================= */
+#define I8051_BR_LONG     0    /* LJMP / LCALL                             */
+#define I8051_BR_SHORT    1    /* SJMP, AJMP, ACALL or rel8 conditional    */
+#define I8051_BR_PINNED   2    /* long, the short form went out of reach   */
+
+static int i8051_is_relaxable(const Instruction *inst)
+{
+    if (inst->is_label) return 0;
+    switch (inst->opcode) {
+        case OP_JMP: case OP_CALL:
+        case OP_JZ: case OP_JNZ: case OP_JL: case OP_JG:
+            return inst->operands[0].type == OPERAND_LABEL_REF;
+        default:
+            return 0;
+    }
+}
+
+static int i8051_fits_rel8(int rel)
+{
+    return rel >= -128 && rel <= 127;
+}
+
+static int i8051_same_page(int next_pc, int target)
+{
+    return (next_pc & 0xF800) == (target & 0xF800);
+}
+
+/* Can the 2-byte form of `inst` at `pc` reach `target`? */
+static int i8051_short_reaches(const Instruction *inst, int pc, int target)
+{
+    switch (inst->opcode) {
+        case OP_JMP:
+            return i8051_fits_rel8(target - (pc + 2)) ||
+                   i8051_same_page(pc + 2, target);
+        case OP_CALL:
+            return i8051_same_page(pc + 2, target);
+        case OP_JG:
+            return i8051_fits_rel8(target - (pc + 4));
+        default:
+            return i8051_fits_rel8(target - (pc + 2));
+    }
+}
+
+static uint8_t* i8051_relax_branches(const Instruction *ir, int ir_count,
+                                     const StrPool *strs, UaDiag *diag)
+{
+    uint8_t *form     = (uint8_t *)calloc((size_t)ir_count + 1, 1);
+    int     *inst_pc  = (int *)malloc(((size_t)ir_count + 1) * sizeof(int));
+    int     *label_at = (int *)malloc(((size_t)strs->count + 1) * sizeof(int));
+    if (!form || !inst_pc || !label_at) {
+        free(form); free(inst_pc); free(label_at);
+        return NULL;
+    }
+
+    /* Sizing an operand can raise an error: release the arrays then */
+    int mark = diag_owned(diag);
+    diag_own(diag, &form, diag_free_ptr);
+    diag_own(diag, &inst_pc, diag_free_ptr);
+    diag_own(diag, &label_at, diag_free_ptr);
+
+    /* Label name -> IR index of its first definition */
+    for (int id = 0; id < strs->count; id++) label_at[id] = -1;
+    for (int i = 0; i < ir_count; i++) {
+        if (ir[i].is_label && label_at[ir[i].label_id] < 0)
+            label_at[ir[i].label_id] = i;
+    }
+
+    int changed;
+    do {
+        int pc = 0;
+        for (int i = 0; i < ir_count; i++) {
+            const Instruction *inst = &ir[i];
+            inst_pc[i] = pc;
+            if (!inst->is_label && inst->opcode == OP_ORG) {
+                int target = (int)(uint32_t)inst->operands[0].data.imm;
+                if (target > pc) pc = target;
+            } else {
+                pc += instruction_size_8051(inst, form[i] == I8051_BR_SHORT,
+                                            diag);
+            }
+        }
+        inst_pc[ir_count] = pc;
+
+        changed = 0;
+        for (int i = 0; i < ir_count; i++) {
+            if (form[i] == I8051_BR_PINNED || !i8051_is_relaxable(&ir[i]))
+                continue;
+            int t = label_at[ir[i].operands[0].data.label_id];
+            if (t < 0) continue;
+
+            int target = inst_pc[t];
+            if (form[i] == I8051_BR_SHORT) {
+                if (!i8051_short_reaches(&ir[i], inst_pc[i], target)) {
+                    form[i] = I8051_BR_PINNED;
+                    changed = 1;
+                }
+            } else {
+                int shrink = instruction_size_8051(&ir[i], 0, diag)
+                           - instruction_size_8051(&ir[i], 1, diag);
+                if (t > i) target -= shrink;
+                if (i8051_short_reaches(&ir[i], inst_pc[i], target)) {
+                    form[i] = I8051_BR_SHORT;
+                    changed = 1;
+                }
+            }
+        }
+    } while (changed);
+
+    diag_release(diag, mark);
+    free(inst_pc);
+    free(label_at);
+    return form;
+}
+
 /* =========================================================================
  *  Pass 1:  Build symbol table
  * ========================================================================= */
 static int pass1_build_symbols(const Instruction *ir, int ir_count,
+                               const StrPool *strs, const uint8_t *br_form,
                                SymbolTable *st, I8051VarTable *vtab,
-                               I8051BufTable *buftab)
+                               I8051BufTable *buftab, UaDiag *diag)
 {
-    symtab_init(st);
+    symtab_init(st, diag);
+    diag_own(diag, st, symtab_drop);
     vtab->count = 0;
     i8051_buftab_init(buftab);
     int pc = 0;    /* program counter (byte offset) */
@@ -432,25 +648,25 @@ static int pass1_build_symbols(const Instruction *ir, int ir_count,
 
         if (inst->is_label) {
             /* Check for duplicate */
-            if (symtab_lookup(st, inst->label_name) >= 0) {
+            if (symtab_lookup(st, strpool_get(strs, inst->label_id)) >= 0) {
                 char msg[256];
                 snprintf(msg, sizeof(msg),
-                         "duplicate label '%s'", inst->label_name);
-                backend_error(inst, msg);
+                         "duplicate label '%s'", strpool_get(strs, inst->label_id));
+                backend_error(diag, inst, msg);
             }
-            symtab_add(st, inst->label_name, pc);
+            symtab_add(st, strpool_get(strs, inst->label_id), pc);
         } else if (inst->opcode == OP_VAR) {
             /* Allocate a direct-address slot in internal RAM */
-            const char *vname = inst->operands[0].data.label;
+            const char *vname = strpool_get(strs, inst->operands[0].data.label_id);
             if (vtab->count >= I8051_MAX_VARS) {
-                backend_error(inst,
+                backend_error(diag, inst,
                               "too many variables (8051 internal RAM full)");
             }
             if (symtab_lookup(st, vname) >= 0) {
                 char msg[256];
                 snprintf(msg, sizeof(msg),
                          "duplicate variable '%s'", vname);
-                backend_error(inst, msg);
+                backend_error(diag, inst, msg);
             }
             int addr = I8051_VAR_BASE + vtab->count;
             I8051VarEntry *v = &vtab->vars[vtab->count];
@@ -471,27 +687,27 @@ static int pass1_build_symbols(const Instruction *ir, int ir_count,
              * The "address" here is the direct RAM address (not a PC offset). */
             symtab_add(st, vname, addr);
 
-            pc += instruction_size_8051(inst);
+            pc += instruction_size_8051(inst, 0, diag);
         } else if (inst->opcode == OP_BUFFER) {
             /* Allocate consecutive bytes in internal RAM for a buffer */
-            const char *bname = inst->operands[0].data.label;
+            const char *bname = strpool_get(strs, inst->operands[0].data.label_id);
             int bsize = (int)inst->operands[1].data.imm;
             int addr = I8051_VAR_BASE + vtab->count;
             if (addr + bsize > I8051_VAR_LIMIT) {
-                backend_error(inst,
+                backend_error(diag, inst,
                               "BUFFER too large for 8051 internal RAM");
             }
             if (symtab_lookup(st, bname) >= 0) {
                 char msg[256];
                 snprintf(msg, sizeof(msg),
                          "duplicate buffer '%s'", bname);
-                backend_error(inst, msg);
+                backend_error(diag, inst, msg);
             }
             symtab_add(st, bname, addr);
             i8051_buftab_add(buftab, bname);
             vtab->count += bsize;  /* reserve bsize bytes */
 
-            pc += instruction_size_8051(inst);
+            pc += instruction_size_8051(inst, 0, diag);
         } else if (inst->opcode == OP_ORG) {
             /* @ORG <address> — advance PC to the given address */
             uint32_t target = (uint32_t)inst->operands[0].data.imm;
@@ -500,11 +716,12 @@ static int pass1_build_symbols(const Instruction *ir, int ir_count,
                 snprintf(msg, sizeof(msg),
                          "@ORG 0x%04X would move address backwards "
                          "(current PC = 0x%04X)", target, (unsigned)pc);
-                backend_error(inst, msg);
+                backend_error(diag, inst, msg);
             }
             pc = (int)target;
         } else {
-            pc += instruction_size_8051(inst);
+            pc += instruction_size_8051(inst, br_form[i] == I8051_BR_SHORT,
+                                        diag);
         }
     }
 
@@ -604,16 +821,6 @@ static void emit_cpl_a(CodeBuffer *buf)
     emit(buf, 0xF4);
 }
 
-static void emit_rl_a(CodeBuffer *buf)
-{
-    emit(buf, 0x23);    /* RL A — rotate left through accumulator */
-}
-
-static void emit_rr_a(CodeBuffer *buf)
-{
-    emit(buf, 0x03);    /* RR A — rotate right */
-}
-
 /* Emit LJMP addr16 */
 static void emit_ljmp(CodeBuffer *buf, uint16_t addr)
 {
@@ -630,13 +837,53 @@ static void emit_lcall(CodeBuffer *buf, uint16_t addr)
     emit(buf, (uint8_t)(addr & 0xFF));
 }
 
+/* Emit AJMP (op 0x01) / ACALL (op 0x11) addr11: a10-a8 in the opcode */
+static void emit_abs11(CodeBuffer *buf, uint8_t op, uint16_t addr)
+{
+    emit(buf, (uint8_t)(((addr >> 3) & 0xE0) | op));
+    emit(buf, (uint8_t)(addr & 0xFF));
+}
+
+/* Emit a 2-byte rel8 jump (SJMP, JZ, JNZ, JC, ...) to `target` */
+static void emit_rel8_jump(CodeBuffer *buf, uint8_t op, int target)
+{
+    int rel = target - (buf->size + 2);
+    emit(buf, op);
+    emit(buf, (uint8_t)(rel & 0xFF));
+}
+
+/* Emit JMP in the form relaxation chose: SJMP, else AJMP, or LJMP */
+static void emit_jmp_form(CodeBuffer *buf, int is_short, int target)
+{
+    if (!is_short)
+        emit_ljmp(buf, (uint16_t)target);
+    else if (i8051_fits_rel8(target - (buf->size + 2)))
+        emit_rel8_jump(buf, 0x80, target);                 /* SJMP */
+    else
+        emit_abs11(buf, 0x01, (uint16_t)target);           /* AJMP */
+}
+
+/* Emit a conditional jump: `op` rel8, or `inv_op` $+5 over an LJMP */
+static void emit_jcc_form(CodeBuffer *buf, uint8_t op, uint8_t inv_op,
+                          int is_short, int target)
+{
+    if (is_short) {
+        emit_rel8_jump(buf, op, target);
+    } else {
+        emit(buf, inv_op);
+        emit(buf, 0x03);                    /* skip the LJMP */
+        emit_ljmp(buf, (uint16_t)target);
+    }
+}
+
 /* =========================================================================
  *  Pass 2:  Code emission
  * ========================================================================= */
 static void pass2_emit_code(const Instruction *ir, int ir_count,
+                            const StrPool *strs, const uint8_t *br_form,
                             const SymbolTable *st,
                             const I8051BufTable *buftab,
-                            CodeBuffer *buf)
+                            CodeBuffer *buf, UaDiag *diag)
 {
     for (int i = 0; i < ir_count; i++) {
         const Instruction *inst = &ir[i];
@@ -648,6 +895,8 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
         int target_addr;
         int rel;
 
+        codebuf_add_line(buf, inst->file, inst->line);
+
         switch (inst->opcode) {
 
         /* ----------------------------------------------------------------
@@ -656,8 +905,8 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
         case OP_LDI:
             rd  = inst->operands[0].data.reg;
             imm = inst->operands[1].data.imm;
-            validate_register(inst, rd);
-            validate_imm8(inst, imm);
+            validate_register(diag, inst, rd);
+            validate_imm8(diag, inst, imm);
             emit_mov_rn_imm(buf, rd, (uint8_t)(imm & 0xFF));
             break;
 
@@ -667,8 +916,8 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
         case OP_MOV:
             rd = inst->operands[0].data.reg;
             rs = inst->operands[1].data.reg;
-            validate_register(inst, rd);
-            validate_register(inst, rs);
+            validate_register(diag, inst, rd);
+            validate_register(diag, inst, rs);
             emit_mov_a_rn(buf, rs);
             emit_mov_rn_a(buf, rd);
             break;
@@ -680,9 +929,9 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
         case OP_LOAD:
             rd = inst->operands[0].data.reg;
             rs = inst->operands[1].data.reg;
-            validate_register(inst, rd);
+            validate_register(diag, inst, rd);
             if (rs != 0 && rs != 1) {
-                backend_error(inst,
+                backend_error(diag, inst,
                     "LOAD: indirect source must be R0 or R1 on 8051 "
                     "(MOV A, @Ri)");
             }
@@ -697,9 +946,9 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
         case OP_STORE:
             rs = inst->operands[0].data.reg;
             rd = inst->operands[1].data.reg;
-            validate_register(inst, rs);
+            validate_register(diag, inst, rs);
             if (rd != 0 && rd != 1) {
-                backend_error(inst,
+                backend_error(diag, inst,
                     "STORE: indirect destination must be R0 or R1 on 8051 "
                     "(MOV @Ri, A)");
             }
@@ -713,15 +962,15 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
          * ---------------------------------------------------------------- */
         case OP_ADD:
             rd = inst->operands[0].data.reg;
-            validate_register(inst, rd);
+            validate_register(diag, inst, rd);
             emit_mov_a_rn(buf, rd);
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 rs = inst->operands[1].data.reg;
-                validate_register(inst, rs);
+                validate_register(diag, inst, rs);
                 emit_add_a_rn(buf, rs);
             } else {
                 imm = inst->operands[1].data.imm;
-                validate_imm8(inst, imm);
+                validate_imm8(diag, inst, imm);
                 emit_add_a_imm(buf, (uint8_t)(imm & 0xFF));
             }
             emit_mov_rn_a(buf, rd);
@@ -733,16 +982,16 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
          * ---------------------------------------------------------------- */
         case OP_SUB:
             rd = inst->operands[0].data.reg;
-            validate_register(inst, rd);
+            validate_register(diag, inst, rd);
             emit_clr_c(buf);
             emit_mov_a_rn(buf, rd);
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 rs = inst->operands[1].data.reg;
-                validate_register(inst, rs);
+                validate_register(diag, inst, rs);
                 emit_subb_a_rn(buf, rs);
             } else {
                 imm = inst->operands[1].data.imm;
-                validate_imm8(inst, imm);
+                validate_imm8(diag, inst, imm);
                 emit_subb_a_imm(buf, (uint8_t)(imm & 0xFF));
             }
             emit_mov_rn_a(buf, rd);
@@ -754,15 +1003,15 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
          * ---------------------------------------------------------------- */
         case OP_AND:
             rd = inst->operands[0].data.reg;
-            validate_register(inst, rd);
+            validate_register(diag, inst, rd);
             emit_mov_a_rn(buf, rd);
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 rs = inst->operands[1].data.reg;
-                validate_register(inst, rs);
+                validate_register(diag, inst, rs);
                 emit_anl_a_rn(buf, rs);
             } else {
                 imm = inst->operands[1].data.imm;
-                validate_imm8(inst, imm);
+                validate_imm8(diag, inst, imm);
                 emit_anl_a_imm(buf, (uint8_t)(imm & 0xFF));
             }
             emit_mov_rn_a(buf, rd);
@@ -773,15 +1022,15 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
          * ---------------------------------------------------------------- */
         case OP_OR:
             rd = inst->operands[0].data.reg;
-            validate_register(inst, rd);
+            validate_register(diag, inst, rd);
             emit_mov_a_rn(buf, rd);
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 rs = inst->operands[1].data.reg;
-                validate_register(inst, rs);
+                validate_register(diag, inst, rs);
                 emit_orl_a_rn(buf, rs);
             } else {
                 imm = inst->operands[1].data.imm;
-                validate_imm8(inst, imm);
+                validate_imm8(diag, inst, imm);
                 emit_orl_a_imm(buf, (uint8_t)(imm & 0xFF));
             }
             emit_mov_rn_a(buf, rd);
@@ -792,15 +1041,15 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
          * ---------------------------------------------------------------- */
         case OP_XOR:
             rd = inst->operands[0].data.reg;
-            validate_register(inst, rd);
+            validate_register(diag, inst, rd);
             emit_mov_a_rn(buf, rd);
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 rs = inst->operands[1].data.reg;
-                validate_register(inst, rs);
+                validate_register(diag, inst, rs);
                 emit_xrl_a_rn(buf, rs);
             } else {
                 imm = inst->operands[1].data.imm;
-                validate_imm8(inst, imm);
+                validate_imm8(diag, inst, imm);
                 emit_xrl_a_imm(buf, (uint8_t)(imm & 0xFF));
             }
             emit_mov_rn_a(buf, rd);
@@ -811,48 +1060,52 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
          * ---------------------------------------------------------------- */
         case OP_NOT:
             rd = inst->operands[0].data.reg;
-            validate_register(inst, rd);
+            validate_register(diag, inst, rd);
             emit_mov_a_rn(buf, rd);
             emit_cpl_a(buf);
             emit_mov_rn_a(buf, rd);
             break;
 
         /* ----------------------------------------------------------------
-         *  SHL Rd, #n  ->  MOV A,Rd; (RL A)*n; MOV Rd,A      2+n bytes
+         *  SHL / SHR Rd, #n  ->  MOV A,Rd; <shift>; MOV Rd,A  2-6 bytes
+         *  SHL / SHR Rd, Rs  ->  DJNZ loop on B               13 bytes
+         *  Logical shifts (zero fill); see "Shift lowering".
          * ---------------------------------------------------------------- */
         case OP_SHL:
+        case OP_SHR: {
+            int left = inst->opcode == OP_SHL;
             rd = inst->operands[0].data.reg;
-            validate_register(inst, rd);
-            emit_mov_a_rn(buf, rd);
-            if (inst->operands[1].type == OPERAND_IMMEDIATE) {
-                imm = inst->operands[1].data.imm;
-                for (int k = 0; k < (int)imm; k++) emit_rl_a(buf);
-            } else {
-                rs = inst->operands[1].data.reg;
-                validate_register(inst, rs);
-                /* Single shift as fallback */
-                emit_rl_a(buf);
-            }
-            emit_mov_rn_a(buf, rd);
-            break;
-
-        /* ----------------------------------------------------------------
-         *  SHR Rd, #n  ->  MOV A,Rd; (RR A)*n; MOV Rd,A      2+n bytes
-         * ---------------------------------------------------------------- */
-        case OP_SHR:
-            rd = inst->operands[0].data.reg;
-            validate_register(inst, rd);
-            emit_mov_a_rn(buf, rd);
+            validate_register(diag, inst, rd);
             if (inst->operands[1].type == OPERAND_IMMEDIATE) {
+                uint8_t seq[I8051_SHIFT_MAX];
                 imm = inst->operands[1].data.imm;
-                for (int k = 0; k < (int)imm; k++) emit_rr_a(buf);
+                if (imm < 8) emit_mov_a_rn(buf, rd);
+                emit_bytes(buf, seq, i8051_shift_imm_seq(left, imm, seq));
+                emit_mov_rn_a(buf, rd);
             } else {
                 rs = inst->operands[1].data.reg;
-                validate_register(inst, rs);
-                emit_rr_a(buf);
+                validate_register(diag, inst, rs);
+                emit(buf, (uint8_t)(0x88 + rs));    /* MOV B, Rs      */
+                emit(buf, 0xF0);
+                emit_mov_a_rn(buf, rd);             /* MOV A, Rd      */
+                emit(buf, 0x05);                    /* INC B          */
+                emit(buf, 0xF0);
+                emit(buf, 0x80);                    /* SJMP test      */
+                emit(buf, 0x02);
+                if (left) {
+                    emit(buf, 0x25);                /* ADD A, ACC     */
+                    emit(buf, 0xE0);
+                } else {
+                    emit_clr_c(buf);                /* CLR C          */
+                    emit(buf, 0x13);                /* RRC A          */
+                }
+                emit(buf, 0xD5);                    /* test: DJNZ B,  */
+                emit(buf, 0xF0);
+                emit(buf, 0xFB);                    /*   loop (-5)    */
+                emit_mov_rn_a(buf, rd);             /* MOV Rd, A      */
             }
-            emit_mov_rn_a(buf, rd);
             break;
+        }
 
         /* ----------------------------------------------------------------
          *  CMP Ra, Rb   -> MOV A,Ra; CLR C; SUBB A,Rb        4 bytes
@@ -863,16 +1116,16 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
          * ---------------------------------------------------------------- */
         case OP_CMP:
             rd = inst->operands[0].data.reg;
-            validate_register(inst, rd);
+            validate_register(diag, inst, rd);
             emit_mov_a_rn(buf, rd);
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 rs = inst->operands[1].data.reg;
-                validate_register(inst, rs);
+                validate_register(diag, inst, rs);
                 emit_clr_c(buf);
                 emit_subb_a_rn(buf, rs);
             } else {
                 imm = inst->operands[1].data.imm;
-                validate_imm8(inst, imm);
+                validate_imm8(diag, inst, imm);
                 /* CJNE A, #imm, $+3   (skip 0 bytes — just sets C flag) */
                 emit(buf, 0xB4);
                 emit(buf, (uint8_t)(imm & 0xFF));
@@ -881,132 +1134,94 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
             break;
 
         /* ----------------------------------------------------------------
-         *  JMP label  ->  LJMP addr16   [0x02, hi, lo]        3 bytes
+         *  JMP label   ->  SJMP rel  [0x80, rel8]             2 bytes
+         *              or  AJMP addr11 (same 2 KB page)       2 bytes
+         *              or  LJMP addr16 [0x02, hi, lo]         3 bytes
+         *  CALL label  ->  ACALL addr11 (same 2 KB page)      2 bytes
+         *              or  LCALL addr16 [0x12, hi, lo]        3 bytes
+         *  JZ / JNZ / JL label  ->  JZ / JNZ / JC rel         2 bytes
+         *      far: JNZ / JZ / JNC $+5; LJMP addr16           5 bytes
+         *
+         *  After CMP, Carry is set if Ra < Rb (unsigned).
+         *  The form of each branch was chosen by i8051_relax_branches().
          * ---------------------------------------------------------------- */
         case OP_JMP:
-            target_addr = symtab_lookup(st, inst->operands[0].data.label);
-            if (target_addr < 0) {
-                char msg[256];
-                snprintf(msg, sizeof(msg),
-                         "undefined label '%s'",
-                         inst->operands[0].data.label);
-                backend_error(inst, msg);
-            }
-            emit_ljmp(buf, (uint16_t)target_addr);
-            break;
-
-        /* ----------------------------------------------------------------
-         *  JZ label  ->  JZ rel   [0x60, rel8]                2 bytes
-         * ---------------------------------------------------------------- */
+        case OP_CALL:
         case OP_JZ:
-            target_addr = symtab_lookup(st, inst->operands[0].data.label);
-            if (target_addr < 0) {
-                char msg[256];
-                snprintf(msg, sizeof(msg),
-                         "undefined label '%s'",
-                         inst->operands[0].data.label);
-                backend_error(inst, msg);
-            }
-            /* Relative offset is computed from PC AFTER this instruction */
-            rel = target_addr - (buf->size + 2);
-            if (rel < -128 || rel > 127) {
-                backend_error(inst,
-                    "JZ target out of range for 8-bit relative jump");
-            }
-            emit(buf, 0x60);
-            emit(buf, (uint8_t)(rel & 0xFF));
-            break;
-
-        /* ----------------------------------------------------------------
-         *  JNZ label  ->  JNZ rel   [0x70, rel8]              2 bytes
-         * ---------------------------------------------------------------- */
         case OP_JNZ:
-            target_addr = symtab_lookup(st, inst->operands[0].data.label);
+        case OP_JL: {
+            const char *lname = strpool_get(strs, inst->operands[0].data.label_id);
+            int is_short = br_form[i] == I8051_BR_SHORT;
+            target_addr = symtab_lookup(st, lname);
             if (target_addr < 0) {
                 char msg[256];
-                snprintf(msg, sizeof(msg),
-                         "undefined label '%s'",
-                         inst->operands[0].data.label);
-                backend_error(inst, msg);
+                snprintf(msg, sizeof(msg), "undefined label '%s'", lname);
+                backend_error(diag, inst, msg);
             }
-            /* Relative from PC after the 2-byte JNZ instruction */
-            rel = target_addr - (buf->size + 2);
-            if (rel < -128 || rel > 127) {
-                backend_error(inst,
-                    "JNZ target out of range for 8-bit relative jump");
+            if (is_short &&
+                !i8051_short_reaches(inst, buf->size, target_addr)) {
+                backend_error(diag, inst,
+                    "internal: relaxed branch target out of reach");
             }
-            emit(buf, 0x70);
-            emit(buf, (uint8_t)(rel & 0xFF));
-            break;
-
-        /* ----------------------------------------------------------------
-         *  JL label  ->  JC rel   [0x40, rel8]                2 bytes
-         *  After CMP, Carry is set if Ra < Rb (unsigned).
-         * ---------------------------------------------------------------- */
-        case OP_JL:
-            target_addr = symtab_lookup(st, inst->operands[0].data.label);
-            if (target_addr < 0) {
-                char msg[256];
-                snprintf(msg, sizeof(msg),
-                         "undefined label '%s'",
-                         inst->operands[0].data.label);
-                backend_error(inst, msg);
+            switch (inst->opcode) {
+            case OP_JMP:
+                emit_jmp_form(buf, is_short, target_addr);
+                break;
+            case OP_CALL:
+                if (is_short)
+                    emit_abs11(buf, 0x11, (uint16_t)target_addr); /* ACALL */
+                else
+                    emit_lcall(buf, (uint16_t)target_addr);
+                break;
+            case OP_JZ:
+                emit_jcc_form(buf, 0x60, 0x70, is_short, target_addr);
+                break;
+            case OP_JNZ:
+                emit_jcc_form(buf, 0x70, 0x60, is_short, target_addr);
+                break;
+            default:   /* OP_JL: JC / JNC */
+                emit_jcc_form(buf, 0x40, 0x50, is_short, target_addr);
+                break;
             }
-            rel = target_addr - (buf->size + 2);
-            if (rel < -128 || rel > 127) {
-                backend_error(inst,
-                    "JL target out of range for 8-bit relative jump");
-            }
-            emit(buf, 0x40);  /* JC rel */
-            emit(buf, (uint8_t)(rel & 0xFF));
             break;
+        }
 
         /* ----------------------------------------------------------------
-         *  JG label  ->  polyfill (6 bytes)
-         *  After CMP, Ra > Rb means C==0 AND A!=0.
-         *    JC  $+4   [0x40, 0x04]  — skip if less
-         *    JZ  $+2   [0x60, 0x02]  — skip if equal
-         *    SJMP target [0x80, rel8] — take jump (greater)
+         *  JG label  ->  After CMP, Ra > Rb means C==0 AND A!=0.
+         *    JC  $+4     [0x40, 0x02]  — skip if less           4 bytes
+         *    JNZ target  [0x70, rel8]  — take jump (greater)
+         *  far:
+         *    JC  $+7     [0x40, 0x05]  — skip if less           7 bytes
+         *    JZ  $+5     [0x60, 0x03]  — skip if equal
+         *    LJMP target [0x02, hi, lo]
          * ---------------------------------------------------------------- */
-        case OP_JG:
-            target_addr = symtab_lookup(st, inst->operands[0].data.label);
+        case OP_JG: {
+            const char *lname = strpool_get(strs, inst->operands[0].data.label_id);
+            int is_short = br_form[i] == I8051_BR_SHORT;
+            target_addr = symtab_lookup(st, lname);
             if (target_addr < 0) {
                 char msg[256];
-                snprintf(msg, sizeof(msg),
-                         "undefined label '%s'",
-                         inst->operands[0].data.label);
-                backend_error(inst, msg);
+                snprintf(msg, sizeof(msg), "undefined label '%s'", lname);
+                backend_error(diag, inst, msg);
             }
-            /* JC $+4 (skip SJMP if carry set = less than) */
-            emit(buf, 0x40);       /* JC */
-            emit(buf, 0x04);       /* skip 4 bytes ahead to after SJMP */
-            /* JZ $+2 (skip SJMP if zero = equal) */
-            emit(buf, 0x60);       /* JZ */
-            emit(buf, 0x02);       /* skip 2 bytes ahead to after SJMP */
-            /* SJMP target (greater than) */
-            rel = target_addr - (buf->size + 2);
-            if (rel < -128 || rel > 127) {
-                backend_error(inst,
-                    "JG target out of range for 8-bit relative jump");
+            if (is_short &&
+                !i8051_short_reaches(inst, buf->size, target_addr)) {
+                backend_error(diag, inst,
+                    "internal: relaxed branch target out of reach");
             }
-            emit(buf, 0x80);       /* SJMP */
-            emit(buf, (uint8_t)(rel & 0xFF));
-            break;
-
-        /* ----------------------------------------------------------------
-         *  CALL label  ->  LCALL addr16   [0x12, hi, lo]      3 bytes
-         * ---------------------------------------------------------------- */
-        case OP_CALL:
-            target_addr = symtab_lookup(st, inst->operands[0].data.label);
-            if (target_addr < 0) {
-                char msg[256];
-                snprintf(msg, sizeof(msg),
-                         "undefined label '%s'",
-                         inst->operands[0].data.label);
-                backend_error(inst, msg);
+            if (is_short) {
+                emit(buf, 0x40);       /* JC over the JNZ */
+                emit(buf, 0x02);
+                emit_rel8_jump(buf, 0x70, target_addr);    /* JNZ */
+            } else {
+                emit(buf, 0x40);       /* JC over JZ + LJMP */
+                emit(buf, 0x05);
+                emit(buf, 0x60);       /* JZ over the LJMP */
+                emit(buf, 0x03);
+                emit_ljmp(buf, (uint16_t)target_addr);
             }
-            emit_lcall(buf, (uint16_t)target_addr);
             break;
+        }
 
         /* ----------------------------------------------------------------
          *  RET  ->  RET   [0x22]                              1 byte
@@ -1020,7 +1235,7 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
          * ---------------------------------------------------------------- */
         case OP_PUSH:
             rs = inst->operands[0].data.reg;
-            validate_register(inst, rs);
+            validate_register(diag, inst, rs);
             emit(buf, 0xC0);
             emit(buf, REG_DIRECT_ADDR[rs]);
             break;
@@ -1030,7 +1245,7 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
          * ---------------------------------------------------------------- */
         case OP_POP:
             rd = inst->operands[0].data.reg;
-            validate_register(inst, rd);
+            validate_register(diag, inst, rd);
             emit(buf, 0xD0);
             emit(buf, REG_DIRECT_ADDR[rd]);
             break;
@@ -1058,10 +1273,10 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
          * ---------------------------------------------------------------- */
         case OP_MUL:
             rd = inst->operands[0].data.reg;
-            validate_register(inst, rd);
+            validate_register(diag, inst, rd);
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 rs = inst->operands[1].data.reg;
-                validate_register(inst, rs);
+                validate_register(diag, inst, rs);
                 /* MOV A, Rs; MOV B, A (via MOV direct,A); MOV A, Rd;
                  * MUL AB; MOV Rd, A                        = 6 bytes */
                 emit_mov_a_rn(buf, rs);      /* MOV A, Rs     1 byte  */
@@ -1073,7 +1288,7 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
                 emit_mov_rn_a(buf, rd);      /* MOV Rd, A     1 byte  */
             } else {
                 imm = inst->operands[1].data.imm;
-                validate_imm8(inst, imm);
+                validate_imm8(diag, inst, imm);
                 emit(buf, 0x75);             /* MOV direct, #imm      */
                 emit(buf, 0xF0);             /* B register = 0xF0     */
                 emit(buf, (uint8_t)(imm & 0xFF));  /*            3 bytes */
@@ -1091,10 +1306,10 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
          * ---------------------------------------------------------------- */
         case OP_DIV:
             rd = inst->operands[0].data.reg;
-            validate_register(inst, rd);
+            validate_register(diag, inst, rd);
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 rs = inst->operands[1].data.reg;
-                validate_register(inst, rs);
+                validate_register(diag, inst, rs);
                 emit_mov_a_rn(buf, rs);      /* MOV A, Rs             */
                 emit(buf, 0xF5);             /* MOV direct, A         */
                 emit(buf, 0xF0);             /* -> B                  */
@@ -1103,7 +1318,7 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
                 emit_mov_rn_a(buf, rd);      /* MOV Rd, A             */
             } else {
                 imm = inst->operands[1].data.imm;
-                validate_imm8(inst, imm);
+                validate_imm8(diag, inst, imm);
                 emit(buf, 0x75);             /* MOV direct, #imm      */
                 emit(buf, 0xF0);             /* B register             */
                 emit(buf, (uint8_t)(imm & 0xFF));
@@ -1118,7 +1333,7 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
          * ---------------------------------------------------------------- */
         case OP_INC:
             rd = inst->operands[0].data.reg;
-            validate_register(inst, rd);
+            validate_register(diag, inst, rd);
             emit(buf, (uint8_t)(0x08 + rd));
             break;
 
@@ -1127,7 +1342,7 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
          * ---------------------------------------------------------------- */
         case OP_DEC:
             rd = inst->operands[0].data.reg;
-            validate_register(inst, rd);
+            validate_register(diag, inst, rd);
             emit(buf, (uint8_t)(0x18 + rd));
             break;
 
@@ -1149,15 +1364,15 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
          *  Otherwise: no bytes emitted.
          * ---------------------------------------------------------------- */
         case OP_VAR: {
-            const char *vname = inst->operands[0].data.label;
+            const char *vname = strpool_get(strs, inst->operands[0].data.label_id);
             int addr = symtab_lookup(st, vname);
             if (addr < 0) {
-                backend_error(inst, "internal: VAR address not found");
+                backend_error(diag, inst, "internal: VAR address not found");
             }
             if (inst->operand_count > 1 &&
                 inst->operands[1].type == OPERAND_IMMEDIATE) {
                 int64_t val = inst->operands[1].data.imm;
-                validate_imm8(inst, val);
+                validate_imm8(diag, inst, val);
                 /* MOV direct, #data : 0x75, direct, data */
                 emit(buf, 0x75);
                 emit(buf, (uint8_t)addr);
@@ -1178,9 +1393,7 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
          * ---------------------------------------------------------------- */
         case OP_ORG: {
             uint32_t target = (uint32_t)inst->operands[0].data.imm;
-            while (buf->size < (int)target) {
-                emit(buf, 0x00);
-            }
+            emit_fill(buf, 0x00, (int)target - buf->size);
             break;
         }
 
@@ -1189,23 +1402,23 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
          *  SET name, #imm  ->  MOV direct,#imm [0x75, addr, imm] 3 bytes
          * ---------------------------------------------------------------- */
         case OP_SET: {
-            const char *vname = inst->operands[0].data.label;
+            const char *vname = strpool_get(strs, inst->operands[0].data.label_id);
             int addr = symtab_lookup(st, vname);
             if (addr < 0) {
                 char msg[256];
                 snprintf(msg, sizeof(msg),
                          "undefined variable '%s'", vname);
-                backend_error(inst, msg);
+                backend_error(diag, inst, msg);
             }
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 rs = inst->operands[1].data.reg;
-                validate_register(inst, rs);
+                validate_register(diag, inst, rs);
                 /* MOV direct, Rn : 0x88+n, direct */
                 emit(buf, (uint8_t)(0x88 + rs));
                 emit(buf, (uint8_t)addr);
             } else {
                 imm = inst->operands[1].data.imm;
-                validate_imm8(inst, imm);
+                validate_imm8(diag, inst, imm);
                 /* MOV direct, #data : 0x75, direct, data */
                 emit(buf, 0x75);
                 emit(buf, (uint8_t)addr);
@@ -1220,14 +1433,14 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
          * ---------------------------------------------------------------- */
         case OP_GET: {
             rd = inst->operands[0].data.reg;
-            const char *vname = inst->operands[1].data.label;
-            validate_register(inst, rd);
+            const char *vname = strpool_get(strs, inst->operands[1].data.label_id);
+            validate_register(diag, inst, rd);
             int addr = symtab_lookup(st, vname);
             if (addr < 0) {
                 char msg[256];
                 snprintf(msg, sizeof(msg),
                          "undefined variable '%s'", vname);
-                backend_error(inst, msg);
+                backend_error(diag, inst, msg);
             }
             if (i8051_buftab_has(buftab, vname)) {
                 /* Load buffer ADDRESS as immediate */
@@ -1266,9 +1479,9 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
         case OP_LOADB:
             rd = inst->operands[0].data.reg;
             rs = inst->operands[1].data.reg;
-            validate_register(inst, rd);
+            validate_register(diag, inst, rd);
             if (rs != 0 && rs != 1) {
-                backend_error(inst,
+                backend_error(diag, inst,
                     "LOADB: indirect source must be R0 or R1 on 8051 "
                     "(MOV A, @Ri)");
             }
@@ -1284,9 +1497,9 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
         case OP_STOREB:
             rs = inst->operands[0].data.reg;
             rd = inst->operands[1].data.reg;
-            validate_register(inst, rs);
+            validate_register(diag, inst, rs);
             if (rd != 0 && rd != 1) {
-                backend_error(inst,
+                backend_error(diag, inst,
                     "STOREB: indirect destination must be R0 or R1 on 8051 "
                     "(MOV @Ri, A)");
             }
@@ -1298,7 +1511,7 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
          *  SYS  — not supported on baremetal 8051
          * ---------------------------------------------------------------- */
         case OP_SYS:
-            backend_error(inst,
+            backend_error(diag, inst,
                 "SYS is not supported on the 8051 (baremetal, no OS)");
             break;
 
@@ -1308,18 +1521,18 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
          * ---------------------------------------------------------------- */
         case OP_DJNZ:
             rd = inst->operands[0].data.reg;
-            validate_register(inst, rd);
-            target_addr = symtab_lookup(st, inst->operands[1].data.label);
+            validate_register(diag, inst, rd);
+            target_addr = symtab_lookup(st, strpool_get(strs, inst->operands[1].data.label_id));
             if (target_addr < 0) {
                 char msg[256];
                 snprintf(msg, sizeof(msg),
                          "undefined label '%s'",
-                         inst->operands[1].data.label);
-                backend_error(inst, msg);
+                         strpool_get(strs, inst->operands[1].data.label_id));
+                backend_error(diag, inst, msg);
             }
             rel = target_addr - (buf->size + 2);
             if (rel < -128 || rel > 127) {
-                backend_error(inst,
+                backend_error(diag, inst,
                     "DJNZ target out of range for 8-bit relative jump");
             }
             emit(buf, (uint8_t)(0xD8 + rd));
@@ -1333,19 +1546,19 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
         case OP_CJNE: {
             rd  = inst->operands[0].data.reg;
             imm = inst->operands[1].data.imm;
-            validate_register(inst, rd);
+            validate_register(diag, inst, rd);
             int cjne_size = (rd == 0) ? 3 : 4;
-            target_addr = symtab_lookup(st, inst->operands[2].data.label);
+            target_addr = symtab_lookup(st, strpool_get(strs, inst->operands[2].data.label_id));
             if (target_addr < 0) {
                 char msg[256];
                 snprintf(msg, sizeof(msg),
                          "undefined label '%s'",
-                         inst->operands[2].data.label);
-                backend_error(inst, msg);
+                         strpool_get(strs, inst->operands[2].data.label_id));
+                backend_error(diag, inst, msg);
             }
             rel = target_addr - (buf->size + cjne_size);
             if (rel < -128 || rel > 127) {
-                backend_error(inst,
+                backend_error(diag, inst,
                     "CJNE target out of range for 8-bit relative jump");
             }
             if (rd != 0) {
@@ -1388,7 +1601,7 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
             break;
 
         default:
-            backend_error(inst, "unsupported opcode for 8051 backend");
+            backend_error(diag, inst, "unsupported opcode for 8051 backend");
             break;
         }
     }
@@ -1399,56 +1612,96 @@ static void pass2_emit_code(const Instruction *ir, int ir_count,
 /* =========================================================================
  *  generate_8051()  —  main entry point
  * ========================================================================= */
-CodeBuffer* generate_8051(const Instruction *ir, int ir_count)
+CodeBuffer* generate_8051(const Instruction *ir, int ir_count,
+                          const StrPool *strs, UaDiag *diag)
 {
-    fprintf(stderr, "[8051] Pass 1: address resolution ...\n");
+    diag_log(diag, DIAG_VERBOSE, "[8051] Pass 1: address resolution ...\n");
+
+    /* --- Branch forms, then symbol table + variable table -------------- */
+    uint8_t *br_form = i8051_relax_branches(ir, ir_count, strs, diag);
+    if (!br_form) {
+        diag_printf(diag, "UA 8051: out of memory\n");
+        return NULL;
+    }
+    diag_own(diag, &br_form, diag_free_ptr);
+    int br_total = 0, br_short = 0, br_saved = 0;
+    for (int i = 0; i < ir_count; i++) {
+        if (!i8051_is_relaxable(&ir[i])) continue;
+        br_total++;
+        if (br_form[i] != I8051_BR_SHORT) continue;
+        br_short++;
+        br_saved += instruction_size_8051(&ir[i], 0, diag)
+                  - instruction_size_8051(&ir[i], 1, diag);
+    }
 
-    /* --- Pass 1: symbol table + variable table ------------------------- */
     SymbolTable    symtab;
     I8051VarTable  vtab;
     I8051BufTable  buftab;
-    int total_size = pass1_build_symbols(ir, ir_count, &symtab, &vtab, &buftab);
-
-    fprintf(stderr, "[8051] Symbol table (%d entries):\n", symtab.count);
-    for (int i = 0; i < symtab.count; i++) {
-        fprintf(stderr, "  %-20s = 0x%04X (%d)\n",
-                symtab.entries[i].name,
-                symtab.entries[i].address,
-                symtab.entries[i].address);
-    }
-    if (vtab.count > 0) {
-        fprintf(stderr, "[8051] Variables (%d, direct RAM 0x%02X-0x%02X):\n",
-                vtab.count, I8051_VAR_BASE,
-                I8051_VAR_BASE + vtab.count - 1);
-        for (int v = 0; v < vtab.count; v++) {
-            fprintf(stderr, "  %-20s @ 0x%02X", vtab.vars[v].name,
-                    vtab.vars[v].address);
-            if (vtab.vars[v].has_init)
-                fprintf(stderr, " = %d", (int)vtab.vars[v].init_value);
-            fprintf(stderr, "\n");
+    int total_size = pass1_build_symbols(ir, ir_count, strs, br_form,
+                                         &symtab, &vtab, &buftab, diag);
+
+    if (diag_enabled(diag, DIAG_VERBOSE)) {
+        diag_printf(diag, "[8051] Symbol table (%d entries):\n", symtab.count);
+        for (int i = 0; i < symtab.count; i++) {
+            diag_printf(diag, "  %-20s = 0x%04X (%d)\n",
+                        symtab.entries[i].name,
+                        symtab.entries[i].address,
+                        symtab.entries[i].address);
+        }
+        if (vtab.count > 0) {
+            diag_printf(diag, "[8051] Variables (%d, direct RAM "
+                        "0x%02X-0x%02X):\n", vtab.count, I8051_VAR_BASE,
+                        I8051_VAR_BASE + vtab.count - 1);
+            for (int v = 0; v < vtab.count; v++) {
+                diag_printf(diag, "  %-20s @ 0x%02X", vtab.vars[v].name,
+                            vtab.vars[v].address);
+                if (vtab.vars[v].has_init)
+                    diag_printf(diag, " = %d", (int)vtab.vars[v].init_value);
+                diag_printf(diag, "\n");
+            }
         }
     }
-    fprintf(stderr, "[8051] Estimated code size: %d bytes\n", total_size);
+    diag_log(diag, DIAG_VERBOSE, "[8051] Estimated code size: %d bytes\n",
+             total_size);
 
     /* --- Pass 2: code emission ----------------------------------------- */
-    fprintf(stderr, "[8051] Pass 2: code emission ...\n");
+    diag_log(diag, DIAG_VERBOSE, "[8051] Pass 2: code emission ...\n");
 
-    CodeBuffer *code = create_code_buffer();
+    CodeBuffer *code = create_code_buffer(diag);
     if (!code) {
-        fprintf(stderr, "UA 8051: out of memory\n");
+        diag_printf(diag, "UA 8051: out of memory\n");
+        symtab_free(&symtab);
+        free(br_form);
         return NULL;
     }
+    diag_own(diag, &code, codebuf_drop);
+    codebuf_reserve(code, total_size);
+
+    pass2_emit_code(ir, ir_count, strs, br_form, &symtab, &buftab, code,
+                    diag);
 
-    pass2_emit_code(ir, ir_count, &symtab, &buftab, code);
+    diag_log(diag, DIAG_NORMAL, "[8051] Emitted %d bytes (expected %d)\n",
+             code->size, total_size);
+    if (br_total > 0)
+        diag_log(diag, DIAG_NORMAL, "[8051] Short branches: %d of %d "
+                 "(%d bytes saved)\n", br_short, br_total, br_saved);
 
-    fprintf(stderr, "[8051] Emitted %d bytes (expected %d)\n",
-            code->size, total_size);
+    /* Export code labels (simulator entry points and profile) */
+    for (int i = 0; i < ir_count; i++) {
+        if (!ir[i].is_label) continue;
+        const char *lname = strpool_get(strs, ir[i].label_id);
+        if (symtab_lookup(&code->labels, lname) < 0)
+            symtab_add(&code->labels, lname, symtab_lookup(&symtab, lname));
+    }
+    symtab_free(&symtab);
+    free(br_form);
+    br_form = NULL;
 
     /* Sanity check */
     if (code->size != total_size) {
-        fprintf(stderr, "UA 8051: WARNING — size mismatch! "
-                "Emitted %d bytes but Pass 1 estimated %d.\n",
-                code->size, total_size);
+        diag_printf(diag, "UA 8051: WARNING — size mismatch! "
+                    "Emitted %d bytes but Pass 1 estimated %d.\n",
+                    code->size, total_size);
     }
 
     return code;
@@ -28,24 +28,9 @@
 #define UA_BACKEND_8051_H
 
 #include "parser.h"
-#include "codegen.h"    /* CodeBuffer, free_code_buffer, hexdump */
+#include "codegen.h"    /* CodeBuffer, SymbolTable, hexdump */
 #include <stdint.h>
 
-/* =========================================================================
- *  Symbol Table Entry
- * ========================================================================= */
-#define MAX_SYMBOLS  256
-
-typedef struct {
-    char    name[UA_MAX_LABEL_LEN];   /* Label name                     */
-    int     address;                   /* Byte offset from start of code */
-} Symbol;
-
-typedef struct {
-    Symbol  entries[MAX_SYMBOLS];
-    int     count;
-} SymbolTable;
-
 /* =========================================================================
  *  Public API
  * ========================================================================= */
@@ -53,10 +38,12 @@ typedef struct {
 /*
  * generate_8051()
  *   Two-pass assembler: builds symbol table, emits 8051 machine code,
- *   and returns the code buffer.
+ *   and returns the code buffer.  `strs` is the string pool filled by
+ *   parse() for this IR; messages go to `diag`.
  *
  *   The caller must free the result with free_code_buffer().
  */
-CodeBuffer* generate_8051(const Instruction *ir, int ir_count);
+CodeBuffer* generate_8051(const Instruction *ir, int ir_count,
+                          const StrPool *strs, UaDiag *diag);
 
 #endif /* UA_BACKEND_8051_H */
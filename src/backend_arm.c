@@ -22,6 +22,7 @@
  *  │    ORR=0xC  MOV=0xD  BIC=0xE  MVN=0xF                             │
  *  │                                                                    │
  *  │  LDR Rd, [Rn]:       cond 01 I P U B W L Rn Rd offset12           │
+ *  │  LDR Rd, [PC, #off]: cond 0101 1001 1111 Rd offset12 (literal)    │
  *  │  STR Rd, [Rn]:       cond 01 I P U B W L Rn Rd offset12           │
  *  │                                                                    │
  *  │  Branch:              cond 101 L offset24 (signed, <<2, PC-rel)    │
@@ -84,18 +85,19 @@ static const char* ARM_REG_NAME[ARM_MAX_REG] = {
 /* =========================================================================
  *  Error helpers
  * ========================================================================= */
-static void arm_error(const Instruction *inst, const char *msg)
+static void arm_error(UaDiag *diag, const Instruction *inst,
+                      const char *msg)
 {
-    fprintf(stderr,
-            "\n"
-            "  UA ARM Backend Error\n"
-            "  ---------------------\n"
-            "  Line %d, Column %d: %s\n\n",
-            inst->line, inst->column, msg);
-    exit(1);
+    diag_printf(diag,
+                "\n"
+                "  UA ARM Backend Error\n"
+                "  ---------------------\n"
+                "  %s, Line %d, Column %d: %s\n\n",
+                inst->file, inst->line, inst->column, msg);
+    diag_fatal(diag);
 }
 
-static void arm_validate_register(const Instruction *inst, int reg)
+static void arm_validate_register(UaDiag *diag, const Instruction *inst, int reg)
 {
     if (reg < 0 || reg >= ARM_MAX_REG) {
         char msg[256];
@@ -103,7 +105,7 @@ static void arm_validate_register(const Instruction *inst, int reg)
                  "register R%d is not mapped in the ARM backend "
                  "(supports R0-R7: r0-r7)",
                  reg);
-        arm_error(inst, msg);
+        arm_error(diag, inst, msg);
     }
 }
 
@@ -112,10 +114,7 @@ static void arm_validate_register(const Instruction *inst, int reg)
  * ========================================================================= */
 static void emit_arm32(CodeBuffer *buf, uint32_t word)
 {
-    emit_byte(buf, (uint8_t)( word        & 0xFF));
-    emit_byte(buf, (uint8_t)((word >>  8) & 0xFF));
-    emit_byte(buf, (uint8_t)((word >> 16) & 0xFF));
-    emit_byte(buf, (uint8_t)((word >> 24) & 0xFF));
+    emit_le32(buf, word);
 }
 
 /* =========================================================================
@@ -206,10 +205,17 @@ static uint32_t arm_dp_reg_shift_reg(uint8_t cond, uint8_t opcode, uint8_t s,
 #define ARM_DP_SUB  0x2
 #define ARM_DP_ADD  0x4
 #define ARM_DP_CMP  0xA
+#define ARM_DP_CMN  0xB
 #define ARM_DP_ORR  0xC
 #define ARM_DP_MOV  0xD
+#define ARM_DP_BIC  0xE
 #define ARM_DP_MVN  0xF
 
+static const char* ARM_DP_NAME[16] = {
+    "AND", "EOR", "SUB", "RSB", "ADD", "ADC", "SBC", "RSC",
+    "TST", "TEQ", "CMP", "CMN", "ORR", "MOV", "BIC", "MVN"
+};
+
 /* =========================================================================
  *  High-level emit functions
  * ========================================================================= */
@@ -250,17 +256,6 @@ static void emit_arm_movt(CodeBuffer *buf, uint8_t rd, uint16_t imm16)
     emit_arm32(buf, word);
 }
 
-/* --- Load a full 32-bit immediate into Rd ------------------------------ */
-/*     Uses MOVW for low 16 bits, MOVT for high 16 bits if needed.        */
-static void emit_arm_load_imm32(CodeBuffer *buf, uint8_t rd, int32_t imm)
-{
-    uint32_t val = (uint32_t)imm;
-    emit_arm_movw(buf, rd, (uint16_t)(val & 0xFFFF));
-    if ((val >> 16) != 0) {
-        emit_arm_movt(buf, rd, (uint16_t)((val >> 16) & 0xFFFF));
-    }
-}
-
 /* Always emit both MOVW + MOVT (8 bytes) — used for variable addresses
  * where a fixed instruction size is needed for pass-1 sizing. */
 static void emit_arm_load_imm32_full(CodeBuffer *buf, uint8_t rd, int32_t imm)
@@ -331,14 +326,6 @@ static void emit_arm_cmp_reg(CodeBuffer *buf, uint8_t rn, uint8_t rm)
     emit_arm32(buf, arm_dp_reg(ARM_COND_AL, ARM_DP_CMP, 1, rn, 0, rm));
 }
 
-/* --- CMP Rn, #imm8  (sets flags, S=1, Rd=0) --------------------------- */
-static void emit_arm_cmp_imm(CodeBuffer *buf, uint8_t rn,
-                              uint8_t rotate, uint8_t imm8)
-{
-    emit_arm32(buf, arm_dp_imm(ARM_COND_AL, ARM_DP_CMP, 1, rn, 0,
-                                rotate, imm8));
-}
-
 /* --- LSL Rd, Rm, #shift_imm (MOV with barrel shift) -------------------- */
 static void emit_arm_lsl_imm(CodeBuffer *buf, uint8_t rd, uint8_t rm,
                               uint8_t shift_imm)
@@ -502,10 +489,7 @@ static void emit_arm_svc(CodeBuffer *buf, uint32_t imm24)
 /* --- Branch placeholder (4 bytes, will be patched) --------------------- */
 static void emit_arm_branch_placeholder(CodeBuffer *buf)
 {
-    emit_byte(buf, 0x00);
-    emit_byte(buf, 0x00);
-    emit_byte(buf, 0x00);
-    emit_byte(buf, 0x00);
+    emit_le32(buf, 0);
 }
 
 static void patch_arm_branch(CodeBuffer *buf, int offset, uint32_t word)
@@ -517,73 +501,27 @@ static void patch_arm_branch(CodeBuffer *buf, int offset, uint32_t word)
 }
 
 /* =========================================================================
- *  Symbol table for labels
+ *  Branch / data fixups  (labels live in the shared SymbolTable)
  * ========================================================================= */
-#define ARM_MAX_SYMBOLS  256
-#define ARM_MAX_FIXUPS   256
-
 typedef struct {
-    char name[UA_MAX_LABEL_LEN];
-    int  address;
-} ARMSymbol;
-
-typedef struct {
-    char  label[UA_MAX_LABEL_LEN];
+    const char *label;      /* interned in the SymbolTable               */
     int   patch_offset;     /* offset into CodeBuffer where the instr lives */
     int   instr_addr;       /* byte address of the branch instruction       */
-    int   line;
+    const Instruction *inst; /* file and line for error messages */
     int   is_link;          /* 1 = BL (CALL), 0 = B (JMP) */
     int   cond;             /* condition code for branch */
 } ARMFixup;
 
-typedef struct {
-    ARMSymbol symbols[ARM_MAX_SYMBOLS];
-    int       sym_count;
-    ARMFixup  fixups[ARM_MAX_FIXUPS];
-    int       fix_count;
-} ARMSymTab;
-
-static void arm_symtab_init(ARMSymTab *st)
+static void arm_add_fixup(SymbolTable *st, FixupVec *fixups,
+                          const char *label, int patch_offset,
+                          int instr_addr, const Instruction *inst,
+                          int is_link, int cond)
 {
-    st->sym_count = 0;
-    st->fix_count = 0;
-}
-
-static void arm_symtab_add(ARMSymTab *st, const char *name, int address)
-{
-    if (st->sym_count >= ARM_MAX_SYMBOLS) {
-        fprintf(stderr, "ARM: symbol table overflow\n");
-        exit(1);
-    }
-    strncpy(st->symbols[st->sym_count].name, name, UA_MAX_LABEL_LEN - 1);
-    st->symbols[st->sym_count].name[UA_MAX_LABEL_LEN - 1] = '\0';
-    st->symbols[st->sym_count].address = address;
-    st->sym_count++;
-}
-
-static int arm_symtab_lookup(const ARMSymTab *st, const char *name)
-{
-    for (int i = 0; i < st->sym_count; i++) {
-        if (strcmp(st->symbols[i].name, name) == 0)
-            return st->symbols[i].address;
-    }
-    return -1;
-}
-
-static void arm_add_fixup(ARMSymTab *st, const char *label,
-                           int patch_offset, int instr_addr, int line,
-                           int is_link, int cond)
-{
-    if (st->fix_count >= ARM_MAX_FIXUPS) {
-        fprintf(stderr, "ARM: fixup table overflow\n");
-        exit(1);
-    }
-    ARMFixup *f = &st->fixups[st->fix_count++];
-    strncpy(f->label, label, UA_MAX_LABEL_LEN - 1);
-    f->label[UA_MAX_LABEL_LEN - 1] = '\0';
+    ARMFixup *f = (ARMFixup *)fixvec_push(fixups);
+    f->label        = symtab_intern(st, label);
     f->patch_offset = patch_offset;
     f->instr_addr   = instr_addr;
-    f->line         = line;
+    f->inst         = inst;
     f->is_link      = is_link;
     f->cond         = cond;
 }
@@ -592,13 +530,13 @@ static void arm_add_fixup(ARMSymTab *st, const char *label,
  *  Try to encode a 32-bit immediate as ARM rotated imm8
  *
  *  ARM data-processing immediates use an 8-bit value rotated right by
- *  an even number (0, 2, 4, ..., 30).  Returns 1 if encodable,
- *  fills *rotate and *imm8.
+ *  an even number (0, 2, 4, ..., 30), so imm8 is val rotated LEFT by
+ *  the same amount.  Returns 1 if encodable, fills *rotate and *imm8.
  * ========================================================================= */
 static int arm_encode_imm(uint32_t val, uint8_t *rotate, uint8_t *imm8)
 {
     for (int rot = 0; rot < 16; rot++) {
-        uint32_t rotated = (val >> (rot * 2)) | (val << (32 - rot * 2));
+        uint32_t rotated = (val << (rot * 2)) | (val >> (32 - rot * 2));
         if (rot * 2 == 0) rotated = val;
         if ((rotated & 0xFF) == rotated) {
             *rotate = (uint8_t)rot;
@@ -609,120 +547,244 @@ static int arm_encode_imm(uint32_t val, uint8_t *rotate, uint8_t *imm8)
     return 0;
 }
 
+/* =========================================================================
+ *  Immediate selection
+ *
+ *  A constant takes one instruction when it fits the rotated imm8 itself
+ *  or after the complement / negation that the paired opcode undoes, or
+ *  when it fits MOVW:
+ *    LDI      MOV #v   | MVN #~v  | MOVW #v  | LDR from the literal pool
+ *    ADD/SUB  ADD #v  <-> SUB #-v
+ *    AND      AND #v   | BIC #~v
+ *    CMP      CMP #v   | CMN #-v
+ *    OR/XOR   ORR #v / EOR #v
+ *  Any other ALU constant is loaded into r12 by the LDI rules first.
+ * ========================================================================= */
+
+/* One-instruction data-processing form of `op Rd, #val`; returns 0 if none */
+static int arm_alu_imm(Opcode op, uint32_t val, uint8_t *dp,
+                       uint8_t *rot, uint8_t *imm8)
+{
+    uint8_t r, i;
+    switch (op) {
+        case OP_ADD:
+            if (arm_encode_imm(val, &r, &i))      { *dp = ARM_DP_ADD; break; }
+            if (arm_encode_imm(0u - val, &r, &i)) { *dp = ARM_DP_SUB; break; }
+            return 0;
+        case OP_SUB:
+            if (arm_encode_imm(val, &r, &i))      { *dp = ARM_DP_SUB; break; }
+            if (arm_encode_imm(0u - val, &r, &i)) { *dp = ARM_DP_ADD; break; }
+            return 0;
+        case OP_AND:
+            if (arm_encode_imm(val, &r, &i))      { *dp = ARM_DP_AND; break; }
+            if (arm_encode_imm(~val, &r, &i))     { *dp = ARM_DP_BIC; break; }
+            return 0;
+        case OP_CMP:
+            if (arm_encode_imm(val, &r, &i))      { *dp = ARM_DP_CMP; break; }
+            if (arm_encode_imm(0u - val, &r, &i)) { *dp = ARM_DP_CMN; break; }
+            return 0;
+        case OP_OR:
+            if (arm_encode_imm(val, &r, &i))      { *dp = ARM_DP_ORR; break; }
+            return 0;
+        case OP_XOR:
+            if (arm_encode_imm(val, &r, &i))      { *dp = ARM_DP_EOR; break; }
+            return 0;
+        default:
+            return 0;
+    }
+    *rot  = r;
+    *imm8 = i;
+    return 1;
+}
+
+/* MOV / MVN / MOVW: a constant that needs no pool entry */
+static int arm_const_single(uint32_t val)
+{
+    uint8_t r, i;
+    return arm_encode_imm(val, &r, &i) || arm_encode_imm(~val, &r, &i)
+        || val <= 0xFFFF;
+}
+
+/* Mnemonic that loads `val`, for the trace */
+static const char* arm_const_form(uint32_t val)
+{
+    uint8_t r, i;
+    if (arm_encode_imm(val, &r, &i))  return "MOV";
+    if (arm_encode_imm(~val, &r, &i)) return "MVN";
+    if (val <= 0xFFFF)                return "MOVW";
+    return "LDR =";
+}
+
+/* =========================================================================
+ *  Literal pool
+ *
+ *  A constant that would need MOVW + MOVT is loaded by one
+ *  LDR Rd, [PC, #off] from a pool of words kept in the code.  Entries
+ *  (one per distinct value) collect until the next JMP, RET or HLT and
+ *  are dumped right after it, where no code falls into them.  When the
+ *  oldest LDR would no longer reach its word, the pool is dumped early
+ *  behind a B over it.  Pass 1 makes the same calls without a CodeBuffer,
+ *  so both passes place every pool at the same address.
+ * ========================================================================= */
+#define ARM_POOL_MAX   1024    /* LDRs within reach: 4 KB of code      */
+#define ARM_LDR_RANGE  4095    /* LDR (literal) offset past PC+8       */
+
+typedef struct {
+    uint32_t vals[ARM_POOL_MAX];     /* pending words, each value once    */
+    int      count;
+    int      ref_off[ARM_POOL_MAX];  /* LDRs to patch: address ...        */
+    int      ref_idx[ARM_POOL_MAX];  /* ... word ...                      */
+    uint8_t  ref_rd[ARM_POOL_MAX];   /* ... and destination register      */
+    int      refs;
+    int      words;                  /* words dumped so far               */
+} ARMPool;
+
+static void arm_pool_init(ARMPool *p)
+{
+    p->count = 0;
+    p->refs  = 0;
+    p->words = 0;
+}
+
+/* Would an instruction of `size` bytes at `pc` (plus one more word) push
+ * the oldest pending word out of reach if the pool were dumped after it? */
+static int arm_pool_due(const ARMPool *p, int pc, int size)
+{
+    if (p->refs == 0) return 0;
+    if (p->refs >= ARM_POOL_MAX) return 1;
+    int last_word = pc + size + 4 + 4 * p->count;     /* behind a B */
+    return last_word - (p->ref_off[0] + 8) > ARM_LDR_RANGE;
+}
+
+/* LDR Rd, =val at `pc` (emitted as a placeholder when `code` is set) */
+static void arm_pool_ref(ARMPool *p, CodeBuffer *code, int pc,
+                         uint8_t rd, uint32_t val)
+{
+    int idx = 0;
+    while (idx < p->count && p->vals[idx] != val) idx++;
+    if (idx == p->count) p->vals[p->count++] = val;
+    p->ref_off[p->refs] = pc;
+    p->ref_idx[p->refs] = idx;
+    p->ref_rd[p->refs]  = rd;
+    p->refs++;
+    if (code) emit_le32(code, 0);
+}
+
+/* Dump the pending words, behind a B over them if `branch`;
+ * returns the bytes added */
+static int arm_pool_dump(ARMPool *p, CodeBuffer *code, int branch)
+{
+    if (p->count == 0) return 0;
+    int size = (branch ? 4 : 0) + 4 * p->count;
+    if (code) {
+        if (branch)     /* B pc + 4 + 4 * count */
+            emit_arm32(code, 0xEA000000u
+                           | ((uint32_t)(p->count - 1) & 0x00FFFFFF));
+        int base = code->size;
+        for (int w = 0; w < p->count; w++)
+            emit_le32(code, p->vals[w]);
+        for (int r = 0; r < p->refs; r++) {
+            uint32_t off = (uint32_t)(base + 4 * p->ref_idx[r]
+                                      - (p->ref_off[r] + 8));
+            patch_arm_branch(code, p->ref_off[r],
+                             0xE59F0000u    /* LDR Rd, [PC, #off] */
+                             | ((uint32_t)p->ref_rd[r] << 12) | off);
+        }
+    }
+    p->words += p->count;
+    p->count  = 0;
+    p->refs   = 0;
+    return size;
+}
+
+/* Constant that `inst` takes from the literal pool, if any */
+static int arm_inst_literal(const Instruction *inst, uint32_t *val)
+{
+    uint8_t dp, rot, imm8;
+    if (inst->operand_count < 2 ||
+        inst->operands[1].type != OPERAND_IMMEDIATE)
+        return 0;
+    uint32_t v = (uint32_t)(int32_t)inst->operands[1].data.imm;
+    switch (inst->opcode) {
+        case OP_ADD: case OP_SUB: case OP_AND:
+        case OP_OR:  case OP_XOR: case OP_CMP:
+            if (arm_alu_imm(inst->opcode, v, &dp, &rot, &imm8)) return 0;
+            /* fall through */
+        case OP_LDI: case OP_MUL: case OP_DIV: case OP_SET:
+            *val = v;
+            return !arm_const_single(v);
+        default:
+            return 0;
+    }
+}
+
+/* JMP, RET and HLT never fall through: a pool can follow them */
+static int arm_ends_flow(const Instruction *inst)
+{
+    return inst->opcode == OP_JMP || inst->opcode == OP_RET
+        || inst->opcode == OP_HLT;
+}
+
+/* Rd = val:  MOV | MVN | MOVW | LDR from the pool ------------- 4 bytes */
+static void arm_load_const(CodeBuffer *code, ARMPool *pool, uint8_t rd,
+                           uint32_t val)
+{
+    uint8_t rot, imm8;
+    if (arm_encode_imm(val, &rot, &imm8))
+        emit_arm32(code, arm_dp_imm(ARM_COND_AL, ARM_DP_MOV, 0, 0, rd,
+                                    rot, imm8));
+    else if (arm_encode_imm(~val, &rot, &imm8))
+        emit_arm32(code, arm_dp_imm(ARM_COND_AL, ARM_DP_MVN, 0, 0, rd,
+                                    rot, imm8));
+    else if (val <= 0xFFFF)
+        emit_arm_movw(code, rd, (uint16_t)val);
+    else
+        arm_pool_ref(pool, code, code->size, rd, val);
+}
+
 /* =========================================================================
  *  instruction_size_arm()  —  compute byte size of each instruction
  *
- *  Most ARM instructions are 4 bytes.
- *  LDI with large immediates needs 8 bytes (MOVW + MOVT).
- *  ALU with immediate operand: if fits in rotated imm8 -> 4 bytes,
- *    otherwise load imm into scratch (4-8 bytes) + ALU reg (4 bytes).
+ *  Every ARM instruction is 4 bytes and so is every constant load
+ *  (see "Immediate selection"): an ALU immediate with no one-instruction
+ *  form costs the load into r12 plus the register form.  Literal pool
+ *  words are counted where the pool is dumped, not here.
  * ========================================================================= */
 static int instruction_size_arm(const Instruction *inst)
 {
     if (inst->is_label) return 0;
 
+    uint8_t dp, rot, imm8;
+    int imm_op = inst->operand_count >= 2 &&
+                 inst->operands[1].type == OPERAND_IMMEDIATE;
+
     switch (inst->opcode) {
-        case OP_LDI: {
-            int32_t imm = (int32_t)inst->operands[1].data.imm;
-            uint32_t val = (uint32_t)imm;
-            /* If fits in MOVW only (upper 16 bits zero), it's 4 bytes
-             * Otherwise MOVW + MOVT = 8 bytes */
-            if ((val >> 16) == 0) return 4;
-            return 8;
-        }
+        case OP_LDI:    return 4;   /* MOV / MVN / MOVW / LDR =imm */
         case OP_MOV:    return 4;
         case OP_LOAD:   return 4;
         case OP_STORE:  return 4;
         case OP_ADD:
-            if (inst->operands[1].type == OPERAND_REGISTER)
-                return 4;
-            else {
-                uint8_t rot, imm8;
-                if (arm_encode_imm((uint32_t)(int32_t)inst->operands[1].data.imm,
-                                   &rot, &imm8))
-                    return 4;   /* fits in ARM immediate */
-                /* Need to load into scratch then add */
-                uint32_t val = (uint32_t)(int32_t)inst->operands[1].data.imm;
-                return ((val >> 16) == 0 ? 4 : 8) + 4;
-            }
         case OP_SUB:
-            if (inst->operands[1].type == OPERAND_REGISTER)
-                return 4;
-            else {
-                uint8_t rot, imm8;
-                if (arm_encode_imm((uint32_t)(int32_t)inst->operands[1].data.imm,
-                                   &rot, &imm8))
-                    return 4;
-                uint32_t val = (uint32_t)(int32_t)inst->operands[1].data.imm;
-                return ((val >> 16) == 0 ? 4 : 8) + 4;
-            }
         case OP_AND:
-            if (inst->operands[1].type == OPERAND_REGISTER)
-                return 4;
-            else {
-                uint8_t rot, imm8;
-                if (arm_encode_imm((uint32_t)(int32_t)inst->operands[1].data.imm,
-                                   &rot, &imm8))
-                    return 4;
-                uint32_t val = (uint32_t)(int32_t)inst->operands[1].data.imm;
-                return ((val >> 16) == 0 ? 4 : 8) + 4;
-            }
         case OP_OR:
-            if (inst->operands[1].type == OPERAND_REGISTER)
-                return 4;
-            else {
-                uint8_t rot, imm8;
-                if (arm_encode_imm((uint32_t)(int32_t)inst->operands[1].data.imm,
-                                   &rot, &imm8))
-                    return 4;
-                uint32_t val = (uint32_t)(int32_t)inst->operands[1].data.imm;
-                return ((val >> 16) == 0 ? 4 : 8) + 4;
-            }
         case OP_XOR:
-            if (inst->operands[1].type == OPERAND_REGISTER)
+        case OP_CMP:
+            if (!imm_op) return 4;
+            if (arm_alu_imm(inst->opcode,
+                            (uint32_t)(int32_t)inst->operands[1].data.imm,
+                            &dp, &rot, &imm8))
                 return 4;
-            else {
-                uint8_t rot, imm8;
-                if (arm_encode_imm((uint32_t)(int32_t)inst->operands[1].data.imm,
-                                   &rot, &imm8))
-                    return 4;
-                uint32_t val = (uint32_t)(int32_t)inst->operands[1].data.imm;
-                return ((val >> 16) == 0 ? 4 : 8) + 4;
-            }
+            return 8;               /* r12 = imm; op Rd, Rd, r12 */
         case OP_NOT:    return 4;
         case OP_INC:    return 4;
         case OP_DEC:    return 4;
         case OP_MUL:
-            if (inst->operands[1].type == OPERAND_REGISTER)
-                return 4;
-            else {
-                /* Load imm into scratch + MUL */
-                uint32_t val = (uint32_t)(int32_t)inst->operands[1].data.imm;
-                return ((val >> 16) == 0 ? 4 : 8) + 4;
-            }
         case OP_DIV:
-            if (inst->operands[1].type == OPERAND_REGISTER)
-                return 4;
-            else {
-                uint32_t val = (uint32_t)(int32_t)inst->operands[1].data.imm;
-                return ((val >> 16) == 0 ? 4 : 8) + 4;
-            }
+            return imm_op ? 8 : 4;  /* [r12 = imm;] MUL / SDIV */
         case OP_SHL:
             return 4;   /* Both imm and reg forms are 4 bytes */
         case OP_SHR:
             return 4;
-        case OP_CMP:
-            if (inst->operands[1].type == OPERAND_REGISTER)
-                return 4;
-            else {
-                uint8_t rot, imm8;
-                if (arm_encode_imm((uint32_t)(int32_t)inst->operands[1].data.imm,
-                                   &rot, &imm8))
-                    return 4;
-                /* Load into scratch + CMP reg */
-                uint32_t val = (uint32_t)(int32_t)inst->operands[1].data.imm;
-                return ((val >> 16) == 0 ? 4 : 8) + 4;
-            }
         case OP_JMP:    return 4;   /* B rel24 */
         case OP_JZ:     return 4;   /* BEQ rel24 */
         case OP_JNZ:    return 4;   /* BNE rel24 */
@@ -742,9 +804,9 @@ static int instruction_size_arm(const Instruction *inst)
         case OP_SET:
             /* SET name, Rs  -> MOVW+MOVT r12,addr + STR Rs,[r12] (12) */
             if (inst->operands[1].type == OPERAND_REGISTER) return 12;
-            /* SET name, imm -> MOVW+MOVT r11,imm + MOVW+MOVT r12,addr
-             *                + STR r11,[r12]  (20) */
-            return 20;
+            /* SET name, imm -> r11 = imm + MOVW+MOVT r12,addr
+             *                + STR r11,[r12]  (16) */
+            return 16;
         case OP_GET:
             /* GET Rd, name  -> MOVW+MOVT r12,addr + LDR Rd,[r12]  (12) */
             return 12;
@@ -766,22 +828,6 @@ static int instruction_size_arm(const Instruction *inst)
     }
 }
 
-/* =========================================================================
- *  Helper: emit ALU with immediate that may not fit in ARM imm8
- *
- *  If the immediate fits in the ARM rotated-imm8 encoding, emit a single
- *  data-processing-immediate instruction.  Otherwise, load it into a
- *  scratch register (IP=r12) and use the register form.
- * ========================================================================= */
-
-/* Choose a scratch register that doesn't conflict with rd */
-static uint8_t arm_scratch_reg(uint8_t rd)
-{
-    /* Use r12 (IP) as scratch — it's the intra-procedure-call scratch reg */
-    (void)rd;
-    return 12;
-}
-
 /* =========================================================================
  *  Variable table for ARM
  * ========================================================================= */
@@ -824,12 +870,13 @@ static void arm_strtab_init(ARMStringTable *st) {
     st->total_size = 0;
 }
 
-static int arm_strtab_add(ARMStringTable *st, const char *text) {
+static int arm_strtab_add(ARMStringTable *st, const char *text,
+                          UaDiag *diag) {
     for (int i = 0; i < st->count; i++)
         if (strcmp(st->strings[i].text, text) == 0) return i;
     if (st->count >= ARM_MAX_STRINGS) {
-        fprintf(stderr, "ARM: string table overflow (max %d)\n",
-                ARM_MAX_STRINGS);
+        diag_printf(diag, "ARM: string table overflow (max %d)\n",
+                    ARM_MAX_STRINGS);
         return 0;
     }
     int idx = st->count++;
@@ -863,14 +910,15 @@ static void arm_buftab_init(ARMBufTable *bt) {
     bt->total_size = 0;
 }
 
-static int arm_buftab_add(ARMBufTable *bt, const char *name, int size) {
+static int arm_buftab_add(ARMBufTable *bt, const char *name, int size,
+                          UaDiag *diag) {
     for (int i = 0; i < bt->count; i++)
         if (strcmp(bt->bufs[i].name, name) == 0) {
-            fprintf(stderr, "ARM: duplicate buffer '%s'\n", name);
+            diag_printf(diag, "ARM: duplicate buffer '%s'\n", name);
             return -1;
         }
     if (bt->count >= ARM_MAX_BUFFERS) {
-        fprintf(stderr, "ARM: buffer table overflow\n");
+        diag_printf(diag, "ARM: buffer table overflow\n");
         return -1;
     }
     ARMBufEntry *b = &bt->bufs[bt->count++];
@@ -889,17 +937,18 @@ static int arm_buftab_has(const ARMBufTable *bt, const char *name) {
 }
 
 static int arm_vartab_add(ARMVarTable *vt, const char *name,
-                          int32_t init_value, int has_init)
+                          int32_t init_value, int has_init,
+                          UaDiag *diag)
 {
     for (int i = 0; i < vt->count; i++) {
         if (strcmp(vt->vars[i].name, name) == 0) {
-            fprintf(stderr, "ARM: duplicate variable '%s'\n", name);
+            diag_printf(diag, "ARM: duplicate variable '%s'\n", name);
             return -1;
         }
     }
     if (vt->count >= ARM_MAX_VARS) {
-        fprintf(stderr, "ARM: variable table overflow (max %d)\n",
-                ARM_MAX_VARS);
+        diag_printf(diag, "ARM: variable table overflow (max %d)\n",
+                    ARM_MAX_VARS);
         return -1;
     }
     ARMVarEntry *v = &vt->vars[vt->count++];
@@ -913,14 +962,20 @@ static int arm_vartab_add(ARMVarTable *vt, const char *name,
 /* =========================================================================
  *  generate_arm()  —  main entry point  (two-pass)
  * ========================================================================= */
-CodeBuffer* generate_arm(const Instruction *ir, int ir_count)
+CodeBuffer* generate_arm(const Instruction *ir, int ir_count,
+                         const StrPool *strs, int seg_gap, int origin,
+                         UaDiag *diag)
 {
-    fprintf(stderr, "[ARM] Generating code for %d IR instructions ...\n",
-            ir_count);
+    diag_log(diag, DIAG_NORMAL, "[ARM] Generating code for %d IR instructions ...\n",
+             ir_count);
 
     /* --- Pass 1: collect label addresses + variable declarations ------- */
-    ARMSymTab symtab;
-    arm_symtab_init(&symtab);
+    SymbolTable symtab;
+    symtab_init(&symtab, diag);
+    diag_own(diag, &symtab, symtab_drop);
+    FixupVec fixups;
+    fixvec_init(&fixups, sizeof(ARMFixup), diag);
+    diag_own(diag, &fixups, fixvec_drop);
 
     ARMVarTable vartab;
     arm_vartab_init(&vartab);
@@ -931,13 +986,16 @@ CodeBuffer* generate_arm(const Instruction *ir, int ir_count)
     ARMBufTable buftab;
     arm_buftab_init(&buftab);
 
+    ARMPool pool;
+    arm_pool_init(&pool);
+
     int pc = 0;
     for (int i = 0; i < ir_count; i++) {
         const Instruction *inst = &ir[i];
         if (inst->is_label) {
-            arm_symtab_add(&symtab, inst->label_name, pc);
+            symtab_add(&symtab, strpool_get(strs, inst->label_id), pc);
         } else if (inst->opcode == OP_VAR) {
-            const char *vname = inst->operands[0].data.label;
+            const char *vname = strpool_get(strs, inst->operands[0].data.label_id);
             int32_t init_val  = 0;
             int     has_init  = 0;
             if (inst->operand_count >= 2 &&
@@ -945,54 +1003,92 @@ CodeBuffer* generate_arm(const Instruction *ir, int ir_count)
                 init_val = (int32_t)inst->operands[1].data.imm;
                 has_init = 1;
             }
-            arm_vartab_add(&vartab, vname, init_val, has_init);
+            arm_vartab_add(&vartab, vname, init_val, has_init, diag);
         } else if (inst->opcode == OP_BUFFER) {
-            const char *bname = inst->operands[0].data.label;
+            const char *bname = strpool_get(strs, inst->operands[0].data.label_id);
             int bsize = 0;
             if (inst->operand_count >= 2 &&
                 inst->operands[1].type == OPERAND_IMMEDIATE) {
                 bsize = (int)inst->operands[1].data.imm;
             }
-            arm_buftab_add(&buftab, bname, bsize);
+            arm_buftab_add(&buftab, bname, bsize, diag);
         } else if (inst->opcode == OP_ORG) {
             uint32_t target = (uint32_t)inst->operands[0].data.imm;
+            pc += arm_pool_dump(&pool, NULL, 1);
             if ((int)target < pc) {
-                fprintf(stderr, "Error: @ORG 0x%X would move address "
-                        "backwards (current PC = 0x%X)\n",
-                        target, (unsigned)pc);
-                exit(1);
+                diag_printf(diag, "Error: @ORG 0x%X would move address "
+                            "backwards (current PC = 0x%X)\n",
+                            target, (unsigned)pc);
+                diag_fatal(diag);
             }
             pc = (int)target;
         } else {
             if (inst->opcode == OP_LDS)
-                arm_strtab_add(&strtab, inst->operands[1].data.string);
-            pc += instruction_size_arm(inst);
+                arm_strtab_add(&strtab, strpool_get(strs, inst->operands[1].data.string_id),
+                               diag);
+            int size = instruction_size_arm(inst);
+            uint32_t lit;
+            if (arm_pool_due(&pool, pc, size))
+                pc += arm_pool_dump(&pool, NULL, 1);
+            if (arm_inst_literal(inst, &lit))
+                arm_pool_ref(&pool, NULL, pc, 0, lit);
+            pc += size;
+            if (arm_ends_flow(inst))
+                pc += arm_pool_dump(&pool, NULL, 0);
         }
     }
-
-    /* Register variable symbols: each at code_end + index * 4 */
-    int var_base = pc;
-    for (int v = 0; v < vartab.count; v++) {
-        arm_symtab_add(&symtab, vartab.vars[v].name,
-                       var_base + v * ARM_VAR_SIZE);
-    }
-    int buf_base = var_base + vartab.count * ARM_VAR_SIZE;
+    pc += arm_pool_dump(&pool, NULL, 0);
+    int pool_words = pool.words;
+    arm_pool_init(&pool);
+
+    /* Data after the code, stored in bytes[] back to back:
+     *   [strings][pad to a VAR boundary]               read-only
+     *   [initialised VARs]                             writable
+     *   [uninitialised VARs][BUFFERs]                  bss (size only)
+     * Each part after the code is addressed seg_gap further on, so a
+     * container can map code, strings and data as separate segments.
+     * The bss starts on a VAR boundary; the emitter maps it as
+     * zero-filled memory.  Addresses count from `origin`, the run-time
+     * address of bytes[0]. */
+    int code_end  = pc;
+    int init_vars = 0;
+    for (int v = 0; v < vartab.count; v++)
+        if (vartab.vars[v].has_init) init_vars++;
+    int str_base = origin + code_end + seg_gap;
+    int str_end  = (code_end + strtab.total_size + ARM_VAR_SIZE - 1)
+                 & ~(ARM_VAR_SIZE - 1);
+    int var_base = origin + str_end + 2 * seg_gap;
+    int data_end = var_base + init_vars * ARM_VAR_SIZE;
+    int bss_base = (data_end + ARM_VAR_SIZE - 1) & ~(ARM_VAR_SIZE - 1);
+    int buf_base = bss_base + (vartab.count - init_vars) * ARM_VAR_SIZE;
     {
+        int init_idx = 0, bss_idx = 0;
+        for (int v = 0; v < vartab.count; v++) {
+            int addr = vartab.vars[v].has_init
+                     ? var_base + (init_idx++) * ARM_VAR_SIZE
+                     : bss_base + (bss_idx++) * ARM_VAR_SIZE;
+            symtab_add(&symtab, vartab.vars[v].name, addr);
+        }
         int buf_offset = 0;
         for (int b = 0; b < buftab.count; b++) {
-            arm_symtab_add(&symtab, buftab.bufs[b].name,
-                           buf_base + buf_offset);
+            symtab_add(&symtab, buftab.bufs[b].name,
+                       buf_base + buf_offset);
             buf_offset += buftab.bufs[b].size;
         }
     }
-    int str_base = buf_base + buftab.total_size;
 
     /* --- Pass 2: code emission ----------------------------------------- */
-    CodeBuffer *code = create_code_buffer();
+    CodeBuffer *code = create_code_buffer(diag);
     if (!code) {
-        fprintf(stderr, "UA ARM: out of memory\n");
+        diag_printf(diag, "UA ARM: out of memory\n");
+        symtab_free(&symtab);
+        fixvec_free(&fixups);
         return NULL;
     }
+    diag_own(diag, &code, codebuf_drop);
+
+    /* Pass 1 sized the code, strings and VARs: allocate them at once */
+    codebuf_reserve(code, str_end + init_vars * ARM_VAR_SIZE);
 
     for (int i = 0; i < ir_count; i++) {
         const Instruction *inst = &ir[i];
@@ -1000,17 +1096,26 @@ CodeBuffer* generate_arm(const Instruction *ir, int ir_count)
         if (inst->is_label)
             continue;
 
+        /* Dump the literal pool where pass 1 did */
+        if (inst->opcode == OP_ORG)
+            arm_pool_dump(&pool, code, 1);
+        else if (inst->opcode != OP_VAR && inst->opcode != OP_BUFFER &&
+                 arm_pool_due(&pool, code->size, instruction_size_arm(inst)))
+            arm_pool_dump(&pool, code, 1);
+
+        codebuf_add_line(code, inst->file, inst->line);
+
         switch (inst->opcode) {
 
-        /* ---- LDI Rd, #imm  ->  MOVW [+ MOVT] ------------ 4-8 bytes -- */
+        /* ---- LDI Rd, #imm  ->  MOV/MVN/MOVW/LDR =imm ---- 4 bytes ---- */
         case OP_LDI: {
             int rd = inst->operands[0].data.reg;
             int32_t imm = (int32_t)inst->operands[1].data.imm;
-            arm_validate_register(inst, rd);
+            arm_validate_register(diag, inst, rd);
             uint8_t enc = ARM_REG_ENC[rd];
-            fprintf(stderr, "  LDI R%d -> MOV %s, #%d\n",
-                    rd, ARM_REG_NAME[rd], imm);
-            emit_arm_load_imm32(code, enc, imm);
+            diag_trace(diag, "  LDI R%d -> %s %s, #%d\n",
+                       rd, arm_const_form((uint32_t)imm), ARM_REG_NAME[rd], imm);
+            arm_load_const(code, &pool, enc, (uint32_t)imm);
             break;
         }
 
@@ -1018,10 +1123,10 @@ CodeBuffer* generate_arm(const Instruction *ir, int ir_count)
         case OP_MOV: {
             int rd = inst->operands[0].data.reg;
             int rs = inst->operands[1].data.reg;
-            arm_validate_register(inst, rd);
-            arm_validate_register(inst, rs);
-            fprintf(stderr, "  MOV R%d, R%d -> MOV %s, %s\n",
-                    rd, rs, ARM_REG_NAME[rd], ARM_REG_NAME[rs]);
+            arm_validate_register(diag, inst, rd);
+            arm_validate_register(diag, inst, rs);
+            diag_trace(diag, "  MOV R%d, R%d -> MOV %s, %s\n",
+                       rd, rs, ARM_REG_NAME[rd], ARM_REG_NAME[rs]);
             emit_arm_mov_reg(code, ARM_REG_ENC[rd], ARM_REG_ENC[rs]);
             break;
         }
@@ -1030,10 +1135,10 @@ CodeBuffer* generate_arm(const Instruction *ir, int ir_count)
         case OP_LOAD: {
             int rd = inst->operands[0].data.reg;
             int rs = inst->operands[1].data.reg;
-            arm_validate_register(inst, rd);
-            arm_validate_register(inst, rs);
-            fprintf(stderr, "  LOAD R%d, R%d -> LDR %s, [%s]\n",
-                    rd, rs, ARM_REG_NAME[rd], ARM_REG_NAME[rs]);
+            arm_validate_register(diag, inst, rd);
+            arm_validate_register(diag, inst, rs);
+            diag_trace(diag, "  LOAD R%d, R%d -> LDR %s, [%s]\n",
+                       rd, rs, ARM_REG_NAME[rd], ARM_REG_NAME[rs]);
             emit_arm_ldr(code, ARM_REG_ENC[rd], ARM_REG_ENC[rs]);
             break;
         }
@@ -1042,161 +1147,159 @@ CodeBuffer* generate_arm(const Instruction *ir, int ir_count)
         case OP_STORE: {
             int rx = inst->operands[0].data.reg;
             int ry = inst->operands[1].data.reg;
-            arm_validate_register(inst, rx);
-            arm_validate_register(inst, ry);
-            fprintf(stderr, "  STORE R%d, R%d -> STR %s, [%s]\n",
-                    rx, ry, ARM_REG_NAME[ry], ARM_REG_NAME[rx]);
+            arm_validate_register(diag, inst, rx);
+            arm_validate_register(diag, inst, ry);
+            diag_trace(diag, "  STORE R%d, R%d -> STR %s, [%s]\n",
+                       rx, ry, ARM_REG_NAME[ry], ARM_REG_NAME[rx]);
             emit_arm_str(code, ARM_REG_ENC[ry], ARM_REG_ENC[rx]);
             break;
         }
 
-        /* ---- ADD Rd, Rs/imm -------------------------------- 4/4-12 --- */
+        /* ---- ADD Rd, Rs/imm --------------------------------- 4/4-8 --- */
         case OP_ADD: {
             int rd = inst->operands[0].data.reg;
-            arm_validate_register(inst, rd);
+            arm_validate_register(diag, inst, rd);
             uint8_t enc_d = ARM_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                arm_validate_register(inst, rs);
-                fprintf(stderr, "  ADD R%d, R%d -> ADD %s, %s, %s\n",
-                        rd, rs, ARM_REG_NAME[rd], ARM_REG_NAME[rd],
-                        ARM_REG_NAME[rs]);
+                arm_validate_register(diag, inst, rs);
+                diag_trace(diag, "  ADD R%d, R%d -> ADD %s, %s, %s\n",
+                           rd, rs, ARM_REG_NAME[rd], ARM_REG_NAME[rd],
+                           ARM_REG_NAME[rs]);
                 emit_arm_add_reg(code, enc_d, enc_d, ARM_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                uint8_t rot, imm8;
-                if (arm_encode_imm((uint32_t)imm, &rot, &imm8)) {
-                    fprintf(stderr, "  ADD R%d, #%d -> ADD %s, %s, #%d\n",
-                            rd, imm, ARM_REG_NAME[rd], ARM_REG_NAME[rd], imm);
-                    emit_arm32(code, arm_dp_imm(ARM_COND_AL, ARM_DP_ADD, 0,
+                uint8_t dp, rot, imm8;
+                if (arm_alu_imm(OP_ADD, (uint32_t)imm, &dp, &rot, &imm8)) {
+                    diag_trace(diag, "  ADD R%d, #%d -> %s\n",
+                               rd, imm, ARM_DP_NAME[dp]);
+                    emit_arm32(code, arm_dp_imm(ARM_COND_AL, dp, 0,
                                                  enc_d, enc_d, rot, imm8));
                 } else {
-                    uint8_t scratch = arm_scratch_reg(enc_d);
-                    fprintf(stderr, "  ADD R%d, #%d -> MOV r12, #%d; ADD\n",
-                            rd, imm, imm);
-                    emit_arm_load_imm32(code, scratch, imm);
-                    emit_arm_add_reg(code, enc_d, enc_d, scratch);
+                    diag_trace(diag, "  ADD R%d, #%d -> %s r12; ADD\n",
+                               rd, imm, arm_const_form((uint32_t)imm));
+                    arm_load_const(code, &pool, ARM_REG_IP, (uint32_t)imm);
+                    emit_arm_add_reg(code, enc_d, enc_d, ARM_REG_IP);
                 }
             }
             break;
         }
 
-        /* ---- SUB Rd, Rs/imm -------------------------------- 4/4-12 --- */
+        /* ---- SUB Rd, Rs/imm --------------------------------- 4/4-8 --- */
         case OP_SUB: {
             int rd = inst->operands[0].data.reg;
-            arm_validate_register(inst, rd);
+            arm_validate_register(diag, inst, rd);
             uint8_t enc_d = ARM_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                arm_validate_register(inst, rs);
-                fprintf(stderr, "  SUB R%d, R%d -> SUB %s, %s, %s\n",
-                        rd, rs, ARM_REG_NAME[rd], ARM_REG_NAME[rd],
-                        ARM_REG_NAME[rs]);
+                arm_validate_register(diag, inst, rs);
+                diag_trace(diag, "  SUB R%d, R%d -> SUB %s, %s, %s\n",
+                           rd, rs, ARM_REG_NAME[rd], ARM_REG_NAME[rd],
+                           ARM_REG_NAME[rs]);
                 emit_arm_sub_reg(code, enc_d, enc_d, ARM_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                uint8_t rot, imm8;
-                if (arm_encode_imm((uint32_t)imm, &rot, &imm8)) {
-                    fprintf(stderr, "  SUB R%d, #%d -> SUB %s, %s, #%d\n",
-                            rd, imm, ARM_REG_NAME[rd], ARM_REG_NAME[rd], imm);
-                    emit_arm32(code, arm_dp_imm(ARM_COND_AL, ARM_DP_SUB, 0,
+                uint8_t dp, rot, imm8;
+                if (arm_alu_imm(OP_SUB, (uint32_t)imm, &dp, &rot, &imm8)) {
+                    diag_trace(diag, "  SUB R%d, #%d -> %s\n",
+                               rd, imm, ARM_DP_NAME[dp]);
+                    emit_arm32(code, arm_dp_imm(ARM_COND_AL, dp, 0,
                                                  enc_d, enc_d, rot, imm8));
                 } else {
-                    uint8_t scratch = arm_scratch_reg(enc_d);
-                    fprintf(stderr, "  SUB R%d, #%d -> MOV r12, #%d; SUB\n",
-                            rd, imm, imm);
-                    emit_arm_load_imm32(code, scratch, imm);
-                    emit_arm_sub_reg(code, enc_d, enc_d, scratch);
+                    diag_trace(diag, "  SUB R%d, #%d -> %s r12; SUB\n",
+                               rd, imm, arm_const_form((uint32_t)imm));
+                    arm_load_const(code, &pool, ARM_REG_IP, (uint32_t)imm);
+                    emit_arm_sub_reg(code, enc_d, enc_d, ARM_REG_IP);
                 }
             }
             break;
         }
 
-        /* ---- AND Rd, Rs/imm -------------------------------- 4/4-12 --- */
+        /* ---- AND Rd, Rs/imm --------------------------------- 4/4-8 --- */
         case OP_AND: {
             int rd = inst->operands[0].data.reg;
-            arm_validate_register(inst, rd);
+            arm_validate_register(diag, inst, rd);
             uint8_t enc_d = ARM_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                arm_validate_register(inst, rs);
-                fprintf(stderr, "  AND R%d, R%d -> AND %s, %s, %s\n",
-                        rd, rs, ARM_REG_NAME[rd], ARM_REG_NAME[rd],
-                        ARM_REG_NAME[rs]);
+                arm_validate_register(diag, inst, rs);
+                diag_trace(diag, "  AND R%d, R%d -> AND %s, %s, %s\n",
+                           rd, rs, ARM_REG_NAME[rd], ARM_REG_NAME[rd],
+                           ARM_REG_NAME[rs]);
                 emit_arm_and_reg(code, enc_d, enc_d, ARM_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                uint8_t rot, imm8;
-                if (arm_encode_imm((uint32_t)imm, &rot, &imm8)) {
-                    fprintf(stderr, "  AND R%d, #%d\n", rd, imm);
-                    emit_arm32(code, arm_dp_imm(ARM_COND_AL, ARM_DP_AND, 0,
+                uint8_t dp, rot, imm8;
+                if (arm_alu_imm(OP_AND, (uint32_t)imm, &dp, &rot, &imm8)) {
+                    diag_trace(diag, "  AND R%d, #%d -> %s\n",
+                               rd, imm, ARM_DP_NAME[dp]);
+                    emit_arm32(code, arm_dp_imm(ARM_COND_AL, dp, 0,
                                                  enc_d, enc_d, rot, imm8));
                 } else {
-                    uint8_t scratch = arm_scratch_reg(enc_d);
-                    fprintf(stderr, "  AND R%d, #%d -> MOV r12, #%d; AND\n",
-                            rd, imm, imm);
-                    emit_arm_load_imm32(code, scratch, imm);
-                    emit_arm_and_reg(code, enc_d, enc_d, scratch);
+                    diag_trace(diag, "  AND R%d, #%d -> %s r12; AND\n",
+                               rd, imm, arm_const_form((uint32_t)imm));
+                    arm_load_const(code, &pool, ARM_REG_IP, (uint32_t)imm);
+                    emit_arm_and_reg(code, enc_d, enc_d, ARM_REG_IP);
                 }
             }
             break;
         }
 
-        /* ---- OR Rd, Rs/imm --------------------------------- 4/4-12 --- */
+        /* ---- OR Rd, Rs/imm ---------------------------------- 4/4-8 --- */
         case OP_OR: {
             int rd = inst->operands[0].data.reg;
-            arm_validate_register(inst, rd);
+            arm_validate_register(diag, inst, rd);
             uint8_t enc_d = ARM_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                arm_validate_register(inst, rs);
-                fprintf(stderr, "  OR  R%d, R%d -> ORR %s, %s, %s\n",
-                        rd, rs, ARM_REG_NAME[rd], ARM_REG_NAME[rd],
-                        ARM_REG_NAME[rs]);
+                arm_validate_register(diag, inst, rs);
+                diag_trace(diag, "  OR  R%d, R%d -> ORR %s, %s, %s\n",
+                           rd, rs, ARM_REG_NAME[rd], ARM_REG_NAME[rd],
+                           ARM_REG_NAME[rs]);
                 emit_arm_orr_reg(code, enc_d, enc_d, ARM_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                uint8_t rot, imm8;
-                if (arm_encode_imm((uint32_t)imm, &rot, &imm8)) {
-                    fprintf(stderr, "  OR  R%d, #%d\n", rd, imm);
-                    emit_arm32(code, arm_dp_imm(ARM_COND_AL, ARM_DP_ORR, 0,
+                uint8_t dp, rot, imm8;
+                if (arm_alu_imm(OP_OR, (uint32_t)imm, &dp, &rot, &imm8)) {
+                    diag_trace(diag, "  OR  R%d, #%d -> %s\n",
+                               rd, imm, ARM_DP_NAME[dp]);
+                    emit_arm32(code, arm_dp_imm(ARM_COND_AL, dp, 0,
                                                  enc_d, enc_d, rot, imm8));
                 } else {
-                    uint8_t scratch = arm_scratch_reg(enc_d);
-                    fprintf(stderr, "  OR  R%d, #%d -> MOV r12, #%d; ORR\n",
-                            rd, imm, imm);
-                    emit_arm_load_imm32(code, scratch, imm);
-                    emit_arm_orr_reg(code, enc_d, enc_d, scratch);
+                    diag_trace(diag, "  OR  R%d, #%d -> %s r12; ORR\n",
+                               rd, imm, arm_const_form((uint32_t)imm));
+                    arm_load_const(code, &pool, ARM_REG_IP, (uint32_t)imm);
+                    emit_arm_orr_reg(code, enc_d, enc_d, ARM_REG_IP);
                 }
             }
             break;
         }
 
-        /* ---- XOR Rd, Rs/imm -------------------------------- 4/4-12 --- */
+        /* ---- XOR Rd, Rs/imm --------------------------------- 4/4-8 --- */
         case OP_XOR: {
             int rd = inst->operands[0].data.reg;
-            arm_validate_register(inst, rd);
+            arm_validate_register(diag, inst, rd);
             uint8_t enc_d = ARM_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                arm_validate_register(inst, rs);
-                fprintf(stderr, "  XOR R%d, R%d -> EOR %s, %s, %s\n",
-                        rd, rs, ARM_REG_NAME[rd], ARM_REG_NAME[rd],
-                        ARM_REG_NAME[rs]);
+                arm_validate_register(diag, inst, rs);
+                diag_trace(diag, "  XOR R%d, R%d -> EOR %s, %s, %s\n",
+                           rd, rs, ARM_REG_NAME[rd], ARM_REG_NAME[rd],
+                           ARM_REG_NAME[rs]);
                 emit_arm_eor_reg(code, enc_d, enc_d, ARM_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                uint8_t rot, imm8;
-                if (arm_encode_imm((uint32_t)imm, &rot, &imm8)) {
-                    fprintf(stderr, "  XOR R%d, #%d\n", rd, imm);
-                    emit_arm32(code, arm_dp_imm(ARM_COND_AL, ARM_DP_EOR, 0,
+                uint8_t dp, rot, imm8;
+                if (arm_alu_imm(OP_XOR, (uint32_t)imm, &dp, &rot, &imm8)) {
+                    diag_trace(diag, "  XOR R%d, #%d -> %s\n",
+                               rd, imm, ARM_DP_NAME[dp]);
+                    emit_arm32(code, arm_dp_imm(ARM_COND_AL, dp, 0,
                                                  enc_d, enc_d, rot, imm8));
                 } else {
-                    uint8_t scratch = arm_scratch_reg(enc_d);
-                    fprintf(stderr, "  XOR R%d, #%d -> MOV r12, #%d; EOR\n",
-                            rd, imm, imm);
-                    emit_arm_load_imm32(code, scratch, imm);
-                    emit_arm_eor_reg(code, enc_d, enc_d, scratch);
+                    diag_trace(diag, "  XOR R%d, #%d -> %s r12; EOR\n",
+                               rd, imm, arm_const_form((uint32_t)imm));
+                    arm_load_const(code, &pool, ARM_REG_IP, (uint32_t)imm);
+                    emit_arm_eor_reg(code, enc_d, enc_d, ARM_REG_IP);
                 }
             }
             break;
@@ -1205,9 +1308,9 @@ CodeBuffer* generate_arm(const Instruction *ir, int ir_count)
         /* ---- NOT Rd  ->  MVN Rd, Rd ------------------------ 4 bytes -- */
         case OP_NOT: {
             int rd = inst->operands[0].data.reg;
-            arm_validate_register(inst, rd);
-            fprintf(stderr, "  NOT R%d -> MVN %s, %s\n",
-                    rd, ARM_REG_NAME[rd], ARM_REG_NAME[rd]);
+            arm_validate_register(diag, inst, rd);
+            diag_trace(diag, "  NOT R%d -> MVN %s, %s\n",
+                       rd, ARM_REG_NAME[rd], ARM_REG_NAME[rd]);
             emit_arm_mvn_reg(code, ARM_REG_ENC[rd], ARM_REG_ENC[rd]);
             break;
         }
@@ -1215,9 +1318,9 @@ CodeBuffer* generate_arm(const Instruction *ir, int ir_count)
         /* ---- INC Rd  ->  ADD Rd, Rd, #1 -------------------- 4 bytes -- */
         case OP_INC: {
             int rd = inst->operands[0].data.reg;
-            arm_validate_register(inst, rd);
-            fprintf(stderr, "  INC R%d -> ADD %s, %s, #1\n",
-                    rd, ARM_REG_NAME[rd], ARM_REG_NAME[rd]);
+            arm_validate_register(diag, inst, rd);
+            diag_trace(diag, "  INC R%d -> ADD %s, %s, #1\n",
+                       rd, ARM_REG_NAME[rd], ARM_REG_NAME[rd]);
             emit_arm_add_imm(code, ARM_REG_ENC[rd], ARM_REG_ENC[rd], 1);
             break;
         }
@@ -1225,55 +1328,53 @@ CodeBuffer* generate_arm(const Instruction *ir, int ir_count)
         /* ---- DEC Rd  ->  SUB Rd, Rd, #1 -------------------- 4 bytes -- */
         case OP_DEC: {
             int rd = inst->operands[0].data.reg;
-            arm_validate_register(inst, rd);
-            fprintf(stderr, "  DEC R%d -> SUB %s, %s, #1\n",
-                    rd, ARM_REG_NAME[rd], ARM_REG_NAME[rd]);
+            arm_validate_register(diag, inst, rd);
+            diag_trace(diag, "  DEC R%d -> SUB %s, %s, #1\n",
+                       rd, ARM_REG_NAME[rd], ARM_REG_NAME[rd]);
             emit_arm_sub_imm(code, ARM_REG_ENC[rd], ARM_REG_ENC[rd], 1);
             break;
         }
 
-        /* ---- MUL Rd, Rs/imm  ->  MUL Rd, Rd, Rm ------ 4/8-12 bytes - */
+        /* ---- MUL Rd, Rs/imm  ->  MUL Rd, Rd, Rm ------- 4/8 bytes -- */
         case OP_MUL: {
             int rd = inst->operands[0].data.reg;
-            arm_validate_register(inst, rd);
+            arm_validate_register(diag, inst, rd);
             uint8_t enc_d = ARM_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                arm_validate_register(inst, rs);
-                fprintf(stderr, "  MUL R%d, R%d -> MUL %s, %s, %s\n",
-                        rd, rs, ARM_REG_NAME[rd], ARM_REG_NAME[rd],
-                        ARM_REG_NAME[rs]);
+                arm_validate_register(diag, inst, rs);
+                diag_trace(diag, "  MUL R%d, R%d -> MUL %s, %s, %s\n",
+                           rd, rs, ARM_REG_NAME[rd], ARM_REG_NAME[rd],
+                           ARM_REG_NAME[rs]);
                 emit_arm_mul(code, enc_d, enc_d, ARM_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                uint8_t scratch = arm_scratch_reg(enc_d);
-                fprintf(stderr, "  MUL R%d, #%d -> MOV r12, #%d; MUL\n",
-                        rd, imm, imm);
-                emit_arm_load_imm32(code, scratch, imm);
-                emit_arm_mul(code, enc_d, enc_d, scratch);
+                diag_trace(diag, "  MUL R%d, #%d -> %s r12; MUL\n",
+                           rd, imm, arm_const_form((uint32_t)imm));
+                arm_load_const(code, &pool, ARM_REG_IP, (uint32_t)imm);
+                emit_arm_mul(code, enc_d, enc_d, ARM_REG_IP);
             }
             break;
         }
 
-        /* ---- DIV Rd, Rs/imm  ->  SDIV Rd, Rd, Rm ----- 4/8-12 bytes - */
+        /* ---- DIV Rd, Rs/imm  ->  SDIV Rd, Rd, Rm ------ 4/8 bytes -- */
         case OP_DIV: {
             int rd = inst->operands[0].data.reg;
-            arm_validate_register(inst, rd);
+            arm_validate_register(diag, inst, rd);
             uint8_t enc_d = ARM_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                arm_validate_register(inst, rs);
-                fprintf(stderr, "  DIV R%d, R%d -> SDIV %s, %s, %s\n",
-                        rd, rs, ARM_REG_NAME[rd], ARM_REG_NAME[rd],
-                        ARM_REG_NAME[rs]);
+                arm_validate_register(diag, inst, rs);
+                diag_trace(diag, "  DIV R%d, R%d -> SDIV %s, %s, %s\n",
+                           rd, rs, ARM_REG_NAME[rd], ARM_REG_NAME[rd],
+                           ARM_REG_NAME[rs]);
                 emit_arm_sdiv(code, enc_d, enc_d, ARM_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                uint8_t scratch = arm_scratch_reg(enc_d);
-                fprintf(stderr, "  DIV R%d, #%d -> MOV r12, #%d; SDIV\n",
-                        rd, imm, imm);
-                emit_arm_load_imm32(code, scratch, imm);
-                emit_arm_sdiv(code, enc_d, enc_d, scratch);
+                diag_trace(diag, "  DIV R%d, #%d -> %s r12; SDIV\n",
+                           rd, imm, arm_const_form((uint32_t)imm));
+                arm_load_const(code, &pool, ARM_REG_IP, (uint32_t)imm);
+                emit_arm_sdiv(code, enc_d, enc_d, ARM_REG_IP);
             }
             break;
         }
@@ -1281,19 +1382,19 @@ CodeBuffer* generate_arm(const Instruction *ir, int ir_count)
         /* ---- SHL Rd, Rs/imm -------------------------------- 4 bytes -- */
         case OP_SHL: {
             int rd = inst->operands[0].data.reg;
-            arm_validate_register(inst, rd);
+            arm_validate_register(diag, inst, rd);
             uint8_t enc_d = ARM_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_IMMEDIATE) {
                 uint8_t imm = (uint8_t)(inst->operands[1].data.imm & 0x1F);
-                fprintf(stderr, "  SHL R%d, #%d -> LSL %s, %s, #%d\n",
-                        rd, imm, ARM_REG_NAME[rd], ARM_REG_NAME[rd], imm);
+                diag_trace(diag, "  SHL R%d, #%d -> LSL %s, %s, #%d\n",
+                           rd, imm, ARM_REG_NAME[rd], ARM_REG_NAME[rd], imm);
                 emit_arm_lsl_imm(code, enc_d, enc_d, imm);
             } else {
                 int rs = inst->operands[1].data.reg;
-                arm_validate_register(inst, rs);
-                fprintf(stderr, "  SHL R%d, R%d -> LSL %s, %s, %s\n",
-                        rd, rs, ARM_REG_NAME[rd], ARM_REG_NAME[rd],
-                        ARM_REG_NAME[rs]);
+                arm_validate_register(diag, inst, rs);
+                diag_trace(diag, "  SHL R%d, R%d -> LSL %s, %s, %s\n",
+                           rd, rs, ARM_REG_NAME[rd], ARM_REG_NAME[rd],
+                           ARM_REG_NAME[rs]);
                 emit_arm_lsl_reg(code, enc_d, enc_d, ARM_REG_ENC[rs]);
             }
             break;
@@ -1302,47 +1403,48 @@ CodeBuffer* generate_arm(const Instruction *ir, int ir_count)
         /* ---- SHR Rd, Rs/imm -------------------------------- 4 bytes -- */
         case OP_SHR: {
             int rd = inst->operands[0].data.reg;
-            arm_validate_register(inst, rd);
+            arm_validate_register(diag, inst, rd);
             uint8_t enc_d = ARM_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_IMMEDIATE) {
                 uint8_t imm = (uint8_t)(inst->operands[1].data.imm & 0x1F);
-                fprintf(stderr, "  SHR R%d, #%d -> LSR %s, %s, #%d\n",
-                        rd, imm, ARM_REG_NAME[rd], ARM_REG_NAME[rd], imm);
+                diag_trace(diag, "  SHR R%d, #%d -> LSR %s, %s, #%d\n",
+                           rd, imm, ARM_REG_NAME[rd], ARM_REG_NAME[rd], imm);
                 emit_arm_lsr_imm(code, enc_d, enc_d, imm);
             } else {
                 int rs = inst->operands[1].data.reg;
-                arm_validate_register(inst, rs);
-                fprintf(stderr, "  SHR R%d, R%d -> LSR %s, %s, %s\n",
-                        rd, rs, ARM_REG_NAME[rd], ARM_REG_NAME[rd],
-                        ARM_REG_NAME[rs]);
+                arm_validate_register(diag, inst, rs);
+                diag_trace(diag, "  SHR R%d, R%d -> LSR %s, %s, %s\n",
+                           rd, rs, ARM_REG_NAME[rd], ARM_REG_NAME[rd],
+                           ARM_REG_NAME[rs]);
                 emit_arm_lsr_reg(code, enc_d, enc_d, ARM_REG_ENC[rs]);
             }
             break;
         }
 
-        /* ---- CMP Ra, Rb/imm -------------------------------- 4/4-12 --- */
+        /* ---- CMP Ra, Rb/imm --------------------------------- 4/4-8 --- */
         case OP_CMP: {
             int ra = inst->operands[0].data.reg;
-            arm_validate_register(inst, ra);
+            arm_validate_register(diag, inst, ra);
             uint8_t enc_a = ARM_REG_ENC[ra];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rb = inst->operands[1].data.reg;
-                arm_validate_register(inst, rb);
-                fprintf(stderr, "  CMP R%d, R%d -> CMP %s, %s\n",
-                        ra, rb, ARM_REG_NAME[ra], ARM_REG_NAME[rb]);
+                arm_validate_register(diag, inst, rb);
+                diag_trace(diag, "  CMP R%d, R%d -> CMP %s, %s\n",
+                           ra, rb, ARM_REG_NAME[ra], ARM_REG_NAME[rb]);
                 emit_arm_cmp_reg(code, enc_a, ARM_REG_ENC[rb]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                uint8_t rot, imm8;
-                if (arm_encode_imm((uint32_t)imm, &rot, &imm8)) {
-                    fprintf(stderr, "  CMP R%d, #%d\n", ra, imm);
-                    emit_arm_cmp_imm(code, enc_a, rot, imm8);
+                uint8_t dp, rot, imm8;
+                if (arm_alu_imm(OP_CMP, (uint32_t)imm, &dp, &rot, &imm8)) {
+                    diag_trace(diag, "  CMP R%d, #%d -> %s\n",
+                               ra, imm, ARM_DP_NAME[dp]);
+                    emit_arm32(code, arm_dp_imm(ARM_COND_AL, dp, 1,
+                                                 enc_a, 0, rot, imm8));
                 } else {
-                    uint8_t scratch = arm_scratch_reg(enc_a);
-                    fprintf(stderr, "  CMP R%d, #%d -> MOV r12, #%d; CMP\n",
-                            ra, imm, imm);
-                    emit_arm_load_imm32(code, scratch, imm);
-                    emit_arm_cmp_reg(code, enc_a, scratch);
+                    diag_trace(diag, "  CMP R%d, #%d -> %s r12; CMP\n",
+                               ra, imm, arm_const_form((uint32_t)imm));
+                    arm_load_const(code, &pool, ARM_REG_IP, (uint32_t)imm);
+                    emit_arm_cmp_reg(code, enc_a, ARM_REG_IP);
                 }
             }
             break;
@@ -1350,82 +1452,88 @@ CodeBuffer* generate_arm(const Instruction *ir, int ir_count)
 
         /* ---- JMP label  ->  B label ------------------------ 4 bytes -- */
         case OP_JMP: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  JMP %s -> B\n", label);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  JMP %s -> B\n", label);
             int patch_off = code->size;
             emit_arm_branch_placeholder(code);
-            arm_add_fixup(&symtab, label, patch_off, patch_off, inst->line,
+            arm_add_fixup(&symtab, &fixups, label, patch_off, patch_off,
+                          inst,
                           0, ARM_COND_AL);
             break;
         }
 
         /* ---- JZ label  ->  BEQ label ----------------------- 4 bytes -- */
         case OP_JZ: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  JZ  %s -> BEQ\n", label);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  JZ  %s -> BEQ\n", label);
             int patch_off = code->size;
             emit_arm_branch_placeholder(code);
-            arm_add_fixup(&symtab, label, patch_off, patch_off, inst->line,
+            arm_add_fixup(&symtab, &fixups, label, patch_off, patch_off,
+                          inst,
                           0, ARM_COND_EQ);
             break;
         }
 
         /* ---- JNZ label  ->  BNE label ---------------------- 4 bytes -- */
         case OP_JNZ: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  JNZ %s -> BNE\n", label);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  JNZ %s -> BNE\n", label);
             int patch_off = code->size;
             emit_arm_branch_placeholder(code);
-            arm_add_fixup(&symtab, label, patch_off, patch_off, inst->line,
+            arm_add_fixup(&symtab, &fixups, label, patch_off, patch_off,
+                          inst,
                           0, ARM_COND_NE);
             break;
         }
 
         /* ---- JL label  ->  BLT label ----------------------- 4 bytes -- */
         case OP_JL: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  JL  %s -> BLT\n", label);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  JL  %s -> BLT\n", label);
             int patch_off = code->size;
             emit_arm_branch_placeholder(code);
-            arm_add_fixup(&symtab, label, patch_off, patch_off, inst->line,
+            arm_add_fixup(&symtab, &fixups, label, patch_off, patch_off,
+                          inst,
                           0, ARM_COND_LT);
             break;
         }
 
         /* ---- JG label  ->  BGT label ----------------------- 4 bytes -- */
         case OP_JG: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  JG  %s -> BGT\n", label);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  JG  %s -> BGT\n", label);
             int patch_off = code->size;
             emit_arm_branch_placeholder(code);
-            arm_add_fixup(&symtab, label, patch_off, patch_off, inst->line,
+            arm_add_fixup(&symtab, &fixups, label, patch_off, patch_off,
+                          inst,
                           0, ARM_COND_GT);
             break;
         }
 
         /* ---- CALL label  ->  BL label ---------------------- 4 bytes -- */
         case OP_CALL: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  CALL %s -> BL\n", label);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  CALL %s -> BL\n", label);
             int patch_off = code->size;
             emit_arm_branch_placeholder(code);
-            arm_add_fixup(&symtab, label, patch_off, patch_off, inst->line,
+            arm_add_fixup(&symtab, &fixups, label, patch_off, patch_off,
+                          inst,
                           1, ARM_COND_AL);
             break;
         }
 
         /* ---- RET  ->  BX LR -------------------------------- 4 bytes -- */
         case OP_RET:
-            fprintf(stderr, "  RET -> BX LR\n");
+            diag_trace(diag, "  RET -> BX LR\n");
             emit_arm_bx(code, ARM_REG_LR);
             break;
 
         /* ---- PUSH Rs ---------------------------------------- 4 bytes -- */
         case OP_PUSH: {
             int rs = inst->operands[0].data.reg;
-            arm_validate_register(inst, rs);
-            fprintf(stderr, "  PUSH R%d -> STR %s, [SP, #-4]!\n",
-                    rs, ARM_REG_NAME[rs]);
+            arm_validate_register(diag, inst, rs);
+            diag_trace(diag, "  PUSH R%d -> STR %s, [SP, #-4]!\n",
+                       rs, ARM_REG_NAME[rs]);
             emit_arm_push(code, ARM_REG_ENC[rs]);
             break;
         }
@@ -1433,29 +1541,29 @@ CodeBuffer* generate_arm(const Instruction *ir, int ir_count)
         /* ---- POP Rd ----------------------------------------- 4 bytes -- */
         case OP_POP: {
             int rd = inst->operands[0].data.reg;
-            arm_validate_register(inst, rd);
-            fprintf(stderr, "  POP  R%d -> LDR %s, [SP], #4\n",
-                    rd, ARM_REG_NAME[rd]);
+            arm_validate_register(diag, inst, rd);
+            diag_trace(diag, "  POP  R%d -> LDR %s, [SP], #4\n",
+                       rd, ARM_REG_NAME[rd]);
             emit_arm_pop(code, ARM_REG_ENC[rd]);
             break;
         }
 
         /* ---- NOP -------------------------------------------- 4 bytes -- */
         case OP_NOP:
-            fprintf(stderr, "  NOP\n");
+            diag_trace(diag, "  NOP\n");
             emit_arm_nop(code);
             break;
 
         /* ---- HLT  ->  BX LR -------------------------------- 4 bytes -- */
         case OP_HLT:
-            fprintf(stderr, "  HLT -> BX LR\n");
+            diag_trace(diag, "  HLT -> BX LR\n");
             emit_arm_bx(code, ARM_REG_LR);
             break;
 
         /* ---- INT #imm  ->  SVC #imm ------------------------ 4 bytes -- */
         case OP_INT: {
             uint32_t imm = (uint32_t)(inst->operands[0].data.imm & 0x00FFFFFF);
-            fprintf(stderr, "  INT #%d -> SVC #%d\n", (int)imm, (int)imm);
+            diag_trace(diag, "  INT #%d -> SVC #%d\n", (int)imm, (int)imm);
             emit_arm_svc(code, imm);
             break;
         }
@@ -1471,27 +1579,25 @@ CodeBuffer* generate_arm(const Instruction *ir, int ir_count)
         /* ---- ORG addr — pad with zeros until target address ----------- */
         case OP_ORG: {
             uint32_t target = (uint32_t)inst->operands[0].data.imm;
-            while (code->size < (int)target) {
-                emit_byte(code, 0x00);
-            }
+            emit_fill(code, 0x00, (int)target - code->size);
             break;
         }
 
         /* ---- SET name, Rs/imm — store to variable --------------------- */
         case OP_SET: {
-            const char *vname = inst->operands[0].data.label;
-            int var_addr = arm_symtab_lookup(&symtab, vname);
+            const char *vname = strpool_get(strs, inst->operands[0].data.label_id);
+            int var_addr = symtab_lookup(&symtab, vname);
             if (var_addr < 0) {
                 char msg[256];
                 snprintf(msg, sizeof(msg),
                          "undefined variable '%s'", vname);
-                arm_error(inst, msg);
+                arm_error(diag, inst, msg);
             }
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                arm_validate_register(inst, rs);
-                fprintf(stderr, "  SET %s, R%d -> STR %s, [r12]\n",
-                        vname, rs, ARM_REG_NAME[rs]);
+                arm_validate_register(diag, inst, rs);
+                diag_trace(diag, "  SET %s, R%d -> STR %s, [r12]\n",
+                           vname, rs, ARM_REG_NAME[rs]);
                 /* Load address into r12 (scratch) */
                 emit_arm_load_imm32_full(code, ARM_REG_IP,
                                          (int32_t)var_addr);
@@ -1499,10 +1605,10 @@ CodeBuffer* generate_arm(const Instruction *ir, int ir_count)
                 emit_arm_str(code, ARM_REG_ENC[rs], ARM_REG_IP);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                fprintf(stderr, "  SET %s, #%d -> STR r11, [r12]\n",
-                        vname, imm);
+                diag_trace(diag, "  SET %s, #%d -> %s r11; STR r11, [r12]\n",
+                           vname, imm, arm_const_form((uint32_t)imm));
                 /* Load value into r11 */
-                emit_arm_load_imm32_full(code, ARM_REG_FP, imm);
+                arm_load_const(code, &pool, ARM_REG_FP, (uint32_t)imm);
                 /* Load address into r12 */
                 emit_arm_load_imm32_full(code, ARM_REG_IP,
                                          (int32_t)var_addr);
@@ -1515,26 +1621,26 @@ CodeBuffer* generate_arm(const Instruction *ir, int ir_count)
         /* ---- GET Rd, name — load from variable or buffer address ------ */
         case OP_GET: {
             int rd = inst->operands[0].data.reg;
-            const char *vname = inst->operands[1].data.label;
-            arm_validate_register(inst, rd);
-            int var_addr = arm_symtab_lookup(&symtab, vname);
+            const char *vname = strpool_get(strs, inst->operands[1].data.label_id);
+            arm_validate_register(diag, inst, rd);
+            int var_addr = symtab_lookup(&symtab, vname);
             if (var_addr < 0) {
                 char msg[256];
                 snprintf(msg, sizeof(msg),
                          "undefined variable '%s'", vname);
-                arm_error(inst, msg);
+                arm_error(diag, inst, msg);
             }
             int is_buf = arm_buftab_has(&buftab, vname);
             if (is_buf) {
-                fprintf(stderr, "  GET R%d, %s -> MOVW+MOVT %s, #%d (buffer address)\n",
-                        rd, vname, ARM_REG_NAME[rd], var_addr);
+                diag_trace(diag, "  GET R%d, %s -> MOVW+MOVT %s, #%d (buffer address)\n",
+                           rd, vname, ARM_REG_NAME[rd], var_addr);
                 /* Load address into r12, then MOV Rd, r12 */
                 emit_arm_load_imm32_full(code, ARM_REG_IP,
                                          (int32_t)var_addr);
                 emit_arm_mov_reg(code, ARM_REG_ENC[rd], ARM_REG_IP);
             } else {
-                fprintf(stderr, "  GET R%d, %s -> LDR %s, [r12]\n",
-                        rd, vname, ARM_REG_NAME[rd]);
+                diag_trace(diag, "  GET R%d, %s -> LDR %s, [r12]\n",
+                           rd, vname, ARM_REG_NAME[rd]);
                 /* Load address into r12 */
                 emit_arm_load_imm32_full(code, ARM_REG_IP,
                                          (int32_t)var_addr);
@@ -1547,12 +1653,12 @@ CodeBuffer* generate_arm(const Instruction *ir, int ir_count)
         /* ---- LDS Rd, "str"  ->  MOVW+MOVT Rd, addr -------- 8 bytes --- */
         case OP_LDS: {
             int rd = inst->operands[0].data.reg;
-            const char *str = inst->operands[1].data.string;
-            arm_validate_register(inst, rd);
-            int str_idx = arm_strtab_add(&strtab, str);
+            const char *str = strpool_get(strs, inst->operands[1].data.string_id);
+            arm_validate_register(diag, inst, rd);
+            int str_idx = arm_strtab_add(&strtab, str, diag);
             int str_addr = str_base + strtab.strings[str_idx].offset;
-            fprintf(stderr, "  LDS R%d, \"%s\" -> MOVW+MOVT %s, #%d\n",
-                    rd, str, ARM_REG_NAME[rd], str_addr);
+            diag_trace(diag, "  LDS R%d, \"%s\" -> MOVW+MOVT %s, #%d\n",
+                       rd, str, ARM_REG_NAME[rd], str_addr);
             emit_arm_load_imm32_full(code, ARM_REG_ENC[rd],
                                      (int32_t)str_addr);
             break;
@@ -1562,10 +1668,10 @@ CodeBuffer* generate_arm(const Instruction *ir, int ir_count)
         case OP_LOADB: {
             int rd = inst->operands[0].data.reg;
             int rs = inst->operands[1].data.reg;
-            arm_validate_register(inst, rd);
-            arm_validate_register(inst, rs);
-            fprintf(stderr, "  LOADB R%d, R%d -> LDRB %s, [%s]\n",
-                    rd, rs, ARM_REG_NAME[rd], ARM_REG_NAME[rs]);
+            arm_validate_register(diag, inst, rd);
+            arm_validate_register(diag, inst, rs);
+            diag_trace(diag, "  LOADB R%d, R%d -> LDRB %s, [%s]\n",
+                       rd, rs, ARM_REG_NAME[rd], ARM_REG_NAME[rs]);
             /* LDRB: same as LDR but B=1 (bit 22) */
             {
                 uint32_t word = ((uint32_t)ARM_COND_AL << 28)
@@ -1587,10 +1693,10 @@ CodeBuffer* generate_arm(const Instruction *ir, int ir_count)
         case OP_STOREB: {
             int rx = inst->operands[0].data.reg;
             int ry = inst->operands[1].data.reg;
-            arm_validate_register(inst, rx);
-            arm_validate_register(inst, ry);
-            fprintf(stderr, "  STOREB R%d, R%d -> STRB %s, [%s]\n",
-                    rx, ry, ARM_REG_NAME[rx], ARM_REG_NAME[ry]);
+            arm_validate_register(diag, inst, rx);
+            arm_validate_register(diag, inst, ry);
+            diag_trace(diag, "  STOREB R%d, R%d -> STRB %s, [%s]\n",
+                       rx, ry, ARM_REG_NAME[rx], ARM_REG_NAME[ry]);
             /* STRB: same as STR but B=1 (bit 22) */
             {
                 uint32_t word = ((uint32_t)ARM_COND_AL << 28)
@@ -1610,19 +1716,19 @@ CodeBuffer* generate_arm(const Instruction *ir, int ir_count)
 
         /* ---- SYS  ->  SVC #0 ----------------------------- 4 bytes --- */
         case OP_SYS:
-            fprintf(stderr, "  SYS -> SVC #0\n");
+            diag_trace(diag, "  SYS -> SVC #0\n");
             emit_arm_svc(code, 0);
             break;
 
         /* ---- WFI ------------------------------------------ 4 bytes --- */
         case OP_WFI:
-            fprintf(stderr, "  WFI\n");
+            diag_trace(diag, "  WFI\n");
             emit_arm32(code, 0xE320F003u);   /* WFI (cond=AL) */
             break;
 
         /* ---- DMB SY --------------------------------------- 4 bytes --- */
         case OP_DMB:
-            fprintf(stderr, "  DMB SY\n");
+            diag_trace(diag, "  DMB SY\n");
             emit_arm32(code, 0xF57FF05Fu);   /* DMB SY (unconditional) */
             break;
 
@@ -1631,20 +1737,26 @@ CodeBuffer* generate_arm(const Instruction *ir, int ir_count)
             snprintf(msg, sizeof(msg),
                      "opcode '%s' is not supported by the ARM backend",
                      opcode_name(inst->opcode));
-            arm_error(inst, msg);
+            arm_error(diag, inst, msg);
             break;
         }
         }
+
+        if (arm_ends_flow(inst))
+            arm_pool_dump(&pool, code, 0);
     }
+    arm_pool_dump(&pool, code, 0);
 
     /* --- Pass 3: patch branch relocations ------------------------------ */
-    for (int f = 0; f < symtab.fix_count; f++) {
-        ARMFixup *fix = &symtab.fixups[f];
-        int target = arm_symtab_lookup(&symtab, fix->label);
+    for (int f = 0; f < fixups.count; f++) {
+        ARMFixup *fix = fixvec_at(&fixups, ARMFixup, f);
+        int target = symtab_lookup(&symtab, fix->label);
         if (target < 0) {
-            fprintf(stderr,
-                    "ARM: undefined label or variable '%s' (line %d)\n",
-                    fix->label, fix->line);
+            diag_printf(diag,
+                        "ARM: %s, Line %d: undefined label or variable '%s'\n",
+                        fix->inst->file, fix->inst->line, fix->label);
+            symtab_free(&symtab);
+            fixvec_free(&fixups);
             free_code_buffer(code);
             return NULL;
         }
@@ -1655,8 +1767,10 @@ CodeBuffer* generate_arm(const Instruction *ir, int ir_count)
 
         /* Check range: 24-bit signed = ±32 MB */
         if (offset24 < -0x800000 || offset24 > 0x7FFFFF) {
-            fprintf(stderr, "ARM: branch target '%s' out of range (line %d)\n",
-                    fix->label, fix->line);
+            diag_printf(diag, "ARM: %s, Line %d: branch target '%s' out of "
+                        "range\n", fix->inst->file, fix->inst->line, fix->label);
+            symtab_free(&symtab);
+            fixvec_free(&fixups);
             free_code_buffer(code);
             return NULL;
         }
@@ -1668,33 +1782,75 @@ CodeBuffer* generate_arm(const Instruction *ir, int ir_count)
         patch_arm_branch(code, fix->patch_offset, word);
     }
 
-    /* --- Append variable data section --------------------------------- */
-    int data_start = code->size;
-    for (int v = 0; v < vartab.count; v++) {
-        uint32_t val = (uint32_t)vartab.vars[v].init_value;
-        emit_byte(code, (uint8_t)(val & 0xFF));
-        emit_byte(code, (uint8_t)((val >> 8) & 0xFF));
-        emit_byte(code, (uint8_t)((val >> 16) & 0xFF));
-        emit_byte(code, (uint8_t)((val >> 24) & 0xFF));
+    /* Export code labels and the code/data split (ELF symbols, segments) */
+    code->code_size = code->size;
+    for (int i = 0; i < ir_count; i++) {
+        if (!ir[i].is_label) continue;
+        const char *lname = strpool_get(strs, ir[i].label_id);
+        if (symtab_lookup(&code->labels, lname) < 0)
+            symtab_add(&code->labels, lname, symtab_lookup(&symtab, lname));
     }
-
-    /* --- Append buffer data section (zero-filled) -------------------- */
-    for (int b = 0; b < buftab.count; b++)
-        for (int i = 0; i < buftab.bufs[b].size; i++)
-            emit_byte(code, 0x00);
+    symtab_free(&symtab);
+    fixvec_free(&fixups);
 
     /* --- Append string data section ----------------------------------- */
     for (int s = 0; s < strtab.count; s++) {
         const char *p = strtab.strings[s].text;
         int len = strtab.strings[s].length;
-        for (int b = 0; b < len; b++)
-            emit_byte(code, (uint8_t)p[b]);
+        emit_bytes(code, p, len);
         emit_byte(code, 0x00);
     }
 
-    fprintf(stderr, "[ARM] Emitted %d bytes (%d code + %d var + %d buf + %d str)\n",
-            code->size, data_start,
-            vartab.count * ARM_VAR_SIZE, buftab.total_size,
-            strtab.total_size);
+    code->str_size = code->size - code->code_size;
+    emit_fill(code, 0x00, str_end - code->size);
+    code->data_offset = code->size;
+    code->seg_gap     = seg_gap;
+
+    /* --- Append initialised variable data ------------------------------ */
+    for (int v = 0; v < vartab.count; v++) {
+        if (!vartab.vars[v].has_init) continue;
+        emit_le32(code, (uint32_t)vartab.vars[v].init_value);
+    }
+
+    /* --- Zero-initialised storage (uninitialised VARs, BUFFERs) -------- */
+    int bss_end = buf_base + buftab.total_size;
+    code->bss_size = (bss_end > bss_base) ? bss_end - data_end : 0;
+
+    diag_log(diag, DIAG_NORMAL, "[ARM] Emitted %d bytes (%d code + %d str + %d var) + %d bss\n",
+             code->size, code_end, str_end - code_end,
+             init_vars * ARM_VAR_SIZE, code->bss_size);
+    if (pool_words > 0)
+        diag_log(diag, DIAG_VERBOSE, "[ARM] Literal pools: %d words in the code\n",
+                 pool_words);
     return code;
 }
+
+/* =========================================================================
+ *  ELF target  (-sys linux)
+ *
+ *  Start stub, right before the user code (A32, little-endian):
+ *    EB000002    BL   user_code            ; PC+8+2*4 = stub end
+ *    E3A07001    MOV  r7, #1               ; __NR_exit (EABI)
+ *    EF000000    SVC  #0                   ; exit(r0)
+ *    EAFFFFFE    B    .                    ; never reached
+ * ========================================================================= */
+#define ARM_EF_EABI_VER5  0x05000000u
+
+static const uint8_t ARM_ELF_START_STUB[16] = {
+    0x02, 0x00, 0x00, 0xEB,
+    0x01, 0x70, 0xA0, 0xE3,
+    0x00, 0x00, 0x00, 0xEF,
+    0xFE, 0xFF, 0xFF, 0xEA
+};
+
+static const ElfTarget ARM_ELF_TARGET = {
+    ELF_CLASS32, ELF_EM_ARM, ARM_EF_EABI_VER5,
+    0x00010000,                         /* the usual ld base address   */
+    4,                                  /* A32 instructions            */
+    ARM_ELF_START_STUB, (int)sizeof(ARM_ELF_START_STUB)
+};
+
+const ElfTarget* elf_target_arm(void)
+{
+    return &ARM_ELF_TARGET;
+}
@@ -57,6 +57,7 @@
 
 #include "parser.h"
 #include "codegen.h"    /* CodeBuffer, free_code_buffer, hexdump */
+#include "emitter_elf.h" /* ElfTarget */
 
 /* =========================================================================
  *  Public API
@@ -67,10 +68,25 @@
  *   Translates the architecture-neutral UA IR into raw ARM (ARMv7-A)
  *   machine code in little-endian format.
  *   Returns a CodeBuffer that the caller must free with free_code_buffer().
+ *   `strs` is the string pool filled by parse() for this IR.
+ *   `seg_gap` is the run-time distance put between code, strings and
+ *   data (see CodeBuffer.seg_gap; 0 = packed).  Strings, VARs and
+ *   BUFFERs are addressed absolutely, with bytes[0] at run-time address
+ *   `origin` (elf_code_origin() for ELF, else 0).
  *
  *   Only R0-R7 are supported.  Unsupported opcodes cause a diagnostic
- *   on stderr followed by exit(1).
+ *   on `diag` followed by diag_fatal().
  */
-CodeBuffer* generate_arm(const Instruction *ir, int ir_count);
+CodeBuffer* generate_arm(const Instruction *ir, int ir_count,
+                         const StrPool *strs, int seg_gap, int origin,
+                         UaDiag *diag);
+
+/*
+ * elf_target_arm()
+ *   ELF description of this backend for -sys linux: ELF32, EM_ARM with
+ *   the EABI version 5 e_flags, loaded at 0x00010000.  The start stub
+ *   calls the code and passes r0 to exit(2) (EABI: number in r7).
+ */
+const ElfTarget* elf_target_arm(void);
 
 #endif /* UA_BACKEND_ARM_H */
@@ -28,8 +28,12 @@
  *  │    SDIV Xd, Xn, Xm :  sf=1 0b0011010 110 Rm 00001 1 Xn Xd       │
  *  │    MOVZ Xd, #imm16, LSL #shift :  sf=1 10 100101 hw imm16 Xd     │
  *  │    MOVK Xd, #imm16, LSL #shift :  sf=1 11 100101 hw imm16 Xd     │
+ *  │    MOVN Xd, #imm16, LSL #shift :  sf=1 00 100101 hw imm16 Xd     │
  *  │    LDR  Xd, [Xn]  :  11 111 0 01 01 imm12=0 Xn Xd               │
  *  │    STR  Xd, [Xn]  :  11 111 0 01 00 imm12=0 Xn Xd               │
+ *  │    LDR  Xd, label :  01 011 0 00 imm19 Xd          (literal)     │
+ *  │    ADR  Xd, label :  0 immlo 10000 immhi Xd        (±1 MiB)      │
+ *  │    ADRP Xd, label :  1 immlo 10000 immhi Xd        (±4 GiB)      │
  *  │    B    #imm26     :  000101 imm26                                 │
  *  │    BL   #imm26     :  100101 imm26                                 │
  *  │    B.cond #imm19   :  01010100 imm19 0 cond                       │
@@ -50,6 +54,7 @@
  */
 
 #include "backend_arm64.h"
+#include "regalloc.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -88,18 +93,19 @@ static const char* A64_REG_NAME[A64_MAX_REG] = {
 /* =========================================================================
  *  Error helpers
  * ========================================================================= */
-static void a64_error(const Instruction *inst, const char *msg)
+static void a64_error(UaDiag *diag, const Instruction *inst,
+                      const char *msg)
 {
-    fprintf(stderr,
-            "\n"
-            "  UA ARM64 Backend Error\n"
-            "  -----------------------\n"
-            "  Line %d, Column %d: %s\n\n",
-            inst->line, inst->column, msg);
-    exit(1);
+    diag_printf(diag,
+                "\n"
+                "  UA ARM64 Backend Error\n"
+                "  -----------------------\n"
+                "  %s, Line %d, Column %d: %s\n\n",
+                inst->file, inst->line, inst->column, msg);
+    diag_fatal(diag);
 }
 
-static void a64_validate_register(const Instruction *inst, int reg)
+static void a64_validate_register(UaDiag *diag, const Instruction *inst, int reg)
 {
     if (reg < 0 || reg >= A64_MAX_REG) {
         char msg[256];
@@ -107,7 +113,7 @@ static void a64_validate_register(const Instruction *inst, int reg)
                  "register R%d is not mapped in the ARM64 backend "
                  "(supports R0-R7: X0-X7)",
                  reg);
-        a64_error(inst, msg);
+        a64_error(diag, inst, msg);
     }
 }
 
@@ -116,10 +122,7 @@ static void a64_validate_register(const Instruction *inst, int reg)
  * ========================================================================= */
 static void emit_a64(CodeBuffer *buf, uint32_t word)
 {
-    emit_byte(buf, (uint8_t)( word        & 0xFF));
-    emit_byte(buf, (uint8_t)((word >>  8) & 0xFF));
-    emit_byte(buf, (uint8_t)((word >> 16) & 0xFF));
-    emit_byte(buf, (uint8_t)((word >> 24) & 0xFF));
+    emit_le32(buf, word);
 }
 
 /* =========================================================================
@@ -321,6 +324,61 @@ static void emit_a64_movk(CodeBuffer *buf, uint8_t rd, uint16_t imm16,
     emit_a64(buf, word);
 }
 
+/* --- MOVN Xd, #imm16, LSL #shift  (move wide with NOT) ---------------- */
+static void emit_a64_movn(CodeBuffer *buf, uint8_t rd, uint16_t imm16,
+                            uint8_t shift)
+{
+    uint8_t hw = shift / 16;
+    uint32_t word = (1u << 31)           /* sf=1 */
+                  | (0u << 29)           /* opc=00 (MOVN) */
+                  | (0x25u << 23)        /* 100101 */
+                  | ((uint32_t)(hw & 0x3) << 21)
+                  | ((uint32_t)imm16 << 5)
+                  | ((uint32_t)(rd & 0x1F));
+    emit_a64(buf, word);
+}
+
+/* --- Load a full 64-bit immediate into Xd ----------------------------- */
+/*     Starts from all-zeros (MOVZ) or all-ones (MOVN), whichever leaves  */
+/*     fewer halfwords to fill in with MOVK.  Returns the instruction     */
+/*     count (1-4); pass buf = NULL to size without emitting.            */
+static int a64_load_imm64(CodeBuffer *buf, uint8_t rd, int64_t imm)
+{
+    uint64_t val = (uint64_t)imm;
+    int zeros = 0, ones = 0;
+    for (int k = 0; k < 4; k++) {
+        uint16_t hw = (uint16_t)(val >> (16 * k));
+        if (hw == 0x0000) zeros++;
+        if (hw == 0xFFFF) ones++;
+    }
+    int      use_movn = ones > zeros;
+    uint16_t fill     = use_movn ? 0xFFFF : 0x0000;
+
+    int n = 0;
+    for (int k = 0; k < 4; k++) {
+        uint16_t hw = (uint16_t)(val >> (16 * k));
+        if (hw == fill) continue;
+        if (buf) {
+            if (n > 0)
+                emit_a64_movk(buf, rd, hw, (uint8_t)(16 * k));
+            else if (use_movn)
+                emit_a64_movn(buf, rd, (uint16_t)~hw, (uint8_t)(16 * k));
+            else
+                emit_a64_movz(buf, rd, hw, (uint8_t)(16 * k));
+        }
+        n++;
+    }
+    if (n == 0) {
+        /* 0 or -1: a single MOVZ #0 / MOVN #0 */
+        if (buf) {
+            if (use_movn) emit_a64_movn(buf, rd, 0, 0);
+            else          emit_a64_movz(buf, rd, 0, 0);
+        }
+        n = 1;
+    }
+    return n;
+}
+
 /* --- Load a full 32-bit immediate into Xd ----------------------------- */
 /*     Uses MOVZ for low 16 bits, MOVK for high 16 bits if needed.       */
 static void emit_a64_load_imm32(CodeBuffer *buf, uint8_t rd, int32_t imm)
@@ -472,6 +530,62 @@ static void emit_a64_str(CodeBuffer *buf, uint8_t rt, uint8_t rn)
     emit_a64(buf, word);
 }
 
+/* --- LDR Xd, [Xn, #off]  (unsigned offset, off = 0..32760, 8-aligned) - */
+static void emit_a64_ldr_off(CodeBuffer *buf, uint8_t rd, uint8_t rn,
+                             uint16_t off)
+{
+    uint32_t word = (0xF9400000u)
+         | ((uint32_t)(off >> 3) << 10)
+         | ((uint32_t)(rn & 0x1F) << 5)
+         | ((uint32_t)(rd & 0x1F));
+    emit_a64(buf, word);
+}
+
+/* --- STR Xd, [Xn, #off]  (unsigned offset, off = 0..32760, 8-aligned) - */
+static void emit_a64_str_off(CodeBuffer *buf, uint8_t rt, uint8_t rn,
+                             uint16_t off)
+{
+    uint32_t word = (0xF9000000u)
+         | ((uint32_t)(off >> 3) << 10)
+         | ((uint32_t)(rn & 0x1F) << 5)
+         | ((uint32_t)(rt & 0x1F));
+    emit_a64(buf, word);
+}
+
+/* --- LDR Xd, label  (literal, PC-relative, ±1 MiB, word-aligned) ------ */
+/* Encoding: 01 011 0 00 imm19 Rt                                         */
+static void emit_a64_ldr_literal(CodeBuffer *buf, uint8_t rd, int32_t offset)
+{
+    uint32_t word = (0x58000000u)
+                  | (((uint32_t)(offset >> 2) & 0x7FFFF) << 5)
+                  | ((uint32_t)(rd & 0x1F));
+    emit_a64(buf, word);
+}
+
+/* --- ADR Xd, label  (PC-relative address, ±1 MiB) --------------------- */
+/* Encoding: 0 immlo(2) 10000 immhi(19) Rd                                */
+static void emit_a64_adr(CodeBuffer *buf, uint8_t rd, int32_t offset)
+{
+    uint32_t imm = (uint32_t)offset & 0x1FFFFF;
+    uint32_t word = (0x10000000u)
+                  | ((imm & 0x3) << 29)
+                  | ((imm >> 2) << 5)
+                  | ((uint32_t)(rd & 0x1F));
+    emit_a64(buf, word);
+}
+
+/* --- ADRP Xd, label  (address of the 4 KiB page, ±4 GiB) -------------- */
+/* Encoding: 1 immlo(2) 10000 immhi(19) Rd   — offset in pages            */
+static void emit_a64_adrp(CodeBuffer *buf, uint8_t rd, int32_t pages)
+{
+    uint32_t imm = (uint32_t)pages & 0x1FFFFF;
+    uint32_t word = (0x90000000u)
+                  | ((imm & 0x3) << 29)
+                  | ((imm >> 2) << 5)
+                  | ((uint32_t)(rd & 0x1F));
+    emit_a64(buf, word);
+}
+
 /* --- STR Xd, [SP, #-16]!  (pre-index, decrement SP) --- PUSH ---------- */
 /* Encoding: 11 111 0 00 00 0 imm9 11 Rn Rt  (pre-indexed)              */
 static void emit_a64_push(CodeBuffer *buf, uint8_t rt)
@@ -564,10 +678,7 @@ static void emit_a64_svc(CodeBuffer *buf, uint16_t imm16)
 /* --- Branch placeholder (4 bytes, will be patched) --------------------- */
 static void emit_a64_placeholder(CodeBuffer *buf)
 {
-    emit_byte(buf, 0x00);
-    emit_byte(buf, 0x00);
-    emit_byte(buf, 0x00);
-    emit_byte(buf, 0x00);
+    emit_le32(buf, 0);
 }
 
 static void patch_a64_word(CodeBuffer *buf, int offset, uint32_t word)
@@ -579,96 +690,52 @@ static void patch_a64_word(CodeBuffer *buf, int offset, uint32_t word)
 }
 
 /* =========================================================================
- *  Symbol table for labels
+ *  Branch / data fixups  (labels live in the shared SymbolTable)
  * ========================================================================= */
-#define A64_MAX_SYMBOLS  256
-#define A64_MAX_FIXUPS   256
-
-typedef struct {
-    char name[UA_MAX_LABEL_LEN];
-    int  address;
-} A64Symbol;
-
 /* Fixup types */
 #define A64_FIXUP_B       0   /* Unconditional branch (B) */
 #define A64_FIXUP_BL      1   /* Branch with link (BL) */
 #define A64_FIXUP_BCOND   2   /* Conditional branch (B.cond) */
 
 typedef struct {
-    char    label[UA_MAX_LABEL_LEN];
+    const char *label;      /* interned in the SymbolTable               */
     int     patch_offset;     /* offset into CodeBuffer where instr lives  */
     int     instr_addr;       /* byte address of the branch instruction    */
-    int     line;
+    const Instruction *inst; /* file and line for error messages */
     int     fixup_type;       /* A64_FIXUP_B / BL / BCOND */
     uint8_t cond;             /* condition code for BCOND */
 } A64Fixup;
 
-typedef struct {
-    A64Symbol symbols[A64_MAX_SYMBOLS];
-    int       sym_count;
-    A64Fixup  fixups[A64_MAX_FIXUPS];
-    int       fix_count;
-} A64SymTab;
-
-static void a64_symtab_init(A64SymTab *st)
+static void a64_add_fixup(SymbolTable *st, FixupVec *fixups,
+                          const char *label, int patch_offset,
+                          int instr_addr, const Instruction *inst,
+                          int fixup_type, uint8_t cond)
 {
-    st->sym_count = 0;
-    st->fix_count = 0;
-}
-
-static void a64_symtab_add(A64SymTab *st, const char *name, int address)
-{
-    if (st->sym_count >= A64_MAX_SYMBOLS) {
-        fprintf(stderr, "ARM64: symbol table overflow\n");
-        exit(1);
-    }
-    strncpy(st->symbols[st->sym_count].name, name, UA_MAX_LABEL_LEN - 1);
-    st->symbols[st->sym_count].name[UA_MAX_LABEL_LEN - 1] = '\0';
-    st->symbols[st->sym_count].address = address;
-    st->sym_count++;
-}
-
-static int a64_symtab_lookup(const A64SymTab *st, const char *name)
-{
-    for (int i = 0; i < st->sym_count; i++) {
-        if (strcmp(st->symbols[i].name, name) == 0)
-            return st->symbols[i].address;
-    }
-    return -1;
-}
-
-static void a64_add_fixup(A64SymTab *st, const char *label,
-                           int patch_offset, int instr_addr, int line,
-                           int fixup_type, uint8_t cond)
-{
-    if (st->fix_count >= A64_MAX_FIXUPS) {
-        fprintf(stderr, "ARM64: fixup table overflow\n");
-        exit(1);
-    }
-    A64Fixup *f = &st->fixups[st->fix_count++];
-    strncpy(f->label, label, UA_MAX_LABEL_LEN - 1);
-    f->label[UA_MAX_LABEL_LEN - 1] = '\0';
+    A64Fixup *f = (A64Fixup *)fixvec_push(fixups);
+    f->label        = symtab_intern(st, label);
     f->patch_offset = patch_offset;
     f->instr_addr   = instr_addr;
-    f->line         = line;
+    f->inst         = inst;
     f->fixup_type   = fixup_type;
     f->cond         = cond;
 }
 
 /* =========================================================================
  *  instruction_size_a64()  —  compute byte size of each instruction
+ *
+ *  `var_reg` is non-zero for a GET/SET whose VAR lives in a register.
+ *  `far` is non-zero when some data lies beyond ADR's ±1 MiB reach, so
+ *  GET and LDS take the ADRP forms (see "PC-relative data addressing").
  * ========================================================================= */
-static int instruction_size_a64(const Instruction *inst)
+static int instruction_size_a64(const Instruction *inst, int var_reg,
+                                int far)
 {
     if (inst->is_label) return 0;
 
     switch (inst->opcode) {
-        case OP_LDI: {
-            int32_t imm = (int32_t)inst->operands[1].data.imm;
-            uint32_t val = (uint32_t)imm;
-            if ((val >> 16) == 0) return 4;  /* MOVZ only */
-            return 8;  /* MOVZ + MOVK */
-        }
+        case OP_LDI:
+            /* MOVZ/MOVN + up to 3 MOVK */
+            return 4 * a64_load_imm64(NULL, 0, inst->operands[1].data.imm);
         case OP_MOV:    return 4;
         case OP_LOAD:   return 4;
         case OP_STORE:  return 4;
@@ -731,17 +798,26 @@ static int instruction_size_a64(const Instruction *inst)
         case OP_VAR:    return 0;
         case OP_BUFFER: return 0;
         case OP_SET:
-            /* SET name, Rs  -> MOVZ+MOVK X9,addr(8) + STR Rs,[X9](4) = 12 */
-            if (inst->operands[1].type == OPERAND_REGISTER) return 12;
-            /* SET name, imm -> MOVZ+MOVK X10,imm(8) + MOVZ+MOVK X9,addr(8)
-             *                + STR X10,[X9](4) = 20 */
-            return 20;
+            /* In a register: MOV Xv, Rs (4) / MOVZ [+ MOVK] Xv, imm */
+            if (var_reg) {
+                if (inst->operands[1].type == OPERAND_REGISTER) return 4;
+                return 4 * a64_load_imm64(NULL, 0,
+                           (int64_t)(uint32_t)inst->operands[1].data.imm);
+            }
+            /* SET name, Rs  -> ADR/ADRP X9 + STR Rs,[X9,#lo] = 8 */
+            if (inst->operands[1].type == OPERAND_REGISTER) return 8;
+            /* SET name, imm -> MOVZ/MOVN [+ MOVK] X10,imm + ADR/ADRP X9
+             *                + STR X10,[X9,#lo] */
+            return 4 * a64_load_imm64(NULL, 0,
+                       (int64_t)(uint32_t)inst->operands[1].data.imm) + 8;
         case OP_GET:
-            /* GET Rd, name -> MOVZ+MOVK X9,addr(8) + LDR Rd,[X9](4) = 12 */
-            return 12;
+            /* GET Rd, name -> LDR Rd,=name (4)  |  ADRP + LDR (8)
+             * GET Rd, buf  -> ADR Rd, buf  (4)  |  ADRP + ADD (8)
+             * In a register: MOV Rd, Xv (4)                            */
+            return (var_reg || !far) ? 4 : 8;
 
         /* ---- New Phase-8 instructions --------------------------------- */
-        case OP_LDS:    return 8;   /* MOVZ+MOVK Xd, addr (load string ptr) */
+        case OP_LDS:    return far ? 8 : 4;   /* ADR | ADRP+ADD Xd, str */
         case OP_LOADB:  return 4;   /* LDRB Wd, [Xn]  */
         case OP_STOREB: return 4;   /* STRB Wt, [Xn]  */
         case OP_SYS:    return 8;   /* MOV X8,X7 + SVC #0 */
@@ -799,16 +875,17 @@ static void a64_buftab_init(A64BufTable *bt) {
     bt->total_size = 0;
 }
 
-static int a64_buftab_add(A64BufTable *bt, const char *name, int size) {
+static int a64_buftab_add(A64BufTable *bt, const char *name, int size,
+                          UaDiag *diag) {
     for (int i = 0; i < bt->count; i++) {
         if (strcmp(bt->bufs[i].name, name) == 0) {
-            fprintf(stderr, "ARM64: duplicate buffer '%s'\n", name);
+            diag_printf(diag, "ARM64: duplicate buffer '%s'\n", name);
             return -1;
         }
     }
     if (bt->count >= A64_MAX_BUFS) {
-        fprintf(stderr, "ARM64: buffer table overflow (max %d)\n",
-                A64_MAX_BUFS);
+        diag_printf(diag, "ARM64: buffer table overflow (max %d)\n",
+                    A64_MAX_BUFS);
         return -1;
     }
     A64BufEntry *b = &bt->bufs[bt->count++];
@@ -848,12 +925,13 @@ static void a64_strtab_init(A64StringTable *st) {
     st->total_size = 0;
 }
 
-static int a64_strtab_add(A64StringTable *st, const char *text) {
+static int a64_strtab_add(A64StringTable *st, const char *text,
+                          UaDiag *diag) {
     for (int i = 0; i < st->count; i++)
         if (strcmp(st->strings[i].text, text) == 0) return i;
     if (st->count >= A64_MAX_STRINGS) {
-        fprintf(stderr, "ARM64: string table overflow (max %d)\n",
-                A64_MAX_STRINGS);
+        diag_printf(diag, "ARM64: string table overflow (max %d)\n",
+                    A64_MAX_STRINGS);
         return 0;
     }
     int idx = st->count++;
@@ -866,17 +944,18 @@ static int a64_strtab_add(A64StringTable *st, const char *text) {
 }
 
 static int a64_vartab_add(A64VarTable *vt, const char *name,
-                           int64_t init_value, int has_init)
+                           int64_t init_value, int has_init,
+                           UaDiag *diag)
 {
     for (int i = 0; i < vt->count; i++) {
         if (strcmp(vt->vars[i].name, name) == 0) {
-            fprintf(stderr, "ARM64: duplicate variable '%s'\n", name);
+            diag_printf(diag, "ARM64: duplicate variable '%s'\n", name);
             return -1;
         }
     }
     if (vt->count >= A64_MAX_VARS) {
-        fprintf(stderr, "ARM64: variable table overflow (max %d)\n",
-                A64_MAX_VARS);
+        diag_printf(diag, "ARM64: variable table overflow (max %d)\n",
+                    A64_MAX_VARS);
         return -1;
     }
     A64VarEntry *v = &vt->vars[vt->count++];
@@ -887,17 +966,92 @@ static int a64_vartab_add(A64VarTable *vt, const char *name,
     return 0;
 }
 
+/* =========================================================================
+ *  VAR register pool (-O2)  —  X11-X15, caller-saved temporaries that
+ *  the R0-R7 mapping, the X9/X10 scratch pair and SYS (X8) never touch.
+ * ========================================================================= */
+static const uint8_t A64_VAR_POOL[] = { 11, 12, 13, 14, 15 };
+static const char *const A64_VAR_POOL_NAME[] = {
+    "X11", "X12", "X13", "X14", "X15"
+};
+
+/* Load the initial value of every entry-live register VAR; returns size */
+static int a64_var_prologue(CodeBuffer *code, const RegAlloc *ra,
+                            const StrPool *strs, UaDiag *diag)
+{
+    int size = 0;
+    if (!ra) return 0;
+    for (int v = 0; v < ra->var_count; v++) {
+        const RegAllocVar *rv = &ra->vars[v];
+        if (rv->reg < 0 || !rv->live_in) continue;
+        if (code) {
+            diag_trace(diag, "  (entry) %s -> MOVZ/MOVN %s, #%lld\n",
+                       strpool_get(strs, rv->name), A64_VAR_POOL_NAME[rv->slot],
+                       (long long)rv->init);
+        }
+        size += 4 * a64_load_imm64(code, (uint8_t)rv->reg, rv->init);
+    }
+    return size;
+}
+
+/* =========================================================================
+ *  PC-relative data addressing
+ * =========================================================================
+ *  Strings, VARs and BUFFERs are reached from the instruction that uses
+ *  them, so the code does not depend on where the image is loaded and
+ *  data may sit above 4 GiB (Mach-O maps its image there):
+ *
+ *    near  (whole image within ±1 MiB)     far  (±4 GiB)
+ *    LDR  Xd, var          GET             ADRP Xd, var; LDR Xd, [Xd, #lo]
+ *    ADR  Xd, buf / str    GET, LDS        ADRP Xd, x;   ADD Xd, Xd, #lo
+ *    ADR  X9, var          SET             ADRP X9, var
+ *    STR  Rs, [X9]                         STR  Rs, [X9, #lo]
+ *
+ *  ADR and LDR (literal) only need the distance to the data.  ADRP works
+ *  on 4 KiB pages, so the far forms also need the image to be loaded at
+ *  `origin` modulo a page, which holds for ELF, the JIT and flat images.
+ * ========================================================================= */
+#define A64_ADR_RANGE  (1 << 20)
+
+/* ADRP Xd, target — returns target's offset within its page */
+static uint16_t a64_emit_page(CodeBuffer *code, uint8_t rd, int target,
+                              int origin)
+{
+    int pc = origin + code->size;
+    emit_a64_adrp(code, rd, (target >> 12) - (pc >> 12));
+    return (uint16_t)(target & 0xFFF);
+}
+
+/* Xd = target:  ADR  |  ADRP + ADD */
+static void a64_emit_addr(CodeBuffer *code, uint8_t rd, int target,
+                          int origin, int far)
+{
+    if (!far) {
+        emit_a64_adr(code, rd, target - (origin + code->size));
+        return;
+    }
+    uint16_t lo = a64_emit_page(code, rd, target, origin);
+    emit_a64_add_imm(code, rd, rd, lo);
+}
+
 /* =========================================================================
  *  generate_arm64()  —  main entry point  (two-pass)
  * ========================================================================= */
-CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
+CodeBuffer* generate_arm64(const Instruction *ir, int ir_count,
+                           const StrPool *strs, int alloc_vars,
+                           int seg_gap, int origin,
+                           UaDiag *diag)
 {
-    fprintf(stderr, "[ARM64] Generating code for %d IR instructions ...\n",
-            ir_count);
+    diag_log(diag, DIAG_NORMAL, "[ARM64] Generating code for %d IR instructions ...\n",
+             ir_count);
 
     /* --- Pass 1: collect label addresses + variable declarations ------- */
-    A64SymTab symtab;
-    a64_symtab_init(&symtab);
+    SymbolTable symtab;
+    symtab_init(&symtab, diag);
+    diag_own(diag, &symtab, symtab_drop);
+    FixupVec fixups;
+    fixvec_init(&fixups, sizeof(A64Fixup), diag);
+    diag_own(diag, &fixups, fixvec_drop);
 
     A64VarTable vartab;
     a64_vartab_init(&vartab);
@@ -908,66 +1062,135 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
     A64StringTable strtab;
     a64_strtab_init(&strtab);
 
-    int pc = 0;
-    for (int i = 0; i < ir_count; i++) {
-        const Instruction *inst = &ir[i];
-        if (inst->is_label) {
-            a64_symtab_add(&symtab, inst->label_name, pc);
-        } else if (inst->opcode == OP_VAR) {
-            const char *vname = inst->operands[0].data.label;
-            int64_t init_val  = 0;
-            int     has_init  = 0;
-            if (inst->operand_count >= 2 &&
-                inst->operands[1].type == OPERAND_IMMEDIATE) {
-                init_val = inst->operands[1].data.imm;
-                has_init = 1;
-            }
-            a64_vartab_add(&vartab, vname, init_val, has_init);
-        } else if (inst->opcode == OP_BUFFER) {
-            const char *bname = inst->operands[0].data.label;
-            int bsize = (int)inst->operands[1].data.imm;
-            a64_buftab_add(&buftab, bname, bsize);
-        } else if (inst->opcode == OP_ORG) {
-            uint32_t target = (uint32_t)inst->operands[0].data.imm;
-            if ((int)target < pc) {
-                fprintf(stderr, "Error: @ORG 0x%X would move address "
-                        "backwards (current PC = 0x%X)\n",
-                        target, (unsigned)pc);
-                exit(1);
-            }
-            pc = (int)target;
-        } else {
-            if (inst->opcode == OP_LDS)
-                a64_strtab_add(&strtab, inst->operands[1].data.string);
-            pc += instruction_size_a64(inst);
+    /* -O2: keep VARs in spare registers where liveness allows */
+    RegAlloc  regalloc;
+    RegAlloc *ra = NULL;
+    if (alloc_vars) {
+        RegPool pool = { A64_VAR_POOL, A64_VAR_POOL_NAME,
+                         (int)sizeof(A64_VAR_POOL), 0 };
+        if (regalloc_run(&regalloc, ir, ir_count, strs, &pool) == 0) {
+            diag_own(diag, &regalloc, regalloc_drop);
+            regalloc_print(&regalloc, strs, &pool, diag);
+            ra = &regalloc;
         }
     }
 
-    /* Register variable symbols */
-    int var_base = pc;
-    for (int v = 0; v < vartab.count; v++) {
-        a64_symtab_add(&symtab, vartab.vars[v].name,
-                       var_base + v * A64_VAR_SIZE);
-    }
+    /* Pass 1 is run again with the far data forms if the image turns
+     * out too large for ADR / LDR (literal) */
+    int far = 0;
+    int pc, code_end, init_vars, str_base, str_end;
+    int var_base, data_end, bss_base, buf_base;
+    for (;;) {
+        pc = a64_var_prologue(NULL, ra, strs, diag);
+        for (int i = 0; i < ir_count; i++) {
+            const Instruction *inst = &ir[i];
+            if (inst->is_label) {
+                symtab_add(&symtab, strpool_get(strs, inst->label_id), pc);
+            } else if (inst->opcode == OP_VAR) {
+                const char *vname = strpool_get(strs, inst->operands[0].data.label_id);
+                int64_t init_val  = 0;
+                int     has_init  = 0;
+                if (inst->operand_count >= 2 &&
+                    inst->operands[1].type == OPERAND_IMMEDIATE) {
+                    init_val = inst->operands[1].data.imm;
+                    has_init = 1;
+                }
+                a64_vartab_add(&vartab, vname, init_val, has_init, diag);
+            } else if (inst->opcode == OP_BUFFER) {
+                const char *bname = strpool_get(strs, inst->operands[0].data.label_id);
+                int bsize = (int)inst->operands[1].data.imm;
+                a64_buftab_add(&buftab, bname, bsize, diag);
+            } else if (inst->opcode == OP_ORG) {
+                uint32_t target = (uint32_t)inst->operands[0].data.imm;
+                if ((int)target < pc) {
+                    diag_printf(diag, "Error: @ORG 0x%X would move address "
+                                "backwards (current PC = 0x%X)\n",
+                                target, (unsigned)pc);
+                    diag_fatal(diag);
+                }
+                pc = (int)target;
+            } else {
+                if (inst->opcode == OP_LDS)
+                    a64_strtab_add(&strtab, strpool_get(strs, inst->operands[1].data.string_id),
+                                   diag);
+                pc += instruction_size_a64(inst, regalloc_inst_reg(ra, i) >= 0,
+                                          far);
+            }
+        }
 
-    /* Register buffer symbols */
-    int buf_base = var_base + vartab.count * A64_VAR_SIZE;
+        /* Data after the code, stored in bytes[] back to back:
+         *   [strings][pad to a VAR boundary]               read-only
+         *   [initialised VARs]                             writable
+         *   [uninitialised VARs][BUFFERs]                  bss (size only)
+         * Each part after the code is addressed seg_gap further on, so a
+         * container can map code, strings and data as separate segments.
+         * The bss starts on a VAR boundary; the emitter maps it as
+         * zero-filled memory.  Addresses count from `origin`, the run-time
+         * address of bytes[0]. */
+        code_end  = pc;
+        init_vars = 0;
+        for (int v = 0; v < vartab.count; v++)
+            if (vartab.vars[v].has_init) init_vars++;
+        str_base = origin + code_end + seg_gap;
+        str_end  = (code_end + strtab.total_size + A64_VAR_SIZE - 1)
+                 & ~(A64_VAR_SIZE - 1);
+        var_base = origin + str_end + 2 * seg_gap;
+        data_end = var_base + init_vars * A64_VAR_SIZE;
+        bss_base = (data_end + A64_VAR_SIZE - 1) & ~(A64_VAR_SIZE - 1);
+        buf_base = bss_base + (vartab.count - init_vars) * A64_VAR_SIZE;
+
+        /* Code reaches the start of each VAR, BUFFER and string; the
+         * last BUFFER starts highest */
+        int top = buf_base;
+        if (buftab.count > 0)
+            top += buftab.total_size - buftab.bufs[buftab.count - 1].size;
+        if (far || top - origin < A64_ADR_RANGE)
+            break;
+        diag_log(diag, DIAG_VERBOSE,
+                 "[ARM64] Data beyond +-1 MiB of the code: using ADRP\n");
+        far = 1;
+        symtab_free(&symtab);
+        symtab_init(&symtab, diag);
+        a64_vartab_init(&vartab);
+        a64_buftab_init(&buftab);
+        a64_strtab_init(&strtab);
+    }
+    if (far && (var_base & (A64_VAR_SIZE - 1))) {
+        diag_printf(diag, "ARM64: VARs at 0x%X are not 8-byte aligned "
+                    "for ADRP + LDR/STR\n", (unsigned)var_base);
+        diag_fatal(diag);
+    }
     {
+        int init_idx = 0, bss_idx = 0;
+        for (int v = 0; v < vartab.count; v++) {
+            int addr = vartab.vars[v].has_init
+                     ? var_base + (init_idx++) * A64_VAR_SIZE
+                     : bss_base + (bss_idx++) * A64_VAR_SIZE;
+            symtab_add(&symtab, vartab.vars[v].name, addr);
+        }
         int buf_offset = 0;
         for (int b = 0; b < buftab.count; b++) {
-            a64_symtab_add(&symtab, buftab.bufs[b].name,
-                           buf_base + buf_offset);
+            symtab_add(&symtab, buftab.bufs[b].name,
+                       buf_base + buf_offset);
             buf_offset += buftab.bufs[b].size;
         }
     }
-    int str_base = buf_base + buftab.total_size;
 
     /* --- Pass 2: code emission ----------------------------------------- */
-    CodeBuffer *code = create_code_buffer();
+    CodeBuffer *code = create_code_buffer(diag);
     if (!code) {
-        fprintf(stderr, "UA ARM64: out of memory\n");
+        diag_printf(diag, "UA ARM64: out of memory\n");
+        if (ra) regalloc_free(ra);
+        symtab_free(&symtab);
+        fixvec_free(&fixups);
         return NULL;
     }
+    diag_own(diag, &code, codebuf_drop);
+
+    /* Pass 1 sized the code, strings and VARs: allocate them at once */
+    codebuf_reserve(code, str_end + init_vars * A64_VAR_SIZE);
+
+    a64_var_prologue(code, ra, strs, diag);
 
     for (int i = 0; i < ir_count; i++) {
         const Instruction *inst = &ir[i];
@@ -975,17 +1198,19 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
         if (inst->is_label)
             continue;
 
+        codebuf_add_line(code, inst->file, inst->line);
+
         switch (inst->opcode) {
 
-        /* ---- LDI Rd, #imm  ->  MOVZ [+ MOVK] ------------ 4-8 bytes -- */
+        /* ---- LDI Rd, #imm  ->  MOVZ/MOVN [+ MOVK ...] --- 4-16 bytes - */
         case OP_LDI: {
             int rd = inst->operands[0].data.reg;
-            int32_t imm = (int32_t)inst->operands[1].data.imm;
-            a64_validate_register(inst, rd);
+            int64_t imm = inst->operands[1].data.imm;
+            a64_validate_register(diag, inst, rd);
             uint8_t enc = A64_REG_ENC[rd];
-            fprintf(stderr, "  LDI R%d -> MOVZ %s, #%d\n",
-                    rd, A64_REG_NAME[rd], imm);
-            emit_a64_load_imm32(code, enc, imm);
+            diag_trace(diag, "  LDI R%d -> MOVZ/MOVN %s, #%lld\n",
+                       rd, A64_REG_NAME[rd], (long long)imm);
+            a64_load_imm64(code, enc, imm);
             break;
         }
 
@@ -993,10 +1218,10 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
         case OP_MOV: {
             int rd = inst->operands[0].data.reg;
             int rs = inst->operands[1].data.reg;
-            a64_validate_register(inst, rd);
-            a64_validate_register(inst, rs);
-            fprintf(stderr, "  MOV R%d, R%d -> MOV %s, %s\n",
-                    rd, rs, A64_REG_NAME[rd], A64_REG_NAME[rs]);
+            a64_validate_register(diag, inst, rd);
+            a64_validate_register(diag, inst, rs);
+            diag_trace(diag, "  MOV R%d, R%d -> MOV %s, %s\n",
+                       rd, rs, A64_REG_NAME[rd], A64_REG_NAME[rs]);
             emit_a64_mov_reg(code, A64_REG_ENC[rd], A64_REG_ENC[rs]);
             break;
         }
@@ -1005,10 +1230,10 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
         case OP_LOAD: {
             int rd = inst->operands[0].data.reg;
             int rs = inst->operands[1].data.reg;
-            a64_validate_register(inst, rd);
-            a64_validate_register(inst, rs);
-            fprintf(stderr, "  LOAD R%d, R%d -> LDR %s, [%s]\n",
-                    rd, rs, A64_REG_NAME[rd], A64_REG_NAME[rs]);
+            a64_validate_register(diag, inst, rd);
+            a64_validate_register(diag, inst, rs);
+            diag_trace(diag, "  LOAD R%d, R%d -> LDR %s, [%s]\n",
+                       rd, rs, A64_REG_NAME[rd], A64_REG_NAME[rs]);
             emit_a64_ldr(code, A64_REG_ENC[rd], A64_REG_ENC[rs]);
             break;
         }
@@ -1017,10 +1242,10 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
         case OP_STORE: {
             int rx = inst->operands[0].data.reg;
             int ry = inst->operands[1].data.reg;
-            a64_validate_register(inst, rx);
-            a64_validate_register(inst, ry);
-            fprintf(stderr, "  STORE R%d, R%d -> STR %s, [%s]\n",
-                    rx, ry, A64_REG_NAME[ry], A64_REG_NAME[rx]);
+            a64_validate_register(diag, inst, rx);
+            a64_validate_register(diag, inst, ry);
+            diag_trace(diag, "  STORE R%d, R%d -> STR %s, [%s]\n",
+                       rx, ry, A64_REG_NAME[ry], A64_REG_NAME[rx]);
             emit_a64_str(code, A64_REG_ENC[ry], A64_REG_ENC[rx]);
             break;
         }
@@ -1028,30 +1253,30 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
         /* ---- ADD Rd, Rs/imm -------------------------------- 4/4-12 --- */
         case OP_ADD: {
             int rd = inst->operands[0].data.reg;
-            a64_validate_register(inst, rd);
+            a64_validate_register(diag, inst, rd);
             uint8_t enc_d = A64_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                a64_validate_register(inst, rs);
-                fprintf(stderr, "  ADD R%d, R%d -> ADD %s, %s, %s\n",
-                        rd, rs, A64_REG_NAME[rd], A64_REG_NAME[rd],
-                        A64_REG_NAME[rs]);
+                a64_validate_register(diag, inst, rs);
+                diag_trace(diag, "  ADD R%d, R%d -> ADD %s, %s, %s\n",
+                           rd, rs, A64_REG_NAME[rd], A64_REG_NAME[rd],
+                           A64_REG_NAME[rs]);
                 emit_a64_add_reg(code, enc_d, enc_d, A64_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
                 uint32_t uval = (uint32_t)(imm < 0 ? -imm : imm);
                 if (uval <= 0xFFF) {
                     if (imm >= 0) {
-                        fprintf(stderr, "  ADD R%d, #%d\n", rd, imm);
+                        diag_trace(diag, "  ADD R%d, #%d\n", rd, imm);
                         emit_a64_add_imm(code, enc_d, enc_d, (uint16_t)imm);
                     } else {
-                        fprintf(stderr, "  ADD R%d, #%d -> SUB #%d\n",
-                                rd, imm, -imm);
+                        diag_trace(diag, "  ADD R%d, #%d -> SUB #%d\n",
+                                   rd, imm, -imm);
                         emit_a64_sub_imm(code, enc_d, enc_d, (uint16_t)(-imm));
                     }
                 } else {
-                    fprintf(stderr, "  ADD R%d, #%d -> MOVZ X9; ADD\n",
-                            rd, imm);
+                    diag_trace(diag, "  ADD R%d, #%d -> MOVZ X9; ADD\n",
+                               rd, imm);
                     emit_a64_load_imm32(code, A64_REG_SCRATCH, imm);
                     emit_a64_add_reg(code, enc_d, enc_d, A64_REG_SCRATCH);
                 }
@@ -1062,30 +1287,30 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
         /* ---- SUB Rd, Rs/imm -------------------------------- 4/4-12 --- */
         case OP_SUB: {
             int rd = inst->operands[0].data.reg;
-            a64_validate_register(inst, rd);
+            a64_validate_register(diag, inst, rd);
             uint8_t enc_d = A64_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                a64_validate_register(inst, rs);
-                fprintf(stderr, "  SUB R%d, R%d -> SUB %s, %s, %s\n",
-                        rd, rs, A64_REG_NAME[rd], A64_REG_NAME[rd],
-                        A64_REG_NAME[rs]);
+                a64_validate_register(diag, inst, rs);
+                diag_trace(diag, "  SUB R%d, R%d -> SUB %s, %s, %s\n",
+                           rd, rs, A64_REG_NAME[rd], A64_REG_NAME[rd],
+                           A64_REG_NAME[rs]);
                 emit_a64_sub_reg(code, enc_d, enc_d, A64_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
                 uint32_t uval = (uint32_t)(imm < 0 ? -imm : imm);
                 if (uval <= 0xFFF) {
                     if (imm >= 0) {
-                        fprintf(stderr, "  SUB R%d, #%d\n", rd, imm);
+                        diag_trace(diag, "  SUB R%d, #%d\n", rd, imm);
                         emit_a64_sub_imm(code, enc_d, enc_d, (uint16_t)imm);
                     } else {
-                        fprintf(stderr, "  SUB R%d, #%d -> ADD #%d\n",
-                                rd, imm, -imm);
+                        diag_trace(diag, "  SUB R%d, #%d -> ADD #%d\n",
+                                   rd, imm, -imm);
                         emit_a64_add_imm(code, enc_d, enc_d, (uint16_t)(-imm));
                     }
                 } else {
-                    fprintf(stderr, "  SUB R%d, #%d -> MOVZ X9; SUB\n",
-                            rd, imm);
+                    diag_trace(diag, "  SUB R%d, #%d -> MOVZ X9; SUB\n",
+                               rd, imm);
                     emit_a64_load_imm32(code, A64_REG_SCRATCH, imm);
                     emit_a64_sub_reg(code, enc_d, enc_d, A64_REG_SCRATCH);
                 }
@@ -1096,18 +1321,18 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
         /* ---- AND Rd, Rs/imm -------------------------------- 4/12 ----- */
         case OP_AND: {
             int rd = inst->operands[0].data.reg;
-            a64_validate_register(inst, rd);
+            a64_validate_register(diag, inst, rd);
             uint8_t enc_d = A64_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                a64_validate_register(inst, rs);
-                fprintf(stderr, "  AND R%d, R%d -> AND %s, %s, %s\n",
-                        rd, rs, A64_REG_NAME[rd], A64_REG_NAME[rd],
-                        A64_REG_NAME[rs]);
+                a64_validate_register(diag, inst, rs);
+                diag_trace(diag, "  AND R%d, R%d -> AND %s, %s, %s\n",
+                           rd, rs, A64_REG_NAME[rd], A64_REG_NAME[rd],
+                           A64_REG_NAME[rs]);
                 emit_a64_and_reg(code, enc_d, enc_d, A64_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                fprintf(stderr, "  AND R%d, #%d -> MOVZ X9; AND\n", rd, imm);
+                diag_trace(diag, "  AND R%d, #%d -> MOVZ X9; AND\n", rd, imm);
                 emit_a64_load_imm32_full(code, A64_REG_SCRATCH, imm);
                 emit_a64_and_reg(code, enc_d, enc_d, A64_REG_SCRATCH);
             }
@@ -1117,18 +1342,18 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
         /* ---- OR Rd, Rs/imm --------------------------------- 4/12 ----- */
         case OP_OR: {
             int rd = inst->operands[0].data.reg;
-            a64_validate_register(inst, rd);
+            a64_validate_register(diag, inst, rd);
             uint8_t enc_d = A64_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                a64_validate_register(inst, rs);
-                fprintf(stderr, "  OR  R%d, R%d -> ORR %s, %s, %s\n",
-                        rd, rs, A64_REG_NAME[rd], A64_REG_NAME[rd],
-                        A64_REG_NAME[rs]);
+                a64_validate_register(diag, inst, rs);
+                diag_trace(diag, "  OR  R%d, R%d -> ORR %s, %s, %s\n",
+                           rd, rs, A64_REG_NAME[rd], A64_REG_NAME[rd],
+                           A64_REG_NAME[rs]);
                 emit_a64_orr_reg(code, enc_d, enc_d, A64_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                fprintf(stderr, "  OR  R%d, #%d -> MOVZ X9; ORR\n", rd, imm);
+                diag_trace(diag, "  OR  R%d, #%d -> MOVZ X9; ORR\n", rd, imm);
                 emit_a64_load_imm32_full(code, A64_REG_SCRATCH, imm);
                 emit_a64_orr_reg(code, enc_d, enc_d, A64_REG_SCRATCH);
             }
@@ -1138,18 +1363,18 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
         /* ---- XOR Rd, Rs/imm -------------------------------- 4/12 ----- */
         case OP_XOR: {
             int rd = inst->operands[0].data.reg;
-            a64_validate_register(inst, rd);
+            a64_validate_register(diag, inst, rd);
             uint8_t enc_d = A64_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                a64_validate_register(inst, rs);
-                fprintf(stderr, "  XOR R%d, R%d -> EOR %s, %s, %s\n",
-                        rd, rs, A64_REG_NAME[rd], A64_REG_NAME[rd],
-                        A64_REG_NAME[rs]);
+                a64_validate_register(diag, inst, rs);
+                diag_trace(diag, "  XOR R%d, R%d -> EOR %s, %s, %s\n",
+                           rd, rs, A64_REG_NAME[rd], A64_REG_NAME[rd],
+                           A64_REG_NAME[rs]);
                 emit_a64_eor_reg(code, enc_d, enc_d, A64_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                fprintf(stderr, "  XOR R%d, #%d -> MOVZ X9; EOR\n", rd, imm);
+                diag_trace(diag, "  XOR R%d, #%d -> MOVZ X9; EOR\n", rd, imm);
                 emit_a64_load_imm32_full(code, A64_REG_SCRATCH, imm);
                 emit_a64_eor_reg(code, enc_d, enc_d, A64_REG_SCRATCH);
             }
@@ -1159,9 +1384,9 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
         /* ---- NOT Rd  ->  MVN Xd, Xd ------------------------ 4 bytes -- */
         case OP_NOT: {
             int rd = inst->operands[0].data.reg;
-            a64_validate_register(inst, rd);
-            fprintf(stderr, "  NOT R%d -> MVN %s, %s\n",
-                    rd, A64_REG_NAME[rd], A64_REG_NAME[rd]);
+            a64_validate_register(diag, inst, rd);
+            diag_trace(diag, "  NOT R%d -> MVN %s, %s\n",
+                       rd, A64_REG_NAME[rd], A64_REG_NAME[rd]);
             emit_a64_mvn(code, A64_REG_ENC[rd], A64_REG_ENC[rd]);
             break;
         }
@@ -1169,9 +1394,9 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
         /* ---- INC Rd  ->  ADD Xd, Xd, #1 -------------------- 4 bytes -- */
         case OP_INC: {
             int rd = inst->operands[0].data.reg;
-            a64_validate_register(inst, rd);
-            fprintf(stderr, "  INC R%d -> ADD %s, %s, #1\n",
-                    rd, A64_REG_NAME[rd], A64_REG_NAME[rd]);
+            a64_validate_register(diag, inst, rd);
+            diag_trace(diag, "  INC R%d -> ADD %s, %s, #1\n",
+                       rd, A64_REG_NAME[rd], A64_REG_NAME[rd]);
             emit_a64_add_imm(code, A64_REG_ENC[rd], A64_REG_ENC[rd], 1);
             break;
         }
@@ -1179,9 +1404,9 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
         /* ---- DEC Rd  ->  SUB Xd, Xd, #1 -------------------- 4 bytes -- */
         case OP_DEC: {
             int rd = inst->operands[0].data.reg;
-            a64_validate_register(inst, rd);
-            fprintf(stderr, "  DEC R%d -> SUB %s, %s, #1\n",
-                    rd, A64_REG_NAME[rd], A64_REG_NAME[rd]);
+            a64_validate_register(diag, inst, rd);
+            diag_trace(diag, "  DEC R%d -> SUB %s, %s, #1\n",
+                       rd, A64_REG_NAME[rd], A64_REG_NAME[rd]);
             emit_a64_sub_imm(code, A64_REG_ENC[rd], A64_REG_ENC[rd], 1);
             break;
         }
@@ -1189,18 +1414,18 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
         /* ---- MUL Rd, Rs/imm  ->  MUL Xd, Xd, Xm ------ 4/12 bytes --- */
         case OP_MUL: {
             int rd = inst->operands[0].data.reg;
-            a64_validate_register(inst, rd);
+            a64_validate_register(diag, inst, rd);
             uint8_t enc_d = A64_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                a64_validate_register(inst, rs);
-                fprintf(stderr, "  MUL R%d, R%d -> MUL %s, %s, %s\n",
-                        rd, rs, A64_REG_NAME[rd], A64_REG_NAME[rd],
-                        A64_REG_NAME[rs]);
+                a64_validate_register(diag, inst, rs);
+                diag_trace(diag, "  MUL R%d, R%d -> MUL %s, %s, %s\n",
+                           rd, rs, A64_REG_NAME[rd], A64_REG_NAME[rd],
+                           A64_REG_NAME[rs]);
                 emit_a64_mul(code, enc_d, enc_d, A64_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                fprintf(stderr, "  MUL R%d, #%d -> MOVZ X9; MUL\n", rd, imm);
+                diag_trace(diag, "  MUL R%d, #%d -> MOVZ X9; MUL\n", rd, imm);
                 emit_a64_load_imm32_full(code, A64_REG_SCRATCH, imm);
                 emit_a64_mul(code, enc_d, enc_d, A64_REG_SCRATCH);
             }
@@ -1210,18 +1435,18 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
         /* ---- DIV Rd, Rs/imm  ->  SDIV Xd, Xd, Xm ---- 4/12 bytes ---- */
         case OP_DIV: {
             int rd = inst->operands[0].data.reg;
-            a64_validate_register(inst, rd);
+            a64_validate_register(diag, inst, rd);
             uint8_t enc_d = A64_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                a64_validate_register(inst, rs);
-                fprintf(stderr, "  DIV R%d, R%d -> SDIV %s, %s, %s\n",
-                        rd, rs, A64_REG_NAME[rd], A64_REG_NAME[rd],
-                        A64_REG_NAME[rs]);
+                a64_validate_register(diag, inst, rs);
+                diag_trace(diag, "  DIV R%d, R%d -> SDIV %s, %s, %s\n",
+                           rd, rs, A64_REG_NAME[rd], A64_REG_NAME[rd],
+                           A64_REG_NAME[rs]);
                 emit_a64_sdiv(code, enc_d, enc_d, A64_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                fprintf(stderr, "  DIV R%d, #%d -> MOVZ X9; SDIV\n", rd, imm);
+                diag_trace(diag, "  DIV R%d, #%d -> MOVZ X9; SDIV\n", rd, imm);
                 emit_a64_load_imm32_full(code, A64_REG_SCRATCH, imm);
                 emit_a64_sdiv(code, enc_d, enc_d, A64_REG_SCRATCH);
             }
@@ -1231,19 +1456,19 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
         /* ---- SHL Rd, Rs/imm -------------------------------- 4 bytes -- */
         case OP_SHL: {
             int rd = inst->operands[0].data.reg;
-            a64_validate_register(inst, rd);
+            a64_validate_register(diag, inst, rd);
             uint8_t enc_d = A64_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_IMMEDIATE) {
                 uint8_t shamt = (uint8_t)(inst->operands[1].data.imm & 0x3F);
-                fprintf(stderr, "  SHL R%d, #%d -> LSL %s, %s, #%d\n",
-                        rd, shamt, A64_REG_NAME[rd], A64_REG_NAME[rd], shamt);
+                diag_trace(diag, "  SHL R%d, #%d -> LSL %s, %s, #%d\n",
+                           rd, shamt, A64_REG_NAME[rd], A64_REG_NAME[rd], shamt);
                 emit_a64_lsl_imm(code, enc_d, enc_d, shamt);
             } else {
                 int rs = inst->operands[1].data.reg;
-                a64_validate_register(inst, rs);
-                fprintf(stderr, "  SHL R%d, R%d -> LSLV %s, %s, %s\n",
-                        rd, rs, A64_REG_NAME[rd], A64_REG_NAME[rd],
-                        A64_REG_NAME[rs]);
+                a64_validate_register(diag, inst, rs);
+                diag_trace(diag, "  SHL R%d, R%d -> LSLV %s, %s, %s\n",
+                           rd, rs, A64_REG_NAME[rd], A64_REG_NAME[rd],
+                           A64_REG_NAME[rs]);
                 emit_a64_lslv(code, enc_d, enc_d, A64_REG_ENC[rs]);
             }
             break;
@@ -1252,19 +1477,19 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
         /* ---- SHR Rd, Rs/imm -------------------------------- 4 bytes -- */
         case OP_SHR: {
             int rd = inst->operands[0].data.reg;
-            a64_validate_register(inst, rd);
+            a64_validate_register(diag, inst, rd);
             uint8_t enc_d = A64_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_IMMEDIATE) {
                 uint8_t shamt = (uint8_t)(inst->operands[1].data.imm & 0x3F);
-                fprintf(stderr, "  SHR R%d, #%d -> LSR %s, %s, #%d\n",
-                        rd, shamt, A64_REG_NAME[rd], A64_REG_NAME[rd], shamt);
+                diag_trace(diag, "  SHR R%d, #%d -> LSR %s, %s, #%d\n",
+                           rd, shamt, A64_REG_NAME[rd], A64_REG_NAME[rd], shamt);
                 emit_a64_lsr_imm(code, enc_d, enc_d, shamt);
             } else {
                 int rs = inst->operands[1].data.reg;
-                a64_validate_register(inst, rs);
-                fprintf(stderr, "  SHR R%d, R%d -> LSRV %s, %s, %s\n",
-                        rd, rs, A64_REG_NAME[rd], A64_REG_NAME[rd],
-                        A64_REG_NAME[rs]);
+                a64_validate_register(diag, inst, rs);
+                diag_trace(diag, "  SHR R%d, R%d -> LSRV %s, %s, %s\n",
+                           rd, rs, A64_REG_NAME[rd], A64_REG_NAME[rd],
+                           A64_REG_NAME[rs]);
                 emit_a64_lsrv(code, enc_d, enc_d, A64_REG_ENC[rs]);
             }
             break;
@@ -1273,23 +1498,23 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
         /* ---- CMP Ra, Rb/imm  ->  SUBS XZR, Xa, Xb/imm12  4/4-12 ----- */
         case OP_CMP: {
             int ra = inst->operands[0].data.reg;
-            a64_validate_register(inst, ra);
+            a64_validate_register(diag, inst, ra);
             uint8_t enc_a = A64_REG_ENC[ra];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rb = inst->operands[1].data.reg;
-                a64_validate_register(inst, rb);
-                fprintf(stderr, "  CMP R%d, R%d -> CMP %s, %s\n",
-                        ra, rb, A64_REG_NAME[ra], A64_REG_NAME[rb]);
+                a64_validate_register(diag, inst, rb);
+                diag_trace(diag, "  CMP R%d, R%d -> CMP %s, %s\n",
+                           ra, rb, A64_REG_NAME[ra], A64_REG_NAME[rb]);
                 emit_a64_cmp_reg(code, enc_a, A64_REG_ENC[rb]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
                 uint32_t uval = (uint32_t)(imm < 0 ? -imm : imm);
                 if (uval <= 0xFFF && imm >= 0) {
-                    fprintf(stderr, "  CMP R%d, #%d\n", ra, imm);
+                    diag_trace(diag, "  CMP R%d, #%d\n", ra, imm);
                     emit_a64_cmp_imm(code, enc_a, (uint16_t)imm);
                 } else {
-                    fprintf(stderr, "  CMP R%d, #%d -> MOVZ X9; CMP\n",
-                            ra, imm);
+                    diag_trace(diag, "  CMP R%d, #%d -> MOVZ X9; CMP\n",
+                               ra, imm);
                     emit_a64_load_imm32(code, A64_REG_SCRATCH, imm);
                     emit_a64_cmp_reg(code, enc_a, A64_REG_SCRATCH);
                 }
@@ -1299,82 +1524,88 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
 
         /* ---- JMP label  ->  B label ----------------------- 4 bytes --- */
         case OP_JMP: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  JMP %s -> B\n", label);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  JMP %s -> B\n", label);
             int patch_off = code->size;
             emit_a64_placeholder(code);
-            a64_add_fixup(&symtab, label, patch_off, patch_off, inst->line,
+            a64_add_fixup(&symtab, &fixups, label, patch_off, patch_off,
+                          inst,
                           A64_FIXUP_B, 0);
             break;
         }
 
         /* ---- JZ label  ->  B.EQ label --------------------- 4 bytes --- */
         case OP_JZ: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  JZ  %s -> B.EQ\n", label);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  JZ  %s -> B.EQ\n", label);
             int patch_off = code->size;
             emit_a64_placeholder(code);
-            a64_add_fixup(&symtab, label, patch_off, patch_off, inst->line,
+            a64_add_fixup(&symtab, &fixups, label, patch_off, patch_off,
+                          inst,
                           A64_FIXUP_BCOND, A64_COND_EQ);
             break;
         }
 
         /* ---- JNZ label  ->  B.NE label -------------------- 4 bytes --- */
         case OP_JNZ: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  JNZ %s -> B.NE\n", label);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  JNZ %s -> B.NE\n", label);
             int patch_off = code->size;
             emit_a64_placeholder(code);
-            a64_add_fixup(&symtab, label, patch_off, patch_off, inst->line,
+            a64_add_fixup(&symtab, &fixups, label, patch_off, patch_off,
+                          inst,
                           A64_FIXUP_BCOND, A64_COND_NE);
             break;
         }
 
         /* ---- JL label  ->  B.LT label --------------------- 4 bytes --- */
         case OP_JL: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  JL  %s -> B.LT\n", label);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  JL  %s -> B.LT\n", label);
             int patch_off = code->size;
             emit_a64_placeholder(code);
-            a64_add_fixup(&symtab, label, patch_off, patch_off, inst->line,
+            a64_add_fixup(&symtab, &fixups, label, patch_off, patch_off,
+                          inst,
                           A64_FIXUP_BCOND, A64_COND_LT);
             break;
         }
 
         /* ---- JG label  ->  B.GT label --------------------- 4 bytes --- */
         case OP_JG: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  JG  %s -> B.GT\n", label);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  JG  %s -> B.GT\n", label);
             int patch_off = code->size;
             emit_a64_placeholder(code);
-            a64_add_fixup(&symtab, label, patch_off, patch_off, inst->line,
+            a64_add_fixup(&symtab, &fixups, label, patch_off, patch_off,
+                          inst,
                           A64_FIXUP_BCOND, A64_COND_GT);
             break;
         }
 
         /* ---- CALL label  ->  BL label --------------------- 4 bytes --- */
         case OP_CALL: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  CALL %s -> BL\n", label);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  CALL %s -> BL\n", label);
             int patch_off = code->size;
             emit_a64_placeholder(code);
-            a64_add_fixup(&symtab, label, patch_off, patch_off, inst->line,
+            a64_add_fixup(&symtab, &fixups, label, patch_off, patch_off,
+                          inst,
                           A64_FIXUP_BL, 0);
             break;
         }
 
         /* ---- RET  ->  RET X30 ------------------------------ 4 bytes -- */
         case OP_RET:
-            fprintf(stderr, "  RET -> RET X30\n");
+            diag_trace(diag, "  RET -> RET X30\n");
             emit_a64_ret(code, A64_REG_LR);
             break;
 
         /* ---- PUSH Rs  ->  STR Xd, [SP, #-16]! ------------ 4 bytes --- */
         case OP_PUSH: {
             int rs = inst->operands[0].data.reg;
-            a64_validate_register(inst, rs);
-            fprintf(stderr, "  PUSH R%d -> STR %s, [SP, #-16]!\n",
-                    rs, A64_REG_NAME[rs]);
+            a64_validate_register(diag, inst, rs);
+            diag_trace(diag, "  PUSH R%d -> STR %s, [SP, #-16]!\n",
+                       rs, A64_REG_NAME[rs]);
             emit_a64_push(code, A64_REG_ENC[rs]);
             break;
         }
@@ -1382,29 +1613,29 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
         /* ---- POP Rd  ->  LDR Xd, [SP], #16 --------------- 4 bytes --- */
         case OP_POP: {
             int rd = inst->operands[0].data.reg;
-            a64_validate_register(inst, rd);
-            fprintf(stderr, "  POP  R%d -> LDR %s, [SP], #16\n",
-                    rd, A64_REG_NAME[rd]);
+            a64_validate_register(diag, inst, rd);
+            diag_trace(diag, "  POP  R%d -> LDR %s, [SP], #16\n",
+                       rd, A64_REG_NAME[rd]);
             emit_a64_pop(code, A64_REG_ENC[rd]);
             break;
         }
 
         /* ---- NOP -------------------------------------------- 4 bytes -- */
         case OP_NOP:
-            fprintf(stderr, "  NOP\n");
+            diag_trace(diag, "  NOP\n");
             emit_a64_nop(code);
             break;
 
         /* ---- HLT  ->  RET X30 ------------------------------ 4 bytes -- */
         case OP_HLT:
-            fprintf(stderr, "  HLT -> RET X30\n");
+            diag_trace(diag, "  HLT -> RET X30\n");
             emit_a64_ret(code, A64_REG_LR);
             break;
 
         /* ---- INT #imm  ->  SVC #imm ------------------------ 4 bytes -- */
         case OP_INT: {
             uint16_t imm = (uint16_t)(inst->operands[0].data.imm & 0xFFFF);
-            fprintf(stderr, "  INT #%d -> SVC #%d\n", (int)imm, (int)imm);
+            diag_trace(diag, "  INT #%d -> SVC #%d\n", (int)imm, (int)imm);
             emit_a64_svc(code, imm);
             break;
         }
@@ -1420,38 +1651,57 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
         /* ---- ORG addr — pad with zeros until target address ----------- */
         case OP_ORG: {
             uint32_t target = (uint32_t)inst->operands[0].data.imm;
-            while (code->size < (int)target) {
-                emit_byte(code, 0x00);
-            }
+            emit_fill(code, 0x00, (int)target - code->size);
             break;
         }
 
         /* ---- SET name, Rs/imm — store to variable --------------------- */
         case OP_SET: {
-            const char *vname = inst->operands[0].data.label;
-            int var_addr = a64_symtab_lookup(&symtab, vname);
+            const char *vname = strpool_get(strs, inst->operands[0].data.label_id);
+            int vr = regalloc_inst_reg(ra, i);
+            if (vr >= 0) {
+                if (inst->operands[1].type == OPERAND_REGISTER) {
+                    int rs = inst->operands[1].data.reg;
+                    a64_validate_register(diag, inst, rs);
+                    diag_trace(diag, "  SET %s, R%d -> MOV X%d, %s\n",
+                               vname, rs, vr, A64_REG_NAME[rs]);
+                    emit_a64_mov_reg(code, (uint8_t)vr, A64_REG_ENC[rs]);
+                } else {
+                    uint32_t imm = (uint32_t)inst->operands[1].data.imm;
+                    diag_trace(diag, "  SET %s, #%u -> MOVZ X%d, #%u\n",
+                               vname, imm, vr, imm);
+                    a64_load_imm64(code, (uint8_t)vr, (int64_t)imm);
+                }
+                break;
+            }
+            int var_addr = symtab_lookup(&symtab, vname);
             if (var_addr < 0) {
                 char msg[256];
                 snprintf(msg, sizeof(msg),
                          "undefined variable '%s'", vname);
-                a64_error(inst, msg);
+                a64_error(diag, inst, msg);
             }
+            uint8_t rt = A64_REG_SCRATCH2;
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                a64_validate_register(inst, rs);
-                fprintf(stderr, "  SET %s, R%d -> STR %s, [X9]\n",
-                        vname, rs, A64_REG_NAME[rs]);
-                emit_a64_load_imm32_full(code, A64_REG_SCRATCH,
-                                          (int32_t)var_addr);
-                emit_a64_str(code, A64_REG_ENC[rs], A64_REG_SCRATCH);
+                a64_validate_register(diag, inst, rs);
+                diag_trace(diag, "  SET %s, R%d -> %s X9; STR %s, [X9]\n",
+                           vname, rs, far ? "ADRP" : "ADR", A64_REG_NAME[rs]);
+                rt = A64_REG_ENC[rs];
             } else {
-                int32_t imm = (int32_t)inst->operands[1].data.imm;
-                fprintf(stderr, "  SET %s, #%d -> STR X10, [X9]\n",
-                        vname, imm);
-                emit_a64_load_imm32_full(code, A64_REG_SCRATCH2, imm);
-                emit_a64_load_imm32_full(code, A64_REG_SCRATCH,
-                                          (int32_t)var_addr);
-                emit_a64_str(code, A64_REG_SCRATCH2, A64_REG_SCRATCH);
+                uint32_t imm = (uint32_t)inst->operands[1].data.imm;
+                diag_trace(diag, "  SET %s, #%u -> MOVZ X10; %s X9; STR X10, [X9]\n",
+                           vname, imm, far ? "ADRP" : "ADR");
+                a64_load_imm64(code, A64_REG_SCRATCH2, (int64_t)imm);
+            }
+            if (far) {
+                uint16_t lo = a64_emit_page(code, A64_REG_SCRATCH,
+                                            var_addr, origin);
+                emit_a64_str_off(code, rt, A64_REG_SCRATCH, lo);
+            } else {
+                emit_a64_adr(code, A64_REG_SCRATCH,
+                             var_addr - (origin + code->size));
+                emit_a64_str(code, rt, A64_REG_SCRATCH);
             }
             break;
         }
@@ -1459,44 +1709,54 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
         /* ---- GET Rd, name — load from variable or buffer address ------ */
         case OP_GET: {
             int rd = inst->operands[0].data.reg;
-            const char *vname = inst->operands[1].data.label;
-            a64_validate_register(inst, rd);
-            int var_addr = a64_symtab_lookup(&symtab, vname);
+            const char *vname = strpool_get(strs, inst->operands[1].data.label_id);
+            a64_validate_register(diag, inst, rd);
+            int vr = regalloc_inst_reg(ra, i);
+            if (vr >= 0) {
+                diag_trace(diag, "  GET R%d, %s -> MOV %s, X%d\n",
+                           rd, vname, A64_REG_NAME[rd], vr);
+                emit_a64_mov_reg(code, A64_REG_ENC[rd], (uint8_t)vr);
+                break;
+            }
+            int var_addr = symtab_lookup(&symtab, vname);
             if (var_addr < 0) {
                 char msg[256];
                 snprintf(msg, sizeof(msg),
                          "undefined variable '%s'", vname);
-                a64_error(inst, msg);
+                a64_error(diag, inst, msg);
             }
             int is_buf = a64_buftab_has(&buftab, vname);
             if (is_buf) {
-                fprintf(stderr, "  GET R%d, %s -> MOVZ+MOVK %s, #%d (buffer address)\n",
-                        rd, vname, A64_REG_NAME[rd], var_addr);
-                /* Load address into X9, then MOV Xd, X9 */
-                emit_a64_load_imm32_full(code, A64_REG_SCRATCH,
-                                          (int32_t)var_addr);
-                emit_a64_mov_reg(code, A64_REG_ENC[rd], A64_REG_SCRATCH);
+                diag_trace(diag, "  GET R%d, %s -> %s %s, #0x%X (buffer address)\n",
+                           rd, vname, far ? "ADRP+ADD" : "ADR",
+                           A64_REG_NAME[rd], (unsigned)var_addr);
+                a64_emit_addr(code, A64_REG_ENC[rd], var_addr, origin, far);
+            } else if (far) {
+                diag_trace(diag, "  GET R%d, %s -> ADRP+LDR %s\n",
+                           rd, vname, A64_REG_NAME[rd]);
+                uint16_t lo = a64_emit_page(code, A64_REG_ENC[rd],
+                                            var_addr, origin);
+                emit_a64_ldr_off(code, A64_REG_ENC[rd], A64_REG_ENC[rd], lo);
             } else {
-                fprintf(stderr, "  GET R%d, %s -> LDR %s, [X9]\n",
-                        rd, vname, A64_REG_NAME[rd]);
-                emit_a64_load_imm32_full(code, A64_REG_SCRATCH,
-                                          (int32_t)var_addr);
-                emit_a64_ldr(code, A64_REG_ENC[rd], A64_REG_SCRATCH);
+                diag_trace(diag, "  GET R%d, %s -> LDR %s, #0x%X\n",
+                           rd, vname, A64_REG_NAME[rd], (unsigned)var_addr);
+                emit_a64_ldr_literal(code, A64_REG_ENC[rd],
+                                     var_addr - (origin + code->size));
             }
             break;
         }
 
-        /* ---- LDS Rd, "str"  ->  MOVZ+MOVK Xd, addr ------- 8 bytes --- */
+        /* ---- LDS Rd, "str"  ->  ADR Xd, str ----------- 4 / 8 bytes --- */
         case OP_LDS: {
             int rd = inst->operands[0].data.reg;
-            const char *str = inst->operands[1].data.string;
-            a64_validate_register(inst, rd);
-            int str_idx = a64_strtab_add(&strtab, str);
+            const char *str = strpool_get(strs, inst->operands[1].data.string_id);
+            a64_validate_register(diag, inst, rd);
+            int str_idx = a64_strtab_add(&strtab, str, diag);
             int str_addr = str_base + strtab.strings[str_idx].offset;
-            fprintf(stderr, "  LDS R%d, \"%s\" -> MOVZ+MOVK %s, #%d\n",
-                    rd, str, A64_REG_NAME[rd], str_addr);
-            emit_a64_load_imm32_full(code, A64_REG_ENC[rd],
-                                     (int32_t)str_addr);
+            diag_trace(diag, "  LDS R%d, \"%s\" -> %s %s, #0x%X\n",
+                       rd, str, far ? "ADRP+ADD" : "ADR",
+                       A64_REG_NAME[rd], (unsigned)str_addr);
+            a64_emit_addr(code, A64_REG_ENC[rd], str_addr, origin, far);
             break;
         }
 
@@ -1504,10 +1764,10 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
         case OP_LOADB: {
             int rd = inst->operands[0].data.reg;
             int rs = inst->operands[1].data.reg;
-            a64_validate_register(inst, rd);
-            a64_validate_register(inst, rs);
-            fprintf(stderr, "  LOADB R%d, R%d -> LDRB W%d, [X%d]\n",
-                    rd, rs, A64_REG_ENC[rd], A64_REG_ENC[rs]);
+            a64_validate_register(diag, inst, rd);
+            a64_validate_register(diag, inst, rs);
+            diag_trace(diag, "  LOADB R%d, R%d -> LDRB W%d, [X%d]\n",
+                       rd, rs, A64_REG_ENC[rd], A64_REG_ENC[rs]);
             /* LDRB (unsigned offset): size=00, V=0, opc=01
              * 0011 1001 01 imm12 Rn Rt  (imm12=0) */
             {
@@ -1523,10 +1783,10 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
         case OP_STOREB: {
             int rx = inst->operands[0].data.reg;
             int ry = inst->operands[1].data.reg;
-            a64_validate_register(inst, rx);
-            a64_validate_register(inst, ry);
-            fprintf(stderr, "  STOREB R%d, R%d -> STRB W%d, [X%d]\n",
-                    rx, ry, A64_REG_ENC[rx], A64_REG_ENC[ry]);
+            a64_validate_register(diag, inst, rx);
+            a64_validate_register(diag, inst, ry);
+            diag_trace(diag, "  STOREB R%d, R%d -> STRB W%d, [X%d]\n",
+                       rx, ry, A64_REG_ENC[rx], A64_REG_ENC[ry]);
             /* STRB (unsigned offset): size=00, V=0, opc=00
              * 0011 1001 00 imm12 Rn Rt  (imm12=0) */
             {
@@ -1540,7 +1800,7 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
 
         /* ---- SYS  ->  MOV X8,X7 + SVC #0 ---------------- 8 bytes --- */
         case OP_SYS:
-            fprintf(stderr, "  SYS -> MOV X8,X7 + SVC #0\n");
+            diag_trace(diag, "  SYS -> MOV X8,X7 + SVC #0\n");
             /* Move syscall number from R7 (X7) to X8 (Linux ABI).
              * MOV X8, X7 is ORR X8, XZR, X7 = 0xAA0703E8 */
             emit_a64(code, 0xAA0703E8u);
@@ -1549,13 +1809,13 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
 
         /* ---- WFI ------------------------------------------ 4 bytes --- */
         case OP_WFI:
-            fprintf(stderr, "  WFI\n");
+            diag_trace(diag, "  WFI\n");
             emit_a64(code, 0xD503207Fu);   /* HINT #3 = WFI */
             break;
 
         /* ---- DMB SY --------------------------------------- 4 bytes --- */
         case OP_DMB:
-            fprintf(stderr, "  DMB SY\n");
+            diag_trace(diag, "  DMB SY\n");
             emit_a64(code, 0xD5033FBFu);   /* DMB SY */
             break;
 
@@ -1564,20 +1824,24 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
             snprintf(msg, sizeof(msg),
                      "opcode '%s' is not supported by the ARM64 backend",
                      opcode_name(inst->opcode));
-            a64_error(inst, msg);
+            a64_error(diag, inst, msg);
             break;
         }
         }
     }
 
+    if (ra) regalloc_free(ra);
+
     /* --- Pass 3: patch branch relocations ------------------------------ */
-    for (int f = 0; f < symtab.fix_count; f++) {
-        A64Fixup *fix = &symtab.fixups[f];
-        int target = a64_symtab_lookup(&symtab, fix->label);
+    for (int f = 0; f < fixups.count; f++) {
+        A64Fixup *fix = fixvec_at(&fixups, A64Fixup, f);
+        int target = symtab_lookup(&symtab, fix->label);
         if (target < 0) {
-            fprintf(stderr,
-                    "ARM64: undefined label or variable '%s' (line %d)\n",
-                    fix->label, fix->line);
+            diag_printf(diag,
+                        "ARM64: %s, Line %d: undefined label or variable '%s'\n",
+                        fix->inst->file, fix->inst->line, fix->label);
+            symtab_free(&symtab);
+            fixvec_free(&fixups);
             free_code_buffer(code);
             return NULL;
         }
@@ -1587,9 +1851,11 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
             /* B: ±128 MiB range (26-bit signed offset, <<2) */
             int32_t imm26 = offset >> 2;
             if (imm26 < -(1 << 25) || imm26 >= (1 << 25)) {
-                fprintf(stderr,
-                        "ARM64: B target '%s' out of range (line %d)\n",
-                        fix->label, fix->line);
+                diag_printf(diag,
+                            "ARM64: %s, Line %d: B target '%s' out of range\n",
+                            fix->inst->file, fix->inst->line, fix->label);
+                symtab_free(&symtab);
+                fixvec_free(&fixups);
                 free_code_buffer(code);
                 return NULL;
             }
@@ -1601,9 +1867,11 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
             /* BL: same range as B */
             int32_t imm26 = offset >> 2;
             if (imm26 < -(1 << 25) || imm26 >= (1 << 25)) {
-                fprintf(stderr,
-                        "ARM64: BL target '%s' out of range (line %d)\n",
-                        fix->label, fix->line);
+                diag_printf(diag,
+                            "ARM64: %s, Line %d: BL target '%s' out of range\n",
+                            fix->inst->file, fix->inst->line, fix->label);
+                symtab_free(&symtab);
+                fixvec_free(&fixups);
                 free_code_buffer(code);
                 return NULL;
             }
@@ -1615,9 +1883,11 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
             /* B.cond: ±1 MiB range (19-bit signed offset, <<2) */
             int32_t imm19 = offset >> 2;
             if (imm19 < -(1 << 18) || imm19 >= (1 << 18)) {
-                fprintf(stderr,
-                        "ARM64: B.cond target '%s' out of range (line %d)\n",
-                        fix->label, fix->line);
+                diag_printf(diag,
+                            "ARM64: %s, Line %d: B.cond target '%s' out of range\n",
+                            fix->inst->file, fix->inst->line, fix->label);
+                symtab_free(&symtab);
+                fixvec_free(&fixups);
                 free_code_buffer(code);
                 return NULL;
             }
@@ -1628,33 +1898,70 @@ CodeBuffer* generate_arm64(const Instruction *ir, int ir_count)
         }
     }
 
-    /* --- Append variable data section --------------------------------- */
-    int data_start = code->size;
-    for (int v = 0; v < vartab.count; v++) {
-        int64_t val = vartab.vars[v].has_init ? vartab.vars[v].init_value : 0;
-        for (int b = 0; b < A64_VAR_SIZE; b++) {
-            emit_byte(code, (uint8_t)((val >> (b * 8)) & 0xFF));
-        }
-    }
-
-    /* --- Append buffer data section (zero-filled) --------------------- */
-    for (int b = 0; b < buftab.count; b++) {
-        for (int z = 0; z < buftab.bufs[b].size; z++)
-            emit_byte(code, 0x00);
+    /* Export code labels and the code/data split (ELF symbols, segments) */
+    code->code_size = code->size;
+    for (int i = 0; i < ir_count; i++) {
+        if (!ir[i].is_label) continue;
+        const char *lname = strpool_get(strs, ir[i].label_id);
+        if (symtab_lookup(&code->labels, lname) < 0)
+            symtab_add(&code->labels, lname, symtab_lookup(&symtab, lname));
     }
+    symtab_free(&symtab);
+    fixvec_free(&fixups);
 
     /* --- Append string data section ----------------------------------- */
     for (int s = 0; s < strtab.count; s++) {
         const char *p = strtab.strings[s].text;
         int len = strtab.strings[s].length;
-        for (int b = 0; b < len; b++)
-            emit_byte(code, (uint8_t)p[b]);
+        emit_bytes(code, p, len);
         emit_byte(code, 0x00);
     }
 
-    fprintf(stderr, "[ARM64] Emitted %d bytes (%d code + %d var + %d buf + %d str)\n",
-            code->size, data_start,
-            vartab.count * A64_VAR_SIZE, buftab.total_size,
-            strtab.total_size);
+    code->str_size = code->size - code->code_size;
+    emit_fill(code, 0x00, str_end - code->size);
+    code->data_offset = code->size;
+    code->seg_gap     = seg_gap;
+
+    /* --- Append initialised variable data ------------------------------ */
+    for (int v = 0; v < vartab.count; v++) {
+        if (!vartab.vars[v].has_init) continue;
+        emit_le64(code, (uint64_t)vartab.vars[v].init_value);
+    }
+
+    /* --- Zero-initialised storage (uninitialised VARs, BUFFERs) -------- */
+    int bss_end = buf_base + buftab.total_size;
+    code->bss_size = (bss_end > bss_base) ? bss_end - data_end : 0;
+
+    diag_log(diag, DIAG_NORMAL, "[ARM64] Emitted %d bytes (%d code + %d str + %d var) + %d bss\n",
+             code->size, code_end, str_end - code_end,
+             init_vars * A64_VAR_SIZE, code->bss_size);
     return code;
 }
+
+/* =========================================================================
+ *  ELF target  (-sys linux)
+ *
+ *  Start stub, right before the user code:
+ *    94000004    BL   user_code            ; +16 = stub end
+ *    D2800BA8    MOV  X8, #93              ; __NR_exit (generic table)
+ *    D4000001    SVC  #0                   ; exit(X0)
+ *    14000000    B    .                    ; never reached
+ * ========================================================================= */
+static const uint8_t A64_ELF_START_STUB[16] = {
+    0x04, 0x00, 0x00, 0x94,
+    0xA8, 0x0B, 0x80, 0xD2,
+    0x01, 0x00, 0x00, 0xD4,
+    0x00, 0x00, 0x00, 0x14
+};
+
+static const ElfTarget A64_ELF_TARGET = {
+    ELF_CLASS64, ELF_EM_AARCH64, 0,     /* no e_flags on AArch64       */
+    0x00400000,                         /* the usual ld base address   */
+    4,                                  /* A64 instructions            */
+    A64_ELF_START_STUB, (int)sizeof(A64_ELF_START_STUB)
+};
+
+const ElfTarget* elf_target_arm64(void)
+{
+    return &A64_ELF_TARGET;
+}
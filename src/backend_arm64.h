@@ -60,6 +60,7 @@
 
 #include "parser.h"
 #include "codegen.h"    /* CodeBuffer, free_code_buffer, hexdump */
+#include "emitter_elf.h" /* ElfTarget */
 
 /* =========================================================================
  *  Public API
@@ -69,10 +70,28 @@
  * generate_arm64()
  *   Translates the architecture-neutral UA IR into raw AArch64 machine code.
  *   Returns a CodeBuffer that the caller must free with free_code_buffer().
+ *   `strs` is the string pool filled by parse() for this IR; messages go
+ *   to `diag`.
  *
  *   Generates ARMv8-A (AArch64) 64-bit instructions.
  *   Compatible with Apple Silicon (M1/M2/M3/M4) and all AArch64 processors.
+ *   With `alloc_vars` set (-O2), VARs are kept in X11-X15 where possible.
+ *   `seg_gap` is the run-time distance put between code, strings and
+ *   data (see CodeBuffer.seg_gap; 0 = packed).  Strings, VARs and
+ *   BUFFERs are addressed absolutely, with bytes[0] at run-time address
+ *   `origin` (elf_code_origin() for ELF, else 0).
  */
-CodeBuffer* generate_arm64(const Instruction *ir, int ir_count);
+CodeBuffer* generate_arm64(const Instruction *ir, int ir_count,
+                           const StrPool *strs, int alloc_vars,
+                           int seg_gap, int origin,
+                           UaDiag *diag);
+
+/*
+ * elf_target_arm64()
+ *   ELF description of this backend for -sys linux: ELF64, EM_AARCH64,
+ *   loaded at 0x00400000.  The start stub calls the code and passes X0
+ *   to exit(2) (number in X8).
+ */
+const ElfTarget* elf_target_arm64(void);
 
 #endif /* UA_BACKEND_ARM64_H */
@@ -27,6 +27,7 @@
  *  │    0x33 = OP       (R-type ALU)                                    │
  *  │    0x3B = OP-32    (R-type ALU, 32-bit)                            │
  *  │    0x13 = OP-IMM   (I-type ALU)                                    │
+ *  │    0x1B = OP-IMM-32 (ADDIW)                                        │
  *  │    0x03 = LOAD     (I-type loads)                                  │
  *  │    0x23 = STORE    (S-type stores)                                 │
  *  │    0x63 = BRANCH   (B-type conditional branches)                   │
@@ -47,6 +48,7 @@
  */
 
 #include "backend_risc_v.h"
+#include "regalloc.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -85,18 +87,19 @@ static const char* RV_REG_NAME[RV_MAX_REG] = {
 /* =========================================================================
  *  Error helpers
  * ========================================================================= */
-static void rv_error(const Instruction *inst, const char *msg)
+static void rv_error(UaDiag *diag, const Instruction *inst,
+                     const char *msg)
 {
-    fprintf(stderr,
-            "\n"
-            "  UA RISC-V Backend Error\n"
-            "  ------------------------\n"
-            "  Line %d, Column %d: %s\n\n",
-            inst->line, inst->column, msg);
-    exit(1);
+    diag_printf(diag,
+                "\n"
+                "  UA RISC-V Backend Error\n"
+                "  ------------------------\n"
+                "  %s, Line %d, Column %d: %s\n\n",
+                inst->file, inst->line, inst->column, msg);
+    diag_fatal(diag);
 }
 
-static void rv_validate_register(const Instruction *inst, int reg)
+static void rv_validate_register(UaDiag *diag, const Instruction *inst, int reg)
 {
     if (reg < 0 || reg >= RV_MAX_REG) {
         char msg[256];
@@ -104,7 +107,7 @@ static void rv_validate_register(const Instruction *inst, int reg)
                  "register R%d is not mapped in the RISC-V backend "
                  "(supports R0-R7: a0-a7)",
                  reg);
-        rv_error(inst, msg);
+        rv_error(diag, inst, msg);
     }
 }
 
@@ -113,10 +116,7 @@ static void rv_validate_register(const Instruction *inst, int reg)
  * ========================================================================= */
 static void emit_rv32(CodeBuffer *buf, uint32_t word)
 {
-    emit_byte(buf, (uint8_t)( word        & 0xFF));
-    emit_byte(buf, (uint8_t)((word >>  8) & 0xFF));
-    emit_byte(buf, (uint8_t)((word >> 16) & 0xFF));
-    emit_byte(buf, (uint8_t)((word >> 24) & 0xFF));
+    emit_le32(buf, word);
 }
 
 /* =========================================================================
@@ -213,6 +213,7 @@ static uint32_t rv_j_type(int32_t offset, uint8_t rd, uint8_t opcode)
 #define RV_OP_LOAD    0x03
 #define RV_OP_STORE   0x23
 #define RV_OP_OP_IMM  0x13
+#define RV_OP_OP_IMM_32 0x1B
 #define RV_OP_OP      0x33
 #define RV_OP_SYSTEM  0x73
 
@@ -312,6 +313,13 @@ static void emit_rv_addi(CodeBuffer *buf, uint8_t rd, uint8_t rs1,
     emit_rv32(buf, rv_i_type(imm12, rs1, RV_F3_ADD, rd, RV_OP_OP_IMM));
 }
 
+/* --- ADDIW rd, rs1, imm12  (32-bit add, result sign-extended) --------- */
+static void emit_rv_addiw(CodeBuffer *buf, uint8_t rd, uint8_t rs1,
+                           int32_t imm12)
+{
+    emit_rv32(buf, rv_i_type(imm12, rs1, RV_F3_ADD, rd, RV_OP_OP_IMM_32));
+}
+
 /* --- XORI rd, rs1, imm12 ----------------------------------------------- */
 static void emit_rv_xori(CodeBuffer *buf, uint8_t rd, uint8_t rs1,
                           int32_t imm12)
@@ -409,29 +417,51 @@ static void emit_rv_nop(CodeBuffer *buf)
     emit_rv_addi(buf, RV_REG_ZERO, RV_REG_ZERO, 0);
 }
 
-/* --- Load a full 32-bit / 64-bit immediate into rd --------------------- */
-/*     Uses LUI + ADDI for values that don't fit in 12-bit immediate.     */
-static void emit_rv_load_imm(CodeBuffer *buf, uint8_t rd, int32_t imm)
+/* --- Load a full 64-bit immediate into rd ----------------------------- */
+/*     simm12          -> ADDI rd, x0, imm                                */
+/*     simm32          -> LUI [+ ADDIW]                                   */
+/*     anything else   -> (load upper part) + SLLI [+ ADDI]               */
+/*     The upper part has its trailing zero bits folded into the SLLI     */
+/*     shift, so runs of zero bits cost nothing.  Returns the number of   */
+/*     instructions; pass buf = NULL to size without emitting.           */
+static int rv_load_imm64(CodeBuffer *buf, uint8_t rd, int64_t imm)
 {
-    /* If the value fits in signed 12-bit immediate [-2048, 2047] */
     if (imm >= -2048 && imm <= 2047) {
-        emit_rv_addi(buf, rd, RV_REG_ZERO, imm);
-    } else {
-        /* LUI loads bits [31:12].  If bit 11 of the immediate is set,
-         * ADDI will sign-extend and subtract 0x1000, so we compensate. */
-        int32_t upper = imm & (int32_t)0xFFFFF000;
-        int32_t lower = imm & 0xFFF;
-        if (lower & 0x800) {
-            upper += 0x1000;  /* compensate for sign extension of ADDI */
-        }
-        emit_rv_lui(buf, rd, upper);
-        if (lower != 0) {
-            /* Sign-extend the 12-bit value */
-            int32_t sext_lower = (lower & 0x800) ? (lower | (int32_t)0xFFFFF000)
-                                                  : lower;
-            emit_rv_addi(buf, rd, rd, sext_lower);
+        if (buf) emit_rv_addi(buf, rd, RV_REG_ZERO, (int32_t)imm);
+        return 1;
+    }
+
+    /* Low 12 bits, sign-extended the way ADDI/ADDIW will see them */
+    int32_t lo12 = (int32_t)(((uint64_t)imm & 0xFFF) ^ 0x800) - 0x800;
+
+    if (imm >= INT32_MIN && imm <= INT32_MAX) {
+        /* LUI sign-extends bit 31; ADDIW wraps in 32 bits, so the
+         * +0x800 rounding of hi20 cannot overflow into bit 32. */
+        uint32_t hi20 = (uint32_t)((uint64_t)imm + 0x800) & 0xFFFFF000u;
+        if (buf) {
+            emit_rv_lui(buf, rd, (int32_t)hi20);
+            if (lo12 != 0) emit_rv_addiw(buf, rd, rd, lo12);
         }
+        return (lo12 != 0) ? 2 : 1;
+    }
+
+    uint64_t hi52  = ((uint64_t)imm + 0x800) >> 12;
+    int      shift = 12;
+    while ((hi52 & 1) == 0) {
+        hi52 >>= 1;
+        shift++;
+    }
+    /* Sign-extend what is left from (64 - shift) bits */
+    int64_t upper = (int64_t)(hi52 << shift) >> shift;
+
+    int n = rv_load_imm64(buf, rd, upper);
+    if (buf) emit_rv_slli(buf, rd, rd, (uint8_t)shift);
+    n++;
+    if (lo12 != 0) {
+        if (buf) emit_rv_addi(buf, rd, rd, lo12);
+        n++;
     }
+    return n;
 }
 
 /* Always emit LUI + ADDI (8 bytes) — used for variable addresses
@@ -451,10 +481,7 @@ static void emit_rv_load_imm_full(CodeBuffer *buf, uint8_t rd, int32_t imm)
 /* --- Branch / jump placeholder (4 bytes, will be patched) -------------- */
 static void emit_rv_placeholder(CodeBuffer *buf)
 {
-    emit_byte(buf, 0x00);
-    emit_byte(buf, 0x00);
-    emit_byte(buf, 0x00);
-    emit_byte(buf, 0x00);
+    emit_le32(buf, 0);
 }
 
 static void patch_rv_word(CodeBuffer *buf, int offset, uint32_t word)
@@ -466,25 +493,17 @@ static void patch_rv_word(CodeBuffer *buf, int offset, uint32_t word)
 }
 
 /* =========================================================================
- *  Symbol table for labels
+ *  Branch / data fixups  (labels live in the shared SymbolTable)
  * ========================================================================= */
-#define RV_MAX_SYMBOLS   256
-#define RV_MAX_FIXUPS    256
-
-typedef struct {
-    char name[UA_MAX_LABEL_LEN];
-    int  address;
-} RVSymbol;
-
 /* Fixup types */
 #define RV_FIXUP_JAL     0   /* J-type (JAL) */
 #define RV_FIXUP_BRANCH  1   /* B-type (BEQ, BNE) */
 
 typedef struct {
-    char  label[UA_MAX_LABEL_LEN];
+    const char *label;      /* interned in the SymbolTable               */
     int   patch_offset;     /* offset into CodeBuffer where instr lives  */
     int   instr_addr;       /* byte address of the instruction           */
-    int   line;
+    const Instruction *inst; /* file and line for error messages */
     int   fixup_type;       /* RV_FIXUP_JAL or RV_FIXUP_BRANCH          */
     uint8_t rd;             /* rd field for JAL (x0 or x1)              */
     uint8_t funct3;         /* funct3 for branch type (BEQ/BNE/BLT)     */
@@ -492,55 +511,17 @@ typedef struct {
     uint8_t rs2;            /* rs2 for branch (usually x0 or t0)        */
 } RVFixup;
 
-typedef struct {
-    RVSymbol symbols[RV_MAX_SYMBOLS];
-    int      sym_count;
-    RVFixup  fixups[RV_MAX_FIXUPS];
-    int      fix_count;
-} RVSymTab;
-
-static void rv_symtab_init(RVSymTab *st)
+static void rv_add_fixup(SymbolTable *st, FixupVec *fixups,
+                         const char *label, int patch_offset,
+                         int instr_addr, const Instruction *inst,
+                         int fixup_type, uint8_t rd, uint8_t funct3,
+                         uint8_t rs1, uint8_t rs2)
 {
-    st->sym_count = 0;
-    st->fix_count = 0;
-}
-
-static void rv_symtab_add(RVSymTab *st, const char *name, int address)
-{
-    if (st->sym_count >= RV_MAX_SYMBOLS) {
-        fprintf(stderr, "RISC-V: symbol table overflow\n");
-        exit(1);
-    }
-    strncpy(st->symbols[st->sym_count].name, name, UA_MAX_LABEL_LEN - 1);
-    st->symbols[st->sym_count].name[UA_MAX_LABEL_LEN - 1] = '\0';
-    st->symbols[st->sym_count].address = address;
-    st->sym_count++;
-}
-
-static int rv_symtab_lookup(const RVSymTab *st, const char *name)
-{
-    for (int i = 0; i < st->sym_count; i++) {
-        if (strcmp(st->symbols[i].name, name) == 0)
-            return st->symbols[i].address;
-    }
-    return -1;
-}
-
-static void rv_add_fixup(RVSymTab *st, const char *label,
-                          int patch_offset, int instr_addr, int line,
-                          int fixup_type, uint8_t rd, uint8_t funct3,
-                          uint8_t rs1, uint8_t rs2)
-{
-    if (st->fix_count >= RV_MAX_FIXUPS) {
-        fprintf(stderr, "RISC-V: fixup table overflow\n");
-        exit(1);
-    }
-    RVFixup *f = &st->fixups[st->fix_count++];
-    strncpy(f->label, label, UA_MAX_LABEL_LEN - 1);
-    f->label[UA_MAX_LABEL_LEN - 1] = '\0';
+    RVFixup *f = (RVFixup *)fixvec_push(fixups);
+    f->label        = symtab_intern(st, label);
     f->patch_offset = patch_offset;
     f->instr_addr   = instr_addr;
-    f->line         = line;
+    f->inst         = inst;
     f->fixup_type   = fixup_type;
     f->rd           = rd;
     f->funct3       = funct3;
@@ -550,17 +531,17 @@ static void rv_add_fixup(RVSymTab *st, const char *label,
 
 /* =========================================================================
  *  instruction_size_rv()  —  compute byte size of each instruction
+ *
+ *  `var_reg` is non-zero for a GET/SET whose VAR lives in a register.
  * ========================================================================= */
-static int instruction_size_rv(const Instruction *inst)
+static int instruction_size_rv(const Instruction *inst, int var_reg)
 {
     if (inst->is_label) return 0;
 
     switch (inst->opcode) {
-        case OP_LDI: {
-            int32_t imm = (int32_t)inst->operands[1].data.imm;
-            if (imm >= -2048 && imm <= 2047) return 4;  /* ADDI only */
-            return 8;  /* LUI + ADDI */
-        }
+        case OP_LDI:
+            /* ADDI, LUI [+ ADDIW], or a LUI/ADDI/SLLI chain (up to 8) */
+            return 4 * rv_load_imm64(NULL, 0, inst->operands[1].data.imm);
         case OP_MOV:    return 4;   /* ADDI rd, rs, 0 */
         case OP_LOAD:   return 4;   /* LD */
         case OP_STORE:  return 4;   /* SD */
@@ -621,14 +602,21 @@ static int instruction_size_rv(const Instruction *inst)
         case OP_VAR:    return 0;   /* declaration only */
         case OP_BUFFER: return 0;   /* declaration only */
         case OP_SET:
+            /* In a register: MV tv, Rs (4) / load tv, imm (4-8) */
+            if (var_reg) {
+                if (inst->operands[1].type == OPERAND_REGISTER) return 4;
+                return 4 * rv_load_imm64(NULL, 0,
+                           (int32_t)inst->operands[1].data.imm);
+            }
             /* SET name, Rs  -> LUI+ADDI t0,addr(8) + SD Rs,0(t0)(4) = 12 */
             if (inst->operands[1].type == OPERAND_REGISTER) return 12;
             /* SET name, imm -> LUI+ADDI t1,imm(8) + LUI+ADDI t0,addr(8)
              *                + SD t1,0(t0)(4) = 20 */
             return 20;
         case OP_GET:
-            /* GET Rd, name  -> LUI+ADDI t0,addr(8) + LD Rd,0(t0)(4) = 12 */
-            return 12;
+            /* GET Rd, name  -> LUI+ADDI t0,addr(8) + LD Rd,0(t0)(4) = 12
+             * In a register: MV Rd, tv (4)                             */
+            return var_reg ? 4 : 12;
 
         /* ---- New Phase-8 instructions --------------------------------- */
         case OP_LDS:    return 8;   /* LUI+ADDI Rd, addr (load string ptr)  */
@@ -710,16 +698,17 @@ static void rv_buftab_init(RVBufTable *bt) {
     bt->total_size = 0;
 }
 
-static int rv_buftab_add(RVBufTable *bt, const char *name, int size) {
+static int rv_buftab_add(RVBufTable *bt, const char *name, int size,
+                         UaDiag *diag) {
     for (int i = 0; i < bt->count; i++) {
         if (strcmp(bt->bufs[i].name, name) == 0) {
-            fprintf(stderr, "RISC-V: duplicate buffer '%s'\n", name);
+            diag_printf(diag, "RISC-V: duplicate buffer '%s'\n", name);
             return -1;
         }
     }
     if (bt->count >= RV_MAX_BUFFERS) {
-        fprintf(stderr, "RISC-V: buffer table overflow (max %d)\n",
-                RV_MAX_BUFFERS);
+        diag_printf(diag, "RISC-V: buffer table overflow (max %d)\n",
+                    RV_MAX_BUFFERS);
         return -1;
     }
     RVBufEntry *b = &bt->bufs[bt->count++];
@@ -737,12 +726,13 @@ static int rv_buftab_has(const RVBufTable *bt, const char *name) {
     return 0;
 }
 
-static int rv_strtab_add(RVStringTable *st, const char *text) {
+static int rv_strtab_add(RVStringTable *st, const char *text,
+                         UaDiag *diag) {
     for (int i = 0; i < st->count; i++)
         if (strcmp(st->strings[i].text, text) == 0) return i;
     if (st->count >= RV_MAX_STRINGS) {
-        fprintf(stderr, "RISC-V: string table overflow (max %d)\n",
-                RV_MAX_STRINGS);
+        diag_printf(diag, "RISC-V: string table overflow (max %d)\n",
+                    RV_MAX_STRINGS);
         return 0;
     }
     int idx = st->count++;
@@ -755,17 +745,18 @@ static int rv_strtab_add(RVStringTable *st, const char *text) {
 }
 
 static int rv_vartab_add(RVVarTable *vt, const char *name,
-                          int64_t init_value, int has_init)
+                          int64_t init_value, int has_init,
+                          UaDiag *diag)
 {
     for (int i = 0; i < vt->count; i++) {
         if (strcmp(vt->vars[i].name, name) == 0) {
-            fprintf(stderr, "RISC-V: duplicate variable '%s'\n", name);
+            diag_printf(diag, "RISC-V: duplicate variable '%s'\n", name);
             return -1;
         }
     }
     if (vt->count >= RV_MAX_VARS) {
-        fprintf(stderr, "RISC-V: variable table overflow (max %d)\n",
-                RV_MAX_VARS);
+        diag_printf(diag, "RISC-V: variable table overflow (max %d)\n",
+                    RV_MAX_VARS);
         return -1;
     }
     RVVarEntry *v = &vt->vars[vt->count++];
@@ -776,17 +767,50 @@ static int rv_vartab_add(RVVarTable *vt, const char *name,
     return 0;
 }
 
+/* =========================================================================
+ *  VAR register pool (-O2)  —  t3-t6 (x28-x31), caller-saved temporaries
+ *  that the a0-a7 mapping and the t0-t2 scratch registers never touch.
+ * ========================================================================= */
+static const uint8_t RV_VAR_POOL[] = { 28, 29, 30, 31 };
+static const char *const RV_VAR_POOL_NAME[] = { "t3", "t4", "t5", "t6" };
+
+/* Load the initial value of every entry-live register VAR; returns size */
+static int rv_var_prologue(CodeBuffer *code, const RegAlloc *ra,
+                           const StrPool *strs, UaDiag *diag)
+{
+    int size = 0;
+    if (!ra) return 0;
+    for (int v = 0; v < ra->var_count; v++) {
+        const RegAllocVar *rv = &ra->vars[v];
+        if (rv->reg < 0 || !rv->live_in) continue;
+        if (code) {
+            diag_trace(diag, "  (entry) %s -> load %s, %lld\n",
+                       strpool_get(strs, rv->name), RV_VAR_POOL_NAME[rv->slot],
+                       (long long)rv->init);
+        }
+        size += 4 * rv_load_imm64(code, (uint8_t)rv->reg, rv->init);
+    }
+    return size;
+}
+
 /* =========================================================================
  *  generate_risc_v()  —  main entry point  (two-pass)
  * ========================================================================= */
-CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
+CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count,
+                            const StrPool *strs, int alloc_vars,
+                            int seg_gap, int origin,
+                            UaDiag *diag)
 {
-    fprintf(stderr, "[RISC-V] Generating code for %d IR instructions ...\n",
-            ir_count);
+    diag_log(diag, DIAG_NORMAL, "[RISC-V] Generating code for %d IR instructions ...\n",
+             ir_count);
 
     /* --- Pass 1: collect label addresses + variable declarations ------- */
-    RVSymTab symtab;
-    rv_symtab_init(&symtab);
+    SymbolTable symtab;
+    symtab_init(&symtab, diag);
+    diag_own(diag, &symtab, symtab_drop);
+    FixupVec fixups;
+    fixvec_init(&fixups, sizeof(RVFixup), diag);
+    diag_own(diag, &fixups, fixvec_drop);
 
     RVVarTable vartab;
     rv_vartab_init(&vartab);
@@ -797,13 +821,26 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
     RVBufTable buftab;
     rv_buftab_init(&buftab);
 
-    int pc = 0;
+    /* -O2: keep VARs in spare registers where liveness allows */
+    RegAlloc  regalloc;
+    RegAlloc *ra = NULL;
+    if (alloc_vars) {
+        RegPool pool = { RV_VAR_POOL, RV_VAR_POOL_NAME,
+                         (int)sizeof(RV_VAR_POOL), 0 };
+        if (regalloc_run(&regalloc, ir, ir_count, strs, &pool) == 0) {
+            diag_own(diag, &regalloc, regalloc_drop);
+            regalloc_print(&regalloc, strs, &pool, diag);
+            ra = &regalloc;
+        }
+    }
+
+    int pc = rv_var_prologue(NULL, ra, strs, diag);
     for (int i = 0; i < ir_count; i++) {
         const Instruction *inst = &ir[i];
         if (inst->is_label) {
-            rv_symtab_add(&symtab, inst->label_name, pc);
+            symtab_add(&symtab, strpool_get(strs, inst->label_id), pc);
         } else if (inst->opcode == OP_VAR) {
-            const char *vname = inst->operands[0].data.label;
+            const char *vname = strpool_get(strs, inst->operands[0].data.label_id);
             int64_t init_val  = 0;
             int     has_init  = 0;
             if (inst->operand_count >= 2 &&
@@ -811,54 +848,79 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
                 init_val = inst->operands[1].data.imm;
                 has_init = 1;
             }
-            rv_vartab_add(&vartab, vname, init_val, has_init);
+            rv_vartab_add(&vartab, vname, init_val, has_init, diag);
         } else if (inst->opcode == OP_BUFFER) {
-            const char *bname = inst->operands[0].data.label;
+            const char *bname = strpool_get(strs, inst->operands[0].data.label_id);
             int bsize = (int)inst->operands[1].data.imm;
-            rv_buftab_add(&buftab, bname, bsize);
+            rv_buftab_add(&buftab, bname, bsize, diag);
         } else if (inst->opcode == OP_ORG) {
             uint32_t target = (uint32_t)inst->operands[0].data.imm;
             if ((int)target < pc) {
-                fprintf(stderr, "Error: @ORG 0x%X would move address "
-                        "backwards (current PC = 0x%X)\n",
-                        target, (unsigned)pc);
-                exit(1);
+                diag_printf(diag, "Error: @ORG 0x%X would move address "
+                            "backwards (current PC = 0x%X)\n",
+                            target, (unsigned)pc);
+                diag_fatal(diag);
             }
             pc = (int)target;
         } else {
             if (inst->opcode == OP_LDS)
-                rv_strtab_add(&strtab, inst->operands[1].data.string);
-            pc += instruction_size_rv(inst);
+                rv_strtab_add(&strtab, strpool_get(strs, inst->operands[1].data.string_id),
+                              diag);
+            pc += instruction_size_rv(inst, regalloc_inst_reg(ra, i) >= 0);
         }
     }
 
-    /* Register variable symbols: each at code_end + index * 8 */
-    int var_base = pc;
-    for (int v = 0; v < vartab.count; v++) {
-        rv_symtab_add(&symtab, vartab.vars[v].name,
-                      var_base + v * RV_VAR_SIZE);
-    }
-
-    /* Register buffer symbols: each lives after variables */
-    int buf_base = var_base + vartab.count * RV_VAR_SIZE;
+    /* Data after the code, stored in bytes[] back to back:
+     *   [strings][pad to a VAR boundary]               read-only
+     *   [initialised VARs]                             writable
+     *   [uninitialised VARs][BUFFERs]                  bss (size only)
+     * Each part after the code is addressed seg_gap further on, so a
+     * container can map code, strings and data as separate segments.
+     * The bss starts on a VAR boundary; the emitter maps it as
+     * zero-filled memory.  Addresses count from `origin`, the run-time
+     * address of bytes[0]. */
+    int code_end  = pc;
+    int init_vars = 0;
+    for (int v = 0; v < vartab.count; v++)
+        if (vartab.vars[v].has_init) init_vars++;
+    int str_base = origin + code_end + seg_gap;
+    int str_end  = (code_end + strtab.total_size + RV_VAR_SIZE - 1)
+                 & ~(RV_VAR_SIZE - 1);
+    int var_base = origin + str_end + 2 * seg_gap;
+    int data_end = var_base + init_vars * RV_VAR_SIZE;
+    int bss_base = (data_end + RV_VAR_SIZE - 1) & ~(RV_VAR_SIZE - 1);
+    int buf_base = bss_base + (vartab.count - init_vars) * RV_VAR_SIZE;
     {
+        int init_idx = 0, bss_idx = 0;
+        for (int v = 0; v < vartab.count; v++) {
+            int addr = vartab.vars[v].has_init
+                     ? var_base + (init_idx++) * RV_VAR_SIZE
+                     : bss_base + (bss_idx++) * RV_VAR_SIZE;
+            symtab_add(&symtab, vartab.vars[v].name, addr);
+        }
         int buf_offset = 0;
         for (int b = 0; b < buftab.count; b++) {
-            rv_symtab_add(&symtab, buftab.bufs[b].name,
-                          buf_base + buf_offset);
+            symtab_add(&symtab, buftab.bufs[b].name,
+                       buf_base + buf_offset);
             buf_offset += buftab.bufs[b].size;
         }
     }
 
-    /* String data lives after variables and buffers */
-    int str_base = buf_base + buftab.total_size;
-
     /* --- Pass 2: code emission ----------------------------------------- */
-    CodeBuffer *code = create_code_buffer();
+    CodeBuffer *code = create_code_buffer(diag);
     if (!code) {
-        fprintf(stderr, "UA RISC-V: out of memory\n");
+        diag_printf(diag, "UA RISC-V: out of memory\n");
+        if (ra) regalloc_free(ra);
+        symtab_free(&symtab);
+        fixvec_free(&fixups);
         return NULL;
     }
+    diag_own(diag, &code, codebuf_drop);
+
+    /* Pass 1 sized the code, strings and VARs: allocate them at once */
+    codebuf_reserve(code, str_end + init_vars * RV_VAR_SIZE);
+
+    rv_var_prologue(code, ra, strs, diag);
 
     for (int i = 0; i < ir_count; i++) {
         const Instruction *inst = &ir[i];
@@ -866,17 +928,19 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
         if (inst->is_label)
             continue;
 
+        codebuf_add_line(code, inst->file, inst->line);
+
         switch (inst->opcode) {
 
-        /* ---- LDI Rd, #imm  ->  ADDI / LUI+ADDI ---------- 4-8 bytes -- */
+        /* ---- LDI Rd, #imm  ->  ADDI / LUI+ADDIW / ...+SLLI  4-32 bytes */
         case OP_LDI: {
             int rd = inst->operands[0].data.reg;
-            int32_t imm = (int32_t)inst->operands[1].data.imm;
-            rv_validate_register(inst, rd);
+            int64_t imm = inst->operands[1].data.imm;
+            rv_validate_register(diag, inst, rd);
             uint8_t enc = RV_REG_ENC[rd];
-            fprintf(stderr, "  LDI R%d -> load %s, %d\n",
-                    rd, RV_REG_NAME[rd], imm);
-            emit_rv_load_imm(code, enc, imm);
+            diag_trace(diag, "  LDI R%d -> load %s, %lld\n",
+                       rd, RV_REG_NAME[rd], (long long)imm);
+            rv_load_imm64(code, enc, imm);
             break;
         }
 
@@ -884,10 +948,10 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
         case OP_MOV: {
             int rd = inst->operands[0].data.reg;
             int rs = inst->operands[1].data.reg;
-            rv_validate_register(inst, rd);
-            rv_validate_register(inst, rs);
-            fprintf(stderr, "  MOV R%d, R%d -> ADDI %s, %s, 0\n",
-                    rd, rs, RV_REG_NAME[rd], RV_REG_NAME[rs]);
+            rv_validate_register(diag, inst, rd);
+            rv_validate_register(diag, inst, rs);
+            diag_trace(diag, "  MOV R%d, R%d -> ADDI %s, %s, 0\n",
+                       rd, rs, RV_REG_NAME[rd], RV_REG_NAME[rs]);
             emit_rv_addi(code, RV_REG_ENC[rd], RV_REG_ENC[rs], 0);
             break;
         }
@@ -896,10 +960,10 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
         case OP_LOAD: {
             int rd = inst->operands[0].data.reg;
             int rs = inst->operands[1].data.reg;
-            rv_validate_register(inst, rd);
-            rv_validate_register(inst, rs);
-            fprintf(stderr, "  LOAD R%d, R%d -> LD %s, 0(%s)\n",
-                    rd, rs, RV_REG_NAME[rd], RV_REG_NAME[rs]);
+            rv_validate_register(diag, inst, rd);
+            rv_validate_register(diag, inst, rs);
+            diag_trace(diag, "  LOAD R%d, R%d -> LD %s, 0(%s)\n",
+                       rd, rs, RV_REG_NAME[rd], RV_REG_NAME[rs]);
             emit_rv_ld(code, RV_REG_ENC[rd], RV_REG_ENC[rs], 0);
             break;
         }
@@ -908,10 +972,10 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
         case OP_STORE: {
             int rx = inst->operands[0].data.reg;
             int ry = inst->operands[1].data.reg;
-            rv_validate_register(inst, rx);
-            rv_validate_register(inst, ry);
-            fprintf(stderr, "  STORE R%d, R%d -> SD %s, 0(%s)\n",
-                    rx, ry, RV_REG_NAME[ry], RV_REG_NAME[rx]);
+            rv_validate_register(diag, inst, rx);
+            rv_validate_register(diag, inst, ry);
+            diag_trace(diag, "  STORE R%d, R%d -> SD %s, 0(%s)\n",
+                       rx, ry, RV_REG_NAME[ry], RV_REG_NAME[rx]);
             emit_rv_sd(code, RV_REG_ENC[ry], RV_REG_ENC[rx], 0);
             break;
         }
@@ -919,18 +983,18 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
         /* ---- ADD Rd, Rs/imm -------------------------------- 4/12 ----- */
         case OP_ADD: {
             int rd = inst->operands[0].data.reg;
-            rv_validate_register(inst, rd);
+            rv_validate_register(diag, inst, rd);
             uint8_t enc_d = RV_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                rv_validate_register(inst, rs);
-                fprintf(stderr, "  ADD R%d, R%d -> ADD %s, %s, %s\n",
-                        rd, rs, RV_REG_NAME[rd], RV_REG_NAME[rd],
-                        RV_REG_NAME[rs]);
+                rv_validate_register(diag, inst, rs);
+                diag_trace(diag, "  ADD R%d, R%d -> ADD %s, %s, %s\n",
+                           rd, rs, RV_REG_NAME[rd], RV_REG_NAME[rd],
+                           RV_REG_NAME[rs]);
                 emit_rv_add(code, enc_d, enc_d, RV_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                fprintf(stderr, "  ADD R%d, #%d\n", rd, imm);
+                diag_trace(diag, "  ADD R%d, #%d\n", rd, imm);
                 emit_rv_load_imm_full(code, RV_REG_T0, imm);
                 emit_rv_add(code, enc_d, enc_d, RV_REG_T0);
             }
@@ -940,18 +1004,18 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
         /* ---- SUB Rd, Rs/imm -------------------------------- 4/12 ----- */
         case OP_SUB: {
             int rd = inst->operands[0].data.reg;
-            rv_validate_register(inst, rd);
+            rv_validate_register(diag, inst, rd);
             uint8_t enc_d = RV_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                rv_validate_register(inst, rs);
-                fprintf(stderr, "  SUB R%d, R%d -> SUB %s, %s, %s\n",
-                        rd, rs, RV_REG_NAME[rd], RV_REG_NAME[rd],
-                        RV_REG_NAME[rs]);
+                rv_validate_register(diag, inst, rs);
+                diag_trace(diag, "  SUB R%d, R%d -> SUB %s, %s, %s\n",
+                           rd, rs, RV_REG_NAME[rd], RV_REG_NAME[rd],
+                           RV_REG_NAME[rs]);
                 emit_rv_sub(code, enc_d, enc_d, RV_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                fprintf(stderr, "  SUB R%d, #%d\n", rd, imm);
+                diag_trace(diag, "  SUB R%d, #%d\n", rd, imm);
                 emit_rv_load_imm_full(code, RV_REG_T0, imm);
                 emit_rv_sub(code, enc_d, enc_d, RV_REG_T0);
             }
@@ -961,22 +1025,22 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
         /* ---- AND Rd, Rs/imm -------------------------------- 4/4-12 --- */
         case OP_AND: {
             int rd = inst->operands[0].data.reg;
-            rv_validate_register(inst, rd);
+            rv_validate_register(diag, inst, rd);
             uint8_t enc_d = RV_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                rv_validate_register(inst, rs);
-                fprintf(stderr, "  AND R%d, R%d -> AND %s, %s, %s\n",
-                        rd, rs, RV_REG_NAME[rd], RV_REG_NAME[rd],
-                        RV_REG_NAME[rs]);
+                rv_validate_register(diag, inst, rs);
+                diag_trace(diag, "  AND R%d, R%d -> AND %s, %s, %s\n",
+                           rd, rs, RV_REG_NAME[rd], RV_REG_NAME[rd],
+                           RV_REG_NAME[rs]);
                 emit_rv_and(code, enc_d, enc_d, RV_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
                 if (imm >= -2048 && imm <= 2047) {
-                    fprintf(stderr, "  AND R%d, #%d -> ANDI\n", rd, imm);
+                    diag_trace(diag, "  AND R%d, #%d -> ANDI\n", rd, imm);
                     emit_rv_andi(code, enc_d, enc_d, imm);
                 } else {
-                    fprintf(stderr, "  AND R%d, #%d -> load t0; AND\n", rd, imm);
+                    diag_trace(diag, "  AND R%d, #%d -> load t0; AND\n", rd, imm);
                     emit_rv_load_imm_full(code, RV_REG_T0, imm);
                     emit_rv_and(code, enc_d, enc_d, RV_REG_T0);
                 }
@@ -987,22 +1051,22 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
         /* ---- OR Rd, Rs/imm --------------------------------- 4/4-12 --- */
         case OP_OR: {
             int rd = inst->operands[0].data.reg;
-            rv_validate_register(inst, rd);
+            rv_validate_register(diag, inst, rd);
             uint8_t enc_d = RV_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                rv_validate_register(inst, rs);
-                fprintf(stderr, "  OR  R%d, R%d -> OR %s, %s, %s\n",
-                        rd, rs, RV_REG_NAME[rd], RV_REG_NAME[rd],
-                        RV_REG_NAME[rs]);
+                rv_validate_register(diag, inst, rs);
+                diag_trace(diag, "  OR  R%d, R%d -> OR %s, %s, %s\n",
+                           rd, rs, RV_REG_NAME[rd], RV_REG_NAME[rd],
+                           RV_REG_NAME[rs]);
                 emit_rv_or(code, enc_d, enc_d, RV_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
                 if (imm >= -2048 && imm <= 2047) {
-                    fprintf(stderr, "  OR  R%d, #%d -> ORI\n", rd, imm);
+                    diag_trace(diag, "  OR  R%d, #%d -> ORI\n", rd, imm);
                     emit_rv_ori(code, enc_d, enc_d, imm);
                 } else {
-                    fprintf(stderr, "  OR  R%d, #%d -> load t0; OR\n", rd, imm);
+                    diag_trace(diag, "  OR  R%d, #%d -> load t0; OR\n", rd, imm);
                     emit_rv_load_imm_full(code, RV_REG_T0, imm);
                     emit_rv_or(code, enc_d, enc_d, RV_REG_T0);
                 }
@@ -1013,22 +1077,22 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
         /* ---- XOR Rd, Rs/imm -------------------------------- 4/4-12 --- */
         case OP_XOR: {
             int rd = inst->operands[0].data.reg;
-            rv_validate_register(inst, rd);
+            rv_validate_register(diag, inst, rd);
             uint8_t enc_d = RV_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                rv_validate_register(inst, rs);
-                fprintf(stderr, "  XOR R%d, R%d -> XOR %s, %s, %s\n",
-                        rd, rs, RV_REG_NAME[rd], RV_REG_NAME[rd],
-                        RV_REG_NAME[rs]);
+                rv_validate_register(diag, inst, rs);
+                diag_trace(diag, "  XOR R%d, R%d -> XOR %s, %s, %s\n",
+                           rd, rs, RV_REG_NAME[rd], RV_REG_NAME[rd],
+                           RV_REG_NAME[rs]);
                 emit_rv_xor(code, enc_d, enc_d, RV_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
                 if (imm >= -2048 && imm <= 2047) {
-                    fprintf(stderr, "  XOR R%d, #%d -> XORI\n", rd, imm);
+                    diag_trace(diag, "  XOR R%d, #%d -> XORI\n", rd, imm);
                     emit_rv_xori(code, enc_d, enc_d, imm);
                 } else {
-                    fprintf(stderr, "  XOR R%d, #%d -> load t0; XOR\n", rd, imm);
+                    diag_trace(diag, "  XOR R%d, #%d -> load t0; XOR\n", rd, imm);
                     emit_rv_load_imm_full(code, RV_REG_T0, imm);
                     emit_rv_xor(code, enc_d, enc_d, RV_REG_T0);
                 }
@@ -1039,9 +1103,9 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
         /* ---- NOT Rd  ->  XORI Rd, Rd, -1 ------------------- 4 bytes -- */
         case OP_NOT: {
             int rd = inst->operands[0].data.reg;
-            rv_validate_register(inst, rd);
-            fprintf(stderr, "  NOT R%d -> XORI %s, %s, -1\n",
-                    rd, RV_REG_NAME[rd], RV_REG_NAME[rd]);
+            rv_validate_register(diag, inst, rd);
+            diag_trace(diag, "  NOT R%d -> XORI %s, %s, -1\n",
+                       rd, RV_REG_NAME[rd], RV_REG_NAME[rd]);
             emit_rv_xori(code, RV_REG_ENC[rd], RV_REG_ENC[rd], -1);
             break;
         }
@@ -1049,9 +1113,9 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
         /* ---- INC Rd  ->  ADDI Rd, Rd, 1 -------------------- 4 bytes -- */
         case OP_INC: {
             int rd = inst->operands[0].data.reg;
-            rv_validate_register(inst, rd);
-            fprintf(stderr, "  INC R%d -> ADDI %s, %s, 1\n",
-                    rd, RV_REG_NAME[rd], RV_REG_NAME[rd]);
+            rv_validate_register(diag, inst, rd);
+            diag_trace(diag, "  INC R%d -> ADDI %s, %s, 1\n",
+                       rd, RV_REG_NAME[rd], RV_REG_NAME[rd]);
             emit_rv_addi(code, RV_REG_ENC[rd], RV_REG_ENC[rd], 1);
             break;
         }
@@ -1059,9 +1123,9 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
         /* ---- DEC Rd  ->  ADDI Rd, Rd, -1 ------------------- 4 bytes -- */
         case OP_DEC: {
             int rd = inst->operands[0].data.reg;
-            rv_validate_register(inst, rd);
-            fprintf(stderr, "  DEC R%d -> ADDI %s, %s, -1\n",
-                    rd, RV_REG_NAME[rd], RV_REG_NAME[rd]);
+            rv_validate_register(diag, inst, rd);
+            diag_trace(diag, "  DEC R%d -> ADDI %s, %s, -1\n",
+                       rd, RV_REG_NAME[rd], RV_REG_NAME[rd]);
             emit_rv_addi(code, RV_REG_ENC[rd], RV_REG_ENC[rd], -1);
             break;
         }
@@ -1069,18 +1133,18 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
         /* ---- MUL Rd, Rs/imm  ->  MUL Rd, Rd, Rm ------ 4/12 bytes ---- */
         case OP_MUL: {
             int rd = inst->operands[0].data.reg;
-            rv_validate_register(inst, rd);
+            rv_validate_register(diag, inst, rd);
             uint8_t enc_d = RV_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                rv_validate_register(inst, rs);
-                fprintf(stderr, "  MUL R%d, R%d -> MUL %s, %s, %s\n",
-                        rd, rs, RV_REG_NAME[rd], RV_REG_NAME[rd],
-                        RV_REG_NAME[rs]);
+                rv_validate_register(diag, inst, rs);
+                diag_trace(diag, "  MUL R%d, R%d -> MUL %s, %s, %s\n",
+                           rd, rs, RV_REG_NAME[rd], RV_REG_NAME[rd],
+                           RV_REG_NAME[rs]);
                 emit_rv_mul(code, enc_d, enc_d, RV_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                fprintf(stderr, "  MUL R%d, #%d -> load t0; MUL\n", rd, imm);
+                diag_trace(diag, "  MUL R%d, #%d -> load t0; MUL\n", rd, imm);
                 emit_rv_load_imm_full(code, RV_REG_T0, imm);
                 emit_rv_mul(code, enc_d, enc_d, RV_REG_T0);
             }
@@ -1090,18 +1154,18 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
         /* ---- DIV Rd, Rs/imm  ->  DIV Rd, Rd, Rm ------ 4/12 bytes ---- */
         case OP_DIV: {
             int rd = inst->operands[0].data.reg;
-            rv_validate_register(inst, rd);
+            rv_validate_register(diag, inst, rd);
             uint8_t enc_d = RV_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                rv_validate_register(inst, rs);
-                fprintf(stderr, "  DIV R%d, R%d -> DIV %s, %s, %s\n",
-                        rd, rs, RV_REG_NAME[rd], RV_REG_NAME[rd],
-                        RV_REG_NAME[rs]);
+                rv_validate_register(diag, inst, rs);
+                diag_trace(diag, "  DIV R%d, R%d -> DIV %s, %s, %s\n",
+                           rd, rs, RV_REG_NAME[rd], RV_REG_NAME[rd],
+                           RV_REG_NAME[rs]);
                 emit_rv_div(code, enc_d, enc_d, RV_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                fprintf(stderr, "  DIV R%d, #%d -> load t0; DIV\n", rd, imm);
+                diag_trace(diag, "  DIV R%d, #%d -> load t0; DIV\n", rd, imm);
                 emit_rv_load_imm_full(code, RV_REG_T0, imm);
                 emit_rv_div(code, enc_d, enc_d, RV_REG_T0);
             }
@@ -1111,19 +1175,19 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
         /* ---- SHL Rd, Rs/imm -------------------------------- 4 bytes -- */
         case OP_SHL: {
             int rd = inst->operands[0].data.reg;
-            rv_validate_register(inst, rd);
+            rv_validate_register(diag, inst, rd);
             uint8_t enc_d = RV_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_IMMEDIATE) {
                 uint8_t shamt = (uint8_t)(inst->operands[1].data.imm & 0x3F);
-                fprintf(stderr, "  SHL R%d, #%d -> SLLI %s, %s, %d\n",
-                        rd, shamt, RV_REG_NAME[rd], RV_REG_NAME[rd], shamt);
+                diag_trace(diag, "  SHL R%d, #%d -> SLLI %s, %s, %d\n",
+                           rd, shamt, RV_REG_NAME[rd], RV_REG_NAME[rd], shamt);
                 emit_rv_slli(code, enc_d, enc_d, shamt);
             } else {
                 int rs = inst->operands[1].data.reg;
-                rv_validate_register(inst, rs);
-                fprintf(stderr, "  SHL R%d, R%d -> SLL %s, %s, %s\n",
-                        rd, rs, RV_REG_NAME[rd], RV_REG_NAME[rd],
-                        RV_REG_NAME[rs]);
+                rv_validate_register(diag, inst, rs);
+                diag_trace(diag, "  SHL R%d, R%d -> SLL %s, %s, %s\n",
+                           rd, rs, RV_REG_NAME[rd], RV_REG_NAME[rd],
+                           RV_REG_NAME[rs]);
                 emit_rv_sll(code, enc_d, enc_d, RV_REG_ENC[rs]);
             }
             break;
@@ -1132,19 +1196,19 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
         /* ---- SHR Rd, Rs/imm -------------------------------- 4 bytes -- */
         case OP_SHR: {
             int rd = inst->operands[0].data.reg;
-            rv_validate_register(inst, rd);
+            rv_validate_register(diag, inst, rd);
             uint8_t enc_d = RV_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_IMMEDIATE) {
                 uint8_t shamt = (uint8_t)(inst->operands[1].data.imm & 0x3F);
-                fprintf(stderr, "  SHR R%d, #%d -> SRLI %s, %s, %d\n",
-                        rd, shamt, RV_REG_NAME[rd], RV_REG_NAME[rd], shamt);
+                diag_trace(diag, "  SHR R%d, #%d -> SRLI %s, %s, %d\n",
+                           rd, shamt, RV_REG_NAME[rd], RV_REG_NAME[rd], shamt);
                 emit_rv_srli(code, enc_d, enc_d, shamt);
             } else {
                 int rs = inst->operands[1].data.reg;
-                rv_validate_register(inst, rs);
-                fprintf(stderr, "  SHR R%d, R%d -> SRL %s, %s, %s\n",
-                        rd, rs, RV_REG_NAME[rd], RV_REG_NAME[rd],
-                        RV_REG_NAME[rs]);
+                rv_validate_register(diag, inst, rs);
+                diag_trace(diag, "  SHR R%d, R%d -> SRL %s, %s, %s\n",
+                           rd, rs, RV_REG_NAME[rd], RV_REG_NAME[rd],
+                           RV_REG_NAME[rs]);
                 emit_rv_srl(code, enc_d, enc_d, RV_REG_ENC[rs]);
             }
             break;
@@ -1155,17 +1219,17 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
         /*  storing (Ra - Rb) in t0.  Subsequent BEQ/BNE test t0 vs x0.   */
         case OP_CMP: {
             int ra = inst->operands[0].data.reg;
-            rv_validate_register(inst, ra);
+            rv_validate_register(diag, inst, ra);
             uint8_t enc_a = RV_REG_ENC[ra];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rb = inst->operands[1].data.reg;
-                rv_validate_register(inst, rb);
-                fprintf(stderr, "  CMP R%d, R%d -> SUB t0, %s, %s\n",
-                        ra, rb, RV_REG_NAME[ra], RV_REG_NAME[rb]);
+                rv_validate_register(diag, inst, rb);
+                diag_trace(diag, "  CMP R%d, R%d -> SUB t0, %s, %s\n",
+                           ra, rb, RV_REG_NAME[ra], RV_REG_NAME[rb]);
                 emit_rv_sub(code, RV_REG_T0, enc_a, RV_REG_ENC[rb]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                fprintf(stderr, "  CMP R%d, #%d -> load t1; SUB t0\n", ra, imm);
+                diag_trace(diag, "  CMP R%d, #%d -> load t1; SUB t0\n", ra, imm);
                 emit_rv_load_imm_full(code, RV_REG_T1, imm);
                 emit_rv_sub(code, RV_REG_T0, enc_a, RV_REG_T1);
             }
@@ -1174,22 +1238,24 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
 
         /* ---- JMP label  ->  JAL x0, offset --------------- 4 bytes ---- */
         case OP_JMP: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  JMP %s -> JAL x0\n", label);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  JMP %s -> JAL x0\n", label);
             int patch_off = code->size;
             emit_rv_placeholder(code);
-            rv_add_fixup(&symtab, label, patch_off, patch_off, inst->line,
+            rv_add_fixup(&symtab, &fixups, label, patch_off, patch_off,
+                         inst,
                          RV_FIXUP_JAL, RV_REG_ZERO, 0, 0, 0);
             break;
         }
 
         /* ---- JZ label  ->  BEQ t0, x0, offset ----------- 4 bytes ---- */
         case OP_JZ: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  JZ  %s -> BEQ t0, x0\n", label);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  JZ  %s -> BEQ t0, x0\n", label);
             int patch_off = code->size;
             emit_rv_placeholder(code);
-            rv_add_fixup(&symtab, label, patch_off, patch_off, inst->line,
+            rv_add_fixup(&symtab, &fixups, label, patch_off, patch_off,
+                         inst,
                          RV_FIXUP_BRANCH, 0, RV_F3_BEQ,
                          RV_REG_T0, RV_REG_ZERO);
             break;
@@ -1197,11 +1263,12 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
 
         /* ---- JNZ label  ->  BNE t0, x0, offset ---------- 4 bytes ---- */
         case OP_JNZ: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  JNZ %s -> BNE t0, x0\n", label);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  JNZ %s -> BNE t0, x0\n", label);
             int patch_off = code->size;
             emit_rv_placeholder(code);
-            rv_add_fixup(&symtab, label, patch_off, patch_off, inst->line,
+            rv_add_fixup(&symtab, &fixups, label, patch_off, patch_off,
+                         inst,
                          RV_FIXUP_BRANCH, 0, RV_F3_BNE,
                          RV_REG_T0, RV_REG_ZERO);
             break;
@@ -1209,11 +1276,12 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
 
         /* ---- JL label  ->  BLT t0, x0, offset ----------- 4 bytes ---- */
         case OP_JL: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  JL  %s -> BLT t0, x0\n", label);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  JL  %s -> BLT t0, x0\n", label);
             int patch_off = code->size;
             emit_rv_placeholder(code);
-            rv_add_fixup(&symtab, label, patch_off, patch_off, inst->line,
+            rv_add_fixup(&symtab, &fixups, label, patch_off, patch_off,
+                         inst,
                          RV_FIXUP_BRANCH, 0, RV_F3_BLT,
                          RV_REG_T0, RV_REG_ZERO);
             break;
@@ -1222,11 +1290,12 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
         /* ---- JG label  ->  BLT x0, t0, offset ----------- 4 bytes ---- */
         /*  RISC-V has no BGT; use BLT with swapped operands.             */
         case OP_JG: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  JG  %s -> BLT x0, t0\n", label);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  JG  %s -> BLT x0, t0\n", label);
             int patch_off = code->size;
             emit_rv_placeholder(code);
-            rv_add_fixup(&symtab, label, patch_off, patch_off, inst->line,
+            rv_add_fixup(&symtab, &fixups, label, patch_off, patch_off,
+                         inst,
                          RV_FIXUP_BRANCH, 0, RV_F3_BLT,
                          RV_REG_ZERO, RV_REG_T0);
             break;
@@ -1234,27 +1303,28 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
 
         /* ---- CALL label  ->  JAL ra, offset -------------- 4 bytes ---- */
         case OP_CALL: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  CALL %s -> JAL ra\n", label);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  CALL %s -> JAL ra\n", label);
             int patch_off = code->size;
             emit_rv_placeholder(code);
-            rv_add_fixup(&symtab, label, patch_off, patch_off, inst->line,
+            rv_add_fixup(&symtab, &fixups, label, patch_off, patch_off,
+                         inst,
                          RV_FIXUP_JAL, RV_REG_RA, 0, 0, 0);
             break;
         }
 
         /* ---- RET  ->  JALR x0, ra, 0 -------------------- 4 bytes ---- */
         case OP_RET:
-            fprintf(stderr, "  RET -> JALR x0, ra, 0\n");
+            diag_trace(diag, "  RET -> JALR x0, ra, 0\n");
             emit_rv_jalr(code, RV_REG_ZERO, RV_REG_RA, 0);
             break;
 
         /* ---- PUSH Rs  ->  ADDI sp, sp, -8; SD Rs, 0(sp) -- 8 bytes --- */
         case OP_PUSH: {
             int rs = inst->operands[0].data.reg;
-            rv_validate_register(inst, rs);
-            fprintf(stderr, "  PUSH R%d -> ADDI sp, sp, -8; SD %s, 0(sp)\n",
-                    rs, RV_REG_NAME[rs]);
+            rv_validate_register(diag, inst, rs);
+            diag_trace(diag, "  PUSH R%d -> ADDI sp, sp, -8; SD %s, 0(sp)\n",
+                       rs, RV_REG_NAME[rs]);
             emit_rv_addi(code, RV_REG_SP, RV_REG_SP, -8);
             emit_rv_sd(code, RV_REG_ENC[rs], RV_REG_SP, 0);
             break;
@@ -1263,9 +1333,9 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
         /* ---- POP Rd  ->  LD Rd, 0(sp); ADDI sp, sp, 8 ---- 8 bytes --- */
         case OP_POP: {
             int rd = inst->operands[0].data.reg;
-            rv_validate_register(inst, rd);
-            fprintf(stderr, "  POP  R%d -> LD %s, 0(sp); ADDI sp, sp, 8\n",
-                    rd, RV_REG_NAME[rd]);
+            rv_validate_register(diag, inst, rd);
+            diag_trace(diag, "  POP  R%d -> LD %s, 0(sp); ADDI sp, sp, 8\n",
+                       rd, RV_REG_NAME[rd]);
             emit_rv_ld(code, RV_REG_ENC[rd], RV_REG_SP, 0);
             emit_rv_addi(code, RV_REG_SP, RV_REG_SP, 8);
             break;
@@ -1273,13 +1343,13 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
 
         /* ---- NOP -------------------------------------------- 4 bytes -- */
         case OP_NOP:
-            fprintf(stderr, "  NOP\n");
+            diag_trace(diag, "  NOP\n");
             emit_rv_nop(code);
             break;
 
         /* ---- HLT  ->  JALR x0, ra, 0 (RET) --------------- 4 bytes --- */
         case OP_HLT:
-            fprintf(stderr, "  HLT -> JALR x0, ra, 0\n");
+            diag_trace(diag, "  HLT -> JALR x0, ra, 0\n");
             emit_rv_jalr(code, RV_REG_ZERO, RV_REG_RA, 0);
             break;
 
@@ -1288,8 +1358,8 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
         /*  The syscall number should be loaded into a7 (R7) beforehand.  */
         case OP_INT: {
             uint32_t imm = (uint32_t)(inst->operands[0].data.imm & 0xFF);
-            fprintf(stderr, "  INT #%d -> ECALL (a7 should hold syscall #)\n",
-                    (int)imm);
+            diag_trace(diag, "  INT #%d -> ECALL (a7 should hold syscall #)\n",
+                       (int)imm);
             (void)imm;  /* ECALL uses a7 for syscall number */
             emit_rv_ecall(code);
             break;
@@ -1306,35 +1376,49 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
         /* ---- ORG addr — pad with zeros until target address ----------- */
         case OP_ORG: {
             uint32_t target = (uint32_t)inst->operands[0].data.imm;
-            while (code->size < (int)target) {
-                emit_byte(code, 0x00);
-            }
+            emit_fill(code, 0x00, (int)target - code->size);
             break;
         }
 
         /* ---- SET name, Rs/imm — store to variable --------------------- */
         case OP_SET: {
-            const char *vname = inst->operands[0].data.label;
-            int var_addr = rv_symtab_lookup(&symtab, vname);
+            const char *vname = strpool_get(strs, inst->operands[0].data.label_id);
+            int vr = regalloc_inst_reg(ra, i);
+            if (vr >= 0) {
+                if (inst->operands[1].type == OPERAND_REGISTER) {
+                    int rs = inst->operands[1].data.reg;
+                    rv_validate_register(diag, inst, rs);
+                    diag_trace(diag, "  SET %s, R%d -> MV x%d, %s\n",
+                               vname, rs, vr, RV_REG_NAME[rs]);
+                    emit_rv_addi(code, (uint8_t)vr, RV_REG_ENC[rs], 0);
+                } else {
+                    int32_t imm = (int32_t)inst->operands[1].data.imm;
+                    diag_trace(diag, "  SET %s, #%d -> load x%d, %d\n",
+                               vname, imm, vr, imm);
+                    rv_load_imm64(code, (uint8_t)vr, imm);
+                }
+                break;
+            }
+            int var_addr = symtab_lookup(&symtab, vname);
             if (var_addr < 0) {
                 char msg[256];
                 snprintf(msg, sizeof(msg),
                          "undefined variable '%s'", vname);
-                rv_error(inst, msg);
+                rv_error(diag, inst, msg);
             }
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                rv_validate_register(inst, rs);
-                fprintf(stderr, "  SET %s, R%d -> SD %s, [t0]\n",
-                        vname, rs, RV_REG_NAME[rs]);
+                rv_validate_register(diag, inst, rs);
+                diag_trace(diag, "  SET %s, R%d -> SD %s, [t0]\n",
+                           vname, rs, RV_REG_NAME[rs]);
                 /* Load address into t0 */
                 emit_rv_load_imm_full(code, RV_REG_T0, (int32_t)var_addr);
                 /* SD Rs, 0(t0) */
                 emit_rv_sd(code, RV_REG_ENC[rs], RV_REG_T0, 0);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                fprintf(stderr, "  SET %s, #%d -> SD t1, [t0]\n",
-                        vname, imm);
+                diag_trace(diag, "  SET %s, #%d -> SD t1, [t0]\n",
+                           vname, imm);
                 /* Load value into t1 */
                 emit_rv_load_imm_full(code, RV_REG_T1, imm);
                 /* Load address into t0 */
@@ -1348,25 +1432,32 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
         /* ---- GET Rd, name — load from variable or buffer address ------ */
         case OP_GET: {
             int rd = inst->operands[0].data.reg;
-            const char *vname = inst->operands[1].data.label;
-            rv_validate_register(inst, rd);
-            int var_addr = rv_symtab_lookup(&symtab, vname);
+            const char *vname = strpool_get(strs, inst->operands[1].data.label_id);
+            rv_validate_register(diag, inst, rd);
+            int vr = regalloc_inst_reg(ra, i);
+            if (vr >= 0) {
+                diag_trace(diag, "  GET R%d, %s -> MV %s, x%d\n",
+                           rd, vname, RV_REG_NAME[rd], vr);
+                emit_rv_addi(code, RV_REG_ENC[rd], (uint8_t)vr, 0);
+                break;
+            }
+            int var_addr = symtab_lookup(&symtab, vname);
             if (var_addr < 0) {
                 char msg[256];
                 snprintf(msg, sizeof(msg),
                          "undefined variable '%s'", vname);
-                rv_error(inst, msg);
+                rv_error(diag, inst, msg);
             }
             int is_buf = rv_buftab_has(&buftab, vname);
             if (is_buf) {
-                fprintf(stderr, "  GET R%d, %s -> LUI+ADDI %s (buffer address)\n",
-                        rd, vname, RV_REG_NAME[rd]);
+                diag_trace(diag, "  GET R%d, %s -> LUI+ADDI %s (buffer address)\n",
+                           rd, vname, RV_REG_NAME[rd]);
                 /* Load address into t0, then MV Rd, t0 */
                 emit_rv_load_imm_full(code, RV_REG_T0, (int32_t)var_addr);
                 emit_rv_addi(code, RV_REG_ENC[rd], RV_REG_T0, 0);
             } else {
-                fprintf(stderr, "  GET R%d, %s -> LD %s, [t0]\n",
-                        rd, vname, RV_REG_NAME[rd]);
+                diag_trace(diag, "  GET R%d, %s -> LD %s, [t0]\n",
+                           rd, vname, RV_REG_NAME[rd]);
                 /* Load address into t0 */
                 emit_rv_load_imm_full(code, RV_REG_T0, (int32_t)var_addr);
                 /* LD Rd, 0(t0) */
@@ -1378,12 +1469,12 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
         /* ---- LDS Rd, "str"  ->  LUI+ADDI Rd, addr -------- 8 bytes --- */
         case OP_LDS: {
             int rd = inst->operands[0].data.reg;
-            const char *str = inst->operands[1].data.string;
-            rv_validate_register(inst, rd);
-            int str_idx = rv_strtab_add(&strtab, str);
+            const char *str = strpool_get(strs, inst->operands[1].data.string_id);
+            rv_validate_register(diag, inst, rd);
+            int str_idx = rv_strtab_add(&strtab, str, diag);
             int str_addr = str_base + strtab.strings[str_idx].offset;
-            fprintf(stderr, "  LDS R%d, \"%s\" -> LUI+ADDI %s, #%d\n",
-                    rd, str, RV_REG_NAME[rd], str_addr);
+            diag_trace(diag, "  LDS R%d, \"%s\" -> LUI+ADDI %s, #%d\n",
+                       rd, str, RV_REG_NAME[rd], str_addr);
             emit_rv_load_imm_full(code, RV_REG_ENC[rd], (int32_t)str_addr);
             break;
         }
@@ -1392,10 +1483,10 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
         case OP_LOADB: {
             int rd = inst->operands[0].data.reg;
             int rs = inst->operands[1].data.reg;
-            rv_validate_register(inst, rd);
-            rv_validate_register(inst, rs);
-            fprintf(stderr, "  LOADB R%d, R%d -> LBU %s, 0(%s)\n",
-                    rd, rs, RV_REG_NAME[rd], RV_REG_NAME[rs]);
+            rv_validate_register(diag, inst, rd);
+            rv_validate_register(diag, inst, rs);
+            diag_trace(diag, "  LOADB R%d, R%d -> LBU %s, 0(%s)\n",
+                       rd, rs, RV_REG_NAME[rd], RV_REG_NAME[rs]);
             /* LBU: I-type, funct3=0x4, opcode=0x03 */
             emit_rv32(code, rv_i_type(0, RV_REG_ENC[rs], 0x4,
                                       RV_REG_ENC[rd], RV_OP_LOAD));
@@ -1406,10 +1497,10 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
         case OP_STOREB: {
             int rx = inst->operands[0].data.reg;
             int ry = inst->operands[1].data.reg;
-            rv_validate_register(inst, rx);
-            rv_validate_register(inst, ry);
-            fprintf(stderr, "  STOREB R%d, R%d -> SB %s, 0(%s)\n",
-                    rx, ry, RV_REG_NAME[rx], RV_REG_NAME[ry]);
+            rv_validate_register(diag, inst, rx);
+            rv_validate_register(diag, inst, ry);
+            diag_trace(diag, "  STOREB R%d, R%d -> SB %s, 0(%s)\n",
+                       rx, ry, RV_REG_NAME[rx], RV_REG_NAME[ry]);
             /* SB: S-type, funct3=0x0, opcode=0x23 */
             emit_rv32(code, rv_s_type(0, RV_REG_ENC[rx], RV_REG_ENC[ry],
                                       0x0, RV_OP_STORE));
@@ -1418,25 +1509,25 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
 
         /* ---- SYS  ->  ECALL ----------------------------- 4 bytes --- */
         case OP_SYS:
-            fprintf(stderr, "  SYS -> ECALL\n");
+            diag_trace(diag, "  SYS -> ECALL\n");
             emit_rv_ecall(code);
             break;
 
         /* ---- WFI ------------------------------------------ 4 bytes --- */
         case OP_WFI:
-            fprintf(stderr, "  WFI\n");
+            diag_trace(diag, "  WFI\n");
             emit_rv32(code, 0x10500073u);  /* WFI */
             break;
 
         /* ---- EBREAK --------------------------------------- 4 bytes --- */
         case OP_EBREAK:
-            fprintf(stderr, "  EBREAK\n");
+            diag_trace(diag, "  EBREAK\n");
             emit_rv32(code, 0x00100073u);  /* EBREAK */
             break;
 
         /* ---- FENCE iorw, iorw ----------------------------- 4 bytes --- */
         case OP_FENCE:
-            fprintf(stderr, "  FENCE\n");
+            diag_trace(diag, "  FENCE\n");
             emit_rv32(code, 0x0FF0000Fu);  /* FENCE iorw, iorw */
             break;
 
@@ -1445,20 +1536,24 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
             snprintf(msg, sizeof(msg),
                      "opcode '%s' is not supported by the RISC-V backend",
                      opcode_name(inst->opcode));
-            rv_error(inst, msg);
+            rv_error(diag, inst, msg);
             break;
         }
         }
     }
 
+    if (ra) regalloc_free(ra);
+
     /* --- Pass 3: patch branch / jump relocations ----------------------- */
-    for (int f = 0; f < symtab.fix_count; f++) {
-        RVFixup *fix = &symtab.fixups[f];
-        int target = rv_symtab_lookup(&symtab, fix->label);
+    for (int f = 0; f < fixups.count; f++) {
+        RVFixup *fix = fixvec_at(&fixups, RVFixup, f);
+        int target = symtab_lookup(&symtab, fix->label);
         if (target < 0) {
-            fprintf(stderr,
-                    "RISC-V: undefined label or variable '%s' (line %d)\n",
-                    fix->label, fix->line);
+            diag_printf(diag,
+                        "RISC-V: %s, Line %d: undefined label or variable '%s'\n",
+                        fix->inst->file, fix->inst->line, fix->label);
+            symtab_free(&symtab);
+            fixvec_free(&fixups);
             free_code_buffer(code);
             return NULL;
         }
@@ -1467,9 +1562,11 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
         if (fix->fixup_type == RV_FIXUP_JAL) {
             /* J-type offset: ±1 MiB.  Check range. */
             if (offset < -(1 << 20) || offset >= (1 << 20)) {
-                fprintf(stderr,
-                        "RISC-V: JAL target '%s' out of range (line %d)\n",
-                        fix->label, fix->line);
+                diag_printf(diag,
+                            "RISC-V: %s, Line %d: JAL target '%s' out of range\n",
+                            fix->inst->file, fix->inst->line, fix->label);
+                symtab_free(&symtab);
+                fixvec_free(&fixups);
                 free_code_buffer(code);
                 return NULL;
             }
@@ -1478,9 +1575,11 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
         } else {
             /* B-type offset: ±4 KiB.  Check range. */
             if (offset < -(1 << 12) || offset >= (1 << 12)) {
-                fprintf(stderr,
-                        "RISC-V: branch target '%s' out of range (line %d)\n",
-                        fix->label, fix->line);
+                diag_printf(diag,
+                            "RISC-V: %s, Line %d: branch target '%s' out of range\n",
+                            fix->inst->file, fix->inst->line, fix->label);
+                symtab_free(&symtab);
+                fixvec_free(&fixups);
                 free_code_buffer(code);
                 return NULL;
             }
@@ -1490,33 +1589,71 @@ CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count)
         }
     }
 
-    /* --- Append variable data section --------------------------------- */
-    int data_start = code->size;
-    for (int v = 0; v < vartab.count; v++) {
-        int64_t val = vartab.vars[v].has_init ? vartab.vars[v].init_value : 0;
-        for (int b = 0; b < RV_VAR_SIZE; b++) {
-            emit_byte(code, (uint8_t)((val >> (b * 8)) & 0xFF));
-        }
-    }
-
-    /* --- Append buffer data section (zero-initialised) ----------------- */
-    for (int b = 0; b < buftab.count; b++) {
-        for (int i = 0; i < buftab.bufs[b].size; i++) {
-            emit_byte(code, 0x00);
-        }
+    /* Export code labels and the code/data split (ELF symbols, segments) */
+    code->code_size = code->size;
+    for (int i = 0; i < ir_count; i++) {
+        if (!ir[i].is_label) continue;
+        const char *lname = strpool_get(strs, ir[i].label_id);
+        if (symtab_lookup(&code->labels, lname) < 0)
+            symtab_add(&code->labels, lname, symtab_lookup(&symtab, lname));
     }
+    symtab_free(&symtab);
+    fixvec_free(&fixups);
 
     /* --- Append string data section ----------------------------------- */
     for (int s = 0; s < strtab.count; s++) {
         const char *p = strtab.strings[s].text;
         int len = strtab.strings[s].length;
-        for (int b = 0; b < len; b++)
-            emit_byte(code, (uint8_t)p[b]);
+        emit_bytes(code, p, len);
         emit_byte(code, 0x00);
     }
 
-    fprintf(stderr, "[RISC-V] Emitted %d bytes (%d code + %d var + %d buf + %d str)\n",
-            code->size, data_start,
-            vartab.count * RV_VAR_SIZE, buftab.total_size, strtab.total_size);
+    code->str_size = code->size - code->code_size;
+    emit_fill(code, 0x00, str_end - code->size);
+    code->data_offset = code->size;
+    code->seg_gap     = seg_gap;
+
+    /* --- Append initialised variable data ------------------------------ */
+    for (int v = 0; v < vartab.count; v++) {
+        if (!vartab.vars[v].has_init) continue;
+        emit_le64(code, (uint64_t)vartab.vars[v].init_value);
+    }
+
+    /* --- Zero-initialised storage (uninitialised VARs, BUFFERs) -------- */
+    int bss_end = buf_base + buftab.total_size;
+    code->bss_size = (bss_end > bss_base) ? bss_end - data_end : 0;
+
+    diag_log(diag, DIAG_NORMAL, "[RISC-V] Emitted %d bytes (%d code + %d str + %d var) + %d bss\n",
+             code->size, code_end, str_end - code_end,
+             init_vars * RV_VAR_SIZE, code->bss_size);
     return code;
 }
+
+/* =========================================================================
+ *  ELF target  (-sys linux)
+ *
+ *  Start stub, right before the user code:
+ *    010000EF    JAL  ra, user_code        ; +16 = stub end
+ *    05D00893    ADDI a7, zero, 93         ; __NR_exit (generic table)
+ *    00000073    ECALL                     ; exit(a0)
+ *    0000006F    JAL  zero, .              ; never reached
+ * ========================================================================= */
+static const uint8_t RV_ELF_START_STUB[16] = {
+    0xEF, 0x00, 0x00, 0x01,
+    0x93, 0x08, 0xD0, 0x05,
+    0x73, 0x00, 0x00, 0x00,
+    0x6F, 0x00, 0x00, 0x00
+};
+
+static const ElfTarget RV_ELF_TARGET = {
+    ELF_CLASS64, ELF_EM_RISCV,
+    0,                                  /* soft-float ABI, no RVC      */
+    0x00010000,                         /* the usual ld base address   */
+    4,                                  /* 32-bit instructions         */
+    RV_ELF_START_STUB, (int)sizeof(RV_ELF_START_STUB)
+};
+
+const ElfTarget* elf_target_risc_v(void)
+{
+    return &RV_ELF_TARGET;
+}
@@ -60,6 +60,7 @@
 
 #include "parser.h"
 #include "codegen.h"    /* CodeBuffer, free_code_buffer, hexdump */
+#include "emitter_elf.h" /* ElfTarget */
 
 /* =========================================================================
  *  Public API
@@ -69,10 +70,29 @@
  * generate_risc_v()
  *   Translates the architecture-neutral UA IR into raw RISC-V machine code.
  *   Returns a CodeBuffer that the caller must free with free_code_buffer().
+ *   `strs` is the string pool filled by parse() for this IR; messages go
+ *   to `diag`.
  *
  *   Generates RV64I + RV64M instructions (64-bit base integer + multiply).
  *   Uses the standard RISC-V calling convention for register allocation.
+ *   With `alloc_vars` set (-O2), VARs are kept in t3-t6 where possible.
+ *   `seg_gap` is the run-time distance put between code, strings and
+ *   data (see CodeBuffer.seg_gap; 0 = packed).  Strings, VARs and
+ *   BUFFERs are addressed absolutely, with bytes[0] at run-time address
+ *   `origin` (elf_code_origin() for ELF, else 0).
  */
-CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count);
+CodeBuffer* generate_risc_v(const Instruction *ir, int ir_count,
+                            const StrPool *strs, int alloc_vars,
+                            int seg_gap, int origin,
+                            UaDiag *diag);
+
+/*
+ * elf_target_risc_v()
+ *   ELF description of this backend for -sys linux: ELF64, EM_RISCV,
+ *   loaded at 0x00010000.  e_flags is 0: soft-float ABI, no compressed
+ *   instructions (the backend emits neither FP nor RVC code).  The start
+ *   stub calls the code and passes a0 to exit(2) (number in a7).
+ */
+const ElfTarget* elf_target_risc_v(void);
 
 #endif /* UA_BACKEND_RISC_V_H */
@@ -33,6 +33,8 @@
  *  │  SHR  r32, imm8     C1 /5 ib                3 bytes                │
  *  │  CMP  r32, r32      39 ModRM                2 bytes                │
  *  │  CMP  r32, imm32    81 /7 id                6 bytes                │
+ *  │  JMP  rel8          EB cb                   2 bytes (relaxed)      │
+ *  │  Jcc  rel8          70+cc cb                2 bytes (relaxed)      │
  *  │  JMP  rel32         E9 cd                   5 bytes                │
  *  │  JZ   rel32         0F 84 cd                6 bytes                │
  *  │  JNZ  rel32         0F 85 cd                6 bytes                │
@@ -87,18 +89,19 @@ static const char* X32_REG_NAME[X32_MAX_REG] = {
 /* =========================================================================
  *  Error helpers
  * ========================================================================= */
-static void x32_error(const Instruction *inst, const char *msg)
+static void x32_error(UaDiag *diag, const Instruction *inst,
+                      const char *msg)
 {
-    fprintf(stderr,
-            "\n"
-            "  UA x86-32 Backend Error\n"
-            "  ------------------------\n"
-            "  Line %d, Column %d: %s\n\n",
-            inst->line, inst->column, msg);
-    exit(1);
+    diag_printf(diag,
+                "\n"
+                "  UA x86-32 Backend Error\n"
+                "  ------------------------\n"
+                "  %s, Line %d, Column %d: %s\n\n",
+                inst->file, inst->line, inst->column, msg);
+    diag_fatal(diag);
 }
 
-static void x32_validate_register(const Instruction *inst, int reg)
+static void x32_validate_register(UaDiag *diag, const Instruction *inst, int reg)
 {
     if (reg < 0 || reg >= X32_MAX_REG) {
         char msg[128];
@@ -106,7 +109,7 @@ static void x32_validate_register(const Instruction *inst, int reg)
                  "register R%d is not mapped in the x86-32 backend "
                  "(supports R0-R7: EAX, ECX, EDX, EBX, ESP, EBP, ESI, EDI)",
                  reg);
-        x32_error(inst, msg);
+        x32_error(diag, inst, msg);
     }
 }
 
@@ -118,10 +121,7 @@ static void x32_validate_register(const Instruction *inst, int reg)
 static void emit_mov_r32_imm32(CodeBuffer *buf, uint8_t rd, int32_t imm)
 {
     emit_byte(buf, (uint8_t)(0xB8 + rd));
-    emit_byte(buf, (uint8_t)( imm        & 0xFF));
-    emit_byte(buf, (uint8_t)((imm >>  8) & 0xFF));
-    emit_byte(buf, (uint8_t)((imm >> 16) & 0xFF));
-    emit_byte(buf, (uint8_t)((imm >> 24) & 0xFF));
+    emit_le32(buf, (uint32_t)imm);
 }
 
 /* --- Generic opcode + ModR/M(reg,rm) : 2 bytes ------------------------- */
@@ -281,10 +281,7 @@ static void emit_cmp_r32_imm32(CodeBuffer *buf, uint8_t rd, int32_t imm)
 {
     emit_byte(buf, 0x81);
     emit_byte(buf, (uint8_t)(0xC0 | (7 << 3) | rd));
-    emit_byte(buf, (uint8_t)( imm        & 0xFF));
-    emit_byte(buf, (uint8_t)((imm >>  8) & 0xFF));
-    emit_byte(buf, (uint8_t)((imm >> 16) & 0xFF));
-    emit_byte(buf, (uint8_t)((imm >> 24) & 0xFF));
+    emit_le32(buf, (uint32_t)imm);
 }
 
 /* --- PUSH r32  (50+rd) : 1 byte ---------------------------------------- */
@@ -321,10 +318,7 @@ static void emit_int_imm8(CodeBuffer *buf, uint8_t imm)
 /* --- rel32 placeholder helpers ----------------------------------------- */
 static void emit_rel32_placeholder(CodeBuffer *buf)
 {
-    emit_byte(buf, 0x00);
-    emit_byte(buf, 0x00);
-    emit_byte(buf, 0x00);
-    emit_byte(buf, 0x00);
+    emit_le32(buf, 0);
 }
 
 static void patch_rel32(CodeBuffer *buf, int offset, int32_t value)
@@ -336,78 +330,35 @@ static void patch_rel32(CodeBuffer *buf, int offset, int32_t value)
 }
 
 /* =========================================================================
- *  Symbol table for labels
+ *  Branch / data fixups  (labels live in the shared SymbolTable)
  * ========================================================================= */
-#define X32_MAX_SYMBOLS  256
-#define X32_MAX_FIXUPS   256
-
-typedef struct {
-    char name[UA_MAX_LABEL_LEN];
-    int  address;
-} X32Symbol;
-
 typedef struct {
-    char  label[UA_MAX_LABEL_LEN];
+    const char *label;      /* interned in the SymbolTable               */
     int   patch_offset;
     int   instr_end;
-    int   line;
+    const Instruction *inst; /* file and line for error messages */
+    int   rel8;             /* 1 = short branch, patch a single byte     */
 } X32Fixup;
 
-typedef struct {
-    X32Symbol symbols[X32_MAX_SYMBOLS];
-    int       sym_count;
-    X32Fixup  fixups[X32_MAX_FIXUPS];
-    int       fix_count;
-} X32SymTab;
-
-static void x32_symtab_init(X32SymTab *st)
-{
-    st->sym_count = 0;
-    st->fix_count = 0;
-}
-
-static void x32_symtab_add(X32SymTab *st, const char *name, int address)
-{
-    if (st->sym_count >= X32_MAX_SYMBOLS) {
-        fprintf(stderr, "x86-32: symbol table overflow\n");
-        exit(1);
-    }
-    strncpy(st->symbols[st->sym_count].name, name, UA_MAX_LABEL_LEN - 1);
-    st->symbols[st->sym_count].name[UA_MAX_LABEL_LEN - 1] = '\0';
-    st->symbols[st->sym_count].address = address;
-    st->sym_count++;
-}
-
-static int x32_symtab_lookup(const X32SymTab *st, const char *name)
-{
-    for (int i = 0; i < st->sym_count; i++) {
-        if (strcmp(st->symbols[i].name, name) == 0)
-            return st->symbols[i].address;
-    }
-    return -1;
-}
-
-static void x32_add_fixup(X32SymTab *st, const char *label,
-                           int patch_offset, int instr_end, int line)
+static void x32_add_fixup(SymbolTable *st, FixupVec *fixups,
+                          const char *label, int patch_offset,
+                          int instr_end, const Instruction *inst)
 {
-    if (st->fix_count >= X32_MAX_FIXUPS) {
-        fprintf(stderr, "x86-32: fixup table overflow\n");
-        exit(1);
-    }
-    X32Fixup *f = &st->fixups[st->fix_count++];
-    strncpy(f->label, label, UA_MAX_LABEL_LEN - 1);
-    f->label[UA_MAX_LABEL_LEN - 1] = '\0';
+    X32Fixup *f = (X32Fixup *)fixvec_push(fixups);
+    f->label        = symtab_intern(st, label);
     f->patch_offset = patch_offset;
     f->instr_end    = instr_end;
-    f->line         = line;
+    f->inst         = inst;
+    f->rel8         = 0;
 }
 
 /* =========================================================================
  *  instruction_size_x32()  —  compute byte size of each instruction
  *
  *  x86-32 encodings are shorter than x86-64 (no REX prefix).
+ *  `short_branch` selects the rel8 form of JMP / Jcc.
  * ========================================================================= */
-static int instruction_size_x32(const Instruction *inst)
+static int instruction_size_x32(const Instruction *inst, int short_branch)
 {
     if (inst->is_label) return 0;
 
@@ -464,11 +415,11 @@ static int instruction_size_x32(const Instruction *inst)
                 return 2;
             else
                 return 6;  /* CMP r/m32, imm32 */
-        case OP_JMP:    return 5;   /* E9 rel32 */
-        case OP_JZ:     return 6;   /* 0F 84 rel32 */
-        case OP_JNZ:    return 6;   /* 0F 85 rel32 */
-        case OP_JL:     return 6;   /* 0F 8C rel32 */
-        case OP_JG:     return 6;   /* 0F 8F rel32 */
+        case OP_JMP:    return short_branch ? 2 : 5;   /* EB rel8 / E9 rel32 */
+        case OP_JZ:     return short_branch ? 2 : 6;   /* 74 rel8 / 0F 84 rel32 */
+        case OP_JNZ:    return short_branch ? 2 : 6;   /* 75 rel8 / 0F 85 rel32 */
+        case OP_JL:     return short_branch ? 2 : 6;   /* 7C rel8 / 0F 8C rel32 */
+        case OP_JG:     return short_branch ? 2 : 6;   /* 7F rel8 / 0F 8F rel32 */
         case OP_CALL:   return 5;   /* E8 rel32 */
         case OP_RET:    return 1;
         case OP_PUSH:   return 1;
@@ -515,6 +466,112 @@ static int instruction_size_x32(const Instruction *inst)
     }
 }
 
+/* =========================================================================
+ *  Branch relaxation  —  same scheme as the x86-64 backend: start with
+ *  rel32 everywhere, shrink to rel8 (EB / 7x) until nothing changes, and
+ *  pin a branch back to rel32 if @ORG pushes its target out of range.
+ * ========================================================================= */
+#define X32_BR_NEAR    0    /* rel32                                    */
+#define X32_BR_SHORT   1    /* rel8                                     */
+#define X32_BR_PINNED  2    /* rel32, rel8 was tried and went out of range */
+
+static int x32_is_relaxable(const Instruction *inst)
+{
+    if (inst->is_label) return 0;
+    switch (inst->opcode) {
+        case OP_JMP: case OP_JZ: case OP_JNZ: case OP_JL: case OP_JG:
+            return inst->operands[0].type == OPERAND_LABEL_REF;
+        default:
+            return 0;
+    }
+}
+
+static uint8_t* x32_relax_branches(const Instruction *ir, int ir_count,
+                                   const StrPool *strs)
+{
+    uint8_t *form     = (uint8_t *)calloc((size_t)ir_count + 1, 1);
+    int     *inst_pc  = (int *)malloc(((size_t)ir_count + 1) * sizeof(int));
+    int     *label_at = (int *)malloc((size_t)strs->count * sizeof(int));
+    if (!form || !inst_pc || !label_at) {
+        free(form); free(inst_pc); free(label_at);
+        return NULL;
+    }
+
+    /* Label name -> IR index of its first definition */
+    for (int id = 0; id < strs->count; id++) label_at[id] = -1;
+    for (int i = 0; i < ir_count; i++) {
+        if (ir[i].is_label && label_at[ir[i].label_id] < 0)
+            label_at[ir[i].label_id] = i;
+    }
+
+    int changed;
+    do {
+        int pc = 0;
+        for (int i = 0; i < ir_count; i++) {
+            const Instruction *inst = &ir[i];
+            inst_pc[i] = pc;
+            if (!inst->is_label && inst->opcode == OP_ORG) {
+                int target = (int)(uint32_t)inst->operands[0].data.imm;
+                if (target > pc) pc = target;
+            } else {
+                pc += instruction_size_x32(inst, form[i] == X32_BR_SHORT);
+            }
+        }
+        inst_pc[ir_count] = pc;
+
+        changed = 0;
+        for (int i = 0; i < ir_count; i++) {
+            if (form[i] == X32_BR_PINNED || !x32_is_relaxable(&ir[i]))
+                continue;
+            int t = label_at[ir[i].operands[0].data.label_id];
+            if (t < 0) continue;
+
+            int target = inst_pc[t];
+            if (form[i] == X32_BR_SHORT) {
+                int rel = target - (inst_pc[i] + 2);
+                if (rel < -128 || rel > 127) {
+                    form[i] = X32_BR_PINNED;
+                    changed = 1;
+                }
+            } else {
+                int shrink = instruction_size_x32(&ir[i], 0) - 2;
+                if (t > i) target -= shrink;
+                int rel = target - (inst_pc[i] + 2);
+                if (rel >= -128 && rel <= 127) {
+                    form[i] = X32_BR_SHORT;
+                    changed = 1;
+                }
+            }
+        }
+    } while (changed);
+
+    free(inst_pc);
+    free(label_at);
+    return form;
+}
+
+/* Emit JMP (cc < 0) or Jcc label in the form chosen by relaxation */
+static void x32_emit_branch(CodeBuffer *code, SymbolTable *st,
+                            FixupVec *fixups, const char *label,
+                            int cc, int is_short, const Instruction *inst)
+{
+    if (is_short) {
+        emit_byte(code, (uint8_t)(cc < 0 ? 0xEB : 0x70 | cc));
+    } else if (cc < 0) {
+        emit_byte(code, 0xE9);
+    } else {
+        emit_byte(code, 0x0F);
+        emit_byte(code, (uint8_t)(0x80 | cc));
+    }
+    int patch_off = code->size;
+    if (is_short)
+        emit_byte(code, 0x00);
+    else
+        emit_rel32_placeholder(code);
+    x32_add_fixup(st, fixups, label, patch_off, code->size, inst);
+    fixvec_at(fixups, X32Fixup, fixups->count - 1)->rel8 = is_short;
+}
+
 /* =========================================================================
  *  Variable table for x86-32
  * ========================================================================= */
@@ -555,16 +612,17 @@ static void x32_buftab_init(X32BufTable *bt) {
     bt->total_size = 0;
 }
 
-static int x32_buftab_add(X32BufTable *bt, const char *name, int size) {
+static int x32_buftab_add(X32BufTable *bt, const char *name, int size,
+                          UaDiag *diag) {
     for (int i = 0; i < bt->count; i++) {
         if (strcmp(bt->bufs[i].name, name) == 0) {
-            fprintf(stderr, "x86-32: duplicate buffer '%s'\n", name);
+            diag_printf(diag, "x86-32: duplicate buffer '%s'\n", name);
             return -1;
         }
     }
     if (bt->count >= X32_MAX_BUFFERS) {
-        fprintf(stderr, "x86-32: buffer table overflow (max %d)\n",
-                X32_MAX_BUFFERS);
+        diag_printf(diag, "x86-32: buffer table overflow (max %d)\n",
+                    X32_MAX_BUFFERS);
         return -1;
     }
     X32BufEntry *b = &bt->bufs[bt->count++];
@@ -605,13 +663,14 @@ static void x32_strtab_init(X32StringTable *st) {
     st->total_size = 0;
 }
 
-static int x32_strtab_add(X32StringTable *st, const char *text) {
+static int x32_strtab_add(X32StringTable *st, const char *text,
+                          UaDiag *diag) {
     /* De-duplicate */
     for (int i = 0; i < st->count; i++)
         if (strcmp(st->strings[i].text, text) == 0) return i;
     if (st->count >= X32_MAX_STRINGS) {
-        fprintf(stderr, "x86-32: string table overflow (max %d)\n",
-                X32_MAX_STRINGS);
+        diag_printf(diag, "x86-32: string table overflow (max %d)\n",
+                    X32_MAX_STRINGS);
         return 0;
     }
     int idx = st->count++;
@@ -624,17 +683,18 @@ static int x32_strtab_add(X32StringTable *st, const char *text) {
 }
 
 static int x32_vartab_add(X32VarTable *vt, const char *name,
-                          int32_t init_value, int has_init)
+                          int32_t init_value, int has_init,
+                          UaDiag *diag)
 {
     for (int i = 0; i < vt->count; i++) {
         if (strcmp(vt->vars[i].name, name) == 0) {
-            fprintf(stderr, "x86-32: duplicate variable '%s'\n", name);
+            diag_printf(diag, "x86-32: duplicate variable '%s'\n", name);
             return -1;
         }
     }
     if (vt->count >= X32_MAX_VARS) {
-        fprintf(stderr, "x86-32: variable table overflow (max %d)\n",
-                X32_MAX_VARS);
+        diag_printf(diag, "x86-32: variable table overflow (max %d)\n",
+                    X32_MAX_VARS);
         return -1;
     }
     X32VarEntry *v = &vt->vars[vt->count++];
@@ -648,14 +708,20 @@ static int x32_vartab_add(X32VarTable *vt, const char *name,
 /* =========================================================================
  *  generate_x86_32()  —  main entry point  (two-pass)
  * ========================================================================= */
-CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
+CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count,
+                            const StrPool *strs, int seg_gap, int origin,
+                            UaDiag *diag)
 {
-    fprintf(stderr, "[x86-32] Generating code for %d IR instructions ...\n",
-            ir_count);
+    diag_log(diag, DIAG_NORMAL, "[x86-32] Generating code for %d IR instructions ...\n",
+             ir_count);
 
     /* --- Pass 1: collect label addresses + variable declarations ------- */
-    X32SymTab symtab;
-    x32_symtab_init(&symtab);
+    SymbolTable symtab;
+    symtab_init(&symtab, diag);
+    diag_own(diag, &symtab, symtab_drop);
+    FixupVec fixups;
+    fixvec_init(&fixups, sizeof(X32Fixup), diag);
+    diag_own(diag, &fixups, fixvec_drop);
 
     X32VarTable vartab;
     x32_vartab_init(&vartab);
@@ -666,13 +732,22 @@ CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
     X32BufTable buftab;
     x32_buftab_init(&buftab);
 
+    uint8_t *br_form = x32_relax_branches(ir, ir_count, strs);
+    if (!br_form) {
+        diag_printf(diag, "UA x86-32: out of memory\n");
+        symtab_free(&symtab);
+        fixvec_free(&fixups);
+        return NULL;
+    }
+    diag_own(diag, &br_form, diag_free_ptr);
+
     int pc = 0;
     for (int i = 0; i < ir_count; i++) {
         const Instruction *inst = &ir[i];
         if (inst->is_label) {
-            x32_symtab_add(&symtab, inst->label_name, pc);
+            symtab_add(&symtab, strpool_get(strs, inst->label_id), pc);
         } else if (inst->opcode == OP_VAR) {
-            const char *vname = inst->operands[0].data.label;
+            const char *vname = strpool_get(strs, inst->operands[0].data.label_id);
             int32_t init_val  = 0;
             int     has_init  = 0;
             if (inst->operand_count >= 2 &&
@@ -680,52 +755,78 @@ CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
                 init_val = (int32_t)inst->operands[1].data.imm;
                 has_init = 1;
             }
-            x32_vartab_add(&vartab, vname, init_val, has_init);
+            x32_vartab_add(&vartab, vname, init_val, has_init, diag);
         } else if (inst->opcode == OP_BUFFER) {
-            const char *bname = inst->operands[0].data.label;
+            const char *bname = strpool_get(strs, inst->operands[0].data.label_id);
             int bsize = (int)inst->operands[1].data.imm;
-            x32_buftab_add(&buftab, bname, bsize);
+            x32_buftab_add(&buftab, bname, bsize, diag);
         } else if (inst->opcode == OP_ORG) {
             uint32_t target = (uint32_t)inst->operands[0].data.imm;
             if ((int)target < pc) {
-                fprintf(stderr, "Error: @ORG 0x%X would move address "
-                        "backwards (current PC = 0x%X)\n",
-                        target, (unsigned)pc);
-                exit(1);
+                diag_printf(diag, "Error: @ORG 0x%X would move address "
+                            "backwards (current PC = 0x%X)\n",
+                            target, (unsigned)pc);
+                diag_fatal(diag);
             }
             pc = (int)target;
         } else {
             /* Collect LDS string literals */
             if (inst->opcode == OP_LDS)
-                x32_strtab_add(&strtab, inst->operands[1].data.string);
-            pc += instruction_size_x32(inst);
+                x32_strtab_add(&strtab, strpool_get(strs, inst->operands[1].data.string_id),
+                               diag);
+            pc += instruction_size_x32(inst, br_form[i] == X32_BR_SHORT);
         }
     }
 
-    /* Register variable symbols: each at code_end + index * 4 */
-    int var_base = pc;
-    for (int v = 0; v < vartab.count; v++) {
-        x32_symtab_add(&symtab, vartab.vars[v].name,
-                        var_base + v * X32_VAR_SIZE);
-    }
-    /* Register buffer symbols: after variables */
-    int buf_base = var_base + vartab.count * X32_VAR_SIZE;
+    /* Data after the code, stored in bytes[] back to back:
+     *   [strings][pad to a VAR boundary]               read-only
+     *   [initialised VARs]                             writable
+     *   [uninitialised VARs][BUFFERs]                  bss (size only)
+     * Each part after the code is addressed seg_gap further on, so a
+     * container can map code, strings and data as separate segments.
+     * The bss starts on a VAR boundary; the emitter maps it as
+     * zero-filled memory.  Addresses count from `origin`, the run-time
+     * address of bytes[0]. */
+    int code_end  = pc;
+    int init_vars = 0;
+    for (int v = 0; v < vartab.count; v++)
+        if (vartab.vars[v].has_init) init_vars++;
+    int str_base = origin + code_end + seg_gap;
+    int str_end  = (code_end + strtab.total_size + X32_VAR_SIZE - 1)
+                 & ~(X32_VAR_SIZE - 1);
+    int var_base = origin + str_end + 2 * seg_gap;
+    int data_end = var_base + init_vars * X32_VAR_SIZE;
+    int bss_base = (data_end + X32_VAR_SIZE - 1) & ~(X32_VAR_SIZE - 1);
+    int buf_base = bss_base + (vartab.count - init_vars) * X32_VAR_SIZE;
     {
+        int init_idx = 0, bss_idx = 0;
+        for (int v = 0; v < vartab.count; v++) {
+            int addr = vartab.vars[v].has_init
+                     ? var_base + (init_idx++) * X32_VAR_SIZE
+                     : bss_base + (bss_idx++) * X32_VAR_SIZE;
+            symtab_add(&symtab, vartab.vars[v].name, addr);
+        }
         int buf_offset = 0;
         for (int b = 0; b < buftab.count; b++) {
-            x32_symtab_add(&symtab, buftab.bufs[b].name,
-                            buf_base + buf_offset);
+            symtab_add(&symtab, buftab.bufs[b].name,
+                       buf_base + buf_offset);
             buf_offset += buftab.bufs[b].size;
         }
     }
-    int str_base = buf_base + buftab.total_size;
 
     /* --- Pass 2: code emission ----------------------------------------- */
-    CodeBuffer *code = create_code_buffer();
+    CodeBuffer *code = create_code_buffer(diag);
     if (!code) {
-        fprintf(stderr, "UA x86-32: out of memory\n");
+        diag_printf(diag, "UA x86-32: out of memory\n");
+        free(br_form);
+        symtab_free(&symtab);
+        fixvec_free(&fixups);
         return NULL;
     }
+    diag_own(diag, &code, codebuf_drop);
+
+    /* Pass 1 sized the code, strings and VARs: allocate them at once */
+    codebuf_reserve(code, str_end + init_vars * X32_VAR_SIZE);
 
     for (int i = 0; i < ir_count; i++) {
         const Instruction *inst = &ir[i];
@@ -733,16 +834,18 @@ CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
         if (inst->is_label)
             continue;
 
+        codebuf_add_line(code, inst->file, inst->line);
+
         switch (inst->opcode) {
 
         /* ---- LDI Rd, #imm  ->  MOV r32, imm32 ------------ 5 bytes --- */
         case OP_LDI: {
             int rd = inst->operands[0].data.reg;
             int32_t imm = (int32_t)inst->operands[1].data.imm;
-            x32_validate_register(inst, rd);
+            x32_validate_register(diag, inst, rd);
             uint8_t enc = X32_REG_ENC[rd];
-            fprintf(stderr, "  LDI R%d -> MOV %s, %d\n",
-                    rd, X32_REG_NAME[rd], imm);
+            diag_trace(diag, "  LDI R%d -> MOV %s, %d\n",
+                       rd, X32_REG_NAME[rd], imm);
             emit_mov_r32_imm32(code, enc, imm);
             break;
         }
@@ -751,12 +854,12 @@ CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
         case OP_MOV: {
             int rd = inst->operands[0].data.reg;
             int rs = inst->operands[1].data.reg;
-            x32_validate_register(inst, rd);
-            x32_validate_register(inst, rs);
+            x32_validate_register(diag, inst, rd);
+            x32_validate_register(diag, inst, rs);
             uint8_t enc_d = X32_REG_ENC[rd];
             uint8_t enc_s = X32_REG_ENC[rs];
-            fprintf(stderr, "  MOV R%d, R%d -> MOV %s, %s\n",
-                    rd, rs, X32_REG_NAME[rd], X32_REG_NAME[rs]);
+            diag_trace(diag, "  MOV R%d, R%d -> MOV %s, %s\n",
+                       rd, rs, X32_REG_NAME[rd], X32_REG_NAME[rs]);
             emit_mov_r32_r32(code, enc_d, enc_s);
             break;
         }
@@ -765,10 +868,10 @@ CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
         case OP_LOAD: {
             int rd = inst->operands[0].data.reg;
             int rs = inst->operands[1].data.reg;
-            x32_validate_register(inst, rd);
-            x32_validate_register(inst, rs);
-            fprintf(stderr, "  LOAD R%d, R%d -> MOV %s, [%s]\n",
-                    rd, rs, X32_REG_NAME[rd], X32_REG_NAME[rs]);
+            x32_validate_register(diag, inst, rd);
+            x32_validate_register(diag, inst, rs);
+            diag_trace(diag, "  LOAD R%d, R%d -> MOV %s, [%s]\n",
+                       rd, rs, X32_REG_NAME[rd], X32_REG_NAME[rs]);
             emit_load_r32_mem(code, X32_REG_ENC[rd], X32_REG_ENC[rs]);
             break;
         }
@@ -777,10 +880,10 @@ CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
         case OP_STORE: {
             int rx = inst->operands[0].data.reg;
             int ry = inst->operands[1].data.reg;
-            x32_validate_register(inst, rx);
-            x32_validate_register(inst, ry);
-            fprintf(stderr, "  STORE R%d, R%d -> MOV [%s], %s\n",
-                    rx, ry, X32_REG_NAME[rx], X32_REG_NAME[ry]);
+            x32_validate_register(diag, inst, rx);
+            x32_validate_register(diag, inst, ry);
+            diag_trace(diag, "  STORE R%d, R%d -> MOV [%s], %s\n",
+                       rx, ry, X32_REG_NAME[rx], X32_REG_NAME[ry]);
             emit_store_mem_r32(code, X32_REG_ENC[rx], X32_REG_ENC[ry]);
             break;
         }
@@ -788,19 +891,19 @@ CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
         /* ---- ADD Rd, Rs/imm -------------------------------- 2/7 bytes  */
         case OP_ADD: {
             int rd = inst->operands[0].data.reg;
-            x32_validate_register(inst, rd);
+            x32_validate_register(diag, inst, rd);
             uint8_t enc_d = X32_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                x32_validate_register(inst, rs);
-                fprintf(stderr, "  ADD R%d, R%d -> ADD %s, %s\n",
-                        rd, rs, X32_REG_NAME[rd], X32_REG_NAME[rs]);
+                x32_validate_register(diag, inst, rs);
+                diag_trace(diag, "  ADD R%d, R%d -> ADD %s, %s\n",
+                           rd, rs, X32_REG_NAME[rd], X32_REG_NAME[rs]);
                 emit_add_r32_r32(code, enc_d, X32_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
                 uint8_t scratch = (enc_d == 1) ? 2 : 1;
-                fprintf(stderr, "  ADD R%d, #%d -> MOV scratch, %d; ADD %s, scratch\n",
-                        rd, imm, imm, X32_REG_NAME[rd]);
+                diag_trace(diag, "  ADD R%d, #%d -> MOV scratch, %d; ADD %s, scratch\n",
+                           rd, imm, imm, X32_REG_NAME[rd]);
                 emit_mov_r32_imm32(code, scratch, imm);
                 emit_add_r32_r32(code, enc_d, scratch);
             }
@@ -810,19 +913,19 @@ CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
         /* ---- SUB Rd, Rs/imm -------------------------------- 2/7 bytes  */
         case OP_SUB: {
             int rd = inst->operands[0].data.reg;
-            x32_validate_register(inst, rd);
+            x32_validate_register(diag, inst, rd);
             uint8_t enc_d = X32_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                x32_validate_register(inst, rs);
-                fprintf(stderr, "  SUB R%d, R%d -> SUB %s, %s\n",
-                        rd, rs, X32_REG_NAME[rd], X32_REG_NAME[rs]);
+                x32_validate_register(diag, inst, rs);
+                diag_trace(diag, "  SUB R%d, R%d -> SUB %s, %s\n",
+                           rd, rs, X32_REG_NAME[rd], X32_REG_NAME[rs]);
                 emit_sub_r32_r32(code, enc_d, X32_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
                 uint8_t scratch = (enc_d == 1) ? 2 : 1;
-                fprintf(stderr, "  SUB R%d, #%d -> MOV scratch, %d; SUB %s, scratch\n",
-                        rd, imm, imm, X32_REG_NAME[rd]);
+                diag_trace(diag, "  SUB R%d, #%d -> MOV scratch, %d; SUB %s, scratch\n",
+                           rd, imm, imm, X32_REG_NAME[rd]);
                 emit_mov_r32_imm32(code, scratch, imm);
                 emit_sub_r32_r32(code, enc_d, scratch);
             }
@@ -832,18 +935,18 @@ CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
         /* ---- AND Rd, Rs/imm -------------------------------- 2/7 bytes  */
         case OP_AND: {
             int rd = inst->operands[0].data.reg;
-            x32_validate_register(inst, rd);
+            x32_validate_register(diag, inst, rd);
             uint8_t enc_d = X32_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                x32_validate_register(inst, rs);
-                fprintf(stderr, "  AND R%d, R%d -> AND %s, %s\n",
-                        rd, rs, X32_REG_NAME[rd], X32_REG_NAME[rs]);
+                x32_validate_register(diag, inst, rs);
+                diag_trace(diag, "  AND R%d, R%d -> AND %s, %s\n",
+                           rd, rs, X32_REG_NAME[rd], X32_REG_NAME[rs]);
                 emit_and_r32_r32(code, enc_d, X32_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
                 uint8_t scratch = (enc_d == 1) ? 2 : 1;
-                fprintf(stderr, "  AND R%d, #%d\n", rd, imm);
+                diag_trace(diag, "  AND R%d, #%d\n", rd, imm);
                 emit_mov_r32_imm32(code, scratch, imm);
                 emit_and_r32_r32(code, enc_d, scratch);
             }
@@ -853,18 +956,18 @@ CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
         /* ---- OR Rd, Rs/imm --------------------------------- 2/7 bytes  */
         case OP_OR: {
             int rd = inst->operands[0].data.reg;
-            x32_validate_register(inst, rd);
+            x32_validate_register(diag, inst, rd);
             uint8_t enc_d = X32_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                x32_validate_register(inst, rs);
-                fprintf(stderr, "  OR  R%d, R%d -> OR %s, %s\n",
-                        rd, rs, X32_REG_NAME[rd], X32_REG_NAME[rs]);
+                x32_validate_register(diag, inst, rs);
+                diag_trace(diag, "  OR  R%d, R%d -> OR %s, %s\n",
+                           rd, rs, X32_REG_NAME[rd], X32_REG_NAME[rs]);
                 emit_or_r32_r32(code, enc_d, X32_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
                 uint8_t scratch = (enc_d == 1) ? 2 : 1;
-                fprintf(stderr, "  OR  R%d, #%d\n", rd, imm);
+                diag_trace(diag, "  OR  R%d, #%d\n", rd, imm);
                 emit_mov_r32_imm32(code, scratch, imm);
                 emit_or_r32_r32(code, enc_d, scratch);
             }
@@ -874,18 +977,18 @@ CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
         /* ---- XOR Rd, Rs/imm -------------------------------- 2/7 bytes  */
         case OP_XOR: {
             int rd = inst->operands[0].data.reg;
-            x32_validate_register(inst, rd);
+            x32_validate_register(diag, inst, rd);
             uint8_t enc_d = X32_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                x32_validate_register(inst, rs);
-                fprintf(stderr, "  XOR R%d, R%d -> XOR %s, %s\n",
-                        rd, rs, X32_REG_NAME[rd], X32_REG_NAME[rs]);
+                x32_validate_register(diag, inst, rs);
+                diag_trace(diag, "  XOR R%d, R%d -> XOR %s, %s\n",
+                           rd, rs, X32_REG_NAME[rd], X32_REG_NAME[rs]);
                 emit_xor_r32_r32(code, enc_d, X32_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
                 uint8_t scratch = (enc_d == 1) ? 2 : 1;
-                fprintf(stderr, "  XOR R%d, #%d\n", rd, imm);
+                diag_trace(diag, "  XOR R%d, #%d\n", rd, imm);
                 emit_mov_r32_imm32(code, scratch, imm);
                 emit_xor_r32_r32(code, enc_d, scratch);
             }
@@ -895,8 +998,8 @@ CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
         /* ---- NOT Rd  ->  NOT r32 --------------------------- 2 bytes -- */
         case OP_NOT: {
             int rd = inst->operands[0].data.reg;
-            x32_validate_register(inst, rd);
-            fprintf(stderr, "  NOT R%d -> NOT %s\n", rd, X32_REG_NAME[rd]);
+            x32_validate_register(diag, inst, rd);
+            diag_trace(diag, "  NOT R%d -> NOT %s\n", rd, X32_REG_NAME[rd]);
             emit_not_r32(code, X32_REG_ENC[rd]);
             break;
         }
@@ -904,8 +1007,8 @@ CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
         /* ---- INC Rd  ->  INC r32 --------------------------- 1 byte -- */
         case OP_INC: {
             int rd = inst->operands[0].data.reg;
-            x32_validate_register(inst, rd);
-            fprintf(stderr, "  INC R%d -> INC %s\n", rd, X32_REG_NAME[rd]);
+            x32_validate_register(diag, inst, rd);
+            diag_trace(diag, "  INC R%d -> INC %s\n", rd, X32_REG_NAME[rd]);
             emit_inc_r32(code, X32_REG_ENC[rd]);
             break;
         }
@@ -913,8 +1016,8 @@ CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
         /* ---- DEC Rd  ->  DEC r32 --------------------------- 1 byte -- */
         case OP_DEC: {
             int rd = inst->operands[0].data.reg;
-            x32_validate_register(inst, rd);
-            fprintf(stderr, "  DEC R%d -> DEC %s\n", rd, X32_REG_NAME[rd]);
+            x32_validate_register(diag, inst, rd);
+            diag_trace(diag, "  DEC R%d -> DEC %s\n", rd, X32_REG_NAME[rd]);
             emit_dec_r32(code, X32_REG_ENC[rd]);
             break;
         }
@@ -922,19 +1025,19 @@ CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
         /* ---- MUL Rd, Rs/imm  ->  IMUL r32, r32 ------- 3/8 bytes ----- */
         case OP_MUL: {
             int rd = inst->operands[0].data.reg;
-            x32_validate_register(inst, rd);
+            x32_validate_register(diag, inst, rd);
             uint8_t enc_d = X32_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                x32_validate_register(inst, rs);
-                fprintf(stderr, "  MUL R%d, R%d -> IMUL %s, %s\n",
-                        rd, rs, X32_REG_NAME[rd], X32_REG_NAME[rs]);
+                x32_validate_register(diag, inst, rs);
+                diag_trace(diag, "  MUL R%d, R%d -> IMUL %s, %s\n",
+                           rd, rs, X32_REG_NAME[rd], X32_REG_NAME[rs]);
                 emit_imul_r32_r32(code, enc_d, X32_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
                 uint8_t scratch = (enc_d == 1) ? 2 : 1;
-                fprintf(stderr, "  MUL R%d, #%d -> MOV scratch, %d; IMUL %s, scratch\n",
-                        rd, imm, imm, X32_REG_NAME[rd]);
+                diag_trace(diag, "  MUL R%d, #%d -> MOV scratch, %d; IMUL %s, scratch\n",
+                           rd, imm, imm, X32_REG_NAME[rd]);
                 emit_mov_r32_imm32(code, scratch, imm);
                 emit_imul_r32_r32(code, enc_d, scratch);
             }
@@ -947,14 +1050,14 @@ CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
          * --------------------------------------------------------------- */
         case OP_DIV: {
             int rd = inst->operands[0].data.reg;
-            x32_validate_register(inst, rd);
+            x32_validate_register(diag, inst, rd);
             uint8_t enc_d = X32_REG_ENC[rd];
 
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                x32_validate_register(inst, rs);
+                x32_validate_register(diag, inst, rs);
                 uint8_t enc_s = X32_REG_ENC[rs];
-                fprintf(stderr, "  DIV R%d, R%d -> IDIV\n", rd, rs);
+                diag_trace(diag, "  DIV R%d, R%d -> IDIV\n", rd, rs);
                 emit_push_r32(code, 2);            /* PUSH EDX      1 */
                 emit_mov_r32_r32(code, 0, enc_d);  /* MOV EAX, Rd   2 */
                 emit_cdq(code);                    /* CDQ            1 */
@@ -965,8 +1068,8 @@ CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
                 uint8_t scratch = 1; /* ECX */
                 if (enc_d == 1) scratch = 3; /* EBX if Rd=ECX */
-                fprintf(stderr, "  DIV R%d, #%d -> MOV scratch, %d; IDIV\n",
-                        rd, imm, imm);
+                diag_trace(diag, "  DIV R%d, #%d -> MOV scratch, %d; IDIV\n",
+                           rd, imm, imm);
                 emit_push_r32(code, 2);                /* PUSH EDX   1 */
                 emit_mov_r32_imm32(code, scratch, imm); /* MOV scr,imm 5 */
                 emit_mov_r32_r32(code, 0, enc_d);      /* MOV EAX,Rd 2 */
@@ -981,18 +1084,18 @@ CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
         /* ---- SHL Rd, Rs/imm -------------------------------- 3/9 bytes  */
         case OP_SHL: {
             int rd = inst->operands[0].data.reg;
-            x32_validate_register(inst, rd);
+            x32_validate_register(diag, inst, rd);
             uint8_t enc_d = X32_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_IMMEDIATE) {
                 uint8_t imm = (uint8_t)(inst->operands[1].data.imm & 0x1F);
-                fprintf(stderr, "  SHL R%d, #%d\n", rd, imm);
+                diag_trace(diag, "  SHL R%d, #%d\n", rd, imm);
                 emit_shl_r32_imm8(code, enc_d, imm);
             } else {
                 int rs = inst->operands[1].data.reg;
-                x32_validate_register(inst, rs);
+                x32_validate_register(diag, inst, rs);
                 uint8_t enc_s = X32_REG_ENC[rs];
-                fprintf(stderr, "  SHL R%d, R%d -> SHL %s, CL\n",
-                        rd, rs, X32_REG_NAME[rd]);
+                diag_trace(diag, "  SHL R%d, R%d -> SHL %s, CL\n",
+                           rd, rs, X32_REG_NAME[rd]);
                 emit_push_r32(code, 1);            /* PUSH ECX       1 */
                 emit_mov_r32_r32(code, 1, enc_s);  /* MOV ECX, Rs    2 */
                 emit_shl_r32_cl(code, enc_d);      /* SHL Rd, CL     2 */
@@ -1006,18 +1109,18 @@ CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
         /* ---- SHR Rd, Rs/imm -------------------------------- 3/9 bytes  */
         case OP_SHR: {
             int rd = inst->operands[0].data.reg;
-            x32_validate_register(inst, rd);
+            x32_validate_register(diag, inst, rd);
             uint8_t enc_d = X32_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_IMMEDIATE) {
                 uint8_t imm = (uint8_t)(inst->operands[1].data.imm & 0x1F);
-                fprintf(stderr, "  SHR R%d, #%d\n", rd, imm);
+                diag_trace(diag, "  SHR R%d, #%d\n", rd, imm);
                 emit_shr_r32_imm8(code, enc_d, imm);
             } else {
                 int rs = inst->operands[1].data.reg;
-                x32_validate_register(inst, rs);
+                x32_validate_register(diag, inst, rs);
                 uint8_t enc_s = X32_REG_ENC[rs];
-                fprintf(stderr, "  SHR R%d, R%d -> SHR %s, CL\n",
-                        rd, rs, X32_REG_NAME[rd]);
+                diag_trace(diag, "  SHR R%d, R%d -> SHR %s, CL\n",
+                           rd, rs, X32_REG_NAME[rd]);
                 emit_push_r32(code, 1);
                 emit_mov_r32_r32(code, 1, enc_s);
                 emit_shr_r32_cl(code, enc_d);
@@ -1030,103 +1133,90 @@ CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
         /* ---- CMP Ra, Rb/imm -------------------------------- 2/6 bytes  */
         case OP_CMP: {
             int ra = inst->operands[0].data.reg;
-            x32_validate_register(inst, ra);
+            x32_validate_register(diag, inst, ra);
             uint8_t enc_a = X32_REG_ENC[ra];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rb = inst->operands[1].data.reg;
-                x32_validate_register(inst, rb);
-                fprintf(stderr, "  CMP R%d, R%d -> CMP %s, %s\n",
-                        ra, rb, X32_REG_NAME[ra], X32_REG_NAME[rb]);
+                x32_validate_register(diag, inst, rb);
+                diag_trace(diag, "  CMP R%d, R%d -> CMP %s, %s\n",
+                           ra, rb, X32_REG_NAME[ra], X32_REG_NAME[rb]);
                 emit_cmp_r32_r32(code, enc_a, X32_REG_ENC[rb]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                fprintf(stderr, "  CMP R%d, #%d\n", ra, imm);
+                diag_trace(diag, "  CMP R%d, #%d\n", ra, imm);
                 emit_cmp_r32_imm32(code, enc_a, imm);
             }
             break;
         }
 
-        /* ---- JMP label  ->  JMP rel32 ---------------------- 5 bytes -- */
+        /* ---- JMP label  ->  EB rel8 / E9 rel32 ----------- 2 / 5 bytes -- */
         case OP_JMP: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  JMP %s\n", label);
-            emit_byte(code, 0xE9);
-            int patch_off = code->size;
-            emit_rel32_placeholder(code);
-            x32_add_fixup(&symtab, label, patch_off, code->size, inst->line);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  JMP %s\n", label);
+            x32_emit_branch(code, &symtab, &fixups, label, -1,
+                            br_form[i] == X32_BR_SHORT, inst);
             break;
         }
 
-        /* ---- JZ label  ->  JZ rel32 (0F 84) --------------- 6 bytes -- */
+        /* ---- JZ label  ->  74 rel8 / 0F 84 rel32 -- 2 / 6 bytes -- */
         case OP_JZ: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  JZ  %s\n", label);
-            emit_byte(code, 0x0F);
-            emit_byte(code, 0x84);
-            int patch_off = code->size;
-            emit_rel32_placeholder(code);
-            x32_add_fixup(&symtab, label, patch_off, code->size, inst->line);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  JZ  %s\n", label);
+            x32_emit_branch(code, &symtab, &fixups, label, 0x4,
+                            br_form[i] == X32_BR_SHORT, inst);
             break;
         }
 
-        /* ---- JNZ label  ->  JNZ rel32 (0F 85) ------------- 6 bytes -- */
+        /* ---- JNZ label  ->  75 rel8 / 0F 85 rel32 - 2 / 6 bytes -- */
         case OP_JNZ: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  JNZ %s\n", label);
-            emit_byte(code, 0x0F);
-            emit_byte(code, 0x85);
-            int patch_off = code->size;
-            emit_rel32_placeholder(code);
-            x32_add_fixup(&symtab, label, patch_off, code->size, inst->line);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  JNZ %s\n", label);
+            x32_emit_branch(code, &symtab, &fixups, label, 0x5,
+                            br_form[i] == X32_BR_SHORT, inst);
             break;
         }
 
-        /* ---- JL label  ->  JL rel32 (0F 8C) --------------- 6 bytes -- */
+        /* ---- JL label  ->  7C rel8 / 0F 8C rel32 -- 2 / 6 bytes -- */
         case OP_JL: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  JL  %s\n", label);
-            emit_byte(code, 0x0F);
-            emit_byte(code, 0x8C);
-            int patch_off = code->size;
-            emit_rel32_placeholder(code);
-            x32_add_fixup(&symtab, label, patch_off, code->size, inst->line);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  JL  %s\n", label);
+            x32_emit_branch(code, &symtab, &fixups, label, 0xC,
+                            br_form[i] == X32_BR_SHORT, inst);
             break;
         }
 
-        /* ---- JG label  ->  JG rel32 (0F 8F) --------------- 6 bytes -- */
+        /* ---- JG label  ->  7F rel8 / 0F 8F rel32 -- 2 / 6 bytes -- */
         case OP_JG: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  JG  %s\n", label);
-            emit_byte(code, 0x0F);
-            emit_byte(code, 0x8F);
-            int patch_off = code->size;
-            emit_rel32_placeholder(code);
-            x32_add_fixup(&symtab, label, patch_off, code->size, inst->line);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  JG  %s\n", label);
+            x32_emit_branch(code, &symtab, &fixups, label, 0xF,
+                            br_form[i] == X32_BR_SHORT, inst);
             break;
         }
 
         /* ---- CALL label  ->  CALL rel32 -------------------- 5 bytes -- */
         case OP_CALL: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  CALL %s\n", label);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  CALL %s\n", label);
             emit_byte(code, 0xE8);
             int patch_off = code->size;
             emit_rel32_placeholder(code);
-            x32_add_fixup(&symtab, label, patch_off, code->size, inst->line);
+            x32_add_fixup(&symtab, &fixups, label, patch_off, code->size,
+                          inst);
             break;
         }
 
         /* ---- RET ------------------------------------------- 1 byte -- */
         case OP_RET:
-            fprintf(stderr, "  RET\n");
+            diag_trace(diag, "  RET\n");
             emit_ret(code);
             break;
 
         /* ---- PUSH Rs ---------------------------------------- 1 byte -- */
         case OP_PUSH: {
             int rs = inst->operands[0].data.reg;
-            x32_validate_register(inst, rs);
-            fprintf(stderr, "  PUSH R%d -> PUSH %s\n", rs, X32_REG_NAME[rs]);
+            x32_validate_register(diag, inst, rs);
+            diag_trace(diag, "  PUSH R%d -> PUSH %s\n", rs, X32_REG_NAME[rs]);
             emit_push_r32(code, X32_REG_ENC[rs]);
             break;
         }
@@ -1134,28 +1224,28 @@ CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
         /* ---- POP Rd ----------------------------------------- 1 byte -- */
         case OP_POP: {
             int rd = inst->operands[0].data.reg;
-            x32_validate_register(inst, rd);
-            fprintf(stderr, "  POP  R%d -> POP %s\n", rd, X32_REG_NAME[rd]);
+            x32_validate_register(diag, inst, rd);
+            diag_trace(diag, "  POP  R%d -> POP %s\n", rd, X32_REG_NAME[rd]);
             emit_pop_r32(code, X32_REG_ENC[rd]);
             break;
         }
 
         /* ---- NOP -------------------------------------------- 1 byte -- */
         case OP_NOP:
-            fprintf(stderr, "  NOP\n");
+            diag_trace(diag, "  NOP\n");
             emit_nop(code);
             break;
 
         /* ---- HLT  ->  RET ---------------------------------- 1 byte -- */
         case OP_HLT:
-            fprintf(stderr, "  HLT -> RET\n");
+            diag_trace(diag, "  HLT -> RET\n");
             emit_ret(code);
             break;
 
         /* ---- INT #imm  ->  INT imm8 (CD ib) --------------- 2 bytes -- */
         case OP_INT: {
             uint8_t imm = (uint8_t)(inst->operands[0].data.imm & 0xFF);
-            fprintf(stderr, "  INT #%d -> INT 0x%02X\n", imm, imm);
+            diag_trace(diag, "  INT #%d -> INT 0x%02X\n", imm, imm);
             emit_int_imm8(code, imm);
             break;
         }
@@ -1171,40 +1261,37 @@ CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
         /* ---- ORG addr — pad with zeros until target address ----------- */
         case OP_ORG: {
             uint32_t target = (uint32_t)inst->operands[0].data.imm;
-            while (code->size < (int)target) {
-                emit_byte(code, 0x00);
-            }
+            emit_fill(code, 0x00, (int)target - code->size);
             break;
         }
 
         /* ---- SET name, Rs/imm → MOV [disp32], r32/imm32 -------------- */
         case OP_SET: {
-            const char *vname = inst->operands[0].data.label;
+            const char *vname = strpool_get(strs, inst->operands[0].data.label_id);
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                x32_validate_register(inst, rs);
+                x32_validate_register(diag, inst, rs);
                 uint8_t enc = X32_REG_ENC[rs];
-                fprintf(stderr, "  SET %s, R%d -> MOV [disp32], %s\n",
-                        vname, rs, X32_REG_NAME[rs]);
+                diag_trace(diag, "  SET %s, R%d -> MOV [disp32], %s\n",
+                           vname, rs, X32_REG_NAME[rs]);
                 emit_byte(code, 0x89);  /* MOV r/m32, r32 */
                 emit_byte(code, (uint8_t)((enc << 3) | 0x05));  /* ModRM: [disp32] */
                 int patch_off = code->size;
                 emit_rel32_placeholder(code);  /* disp32 placeholder */
                 /* For absolute addressing, instr_end=0 so patch = target */
-                x32_add_fixup(&symtab, vname, patch_off, 0, inst->line);
+                x32_add_fixup(&symtab, &fixups, vname, patch_off, 0,
+                              inst);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                fprintf(stderr, "  SET %s, #%d -> MOV [disp32], imm32\n",
-                        vname, imm);
+                diag_trace(diag, "  SET %s, #%d -> MOV [disp32], imm32\n",
+                           vname, imm);
                 emit_byte(code, 0xC7);  /* MOV r/m32, imm32 */
                 emit_byte(code, 0x05);  /* ModRM: [disp32], reg=000 */
                 int patch_off = code->size;
                 emit_rel32_placeholder(code);
-                emit_byte(code, (uint8_t)( imm        & 0xFF));
-                emit_byte(code, (uint8_t)((imm >>  8) & 0xFF));
-                emit_byte(code, (uint8_t)((imm >> 16) & 0xFF));
-                emit_byte(code, (uint8_t)((imm >> 24) & 0xFF));
-                x32_add_fixup(&symtab, vname, patch_off, 0, inst->line);
+                emit_le32(code, (uint32_t)imm);
+                x32_add_fixup(&symtab, &fixups, vname, patch_off, 0,
+                              inst);
             }
             break;
         }
@@ -1212,37 +1299,37 @@ CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
         /* ---- GET Rd, name → MOV r32, [disp32] or LEA (buffer) --------- */
         case OP_GET: {
             int rd = inst->operands[0].data.reg;
-            const char *vname = inst->operands[1].data.label;
-            x32_validate_register(inst, rd);
+            const char *vname = strpool_get(strs, inst->operands[1].data.label_id);
+            x32_validate_register(diag, inst, rd);
             uint8_t enc = X32_REG_ENC[rd];
             int is_buf = x32_buftab_has(&buftab, vname);
             if (is_buf) {
-                fprintf(stderr, "  GET R%d, %s -> LEA %s, [disp32] (buffer address)\n",
-                        rd, vname, X32_REG_NAME[rd]);
+                diag_trace(diag, "  GET R%d, %s -> LEA %s, [disp32] (buffer address)\n",
+                           rd, vname, X32_REG_NAME[rd]);
                 emit_byte(code, 0x8D);  /* LEA r32, [disp32] */
             } else {
-                fprintf(stderr, "  GET R%d, %s -> MOV %s, [disp32]\n",
-                        rd, vname, X32_REG_NAME[rd]);
+                diag_trace(diag, "  GET R%d, %s -> MOV %s, [disp32]\n",
+                           rd, vname, X32_REG_NAME[rd]);
                 emit_byte(code, 0x8B);  /* MOV r32, r/m32 */
             }
             emit_byte(code, (uint8_t)((enc << 3) | 0x05));  /* ModRM: [disp32] */
             int patch_off = code->size;
             emit_rel32_placeholder(code);
-            x32_add_fixup(&symtab, vname, patch_off, 0, inst->line);
+            x32_add_fixup(&symtab, &fixups, vname, patch_off, 0, inst);
             break;
         }
 
         /* ---- LDS Rd, "str"  ->  LEA r32, [disp32] -------- 6 bytes ---- */
         case OP_LDS: {
             int rd = inst->operands[0].data.reg;
-            const char *str = inst->operands[1].data.string;
-            x32_validate_register(inst, rd);
+            const char *str = strpool_get(strs, inst->operands[1].data.string_id);
+            x32_validate_register(diag, inst, rd);
             uint8_t enc = X32_REG_ENC[rd];
-            fprintf(stderr, "  LDS R%d, \"%s\" -> LEA %s, [disp32]\n",
-                    rd, str, X32_REG_NAME[rd]);
+            diag_trace(diag, "  LDS R%d, \"%s\" -> LEA %s, [disp32]\n",
+                       rd, str, X32_REG_NAME[rd]);
             emit_byte(code, 0x8D);  /* LEA r32, [disp32] */
             emit_byte(code, (uint8_t)((enc << 3) | 0x05));  /* ModRM: [disp32] */
-            int str_idx = x32_strtab_add(&strtab, str);
+            int str_idx = x32_strtab_add(&strtab, str, diag);
             int str_addr = str_base + strtab.strings[str_idx].offset;
             int patch_off = code->size;
             emit_rel32_placeholder(code);
@@ -1255,12 +1342,12 @@ CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
         case OP_LOADB: {
             int rd = inst->operands[0].data.reg;
             int rs = inst->operands[1].data.reg;
-            x32_validate_register(inst, rd);
-            x32_validate_register(inst, rs);
+            x32_validate_register(diag, inst, rd);
+            x32_validate_register(diag, inst, rs);
             uint8_t enc_d = X32_REG_ENC[rd];
             uint8_t enc_s = X32_REG_ENC[rs];
-            fprintf(stderr, "  LOADB R%d, R%d -> MOVZX %s, byte [%s]\n",
-                    rd, rs, X32_REG_NAME[rd], X32_REG_NAME[rs]);
+            diag_trace(diag, "  LOADB R%d, R%d -> MOVZX %s, byte [%s]\n",
+                       rd, rs, X32_REG_NAME[rd], X32_REG_NAME[rs]);
             emit_byte(code, 0x0F);
             emit_byte(code, 0xB6);
             if (enc_s == 5) {
@@ -1279,12 +1366,12 @@ CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
         case OP_STOREB: {
             int rx = inst->operands[0].data.reg;
             int ry = inst->operands[1].data.reg;
-            x32_validate_register(inst, rx);
-            x32_validate_register(inst, ry);
+            x32_validate_register(diag, inst, rx);
+            x32_validate_register(diag, inst, ry);
             uint8_t enc_x = X32_REG_ENC[rx];
             uint8_t enc_y = X32_REG_ENC[ry];
-            fprintf(stderr, "  STOREB R%d, R%d -> MOV byte [%s], %s_low8\n",
-                    rx, ry, X32_REG_NAME[rx], X32_REG_NAME[ry]);
+            diag_trace(diag, "  STOREB R%d, R%d -> MOV byte [%s], %s_low8\n",
+                       rx, ry, X32_REG_NAME[rx], X32_REG_NAME[ry]);
             emit_byte(code, 0x88);
             if (enc_x == 5) {
                 emit_byte(code, (uint8_t)(0x40 | (enc_y << 3) | enc_x));
@@ -1300,21 +1387,21 @@ CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
 
         /* ---- SYS  ->  INT 0x80 ---------------------------- 2 bytes --- */
         case OP_SYS:
-            fprintf(stderr, "  SYS -> INT 0x80\n");
+            diag_trace(diag, "  SYS -> INT 0x80\n");
             emit_byte(code, 0xCD);
             emit_byte(code, 0x80);
             break;
 
         /* ---- CPUID ----------------------------------------- 2 bytes --- */
         case OP_CPUID:
-            fprintf(stderr, "  CPUID\n");
+            diag_trace(diag, "  CPUID\n");
             emit_byte(code, 0x0F);
             emit_byte(code, 0xA2);
             break;
 
         /* ---- RDTSC ----------------------------------------- 2 bytes --- */
         case OP_RDTSC:
-            fprintf(stderr, "  RDTSC\n");
+            diag_trace(diag, "  RDTSC\n");
             emit_byte(code, 0x0F);
             emit_byte(code, 0x31);
             break;
@@ -1323,7 +1410,7 @@ CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
         case OP_BSWAP: {
             int rd = inst->operands[0].data.reg;
             uint8_t enc = X32_REG_ENC[rd];
-            fprintf(stderr, "  BSWAP %s\n", X32_REG_NAME[rd]);
+            diag_trace(diag, "  BSWAP %s\n", X32_REG_NAME[rd]);
             emit_byte(code, 0x0F);
             emit_byte(code, (uint8_t)(0xC8 + enc));
             break;
@@ -1331,13 +1418,13 @@ CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
 
         /* ---- PUSHA ----------------------------------------- 1 byte  --- */
         case OP_PUSHA:
-            fprintf(stderr, "  PUSHA\n");
+            diag_trace(diag, "  PUSHA\n");
             emit_byte(code, 0x60);
             break;
 
         /* ---- POPA ------------------------------------------ 1 byte  --- */
         case OP_POPA:
-            fprintf(stderr, "  POPA\n");
+            diag_trace(diag, "  POPA\n");
             emit_byte(code, 0x61);
             break;
 
@@ -1346,53 +1433,102 @@ CodeBuffer* generate_x86_32(const Instruction *ir, int ir_count)
             snprintf(msg, sizeof(msg),
                      "opcode '%s' is not supported by the x86-32 backend",
                      opcode_name(inst->opcode));
-            x32_error(inst, msg);
+            x32_error(diag, inst, msg);
             break;
         }
         }
     }
 
+    free(br_form);
+    br_form = NULL;
+
     /* --- Pass 3: patch relocations ------------------------------------- */
-    for (int f = 0; f < symtab.fix_count; f++) {
-        X32Fixup *fix = &symtab.fixups[f];
-        int target = x32_symtab_lookup(&symtab, fix->label);
+    for (int f = 0; f < fixups.count; f++) {
+        X32Fixup *fix = fixvec_at(&fixups, X32Fixup, f);
+        int target = symtab_lookup(&symtab, fix->label);
         if (target < 0) {
-            fprintf(stderr, "x86-32: undefined label or variable '%s' "
-                    "(line %d)\n", fix->label, fix->line);
+            diag_printf(diag, "x86-32: %s, Line %d: undefined label or "
+                        "variable '%s'\n", fix->inst->file, fix->inst->line,
+                        fix->label);
+            symtab_free(&symtab);
+            fixvec_free(&fixups);
             free_code_buffer(code);
             return NULL;
         }
         int32_t rel = (int32_t)(target - fix->instr_end);
-        patch_rel32(code, fix->patch_offset, rel);
-    }
-
-    /* --- Append variable data section ---------------------------------- */
-    for (int v = 0; v < vartab.count; v++) {
-        int32_t val = vartab.vars[v].has_init ? vartab.vars[v].init_value : 0;
-        emit_byte(code, (uint8_t)( val        & 0xFF));
-        emit_byte(code, (uint8_t)((val >>  8) & 0xFF));
-        emit_byte(code, (uint8_t)((val >> 16) & 0xFF));
-        emit_byte(code, (uint8_t)((val >> 24) & 0xFF));
+        if (fix->rel8)
+            code->bytes[fix->patch_offset] = (uint8_t)(int8_t)rel;
+        else
+            patch_rel32(code, fix->patch_offset, rel);
     }
 
-    /* --- Append buffer data section (zero-initialised) ----------------- */
-    for (int b = 0; b < buftab.count; b++) {
-        for (int i = 0; i < buftab.bufs[b].size; i++) {
-            emit_byte(code, 0x00);
-        }
+    /* Export code labels and the code/data split (ELF symbols, segments) */
+    code->code_size = code->size;
+    for (int i = 0; i < ir_count; i++) {
+        if (!ir[i].is_label) continue;
+        const char *lname = strpool_get(strs, ir[i].label_id);
+        if (symtab_lookup(&code->labels, lname) < 0)
+            symtab_add(&code->labels, lname, symtab_lookup(&symtab, lname));
     }
+    symtab_free(&symtab);
+    fixvec_free(&fixups);
 
     /* --- Append string data section ------------------------------------ */
     for (int s = 0; s < strtab.count; s++) {
         const char *p = strtab.strings[s].text;
         int len = strtab.strings[s].length;
-        for (int b = 0; b < len; b++)
-            emit_byte(code, (uint8_t)p[b]);
+        emit_bytes(code, p, len);
         emit_byte(code, 0x00);  /* null terminator */
     }
 
-    fprintf(stderr, "[x86-32] Emitted %d bytes (%d code + %d var + %d buf + %d str)\n",
-            code->size, var_base, vartab.count * X32_VAR_SIZE,
-            buftab.total_size, strtab.total_size);
+    code->str_size = code->size - code->code_size;
+    emit_fill(code, 0x00, str_end - code->size);
+    code->data_offset = code->size;
+    code->seg_gap     = seg_gap;
+
+    /* --- Append initialised variable data ------------------------------ */
+    for (int v = 0; v < vartab.count; v++) {
+        if (!vartab.vars[v].has_init) continue;
+        int32_t val = vartab.vars[v].init_value;
+        emit_le32(code, (uint32_t)val);
+    }
+
+    /* --- Zero-initialised storage (uninitialised VARs, BUFFERs) -------- */
+    int bss_end = buf_base + buftab.total_size;
+    code->bss_size = (bss_end > bss_base) ? bss_end - data_end : 0;
+
+    diag_log(diag, DIAG_NORMAL, "[x86-32] Emitted %d bytes (%d code + %d str + %d var) + %d bss\n",
+             code->size, code_end, str_end - code_end,
+             init_vars * X32_VAR_SIZE, code->bss_size);
     return code;
 }
+
+/* =========================================================================
+ *  ELF target  (-sys linux)
+ *
+ *  Start stub, right before the user code:
+ *    E8 0B 00 00 00    call user_code      ; over the exit sequence
+ *    89 C3             mov  ebx, eax       ; exit code = R0
+ *    B8 01 00 00 00    mov  eax, 1         ; __NR_exit (i386)
+ *    CD 80             int  0x80
+ *    EB FE             jmp  $              ; never reached
+ * ========================================================================= */
+static const uint8_t X32_ELF_START_STUB[16] = {
+    0xE8, 0x0B, 0x00, 0x00, 0x00,
+    0x89, 0xC3,
+    0xB8, 0x01, 0x00, 0x00, 0x00,
+    0xCD, 0x80,
+    0xEB, 0xFE
+};
+
+static const ElfTarget X32_ELF_TARGET = {
+    ELF_CLASS32, ELF_EM_386, 0,         /* no e_flags on i386          */
+    0x08048000,                         /* the usual ld base address   */
+    16,                                 /* x86 code fetch alignment    */
+    X32_ELF_START_STUB, (int)sizeof(X32_ELF_START_STUB)
+};
+
+const ElfTarget* elf_target_x86_32(void)
+{
+    return &X32_ELF_TARGET;
+}
@@ -12,7 +12,10 @@
  *  │  Register encoding (low 3 bits, no REX.B needed for 0-7):         │
  *  │    RAX=0  RCX=1  RDX=2  RBX=3  RSP=4  RBP=5  RSI=6  RDI=7       │
  *  │                                                                    │
+ *  │  XOR  r32, r32     31 ModRM                  2 bytes (LDI #0)      │
+ *  │  MOV  r32, imm32   B8+rd id                  5 bytes (zero-ext)    │
  *  │  MOV  r64, imm32   REX.W C7 /0 id           7 bytes               │
+ *  │  MOV  r64, imm64   REX.W B8+rd io           10 bytes              │
  *  │  MOV  r64, r64     REX.W 89 ModRM            3 bytes               │
  *  │  MOV  r64,[r64]    REX.W 8B ModRM            3 bytes (LOAD)        │
  *  │  MOV  [r64],r64    REX.W 89 ModRM            3 bytes (STORE)       │
@@ -32,6 +35,12 @@
  *  │  SHL  r64, imm8    REX.W C1 /4 ib            4 bytes               │
  *  │  SHR  r64, imm8    REX.W C1 /5 ib            4 bytes               │
  *  │  CMP  r64, r64     REX.W 39 ModRM            3 bytes               │
+ *  │  ALU  r64, imm8    REX.W 83 /n ib            4 bytes               │
+ *  │  ALU  r64, imm32   REX.W 81 /n id            7 bytes               │
+ *  │  IMUL r64, imm8    REX.W 6B ModRM ib         4 bytes               │
+ *  │  IMUL r64, imm32   REX.W 69 ModRM id         7 bytes               │
+ *  │  JMP  rel8         EB cb                      2 bytes (relaxed)     │
+ *  │  Jcc  rel8         70+cc cb                   2 bytes (relaxed)     │
  *  │  JMP  rel32        E9 cd                      5 bytes               │
  *  │  JZ   rel32        0F 84 cd                   6 bytes               │
  *  │  JNZ  rel32        0F 85 cd                   6 bytes               │
@@ -44,28 +53,20 @@
  *  └──────────────────────────────────────────────────────────────────────┘
  *
  *  UA registers R0-R7 map to RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI.
- *  R8-R15 require REX.B and are rejected (Phase 7 limitation).
+ *  R8-R15 require REX.B and are rejected (Phase 7 limitation); with -O2
+ *  the back-end uses them itself to hold VARs (see regalloc.h).
  *
  *  License: MIT
  * =============================================================================
  */
 
 #include "backend_x86_64.h"
+#include "regalloc.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-/* =========================================================================
- *  Win32 target flag  (set by generate_x86_64 when sys="win32")
- *
- *  When targeting Windows, SYS emits CALL to a write dispatcher stub
- *  and HLT emits CALL to an exit dispatcher stub (both appended after
- *  the code/var/string data).  The stubs use the Windows x64 calling
- *  convention and call through an Import Address Table (IAT).
- * ========================================================================= */
-static int g_win32 = 0;
-
 /* =========================================================================
  *  x86-64 register encoding table
  * =========================================================================
@@ -92,18 +93,19 @@ static const char* X64_REG_NAME[X64_MAX_REG] = {
 /* =========================================================================
  *  Error helpers
  * ========================================================================= */
-static void x64_error(const Instruction *inst, const char *msg)
+static void x64_error(UaDiag *diag, const Instruction *inst,
+                      const char *msg)
 {
-    fprintf(stderr,
-            "\n"
-            "  UA x86-64 Backend Error\n"
-            "  ------------------------\n"
-            "  Line %d, Column %d: %s\n\n",
-            inst->line, inst->column, msg);
-    exit(1);
+    diag_printf(diag,
+                "\n"
+                "  UA x86-64 Backend Error\n"
+                "  ------------------------\n"
+                "  %s, Line %d, Column %d: %s\n\n",
+                inst->file, inst->line, inst->column, msg);
+    diag_fatal(diag);
 }
 
-static void x64_validate_register(const Instruction *inst, int reg)
+static void x64_validate_register(UaDiag *diag, const Instruction *inst, int reg)
 {
     if (reg < 0 || reg >= X64_MAX_REG) {
         char msg[128];
@@ -111,7 +113,7 @@ static void x64_validate_register(const Instruction *inst, int reg)
                  "register R%d is not mapped in the x86-64 backend "
                  "(supports R0-R7: RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI)",
                  reg);
-        x64_error(inst, msg);
+        x64_error(diag, inst, msg);
     }
 }
 
@@ -125,10 +127,63 @@ static void emit_mov_r64_imm32(CodeBuffer *buf, uint8_t rd, int32_t imm)
     emit_byte(buf, 0x48);
     emit_byte(buf, 0xC7);
     emit_byte(buf, (uint8_t)(0xC0 | rd));
-    emit_byte(buf, (uint8_t)( imm        & 0xFF));
-    emit_byte(buf, (uint8_t)((imm >>  8) & 0xFF));
-    emit_byte(buf, (uint8_t)((imm >> 16) & 0xFF));
-    emit_byte(buf, (uint8_t)((imm >> 24) & 0xFF));
+    emit_le32(buf, (uint32_t)imm);
+}
+
+/* --- MOV r32, imm32 (zero-extended to 64) : 5 bytes ------------------- */
+static void emit_mov_r32_imm32(CodeBuffer *buf, uint8_t rd, uint32_t imm)
+{
+    emit_byte(buf, (uint8_t)(0xB8 + rd));
+    emit_le32(buf, (uint32_t)imm);
+}
+
+/* --- MOV r64, imm64 (movabs) : 10 bytes ------------------------------- */
+static void emit_mov_r64_imm64(CodeBuffer *buf, uint8_t rd, int64_t imm)
+{
+    uint64_t val = (uint64_t)imm;
+    emit_byte(buf, 0x48);
+    emit_byte(buf, (uint8_t)(0xB8 + rd));
+    emit_le64(buf, (uint64_t)val);
+}
+
+/* --- MOV r8..r15, imm : 6 / 7 / 10 bytes ----------------------------
+ *  Shortest load of `imm` into an extended register (preg 8-15).
+ *  MOV r32, imm32 zero-extends, MOV r64, imm32 sign-extends; neither
+ *  touches EFLAGS.  With buf == NULL only the size is returned.        */
+static int emit_mov_rx_imm(CodeBuffer *buf, uint8_t preg, int64_t imm)
+{
+    uint8_t rd = (uint8_t)(preg & 7);
+    if (imm >= 0 && imm <= 0xFFFFFFFFLL) {
+        if (buf) {
+            emit_byte(buf, 0x41);                       /* REX.B        */
+            emit_mov_r32_imm32(buf, rd, (uint32_t)imm);
+        }
+        return 6;
+    }
+    if (imm >= INT32_MIN && imm <= INT32_MAX) {
+        if (buf) {
+            int32_t v = (int32_t)imm;
+            emit_byte(buf, 0x49);                       /* REX.W + REX.B */
+            emit_byte(buf, 0xC7);
+            emit_byte(buf, (uint8_t)(0xC0 | rd));
+            emit_le32(buf, (uint32_t)v);
+        }
+        return 7;
+    }
+    if (buf) {
+        uint64_t val = (uint64_t)imm;
+        emit_byte(buf, 0x49);                           /* REX.W + REX.B */
+        emit_byte(buf, (uint8_t)(0xB8 + rd));
+        emit_le64(buf, (uint64_t)val);
+    }
+    return 10;
+}
+
+/* --- XOR r32, r32 (zeroes the full 64-bit register) : 2 bytes --------- */
+static void emit_xor_r32_r32(CodeBuffer *buf, uint8_t dst, uint8_t src)
+{
+    emit_byte(buf, 0x31);
+    emit_byte(buf, (uint8_t)(0xC0 | (src << 3) | dst));
 }
 
 /* --- Generic REX.W + 1-byte-opcode + ModR/M(reg,rm) : 3 bytes --------- */
@@ -299,16 +354,44 @@ static void emit_cmp_r64_r64(CodeBuffer *buf, uint8_t dst, uint8_t src)
     emit_alu_r64_r64(buf, 0x39, dst, src);
 }
 
-/* --- CMP r/m64, imm32  (81 /7) : 7 bytes ------------------------------- */
-static void emit_cmp_r64_imm32(CodeBuffer *buf, uint8_t rd, int32_t imm)
+/* --- Immediate operand width: imm8 when it sign-extends back ---------- */
+static int x64_fits_imm8(int32_t imm)
+{
+    return imm >= -128 && imm <= 127;
+}
+
+static void emit_imm8_or_imm32(CodeBuffer *buf, int32_t imm)
+{
+    if (x64_fits_imm8(imm))
+        emit_byte(buf, (uint8_t)imm);
+    else
+        emit_le32(buf, (uint32_t)imm);
+}
+
+/* --- ALU r/m64, imm  (83 /n ib  or  81 /n id) : 4 or 7 bytes ----------
+ *     /n: ADD=0  OR=1  AND=4  SUB=5  XOR=6  CMP=7                       */
+static void emit_alu_r64_imm(CodeBuffer *buf, uint8_t ext,
+                             uint8_t rd, int32_t imm)
+{
+    emit_byte(buf, 0x48);
+    emit_byte(buf, x64_fits_imm8(imm) ? 0x83 : 0x81);
+    emit_byte(buf, (uint8_t)(0xC0 | (ext << 3) | rd));
+    emit_imm8_or_imm32(buf, imm);
+}
+
+/* --- CMP r/m64, imm  (83 /7 ib  or  81 /7 id) : 4 or 7 bytes ---------- */
+static void emit_cmp_r64_imm(CodeBuffer *buf, uint8_t rd, int32_t imm)
+{
+    emit_alu_r64_imm(buf, 7, rd, imm);
+}
+
+/* --- IMUL r64, r/m64, imm  (6B /r ib  or  69 /r id) : 4 or 7 bytes ---- */
+static void emit_imul_r64_imm(CodeBuffer *buf, uint8_t rd, int32_t imm)
 {
     emit_byte(buf, 0x48);
-    emit_byte(buf, 0x81);
-    emit_byte(buf, (uint8_t)(0xC0 | (7 << 3) | rd));
-    emit_byte(buf, (uint8_t)( imm        & 0xFF));
-    emit_byte(buf, (uint8_t)((imm >>  8) & 0xFF));
-    emit_byte(buf, (uint8_t)((imm >> 16) & 0xFF));
-    emit_byte(buf, (uint8_t)((imm >> 24) & 0xFF));
+    emit_byte(buf, x64_fits_imm8(imm) ? 0x6B : 0x69);
+    emit_byte(buf, (uint8_t)(0xC0 | (rd << 3) | rd));
+    emit_imm8_or_imm32(buf, imm);
 }
 
 /* --- PUSH r64  (50+rd) : 1 byte ---------------------------------------- */
@@ -345,10 +428,7 @@ static void emit_int_imm8(CodeBuffer *buf, uint8_t imm)
 /* --- rel32 placeholder helpers ----------------------------------------- */
 static void emit_rel32_placeholder(CodeBuffer *buf)
 {
-    emit_byte(buf, 0x00);
-    emit_byte(buf, 0x00);
-    emit_byte(buf, 0x00);
-    emit_byte(buf, 0x00);
+    emit_le32(buf, 0);
 }
 
 static void patch_rel32(CodeBuffer *buf, int offset, int32_t value)
@@ -360,84 +440,73 @@ static void patch_rel32(CodeBuffer *buf, int offset, int32_t value)
 }
 
 /* =========================================================================
- *  Symbol table for labels (same approach as 8051 backend)
+ *  Branch / data fixups  (labels live in the shared SymbolTable)
  * ========================================================================= */
-#define X64_MAX_SYMBOLS  256
-#define X64_MAX_FIXUPS   256
-
-typedef struct {
-    char name[UA_MAX_LABEL_LEN];
-    int  address;
-} X64Symbol;
-
 typedef struct {
-    char  label[UA_MAX_LABEL_LEN];
+    const char *label;      /* interned in the SymbolTable               */
     int   patch_offset;     /* offset into CodeBuffer where rel32 lives  */
     int   instr_end;        /* PC after the instruction (for rel calc)   */
-    int   line;
+    const Instruction *inst; /* file and line for error messages */
+    int   rel8;             /* 1 = short branch, patch a single byte     */
 } X64Fixup;
 
-typedef struct {
-    X64Symbol symbols[X64_MAX_SYMBOLS];
-    int       sym_count;
-    X64Fixup  fixups[X64_MAX_FIXUPS];
-    int       fix_count;
-} X64SymTab;
-
-static void x64_symtab_init(X64SymTab *st)
-{
-    st->sym_count = 0;
-    st->fix_count = 0;
-}
-
-static void x64_symtab_add(X64SymTab *st, const char *name, int address)
-{
-    if (st->sym_count >= X64_MAX_SYMBOLS) {
-        fprintf(stderr, "x86-64: symbol table overflow\n");
-        exit(1);
-    }
-    strncpy(st->symbols[st->sym_count].name, name, UA_MAX_LABEL_LEN - 1);
-    st->symbols[st->sym_count].name[UA_MAX_LABEL_LEN - 1] = '\0';
-    st->symbols[st->sym_count].address = address;
-    st->sym_count++;
-}
-
-static int x64_symtab_lookup(const X64SymTab *st, const char *name)
+static void x64_add_fixup(SymbolTable *st, FixupVec *fixups,
+                          const char *label, int patch_offset,
+                          int instr_end, const Instruction *inst)
 {
-    for (int i = 0; i < st->sym_count; i++) {
-        if (strcmp(st->symbols[i].name, name) == 0)
-            return st->symbols[i].address;
-    }
-    return -1;
+    X64Fixup *f = (X64Fixup *)fixvec_push(fixups);
+    f->label        = symtab_intern(st, label);
+    f->patch_offset = patch_offset;
+    f->instr_end    = instr_end;
+    f->inst         = inst;
+    f->rel8         = 0;
 }
 
-static void x64_add_fixup(X64SymTab *st, const char *label,
-                           int patch_offset, int instr_end, int line)
+/* =========================================================================
+ *  Encoding forms  —  one byte per IR entry, chosen by x64_select_forms()
+ *  before pass 1 and honoured by both sizing and emission.
+ * ========================================================================= */
+#define X64_BR_MASK    0x03
+#define X64_BR_NEAR    0x00 /* rel32                                    */
+#define X64_BR_SHORT   0x01 /* rel8                                     */
+#define X64_BR_PINNED  0x02 /* rel32, rel8 was tried and went out of range */
+#define X64_FLAGS_DEAD 0x04 /* EFLAGS are overwritten before being read */
+#define X64_VAR_REG    0x08 /* GET/SET of a VAR held in a register (-O2) */
+
+/* Shortest LDI for a 64-bit constant.  XOR clobbers EFLAGS, so it is
+ * only used when nothing reads them before they are set again. */
+static int x64_ldi_size(int64_t val, int flags_dead)
 {
-    if (st->fix_count >= X64_MAX_FIXUPS) {
-        fprintf(stderr, "x86-64: fixup table overflow\n");
-        exit(1);
-    }
-    X64Fixup *f = &st->fixups[st->fix_count++];
-    strncpy(f->label, label, UA_MAX_LABEL_LEN - 1);
-    f->label[UA_MAX_LABEL_LEN - 1] = '\0';
-    f->patch_offset = patch_offset;
-    f->instr_end    = instr_end;
-    f->line         = line;
+    if (val == 0 && flags_dead)            return 2;   /* XOR r32, r32    */
+    if (val >= 0 && val <= 0xFFFFFFFFLL)   return 5;   /* MOV r32, imm32  */
+    if (val >= INT32_MIN && val <= INT32_MAX) return 7; /* MOV r64, simm32 */
+    return 10;                                          /* MOV r64, imm64  */
 }
 
 /* =========================================================================
  *  instruction_size_x64()  —  compute byte size of each instruction
  *
  *  This allows a two-pass strategy: pass 1 collects label addresses,
- *  pass 2 emits code and patches jumps.
+ *  pass 2 emits code and patches jumps.  `form` carries the X64_BR_* /
+ *  X64_FLAGS_DEAD choices for this instruction.
+ *
+ *  `win32` is set when generating for sys="win32": SYS then emits a CALL
+ *  to a write dispatcher stub and HLT a CALL to an exit dispatcher stub
+ *  (both appended after the code/var/string data).  The stubs use the
+ *  Windows x64 calling convention and call through an Import Address
+ *  Table (IAT).
  * ========================================================================= */
-static int instruction_size_x64(const Instruction *inst)
+static int instruction_size_x64(const Instruction *inst, uint8_t form,
+                                int win32)
 {
+    int short_branch = (form & X64_BR_MASK) == X64_BR_SHORT;
+
     if (inst->is_label) return 0;
 
     switch (inst->opcode) {
-        case OP_LDI:    return 7;   /* MOV r64, imm32 */
+        case OP_LDI:
+            return x64_ldi_size(inst->operands[1].data.imm,
+                                form & X64_FLAGS_DEAD);
         case OP_MOV:    return 3;   /* MOV r64, r64 */
         case OP_LOAD: {
             int rs = inst->operands[1].data.reg;
@@ -452,24 +521,22 @@ static int instruction_size_x64(const Instruction *inst)
             return 3;
         }
         case OP_ADD:
-            return (inst->operands[1].type == OPERAND_REGISTER) ? 3 : 10;
-            /* reg:reg=3, reg:imm = MOV scratch,imm(7) + ADD(3) = 10 */
         case OP_SUB:
-            return (inst->operands[1].type == OPERAND_REGISTER) ? 3 : 10;
         case OP_AND:
-            return (inst->operands[1].type == OPERAND_REGISTER) ? 3 : 10;
         case OP_OR:
-            return (inst->operands[1].type == OPERAND_REGISTER) ? 3 : 10;
         case OP_XOR:
-            return (inst->operands[1].type == OPERAND_REGISTER) ? 3 : 10;
+            /* reg:reg = 3, reg:imm = 83 /n ib (4) or 81 /n id (7) */
+            if (inst->operands[1].type == OPERAND_REGISTER)
+                return 3;
+            return x64_fits_imm8((int32_t)inst->operands[1].data.imm) ? 4 : 7;
         case OP_NOT:    return 3;
         case OP_INC:    return 3;
         case OP_DEC:    return 3;
         case OP_MUL:
             if (inst->operands[1].type == OPERAND_REGISTER)
                 return 4;  /* IMUL r64,r64 */
-            else
-                return 11; /* MOV scratch,imm(7) + IMUL(4) */
+            /* IMUL r64,r64,imm: 6B ib (4) or 69 id (7) */
+            return x64_fits_imm8((int32_t)inst->operands[1].data.imm) ? 4 : 7;
         case OP_DIV:
             /* We need: save RDX(PUSH 1), save RAX if needed,
              * MOV RAX,Rd (3), CQO (2), IDIV Rs (3), MOV Rd,RAX (3),
@@ -491,19 +558,19 @@ static int instruction_size_x64(const Instruction *inst)
         case OP_CMP:
             if (inst->operands[1].type == OPERAND_REGISTER)
                 return 3;
-            else
-                return 7;  /* CMP r/m64, imm32 */
-        case OP_JMP:    return 5;   /* E9 rel32 */
-        case OP_JZ:     return 6;   /* 0F 84 rel32 */
-        case OP_JNZ:    return 6;   /* 0F 85 rel32 */
-        case OP_JL:     return 6;   /* 0F 8C rel32 */
-        case OP_JG:     return 6;   /* 0F 8F rel32 */
+            /* CMP r/m64, imm8 (4) or imm32 (7) */
+            return x64_fits_imm8((int32_t)inst->operands[1].data.imm) ? 4 : 7;
+        case OP_JMP:    return short_branch ? 2 : 5;   /* EB rel8 / E9 rel32 */
+        case OP_JZ:     return short_branch ? 2 : 6;   /* 74 rel8 / 0F 84 rel32 */
+        case OP_JNZ:    return short_branch ? 2 : 6;   /* 75 rel8 / 0F 85 rel32 */
+        case OP_JL:     return short_branch ? 2 : 6;   /* 7C rel8 / 0F 8C rel32 */
+        case OP_JG:     return short_branch ? 2 : 6;   /* 7F rel8 / 0F 8F rel32 */
         case OP_CALL:   return 5;   /* E8 rel32 */
         case OP_RET:    return 1;
         case OP_PUSH:   return 1;
         case OP_POP:    return 1;
         case OP_NOP:    return 1;
-        case OP_HLT:    return g_win32 ? 5 : 1;   /* win32: CALL exit_stub; else RET */
+        case OP_HLT:    return win32 ? 5 : 1;   /* win32: CALL exit_stub; else RET */
         case OP_INT:    return 2;   /* CD ib */
 
         /* ---- Variable pseudo-instructions ----------------------------- */
@@ -511,12 +578,19 @@ static int instruction_size_x64(const Instruction *inst)
         case OP_BUFFER: return 0;   /* declaration only, no code emitted  */
         case OP_SET:
             /* SET name, Rs  →  MOV [RIP+disp32], r64  (7 bytes)
-             * SET name, imm →  MOV qword [RIP+disp32], imm32 (11 bytes) */
+             * SET name, imm →  MOV qword [RIP+disp32], imm32 (11 bytes)
+             * In a register: MOV r64, r64 (3) / MOV rx, imm (6-7)    */
+            if (form & X64_VAR_REG) {
+                if (inst->operands[1].type == OPERAND_REGISTER) return 3;
+                return emit_mov_rx_imm(NULL, 8,
+                           (int32_t)inst->operands[1].data.imm);
+            }
             if (inst->operands[1].type == OPERAND_REGISTER) return 7;
             return 11;
         case OP_GET:
-            /* GET Rd, name  →  MOV r64, [RIP+disp32]  (7 bytes) */
-            return 7;
+            /* GET Rd, name  →  MOV r64, [RIP+disp32]  (7 bytes)
+             * In a register: MOV r64, r64  (3 bytes)                  */
+            return (form & X64_VAR_REG) ? 3 : 7;
 
         /* ---- Phase 8: String / Byte / Syscall -------------------------- */
         case OP_LDS:    return 7;   /* LEA r64, [RIP+disp32]  (7 bytes) */
@@ -534,7 +608,7 @@ static int instruction_size_x64(const Instruction *inst)
             if (rd == 5) return 3;
             return 2;
         }
-        case OP_SYS:    return g_win32 ? 5 : 2;   /* win32: CALL write_stub; else syscall */
+        case OP_SYS:    return win32 ? 5 : 2;   /* win32: CALL write_stub; else syscall */
 
         /* ---- Architecture-specific opcodes (x86-64) -------------------- */
         case OP_CPUID:  return 2;   /* 0F A2 */
@@ -548,6 +622,163 @@ static int instruction_size_x64(const Instruction *inst)
     }
 }
 
+/* =========================================================================
+ *  EFLAGS liveness for LDI #0  —  scan forward in straight-line code.
+ *  Dead only if a flag-setting ALU op comes before any flag reader or
+ *  control transfer; everything else is treated as live.
+ * ========================================================================= */
+#define X64_FLAGS_SCAN_LIMIT  32
+
+static int x64_flags_dead_after(const Instruction *ir, int ir_count, int i)
+{
+    int end = i + 1 + X64_FLAGS_SCAN_LIMIT;
+    if (end > ir_count) end = ir_count;
+    for (int j = i + 1; j < end; j++) {
+        const Instruction *n = &ir[j];
+        if (n->is_label) continue;
+        switch (n->opcode) {
+            case OP_CMP: case OP_ADD: case OP_SUB: case OP_AND:
+            case OP_OR:  case OP_XOR: case OP_INC: case OP_DEC:
+                return 1;
+            case OP_LDI: case OP_MOV: case OP_LOAD: case OP_STORE:
+            case OP_LOADB: case OP_STOREB: case OP_NOT: case OP_PUSH:
+            case OP_POP: case OP_NOP: case OP_GET: case OP_SET:
+            case OP_LDS: case OP_VAR: case OP_BUFFER:
+                continue;
+            default:
+                return 0;   /* Jcc, JMP, CALL, RET, SYS, MUL, ...    */
+        }
+    }
+    return 0;
+}
+
+/* =========================================================================
+ *  x64_select_forms()  —  LDI #0 flag check, VAR registers + branch
+ *                         relaxation
+ *
+ *  GET/SET entries that `ra` placed in a register get X64_VAR_REG (`ra`
+ *  is NULL without -O2).  Code starts at `origin`, the size of the
+ *  register-load prologue in front of the first instruction.
+ *
+ *  Branch relaxation chooses JMP rel8 (EB) / Jcc rel8 (7x) over the
+ *  rel32 forms whenever the target label is within -128..+127 bytes.
+ *  Every branch starts in its rel32 form.  Each round lays the code out
+ *  with the current choices, then shrinks each branch whose target would
+ *  fit in rel8.  Shrinking only pulls code together, so the loop reaches
+ *  a fixed point.  The one exception is @ORG: code in front of it shrinks
+ *  while the code behind it stays put, which can push a short branch out
+ *  of range.  Such a branch is widened again and pinned to rel32.
+ *
+ *  Returns one form byte per IR entry (caller frees), or NULL on
+ *  allocation failure.  Branches to unknown labels stay rel32 so that
+ *  pass 3 reports them as before.
+ * ========================================================================= */
+static int x64_is_relaxable(const Instruction *inst)
+{
+    if (inst->is_label) return 0;
+    switch (inst->opcode) {
+        case OP_JMP: case OP_JZ: case OP_JNZ: case OP_JL: case OP_JG:
+            return inst->operands[0].type == OPERAND_LABEL_REF;
+        default:
+            return 0;
+    }
+}
+
+static uint8_t* x64_select_forms(const Instruction *ir, int ir_count,
+                                 const StrPool *strs, const RegAlloc *ra,
+                                 int origin, int win32)
+{
+    uint8_t *form     = (uint8_t *)calloc((size_t)ir_count + 1, 1);
+    int     *inst_pc  = (int *)malloc(((size_t)ir_count + 1) * sizeof(int));
+    int     *label_at = (int *)malloc((size_t)strs->count * sizeof(int));
+    if (!form || !inst_pc || !label_at) {
+        free(form); free(inst_pc); free(label_at);
+        return NULL;
+    }
+
+    /* Label name -> IR index of its first definition */
+    for (int id = 0; id < strs->count; id++) label_at[id] = -1;
+    for (int i = 0; i < ir_count; i++) {
+        if (ir[i].is_label && label_at[ir[i].label_id] < 0)
+            label_at[ir[i].label_id] = i;
+        else if (!ir[i].is_label && ir[i].opcode == OP_LDI &&
+                 ir[i].operands[1].data.imm == 0 &&
+                 x64_flags_dead_after(ir, ir_count, i))
+            form[i] = X64_FLAGS_DEAD;
+        else if (regalloc_inst_reg(ra, i) >= 0)
+            form[i] = X64_VAR_REG;
+    }
+
+    int changed;
+    do {
+        /* Lay out the code with the current branch forms */
+        int pc = origin;
+        for (int i = 0; i < ir_count; i++) {
+            const Instruction *inst = &ir[i];
+            inst_pc[i] = pc;
+            if (!inst->is_label && inst->opcode == OP_ORG) {
+                int target = (int)(uint32_t)inst->operands[0].data.imm;
+                if (target > pc) pc = target;
+            } else {
+                pc += instruction_size_x64(inst, form[i], win32);
+            }
+        }
+        inst_pc[ir_count] = pc;
+
+        changed = 0;
+        for (int i = 0; i < ir_count; i++) {
+            if (form[i] == X64_BR_PINNED || !x64_is_relaxable(&ir[i]))
+                continue;
+            int t = label_at[ir[i].operands[0].data.label_id];
+            if (t < 0) continue;
+
+            int target = inst_pc[t];
+            if (form[i] == X64_BR_SHORT) {
+                int rel = target - (inst_pc[i] + 2);
+                if (rel < -128 || rel > 127) {
+                    form[i] = X64_BR_PINNED;
+                    changed = 1;
+                }
+            } else {
+                /* A forward target moves back with this branch */
+                int shrink = instruction_size_x64(&ir[i], 0, win32) - 2;
+                if (t > i) target -= shrink;
+                int rel = target - (inst_pc[i] + 2);
+                if (rel >= -128 && rel <= 127) {
+                    form[i] = X64_BR_SHORT;
+                    changed = 1;
+                }
+            }
+        }
+    } while (changed);
+
+    free(inst_pc);
+    free(label_at);
+    return form;
+}
+
+/* Emit JMP (cc < 0) or Jcc label in the form chosen by relaxation */
+static void x64_emit_branch(CodeBuffer *code, SymbolTable *st,
+                            FixupVec *fixups, const char *label,
+                            int cc, int is_short, const Instruction *inst)
+{
+    if (is_short) {
+        emit_byte(code, (uint8_t)(cc < 0 ? 0xEB : 0x70 | cc));
+    } else if (cc < 0) {
+        emit_byte(code, 0xE9);
+    } else {
+        emit_byte(code, 0x0F);
+        emit_byte(code, (uint8_t)(0x80 | cc));
+    }
+    int patch_off = code->size;
+    if (is_short)
+        emit_byte(code, 0x00);
+    else
+        emit_rel32_placeholder(code);
+    x64_add_fixup(st, fixups, label, patch_off, code->size, inst);
+    fixvec_at(fixups, X64Fixup, fixups->count - 1)->rel8 = is_short;
+}
+
 /* =========================================================================
  *  Variable table — compiler-managed named storage
  *
@@ -578,18 +809,19 @@ static void x64_vartab_init(X64VarTable *vt)
 }
 
 static int x64_vartab_add(X64VarTable *vt, const char *name,
-                           int64_t init_value, int has_init)
+                           int64_t init_value, int has_init,
+                           UaDiag *diag)
 {
     /* Check for duplicate */
     for (int i = 0; i < vt->count; i++) {
         if (strcmp(vt->vars[i].name, name) == 0) {
-            fprintf(stderr, "x86-64: duplicate variable '%s'\n", name);
+            diag_printf(diag, "x86-64: duplicate variable '%s'\n", name);
             return -1;
         }
     }
     if (vt->count >= X64_MAX_VARS) {
-        fprintf(stderr, "x86-64: variable table overflow (max %d)\n",
-                X64_MAX_VARS);
+        diag_printf(diag, "x86-64: variable table overflow (max %d)\n",
+                    X64_MAX_VARS);
         return -1;
     }
     X64VarEntry *v = &vt->vars[vt->count++];
@@ -621,16 +853,17 @@ static void x64_buftab_init(X64BufTable *bt) {
     bt->total_size = 0;
 }
 
-static int x64_buftab_add(X64BufTable *bt, const char *name, int size) {
+static int x64_buftab_add(X64BufTable *bt, const char *name, int size,
+                          UaDiag *diag) {
     for (int i = 0; i < bt->count; i++) {
         if (strcmp(bt->bufs[i].name, name) == 0) {
-            fprintf(stderr, "x86-64: duplicate buffer '%s'\n", name);
+            diag_printf(diag, "x86-64: duplicate buffer '%s'\n", name);
             return -1;
         }
     }
     if (bt->count >= X64_MAX_BUFFERS) {
-        fprintf(stderr, "x86-64: buffer table overflow (max %d)\n",
-                X64_MAX_BUFFERS);
+        diag_printf(diag, "x86-64: buffer table overflow (max %d)\n",
+                    X64_MAX_BUFFERS);
         return -1;
     }
     X64BufEntry *b = &bt->bufs[bt->count++];
@@ -672,7 +905,8 @@ static void x64_strtab_init(X64StringTable *st)
 }
 
 /* Add a string literal; returns the index.  De-duplicates identical strings. */
-static int x64_strtab_add(X64StringTable *st, const char *text)
+static int x64_strtab_add(X64StringTable *st, const char *text,
+                          UaDiag *diag)
 {
     /* Check for duplicate */
     for (int i = 0; i < st->count; i++) {
@@ -680,8 +914,8 @@ static int x64_strtab_add(X64StringTable *st, const char *text)
             return i;
     }
     if (st->count >= X64_MAX_STRINGS) {
-        fprintf(stderr, "x86-64: string table overflow (max %d)\n",
-                X64_MAX_STRINGS);
+        diag_printf(diag, "x86-64: string table overflow (max %d)\n",
+                    X64_MAX_STRINGS);
         return -1;
     }
     X64StringEntry *e = &st->strings[st->count];
@@ -693,23 +927,74 @@ static int x64_strtab_add(X64StringTable *st, const char *text)
     return st->count++;
 }
 
+/* =========================================================================
+ *  VAR register pool (-O2)
+ *
+ *  R12-R15 are callee-saved in both the SysV and Win64 ABIs, so they are
+ *  only handed out when the program owns the process (ELF / PE).  R8-R10
+ *  are caller-saved and always usable, but the Win64 API calls behind SYS
+ *  and a 32-bit INT 0x80 may clobber them.  R11 is never used: SYSCALL
+ *  overwrites it with RFLAGS.
+ * ========================================================================= */
+static const uint8_t X64_VAR_POOL[] = { 12, 13, 14, 15, 8, 9, 10 };
+static const char *const X64_VAR_POOL_NAME[] = {
+    "R12", "R13", "R14", "R15", "R8", "R9", "R10"
+};
+#define X64_VAR_POOL_SCRATCH  4     /* first caller-saved entry (R8) */
+
+static void x64_var_pool(RegPool *pool, int var_regs)
+{
+    int first   = (var_regs == X64_VARS_PROCESS) ? 0 : X64_VAR_POOL_SCRATCH;
+    pool->regs  = X64_VAR_POOL + first;
+    pool->names = X64_VAR_POOL_NAME + first;
+    pool->count = (int)(sizeof(X64_VAR_POOL) / sizeof(X64_VAR_POOL[0])) - first;
+    pool->sys_clobber = 0;
+    for (int k = 0; k < pool->count; k++) {
+        if (pool->regs[k] < 12) pool->sys_clobber |= 1u << k;
+    }
+}
+
+/* Load the initial value of every entry-live register VAR; returns size */
+static int x64_var_prologue(CodeBuffer *code, const RegAlloc *ra,
+                            const StrPool *strs, UaDiag *diag)
+{
+    int size = 0;
+    if (!ra) return 0;
+    for (int v = 0; v < ra->var_count; v++) {
+        const RegAllocVar *rv = &ra->vars[v];
+        if (rv->reg < 0 || !rv->live_in) continue;
+        if (code) {
+            diag_trace(diag, "  (entry) %s -> MOV R%d, %lld\n",
+                       strpool_get(strs, rv->name), rv->reg,
+                       (long long)rv->init);
+        }
+        size += emit_mov_rx_imm(code, (uint8_t)rv->reg, rv->init);
+    }
+    return size;
+}
+
 /* =========================================================================
  *  generate_x86_64()  —  main entry point  (two-pass)
  * ========================================================================= */
 CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
-                             const char *sys)
+                             const StrPool *strs, const char *sys,
+                             int var_regs, int seg_gap, UaDiag *diag)
 {
-    /* Set win32 flag for instruction sizing and code generation */
-    g_win32 = (sys != NULL && (strcmp(sys, "win32") == 0 ||
+    /* Win32 target: SYS / HLT call the appended PE runtime stubs */
+    int win32 = (sys != NULL && (strcmp(sys, "win32") == 0 ||
                                strcmp(sys, "Win32") == 0 ||
                                strcmp(sys, "WIN32") == 0));
 
-    fprintf(stderr, "[x86-64] Generating code for %d IR instructions%s ...\n",
-            ir_count, g_win32 ? " (Win32 target)" : "");
+    diag_log(diag, DIAG_NORMAL, "[x86-64] Generating code for %d IR instructions%s ...\n",
+             ir_count, win32 ? " (Win32 target)" : "");
 
     /* --- Pass 1: collect label addresses + variable declarations ------- */
-    X64SymTab symtab;
-    x64_symtab_init(&symtab);
+    SymbolTable symtab;
+    symtab_init(&symtab, diag);
+    diag_own(diag, &symtab, symtab_drop);
+    FixupVec fixups;
+    fixvec_init(&fixups, sizeof(X64Fixup), diag);
+    diag_own(diag, &fixups, fixvec_drop);
 
     X64VarTable vartab;
     x64_vartab_init(&vartab);
@@ -720,14 +1005,39 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
     X64BufTable buftab;
     x64_buftab_init(&buftab);
 
-    int pc = 0;
+    /* -O2: keep VARs in spare registers where liveness allows */
+    RegAlloc  regalloc;
+    RegAlloc *ra = NULL;
+    if (var_regs != X64_VARS_MEMORY) {
+        RegPool pool;
+        x64_var_pool(&pool, var_regs);
+        if (regalloc_run(&regalloc, ir, ir_count, strs, &pool) == 0) {
+            diag_own(diag, &regalloc, regalloc_drop);
+            regalloc_print(&regalloc, strs, &pool, diag);
+            ra = &regalloc;
+        }
+    }
+    int prologue = x64_var_prologue(NULL, ra, strs, diag);
+
+    uint8_t *forms = x64_select_forms(ir, ir_count, strs, ra, prologue,
+                                      win32);
+    if (!forms) {
+        diag_printf(diag, "UA x86-64: out of memory\n");
+        if (ra) regalloc_free(ra);
+        symtab_free(&symtab);
+        fixvec_free(&fixups);
+        return NULL;
+    }
+    diag_own(diag, &forms, diag_free_ptr);
+
+    int pc = prologue;
     for (int i = 0; i < ir_count; i++) {
         const Instruction *inst = &ir[i];
         if (inst->is_label) {
-            x64_symtab_add(&symtab, inst->label_name, pc);
+            symtab_add(&symtab, strpool_get(strs, inst->label_id), pc);
         } else if (inst->opcode == OP_VAR) {
             /* Collect variable declaration — no code emitted */
-            const char *vname = inst->operands[0].data.label;
+            const char *vname = strpool_get(strs, inst->operands[0].data.label_id);
             int64_t init_val  = 0;
             int     has_init  = 0;
             if (inst->operand_count >= 2 &&
@@ -735,54 +1045,52 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
                 init_val = inst->operands[1].data.imm;
                 has_init = 1;
             }
-            x64_vartab_add(&vartab, vname, init_val, has_init);
+            x64_vartab_add(&vartab, vname, init_val, has_init, diag);
         } else if (inst->opcode == OP_BUFFER) {
             /* Collect buffer declaration — no code emitted */
-            const char *bname = inst->operands[0].data.label;
+            const char *bname = strpool_get(strs, inst->operands[0].data.label_id);
             int bsize = (int)inst->operands[1].data.imm;
-            x64_buftab_add(&buftab, bname, bsize);
+            x64_buftab_add(&buftab, bname, bsize, diag);
         } else if (inst->opcode == OP_ORG) {
             /* @ORG <address> — advance PC to the given address */
             uint32_t target = (uint32_t)inst->operands[0].data.imm;
             if ((int)target < pc) {
-                fprintf(stderr, "Error: @ORG 0x%X would move address "
-                        "backwards (current PC = 0x%X)\n",
-                        target, (unsigned)pc);
-                exit(1);
+                diag_printf(diag, "Error: @ORG 0x%X would move address "
+                            "backwards (current PC = 0x%X)\n",
+                            target, (unsigned)pc);
+                diag_fatal(diag);
             }
             pc = (int)target;
         } else if (inst->opcode == OP_LDS) {
             /* Collect string literal */
-            x64_strtab_add(&strtab, inst->operands[1].data.string);
-            pc += instruction_size_x64(inst);
+            x64_strtab_add(&strtab, strpool_get(strs, inst->operands[1].data.string_id),
+                           diag);
+            pc += instruction_size_x64(inst, 0, win32);
         } else {
-            pc += instruction_size_x64(inst);
+            pc += instruction_size_x64(inst, forms[i], win32);
         }
     }
 
-    /* Register variable symbols: each lives at code_end + index * 8 */
-    int var_base = pc;   /* total code size */
-    for (int v = 0; v < vartab.count; v++) {
-        x64_symtab_add(&symtab, vartab.vars[v].name,
-                        var_base + v * X64_VAR_SIZE);
-    }
-
-    /* Register buffer symbols: each lives after variables */
-    int buf_base = var_base + vartab.count * X64_VAR_SIZE;
-    {
-        int buf_offset = 0;
-        for (int b = 0; b < buftab.count; b++) {
-            x64_symtab_add(&symtab, buftab.bufs[b].name,
-                            buf_base + buf_offset);
-            buf_offset += buftab.bufs[b].size;
-        }
-    }
-
-    /* String data lives after variables and buffers */
-    int str_base = buf_base + buftab.total_size;
+    /* Data after the code, stored in bytes[] back to back:
+     *   [strings][pad to a VAR boundary]               read-only
+     *   [initialised VARs][Win32 runtime]              writable
+     *   [uninitialised VARs][BUFFERs]                  bss (size only)
+     * Each part after the code is addressed seg_gap further on, so a
+     * container can map code, strings and data as separate segments.
+     * The bss starts on a VAR boundary; the emitter maps it as
+     * zero-filled memory. */
+    int code_end  = pc;   /* total code size */
+    int init_vars = 0;
+    for (int v = 0; v < vartab.count; v++)
+        if (vartab.vars[v].has_init) init_vars++;
+
+    int str_base = code_end + seg_gap;
+    int str_end  = (code_end + strtab.total_size + X64_VAR_SIZE - 1)
+                 & ~(X64_VAR_SIZE - 1);
+    int var_base = str_end + 2 * seg_gap;
 
     /* --- Win32 runtime stub addresses (computed for pass 2 CALL targets) */
-    /* Layout after string data:
+    /* Layout after the initialised variables:
      *   [syscall_dispatcher  44 bytes]  (multi-way: 0→read, 1→write,
      *                                    2→open, 3→close, else→exit)
      *   [write_dispatcher    98 bytes]  (WriteFile, fd=1→stdout, else handle)
@@ -806,19 +1114,52 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
     #define W32_EXIT_STUB_SIZE   16
     #define W32_DATA_SIZE        32  /* stdout(8)+stdin(8)+written(8)+read(8) */
     #define W32_IAT_SIZE         56  /* 7 entries × 8 bytes */
-    int stub_base  = str_base + strtab.total_size;  /* start of syscall_dispatcher */
+    int stub_base  = var_base + init_vars * X64_VAR_SIZE; /* syscall_dispatcher */
     int exit_base  = stub_base + W32_DISPATCH_SIZE + W32_WRITE_STUB_SIZE
                    + W32_READ_STUB_SIZE + W32_OPEN_STUB_SIZE
                    + W32_CLOSE_STUB_SIZE;
     int iat_offset = exit_base + W32_EXIT_STUB_SIZE + W32_DATA_SIZE;
     (void)iat_offset;  /* recorded later as code->pe_iat_offset */
 
+    /* Register variable and buffer symbols */
+    int data_end = stub_base;
+    if (win32)
+        data_end = iat_offset + W32_IAT_SIZE;
+    int bss_base = (data_end + X64_VAR_SIZE - 1) & ~(X64_VAR_SIZE - 1);
+    int buf_base = bss_base + (vartab.count - init_vars) * X64_VAR_SIZE;
+    {
+        int init_idx = 0, bss_idx = 0;
+        for (int v = 0; v < vartab.count; v++) {
+            int addr = vartab.vars[v].has_init
+                     ? var_base + (init_idx++) * X64_VAR_SIZE
+                     : bss_base + (bss_idx++) * X64_VAR_SIZE;
+            symtab_add(&symtab, vartab.vars[v].name, addr);
+        }
+        int buf_offset = 0;
+        for (int b = 0; b < buftab.count; b++) {
+            symtab_add(&symtab, buftab.bufs[b].name,
+                       buf_base + buf_offset);
+            buf_offset += buftab.bufs[b].size;
+        }
+    }
+
     /* --- Pass 2: code emission ----------------------------------------- */
-    CodeBuffer *code = create_code_buffer();
+    CodeBuffer *code = create_code_buffer(diag);
     if (!code) {
-        fprintf(stderr, "UA x86-64: out of memory\n");
+        diag_printf(diag, "UA x86-64: out of memory\n");
+        free(forms);
+        if (ra) regalloc_free(ra);
+        symtab_free(&symtab);
+        fixvec_free(&fixups);
         return NULL;
     }
+    diag_own(diag, &code, codebuf_drop);
+
+    /* Pass 1 sized the code, strings, VARs and Win32 runtime: allocate
+     * them at once */
+    codebuf_reserve(code, str_end + (data_end - var_base));
+
+    x64_var_prologue(code, ra, strs, diag);
 
     for (int i = 0; i < ir_count; i++) {
         const Instruction *inst = &ir[i];
@@ -826,17 +1167,38 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
         if (inst->is_label)
             continue;
 
+        codebuf_add_line(code, inst->file, inst->line);
+
         switch (inst->opcode) {
 
-        /* ---- LDI Rd, #imm  ->  MOV r64, imm32 ------------ 7 bytes --- */
+        /* ---- LDI Rd, #imm  ->  XOR / MOV r32 / MOV r64 / MOVABS  2-10 bytes */
         case OP_LDI: {
             int rd = inst->operands[0].data.reg;
-            int32_t imm = (int32_t)inst->operands[1].data.imm;
-            x64_validate_register(inst, rd);
+            int64_t imm = inst->operands[1].data.imm;
+            x64_validate_register(diag, inst, rd);
             uint8_t enc = X64_REG_ENC[rd];
-            fprintf(stderr, "  LDI R%d -> MOV %s, %d\n",
-                    rd, X64_REG_NAME[rd], imm);
-            emit_mov_r64_imm32(code, enc, imm);
+            switch (x64_ldi_size(imm, forms[i] & X64_FLAGS_DEAD)) {
+            case 2:
+                diag_trace(diag, "  LDI R%d -> XOR %s, %s (32-bit)\n",
+                           rd, X64_REG_NAME[rd], X64_REG_NAME[rd]);
+                emit_xor_r32_r32(code, enc, enc);
+                break;
+            case 5:
+                diag_trace(diag, "  LDI R%d -> MOV %s, %lld (32-bit)\n",
+                           rd, X64_REG_NAME[rd], (long long)imm);
+                emit_mov_r32_imm32(code, enc, (uint32_t)imm);
+                break;
+            case 7:
+                diag_trace(diag, "  LDI R%d -> MOV %s, %lld\n",
+                           rd, X64_REG_NAME[rd], (long long)imm);
+                emit_mov_r64_imm32(code, enc, (int32_t)imm);
+                break;
+            default:
+                diag_trace(diag, "  LDI R%d -> MOVABS %s, %lld\n",
+                           rd, X64_REG_NAME[rd], (long long)imm);
+                emit_mov_r64_imm64(code, enc, imm);
+                break;
+            }
             break;
         }
 
@@ -844,12 +1206,12 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
         case OP_MOV: {
             int rd = inst->operands[0].data.reg;
             int rs = inst->operands[1].data.reg;
-            x64_validate_register(inst, rd);
-            x64_validate_register(inst, rs);
+            x64_validate_register(diag, inst, rd);
+            x64_validate_register(diag, inst, rs);
             uint8_t enc_d = X64_REG_ENC[rd];
             uint8_t enc_s = X64_REG_ENC[rs];
-            fprintf(stderr, "  MOV R%d, R%d -> MOV %s, %s\n",
-                    rd, rs, X64_REG_NAME[rd], X64_REG_NAME[rs]);
+            diag_trace(diag, "  MOV R%d, R%d -> MOV %s, %s\n",
+                       rd, rs, X64_REG_NAME[rd], X64_REG_NAME[rs]);
             emit_mov_r64_r64(code, enc_d, enc_s);
             break;
         }
@@ -858,10 +1220,10 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
         case OP_LOAD: {
             int rd = inst->operands[0].data.reg;
             int rs = inst->operands[1].data.reg;
-            x64_validate_register(inst, rd);
-            x64_validate_register(inst, rs);
-            fprintf(stderr, "  LOAD R%d, R%d -> MOV %s, [%s]\n",
-                    rd, rs, X64_REG_NAME[rd], X64_REG_NAME[rs]);
+            x64_validate_register(diag, inst, rd);
+            x64_validate_register(diag, inst, rs);
+            diag_trace(diag, "  LOAD R%d, R%d -> MOV %s, [%s]\n",
+                       rd, rs, X64_REG_NAME[rd], X64_REG_NAME[rs]);
             emit_load_r64_mem(code, X64_REG_ENC[rd], X64_REG_ENC[rs]);
             break;
         }
@@ -870,117 +1232,115 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
         case OP_STORE: {
             int rx = inst->operands[0].data.reg;
             int ry = inst->operands[1].data.reg;
-            x64_validate_register(inst, rx);
-            x64_validate_register(inst, ry);
-            fprintf(stderr, "  STORE R%d, R%d -> MOV [%s], %s\n",
-                    rx, ry, X64_REG_NAME[rx], X64_REG_NAME[ry]);
+            x64_validate_register(diag, inst, rx);
+            x64_validate_register(diag, inst, ry);
+            diag_trace(diag, "  STORE R%d, R%d -> MOV [%s], %s\n",
+                       rx, ry, X64_REG_NAME[rx], X64_REG_NAME[ry]);
             emit_store_mem_r64(code, X64_REG_ENC[rx], X64_REG_ENC[ry]);
             break;
         }
 
-        /* ---- ADD Rd, Rs/imm -------------------------------- 3/10 bytes */
+        /* ---- ADD Rd, Rs/imm -------------------------- 3/4/7 bytes */
         case OP_ADD: {
             int rd = inst->operands[0].data.reg;
-            x64_validate_register(inst, rd);
+            x64_validate_register(diag, inst, rd);
             uint8_t enc_d = X64_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                x64_validate_register(inst, rs);
-                fprintf(stderr, "  ADD R%d, R%d -> ADD %s, %s\n",
-                        rd, rs, X64_REG_NAME[rd], X64_REG_NAME[rs]);
+                x64_validate_register(diag, inst, rs);
+                diag_trace(diag, "  ADD R%d, R%d -> ADD %s, %s\n",
+                           rd, rs, X64_REG_NAME[rd], X64_REG_NAME[rs]);
                 emit_add_r64_r64(code, enc_d, X64_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                uint8_t scratch = (enc_d == 1) ? 2 : 1;
-                fprintf(stderr, "  ADD R%d, #%d -> MOV scratch, %d; ADD %s, scratch\n",
-                        rd, imm, imm, X64_REG_NAME[rd]);
-                emit_mov_r64_imm32(code, scratch, imm);
-                emit_add_r64_r64(code, enc_d, scratch);
+                diag_trace(diag, "  ADD R%d, #%d -> ADD %s, imm%s\n",
+                           rd, imm, X64_REG_NAME[rd],
+                           x64_fits_imm8(imm) ? "8" : "32");
+                emit_alu_r64_imm(code, 0, enc_d, imm);
             }
             break;
         }
 
-        /* ---- SUB Rd, Rs/imm -------------------------------- 3/10 bytes */
+        /* ---- SUB Rd, Rs/imm -------------------------- 3/4/7 bytes */
         case OP_SUB: {
             int rd = inst->operands[0].data.reg;
-            x64_validate_register(inst, rd);
+            x64_validate_register(diag, inst, rd);
             uint8_t enc_d = X64_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                x64_validate_register(inst, rs);
-                fprintf(stderr, "  SUB R%d, R%d -> SUB %s, %s\n",
-                        rd, rs, X64_REG_NAME[rd], X64_REG_NAME[rs]);
+                x64_validate_register(diag, inst, rs);
+                diag_trace(diag, "  SUB R%d, R%d -> SUB %s, %s\n",
+                           rd, rs, X64_REG_NAME[rd], X64_REG_NAME[rs]);
                 emit_sub_r64_r64(code, enc_d, X64_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                uint8_t scratch = (enc_d == 1) ? 2 : 1;
-                fprintf(stderr, "  SUB R%d, #%d -> MOV scratch, %d; SUB %s, scratch\n",
-                        rd, imm, imm, X64_REG_NAME[rd]);
-                emit_mov_r64_imm32(code, scratch, imm);
-                emit_sub_r64_r64(code, enc_d, scratch);
+                diag_trace(diag, "  SUB R%d, #%d -> SUB %s, imm%s\n",
+                           rd, imm, X64_REG_NAME[rd],
+                           x64_fits_imm8(imm) ? "8" : "32");
+                emit_alu_r64_imm(code, 5, enc_d, imm);
             }
             break;
         }
 
-        /* ---- AND Rd, Rs/imm -------------------------------- 3/10 bytes */
+        /* ---- AND Rd, Rs/imm -------------------------- 3/4/7 bytes */
         case OP_AND: {
             int rd = inst->operands[0].data.reg;
-            x64_validate_register(inst, rd);
+            x64_validate_register(diag, inst, rd);
             uint8_t enc_d = X64_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                x64_validate_register(inst, rs);
-                fprintf(stderr, "  AND R%d, R%d -> AND %s, %s\n",
-                        rd, rs, X64_REG_NAME[rd], X64_REG_NAME[rs]);
+                x64_validate_register(diag, inst, rs);
+                diag_trace(diag, "  AND R%d, R%d -> AND %s, %s\n",
+                           rd, rs, X64_REG_NAME[rd], X64_REG_NAME[rs]);
                 emit_and_r64_r64(code, enc_d, X64_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                uint8_t scratch = (enc_d == 1) ? 2 : 1;
-                fprintf(stderr, "  AND R%d, #%d\n", rd, imm);
-                emit_mov_r64_imm32(code, scratch, imm);
-                emit_and_r64_r64(code, enc_d, scratch);
+                diag_trace(diag, "  AND R%d, #%d -> AND %s, imm%s\n",
+                           rd, imm, X64_REG_NAME[rd],
+                           x64_fits_imm8(imm) ? "8" : "32");
+                emit_alu_r64_imm(code, 4, enc_d, imm);
             }
             break;
         }
 
-        /* ---- OR Rd, Rs/imm --------------------------------- 3/10 bytes */
+        /* ---- OR Rd, Rs/imm --------------------------- 3/4/7 bytes */
         case OP_OR: {
             int rd = inst->operands[0].data.reg;
-            x64_validate_register(inst, rd);
+            x64_validate_register(diag, inst, rd);
             uint8_t enc_d = X64_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                x64_validate_register(inst, rs);
-                fprintf(stderr, "  OR  R%d, R%d -> OR %s, %s\n",
-                        rd, rs, X64_REG_NAME[rd], X64_REG_NAME[rs]);
+                x64_validate_register(diag, inst, rs);
+                diag_trace(diag, "  OR  R%d, R%d -> OR %s, %s\n",
+                           rd, rs, X64_REG_NAME[rd], X64_REG_NAME[rs]);
                 emit_or_r64_r64(code, enc_d, X64_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                uint8_t scratch = (enc_d == 1) ? 2 : 1;
-                fprintf(stderr, "  OR  R%d, #%d\n", rd, imm);
-                emit_mov_r64_imm32(code, scratch, imm);
-                emit_or_r64_r64(code, enc_d, scratch);
+                diag_trace(diag, "  OR  R%d, #%d -> OR %s, imm%s\n",
+                           rd, imm, X64_REG_NAME[rd],
+                           x64_fits_imm8(imm) ? "8" : "32");
+                emit_alu_r64_imm(code, 1, enc_d, imm);
             }
             break;
         }
 
-        /* ---- XOR Rd, Rs/imm -------------------------------- 3/10 bytes */
+        /* ---- XOR Rd, Rs/imm -------------------------- 3/4/7 bytes */
         case OP_XOR: {
             int rd = inst->operands[0].data.reg;
-            x64_validate_register(inst, rd);
+            x64_validate_register(diag, inst, rd);
             uint8_t enc_d = X64_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                x64_validate_register(inst, rs);
-                fprintf(stderr, "  XOR R%d, R%d -> XOR %s, %s\n",
-                        rd, rs, X64_REG_NAME[rd], X64_REG_NAME[rs]);
+                x64_validate_register(diag, inst, rs);
+                diag_trace(diag, "  XOR R%d, R%d -> XOR %s, %s\n",
+                           rd, rs, X64_REG_NAME[rd], X64_REG_NAME[rs]);
                 emit_xor_r64_r64(code, enc_d, X64_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                uint8_t scratch = (enc_d == 1) ? 2 : 1;
-                fprintf(stderr, "  XOR R%d, #%d\n", rd, imm);
-                emit_mov_r64_imm32(code, scratch, imm);
-                emit_xor_r64_r64(code, enc_d, scratch);
+                diag_trace(diag, "  XOR R%d, #%d -> XOR %s, imm%s\n",
+                           rd, imm, X64_REG_NAME[rd],
+                           x64_fits_imm8(imm) ? "8" : "32");
+                emit_alu_r64_imm(code, 6, enc_d, imm);
             }
             break;
         }
@@ -988,8 +1348,8 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
         /* ---- NOT Rd  ->  NOT r64 --------------------------- 3 bytes -- */
         case OP_NOT: {
             int rd = inst->operands[0].data.reg;
-            x64_validate_register(inst, rd);
-            fprintf(stderr, "  NOT R%d -> NOT %s\n", rd, X64_REG_NAME[rd]);
+            x64_validate_register(diag, inst, rd);
+            diag_trace(diag, "  NOT R%d -> NOT %s\n", rd, X64_REG_NAME[rd]);
             emit_not_r64(code, X64_REG_ENC[rd]);
             break;
         }
@@ -997,8 +1357,8 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
         /* ---- INC Rd  ->  INC r64 --------------------------- 3 bytes -- */
         case OP_INC: {
             int rd = inst->operands[0].data.reg;
-            x64_validate_register(inst, rd);
-            fprintf(stderr, "  INC R%d -> INC %s\n", rd, X64_REG_NAME[rd]);
+            x64_validate_register(diag, inst, rd);
+            diag_trace(diag, "  INC R%d -> INC %s\n", rd, X64_REG_NAME[rd]);
             emit_inc_r64(code, X64_REG_ENC[rd]);
             break;
         }
@@ -1006,30 +1366,29 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
         /* ---- DEC Rd  ->  DEC r64 --------------------------- 3 bytes -- */
         case OP_DEC: {
             int rd = inst->operands[0].data.reg;
-            x64_validate_register(inst, rd);
-            fprintf(stderr, "  DEC R%d -> DEC %s\n", rd, X64_REG_NAME[rd]);
+            x64_validate_register(diag, inst, rd);
+            diag_trace(diag, "  DEC R%d -> DEC %s\n", rd, X64_REG_NAME[rd]);
             emit_dec_r64(code, X64_REG_ENC[rd]);
             break;
         }
 
-        /* ---- MUL Rd, Rs/imm  ->  IMUL r64, r64 ------- 4/11 bytes ---- */
+        /* ---- MUL Rd, Rs/imm  ->  IMUL r64, r64[, imm] ---- 4/7 bytes -- */
         case OP_MUL: {
             int rd = inst->operands[0].data.reg;
-            x64_validate_register(inst, rd);
+            x64_validate_register(diag, inst, rd);
             uint8_t enc_d = X64_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                x64_validate_register(inst, rs);
-                fprintf(stderr, "  MUL R%d, R%d -> IMUL %s, %s\n",
-                        rd, rs, X64_REG_NAME[rd], X64_REG_NAME[rs]);
+                x64_validate_register(diag, inst, rs);
+                diag_trace(diag, "  MUL R%d, R%d -> IMUL %s, %s\n",
+                           rd, rs, X64_REG_NAME[rd], X64_REG_NAME[rs]);
                 emit_imul_r64_r64(code, enc_d, X64_REG_ENC[rs]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                uint8_t scratch = (enc_d == 1) ? 2 : 1;
-                fprintf(stderr, "  MUL R%d, #%d -> MOV scratch, %d; IMUL %s, scratch\n",
-                        rd, imm, imm, X64_REG_NAME[rd]);
-                emit_mov_r64_imm32(code, scratch, imm);
-                emit_imul_r64_r64(code, enc_d, scratch);
+                diag_trace(diag, "  MUL R%d, #%d -> IMUL %s, %s, imm%s\n",
+                           rd, imm, X64_REG_NAME[rd], X64_REG_NAME[rd],
+                           x64_fits_imm8(imm) ? "8" : "32");
+                emit_imul_r64_imm(code, enc_d, imm);
             }
             break;
         }
@@ -1040,14 +1399,14 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
          * --------------------------------------------------------------- */
         case OP_DIV: {
             int rd = inst->operands[0].data.reg;
-            x64_validate_register(inst, rd);
+            x64_validate_register(diag, inst, rd);
             uint8_t enc_d = X64_REG_ENC[rd];
 
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                x64_validate_register(inst, rs);
+                x64_validate_register(diag, inst, rs);
                 uint8_t enc_s = X64_REG_ENC[rs];
-                fprintf(stderr, "  DIV R%d, R%d -> IDIV\n", rd, rs);
+                diag_trace(diag, "  DIV R%d, R%d -> IDIV\n", rd, rs);
                 emit_push_r64(code, 2);            /* PUSH RDX      1 */
                 emit_mov_r64_r64(code, 0, enc_d);  /* MOV RAX, Rd   3 */
                 emit_cqo(code);                    /* CQO            2 */
@@ -1059,8 +1418,8 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
                 /* Use a scratch reg that isn't RAX(0), RDX(2), or Rd */
                 uint8_t scratch = 1; /* RCX */
                 if (enc_d == 1) scratch = 3; /* RBX if Rd=RCX */
-                fprintf(stderr, "  DIV R%d, #%d -> MOV scratch, %d; IDIV\n",
-                        rd, imm, imm);
+                diag_trace(diag, "  DIV R%d, #%d -> MOV scratch, %d; IDIV\n",
+                           rd, imm, imm);
                 emit_push_r64(code, 2);                /* PUSH RDX   1 */
                 emit_mov_r64_imm32(code, scratch, imm); /* MOV scr,imm 7 */
                 emit_mov_r64_r64(code, 0, enc_d);      /* MOV RAX,Rd 3 */
@@ -1075,18 +1434,18 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
         /* ---- SHL Rd, Rs/imm -------------------------------- 4/13 bytes */
         case OP_SHL: {
             int rd = inst->operands[0].data.reg;
-            x64_validate_register(inst, rd);
+            x64_validate_register(diag, inst, rd);
             uint8_t enc_d = X64_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_IMMEDIATE) {
                 uint8_t imm = (uint8_t)(inst->operands[1].data.imm & 0x3F);
-                fprintf(stderr, "  SHL R%d, #%d\n", rd, imm);
+                diag_trace(diag, "  SHL R%d, #%d\n", rd, imm);
                 emit_shl_r64_imm8(code, enc_d, imm);
             } else {
                 int rs = inst->operands[1].data.reg;
-                x64_validate_register(inst, rs);
+                x64_validate_register(diag, inst, rs);
                 uint8_t enc_s = X64_REG_ENC[rs];
-                fprintf(stderr, "  SHL R%d, R%d -> SHL %s, CL\n",
-                        rd, rs, X64_REG_NAME[rd]);
+                diag_trace(diag, "  SHL R%d, R%d -> SHL %s, CL\n",
+                           rd, rs, X64_REG_NAME[rd]);
                 /* Save RCX, move shift count to CL, shift, restore */
                 emit_push_r64(code, 1);            /* PUSH RCX       1 */
                 emit_mov_r64_r64(code, 1, enc_s);  /* MOV RCX, Rs    3 */
@@ -1101,18 +1460,18 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
         /* ---- SHR Rd, Rs/imm -------------------------------- 4/13 bytes */
         case OP_SHR: {
             int rd = inst->operands[0].data.reg;
-            x64_validate_register(inst, rd);
+            x64_validate_register(diag, inst, rd);
             uint8_t enc_d = X64_REG_ENC[rd];
             if (inst->operands[1].type == OPERAND_IMMEDIATE) {
                 uint8_t imm = (uint8_t)(inst->operands[1].data.imm & 0x3F);
-                fprintf(stderr, "  SHR R%d, #%d\n", rd, imm);
+                diag_trace(diag, "  SHR R%d, #%d\n", rd, imm);
                 emit_shr_r64_imm8(code, enc_d, imm);
             } else {
                 int rs = inst->operands[1].data.reg;
-                x64_validate_register(inst, rs);
+                x64_validate_register(diag, inst, rs);
                 uint8_t enc_s = X64_REG_ENC[rs];
-                fprintf(stderr, "  SHR R%d, R%d -> SHR %s, CL\n",
-                        rd, rs, X64_REG_NAME[rd]);
+                diag_trace(diag, "  SHR R%d, R%d -> SHR %s, CL\n",
+                           rd, rs, X64_REG_NAME[rd]);
                 emit_push_r64(code, 1);
                 emit_mov_r64_r64(code, 1, enc_s);
                 emit_shr_r64_cl(code, enc_d);
@@ -1125,103 +1484,90 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
         /* ---- CMP Ra, Rb/imm -------------------------------- 3/7 bytes  */
         case OP_CMP: {
             int ra = inst->operands[0].data.reg;
-            x64_validate_register(inst, ra);
+            x64_validate_register(diag, inst, ra);
             uint8_t enc_a = X64_REG_ENC[ra];
             if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rb = inst->operands[1].data.reg;
-                x64_validate_register(inst, rb);
-                fprintf(stderr, "  CMP R%d, R%d -> CMP %s, %s\n",
-                        ra, rb, X64_REG_NAME[ra], X64_REG_NAME[rb]);
+                x64_validate_register(diag, inst, rb);
+                diag_trace(diag, "  CMP R%d, R%d -> CMP %s, %s\n",
+                           ra, rb, X64_REG_NAME[ra], X64_REG_NAME[rb]);
                 emit_cmp_r64_r64(code, enc_a, X64_REG_ENC[rb]);
             } else {
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                fprintf(stderr, "  CMP R%d, #%d\n", ra, imm);
-                emit_cmp_r64_imm32(code, enc_a, imm);
+                diag_trace(diag, "  CMP R%d, #%d\n", ra, imm);
+                emit_cmp_r64_imm(code, enc_a, imm);
             }
             break;
         }
 
-        /* ---- JMP label  ->  JMP rel32 ---------------------- 5 bytes -- */
+        /* ---- JMP label  ->  EB rel8 / E9 rel32 ----------- 2 / 5 bytes -- */
         case OP_JMP: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  JMP %s\n", label);
-            emit_byte(code, 0xE9);
-            int patch_off = code->size;
-            emit_rel32_placeholder(code);
-            x64_add_fixup(&symtab, label, patch_off, code->size, inst->line);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  JMP %s\n", label);
+            x64_emit_branch(code, &symtab, &fixups, label, -1,
+                            (forms[i] & X64_BR_MASK) == X64_BR_SHORT, inst);
             break;
         }
 
-        /* ---- JZ label  ->  JZ rel32 (0F 84) --------------- 6 bytes -- */
+        /* ---- JZ label  ->  74 rel8 / 0F 84 rel32 -- 2 / 6 bytes -- */
         case OP_JZ: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  JZ  %s\n", label);
-            emit_byte(code, 0x0F);
-            emit_byte(code, 0x84);
-            int patch_off = code->size;
-            emit_rel32_placeholder(code);
-            x64_add_fixup(&symtab, label, patch_off, code->size, inst->line);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  JZ  %s\n", label);
+            x64_emit_branch(code, &symtab, &fixups, label, 0x4,
+                            (forms[i] & X64_BR_MASK) == X64_BR_SHORT, inst);
             break;
         }
 
-        /* ---- JNZ label  ->  JNZ rel32 (0F 85) ------------- 6 bytes -- */
+        /* ---- JNZ label  ->  75 rel8 / 0F 85 rel32 - 2 / 6 bytes -- */
         case OP_JNZ: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  JNZ %s\n", label);
-            emit_byte(code, 0x0F);
-            emit_byte(code, 0x85);
-            int patch_off = code->size;
-            emit_rel32_placeholder(code);
-            x64_add_fixup(&symtab, label, patch_off, code->size, inst->line);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  JNZ %s\n", label);
+            x64_emit_branch(code, &symtab, &fixups, label, 0x5,
+                            (forms[i] & X64_BR_MASK) == X64_BR_SHORT, inst);
             break;
         }
 
-        /* ---- JL label  ->  JL rel32 (0F 8C) --------------- 6 bytes -- */
+        /* ---- JL label  ->  7C rel8 / 0F 8C rel32 -- 2 / 6 bytes -- */
         case OP_JL: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  JL  %s\n", label);
-            emit_byte(code, 0x0F);
-            emit_byte(code, 0x8C);
-            int patch_off = code->size;
-            emit_rel32_placeholder(code);
-            x64_add_fixup(&symtab, label, patch_off, code->size, inst->line);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  JL  %s\n", label);
+            x64_emit_branch(code, &symtab, &fixups, label, 0xC,
+                            (forms[i] & X64_BR_MASK) == X64_BR_SHORT, inst);
             break;
         }
 
-        /* ---- JG label  ->  JG rel32 (0F 8F) --------------- 6 bytes -- */
+        /* ---- JG label  ->  7F rel8 / 0F 8F rel32 -- 2 / 6 bytes -- */
         case OP_JG: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  JG  %s\n", label);
-            emit_byte(code, 0x0F);
-            emit_byte(code, 0x8F);
-            int patch_off = code->size;
-            emit_rel32_placeholder(code);
-            x64_add_fixup(&symtab, label, patch_off, code->size, inst->line);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  JG  %s\n", label);
+            x64_emit_branch(code, &symtab, &fixups, label, 0xF,
+                            (forms[i] & X64_BR_MASK) == X64_BR_SHORT, inst);
             break;
         }
 
         /* ---- CALL label  ->  CALL rel32 -------------------- 5 bytes -- */
         case OP_CALL: {
-            const char *label = inst->operands[0].data.label;
-            fprintf(stderr, "  CALL %s\n", label);
+            const char *label = strpool_get(strs, inst->operands[0].data.label_id);
+            diag_trace(diag, "  CALL %s\n", label);
             emit_byte(code, 0xE8);
             int patch_off = code->size;
             emit_rel32_placeholder(code);
-            x64_add_fixup(&symtab, label, patch_off, code->size, inst->line);
+            x64_add_fixup(&symtab, &fixups, label, patch_off, code->size,
+                          inst);
             break;
         }
 
         /* ---- RET ------------------------------------------- 1 byte -- */
         case OP_RET:
-            fprintf(stderr, "  RET\n");
+            diag_trace(diag, "  RET\n");
             emit_ret(code);
             break;
 
         /* ---- PUSH Rs ---------------------------------------- 1 byte -- */
         case OP_PUSH: {
             int rs = inst->operands[0].data.reg;
-            x64_validate_register(inst, rs);
-            fprintf(stderr, "  PUSH R%d -> PUSH %s\n", rs, X64_REG_NAME[rs]);
+            x64_validate_register(diag, inst, rs);
+            diag_trace(diag, "  PUSH R%d -> PUSH %s\n", rs, X64_REG_NAME[rs]);
             emit_push_r64(code, X64_REG_ENC[rs]);
             break;
         }
@@ -1229,31 +1575,28 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
         /* ---- POP Rd ----------------------------------------- 1 byte -- */
         case OP_POP: {
             int rd = inst->operands[0].data.reg;
-            x64_validate_register(inst, rd);
-            fprintf(stderr, "  POP  R%d -> POP %s\n", rd, X64_REG_NAME[rd]);
+            x64_validate_register(diag, inst, rd);
+            diag_trace(diag, "  POP  R%d -> POP %s\n", rd, X64_REG_NAME[rd]);
             emit_pop_r64(code, X64_REG_ENC[rd]);
             break;
         }
 
         /* ---- NOP -------------------------------------------- 1 byte -- */
         case OP_NOP:
-            fprintf(stderr, "  NOP\n");
+            diag_trace(diag, "  NOP\n");
             emit_nop(code);
             break;
 
         /* ---- HLT ------------------------------------------------ */
         case OP_HLT:
-            if (g_win32) {
+            if (win32) {
                 /* CALL rel32 → exit_dispatcher */
                 int32_t rel = (int32_t)(exit_base - (code->size + 5));
-                fprintf(stderr, "  HLT -> CALL exit_dispatcher\n");
+                diag_trace(diag, "  HLT -> CALL exit_dispatcher\n");
                 emit_byte(code, 0xE8);
-                emit_byte(code, (uint8_t)( rel        & 0xFF));
-                emit_byte(code, (uint8_t)((rel >>  8) & 0xFF));
-                emit_byte(code, (uint8_t)((rel >> 16) & 0xFF));
-                emit_byte(code, (uint8_t)((rel >> 24) & 0xFF));
+                emit_le32(code, (uint32_t)rel);
             } else {
-                fprintf(stderr, "  HLT -> RET\n");
+                diag_trace(diag, "  HLT -> RET\n");
                 emit_ret(code);
             }
             break;
@@ -1261,7 +1604,7 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
         /* ---- INT #imm  ->  INT imm8 (CD ib) --------------- 2 bytes -- */
         case OP_INT: {
             uint8_t imm = (uint8_t)(inst->operands[0].data.imm & 0xFF);
-            fprintf(stderr, "  INT #%d -> INT 0x%02X\n", imm, imm);
+            diag_trace(diag, "  INT #%d -> INT 0x%02X\n", imm, imm);
             emit_int_imm8(code, imm);
             break;
         }
@@ -1279,46 +1622,58 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
         /* ---- ORG addr — pad with zeros until target address ----------- */
         case OP_ORG: {
             uint32_t target = (uint32_t)inst->operands[0].data.imm;
-            while (code->size < (int)target) {
-                emit_byte(code, 0x00);
-            }
+            emit_fill(code, 0x00, (int)target - code->size);
             break;
         }
 
         /* ---- SET name, Rs/imm  →  MOV [RIP+disp32], r64/imm ---------- */
         case OP_SET: {
-            const char *vname = inst->operands[0].data.label;
-            if (inst->operands[1].type == OPERAND_REGISTER) {
+            const char *vname = strpool_get(strs, inst->operands[0].data.label_id);
+            if (forms[i] & X64_VAR_REG) {
+                int vr = regalloc_inst_reg(ra, i);
+                if (inst->operands[1].type == OPERAND_REGISTER) {
+                    int rs = inst->operands[1].data.reg;
+                    x64_validate_register(diag, inst, rs);
+                    diag_trace(diag, "  SET %s, R%d -> MOV R%d, %s\n",
+                               vname, rs, vr, X64_REG_NAME[rs]);
+                    emit_byte(code, 0x49);  /* REX.W + REX.B */
+                    emit_byte(code, 0x89);  /* MOV r/m64, r64 */
+                    emit_byte(code, (uint8_t)(0xC0 | (X64_REG_ENC[rs] << 3) |
+                                              (vr & 7)));
+                } else {
+                    int32_t imm = (int32_t)inst->operands[1].data.imm;
+                    diag_trace(diag, "  SET %s, #%d -> MOV R%d, imm32\n",
+                               vname, imm, vr);
+                    emit_mov_rx_imm(code, (uint8_t)vr, imm);
+                }
+            } else if (inst->operands[1].type == OPERAND_REGISTER) {
                 int rs = inst->operands[1].data.reg;
-                x64_validate_register(inst, rs);
-                fprintf(stderr, "  SET %s, R%d -> MOV [RIP+disp32], r64\n",
-                        vname, rs);
+                x64_validate_register(diag, inst, rs);
+                diag_trace(diag, "  SET %s, R%d -> MOV [RIP+disp32], r64\n",
+                           vname, rs);
                 /* REX.W prefix (+ REX.R if reg >= 8) */
                 emit_byte(code, (uint8_t)(0x48 | ((rs >= 8) ? 0x04 : 0x00)));
                 emit_byte(code, 0x89);  /* MOV r/m64, r64 */
                 emit_byte(code, (uint8_t)(((rs & 7) << 3) | 0x05));  /* ModRM: mod=00 rm=101 (RIP-rel) */
                 int patch_off = code->size;
                 emit_rel32_placeholder(code);
-                x64_add_fixup(&symtab, vname, patch_off, code->size,
-                              inst->line);
+                x64_add_fixup(&symtab, &fixups, vname, patch_off, code->size,
+                              inst);
             } else {
                 /* Immediate: MOV qword [RIP+disp32], imm32 */
                 int32_t imm = (int32_t)inst->operands[1].data.imm;
-                fprintf(stderr, "  SET %s, #%d -> MOV [RIP+disp32], imm32\n",
-                        vname, imm);
+                diag_trace(diag, "  SET %s, #%d -> MOV [RIP+disp32], imm32\n",
+                           vname, imm);
                 emit_byte(code, 0x48);  /* REX.W */
                 emit_byte(code, 0xC7);  /* MOV r/m64, imm32 */
                 emit_byte(code, 0x05);  /* ModRM: mod=00 reg=000 rm=101 */
                 int patch_off = code->size;
                 emit_rel32_placeholder(code);
                 /* imm32 */
-                emit_byte(code, (uint8_t)( imm        & 0xFF));
-                emit_byte(code, (uint8_t)((imm >>  8) & 0xFF));
-                emit_byte(code, (uint8_t)((imm >> 16) & 0xFF));
-                emit_byte(code, (uint8_t)((imm >> 24) & 0xFF));
-                x64_add_fixup(&symtab, vname, patch_off,
+                emit_le32(code, (uint32_t)imm);
+                x64_add_fixup(&symtab, &fixups, vname, patch_off,
                               code->size,  /* instr_end = end of full instruction */
-                              inst->line);
+                              inst);
             }
             break;
         }
@@ -1326,18 +1681,28 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
         /* ---- GET Rd, name  →  MOV r64, [RIP+disp32] or LEA (buffer) -- */
         case OP_GET: {
             int rd = inst->operands[0].data.reg;
-            const char *vname = inst->operands[1].data.label;
-            x64_validate_register(inst, rd);
+            const char *vname = strpool_get(strs, inst->operands[1].data.label_id);
+            x64_validate_register(diag, inst, rd);
+            if (forms[i] & X64_VAR_REG) {
+                int vr = regalloc_inst_reg(ra, i);
+                diag_trace(diag, "  GET R%d, %s -> MOV %s, R%d\n",
+                           rd, vname, X64_REG_NAME[rd], vr);
+                emit_byte(code, 0x4C);      /* REX.W + REX.R */
+                emit_byte(code, 0x89);      /* MOV r/m64, r64 */
+                emit_byte(code, (uint8_t)(0xC0 | ((vr & 7) << 3) |
+                                          X64_REG_ENC[rd]));
+                break;
+            }
             int is_buf = x64_buftab_has(&buftab, vname);
             if (is_buf) {
-                fprintf(stderr, "  GET R%d, %s -> LEA r64, [RIP+disp32] (buffer address)\n",
-                        rd, vname);
+                diag_trace(diag, "  GET R%d, %s -> LEA r64, [RIP+disp32] (buffer address)\n",
+                           rd, vname);
                 emit_byte(code, (uint8_t)(0x48 | ((rd >= 8) ? 0x04 : 0x00)));
                 emit_byte(code, 0x8D);  /* LEA r64, [RIP+disp32] */
                 emit_byte(code, (uint8_t)(((rd & 7) << 3) | 0x05));
             } else {
-                fprintf(stderr, "  GET R%d, %s -> MOV r64, [RIP+disp32]\n",
-                        rd, vname);
+                diag_trace(diag, "  GET R%d, %s -> MOV r64, [RIP+disp32]\n",
+                           rd, vname);
                 /* REX.W prefix (+ REX.R if reg >= 8) */
                 emit_byte(code, (uint8_t)(0x48 | ((rd >= 8) ? 0x04 : 0x00)));
                 emit_byte(code, 0x8B);  /* MOV r64, r/m64 */
@@ -1345,37 +1710,33 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
             }
             int patch_off = code->size;
             emit_rel32_placeholder(code);
-            x64_add_fixup(&symtab, vname, patch_off, code->size,
-                          inst->line);
+            x64_add_fixup(&symtab, &fixups, vname, patch_off, code->size,
+                          inst);
             break;
         }
 
         /* ---- LDS Rd, "str"  →  LEA r64, [RIP+disp32] ------- 7 bytes - */
         case OP_LDS: {
             int rd = inst->operands[0].data.reg;
-            const char *str = inst->operands[1].data.string;
-            x64_validate_register(inst, rd);
+            const char *str = strpool_get(strs, inst->operands[1].data.string_id);
+            x64_validate_register(diag, inst, rd);
             uint8_t enc = X64_REG_ENC[rd];
-            fprintf(stderr, "  LDS R%d, \"%s\" -> LEA %s, [RIP+disp32]\n",
-                    rd, str, X64_REG_NAME[rd]);
+            diag_trace(diag, "  LDS R%d, \"%s\" -> LEA %s, [RIP+disp32]\n",
+                       rd, str, X64_REG_NAME[rd]);
             /* LEA r64, [RIP+disp32] : REX.W 8D ModRM(reg, [RIP+disp32]) */
             emit_byte(code, 0x48);  /* REX.W */
             emit_byte(code, 0x8D);  /* LEA */
             emit_byte(code, (uint8_t)((enc << 3) | 0x05));  /* ModRM: RIP-rel */
             /* Find string index and compute address */
-            int str_idx = x64_strtab_add(&strtab, str);
+            int str_idx = x64_strtab_add(&strtab, str, diag);
             int str_addr = str_base + strtab.strings[str_idx].offset;
             int patch_off = code->size;
             emit_rel32_placeholder(code);
-            x64_add_fixup(&symtab, "__str__", patch_off, code->size,
-                          inst->line);
-            /* Direct patch — we know the address already */
+            /* Direct patch — we know the address already, no fixup */
             {
                 int32_t rel = (int32_t)(str_addr - code->size);
                 patch_rel32(code, patch_off, rel);
             }
-            /* Remove the fixup we just added (it's already resolved) */
-            symtab.fix_count--;
             break;
         }
 
@@ -1383,12 +1744,12 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
         case OP_LOADB: {
             int rd = inst->operands[0].data.reg;
             int rs = inst->operands[1].data.reg;
-            x64_validate_register(inst, rd);
-            x64_validate_register(inst, rs);
+            x64_validate_register(diag, inst, rd);
+            x64_validate_register(diag, inst, rs);
             uint8_t enc_d = X64_REG_ENC[rd];
             uint8_t enc_s = X64_REG_ENC[rs];
-            fprintf(stderr, "  LOADB R%d, R%d -> MOVZX %s, byte [%s]\n",
-                    rd, rs, X64_REG_NAME[rd], X64_REG_NAME[rs]);
+            diag_trace(diag, "  LOADB R%d, R%d -> MOVZX %s, byte [%s]\n",
+                       rd, rs, X64_REG_NAME[rd], X64_REG_NAME[rs]);
             /* REX.W 0F B6 ModRM */
             emit_byte(code, 0x48);
             emit_byte(code, 0x0F);
@@ -1411,12 +1772,12 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
         case OP_STOREB: {
             int rs = inst->operands[0].data.reg;  /* value register */
             int rd = inst->operands[1].data.reg;  /* address register */
-            x64_validate_register(inst, rs);
-            x64_validate_register(inst, rd);
+            x64_validate_register(diag, inst, rs);
+            x64_validate_register(diag, inst, rd);
             uint8_t enc_s = X64_REG_ENC[rs];
             uint8_t enc_d = X64_REG_ENC[rd];
-            fprintf(stderr, "  STOREB R%d, R%d -> MOV byte [%s], %s_low8\n",
-                    rs, rd, X64_REG_NAME[rd], X64_REG_NAME[rs]);
+            diag_trace(diag, "  STOREB R%d, R%d -> MOV byte [%s], %s_low8\n",
+                       rs, rd, X64_REG_NAME[rd], X64_REG_NAME[rs]);
             /* 88 ModRM (MOV r/m8, r8): reg=source, rm=address */
             emit_byte(code, 0x88);
             if (enc_d == 5) {
@@ -1435,17 +1796,14 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
 
         /* ---- SYS ------------------------------------------------ */
         case OP_SYS:
-            if (g_win32) {
+            if (win32) {
                 /* CALL rel32 → syscall_dispatcher */
                 int32_t rel = (int32_t)(stub_base - (code->size + 5));
-                fprintf(stderr, "  SYS -> CALL syscall_dispatcher\n");
+                diag_trace(diag, "  SYS -> CALL syscall_dispatcher\n");
                 emit_byte(code, 0xE8);
-                emit_byte(code, (uint8_t)( rel        & 0xFF));
-                emit_byte(code, (uint8_t)((rel >>  8) & 0xFF));
-                emit_byte(code, (uint8_t)((rel >> 16) & 0xFF));
-                emit_byte(code, (uint8_t)((rel >> 24) & 0xFF));
+                emit_le32(code, (uint32_t)rel);
             } else {
-                fprintf(stderr, "  SYS -> SYSCALL\n");
+                diag_trace(diag, "  SYS -> SYSCALL\n");
                 emit_byte(code, 0x0F);
                 emit_byte(code, 0x05);
             }
@@ -1453,14 +1811,14 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
 
         /* ---- CPUID ----------------------------------------- 2 bytes --- */
         case OP_CPUID:
-            fprintf(stderr, "  CPUID\n");
+            diag_trace(diag, "  CPUID\n");
             emit_byte(code, 0x0F);
             emit_byte(code, 0xA2);
             break;
 
         /* ---- RDTSC ----------------------------------------- 2 bytes --- */
         case OP_RDTSC:
-            fprintf(stderr, "  RDTSC\n");
+            diag_trace(diag, "  RDTSC\n");
             emit_byte(code, 0x0F);
             emit_byte(code, 0x31);
             break;
@@ -1469,7 +1827,7 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
         case OP_BSWAP: {
             int rd = inst->operands[0].data.reg;
             uint8_t enc = X64_REG_ENC[rd];
-            fprintf(stderr, "  BSWAP %s\n", X64_REG_NAME[rd]);
+            diag_trace(diag, "  BSWAP %s\n", X64_REG_NAME[rd]);
             /* REX.W prefix for 64-bit operand */
             emit_byte(code, 0x48);
             emit_byte(code, 0x0F);
@@ -1482,53 +1840,69 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
             snprintf(msg, sizeof(msg),
                      "opcode '%s' is not supported by the x86-64 backend",
                      opcode_name(inst->opcode));
-            x64_error(inst, msg);
+            x64_error(diag, inst, msg);
             break;
         }
         }
     }
+    free(forms);
+    forms = NULL;
+    if (ra) regalloc_free(ra);
 
     /* --- Pass 3: patch relocations ------------------------------------- */
-    for (int f = 0; f < symtab.fix_count; f++) {
-        X64Fixup *fix = &symtab.fixups[f];
-        int target = x64_symtab_lookup(&symtab, fix->label);
+    for (int f = 0; f < fixups.count; f++) {
+        X64Fixup *fix = fixvec_at(&fixups, X64Fixup, f);
+        int target = symtab_lookup(&symtab, fix->label);
         if (target < 0) {
-            fprintf(stderr, "x86-64: undefined label or variable '%s' "
-                    "(line %d)\n", fix->label, fix->line);
+            diag_printf(diag, "x86-64: %s, Line %d: undefined label or "
+                        "variable '%s'\n", fix->inst->file, fix->inst->line,
+                        fix->label);
+            symtab_free(&symtab);
+            fixvec_free(&fixups);
             free_code_buffer(code);
             return NULL;
         }
         int32_t rel = (int32_t)(target - fix->instr_end);
-        patch_rel32(code, fix->patch_offset, rel);
+        if (fix->rel8)
+            code->bytes[fix->patch_offset] = (uint8_t)(int8_t)rel;
+        else
+            patch_rel32(code, fix->patch_offset, rel);
     }
 
-    /* --- Append variable data section ---------------------------------- */
-    for (int v = 0; v < vartab.count; v++) {
-        int64_t val = vartab.vars[v].has_init ? vartab.vars[v].init_value : 0;
-        /* Emit 8 bytes (little-endian qword) */
-        for (int b = 0; b < X64_VAR_SIZE; b++) {
-            emit_byte(code, (uint8_t)((val >> (b * 8)) & 0xFF));
-        }
-    }
-
-    /* --- Append buffer data section (zero-initialised) ----------------- */
-    for (int b = 0; b < buftab.count; b++) {
-        for (int i = 0; i < buftab.bufs[b].size; i++) {
-            emit_byte(code, 0x00);
-        }
+    /* Export code labels and the code/data split (JIT, ELF segments) */
+    code->code_size = code->size;
+    for (int i = 0; i < ir_count; i++) {
+        if (!ir[i].is_label) continue;
+        const char *lname = strpool_get(strs, ir[i].label_id);
+        if (symtab_lookup(&code->labels, lname) < 0)
+            symtab_add(&code->labels, lname, symtab_lookup(&symtab, lname));
     }
+    symtab_free(&symtab);
+    fixvec_free(&fixups);
 
     /* --- Append string data section -------------------------------------- */
     for (int s = 0; s < strtab.count; s++) {
         const char *p = strtab.strings[s].text;
         int len = strtab.strings[s].length;
-        for (int b = 0; b < len; b++)
-            emit_byte(code, (uint8_t)p[b]);
+        emit_bytes(code, p, len);
         emit_byte(code, 0x00);  /* null terminator */
     }
 
+    code->str_size = code->size - code->code_size;
+    emit_fill(code, 0x00, str_end - code->size);
+    code->data_offset = code->size;
+    code->seg_gap     = seg_gap;
+
+    /* --- Append initialised variable data ------------------------------ */
+    for (int v = 0; v < vartab.count; v++) {
+        if (!vartab.vars[v].has_init) continue;
+        int64_t val = vartab.vars[v].init_value;
+        /* Emit 8 bytes (little-endian qword) */
+        emit_le64(code, (uint64_t)val);
+    }
+
     /* --- Append Win32 runtime (dispatcher stubs + IAT) ----------------- */
-    if (g_win32) {
+    if (win32) {
         /* RIP-relative offsets within each stub are constants derived from
          * the fixed layout of the entire runtime block.
          *
@@ -1593,8 +1967,7 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
             0x0F, 0x84, 0x25, 0x01, 0x00, 0x00,     /* je  close (disp=293)      */
             0xE9, 0x33, 0x01, 0x00, 0x00             /* jmp exit  (disp=307)      */
         };
-        for (int b = 0; b < 44; b++)
-            emit_byte(code, syscall_dispatcher[b]);
+        emit_bytes(code, syscall_dispatcher, (int)sizeof(syscall_dispatcher));
 
         /* ---- write_dispatcher (98 bytes, starts at runtime byte 44) ----
          * Translates Linux write ABI (RDI=fd, RSI=buf, RDX=count) to
@@ -1641,8 +2014,7 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
             /* 96 */ 0xC9,                               /* leave                 */
             /* 97 */ 0xC3                                /* ret                   */
         };
-        for (int b = 0; b < 98; b++)
-            emit_byte(code, write_dispatcher[b]);
+        emit_bytes(code, write_dispatcher, (int)sizeof(write_dispatcher));
 
         /* ---- read_dispatcher (97 bytes, starts at runtime byte 142) ----
          * Translates Linux read ABI (RDI=fd, RSI=buf, RDX=count) to
@@ -1689,8 +2061,7 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
             /* 95 */ 0xC9,                               /* leave                 */
             /* 96 */ 0xC3                                /* ret                   */
         };
-        for (int b = 0; b < 97; b++)
-            emit_byte(code, read_dispatcher[b]);
+        emit_bytes(code, read_dispatcher, (int)sizeof(read_dispatcher));
 
         /* ---- open_dispatcher (93 bytes, starts at runtime byte 239) ----
          * Translates: RDI=path (null-terminated), RSI=mode (0=read,1=write)
@@ -1729,8 +2100,7 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
             /* 91 */ 0xC9,                               /* leave                 */
             /* 92 */ 0xC3                                /* ret                   */
         };
-        for (int b = 0; b < 93; b++)
-            emit_byte(code, open_dispatcher[b]);
+        emit_bytes(code, open_dispatcher, (int)sizeof(open_dispatcher));
 
         /* ---- close_dispatcher (19 bytes, starts at runtime byte 332) ---
          * Translates: RDI=handle → CloseHandle(handle).
@@ -1747,8 +2117,7 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
             /* 17 */ 0xC9,                               /* leave                 */
             /* 18 */ 0xC3                                /* ret                   */
         };
-        for (int b = 0; b < 19; b++)
-            emit_byte(code, close_dispatcher[b]);
+        emit_bytes(code, close_dispatcher, (int)sizeof(close_dispatcher));
 
         /* exit_dispatcher (16 bytes, starts at runtime byte 351):
          *   Aligns stack, then calls ExitProcess(0) via IAT[3].
@@ -1759,39 +2128,76 @@ CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
             0x48, 0x83, 0xE4, 0xF0,                      /* and rsp, -16 (align)    */
             0xFF, 0x15, 0x38,0x00,0x00,0x00              /* call [rip+56] → IAT[3] ExitProcess */
         };
-        for (int b = 0; b < 16; b++)
-            emit_byte(code, exit_dispatcher[b]);
+        emit_bytes(code, exit_dispatcher, (int)sizeof(exit_dispatcher));
 
         /* stdout_handle  (8 bytes, init 0) */
-        for (int b = 0; b < 8; b++) emit_byte(code, 0x00);
+        emit_fill(code, 0x00, 8);
 
         /* stdin_handle   (8 bytes, init 0) */
-        for (int b = 0; b < 8; b++) emit_byte(code, 0x00);
+        emit_fill(code, 0x00, 8);
 
         /* written_var  (8 bytes, init 0) */
-        for (int b = 0; b < 8; b++) emit_byte(code, 0x00);
+        emit_fill(code, 0x00, 8);
 
         /* read_var  (8 bytes, init 0) */
-        for (int b = 0; b < 8; b++) emit_byte(code, 0x00);
+        emit_fill(code, 0x00, 8);
 
         /* IAT: 7 entries × 8 bytes (filled by PE emitter on disk,
          *       patched by Windows loader at runtime) */
         code->pe_iat_offset = code->size;
         code->pe_iat_count  = 7;   /* GetStdHandle, WriteFile, ReadFile,
                                       ExitProcess, CreateFileA, CloseHandle, null */
-        for (int b = 0; b < 56; b++) emit_byte(code, 0x00);
-
-        fprintf(stderr, "[x86-64] Emitted %d bytes (%d code + %d var + %d buf + %d str"
-                " + %d win32rt)\n",
-                code->size, var_base, vartab.count * X64_VAR_SIZE,
-                buftab.total_size, strtab.total_size,
-                W32_DISPATCH_SIZE + W32_WRITE_STUB_SIZE + W32_READ_STUB_SIZE
-                + W32_OPEN_STUB_SIZE + W32_CLOSE_STUB_SIZE
-                + W32_EXIT_STUB_SIZE + W32_DATA_SIZE + W32_IAT_SIZE);
+        emit_fill(code, 0x00, 56);
+    }
+
+    /* --- Zero-initialised storage (uninitialised VARs, BUFFERs) -------- */
+    int bss_end = buf_base + buftab.total_size;
+    code->bss_size = (bss_end > bss_base) ? bss_end - data_end : 0;
+
+    if (win32) {
+        diag_log(diag, DIAG_NORMAL, "[x86-64] Emitted %d bytes (%d code + %d str + %d var"
+                 " + %d win32rt) + %d bss\n",
+                 code->size, code_end, str_end - code_end,
+                 init_vars * X64_VAR_SIZE,
+                 W32_DISPATCH_SIZE + W32_WRITE_STUB_SIZE + W32_READ_STUB_SIZE
+                 + W32_OPEN_STUB_SIZE + W32_CLOSE_STUB_SIZE
+                 + W32_EXIT_STUB_SIZE + W32_DATA_SIZE + W32_IAT_SIZE,
+                 code->bss_size);
     } else {
-        fprintf(stderr, "[x86-64] Emitted %d bytes (%d code + %d var + %d buf + %d str)\n",
-                code->size, var_base, vartab.count * X64_VAR_SIZE,
-                buftab.total_size, strtab.total_size);
+        diag_log(diag, DIAG_NORMAL, "[x86-64] Emitted %d bytes (%d code + %d str + %d var)"
+                 " + %d bss\n",
+                 code->size, code_end, str_end - code_end,
+                 init_vars * X64_VAR_SIZE, code->bss_size);
     }
     return code;
 }
+
+/* =========================================================================
+ *  ELF target  (-sys linux)
+ *
+ *  Start stub, right before the user code:
+ *    E8 0C 00 00 00    call user_code      ; over the exit sequence
+ *    48 89 C7          mov  rdi, rax       ; exit code = R0
+ *    B8 3C 00 00 00    mov  eax, 60        ; __NR_exit
+ *    0F 05             syscall
+ *    EB FE             jmp  $              ; never reached
+ * ========================================================================= */
+static const uint8_t X64_ELF_START_STUB[17] = {
+    0xE8, 0x0C, 0x00, 0x00, 0x00,
+    0x48, 0x89, 0xC7,
+    0xB8, 0x3C, 0x00, 0x00, 0x00,
+    0x0F, 0x05,
+    0xEB, 0xFE
+};
+
+static const ElfTarget X64_ELF_TARGET = {
+    ELF_CLASS64, ELF_EM_X86_64, 0,      /* no e_flags on x86-64        */
+    0x00400000,                         /* the usual ld base address   */
+    16,                                 /* x86 code fetch alignment    */
+    X64_ELF_START_STUB, (int)sizeof(X64_ELF_START_STUB)
+};
+
+const ElfTarget* elf_target_x86_64(void)
+{
+    return &X64_ELF_TARGET;
+}
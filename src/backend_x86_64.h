@@ -27,6 +27,7 @@
 
 #include "parser.h"
 #include "codegen.h"    /* CodeBuffer, free_code_buffer, hexdump */
+#include "emitter_elf.h" /* ElfTarget */
 
 /* =========================================================================
  *  Public API
@@ -37,11 +38,29 @@
  *   Translates the architecture-neutral UA IR into raw x86-64 machine code.
  *   Returns a CodeBuffer that the caller must free with free_code_buffer().
  *
+ *   `strs` is the string pool filled by parse() for this IR.
  *   `sys` is the target system (e.g. "win32", "linux", or NULL for raw).
  *   When sys="win32", the backend emits Windows API calls instead of
  *   SYSCALL and appends a PE runtime (dispatchers + IAT) to the output.
+ *   `var_regs` selects which spare registers may hold VARs (-O2).
+ *   `seg_gap` is the run-time distance put between code, strings and
+ *   data (see CodeBuffer.seg_gap; 0 = packed).
+ *   Messages go to `diag`; errors end in diag_fatal().
  */
+#define X64_VARS_MEMORY   0   /* every VAR stays in memory                 */
+#define X64_VARS_SCRATCH  1   /* R8-R10 only: code may be called from C    */
+#define X64_VARS_PROCESS  2   /* also R12-R15: code owns the process       */
+
 CodeBuffer* generate_x86_64(const Instruction *ir, int ir_count,
-                             const char *sys);
+                             const StrPool *strs, const char *sys,
+                             int var_regs, int seg_gap, UaDiag *diag);
+
+/*
+ * elf_target_x86_64()
+ *   ELF description of this backend for -sys linux: ELF64, EM_X86_64,
+ *   loaded at 0x00400000.  The start stub calls the code and passes RAX
+ *   to exit(2).
+ */
+const ElfTarget* elf_target_x86_64(void);
 
 #endif /* UA_BACKEND_X86_64_H */
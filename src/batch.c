@@ -0,0 +1,468 @@
+/*
+ * =============================================================================
+ *  UA - Unified Assembler
+ *  Parallel Batch Driver
+ *
+ *  File:    batch.c
+ *  Purpose: Worker pool, per-job compile/write, in-order log and timing.
+ *           See batch.h for the overview.
+ *
+ *  License: MIT
+ * =============================================================================
+ */
+
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE         /* clock_gettime() with -std=c99 on glibc */
+#endif
+
+#include "batch.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "diag.h"
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <pthread.h>
+    #include <time.h>
+    #include <unistd.h>
+#endif
+
+#define BATCH_MAX_THREADS  256
+
+/* =========================================================================
+ *  Platform layer  —  threads, one lock + condition, clocks
+ * ========================================================================= */
+#ifdef _WIN32
+typedef HANDLE             BatchThread;
+typedef CRITICAL_SECTION   BatchLock;
+typedef CONDITION_VARIABLE BatchCond;
+
+static void bt_init(BatchLock *l, BatchCond *c)
+{
+    InitializeCriticalSection(l);
+    InitializeConditionVariable(c);
+}
+static void bt_destroy(BatchLock *l, BatchCond *c)
+{
+    (void)c;
+    DeleteCriticalSection(l);
+}
+static void bt_lock(BatchLock *l)                 { EnterCriticalSection(l); }
+static void bt_unlock(BatchLock *l)               { LeaveCriticalSection(l); }
+static void bt_wait(BatchCond *c, BatchLock *l)   { SleepConditionVariableCS(c, l, INFINITE); }
+static void bt_broadcast(BatchCond *c)            { WakeAllConditionVariable(c); }
+
+static void batch_worker(void *arg);
+static DWORD WINAPI bt_trampoline(LPVOID arg)
+{
+    batch_worker(arg);
+    return 0;
+}
+static int bt_spawn(BatchThread *t, void *arg)
+{
+    *t = CreateThread(NULL, 0, bt_trampoline, arg, 0, NULL);
+    return *t != NULL ? 0 : -1;
+}
+static void bt_join(BatchThread t)
+{
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+}
+
+static double bt_wall_now(void)
+{
+    LARGE_INTEGER f, c;
+    QueryPerformanceFrequency(&f);
+    QueryPerformanceCounter(&c);
+    return (double)c.QuadPart / (double)f.QuadPart;
+}
+static double bt_thread_cpu_now(void)
+{
+    FILETIME create, exit_t, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &create, &exit_t, &kernel, &user))
+        return 0.0;
+    ULARGE_INTEGER k, u;
+    k.LowPart = kernel.dwLowDateTime;  k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime;    u.HighPart = user.dwHighDateTime;
+    return (double)(k.QuadPart + u.QuadPart) * 1e-7;    /* 100 ns units */
+}
+
+int batch_cpu_count(void)
+{
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors > 0 ? (int)si.dwNumberOfProcessors : 1;
+}
+#else
+typedef pthread_t       BatchThread;
+typedef pthread_mutex_t BatchLock;
+typedef pthread_cond_t  BatchCond;
+
+static void bt_init(BatchLock *l, BatchCond *c)
+{
+    pthread_mutex_init(l, NULL);
+    pthread_cond_init(c, NULL);
+}
+static void bt_destroy(BatchLock *l, BatchCond *c)
+{
+    pthread_cond_destroy(c);
+    pthread_mutex_destroy(l);
+}
+static void bt_lock(BatchLock *l)                 { pthread_mutex_lock(l); }
+static void bt_unlock(BatchLock *l)               { pthread_mutex_unlock(l); }
+static void bt_wait(BatchCond *c, BatchLock *l)   { pthread_cond_wait(c, l); }
+static void bt_broadcast(BatchCond *c)            { pthread_cond_broadcast(c); }
+
+static void batch_worker(void *arg);
+static void* bt_trampoline(void *arg)
+{
+    batch_worker(arg);
+    return NULL;
+}
+static int bt_spawn(BatchThread *t, void *arg)
+{
+    return pthread_create(t, NULL, bt_trampoline, arg) == 0 ? 0 : -1;
+}
+static void bt_join(BatchThread t)
+{
+    pthread_join(t, NULL);
+}
+
+static double bt_wall_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+static double bt_thread_cpu_now(void)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+        return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+    return 0.0;
+}
+
+int batch_cpu_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+#endif
+
+/* =========================================================================
+ *  Shared run state
+ * ========================================================================= */
+typedef struct {
+    BatchJob         *jobs;
+    int               count;
+    const ua_options *base;
+    const char       *out_dir;
+
+    BatchLock         lock;
+    BatchCond         cond;         /* signalled when a job finishes       */
+    int               next;         /* first job not yet taken             */
+    char            **log_text;     /* per-job diagnostics, NULL until done */
+    unsigned char    *done;
+} BatchRun;
+
+/* -------------------------------------------------------------------------
+ *  batch_read_file()  —  whole file into a NUL-terminated heap string
+ * --------------------------------------------------------------------- */
+static char* batch_read_file(const char *path, UaDiag *diag)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        diag_printf(diag, "Error: cannot open '%s'.\n", path);
+        return NULL;
+    }
+    long length = -1;
+    if (fseek(fp, 0, SEEK_END) == 0) length = ftell(fp);
+    if (length < 0 || fseek(fp, 0, SEEK_SET) != 0) {
+        diag_printf(diag, "Error: cannot determine the size of '%s'.\n", path);
+        fclose(fp);
+        return NULL;
+    }
+    char *buf = (char *)malloc((size_t)length + 1);
+    if (!buf) {
+        diag_printf(diag, "Error: out of memory reading '%s'.\n", path);
+        fclose(fp);
+        return NULL;
+    }
+    size_t got = fread(buf, 1, (size_t)length, fp);
+    fclose(fp);
+    if ((long)got != length) {
+        diag_printf(diag, "Error: short read on '%s' (got %zu of %ld bytes).\n",
+                    path, got, length);
+        free(buf);
+        return NULL;
+    }
+    buf[length] = '\0';
+    return buf;
+}
+
+/* -------------------------------------------------------------------------
+ *  batch_write_file()  —  returns 0 on success
+ * --------------------------------------------------------------------- */
+static int batch_write_file(const char *path, const uint8_t *data, int size,
+                            UaDiag *diag)
+{
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        diag_printf(diag, "Error: cannot open '%s' for writing.\n", path);
+        return -1;
+    }
+    size_t written = fwrite(data, 1, (size_t)size, fp);
+    if (fclose(fp) != 0 || (int)written != size) {
+        diag_printf(diag, "Error: short write to '%s' (%zu of %d bytes).\n",
+                    path, written, size);
+        return -1;
+    }
+    return 0;
+}
+
+/* -------------------------------------------------------------------------
+ *  batch_input_dir()  —  directory part of `path` (with separator) or "."
+ * --------------------------------------------------------------------- */
+static void batch_input_dir(const char *path, char *dir, size_t dir_size)
+{
+    const char *last_sep = NULL;
+    for (const char *p = path; *p; p++) {
+        if (*p == '/' || *p == '\\') last_sep = p;
+    }
+    size_t len = last_sep ? (size_t)(last_sep - path + 1) : 0;
+    if (len == 0) {
+        snprintf(dir, dir_size, ".");
+        return;
+    }
+    if (len >= dir_size) len = dir_size - 1;
+    memcpy(dir, path, len);
+    dir[len] = '\0';
+}
+
+/* -------------------------------------------------------------------------
+ *  batch_output_name()  —  <out_dir>/<stem>.<arch><ext>  (heap string)
+ * --------------------------------------------------------------------- */
+static char* batch_output_name(const char *out_dir, const char *input,
+                               const char *arch, ua_format format)
+{
+    const char *stem = input;
+    for (const char *p = input; *p; p++) {
+        if (*p == '/' || *p == '\\') stem = p + 1;
+    }
+    const char *dot = strrchr(stem, '.');
+    int stem_len = dot && dot != stem ? (int)(dot - stem) : (int)strlen(stem);
+
+    const char *ext = ".bin";
+    switch (format) {
+    case UA_FORMAT_PE:    ext = ".exe";   break;
+    case UA_FORMAT_ELF:   ext = ".elf";   break;
+    case UA_FORMAT_MACHO: ext = ".macho"; break;
+    case UA_FORMAT_RAW:                   break;
+    }
+
+    const char *sep = "";
+    size_t dlen = strlen(out_dir);
+    if (dlen > 0 && out_dir[dlen - 1] != '/' && out_dir[dlen - 1] != '\\')
+        sep = "/";
+
+    size_t size = dlen + strlen(sep) + (size_t)stem_len + strlen(arch)
+                + strlen(ext) + 2;
+    char *name = (char *)malloc(size);
+    if (name)
+        snprintf(name, size, "%s%s%.*s.%s%s",
+                 out_dir, sep, stem_len, stem, arch, ext);
+    return name;
+}
+
+/* -------------------------------------------------------------------------
+ *  batch_compile_one()  —  read, compile, write; returns the job's log
+ * --------------------------------------------------------------------- */
+static char* batch_compile_one(const BatchRun *run, BatchJob *job)
+{
+    UaDiag diag;
+    diag_init(&diag, NULL);
+    diag.level = run->base->verbosity;
+
+    double wall0 = bt_wall_now();
+    double cpu0  = bt_thread_cpu_now();
+
+    job->rc = -1;
+    char *src = batch_read_file(job->input, &diag);
+    if (src) {
+        char base_dir[1024];
+        batch_input_dir(job->input, base_dir, sizeof(base_dir));
+
+        ua_options opt  = *run->base;
+        opt.arch        = job->arch;
+        opt.filename    = job->input;
+        opt.base_dir    = base_dir;
+        opt.diag_stream = NULL;
+
+        ua_result res;
+        int rc = ua_compile(&opt, src, &res);
+        if (res.diagnostics)
+            diag_printf(&diag, "%s", res.diagnostics);
+        if (rc == 0) {
+            job->output = batch_output_name(run->out_dir, job->input,
+                                            job->arch, res.format);
+            if (!job->output) {
+                diag_printf(&diag, "Error: out of memory.\n");
+            } else if (batch_write_file(job->output, res.image,
+                                        res.image_size, &diag) == 0) {
+                diag_log(&diag, DIAG_NORMAL, "Wrote %d bytes to %s\n",
+                         res.image_size, job->output);
+                job->rc = 0;
+            }
+        }
+        ua_result_free(&res);
+        free(src);
+    }
+
+    job->cpu_seconds  = bt_thread_cpu_now() - cpu0;
+    job->wall_seconds = bt_wall_now() - wall0;
+
+    char *text = diag_take(&diag);
+    diag_free(&diag);
+    return text;
+}
+
+/* -------------------------------------------------------------------------
+ *  batch_worker()  —  take jobs until the queue is empty
+ * --------------------------------------------------------------------- */
+static void batch_worker(void *arg)
+{
+    BatchRun *run = (BatchRun *)arg;
+    for (;;) {
+        bt_lock(&run->lock);
+        int i = run->next < run->count ? run->next++ : -1;
+        bt_unlock(&run->lock);
+        if (i < 0) return;
+
+        char *text = batch_compile_one(run, &run->jobs[i]);
+
+        bt_lock(&run->lock);
+        run->log_text[i] = text;
+        run->done[i]     = 1;
+        bt_broadcast(&run->cond);
+        bt_unlock(&run->lock);
+    }
+}
+
+/* -------------------------------------------------------------------------
+ *  batch_print_job()  —  header, captured diagnostics, status
+ *
+ *  With -q a job that succeeded without a message prints nothing.
+ * --------------------------------------------------------------------- */
+static void batch_print_job(FILE *log, const BatchJob *job, int index,
+                            int count, const char *text, int quiet)
+{
+    if (quiet && job->rc == 0 && !text) return;
+    fprintf(log, "=== [%d/%d] %s  -arch %s ===\n",
+            index + 1, count, job->input, job->arch);
+    if (text) fputs(text, log);
+    fprintf(log, "--- %s  (%.1f ms)\n\n",
+            job->rc == 0 ? "ok" : "FAILED", job->wall_seconds * 1e3);
+    fflush(log);
+}
+
+/* =========================================================================
+ *  batch_run()
+ * ========================================================================= */
+int batch_run(BatchJob *jobs, int count, int threads, const ua_options *base,
+              const char *out_dir, FILE *log, BatchStats *stats)
+{
+    BatchRun run;
+    memset(&run, 0, sizeof(run));
+    run.jobs     = jobs;
+    run.count    = count;
+    run.base     = base;
+    run.out_dir  = out_dir ? out_dir : ".";
+    run.log_text = (char **)calloc((size_t)(count > 0 ? count : 1),
+                                   sizeof(char *));
+    run.done     = (unsigned char *)calloc((size_t)(count > 0 ? count : 1), 1);
+
+    memset(stats, 0, sizeof(*stats));
+    stats->jobs = count;
+    if (!run.log_text || !run.done) {
+        fprintf(log, "Error: out of memory.\n");
+        free(run.log_text);
+        free(run.done);
+        stats->failed = count;
+        return count;
+    }
+
+    for (int i = 0; i < count; i++) {
+        jobs[i].output = NULL;
+        jobs[i].rc     = -1;
+    }
+
+    if (threads > count) threads = count;
+    if (threads > BATCH_MAX_THREADS) threads = BATCH_MAX_THREADS;
+    if (threads < 1) threads = 1;
+
+    bt_init(&run.lock, &run.cond);
+    double wall0 = bt_wall_now();
+
+    BatchThread pool[BATCH_MAX_THREADS];
+    int started = 0;
+    while (started < threads && bt_spawn(&pool[started], &run) == 0)
+        started++;
+    if (started == 0) {
+        /* No thread could be created: compile on the calling thread */
+        batch_worker(&run);
+    }
+    stats->threads = started > 0 ? started : 1;
+
+    /* ---- Print in job order as results arrive ------------------------- */
+    for (int i = 0; i < count; i++) {
+        bt_lock(&run.lock);
+        while (!run.done[i]) bt_wait(&run.cond, &run.lock);
+        char *text = run.log_text[i];
+        run.log_text[i] = NULL;
+        bt_unlock(&run.lock);
+
+        batch_print_job(log, &jobs[i], i, count, text,
+                        base->verbosity < DIAG_NORMAL);
+        free(text);
+
+        stats->cpu_seconds += jobs[i].cpu_seconds;
+        if (jobs[i].rc != 0) stats->failed++;
+    }
+
+    for (int t = 0; t < started; t++) bt_join(pool[t]);
+    stats->wall_seconds = bt_wall_now() - wall0;
+
+    bt_destroy(&run.lock, &run.cond);
+    free(run.log_text);
+    free(run.done);
+    return stats->failed;
+}
+
+/* =========================================================================
+ *  batch_free()
+ * ========================================================================= */
+void batch_free(BatchJob *jobs, int count)
+{
+    for (int i = 0; i < count; i++) {
+        free(jobs[i].output);
+        jobs[i].output = NULL;
+    }
+}
+
+/* =========================================================================
+ *  batch_print_stats()
+ * ========================================================================= */
+void batch_print_stats(const BatchStats *stats, FILE *log)
+{
+    double speedup = stats->wall_seconds > 0.0
+                   ? stats->cpu_seconds / stats->wall_seconds : 0.0;
+    fprintf(log, "[Batch] %d jobs, %d failed, %d threads: "
+                 "wall %.3f s, CPU %.3f s (%.2fx)\n",
+            stats->jobs, stats->failed, stats->threads,
+            stats->wall_seconds, stats->cpu_seconds, speedup);
+}
@@ -0,0 +1,86 @@
+/*
+ * =============================================================================
+ *  UA - Unified Assembler
+ *  Parallel Batch Driver
+ *
+ *  File:    batch.h
+ *  Purpose: Compile many (input, arch) pairs at once on a pool of worker
+ *           threads.  Each job runs its own ua_compile() pipeline —
+ *           precompiler through emitter — and writes its output file.
+ *
+ *  Jobs share nothing but a queue index: a worker takes the next job,
+ *  compiles it with diagnostics captured in memory, writes the output
+ *  and marks the job done.  The calling thread prints each job's
+ *  diagnostics as soon as it and every job before it have finished, so
+ *  the log reads in job order however the work was scheduled.
+ *
+ *  Threads: POSIX threads, or the Win32 API on Windows (link with
+ *  -pthread where the C library needs it).
+ *
+ *  License: MIT
+ * =============================================================================
+ */
+
+#ifndef UA_BATCH_H
+#define UA_BATCH_H
+
+#include <stdio.h>
+
+#include "ua.h"
+
+/* =========================================================================
+ *  One compilation
+ * ========================================================================= */
+typedef struct {
+    const char *input;          /* .ua source path                         */
+    const char *arch;           /* target architecture for this job        */
+
+    /* ---- filled in by batch_run() ------------------------------------ */
+    char       *output;         /* file written (NULL if none)             */
+    int         rc;             /* 0 = compiled and written, -1 = failed   */
+    double      wall_seconds;   /* elapsed time of the job                 */
+    double      cpu_seconds;    /* CPU time of the worker spent on the job */
+} BatchJob;
+
+/* =========================================================================
+ *  Whole-run summary
+ * ========================================================================= */
+typedef struct {
+    int    jobs;
+    int    failed;
+    int    threads;             /* workers actually started                */
+    double wall_seconds;        /* first job start to last job end         */
+    double cpu_seconds;         /* sum of the jobs' CPU time               */
+} BatchStats;
+
+/*
+ * batch_run()
+ *   Compiles `jobs[0..count)` on `threads` workers.  `base` supplies the
+ *   options every job shares (sys, opt_level, lib_dir, verbosity); arch,
+ *   filename and base_dir are set per job.  Output files are named
+ *   <out_dir>/<input stem>.<arch><ext>, where <ext> is .exe, .elf,
+ *   .macho or .bin by container.  Diagnostics go to `log` in job order.
+ *   Returns the number of failed jobs.
+ */
+int batch_run(BatchJob *jobs, int count, int threads, const ua_options *base,
+              const char *out_dir, FILE *log, BatchStats *stats);
+
+/*
+ * batch_free()
+ *   Releases the output names batch_run() stored in `jobs`.
+ */
+void batch_free(BatchJob *jobs, int count);
+
+/*
+ * batch_cpu_count()
+ *   Number of online processors (at least 1) — the default worker count.
+ */
+int batch_cpu_count(void);
+
+/*
+ * batch_print_stats()
+ *   One-line wall-clock / CPU summary of a run.
+ */
+void batch_print_stats(const BatchStats *stats, FILE *log);
+
+#endif /* UA_BATCH_H */
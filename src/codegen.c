@@ -4,7 +4,8 @@
  *  Shared Code-Generation Utilities
  *
  *  File:    codegen.c
- *  Purpose: Implementations for CodeBuffer management and hexdump.
+ *  Purpose: Implementations for CodeBuffer management, the shared
+ *           symbol table / fixup vector, and hexdump.
  *
  *  License: MIT
  * =============================================================================
@@ -14,25 +15,48 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 /* =========================================================================
  *  Constants
  * ========================================================================= */
 #define INITIAL_CODE_CAPACITY  256
+#define INITIAL_SYMBOLS        64
+#define INITIAL_FIXUPS         32
+
+/* =========================================================================
+ *  Allocation helpers  —  the code generators have no recovery path for
+ *  running out of memory, so raise it on the phase's sink in one place.
+ * ========================================================================= */
+static void *cg_xrealloc(UaDiag *diag, void *ptr, size_t size)
+{
+    void *tmp = realloc(ptr, size);
+    if (!tmp) {
+        diag_printf(diag, "UA codegen: out of memory\n");
+        diag_fatal(diag);
+    }
+    return tmp;
+}
 
 /* =========================================================================
  *  create_code_buffer()
+ *
+ *  The buffer is registered while its tables are set up, so running out
+ *  of memory half-way releases it.
  * ========================================================================= */
-CodeBuffer* create_code_buffer(void)
+CodeBuffer* create_code_buffer(UaDiag *diag)
 {
-    CodeBuffer *buf = (CodeBuffer *)malloc(sizeof(CodeBuffer));
+    CodeBuffer *buf = (CodeBuffer *)calloc(1, sizeof(CodeBuffer));
     if (!buf) return NULL;
-    buf->bytes    = (uint8_t *)malloc(INITIAL_CODE_CAPACITY);
-    buf->size     = 0;
+    buf->diag = diag;
+
+    int mark = diag_owned(diag);
+    diag_own(diag, &buf, codebuf_drop);
+    buf->bytes    = (uint8_t *)cg_xrealloc(diag, NULL, INITIAL_CODE_CAPACITY);
     buf->capacity = INITIAL_CODE_CAPACITY;
-    buf->pe_iat_offset = 0;
-    buf->pe_iat_count  = 0;
-    if (!buf->bytes) { free(buf); return NULL; }
+    symtab_init(&buf->labels, diag);
+    symtab_init(&buf->functions, diag);
+    diag_release(diag, mark);
     return buf;
 }
 
@@ -42,54 +66,242 @@ CodeBuffer* create_code_buffer(void)
 void free_code_buffer(CodeBuffer *buf)
 {
     if (!buf) return;
+    symtab_free(&buf->labels);
+    symtab_free(&buf->functions);
+    free(buf->lines);
     free(buf->bytes);
     free(buf);
 }
 
+void codebuf_set_diag(CodeBuffer *buf, UaDiag *diag)
+{
+    buf->diag                 = diag;
+    buf->labels.names.diag    = diag;
+    buf->functions.names.diag = diag;
+}
+
+void codebuf_drop(void *pbuf)
+{
+    CodeBuffer **p = (CodeBuffer **)pbuf;
+    free_code_buffer(*p);
+    *p = NULL;
+}
+
 /* =========================================================================
- *  emit_byte()
+ *  codebuf_reserve()
+ *
+ *  Grows to at least twice the old capacity, so a run of emit_byte()
+ *  calls without a reserve still reallocates only O(log n) times.
  * ========================================================================= */
-void emit_byte(CodeBuffer *buf, uint8_t byte)
-{
-    if (buf->size >= buf->capacity) {
-        int new_cap = buf->capacity * 2;
-        uint8_t *tmp = (uint8_t *)realloc(buf->bytes, (size_t)new_cap);
-        if (!tmp) {
-            fprintf(stderr, "UA codegen: out of memory\n");
-            exit(1);
-        }
-        buf->bytes    = tmp;
-        buf->capacity = new_cap;
+void codebuf_reserve(CodeBuffer *buf, int count)
+{
+    if (count <= buf->capacity - buf->size) return;
+    int need    = buf->size + count;
+    int new_cap = buf->capacity * 2;
+    if (need < 0) new_cap = -1;                    /* int overflow */
+    else if (new_cap < need) new_cap = need;
+    uint8_t *tmp = new_cap > 0
+                 ? (uint8_t *)realloc(buf->bytes, (size_t)new_cap) : NULL;
+    if (!tmp) {
+        diag_printf(buf->diag, "UA codegen: out of memory\n");
+        diag_fatal(buf->diag);
+    }
+    buf->bytes    = tmp;
+    buf->capacity = new_cap;
+}
+
+/* =========================================================================
+ *  codebuf_add_line()
+ * ========================================================================= */
+void codebuf_add_line(CodeBuffer *buf, const char *file, int line)
+{
+    if (!file) return;
+    if (file != buf->line_src) {
+        buf->line_name = symtab_intern(&buf->labels, file);
+        buf->line_src  = file;
+    }
+
+    int n = buf->line_count;
+    if (n > 0 && buf->lines[n - 1].offset == buf->size)
+        n--;                                /* produced no bytes: replace */
+    if (n > 0 && buf->lines[n - 1].file == buf->line_name &&
+        buf->lines[n - 1].line == line) {
+        buf->line_count = n;                /* same line continues */
+        return;
+    }
+
+    if (n == buf->line_cap) {
+        buf->line_cap = buf->line_cap ? buf->line_cap * 2 : 256;
+        buf->lines = (CodeLine *)cg_xrealloc(buf->diag, buf->lines,
+                                             (size_t)buf->line_cap *
+                                             sizeof(CodeLine));
+    }
+    buf->lines[n].offset = buf->size;
+    buf->lines[n].file   = buf->line_name;
+    buf->lines[n].line   = line;
+    buf->line_count      = n + 1;
+}
+
+/* =========================================================================
+ *  emit_bytes() / emit_fill()
+ * ========================================================================= */
+void emit_bytes(CodeBuffer *buf, const void *data, int count)
+{
+    if (count <= 0) return;
+    codebuf_reserve(buf, count);
+    memcpy(buf->bytes + buf->size, data, (size_t)count);
+    buf->size += count;
+}
+
+void emit_fill(CodeBuffer *buf, uint8_t byte, int count)
+{
+    if (count <= 0) return;
+    codebuf_reserve(buf, count);
+    memset(buf->bytes + buf->size, byte, (size_t)count);
+    buf->size += count;
+}
+
+/* =========================================================================
+ *  Symbol table
+ * ========================================================================= */
+void symtab_init(SymbolTable *st, UaDiag *diag)
+{
+    st->count     = 0;
+    st->capacity  = 0;
+    st->entries   = NULL;
+    st->first_cap = 0;
+    st->first     = NULL;
+    strpool_init(&st->names, diag);
+    st->entries   = (Symbol *)malloc(INITIAL_SYMBOLS * sizeof(Symbol));
+    if (!st->entries) {
+        symtab_free(st);
+        diag_printf(diag, "UA codegen: out of memory\n");
+        diag_fatal(diag);
+    }
+    st->capacity  = INITIAL_SYMBOLS;
+}
+
+void symtab_free(SymbolTable *st)
+{
+    free(st->entries);
+    free(st->first);
+    st->entries   = NULL;
+    st->first     = NULL;
+    st->count     = 0;
+    st->capacity  = 0;
+    st->first_cap = 0;
+    strpool_free(&st->names);
+}
+
+void symtab_drop(void *st)
+{
+    symtab_free((SymbolTable *)st);
+}
+
+void symtab_add(SymbolTable *st, const char *name, int address)
+{
+    if (st->count >= st->capacity) {
+        st->entries = (Symbol *)cg_xrealloc(st->names.diag, st->entries,
+                                            (size_t)st->capacity * 2 *
+                                            sizeof(Symbol));
+        st->capacity *= 2;
+    }
+    StrId id = strpool_intern(&st->names, name);
+    int idx = st->count++;
+    st->entries[idx].name    = strpool_get(&st->names, id);
+    st->entries[idx].address = address;
+
+    /* first[] covers every ID the pool has handed out so far */
+    if (st->names.count > st->first_cap) {
+        int new_cap = st->first_cap ? st->first_cap : INITIAL_SYMBOLS;
+        while (new_cap < st->names.count) new_cap *= 2;
+        st->first = (int *)cg_xrealloc(st->names.diag, st->first,
+                                       (size_t)new_cap * sizeof(int));
+        for (int i = st->first_cap; i < new_cap; i++) st->first[i] = -1;
+        st->first_cap = new_cap;
+    }
+    if (st->first[id] < 0) st->first[id] = idx;
+}
+
+int symtab_lookup(const SymbolTable *st, const char *name)
+{
+    StrId id = strpool_find(&st->names, name);
+    if (id == STR_NONE || (int)id >= st->first_cap || st->first[id] < 0)
+        return -1;
+    return st->entries[st->first[id]].address;
+}
+
+const char* symtab_intern(SymbolTable *st, const char *name)
+{
+    return strpool_get(&st->names, strpool_intern(&st->names, name));
+}
+
+/* =========================================================================
+ *  Fixup vector
+ * ========================================================================= */
+void fixvec_init(FixupVec *vec, size_t item_size, UaDiag *diag)
+{
+    vec->item_size = item_size;
+    vec->diag      = diag;
+    vec->count     = 0;
+    vec->capacity  = 0;
+    vec->items     = NULL;
+    vec->items     = cg_xrealloc(diag, NULL, INITIAL_FIXUPS * item_size);
+    vec->capacity  = INITIAL_FIXUPS;
+}
+
+void fixvec_free(FixupVec *vec)
+{
+    free(vec->items);
+    vec->items    = NULL;
+    vec->count    = 0;
+    vec->capacity = 0;
+}
+
+void fixvec_drop(void *vec)
+{
+    fixvec_free((FixupVec *)vec);
+}
+
+void* fixvec_push(FixupVec *vec)
+{
+    if (vec->count >= vec->capacity) {
+        vec->items = cg_xrealloc(vec->diag, vec->items,
+                                 (size_t)vec->capacity * 2 * vec->item_size);
+        vec->capacity *= 2;
     }
-    buf->bytes[buf->size++] = byte;
+    void *slot = (char *)vec->items + (size_t)vec->count * vec->item_size;
+    memset(slot, 0, vec->item_size);
+    vec->count++;
+    return slot;
 }
 
 /* =========================================================================
  *  hexdump()  —  canonical hex dump of a byte buffer
  * ========================================================================= */
-void hexdump(const uint8_t *data, int size)
+void hexdump(FILE *out, const uint8_t *data, int size)
 {
     for (int i = 0; i < size; i += 16) {
         /* Address */
-        printf("  %04X: ", i);
+        fprintf(out, "  %04X: ", i);
 
         /* Hex bytes */
         for (int j = 0; j < 16; j++) {
             if (i + j < size)
-                printf("%02X ", data[i + j]);
+                fprintf(out, "%02X ", data[i + j]);
             else
-                printf("   ");
-            if (j == 7) printf(" ");   /* midpoint separator */
+                fprintf(out, "   ");
+            if (j == 7) fprintf(out, " ");   /* midpoint separator */
         }
 
         /* ASCII representation */
-        printf(" |");
+        fprintf(out, " |");
         for (int j = 0; j < 16; j++) {
             if (i + j < size) {
                 uint8_t c = data[i + j];
-                printf("%c", (c >= 0x20 && c <= 0x7E) ? c : '.');
+                fputc((c >= 0x20 && c <= 0x7E) ? c : '.', out);
             }
         }
-        printf("|\n");
+        fprintf(out, "|\n");
     }
 }
@@ -6,7 +6,10 @@
  *  File:    codegen.h
  *  Purpose: Common types and helpers used by every back-end:
  *             - CodeBuffer  (dynamic byte buffer for machine code)
- *             - hexdump()   (canonical hex dump to stdout)
+ *             - SymbolTable (interned-name table for labels)
+ *             - FixupVec    (growable vector of pending relocations)
+ *             - CodeLine    (source line of each run of code bytes)
+ *             - hexdump()   (canonical hex dump to a stream)
  *
  *  License: MIT
  * =============================================================================
@@ -15,22 +18,113 @@
 #ifndef UA_CODEGEN_H
 #define UA_CODEGEN_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+
+#include "strpool.h"    /* StrPool, StrId */
+#include "diag.h"       /* UaDiag */
+
+/* =========================================================================
+ *  Symbol Table
+ * =========================================================================
+ *  Maps label / variable names to addresses.  Names are interned in the
+ *  table's StrPool, and the resulting ID indexes `first[]` directly, so
+ *  a lookup is one hash probe instead of a linear strcmp() scan.  The
+ *  table grows on demand; there is no upper bound on the number of labels.
+ *
+ *  entries[] keeps insertion order (for listings).  If a name is added
+ *  twice, lookup keeps returning the first address, exactly like the
+ *  old linear scan did.
+ * ========================================================================= */
+typedef struct {
+    const char *name;       /* Interned name (owned by the table's pool) */
+    int         address;    /* Byte offset / address of the symbol       */
+} Symbol;
+
+typedef struct {
+    Symbol   *entries;      /* Symbols in insertion order                */
+    int       count;
+    int       capacity;
+    int      *first;        /* StrId -> index of first entry (-1 = none) */
+    int       first_cap;    /* Allocated length of first[]               */
+    StrPool   names;        /* Interned symbol and fixup label names     */
+} SymbolTable;
+
+/* =========================================================================
+ *  Fixup Vector
+ * =========================================================================
+ *  Growable array of backend-specific fixup records.  Each back-end keeps
+ *  its own fixup struct (patch kind, condition code, ...); the vector
+ *  only knows the element size.
+ * ========================================================================= */
+typedef struct {
+    void   *items;          /* Array of `item_size`-byte records         */
+    int     count;
+    int     capacity;
+    size_t  item_size;
+    UaDiag *diag;           /* where running out of memory is raised     */
+} FixupVec;
+
+/* =========================================================================
+ *  Source Lines
+ * =========================================================================
+ *  The bytes from `offset` up to the next entry's were generated for line
+ *  `line` of `file`.  Back-ends add one per IR instruction in pass 2 with
+ *  codebuf_add_line(); the ELF emitter turns them into a DWARF line table.
+ * ========================================================================= */
+typedef struct {
+    int         offset;     /* First byte in bytes[]                     */
+    const char *file;       /* Source file (interned in labels.names)    */
+    int         line;       /* 1-based line in that file                 */
+} CodeLine;
 
 /* =========================================================================
  *  Code Buffer
  * =========================================================================
  *  All back-ends emit raw bytes into a CodeBuffer.
  *  The caller must free it with free_code_buffer().
+ *  Instructions come first; strings follow at `code_size` and the
+ *  initialised VARs at `data_offset` when the back-end records them.
+ *  Uninitialised VARs and BUFFERs are not stored: they occupy the
+ *  `bss_size` zero bytes that follow bytes[size] at run time, which
+ *  emitters map as BSS.
+ *
+ *  The parts are stored back to back, but at run time the strings sit
+ *  `seg_gap` bytes further from the code than their offset in bytes[],
+ *  and the data and bss 2 * `seg_gap` bytes further.  A non-zero gap (a
+ *  multiple of the page size) lets the ELF emitter map code, strings and
+ *  data as separate segments without padding the file.
  * ========================================================================= */
 typedef struct {
     uint8_t *bytes;         /* Raw machine code bytes                    */
     int      size;          /* Number of valid bytes in `bytes`           */
     int      capacity;      /* Allocated capacity                        */
+    int      bss_size;      /* Zero-filled bytes after bytes[size]       */
 
     /* PE Win32 runtime metadata (set by backend when targeting win32) */
     int      pe_iat_offset; /* Offset of IAT within bytes[] (0 = none)   */
     int      pe_iat_count;  /* Number of IAT entries (incl. null term.)  */
+
+    /* Layout metadata (set by back-ends with a data section) */
+    int      code_size;     /* Bytes of code before the data (0 = unset) */
+    int      str_size;      /* String bytes at code_size, without the
+                               padding up to data_offset                 */
+    int      data_offset;   /* Start of the writable data in bytes[]     */
+    int      seg_gap;       /* Run-time gap before strings and data      */
+    SymbolTable labels;     /* Code label -> offset in bytes[]           */
+    SymbolTable functions;  /* The labels that start a function
+                               (ua_compile(), for ELF symbols)           */
+
+    /* Source lines of the code, in offset order (codebuf_add_line()) */
+    CodeLine *lines;
+    int      line_count;
+    int      line_cap;
+    const char *line_src;   /* File last given, and its interned name    */
+    const char *line_name;
+
+    UaDiag  *diag;          /* Where the emitters report running out of
+                               memory (codebuf_set_diag())               */
 } CodeBuffer;
 
 /* =========================================================================
@@ -39,10 +133,10 @@ typedef struct {
 
 /*
  * create_code_buffer()
- *   Allocate an empty CodeBuffer with an initial capacity.
- *   Returns NULL on allocation failure.
+ *   Allocate an empty CodeBuffer with an initial capacity that reports on
+ *   `diag`.  Returns NULL if the buffer itself cannot be allocated.
  */
-CodeBuffer* create_code_buffer(void);
+CodeBuffer* create_code_buffer(UaDiag *diag);
 
 /*
  * free_code_buffer()
@@ -50,16 +144,148 @@ CodeBuffer* create_code_buffer(void);
  */
 void free_code_buffer(CodeBuffer *buf);
 
+/*
+ * codebuf_set_diag()
+ *   Points the buffer and its symbol tables at another sink — NULL once
+ *   the sink that built it is gone.
+ */
+void codebuf_set_diag(CodeBuffer *buf, UaDiag *diag);
+
+/*
+ * symtab_drop() / fixvec_drop() / codebuf_drop()
+ *   DiagCleanup forms of symtab_free(), fixvec_free() and, for the
+ *   address of a CodeBuffer pointer, free_code_buffer(), so a back-end
+ *   can diag_own() its tables before pass 1 starts.
+ */
+void symtab_drop(void *st);
+void fixvec_drop(void *vec);
+void codebuf_drop(void *pbuf);
+
+/*
+ * codebuf_reserve()
+ *   Make room for `count` more bytes in one allocation, so the appends
+ *   that follow never reallocate.  Back-ends call it with the size pass 1
+ *   computed.  Running out of memory is fatal (diag_fatal() on
+ *   buf->diag), as it is for every emitter below.
+ */
+void codebuf_reserve(CodeBuffer *buf, int count);
+
+/*
+ * codebuf_add_line()
+ *   The code emitted next comes from line `line` of `file` (an
+ *   Instruction's file and line; NULL records nothing).  An entry that
+ *   continues the previous line, or replaces one that produced no bytes,
+ *   is merged.  The name is interned, so it lives as long as the buffer.
+ */
+void codebuf_add_line(CodeBuffer *buf, const char *file, int line);
+
 /*
  * emit_byte()
  *   Append a single byte to the buffer, growing if necessary.
  */
-void emit_byte(CodeBuffer *buf, uint8_t byte);
+static inline void emit_byte(CodeBuffer *buf, uint8_t byte)
+{
+    if (buf->size >= buf->capacity) codebuf_reserve(buf, 1);
+    buf->bytes[buf->size++] = byte;
+}
+
+/*
+ * emit_le16() / emit_le32() / emit_le64()
+ *   Append a 16-, 32- or 64-bit value, least significant byte first.
+ */
+static inline void emit_le16(CodeBuffer *buf, uint16_t value)
+{
+    if (buf->capacity - buf->size < 2) codebuf_reserve(buf, 2);
+    uint8_t *p = buf->bytes + buf->size;
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    buf->size += 2;
+}
+
+static inline void emit_le32(CodeBuffer *buf, uint32_t value)
+{
+    if (buf->capacity - buf->size < 4) codebuf_reserve(buf, 4);
+    uint8_t *p = buf->bytes + buf->size;
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+    buf->size += 4;
+}
+
+static inline void emit_le64(CodeBuffer *buf, uint64_t value)
+{
+    emit_le32(buf, (uint32_t)value);
+    emit_le32(buf, (uint32_t)(value >> 32));
+}
+
+/*
+ * emit_bytes()
+ *   Append `count` bytes copied from `data`.
+ */
+void emit_bytes(CodeBuffer *buf, const void *data, int count);
+
+/*
+ * emit_fill()
+ *   Append `count` copies of `byte` (padding, placeholders, @ORG gaps).
+ *   A count of zero or less appends nothing.
+ */
+void emit_fill(CodeBuffer *buf, uint8_t byte, int count);
+
+/*
+ * symtab_init() / symtab_free()
+ *   Initialise an empty symbol table that raises running out of memory
+ *   on `diag` / release all of its storage (safe to repeat).
+ */
+void symtab_init(SymbolTable *st, UaDiag *diag);
+void symtab_free(SymbolTable *st);
+
+/*
+ * symtab_add()
+ *   Append a symbol.  Duplicates are recorded but shadowed by the first
+ *   definition; callers that forbid duplicates check symtab_lookup() first.
+ */
+void symtab_add(SymbolTable *st, const char *name, int address);
+
+/*
+ * symtab_lookup()
+ *   Returns the address of `name`, or -1 if it is not defined.
+ */
+int symtab_lookup(const SymbolTable *st, const char *name);
+
+/*
+ * symtab_intern()
+ *   Intern a name in the table's string pool without defining it.
+ *   Used for fixup labels, which may still be unresolved.
+ */
+const char* symtab_intern(SymbolTable *st, const char *name);
+
+/*
+ * fixvec_init() / fixvec_free()
+ *   Initialise an empty vector of `item_size`-byte records that raises
+ *   running out of memory on `diag` / free it (safe to repeat).
+ */
+void fixvec_init(FixupVec *vec, size_t item_size, UaDiag *diag);
+void fixvec_free(FixupVec *vec);
+
+/*
+ * fixvec_push()
+ *   Append a zero-filled record and return a pointer to it.  The pointer
+ *   is only valid until the next push.
+ */
+void* fixvec_push(FixupVec *vec);
+
+/*
+ * fixvec_at()
+ *   Pointer to the i-th record.
+ */
+#define fixvec_at(vec, type, i)  (&((type *)(vec)->items)[i])
 
 /*
  * hexdump()
- *   Pretty-prints `size` bytes from `data` in canonical hex-dump format.
+ *   Pretty-prints `size` bytes from `data` to `out` in canonical hex-dump
+ *   format.
  */
-void hexdump(const uint8_t *data, int size);
+void hexdump(FILE *out, const uint8_t *data, int size);
 
 #endif /* UA_CODEGEN_H */
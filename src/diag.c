@@ -0,0 +1,197 @@
+/*
+ * =============================================================================
+ *  UA - Unified Assembler
+ *  Diagnostics Sink
+ *
+ *  File:    diag.c
+ *  Purpose: Buffered stream / in-memory message sink, message levels and
+ *           fatal-error unwinding.
+ *
+ *  License: MIT
+ * =============================================================================
+ */
+
+#include "diag.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DIAG_INITIAL_CAPACITY  1024
+#define DIAG_INITIAL_OWNED     16
+
+void diag_init(UaDiag *d, FILE *stream)
+{
+    d->stream = stream;
+    d->text   = NULL;
+    d->len    = 0;
+    d->cap    = 0;
+    d->level  = DIAG_NORMAL;
+    d->errors = 0;
+    d->bail   = NULL;
+    d->owned       = NULL;
+    d->owned_count = 0;
+    d->owned_cap   = 0;
+}
+
+void diag_free(UaDiag *d)
+{
+    diag_flush(d);
+    free(d->text);
+    d->text = NULL;
+    d->len  = 0;
+    d->cap  = 0;
+    free(d->owned);
+    d->owned       = NULL;
+    d->owned_count = 0;
+    d->owned_cap   = 0;
+}
+
+/* Make room for `extra` more characters plus the terminator.
+ * Returns 0 on success, -1 if the text cannot grow (output is dropped). */
+static int diag_reserve(UaDiag *d, size_t extra)
+{
+    if (d->len + extra + 1 <= d->cap) return 0;
+    size_t new_cap = d->cap ? d->cap : DIAG_INITIAL_CAPACITY;
+    while (new_cap < d->len + extra + 1) new_cap *= 2;
+    char *tmp = (char *)realloc(d->text, new_cap);
+    if (!tmp) return -1;
+    d->text = tmp;
+    d->cap  = new_cap;
+    return 0;
+}
+
+/* Append one formatted message to the sink */
+static void diag_vwrite(UaDiag *d, const char *fmt, va_list ap)
+{
+    va_list ap2;
+
+    if (!d) {
+        vfprintf(stderr, fmt, ap);
+        return;
+    }
+
+    va_copy(ap2, ap);
+    int n = vsnprintf(NULL, 0, fmt, ap2);
+    va_end(ap2);
+    if (n <= 0) return;
+    if (diag_reserve(d, (size_t)n) != 0) {
+        /* No room to buffer: a stream still gets the message */
+        if (d->stream) {
+            diag_flush(d);
+            vfprintf(d->stream, fmt, ap);
+        }
+        return;
+    }
+
+    vsnprintf(d->text + d->len, (size_t)n + 1, fmt, ap);
+    d->len += (size_t)n;
+    if (d->stream && d->len >= DIAG_FLUSH_SIZE) diag_flush(d);
+}
+
+void diag_printf(UaDiag *d, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    diag_vwrite(d, fmt, ap);
+    va_end(ap);
+}
+
+int diag_enabled(const UaDiag *d, int level)
+{
+    return level <= (d ? d->level : DIAG_NORMAL);
+}
+
+void diag_log(UaDiag *d, int level, const char *fmt, ...)
+{
+    va_list ap;
+    if (!diag_enabled(d, level)) return;
+    va_start(ap, fmt);
+    diag_vwrite(d, fmt, ap);
+    va_end(ap);
+}
+
+void diag_trace(UaDiag *d, const char *fmt, ...)
+{
+    va_list ap;
+    if (!diag_enabled(d, DIAG_TRACE)) return;
+    va_start(ap, fmt);
+    diag_vwrite(d, fmt, ap);
+    va_end(ap);
+}
+
+void diag_flush(UaDiag *d)
+{
+    if (!d || !d->stream || d->len == 0) return;
+    fwrite(d->text, 1, d->len, d->stream);
+    fflush(d->stream);
+    d->len = 0;
+}
+
+/* Release everything registered, newest first */
+static void diag_release_owned(UaDiag *d)
+{
+    while (d->owned_count > 0) {
+        DiagOwned *o = &d->owned[--d->owned_count];
+        o->fn(o->obj);
+    }
+}
+
+void diag_fatal(UaDiag *d)
+{
+    if (d) {
+        diag_flush(d);
+        diag_release_owned(d);
+        d->errors++;
+        if (d->bail) longjmp(*d->bail, 1);
+    }
+    exit(1);
+}
+
+void diag_own(UaDiag *d, void *obj, DiagCleanup fn)
+{
+    if (!d) return;
+    if (d->owned_count == d->owned_cap) {
+        int new_cap = d->owned_cap ? d->owned_cap * 2 : DIAG_INITIAL_OWNED;
+        DiagOwned *tmp = (DiagOwned *)realloc(d->owned,
+                             (size_t)new_cap * sizeof(DiagOwned));
+        if (!tmp) {
+            fn(obj);
+            diag_printf(d, "UA: out of memory\n");
+            diag_fatal(d);
+        }
+        d->owned     = tmp;
+        d->owned_cap = new_cap;
+    }
+    d->owned[d->owned_count].fn  = fn;
+    d->owned[d->owned_count].obj = obj;
+    d->owned_count++;
+}
+
+int diag_owned(const UaDiag *d)
+{
+    return d ? d->owned_count : 0;
+}
+
+void diag_release(UaDiag *d, int mark)
+{
+    if (d && mark < d->owned_count) d->owned_count = mark;
+}
+
+void diag_free_ptr(void *pptr)
+{
+    void **p = (void **)pptr;
+    free(*p);
+    *p = NULL;
+}
+
+char* diag_take(UaDiag *d)
+{
+    diag_flush(d);
+    if (d->stream) return NULL;
+    char *text = d->text;
+    d->text = NULL;
+    d->len  = 0;
+    d->cap  = 0;
+    return text;
+}
@@ -0,0 +1,176 @@
+/*
+ * =============================================================================
+ *  UA - Unified Assembler
+ *  Diagnostics Sink
+ *
+ *  File:    diag.h
+ *  Purpose: Per-compilation destination for every message the pipeline
+ *           prints (errors, warnings and progress lines), and the way a
+ *           fatal error leaves the current phase.
+ *
+ *  A UaDiag either writes straight to a stream (the CLI uses stderr) or
+ *  collects the text in memory (libua returns it in ua_result).  A fatal
+ *  error is reported with diag_printf() and then raised with diag_fatal():
+ *  control returns to the setjmp() its owner armed in `bail`.  Every
+ *  libua entry point (ua_compile(), jit_create(), jit_load()) arms one, so
+ *  the library never ends its host; an unarmed or NULL sink exits with
+ *  status 1 and is only for a tool that runs a phase on its own.
+ *
+ *  Every phase receives its UaDiag explicitly, so independent
+ *  compilations share no state.  A NULL UaDiag means "stderr, exit on
+ *  fatal error".
+ *
+ *  Errors and warnings always print (diag_printf()).  Progress and
+ *  tracing go through diag_log() with a level and print only when the
+ *  sink's `level` reaches it: -q shows errors only, the default one line
+ *  per phase, -v the phase details and --trace-codegen every instruction
+ *  the backends translate.  A message above the sink's level costs one
+ *  comparison — it is never formatted.
+ *
+ *  Stream output is buffered: text collects in memory and is written in
+ *  DIAG_FLUSH_SIZE blocks, by diag_flush(), and before a fatal error
+ *  unwinds, instead of one unbuffered stderr write per message.
+ *
+ *  A phase that may raise a fatal error registers the heap state held in
+ *  its locals with diag_own().  diag_fatal() releases it, newest first,
+ *  before it unwinds; the caller that took a mark with diag_owned() before
+ *  the phase forgets the registrations with diag_release() once the phase
+ *  has returned normally.  Out of memory is a fatal error like any other.
+ *
+ *  License: MIT
+ * =============================================================================
+ */
+
+#ifndef UA_DIAG_H
+#define UA_DIAG_H
+
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/* Message levels (diag_log()) and sink levels (UaDiag.level) */
+#define DIAG_QUIET     (-1) /* sink only: errors and warnings            */
+#define DIAG_NORMAL      0  /* one progress line per phase (default)     */
+#define DIAG_VERBOSE     1  /* phase details: tables, segments, stats    */
+#define DIAG_TRACE       2  /* one line per translated instruction       */
+
+#define DIAG_FLUSH_SIZE  16384  /* stream sinks write in blocks this big  */
+
+/* Releases one registered object (diag_own()) */
+typedef void (*DiagCleanup)(void *obj);
+
+typedef struct {
+    DiagCleanup fn;
+    void       *obj;
+} DiagOwned;
+
+typedef struct UaDiag {
+    FILE    *stream;        /* output stream (NULL = capture in text[])  */
+    char    *text;          /* captured / not yet flushed output         */
+    size_t   len;
+    size_t   cap;
+    int      level;         /* highest message level printed             */
+    int      errors;        /* diag_fatal() calls so far                 */
+    jmp_buf *bail;          /* where diag_fatal() unwinds (NULL = exit)  */
+    DiagOwned *owned;       /* released by diag_fatal(), newest last     */
+    int      owned_count;
+    int      owned_cap;
+} UaDiag;
+
+/*
+ * diag_init() / diag_free()
+ *   Initialise a sink of level DIAG_NORMAL that writes to `stream`, or
+ *   captures the text when `stream` is NULL / flush a stream sink and
+ *   release the text.
+ */
+void diag_init(UaDiag *d, FILE *stream);
+void diag_free(UaDiag *d);
+
+/*
+ * diag_printf()
+ *   printf-style output to the sink.  `d` may be NULL (stderr).
+ */
+void diag_printf(UaDiag *d, const char *fmt, ...)
+#if defined(__GNUC__)
+    __attribute__((format(printf, 2, 3)))
+#endif
+    ;
+
+/*
+ * diag_log()
+ *   Like diag_printf(), for a message of `level` (DIAG_NORMAL ..
+ *   DIAG_TRACE): dropped unless the sink's level reaches it.  A NULL
+ *   sink prints DIAG_NORMAL messages.
+ */
+void diag_log(UaDiag *d, int level, const char *fmt, ...)
+#if defined(__GNUC__)
+    __attribute__((format(printf, 3, 4)))
+#endif
+    ;
+
+/*
+ * diag_trace()
+ *   diag_log() at DIAG_TRACE: the backends' per-instruction lines.
+ */
+void diag_trace(UaDiag *d, const char *fmt, ...)
+#if defined(__GNUC__)
+    __attribute__((format(printf, 2, 3)))
+#endif
+    ;
+
+/*
+ * diag_enabled()
+ *   Non-zero if a message of `level` would be printed — for callers that
+ *   loop to build one.
+ */
+int diag_enabled(const UaDiag *d, int level);
+
+/*
+ * diag_flush()
+ *   Writes out what a stream sink holds.  No-op for a capturing sink.
+ */
+void diag_flush(UaDiag *d);
+
+/*
+ * diag_fatal()
+ *   Abandons the current phase after its message has been printed
+ *   (and flushed).  Does not return.
+ */
+void diag_fatal(UaDiag *d)
+#if defined(__GNUC__)
+    __attribute__((noreturn))
+#endif
+    ;
+
+/*
+ * diag_own()
+ *   Registers `obj` for release by `fn` if a fatal error unwinds the
+ *   current phase.  If the list cannot grow, `obj` is released at once
+ *   and the out-of-memory error is raised.  No-op for a NULL sink.
+ */
+void diag_own(UaDiag *d, void *obj, DiagCleanup fn);
+
+/*
+ * diag_owned() / diag_release()
+ *   A mark: the number of registrations so far / forgets (without
+ *   releasing) every registration made after `mark`.
+ */
+int  diag_owned(const UaDiag *d);
+void diag_release(UaDiag *d, int mark);
+
+/*
+ * diag_free_ptr()
+ *   DiagCleanup for a heap block: `pptr` is the address of the pointer
+ *   variable, so the block it holds when the error strikes is freed.
+ */
+void diag_free_ptr(void *pptr);
+
+/*
+ * diag_take()
+ *   Hands the captured text to the caller (who must free() it) and
+ *   empties the sink.  Returns NULL when nothing was captured; a stream
+ *   sink is flushed instead.
+ */
+char* diag_take(UaDiag *d);
+
+#endif /* UA_DIAG_H */
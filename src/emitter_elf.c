@@ -4,8 +4,8 @@
  *  ELF (Executable and Linkable Format) Emitter
  *
  *  File:    emitter_elf.c
- *  Purpose: Build a minimal but valid 64-bit Linux ELF executable from
- *           a raw x86-64 machine-code buffer.  Zero external dependencies —
+ *  Purpose: Build a minimal but valid static Linux ELF executable from
+ *           a raw machine-code buffer.  Zero external dependencies —
  *           all ELF structures are defined inline with <stdint.h>.
  *
  *  ┌──────────────────────────────────────────────────────────────────────┐
@@ -13,35 +13,50 @@
  *  │                                                                    │
  *  │  File offset   Size   Content                                      │
  *  │  ────────────  ─────  ────────────────────────────────────          │
- *  │  0x0000        64     ELF64 header (e_ident + fields)              │
- *  │  0x0040        56     Program header (PT_LOAD)                     │
- *  │  0x0078        code   .text (raw machine code)                     │
- *  │  + epilogue    12     exit(R0) syscall stub                        │
- *  └──────────────────────────────────────────────────────────────────────┘
+ *  │  0x0000        E      ELF header  (E = 52 ELF32 / 64 ELF64)        │
+ *  │  E             P×n    Program headers (PT_LOAD, n = 1..3;          │
+ *  │                       P = 32 / 56; room is kept for three)         │
+ *  │  U - S         S      start stub from the ElfTarget                │
+ *  │  U                    user machine code (U aligned to the target)  │
+ *  │  U+code_size          strings            (read-only)               │
+ *  │  U+data_offset        initialised VARs   (read/write)              │
+ *  │  (memory only) bss    zero-filled BUFFERs / uninitialised VARs     │
+ *  │  then (not loaded)    .symtab, .strtab, .debug_* (-g), .shstrtab   │
+ *  │  8-aligned            section header table                         │
  *  │                                                                    │
- *  │  The emitter appends a Linux exit syscall after the user code so   │
- *  │  that HLT (RET = 0xC3) branches into:                             │
+ *  │  Segments (when the backend laid the data out with a seg_gap):     │
  *  │                                                                    │
- *  │    mov  rdi, rax       ; exit code = R0                            │
- *  │    mov  eax, 60        ; __NR_exit                                 │
- *  │    syscall                                                         │
+ *  │    text    R X   headers, stubs, code      vaddr = base + offset   │
+ *  │    rodata  R     strings                   vaddr + seg_gap         │
+ *  │    data    R W   VARs, then bss            vaddr + 2 * seg_gap     │
  *  │                                                                    │
- *  │  The entry point calls the user code, then falls through to the    │
- *  │  exit stub.                                                        │
+ *  │  The file is not padded: each segment starts right after the       │
+ *  │  previous one in the file, and the gap (a multiple of any page     │
+ *  │  size) keeps p_vaddr ≡ p_offset while putting every segment on     │
+ *  │  its own pages.  Stores to VARs therefore never touch a page (or   │
+ *  │  cache line) that holds code.  The data segment's p_memsz exceeds  │
+ *  │  its p_filesz by the bss; the kernel supplies demand-zero pages.   │
+ *  │  Code built without a gap is mapped as one segment, read/write/    │
+ *  │  execute when it has a bss.                                        │
  *  │                                                                    │
- *  │  Entry stub (5 bytes):                                             │
- *  │    call  user_code     ; rel32 to user code start                  │
+ *  │  The header area is the same size whatever the segment count, so   │
+ *  │  the user code's address — elf_code_origin() — is known before the │
+ *  │  backend runs.  Backends that address data absolutely (x86-32,     │
+ *  │  ARM, ARM64, RISC-V) build on it; x86-64 code is RIP-relative.     │
  *  │                                                                    │
- *  │  So the full layout in the segment is:                             │
- *  │    [CALL stub (5)] [user code ...] [exit stub (12)]                │
+ *  │  The section headers name the same parts (.text from the stub,     │
+ *  │  .rodata, .data, .bss) for disassemblers, debuggers and profilers; │
+ *  │  the loader only reads the program headers.  .symtab sizes every   │
+ *  │  function label; with -g, .debug_line maps the code to             │
+ *  │  the source lines the back-end recorded (see the DWARF section).   │
  *  │                                                                    │
- *  │  This way the user's HLT → RET returns from the CALL, and         │
- *  │  execution falls through to the exit syscall with RAX intact.      │
+ *  │  HLT returns from the stub's call into its exit sequence, e.g.     │
+ *  │  on x86-64:                                                        │
  *  │                                                                    │
- *  │  Constants:                                                        │
- *  │    BaseAddress = 0x00400000                                        │
- *  │    HeaderSize  = 0x78  (ELF hdr + 1 phdr = 64 + 56 = 120)         │
- *  │    EntryPoint  = BaseAddress + HeaderSize                          │
+ *  │    call user_code                                                  │
+ *  │    mov  rdi, rax       ; exit code = R0                            │
+ *  │    mov  eax, 60        ; __NR_exit                                 │
+ *  │    syscall                                                         │
  *  └──────────────────────────────────────────────────────────────────────┘
  *
  *  License: MIT
@@ -77,16 +92,12 @@
 #define ELFMAG1         'E'
 #define ELFMAG2         'L'
 #define ELFMAG3         'F'
-#define ELFCLASS64      2
 #define ELFDATA2LSB     1       /* little-endian */
 #define EV_CURRENT      1
 
 /* e_type */
 #define ET_EXEC         2       /* executable */
 
-/* e_machine */
-#define EM_X86_64       62
-
 /* p_type */
 #define PT_LOAD         1
 
@@ -95,25 +106,61 @@
 #define PF_W            2       /* write */
 #define PF_R            4       /* read */
 
-/* Layout constants */
-#define ELF_BASE_ADDR       0x00400000ULL
-#define ELF_EHDR_SIZE       64      /* sizeof(Elf64_Ehdr) */
-#define ELF_PHDR_SIZE       56      /* sizeof(Elf64_Phdr) */
-#define ELF_HEADER_SIZE     (ELF_EHDR_SIZE + ELF_PHDR_SIZE)  /* 120 = 0x78 */
-
-/* Exit stub:
- *   48 89 C7          mov rdi, rax        (3 bytes)
- *   B8 3C 00 00 00    mov eax, 60         (5 bytes)
- *   0F 05             syscall             (2 bytes)
- *   EB FE             jmp $  (safety)     (2 bytes)
- *                                  total: 12 bytes
- */
-#define ELF_EXIT_STUB_SIZE  12
+/* sh_type */
+#define SHT_PROGBITS    1
+#define SHT_SYMTAB      2
+#define SHT_STRTAB      3
+#define SHT_NOBITS      8
 
-/* Call stub:
- *   E8 xx xx xx xx    call rel32          (5 bytes)
- */
-#define ELF_CALL_STUB_SIZE  5
+/* sh_flags */
+#define SHF_WRITE       1
+#define SHF_ALLOC       2
+#define SHF_EXECINSTR   4
+
+/* st_info */
+#define STB_LOCAL       0
+#define STB_GLOBAL      1
+#define STT_NOTYPE      0
+#define STT_FUNC        2
+#define ELF_ST_INFO(b, t)   (uint8_t)(((b) << 4) | (t))
+
+/* Layout constants */
+#define ELF32_EHDR_SIZE     52      /* sizeof(Elf32_Ehdr) */
+#define ELF32_PHDR_SIZE     32      /* sizeof(Elf32_Phdr) */
+#define ELF64_EHDR_SIZE     64      /* sizeof(Elf64_Ehdr) */
+#define ELF64_PHDR_SIZE     56      /* sizeof(Elf64_Phdr) */
+#define ELF_MAX_PHDRS       3       /* text, rodata, data */
+#define ELF_SINGLE_ALIGN    0x200000ULL /* p_align of a lone segment */
+#define ELF32_SHDR_SIZE     40      /* sizeof(Elf32_Shdr) */
+#define ELF64_SHDR_SIZE     64      /* sizeof(Elf64_Shdr) */
+#define ELF32_SYM_SIZE      16      /* sizeof(Elf32_Sym)  */
+#define ELF64_SYM_SIZE      24      /* sizeof(Elf64_Sym)  */
+#define ELF_MAX_SECTIONS    11      /* null .text .rodata .data .bss
+                                       .symtab .strtab .debug_abbrev
+                                       .debug_info .debug_line .shstrtab */
+
+/* DWARF (version 3 line table and compile unit) */
+#define DW_TAG_compile_unit     0x11
+#define DW_AT_name              0x03
+#define DW_AT_stmt_list         0x10
+#define DW_AT_low_pc            0x11
+#define DW_AT_high_pc           0x12
+#define DW_AT_language          0x13
+#define DW_AT_producer          0x25
+#define DW_FORM_addr            0x01
+#define DW_FORM_data2           0x05
+#define DW_FORM_data4           0x06
+#define DW_FORM_string          0x08
+#define DW_LANG_Mips_Assembler  0x8001
+#define DW_LNS_copy             1
+#define DW_LNS_advance_pc       2
+#define DW_LNS_advance_line     3
+#define DW_LNS_set_file         4
+#define DW_LNE_end_sequence     1
+#define DW_LNE_set_address      2
+#define DWARF_LINE_BASE         (-5)
+#define DWARF_LINE_RANGE        14
+#define DWARF_OPCODE_BASE       13
 
 /* =========================================================================
  *  Little-endian serialisers
@@ -138,178 +185,789 @@ static void elf_write_le64(uint8_t *p, uint64_t v)
     elf_write_le32(p + 4, (uint32_t)(v >> 32));
 }
 
+/* Address-sized field: 4 bytes in ELF32, 8 in ELF64 */
+static void elf_write_addr(uint8_t *p, int is64, uint64_t v)
+{
+    if (is64) elf_write_le64(p, v);
+    else      elf_write_le32(p, (uint32_t)v);
+}
+
+/* Size of the ELF header plus room for ELF_MAX_PHDRS program headers */
+static uint32_t elf_header_area(const ElfTarget *target)
+{
+    if (target->elf_class == ELF_CLASS64)
+        return ELF64_EHDR_SIZE + ELF_MAX_PHDRS * ELF64_PHDR_SIZE;
+    return ELF32_EHDR_SIZE + ELF_MAX_PHDRS * ELF32_PHDR_SIZE;
+}
+
+/* File offset of the user code: after the headers and the start stub,
+ * rounded up to the target's entry alignment (the gap goes before the
+ * stub, so the stub always ends where the code begins). */
+static uint32_t elf_user_offset(const ElfTarget *target)
+{
+    uint32_t off   = elf_header_area(target)
+                   + (uint32_t)target->start_stub_size;
+    uint32_t align = target->entry_align ? target->entry_align : 1;
+    return (off + align - 1) / align * align;
+}
+
+uint32_t elf_code_origin(const ElfTarget *target)
+{
+    return target->base_addr + elf_user_offset(target);
+}
+
 /* =========================================================================
- *  emit_elf_exe()
+ *  Program header (PT_LOAD)
+ *
+ *  typedef struct {                typedef struct {
+ *      uint32_t p_type;                uint32_t p_type;
+ *      uint32_t p_flags;               uint32_t p_offset;
+ *      uint64_t p_offset;              uint32_t p_vaddr;
+ *      uint64_t p_vaddr;               uint32_t p_paddr;
+ *      uint64_t p_paddr;               uint32_t p_filesz;
+ *      uint64_t p_filesz;              uint32_t p_memsz;
+ *      uint64_t p_memsz;               uint32_t p_flags;
+ *      uint64_t p_align;               uint32_t p_align;
+ *  } Elf64_Phdr;                   } Elf32_Phdr;
  * ========================================================================= */
-int emit_elf_exe(const char *filename, const CodeBuffer *code)
+typedef struct {
+    uint32_t flags;
+    uint64_t offset;
+    uint64_t vaddr;
+    uint64_t filesz;
+    uint64_t memsz;
+    uint64_t align;
+} ElfSegment;
+
+static void elf_write_phdr(uint8_t *ph, int is64, const ElfSegment *seg)
+{
+    if (is64) {
+        elf_write_le32(ph +  0, PT_LOAD);           /* p_type   */
+        elf_write_le32(ph +  4, seg->flags);        /* p_flags  */
+        elf_write_le64(ph +  8, seg->offset);       /* p_offset */
+        elf_write_le64(ph + 16, seg->vaddr);        /* p_vaddr  */
+        elf_write_le64(ph + 24, seg->vaddr);        /* p_paddr  */
+        elf_write_le64(ph + 32, seg->filesz);       /* p_filesz */
+        elf_write_le64(ph + 40, seg->memsz);        /* p_memsz  */
+        elf_write_le64(ph + 48, seg->align);        /* p_align  */
+    } else {
+        elf_write_le32(ph +  0, PT_LOAD);                   /* p_type   */
+        elf_write_le32(ph +  4, (uint32_t)seg->offset);     /* p_offset */
+        elf_write_le32(ph +  8, (uint32_t)seg->vaddr);      /* p_vaddr  */
+        elf_write_le32(ph + 12, (uint32_t)seg->vaddr);      /* p_paddr  */
+        elf_write_le32(ph + 16, (uint32_t)seg->filesz);     /* p_filesz */
+        elf_write_le32(ph + 20, (uint32_t)seg->memsz);      /* p_memsz  */
+        elf_write_le32(ph + 24, seg->flags);                /* p_flags  */
+        elf_write_le32(ph + 28, (uint32_t)seg->align);      /* p_align  */
+    }
+}
+
+/* =========================================================================
+ *  Growable byte buffer (contents of the non-loaded sections)
+ *
+ *  Running out of memory sets `failed`; later writes are dropped and the
+ *  caller checks the flag once.
+ * ========================================================================= */
+typedef struct {
+    uint8_t *data;
+    size_t   size;
+    size_t   cap;
+    int      failed;
+} ElfBuf;
+
+/* `n` new zero bytes at the end, or NULL once out of memory */
+static uint8_t *elf_buf_grow(ElfBuf *b, size_t n)
+{
+    if (b->failed) return NULL;
+    if (b->size + n > b->cap) {
+        size_t   cap = b->cap ? b->cap * 2 : 256;
+        while (cap < b->size + n) cap *= 2;
+        uint8_t *d = (uint8_t *)realloc(b->data, cap);
+        if (!d) {
+            b->failed = 1;
+            return NULL;
+        }
+        b->data = d;
+        b->cap  = cap;
+    }
+    uint8_t *p = b->data + b->size;
+    memset(p, 0, n);
+    b->size += n;
+    return p;
+}
+
+static void elf_buf_u8(ElfBuf *b, unsigned v)
+{
+    uint8_t *p = elf_buf_grow(b, 1);
+    if (p) *p = (uint8_t)v;
+}
+
+static void elf_buf_u16(ElfBuf *b, uint16_t v)
+{
+    uint8_t *p = elf_buf_grow(b, 2);
+    if (p) elf_write_le16(p, v);
+}
+
+static void elf_buf_u32(ElfBuf *b, uint32_t v)
+{
+    uint8_t *p = elf_buf_grow(b, 4);
+    if (p) elf_write_le32(p, v);
+}
+
+static void elf_buf_addr(ElfBuf *b, int is64, uint64_t v)
+{
+    uint8_t *p = elf_buf_grow(b, is64 ? 8 : 4);
+    if (p) elf_write_addr(p, is64, v);
+}
+
+static void elf_buf_uleb(ElfBuf *b, uint64_t v)
+{
+    do {
+        unsigned byte = (unsigned)(v & 0x7F);
+        v >>= 7;
+        elf_buf_u8(b, v ? byte | 0x80 : byte);
+    } while (v);
+}
+
+static void elf_buf_sleb(ElfBuf *b, int64_t v)
+{
+    for (;;) {
+        unsigned byte = (unsigned)((uint64_t)v & 0x7F);
+        v = v < 0 ? ~(~v >> 7) : v >> 7;        /* arithmetic shift */
+        int done = (v == 0 && !(byte & 0x40)) || (v == -1 && (byte & 0x40));
+        elf_buf_u8(b, done ? byte : byte | 0x80);
+        if (done) return;
+    }
+}
+
+/* Appends `str` with its NUL; returns its offset */
+static uint32_t elf_buf_str(ElfBuf *b, const char *str)
+{
+    uint32_t off = (uint32_t)b->size;
+    size_t   len = strlen(str) + 1;
+    uint8_t *p   = elf_buf_grow(b, len);
+    if (p) memcpy(p, str, len);
+    return off;
+}
+
+/* =========================================================================
+ *  Section header
+ *
+ *  typedef struct {                typedef struct {
+ *      uint32_t sh_name;               uint32_t sh_name;
+ *      uint32_t sh_type;               uint32_t sh_type;
+ *      uint64_t sh_flags;              uint32_t sh_flags;
+ *      uint64_t sh_addr;               uint32_t sh_addr;
+ *      uint64_t sh_offset;             uint32_t sh_offset;
+ *      uint64_t sh_size;               uint32_t sh_size;
+ *      uint32_t sh_link;               uint32_t sh_link;
+ *      uint32_t sh_info;               uint32_t sh_info;
+ *      uint64_t sh_addralign;          uint32_t sh_addralign;
+ *      uint64_t sh_entsize;            uint32_t sh_entsize;
+ *  } Elf64_Shdr;                   } Elf32_Shdr;
+ * ========================================================================= */
+typedef struct {
+    uint32_t      name;         /* offset in .shstrtab                    */
+    uint32_t      type;
+    uint64_t      flags;
+    uint64_t      addr;
+    uint64_t      offset;
+    uint64_t      size;
+    uint32_t      link;
+    uint32_t      info;
+    uint64_t      align;
+    uint64_t      entsize;
+    const ElfBuf *content;      /* not loaded: placed after the segments  */
+} ElfSection;
+
+static void elf_write_shdr(uint8_t *sh, int is64, const ElfSection *sec)
+{
+    int asz = is64 ? 8 : 4;
+    elf_write_le32(sh + 0, sec->name);                  /* sh_name      */
+    elf_write_le32(sh + 4, sec->type);                  /* sh_type      */
+    uint8_t *p = sh + 8;
+    elf_write_addr(p, is64, sec->flags);   p += asz;    /* sh_flags     */
+    elf_write_addr(p, is64, sec->addr);    p += asz;    /* sh_addr      */
+    elf_write_addr(p, is64, sec->offset);  p += asz;    /* sh_offset    */
+    elf_write_addr(p, is64, sec->size);    p += asz;    /* sh_size      */
+    elf_write_le32(p, sec->link);          p += 4;      /* sh_link      */
+    elf_write_le32(p, sec->info);          p += 4;      /* sh_info      */
+    elf_write_addr(p, is64, sec->align);   p += asz;    /* sh_addralign */
+    elf_write_addr(p, is64, sec->entsize);              /* sh_entsize   */
+}
+
+/* Next section header, named `name` in .shstrtab */
+static ElfSection *elf_add_section(ElfSection *secs, int *count,
+                                   ElfBuf *shstrtab, const char *name,
+                                   uint32_t type, uint64_t flags)
+{
+    ElfSection *sec = &secs[(*count)++];
+    memset(sec, 0, sizeof(*sec));
+    sec->name  = elf_buf_str(shstrtab, name);
+    sec->type  = type;
+    sec->flags = flags;
+    sec->align = 1;
+    return sec;
+}
+
+/* Largest power of two up to `max` that divides `addr` */
+static uint64_t elf_addr_align(uint64_t addr, uint64_t max)
+{
+    uint64_t align = 1;
+    while (align < max && addr % (align * 2) == 0) align *= 2;
+    return align;
+}
+
+/* =========================================================================
+ *  Symbols (.symtab / .strtab)
+ *
+ *  typedef struct {                typedef struct {
+ *      uint32_t st_name;               uint32_t st_name;
+ *      uint8_t  st_info;               uint32_t st_value;
+ *      uint8_t  st_other;              uint32_t st_size;
+ *      uint16_t st_shndx;              uint8_t  st_info;
+ *      uint64_t st_value;              uint8_t  st_other;
+ *      uint64_t st_size;               uint16_t st_shndx;
+ *  } Elf64_Sym;                    } Elf32_Sym;
+ *
+ *  The labels the program calls (CodeBuffer.functions) are global
+ *  functions, each running up to the next one or to the end of the code;
+ *  _start covers the stub and the code before the first of them.  Other
+ *  labels are local and untyped: disassemblers show them as branch
+ *  targets, profilers leave them inside their function.
+ * ========================================================================= */
+static void elf_put_sym(ElfBuf *b, int is64, uint32_t name, uint8_t info,
+                        uint16_t shndx, uint64_t value, uint64_t size)
+{
+    elf_buf_u32(b, name);                               /* st_name      */
+    if (!is64) {
+        elf_buf_u32(b, (uint32_t)value);                /* st_value     */
+        elf_buf_u32(b, (uint32_t)size);                 /* st_size      */
+    }
+    elf_buf_u8(b, info);                                /* st_info      */
+    elf_buf_u8(b, 0);                       /* st_other (STV_DEFAULT)   */
+    elf_buf_u16(b, shndx);                              /* st_shndx     */
+    if (is64) {
+        elf_buf_addr(b, 1, value);                      /* st_value     */
+        elf_buf_addr(b, 1, size);                       /* st_size      */
+    }
+}
+
+static int elf_cmp_offset(const void *a, const void *b)
+{
+    int x = *(const int *)a;
+    int y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+/* First of the ascending starts[] above `offset`, or `end` */
+static int elf_next_start(const int *starts, int n, int offset, int end)
+{
+    int lo = 0, hi = n;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (starts[mid] <= offset) lo = mid + 1;
+        else                       hi = mid;
+    }
+    return lo < n ? starts[lo] : end;
+}
+
+/* Fills .symtab and .strtab for code of `code_end` bytes at `code_vaddr`
+ * and a stub of `stub_size` bytes right before it.  Returns the index of
+ * the first global symbol (sh_info), or -1 when out of memory. */
+static int elf_build_symbols(const CodeBuffer *code, int is64,
+                             uint16_t text, uint64_t code_vaddr,
+                             int code_end, int stub_size,
+                             ElfBuf *sym, ElfBuf *str)
+{
+    const SymbolTable *funcs = &code->functions;
+    int *starts = (int *)malloc(((size_t)funcs->count + 1) * sizeof(int));
+    if (!starts) return -1;
+    int nstart = 0;
+    for (int i = 0; i < funcs->count; i++) {
+        int off = funcs->entries[i].address;
+        if (off >= 0 && off <= code_end) starts[nstart++] = off;
+    }
+    qsort(starts, (size_t)nstart, sizeof(int), elf_cmp_offset);
+
+    elf_buf_str(str, "");
+    elf_put_sym(sym, is64, 0, 0, 0, 0, 0);          /* 0: undefined */
+
+    /* Locals: the labels that are not functions */
+    int first_global = 1;
+    for (int i = 0; i < code->labels.count; i++) {
+        const Symbol *l = &code->labels.entries[i];
+        if (l->address < 0 || l->address > code_end ||
+            symtab_lookup(funcs, l->name) >= 0)
+            continue;
+        elf_put_sym(sym, is64, elf_buf_str(str, l->name),
+                    ELF_ST_INFO(STB_LOCAL, STT_NOTYPE), text,
+                    code_vaddr + (uint64_t)l->address, 0);
+        first_global++;
+    }
+
+    /* Globals: the stub, then the functions */
+    int first = nstart > 0 ? starts[0] : code_end;
+    elf_put_sym(sym, is64, elf_buf_str(str, "_start"),
+                ELF_ST_INFO(STB_GLOBAL, STT_FUNC), text,
+                code_vaddr - (uint64_t)stub_size,
+                (uint64_t)(stub_size + first));
+    for (int i = 0; i < funcs->count; i++) {
+        const Symbol *f = &funcs->entries[i];
+        if (f->address < 0 || f->address > code_end) continue;
+        int end = elf_next_start(starts, nstart, f->address, code_end);
+        elf_put_sym(sym, is64, elf_buf_str(str, f->name),
+                    ELF_ST_INFO(STB_GLOBAL, STT_FUNC), text,
+                    code_vaddr + (uint64_t)f->address,
+                    (uint64_t)(end - f->address));
+    }
+    free(starts);
+    return first_global;
+}
+
+/* =========================================================================
+ *  DWARF line table (-g: .debug_line, .debug_info, .debug_abbrev)
+ *
+ *  One DWARF 3 line-number program maps the code to the source lines
+ *  the back-end recorded (CodeBuffer.lines), naming each file as the
+ *  precompiler found it.  A single compile unit spanning the code points
+ *  at it; that is where debuggers and profilers look for line tables.
+ * ========================================================================= */
+
+/* 1-based index of `file` in files[] (names are interned, so pointers
+ * compare), appending it if new */
+static int elf_line_file(const char **files, int *count, const char *file)
+{
+    for (int i = *count - 1; i >= 0; i--) {
+        if (files[i] == file) return i + 1;
+    }
+    files[*count] = file;
+    return ++*count;
+}
+
+/* A row `addr_delta` bytes and `line_delta` lines after the last one */
+static void elf_line_row(ElfBuf *b, uint64_t addr_delta, int64_t line_delta)
+{
+    if (line_delta < DWARF_LINE_BASE ||
+        line_delta >= DWARF_LINE_BASE + DWARF_LINE_RANGE) {
+        elf_buf_u8(b, DW_LNS_advance_line);
+        elf_buf_sleb(b, line_delta);
+        line_delta = 0;
+    }
+    uint64_t op = (uint64_t)(line_delta - DWARF_LINE_BASE)
+                + DWARF_LINE_RANGE * addr_delta + DWARF_OPCODE_BASE;
+    if (op > 255) {
+        elf_buf_u8(b, DW_LNS_advance_pc);
+        elf_buf_uleb(b, addr_delta);
+        op = (uint64_t)(line_delta - DWARF_LINE_BASE) + DWARF_OPCODE_BASE;
+    }
+    elf_buf_u8(b, (unsigned)op);                /* special opcode: a row */
+}
+
+static void elf_patch_u32(ElfBuf *b, size_t at, uint32_t v)
+{
+    if (!b->failed) elf_write_le32(b->data + at, v);
+}
+
+/* The line-number program for the code's first `code_end` bytes */
+static void elf_build_debug_line(const CodeBuffer *code, int is64,
+                                 uint64_t code_vaddr, int code_end,
+                                 ElfBuf *b)
+{
+    static const uint8_t std_lengths[DWARF_OPCODE_BASE - 1] = {
+        0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1
+    };
+    const char **files = (const char **)malloc((size_t)code->line_count *
+                                               sizeof(char *));
+    if (!files) {
+        b->failed = 1;
+        return;
+    }
+    int nfile = 0;
+    for (int i = 0; i < code->line_count; i++) {
+        if (code->lines[i].offset < code_end)
+            elf_line_file(files, &nfile, code->lines[i].file);
+    }
+
+    /* ---- Header --------------------------------------------------------- */
+    elf_buf_u32(b, 0);                          /* unit_length (below)   */
+    elf_buf_u16(b, 3);                          /* version               */
+    elf_buf_u32(b, 0);                          /* header_length (below) */
+    size_t header = b->size;
+    elf_buf_u8(b, 1);                           /* minimum_instruction_length */
+    elf_buf_u8(b, 1);                           /* default_is_stmt       */
+    elf_buf_u8(b, (uint8_t)DWARF_LINE_BASE);
+    elf_buf_u8(b, DWARF_LINE_RANGE);
+    elf_buf_u8(b, DWARF_OPCODE_BASE);
+    for (int i = 0; i < DWARF_OPCODE_BASE - 1; i++)
+        elf_buf_u8(b, std_lengths[i]);
+    elf_buf_u8(b, 0);                           /* include_directories   */
+    for (int i = 0; i < nfile; i++) {
+        elf_buf_str(b, files[i]);               /* file_names: name,     */
+        elf_buf_u8(b, 0);                       /* directory, mtime and  */
+        elf_buf_u8(b, 0);                       /* length (unknown)      */
+        elf_buf_u8(b, 0);
+    }
+    elf_buf_u8(b, 0);
+    size_t program = b->size;
+
+    /* ---- Program: one row per recorded line ----------------------------- */
+    int file = 1, line = 1, pc = -1;
+    for (int i = 0; i < code->line_count; i++) {
+        const CodeLine *cl = &code->lines[i];
+        if (cl->offset >= code_end) break;
+        if (pc < 0) {
+            elf_buf_u8(b, 0);                   /* DW_LNE_set_address    */
+            elf_buf_uleb(b, (uint64_t)(1 + (is64 ? 8 : 4)));
+            elf_buf_u8(b, DW_LNE_set_address);
+            elf_buf_addr(b, is64, code_vaddr + (uint64_t)cl->offset);
+            pc = cl->offset;
+        }
+        int f = elf_line_file(files, &nfile, cl->file);
+        if (f != file) {
+            elf_buf_u8(b, DW_LNS_set_file);
+            elf_buf_uleb(b, (uint64_t)f);
+            file = f;
+        }
+        elf_line_row(b, (uint64_t)(cl->offset - pc),
+                     (int64_t)cl->line - line);
+        pc   = cl->offset;
+        line = cl->line;
+    }
+    elf_buf_u8(b, DW_LNS_advance_pc);
+    elf_buf_uleb(b, (uint64_t)(code_end - pc));
+    elf_buf_u8(b, 0);                           /* DW_LNE_end_sequence   */
+    elf_buf_uleb(b, 1);
+    elf_buf_u8(b, DW_LNE_end_sequence);
+
+    elf_patch_u32(b, 0, (uint32_t)(b->size - 4));
+    elf_patch_u32(b, 6, (uint32_t)(program - header));
+    free(files);
+}
+
+/* The compile unit: `name`, the code at [low, high), line program 0 */
+static void elf_build_debug_info(int is64, const char *name, uint64_t low,
+                                 uint64_t high, ElfBuf *abbrev, ElfBuf *info)
+{
+    static const uint8_t attrs[] = {
+        DW_AT_name,      DW_FORM_string,
+        DW_AT_producer,  DW_FORM_string,
+        DW_AT_language,  DW_FORM_data2,
+        DW_AT_low_pc,    DW_FORM_addr,
+        DW_AT_high_pc,   DW_FORM_addr,
+        DW_AT_stmt_list, DW_FORM_data4,
+        0, 0
+    };
+    elf_buf_uleb(abbrev, 1);                    /* abbreviation code     */
+    elf_buf_uleb(abbrev, DW_TAG_compile_unit);
+    elf_buf_u8(abbrev, 0);                      /* DW_CHILDREN_no        */
+    for (size_t i = 0; i < sizeof(attrs); i++)
+        elf_buf_u8(abbrev, attrs[i]);
+    elf_buf_u8(abbrev, 0);                      /* end of the table      */
+
+    elf_buf_u32(info, 0);                       /* unit_length (below)   */
+    elf_buf_u16(info, 3);                       /* version               */
+    elf_buf_u32(info, 0);                       /* debug_abbrev_offset   */
+    elf_buf_u8(info, is64 ? 8 : 4);             /* address_size          */
+    elf_buf_uleb(info, 1);
+    elf_buf_str(info, name);
+    elf_buf_str(info, "UA - Unified Assembler");
+    elf_buf_u16(info, DW_LANG_Mips_Assembler);
+    elf_buf_addr(info, is64, low);
+    elf_buf_addr(info, is64, high);
+    elf_buf_u32(info, 0);                       /* stmt_list             */
+    elf_patch_u32(info, 0, (uint32_t)(info->size - 4));
+}
+
+/* =========================================================================
+ *  emit_elf_image()
+ * ========================================================================= */
+int emit_elf_image(const CodeBuffer *code, const ElfTarget *target,
+                   int debug_lines, uint8_t **image, int *file_size,
+                   UaDiag *diag)
 {
     if (!code || code->size == 0) {
-        fprintf(stderr, "ELF emitter: no code to emit.\n");
+        diag_printf(diag, "ELF emitter: no code to emit.\n");
         return 1;
     }
+    if (!target) {
+        diag_printf(diag, "ELF emitter: no ELF target for this "
+                          "architecture.\n");
+        return 1;
+    }
+
+    int      is64      = target->elf_class == ELF_CLASS64;
+    uint32_t ehdr_size = is64 ? ELF64_EHDR_SIZE : ELF32_EHDR_SIZE;
+    uint32_t phdr_size = is64 ? ELF64_PHDR_SIZE : ELF32_PHDR_SIZE;
+    uint32_t shdr_size = is64 ? ELF64_SHDR_SIZE : ELF32_SHDR_SIZE;
+    uint64_t base      = target->base_addr;
 
-    /* ---- Compute sizes ------------------------------------------------ */
+    /* ---- Segments --------------------------------------------------- */
+    /* Offsets below are relative to the user code */
     uint32_t user_code_size = (uint32_t)code->size;
-    uint32_t segment_size   = ELF_CALL_STUB_SIZE + user_code_size
-                            + ELF_EXIT_STUB_SIZE;
-    uint32_t total_file_size = ELF_HEADER_SIZE + segment_size;
+    uint32_t bss_size       = (uint32_t)code->bss_size;
+    uint64_t gap            = (uint64_t)code->seg_gap;
+    uint32_t code_end       = user_code_size;   /* end of text             */
+    uint32_t data_off       = user_code_size;   /* start of writable data  */
+    if (gap > 0) {
+        code_end = (uint32_t)code->code_size;
+        data_off = (uint32_t)code->data_offset;
+    }
+    int has_rodata = gap > 0 && code->str_size > 0;
+    int has_data   = gap > 0 && (user_code_size > data_off || bss_size > 0);
+
+    uint32_t user_off        = elf_user_offset(target);
+    uint32_t stub_off        = user_off - (uint32_t)target->start_stub_size;
+    uint32_t load_size       = user_off + user_code_size;
+    uint64_t entry_vaddr     = base + stub_off;
+
+    ElfSegment segs[ELF_MAX_PHDRS];
+    int nseg = 0;
+
+    /* text: headers, stub and code — read + execute */
+    segs[nseg].flags  = PF_R | PF_X;
+    segs[nseg].offset = 0;
+    segs[nseg].vaddr  = base;
+    segs[nseg].filesz = user_off + code_end;
+    segs[nseg].memsz  = segs[nseg].filesz;
+    segs[nseg].align  = gap > 0 ? gap : ELF_SINGLE_ALIGN;
+    if (gap == 0 && bss_size > 0) {
+        /* One segment for everything: the bss must be writable */
+        segs[nseg].flags |= PF_W;
+        segs[nseg].memsz += bss_size;
+    }
+    nseg++;
+
+    /* rodata: strings — read only, one gap further */
+    if (has_rodata) {
+        segs[nseg].flags  = PF_R;
+        segs[nseg].offset = user_off + code_end;
+        segs[nseg].vaddr  = base + segs[nseg].offset + gap;
+        segs[nseg].filesz = (uint32_t)code->str_size;
+        segs[nseg].memsz  = segs[nseg].filesz;
+        segs[nseg].align  = gap;
+        nseg++;
+    }
 
-    uint64_t entry_vaddr    = ELF_BASE_ADDR + ELF_HEADER_SIZE;
+    /* data: initialised VARs, then the bss — read + write, two gaps */
+    if (has_data) {
+        segs[nseg].flags  = PF_R | PF_W;
+        segs[nseg].offset = user_off + data_off;
+        segs[nseg].vaddr  = base + segs[nseg].offset + 2 * gap;
+        segs[nseg].filesz = user_code_size - data_off;
+        segs[nseg].memsz  = segs[nseg].filesz + bss_size;
+        segs[nseg].align  = gap;
+        nseg++;
+    }
 
-    fprintf(stderr, "[ELF] User code size   : %u bytes\n", user_code_size);
-    fprintf(stderr, "[ELF] Segment size     : %u bytes (stub + code + exit)\n",
-            segment_size);
-    fprintf(stderr, "[ELF] Entry point      : 0x%llX\n",
-            (unsigned long long)entry_vaddr);
-    fprintf(stderr, "[ELF] Total file size  : %u bytes\n", total_file_size);
+    /* A 32-bit image must fit below 4 GiB */
+    if (!is64 && segs[nseg - 1].vaddr + segs[nseg - 1].memsz > 0xFFFFFFFFULL) {
+        diag_printf(diag, "ELF emitter: image does not fit in a 32-bit "
+                          "address space.\n");
+        return 1;
+    }
+
+    diag_log(diag, DIAG_VERBOSE, "[ELF] Target           : ELF%d, e_machine %u, "
+             "e_flags 0x%X\n", is64 ? 64 : 32,
+             (unsigned)target->machine, (unsigned)target->flags);
+    diag_log(diag, DIAG_VERBOSE, "[ELF] User code size   : %u bytes\n", user_code_size);
+    for (int i = 0; i < nseg; i++) {
+        diag_log(diag, DIAG_VERBOSE, "[ELF] Segment %c%c%c      : 0x%llX, %llu bytes"
+                 " (%llu in file)\n",
+                 (segs[i].flags & PF_R) ? 'R' : '-',
+                 (segs[i].flags & PF_W) ? 'W' : '-',
+                 (segs[i].flags & PF_X) ? 'X' : '-',
+                 (unsigned long long)segs[i].vaddr,
+                 (unsigned long long)segs[i].memsz,
+                 (unsigned long long)segs[i].filesz);
+    }
+
+    /* ---- Sections ----------------------------------------------------- */
+    /* The loaded ones describe the segments' contents; symbols, the
+     * debug information and the section names follow the last segment
+     * in the file, then the section header table. */
+    ElfSection secs[ELF_MAX_SECTIONS];
+    ElfBuf     shstrtab = { 0 }, symtab = { 0 }, strtab = { 0 };
+    ElfBuf     abbrev = { 0 }, info = { 0 }, lines = { 0 };
+    int        nsec = 0;
+    uint64_t   code_vaddr = base + user_off;
+    ElfSection *sec;
+
+    elf_buf_str(&shstrtab, "");
+    elf_add_section(secs, &nsec, &shstrtab, "", 0, 0);     /* SHN_UNDEF */
+    uint16_t text = (uint16_t)nsec;
+    sec = elf_add_section(secs, &nsec, &shstrtab, ".text", SHT_PROGBITS,
+                          SHF_ALLOC | SHF_EXECINSTR);
+    sec->addr   = entry_vaddr;
+    sec->offset = stub_off;
+    sec->size   = (uint64_t)target->start_stub_size + code_end;
+    sec->align  = elf_addr_align(entry_vaddr, target->entry_align);
+    if (has_rodata) {
+        sec = elf_add_section(secs, &nsec, &shstrtab, ".rodata",
+                              SHT_PROGBITS, SHF_ALLOC);
+        sec->offset = user_off + code_end;
+        sec->addr   = base + sec->offset + gap;
+        sec->size   = (uint64_t)code->str_size;
+    }
+    if (has_data && user_code_size > data_off) {
+        sec = elf_add_section(secs, &nsec, &shstrtab, ".data",
+                              SHT_PROGBITS, SHF_ALLOC | SHF_WRITE);
+        sec->offset = user_off + data_off;
+        sec->addr   = base + sec->offset + 2 * gap;
+        sec->size   = user_code_size - data_off;
+        sec->align  = elf_addr_align(sec->addr, 8);
+    }
+    if (bss_size > 0) {
+        sec = elf_add_section(secs, &nsec, &shstrtab, ".bss", SHT_NOBITS,
+                              SHF_ALLOC | SHF_WRITE);
+        sec->offset = load_size;
+        sec->addr   = base + load_size + (has_data ? 2 * gap : 0);
+        sec->size   = bss_size;
+        sec->align  = elf_addr_align(sec->addr, 8);
+    }
+
+    int first_global = elf_build_symbols(code, is64, text, code_vaddr,
+                                         (int)code_end,
+                                         target->start_stub_size,
+                                         &symtab, &strtab);
+    sec = elf_add_section(secs, &nsec, &shstrtab, ".symtab", SHT_SYMTAB, 0);
+    sec->content = &symtab;
+    sec->link    = (uint32_t)nsec;                      /* .strtab, next */
+    sec->info    = first_global > 0 ? (uint32_t)first_global : 0;
+    sec->align   = is64 ? 8 : 4;
+    sec->entsize = is64 ? ELF64_SYM_SIZE : ELF32_SYM_SIZE;
+    sec = elf_add_section(secs, &nsec, &shstrtab, ".strtab", SHT_STRTAB, 0);
+    sec->content = &strtab;
+
+    if (debug_lines && code->line_count > 0 &&
+        code->lines[0].offset < (int)code_end) {
+        elf_build_debug_info(is64, code->lines[0].file,
+                             code_vaddr + (uint64_t)code->lines[0].offset,
+                             code_vaddr + code_end, &abbrev, &info);
+        elf_build_debug_line(code, is64, code_vaddr, (int)code_end, &lines);
+        sec = elf_add_section(secs, &nsec, &shstrtab, ".debug_abbrev",
+                              SHT_PROGBITS, 0);
+        sec->content = &abbrev;
+        sec = elf_add_section(secs, &nsec, &shstrtab, ".debug_info",
+                              SHT_PROGBITS, 0);
+        sec->content = &info;
+        sec = elf_add_section(secs, &nsec, &shstrtab, ".debug_line",
+                              SHT_PROGBITS, 0);
+        sec->content = &lines;
+    }
+
+    uint16_t shstrndx = (uint16_t)nsec;
+    sec = elf_add_section(secs, &nsec, &shstrtab, ".shstrtab", SHT_STRTAB, 0);
+    sec->content = &shstrtab;
+
+    uint64_t end = load_size;
+    int      failed = first_global < 0;
+    for (int i = 0; i < nsec; i++) {
+        if (!secs[i].content) continue;
+        failed |= secs[i].content->failed;
+        end = (end + secs[i].align - 1) / secs[i].align * secs[i].align;
+        secs[i].offset = end;
+        secs[i].size   = secs[i].content->size;
+        end += secs[i].size;
+    }
+    uint64_t shoff = (end + 7) / 8 * 8;
+    uint64_t total = shoff + (uint64_t)nsec * shdr_size;
+    if (total > 0x7FFFFFFFULL) failed = 1;
+
+    diag_log(diag, DIAG_VERBOSE, "[ELF] Sections         : %d (%d symbols%s)\n",
+             nsec, (int)(symtab.size / (is64 ? ELF64_SYM_SIZE : ELF32_SYM_SIZE)),
+             lines.size > 0 ? ", line table" : "");
+    diag_log(diag, DIAG_VERBOSE, "[ELF] Entry point      : 0x%llX\n",
+             (unsigned long long)entry_vaddr);
+    diag_log(diag, DIAG_VERBOSE, "[ELF] Total file size  : %llu bytes\n",
+             (unsigned long long)total);
 
     /* ---- Allocate a zero-filled file image ----------------------------- */
-    uint8_t *img = (uint8_t *)calloc(1, total_file_size);
+    uint8_t *img = failed ? NULL : (uint8_t *)calloc(1, (size_t)total);
     if (!img) {
-        fprintf(stderr, "ELF emitter: out of memory.\n");
+        diag_printf(diag, "ELF emitter: out of memory.\n");
+        free(shstrtab.data); free(symtab.data); free(strtab.data);
+        free(abbrev.data);   free(info.data);   free(lines.data);
         return 1;
     }
 
     /* ====================================================================
-     *  ELF64 Header  (64 bytes at offset 0x0000)
+     *  ELF Header  (at offset 0x0000)
      *
-     *  typedef struct {
-     *      unsigned char e_ident[16];
-     *      uint16_t      e_type;
-     *      uint16_t      e_machine;
-     *      uint32_t      e_version;
-     *      uint64_t      e_entry;
-     *      uint64_t      e_phoff;
-     *      uint64_t      e_shoff;
-     *      uint32_t      e_flags;
-     *      uint16_t      e_ehsize;
-     *      uint16_t      e_phentsize;
-     *      uint16_t      e_phnum;
-     *      uint16_t      e_shentsize;
-     *      uint16_t      e_shnum;
-     *      uint16_t      e_shstrndx;
-     *  } Elf64_Ehdr;
+     *  Field            ELF64 offset   ELF32 offset
+     *  e_ident[16]           0              0
+     *  e_type                16             16
+     *  e_machine             18             18
+     *  e_version             20             20
+     *  e_entry               24  (8)        24  (4)
+     *  e_phoff               32  (8)        28  (4)
+     *  e_shoff               40  (8)        32  (4)
+     *  e_flags               48             36
+     *  e_ehsize              52             40
+     *  e_phentsize           54             42
+     *  e_phnum               56             44
+     *  e_shentsize           58             46
+     *  e_shnum               60             48
+     *  e_shstrndx            62             50
      * ==================================================================== */
     uint8_t *eh = img;
+    int      asz = is64 ? 8 : 4;                    /* address size */
 
     /* e_ident */
     eh[EI_MAG0]       = ELFMAG0;
     eh[EI_MAG1]       = ELFMAG1;
     eh[EI_MAG2]       = ELFMAG2;
     eh[EI_MAG3]       = ELFMAG3;
-    eh[EI_CLASS]      = ELFCLASS64;
+    eh[EI_CLASS]      = (uint8_t)target->elf_class;
     eh[EI_DATA]       = ELFDATA2LSB;
     eh[EI_VERSION]    = EV_CURRENT;
     eh[EI_OSABI]      = 0;          /* ELFOSABI_NONE (System V) */
     eh[EI_ABIVERSION] = 0;
     /* bytes 9..15 are zero (padding) */
 
-    elf_write_le16(eh + 16, ET_EXEC);               /* e_type       */
-    elf_write_le16(eh + 18, EM_X86_64);              /* e_machine    */
-    elf_write_le32(eh + 20, EV_CURRENT);             /* e_version    */
-    elf_write_le64(eh + 24, entry_vaddr);            /* e_entry      */
-    elf_write_le64(eh + 32, (uint64_t)ELF_EHDR_SIZE); /* e_phoff    */
-    elf_write_le64(eh + 40, 0);                      /* e_shoff (none) */
-    elf_write_le32(eh + 48, 0);                      /* e_flags      */
-    elf_write_le16(eh + 52, ELF_EHDR_SIZE);          /* e_ehsize     */
-    elf_write_le16(eh + 54, ELF_PHDR_SIZE);          /* e_phentsize  */
-    elf_write_le16(eh + 56, 1);                      /* e_phnum      */
-    elf_write_le16(eh + 58, 0);                      /* e_shentsize  */
-    elf_write_le16(eh + 60, 0);                      /* e_shnum      */
-    elf_write_le16(eh + 62, 0);                      /* e_shstrndx (SHN_UNDEF) */
+    elf_write_le16(eh + 16, ET_EXEC);                   /* e_type       */
+    elf_write_le16(eh + 18, target->machine);           /* e_machine    */
+    elf_write_le32(eh + 20, EV_CURRENT);                /* e_version    */
+    elf_write_addr(eh + 24, is64, entry_vaddr);         /* e_entry      */
+    elf_write_addr(eh + 24 + asz, is64, ehdr_size);     /* e_phoff      */
+    elf_write_addr(eh + 24 + 2 * asz, is64, shoff);     /* e_shoff      */
+
+    uint8_t *ef = eh + 24 + 3 * asz;
+    elf_write_le32(ef +  0, target->flags);             /* e_flags      */
+    elf_write_le16(ef +  4, (uint16_t)ehdr_size);       /* e_ehsize     */
+    elf_write_le16(ef +  6, (uint16_t)phdr_size);       /* e_phentsize  */
+    elf_write_le16(ef +  8, (uint16_t)nseg);            /* e_phnum      */
+    elf_write_le16(ef + 10, (uint16_t)shdr_size);       /* e_shentsize  */
+    elf_write_le16(ef + 12, (uint16_t)nsec);            /* e_shnum      */
+    elf_write_le16(ef + 14, shstrndx);                  /* e_shstrndx   */
+
+    /* ---- Program headers (right after the ELF header) ----------------- */
+    for (int i = 0; i < nseg; i++)
+        elf_write_phdr(img + ehdr_size + (uint32_t)i * phdr_size, is64,
+                       &segs[i]);
 
     /* ====================================================================
-     *  Program Header (PT_LOAD)  (56 bytes at offset 0x0040)
+     *  Start stub and user code
      *
-     *  Maps the entire file (headers + code) as a single read+execute
-     *  segment.  This is the simplest valid layout.
-     *
-     *  typedef struct {
-     *      uint32_t p_type;
-     *      uint32_t p_flags;
-     *      uint64_t p_offset;
-     *      uint64_t p_vaddr;
-     *      uint64_t p_paddr;
-     *      uint64_t p_filesz;
-     *      uint64_t p_memsz;
-     *      uint64_t p_align;
-     *  } Elf64_Phdr;
+     *  The stub ends where the user code begins; any alignment padding
+     *  sits between the program headers and the stub.  The user's HLT
+     *  (a return) comes back into the stub, which exits with R0.
      * ==================================================================== */
-    uint8_t *ph = img + ELF_EHDR_SIZE;
-
-    elf_write_le32(ph +  0, PT_LOAD);                /* p_type       */
-    elf_write_le32(ph +  4, PF_R | PF_X);            /* p_flags      */
-    elf_write_le64(ph +  8, 0);                      /* p_offset (whole file) */
-    elf_write_le64(ph + 16, ELF_BASE_ADDR);          /* p_vaddr      */
-    elf_write_le64(ph + 24, ELF_BASE_ADDR);          /* p_paddr      */
-    elf_write_le64(ph + 32, (uint64_t)total_file_size); /* p_filesz  */
-    elf_write_le64(ph + 40, (uint64_t)total_file_size); /* p_memsz   */
-    elf_write_le64(ph + 48, 0x200000ULL);            /* p_align (2 MB) */
-
-    /* ====================================================================
-     *  Segment Data  (at file offset 0x0078)
-     *
-     *  Layout:
-     *    [0]    CALL stub (5 bytes) — calls user code
-     *    [5]    User machine code
-     *    [5+N]  Exit stub (12 bytes) — sys_exit(rax)
-     *
-     *  The user's HLT → RET returns from the CALL, and execution falls
-     *  through to the exit stub.
-     * ==================================================================== */
-    uint8_t *seg = img + ELF_HEADER_SIZE;
-
-    /* ---- Call stub: E8 <rel32> ---------------------------------------- */
-    /* Call target = user code start, which is 5 bytes after the CALL.
-     * But since CALL rel32 is relative to the *next* instruction,
-     * the rel32 offset is 0 (user code immediately follows the stub). */
-    seg[0] = 0xE8;              /* CALL rel32 */
-    elf_write_le32(seg + 1, 0); /* rel32 = 0 → next instruction = user code */
-
-    /* ---- User code ---------------------------------------------------- */
-    memcpy(seg + ELF_CALL_STUB_SIZE, code->bytes, user_code_size);
-
-    /* ---- Exit stub ---------------------------------------------------- */
-    uint8_t *ex = seg + ELF_CALL_STUB_SIZE + user_code_size;
-
-    /* mov rdi, rax  (48 89 C7) */
-    ex[0] = 0x48;
-    ex[1] = 0x89;
-    ex[2] = 0xC7;
-
-    /* mov eax, 60   (B8 3C 00 00 00) — __NR_exit */
-    ex[3] = 0xB8;
-    elf_write_le32(ex + 4, 60);
-
-    /* syscall       (0F 05) */
-    ex[8] = 0x0F;
-    ex[9] = 0x05;
-
-    /* jmp $         (EB FE) — infinite loop as safety net */
-    ex[10] = 0xEB;
-    ex[11] = 0xFE;
-
-    /* ====================================================================
-     *  Write file
-     * ==================================================================== */
-    FILE *fp = fopen(filename, "wb");
-    if (!fp) {
-        fprintf(stderr, "ELF emitter: cannot open '%s' for writing: ", filename);
-        perror(NULL);
-        free(img);
-        return 1;
-    }
-
-    size_t written = fwrite(img, 1, total_file_size, fp);
-    fclose(fp);
-    free(img);
-
-    if (written != total_file_size) {
-        fprintf(stderr, "ELF emitter: short write (%zu of %u bytes).\n",
-                written, total_file_size);
-        return 1;
+    memcpy(img + stub_off, target->start_stub,
+           (size_t)target->start_stub_size);
+    memcpy(img + user_off, code->bytes, user_code_size);
+
+    /* ---- Non-loaded sections and the section header table ------------- */
+    for (int i = 0; i < nsec; i++) {
+        if (secs[i].content && secs[i].size > 0)
+            memcpy(img + secs[i].offset, secs[i].content->data,
+                   (size_t)secs[i].size);
+        elf_write_shdr(img + shoff + (uint64_t)i * shdr_size, is64, &secs[i]);
     }
+    free(shstrtab.data); free(symtab.data); free(strtab.data);
+    free(abbrev.data);   free(info.data);   free(lines.data);
 
-    fprintf(stderr, "[ELF] Wrote %u bytes to %s\n", total_file_size, filename);
+    *image      = img;
+    *file_size  = (int)total;
     return 0;
 }
@@ -4,20 +4,29 @@
  *  ELF (Executable and Linkable Format) Emitter
  *
  *  File:    emitter_elf.h
- *  Purpose: Public interface for emitting a minimal 64-bit Linux ELF
- *           executable from a raw x86-64 machine-code buffer.
+ *  Purpose: Public interface for emitting a minimal static Linux ELF
+ *           executable from a raw machine-code buffer.
  *
- *  The emitter constructs a valid ELF64 executable from scratch using
- *  only standard C and <stdint.h>.  No Linux headers required to build.
+ *  The emitter constructs a valid ELF32 or ELF64 executable from scratch
+ *  using only standard C and <stdint.h>.  No Linux headers required to
+ *  build.  Everything that depends on the instruction set — ELF class,
+ *  e_machine, e_flags, load address, entry alignment and the start stub —
+ *  comes from the backend as an ElfTarget.
  *
  *  Memory layout of the generated ELF:
  *
- *    File offset  0x0000 .. 0x0077   ELF header   (64 bytes)
- *    File offset  0x0040 .. 0x00B7   Program header (56 bytes, LOAD)
- *    File offset  0x0078 ..          .text segment (user machine code)
+ *    File offset  0                  ELF header   (52 / 64 bytes)
+ *    File offset  e_ehsize ..        Program headers (32 / 56 bytes each)
+ *    File offset  U - stub ..        start stub (calls the code, then exits)
+ *    File offset  U ..               code, strings, VARs
+ *    then                            symbols, -g line table, section
+ *                                    names and the section headers
  *
- *    Virtual addr 0x00400000         Base address
- *    Virtual addr 0x00400078         Entry point  (.text)
+ *    Virtual addr base               Load address  (ElfTarget.base_addr)
+ *    Virtual addr base + U - stub    Entry point   (text)
+ *    Virtual addr base + U           User code     (elf_code_origin())
+ *                 + ELF_SEGMENT_GAP  strings       (rodata)
+ *                 + 2 × the gap      VARs and bss  (data)
  *
  *  License: MIT
  * =============================================================================
@@ -29,17 +38,76 @@
 #include "codegen.h"    /* CodeBuffer */
 
 /*
- * emit_elf_exe()
+ * ELF_SEGMENT_GAP
+ *   Run-time distance the backends put between code, strings and data
+ *   (CodeBuffer.seg_gap) for ELF output.  64 KiB is a multiple of every
+ *   Linux page size, so each part gets pages of its own.
+ */
+#define ELF_SEGMENT_GAP  0x10000
+
+/* ELF class (e_ident[EI_CLASS]) */
+#define ELF_CLASS32      1
+#define ELF_CLASS64      2
+
+/* e_machine values of the backends */
+#define ELF_EM_386       3
+#define ELF_EM_ARM       40
+#define ELF_EM_X86_64    62
+#define ELF_EM_AARCH64   183
+#define ELF_EM_RISCV     243
+
+/*
+ * ElfTarget
+ *   What the ELF emitter needs to know about a backend's instruction
+ *   set.  Each backend that can target Linux returns one from its
+ *   elf_target_<arch>() function.
+ *
+ *   The start stub is placed right before the user code.  It calls the
+ *   code that follows it (HLT returns like a function) and passes R0 to
+ *   the exit system call.
+ */
+typedef struct {
+    int             elf_class;      /* ELF_CLASS32 / ELF_CLASS64          */
+    uint16_t        machine;        /* e_machine                          */
+    uint32_t        flags;          /* e_flags (ABI version, float ABI)   */
+    uint32_t        base_addr;      /* virtual address of file offset 0   */
+    uint32_t        entry_align;    /* alignment of the user code (and
+                                       of the entry when the stub size
+                                       is a multiple of it)              */
+    const uint8_t  *start_stub;     /* call user code, exit(R0)           */
+    int             start_stub_size;
+} ElfTarget;
+
+/*
+ * elf_code_origin()
+ *   Run-time address of the first user-code byte (CodeBuffer bytes[0])
+ *   in an executable for `target`.  Backends that address strings and
+ *   VARs absolutely add it to every data address.
+ */
+uint32_t elf_code_origin(const ElfTarget *target);
+
+/*
+ * emit_elf_image()
+ *
+ *   Build a minimal static Linux ELF executable for `target` from a raw
+ *   machine-code buffer.  On success `*image` receives the malloc()ed
+ *   file contents (the caller frees it) and `*file_size` their length.
  *
- *   Build a minimal 64-bit Linux ELF executable from a raw machine-code
- *   buffer and write it to 'filename'.
+ *   The ELF contains an ELF header of the target's class plus up to
+ *   three PT_LOAD program headers: code read+execute, strings read-only and VARs/bss
+ *   read+write, as laid out by the backend with CodeBuffer.seg_gap.
+ *   A buffer without a gap is mapped as one segment.
  *
- *   The ELF contains an ELF64 header plus a single PT_LOAD program header
- *   that maps the code as read+execute at virtual address 0x00400078.
- *   The generated code must end with a proper exit sequence (e.g. syscall).
+ *   Section headers follow, with a symbol table: _start and every label
+ *   in CodeBuffer.functions as a sized function, the other code labels
+ *   as local symbols.  With `debug_lines` the image also gets a DWARF
+ *   .debug_line built from CodeBuffer.lines, and the compile unit that
+ *   tools look it up through.
  *
- *   Returns 0 on success, non-zero on error (diagnostics to stderr).
+ *   Returns 0 on success, non-zero on error (diagnostics to `diag`).
  */
-int emit_elf_exe(const char *filename, const CodeBuffer *code);
+int emit_elf_image(const CodeBuffer *code, const ElfTarget *target,
+                   int debug_lines, uint8_t **image, int *file_size,
+                   UaDiag *diag);
 
 #endif /* UA_EMITTER_ELF_H */
@@ -15,12 +15,14 @@
  *  │  ───────────     ──────────────────────────────────────             │
  *  │  0x0000          mach_header_64           (32 bytes)               │
  *  │  0x0020          LC_SEGMENT_64 __PAGEZERO (72 bytes)               │
- *  │  0x0068          LC_SEGMENT_64 __TEXT     (72 + 80 = 152 bytes)    │
- *  │  0x0100          LC_MAIN                  (24 bytes)               │
+ *  │  0x0068          LC_SEGMENT_64 __TEXT     (72 + 80 = 152 bytes,    │
+ *  │                                            + 80 with __bss)        │
+ *  │  ...             LC_MAIN                  (24 bytes)               │
  *  │  <page-aligned>  __text section content:                           │
  *  │                    [BL user_code]  (4 bytes)  – call stub          │
- *  │                    [user code ...]             – backend output    │
  *  │                    [exit stub]     (16 bytes)  – SYS_exit(X0)      │
+ *  │                    [user code ...]             – backend output    │
+ *  │  (memory only)   __bss zerofill section        – zeroed storage    │
  *  │                                                                    │
  *  │  macOS AArch64 exit syscall:                                       │
  *  │    MOV X16, #1     ; SYS_exit                                      │
@@ -29,11 +31,13 @@
  *  │    BRK #0          ; alignment padding                             │
  *  │                                                                    │
  *  │  Call stub:                                                        │
- *  │    BL +1           ; branch-with-link to user code (rel offset)    │
- *  │    → falls through to exit stub on return                          │
+ *  │    BL +5           ; branch-with-link over the exit stub           │
+ *  │    → returns into the exit stub                                    │
  *  │                                                                    │
  *  │  This way the user's HLT → RET returns from the BL, and           │
  *  │  execution falls through to the exit stub with X0 intact.          │
+ *  │  The user code ends the file so that its zero-initialised storage  │
+ *  │  directly follows it in memory; __TEXT's vmsize covers it.         │
  *  │                                                                    │
  *  │  Virtual address base: 0x100000000  (standard macOS 64-bit)        │
  *  └──────────────────────────────────────────────────────────────────────┘
@@ -81,6 +85,7 @@
 
 /* Section type */
 #define S_REGULAR                   0x00000000u
+#define S_ZEROFILL                  0x00000001u
 #define S_ATTR_PURE_INSTRUCTIONS    0x80000000u
 #define S_ATTR_SOME_INSTRUCTIONS    0x00000400u
 
@@ -145,12 +150,13 @@ static uint64_t align_up(uint64_t val, uint64_t alignment)
 }
 
 /* =========================================================================
- *  emit_macho_exe()
+ *  emit_macho_image()
  * ========================================================================= */
-int emit_macho_exe(const char *filename, const CodeBuffer *code)
+int emit_macho_image(const CodeBuffer *code, uint8_t **image,
+                     int *file_size, UaDiag *diag)
 {
     if (!code || code->size == 0) {
-        fprintf(stderr, "Mach-O emitter: no code to emit.\n");
+        diag_printf(diag, "Mach-O emitter: no code to emit.\n");
         return 1;
     }
 
@@ -170,11 +176,15 @@ int emit_macho_exe(const char *filename, const CodeBuffer *code)
     /* Number of load commands */
     uint32_t ncmds = 4;  /* __PAGEZERO, __TEXT, LC_MAIN, LC_LOAD_DYLINKER */
 
+    /* Zero-initialised storage becomes a __bss zerofill section */
+    uint32_t bss_size = (uint32_t)code->bss_size;
+    uint32_t nsects   = bss_size > 0 ? 2 : 1;
+
     /* Total header + load commands size */
     uint32_t header_and_cmds_size = MACH_HEADER_64_SIZE
                                   + SEGMENT_CMD_64_SIZE       /* __PAGEZERO */
                                   + SEGMENT_CMD_64_SIZE       /* __TEXT */
-                                  + SECTION_64_SIZE           /* __text sect */
+                                  + SECTION_64_SIZE * nsects  /* __text [__bss] */
                                   + LC_MAIN_SIZE
                                   + lc_dylinker_size;
 
@@ -182,18 +192,20 @@ int emit_macho_exe(const char *filename, const CodeBuffer *code)
     uint32_t text_file_offset = (uint32_t)align_up(header_and_cmds_size,
                                                     MACHO_PAGE_SIZE);
 
-    /* Segment content = call stub + user code + exit stub */
+    /* Segment content = call stub + exit stub + user code */
     uint32_t user_code_size  = (uint32_t)code->size;
-    uint32_t segment_content = MACHO_CALL_STUB_SIZE + user_code_size
-                             + MACHO_EXIT_STUB_SIZE;
+    uint32_t segment_content = MACHO_CALL_STUB_SIZE + MACHO_EXIT_STUB_SIZE
+                             + user_code_size;
 
     /* Total file size: header/cmds padding + segment content, page-aligned */
     uint32_t total_file_size = text_file_offset + segment_content;
 
     /* __TEXT segment covers from file offset 0 to end — this is the standard
-     * macOS layout (the load commands are part of the __TEXT segment). */
+     * macOS layout (the load commands are part of the __TEXT segment).
+     * Its vmsize also covers the __bss, which is not in the file. */
     uint64_t text_seg_vmaddr  = MACHO_BASE_ADDR;
-    uint64_t text_seg_vmsize  = align_up(total_file_size, MACHO_PAGE_SIZE);
+    uint64_t text_seg_vmsize  = align_up((uint64_t)total_file_size + bss_size,
+                                         MACHO_PAGE_SIZE);
     uint64_t text_seg_fileoff = 0;
     uint64_t text_seg_filesz  = (uint64_t)total_file_size;
 
@@ -207,20 +219,23 @@ int emit_macho_exe(const char *filename, const CodeBuffer *code)
     /* sizeofcmds = total bytes of all load commands (without mach_header) */
     uint32_t sizeofcmds = header_and_cmds_size - MACH_HEADER_64_SIZE;
 
-    fprintf(stderr, "[Mach-O] User code size    : %u bytes\n", user_code_size);
-    fprintf(stderr, "[Mach-O] Segment content   : %u bytes (stub + code + exit)\n",
-            segment_content);
-    fprintf(stderr, "[Mach-O] Text file offset  : 0x%X\n", text_file_offset);
-    fprintf(stderr, "[Mach-O] Entry offset      : 0x%llX\n",
-            (unsigned long long)entry_off);
-    fprintf(stderr, "[Mach-O] Total file size   : %u bytes\n", total_file_size);
+    diag_log(diag, DIAG_VERBOSE, "[Mach-O] User code size    : %u bytes\n", user_code_size);
+    diag_log(diag, DIAG_VERBOSE, "[Mach-O] Segment content   : %u bytes (stub + exit + code)\n",
+             segment_content);
+    if (bss_size > 0)
+        diag_log(diag, DIAG_VERBOSE, "[Mach-O] BSS size          : %u bytes (not stored)\n",
+                 bss_size);
+    diag_log(diag, DIAG_VERBOSE, "[Mach-O] Text file offset  : 0x%X\n", text_file_offset);
+    diag_log(diag, DIAG_VERBOSE, "[Mach-O] Entry offset      : 0x%llX\n",
+             (unsigned long long)entry_off);
+    diag_log(diag, DIAG_VERBOSE, "[Mach-O] Total file size   : %u bytes\n", total_file_size);
 
     /* ================================================================
      *  Allocate zero-filled file image
      * ================================================================ */
     uint8_t *img = (uint8_t *)calloc(1, total_file_size);
     if (!img) {
-        fprintf(stderr, "Mach-O emitter: out of memory.\n");
+        diag_printf(diag, "Mach-O emitter: out of memory.\n");
         return 1;
     }
 
@@ -284,12 +299,13 @@ int emit_macho_exe(const char *filename, const CodeBuffer *code)
     off += SEGMENT_CMD_64_SIZE;
 
     /* ================================================================
-     *  LC_SEGMENT_64: __TEXT  (72 + 80 = 152 bytes, includes 1 section)
+     *  LC_SEGMENT_64: __TEXT  (72 + 80 bytes per section)
      *
-     *  Contains the load commands (as part of the mapping) and the
-     *  __text section with executable code.
+     *  Contains the load commands (as part of the mapping), the
+     *  __text section with executable code and, when the program has
+     *  zero-initialised storage, the __bss section right after it.
      * ================================================================ */
-    uint32_t text_seg_cmd_size = SEGMENT_CMD_64_SIZE + SECTION_64_SIZE;
+    uint32_t text_seg_cmd_size = SEGMENT_CMD_64_SIZE + SECTION_64_SIZE * nsects;
 
     macho_write_le32(img + off +  0, LC_SEGMENT_64);
     macho_write_le32(img + off +  4, text_seg_cmd_size);
@@ -300,7 +316,7 @@ int emit_macho_exe(const char *filename, const CodeBuffer *code)
     macho_write_le64(img + off + 48, text_seg_filesz);
     macho_write_le32(img + off + 56, VM_PROT_READ | VM_PROT_EXECUTE);
     macho_write_le32(img + off + 60, VM_PROT_READ | VM_PROT_EXECUTE);
-    macho_write_le32(img + off + 64, 1);    /* nsects = 1 (__text) */
+    macho_write_le32(img + off + 64, nsects); /* __text [+ __bss] */
     macho_write_le32(img + off + 68, 0);    /* flags */
     off += SEGMENT_CMD_64_SIZE;
 
@@ -337,6 +353,23 @@ int emit_macho_exe(const char *filename, const CodeBuffer *code)
     macho_write_le32(img + off + 76, 0);        /* reserved3 */
     off += SECTION_64_SIZE;
 
+    /* ---- __bss section header  (80 bytes, zerofill: offset = 0) ------- */
+    if (bss_size > 0) {
+        memcpy(img + off +  0, "__bss\0\0\0\0\0\0\0\0\0\0\0", 16);
+        memcpy(img + off + 16, "__TEXT\0\0\0\0\0\0\0\0\0\0\0", 16);
+        macho_write_le64(img + off + 32, text_sect_addr + segment_content);
+        macho_write_le64(img + off + 40, (uint64_t)bss_size);
+        macho_write_le32(img + off + 48, 0);    /* offset: not in the file */
+        macho_write_le32(img + off + 52, 0);    /* align = 2^0 */
+        macho_write_le32(img + off + 56, 0);    /* reloff */
+        macho_write_le32(img + off + 60, 0);    /* nreloc */
+        macho_write_le32(img + off + 64, S_ZEROFILL);
+        macho_write_le32(img + off + 68, 0);    /* reserved1 */
+        macho_write_le32(img + off + 72, 0);    /* reserved2 */
+        macho_write_le32(img + off + 76, 0);    /* reserved3 */
+        off += SECTION_64_SIZE;
+    }
+
     /* ================================================================
      *  LC_MAIN  (24 bytes)
      *
@@ -375,55 +408,33 @@ int emit_macho_exe(const char *filename, const CodeBuffer *code)
      *
      *  Layout:
      *    [0]    BL stub (4 bytes) — calls user code
-     *    [4]    User machine code
-     *    [4+N]  Exit stub (16 bytes) — SYS_exit(X0)
+     *    [4]    Exit stub (16 bytes) — SYS_exit(X0)
+     *    [20]   User machine code, followed in memory by the __bss
      *
-     *  The user's HLT → RET returns from the BL, and execution falls
-     *  through to the exit stub with X0 intact.
+     *  The user's HLT → RET returns from the BL into the exit stub
+     *  with X0 intact.
      * ================================================================ */
     uint8_t *text = img + text_file_offset;
 
     /* ---- Call stub: BL user_code -----------------------------------
-     * BL offset: the user code starts 4 bytes after the BL instruction.
+     * BL offset: the user code starts after the BL and the exit stub.
      * BL encoding: 1001 01 imm26, where imm26 = offset/4.
-     * offset = +4 bytes (next instruction), imm26 = 1.                */
+     * offset = +20 bytes, imm26 = 5.                                  */
     {
-        int32_t bl_offset = MACHO_CALL_STUB_SIZE;  /* +4 bytes */
+        int32_t bl_offset = MACHO_CALL_STUB_SIZE + MACHO_EXIT_STUB_SIZE;
         int32_t imm26 = (bl_offset >> 2) & 0x03FFFFFF;
         uint32_t bl_word = (0x25u << 26) | (uint32_t)imm26;
         macho_write_le32(text, bl_word);
     }
 
-    /* ---- User code ------------------------------------------------- */
-    memcpy(text + MACHO_CALL_STUB_SIZE, code->bytes, user_code_size);
-
     /* ---- Exit stub ------------------------------------------------- */
-    memcpy(text + MACHO_CALL_STUB_SIZE + user_code_size,
-           MACHO_EXIT_STUB, MACHO_EXIT_STUB_SIZE);
-
-    /* ================================================================
-     *  Write file
-     * ================================================================ */
-    FILE *fp = fopen(filename, "wb");
-    if (!fp) {
-        fprintf(stderr, "Mach-O emitter: cannot open '%s' for writing: ",
-                filename);
-        perror(NULL);
-        free(img);
-        return 1;
-    }
+    memcpy(text + MACHO_CALL_STUB_SIZE, MACHO_EXIT_STUB, MACHO_EXIT_STUB_SIZE);
 
-    size_t written = fwrite(img, 1, total_file_size, fp);
-    fclose(fp);
-    free(img);
-
-    if (written != total_file_size) {
-        fprintf(stderr, "Mach-O emitter: short write (%zu of %u bytes).\n",
-                written, total_file_size);
-        return 1;
-    }
+    /* ---- User code ------------------------------------------------- */
+    memcpy(text + MACHO_CALL_STUB_SIZE + MACHO_EXIT_STUB_SIZE,
+           code->bytes, user_code_size);
 
-    fprintf(stderr, "[Mach-O] Wrote %u bytes to %s\n",
-            total_file_size, filename);
+    *image      = img;
+    *file_size  = (int)total_file_size;
     return 0;
 }
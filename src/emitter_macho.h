@@ -36,13 +36,15 @@
 #include "codegen.h"    /* CodeBuffer */
 
 /*
- * emit_macho_exe()
+ * emit_macho_image()
  *
- *   Writes a minimal Mach-O 64-bit executable to disk.
+ *   Builds a minimal Mach-O 64-bit executable in memory.
  *
  *   Parameters:
- *     filename – output file path
- *     code     – raw AArch64 machine code from the ARM64 backend
+ *     code       – raw AArch64 machine code from the ARM64 backend
+ *     image      – [out] malloc()ed file contents (caller frees)
+ *     file_size  – [out] length of *image
+ *     diag       – sink for diagnostics
  *
  *   Returns:
  *     0 on success, non-zero on failure.
@@ -60,6 +62,7 @@
  *         MOV X16, #1          ; SYS_exit
  *         SVC #0x80            ; supervisor call
  */
-int emit_macho_exe(const char *filename, const CodeBuffer *code);
+int emit_macho_image(const CodeBuffer *code, uint8_t **image,
+                     int *file_size, UaDiag *diag);
 
 #endif /* UA_EMITTER_MACHO_H */
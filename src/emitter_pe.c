@@ -14,10 +14,15 @@
  *    - Configures data directories for the Windows loader
  *    - Marks .text as RWX so the loader can patch the IAT
  *
+ *  Zero-initialised storage (code->bss_size bytes: uninitialised VARs
+ *  and BUFFERs) is not written to the file.  It extends .text in memory
+ *  only — VirtualSize > SizeOfRawData — and the loader zero-fills it;
+ *  .text is then writable as well.
+ *
  *  Layout (with imports):
  *
  *    0x0000       Headers (DOS + NT + 2 section headers)
- *    0x0200       .text  (code + vars + strings + stubs + IAT)
+ *    0x0200       .text  (code + vars + strings + stubs + IAT) [+ bss]
  *    0x0200+N     .idata (ILT + IDT + HintName + DLL name)
  *
  *  License: MIT
@@ -101,12 +106,13 @@ static void write_le64(uint8_t *p, uint64_t v)
 }
 
 /* =========================================================================
- *  emit_pe_exe()
+ *  emit_pe_image()
  * ========================================================================= */
-int emit_pe_exe(const char *filename, const CodeBuffer *code)
+int emit_pe_image(const CodeBuffer *code, uint8_t **image,
+                  int *file_size, UaDiag *diag)
 {
     if (!code || code->size == 0) {
-        fprintf(stderr, "PE emitter: no code to emit.\n");
+        diag_printf(diag, "PE emitter: no code to emit.\n");
         return 1;
     }
 
@@ -115,8 +121,10 @@ int emit_pe_exe(const char *filename, const CodeBuffer *code)
 
     /* ---- Compute .text sizes ------------------------------------------ */
     uint32_t text_raw_size     = (uint32_t)code->size;
+    uint32_t text_bss_size     = (uint32_t)code->bss_size;
     uint32_t text_file_size    = align_up(text_raw_size, PE_FILE_ALIGNMENT);
-    uint32_t text_virtual_size = align_up(text_raw_size, PE_SECTION_ALIGNMENT);
+    uint32_t text_virtual_size = align_up(text_raw_size + text_bss_size,
+                                          PE_SECTION_ALIGNMENT);
 
     /* ---- Compute .idata sizes (if imports present) -------------------- */
     uint32_t idata_rva          = 0;
@@ -148,20 +156,23 @@ int emit_pe_exe(const char *filename, const CodeBuffer *code)
     uint32_t opt_hdr_size   = 24 + 88 + num_data_dirs * 8;   /* = 240 */
     uint32_t sect_hdr_off   = 0x58 + opt_hdr_size;           /* = 0x148 */
 
-    fprintf(stderr, "[PE] .text raw size  : %u bytes\n", text_raw_size);
+    diag_log(diag, DIAG_VERBOSE, "[PE] .text raw size  : %u bytes\n", text_raw_size);
+    if (text_bss_size > 0)
+        diag_log(diag, DIAG_VERBOSE, "[PE] .text bss size  : %u bytes (not stored)\n",
+                 text_bss_size);
     if (has_imports) {
-        fprintf(stderr, "[PE] .idata raw size : %u bytes\n", idata_raw_size);
-        fprintf(stderr, "[PE] IAT offset      : %u (RVA 0x%X)\n",
-                code->pe_iat_offset,
-                PE_TEXT_RVA + (uint32_t)code->pe_iat_offset);
+        diag_log(diag, DIAG_VERBOSE, "[PE] .idata raw size : %u bytes\n", idata_raw_size);
+        diag_log(diag, DIAG_VERBOSE, "[PE] IAT offset      : %u (RVA 0x%X)\n",
+                 code->pe_iat_offset,
+                 PE_TEXT_RVA + (uint32_t)code->pe_iat_offset);
     }
-    fprintf(stderr, "[PE] Image size      : 0x%X\n", image_size);
-    fprintf(stderr, "[PE] Total file size : %u bytes\n", total_file_size);
+    diag_log(diag, DIAG_VERBOSE, "[PE] Image size      : 0x%X\n", image_size);
+    diag_log(diag, DIAG_VERBOSE, "[PE] Total file size : %u bytes\n", total_file_size);
 
     /* ---- Allocate a zero-filled file image ----------------------------- */
     uint8_t *img = (uint8_t *)calloc(1, total_file_size);
     if (!img) {
-        fprintf(stderr, "PE emitter: out of memory.\n");
+        diag_printf(diag, "PE emitter: out of memory.\n");
         return 1;
     }
 
@@ -204,7 +215,7 @@ int emit_pe_exe(const char *filename, const CodeBuffer *code)
     oh[2] = 1;  oh[3] = 0;
     write_le32(oh +  4, text_file_size);       /* SizeOfCode            */
     write_le32(oh +  8, has_imports ? idata_file_size : 0); /* SizeOfInitializedData */
-    write_le32(oh + 12, 0);                    /* SizeOfUninitializedData */
+    write_le32(oh + 12, text_bss_size);        /* SizeOfUninitializedData */
     write_le32(oh + 16, PE_TEXT_RVA);          /* AddressOfEntryPoint   */
     write_le32(oh + 20, PE_TEXT_RVA);          /* BaseOfCode            */
 
@@ -249,7 +260,7 @@ int emit_pe_exe(const char *filename, const CodeBuffer *code)
     /* ---- .text -------------------------------------------------------- */
     uint8_t *sh0 = img + sect_hdr_off;
     memcpy(sh0, ".text\0\0\0", 8);
-    write_le32(sh0 +  8, text_raw_size);       /* VirtualSize           */
+    write_le32(sh0 +  8, text_raw_size + text_bss_size); /* VirtualSize */
     write_le32(sh0 + 12, PE_TEXT_RVA);         /* VirtualAddress        */
     write_le32(sh0 + 16, text_file_size);      /* SizeOfRawData         */
     write_le32(sh0 + 20, PE_SIZE_OF_HEADERS);  /* PointerToRawData      */
@@ -257,8 +268,10 @@ int emit_pe_exe(const char *filename, const CodeBuffer *code)
     write_le32(sh0 + 28, 0);
     write_le16(sh0 + 32, 0);
     write_le16(sh0 + 34, 0);
-    /* Characteristics: CODE | EXECUTE | READ (+ WRITE if IAT in .text) */
-    write_le32(sh0 + 36, has_imports ? 0xE0000020u : 0x60000020u);
+    /* Characteristics: CODE | EXECUTE | READ
+     * (+ WRITE if the IAT or zero-initialised storage is in .text) */
+    write_le32(sh0 + 36, (has_imports || text_bss_size > 0)
+                         ? 0xE0000020u : 0x60000020u);
 
     /* ---- .idata (only when we have imports) --------------------------- */
     if (has_imports) {
@@ -345,27 +358,7 @@ int emit_pe_exe(const char *filename, const CodeBuffer *code)
         write_le64(iat + 48, 0);  /* null terminator */
     }
 
-    /* ====================================================================
-     *  Write file
-     * ==================================================================== */
-    FILE *fp = fopen(filename, "wb");
-    if (!fp) {
-        fprintf(stderr, "PE emitter: cannot open '%s' for writing: ", filename);
-        perror(NULL);
-        free(img);
-        return 1;
-    }
-
-    size_t written = fwrite(img, 1, total_file_size, fp);
-    fclose(fp);
-    free(img);
-
-    if (written != total_file_size) {
-        fprintf(stderr, "PE emitter: short write (%zu of %u bytes).\n",
-                written, total_file_size);
-        return 1;
-    }
-
-    fprintf(stderr, "[PE] Wrote %u bytes to %s\n", total_file_size, filename);
+    *image      = img;
+    *file_size  = (int)total_file_size;
     return 0;
 }
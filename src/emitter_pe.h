@@ -27,12 +27,15 @@
 #include "codegen.h"    /* CodeBuffer */
 
 /*
- * emit_pe_exe()
- *   Write a minimal 64-bit Windows PE executable to `filename`.
- *   The `.text` section contains the raw bytes from `code`.
+ * emit_pe_image()
+ *   Build a minimal 64-bit Windows PE executable in memory.
+ *   The `.text` section contains the raw bytes from `code`.  On success
+ *   `*image` receives the malloc()ed file contents (the caller frees it)
+ *   and `*file_size` their length.
  *
- *   Returns 0 on success, non-zero on failure (diagnostic on stderr).
+ *   Returns 0 on success, non-zero on failure (diagnostic on `diag`).
  */
-int emit_pe_exe(const char *filename, const CodeBuffer *code);
+int emit_pe_image(const CodeBuffer *code, uint8_t **image,
+                  int *file_size, UaDiag *diag);
 
 #endif /* UA_EMITTER_PE_H */
@@ -0,0 +1,311 @@
+/*
+ * =============================================================================
+ *  UA - Unified Assembler
+ *  Dead-Code Elimination of Imported Code (call-graph GC)
+ *
+ *  File:    gc.c
+ *  Purpose: Reachability over the IR's label graph; unreachable imported
+ *           blocks and unnamed imported data are compacted out.  See
+ *           gc.h for the overview.
+ *
+ *  A block starts at every label (and at offset 0) and runs to the next
+ *  label.  Marking is a worklist over blocks, so the pass is linear in
+ *  the IR size plus the number of label operands.
+ *
+ *  License: MIT
+ * =============================================================================
+ */
+
+#include "gc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Per-name flags (indexed by StrId) */
+#define GC_NAMED_LIVE   0x01    /* operand of an instruction that stays    */
+#define GC_JUMP_TARGET  0x02    /* JMP / Jcc / DJNZ / CJNE target anywhere */
+#define GC_CALL_TARGET  0x04    /* CALL target or function label anywhere  */
+#define GC_STR_LIVE     0x08    /* LDS literal loaded by surviving code    */
+#define GC_STR_DEAD     0x10    /* LDS literal loaded by removed code      */
+
+typedef struct {
+    int first, last;            /* IR index range (inclusive)             */
+    int imported;               /* starts with a namespaced label         */
+    int live;
+} GcBlock;
+
+/* =========================================================================
+ *  Instruction helpers
+ * ========================================================================= */
+static int gc_ends_flow(const Instruction *inst)
+{
+    if (inst->is_label) return 0;
+    switch (inst->opcode) {
+        case OP_JMP: case OP_RET: case OP_RETI: case OP_HLT:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int gc_is_branch(const Instruction *inst)
+{
+    if (inst->is_label) return 0;
+    switch (inst->opcode) {
+        case OP_JMP: case OP_JZ: case OP_JNZ: case OP_JL: case OP_JG:
+        case OP_DJNZ: case OP_CJNE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* VAR / BUFFER declaration: operand 0 names the object, it is no use */
+static int gc_is_data(const Instruction *inst)
+{
+    return !inst->is_label && (inst->opcode == OP_VAR ||
+                               inst->opcode == OP_BUFFER);
+}
+
+/* The precompiler qualifies every imported name with its namespace */
+static int gc_imported(const StrPool *strs, StrId id)
+{
+    return strchr(strpool_get(strs, id), '.') != NULL;
+}
+
+/* Append a report entry; returns its index or -1 when out of memory */
+static int gc_add(GcStats *st, GcKind kind, StrId name)
+{
+    if (st->count == st->capacity) {
+        int cap = st->capacity ? st->capacity * 2 : 16;
+        GcDropped *d = (GcDropped *)realloc(st->dropped,
+                                            (size_t)cap * sizeof(GcDropped));
+        if (!d) return -1;
+        st->dropped  = d;
+        st->capacity = cap;
+    }
+    GcDropped *e = &st->dropped[st->count];
+    memset(e, 0, sizeof(*e));
+    e->kind = kind;
+    e->name = name;
+    return st->count++;
+}
+
+/* =========================================================================
+ *  gc_imports()
+ * ========================================================================= */
+int gc_imports(Instruction *ir, int ir_count, const StrPool *strs,
+               GcStats *stats)
+{
+    GcStats local;
+    if (!stats) stats = &local;
+    memset(stats, 0, sizeof(*stats));
+    if (ir_count <= 0) return ir_count;
+
+    int      n        = ir_count;
+    int     *block_at = (int *)malloc((size_t)strs->count * sizeof(int));
+    uint8_t *flags    = (uint8_t *)calloc((size_t)strs->count, 1);
+    int     *block_of = (int *)malloc((size_t)n * sizeof(int));
+    uint8_t *keep     = (uint8_t *)malloc((size_t)n);
+    GcBlock *blocks   = (GcBlock *)malloc((size_t)n * sizeof(GcBlock));
+    int     *work     = (int *)malloc((size_t)n * sizeof(int));
+    if (!block_at || !flags || !block_of || !keep || !blocks || !work) {
+        free(block_at); free(flags); free(block_of); free(keep);
+        free(blocks); free(work);
+        return ir_count;
+    }
+
+    /* ---- Blocks and the whole-program jump / call targets ------------- */
+    for (int s = 0; s < strs->count; s++) block_at[s] = -1;
+
+    int nb = 0;
+    for (int i = 0; i < n; i++) {
+        const Instruction *inst = &ir[i];
+        if (i == 0 || inst->is_label) {
+            if (nb > 0) blocks[nb - 1].last = i - 1;
+            blocks[nb].first    = i;
+            blocks[nb].imported = 0;
+            blocks[nb].live     = 0;
+            nb++;
+        }
+        block_of[i] = nb - 1;
+
+        if (inst->is_label) {
+            if (gc_imported(strs, inst->label_id))
+                blocks[nb - 1].imported = 1;
+            if (block_at[inst->label_id] < 0)
+                block_at[inst->label_id] = nb - 1;
+            if (inst->is_function)
+                flags[inst->label_id] |= GC_CALL_TARGET;
+        } else if (inst->opcode == OP_CALL &&
+                   inst->operands[0].type == OPERAND_LABEL_REF) {
+            flags[inst->operands[0].data.label_id] |= GC_CALL_TARGET;
+        } else if (gc_is_branch(inst)) {
+            for (int k = 0; k < inst->operand_count; k++) {
+                if (inst->operands[k].type == OPERAND_LABEL_REF)
+                    flags[inst->operands[k].data.label_id] |= GC_JUMP_TARGET;
+            }
+        }
+    }
+    blocks[nb - 1].last = n - 1;
+
+    /* ---- Roots: offset 0, the main file, ORG-placed code -------------- */
+    int top = 0;
+    for (int b = 0; b < nb; b++) {
+        int root = (b == 0 || !blocks[b].imported);
+        for (int i = blocks[b].first; !root && i <= blocks[b].last; i++) {
+            if (!ir[i].is_label && ir[i].opcode == OP_ORG) root = 1;
+        }
+        if (root) {
+            blocks[b].live = 1;
+            work[top++] = b;
+        }
+    }
+
+    /* ---- Mark: follow label operands and fall-through ----------------- */
+    while (top > 0) {
+        int b = work[--top];
+        int flows = 1;
+
+        for (int i = blocks[b].first; i <= blocks[b].last; i++) {
+            const Instruction *inst = &ir[i];
+            if (inst->is_label || gc_is_data(inst)) continue;
+            flows = !gc_ends_flow(inst);
+
+            for (int k = 0; k < inst->operand_count; k++) {
+                if (inst->operands[k].type != OPERAND_LABEL_REF) continue;
+                StrId id = inst->operands[k].data.label_id;
+                flags[id] |= GC_NAMED_LIVE;
+                int t = block_at[id];
+                if (t >= 0 && !blocks[t].live) {
+                    blocks[t].live = 1;
+                    work[top++] = t;
+                }
+            }
+            /* CALL f(a, b): the arguments may name VARs */
+            for (int p = 0; p < inst->param_count; p++)
+                flags[inst->param_ids[p]] |= GC_NAMED_LIVE;
+        }
+
+        if (flows && b + 1 < nb && !blocks[b + 1].live) {
+            blocks[b + 1].live = 1;
+            work[top++] = b + 1;
+        }
+    }
+
+    /* ---- Decide what stays -------------------------------------------- */
+    for (int i = 0; i < n; i++) {
+        const Instruction *inst = &ir[i];
+        if (gc_is_data(inst)) {
+            StrId id = inst->operands[0].data.label_id;
+            keep[i] = !gc_imported(strs, id) ||
+                      (flags[id] & GC_NAMED_LIVE) != 0;
+        } else {
+            keep[i] = (uint8_t)blocks[block_of[i]].live;
+        }
+        if (!inst->is_label && inst->opcode == OP_LDS)
+            flags[inst->operands[1].data.string_id] |=
+                keep[i] ? GC_STR_LIVE : GC_STR_DEAD;
+    }
+    for (int s = 0; s < strs->count; s++) {
+        if ((flags[s] & (GC_STR_LIVE | GC_STR_DEAD)) == GC_STR_DEAD)
+            stats->strings++;
+    }
+
+    /* ---- Report and compact --------------------------------------------
+     * A dead label opens a new function entry when something CALLs it or
+     * nothing jumps to it; the labels its own loops jump to are folded in. */
+    int cur = -1;
+    int out = 0;
+    for (int i = 0; i < n; i++) {
+        const Instruction *inst = &ir[i];
+        const GcBlock     *blk  = &blocks[block_of[i]];
+
+        if (i == blk->first) {
+            if (blk->live) {
+                cur = -1;
+            } else if (inst->is_label) {
+                uint8_t f = flags[inst->label_id];
+                if (cur < 0 || (f & GC_CALL_TARGET) || !(f & GC_JUMP_TARGET))
+                    cur = gc_add(stats, GC_CODE, inst->label_id);
+            }
+        }
+
+        if (keep[i]) {
+            if (out != i) ir[out] = ir[i];
+            out++;
+            continue;
+        }
+
+        stats->removed++;
+        if (gc_is_data(inst)) {
+            int d = gc_add(stats, inst->opcode == OP_VAR ? GC_VAR : GC_BUFFER,
+                           inst->operands[0].data.label_id);
+            if (d >= 0 && inst->opcode == OP_BUFFER)
+                stats->dropped[d].size = inst->operands[1].data.imm;
+        } else if (!inst->is_label && cur >= 0) {
+            stats->dropped[cur].entries++;
+        }
+    }
+
+    free(block_at); free(flags); free(block_of); free(keep);
+    free(blocks); free(work);
+    if (stats == &local) gc_free_stats(&local);
+    return out;
+}
+
+/* =========================================================================
+ *  gc_print_report()
+ * ========================================================================= */
+void gc_print_report(const GcStats *stats, const StrPool *strs,
+                     UaDiag *diag)
+{
+    int funcs = 0, data = 0;
+
+    diag_printf(diag, "[GC] Unreferenced imported code and data:\n");
+    for (int d = 0; d < stats->count; d++) {
+        const GcDropped *e = &stats->dropped[d];
+        const char *name = strpool_get(strs, e->name);
+        switch (e->kind) {
+        case GC_CODE:
+            funcs++;
+            diag_printf(diag, "[GC]   %-32s %5d IR entr%s\n", name,
+                        e->entries, e->entries == 1 ? "y" : "ies");
+            break;
+        case GC_VAR:
+            data++;
+            diag_printf(diag, "[GC]   %-32s VAR\n", name);
+            break;
+        case GC_BUFFER:
+            data++;
+            diag_printf(diag, "[GC]   %-32s BUFFER, %lld bytes\n", name,
+                        (long long)e->size);
+            break;
+        }
+    }
+    if (stats->strings > 0)
+        diag_printf(diag, "[GC]   %d string literal%s\n", stats->strings,
+                    stats->strings == 1 ? "" : "s");
+    if (stats->count == 0 && stats->strings == 0)
+        diag_printf(diag, "[GC]   (none)\n");
+
+    diag_printf(diag, "[GC] %d function%s, %d VAR/BUFFER%s, %d IR entries "
+                      "removed",
+                funcs, funcs == 1 ? "" : "s", data, data == 1 ? "" : "s",
+                stats->removed);
+    if (stats->bytes_before > 0)
+        diag_printf(diag, "; %d -> %d bytes (%d saved)",
+                    stats->bytes_before, stats->bytes_after,
+                    stats->bytes_before - stats->bytes_after);
+    diag_printf(diag, "\n");
+}
+
+/* =========================================================================
+ *  gc_free_stats()
+ * ========================================================================= */
+void gc_free_stats(GcStats *stats)
+{
+    free(stats->dropped);
+    memset(stats, 0, sizeof(*stats));
+}
@@ -0,0 +1,89 @@
+/*
+ * =============================================================================
+ *  UA - Unified Assembler
+ *  Dead-Code Elimination of Imported Code (call-graph GC)
+ *
+ *  File:    gc.h
+ *  Purpose: Drop the parts of @IMPORTed libraries that the program never
+ *           reaches, so that importing std_string for strlen does not
+ *           also assemble parse_int and to_string.
+ *
+ *  The precompiler prefixes every label, VAR and BUFFER of an imported
+ *  file with its namespace ("std_string.strlen"), so a dotted name marks
+ *  imported code.  The IR is cut into blocks at labels and walked from
+ *  the roots — offset 0, every block of the main file and every block
+ *  holding an ORG — along fall-through and every label operand (JMP,
+ *  Jcc, CALL, DJNZ, CJNE, GET, SET).  Imported blocks never reached are
+ *  removed together with the imported VARs and BUFFERs no surviving
+ *  instruction names; LDS strings vanish with the code that loads them.
+ *
+ *  Code of the main file is always kept: without a reference graph of
+ *  its own, a label there may still be an entry point.
+ *
+ *  License: MIT
+ * =============================================================================
+ */
+
+#ifndef UA_GC_H
+#define UA_GC_H
+
+#include "parser.h"
+
+/* =========================================================================
+ *  Report
+ * ========================================================================= */
+typedef enum {
+    GC_CODE = 0,            /* a function: its label and the blocks that
+                               only it jumps to                          */
+    GC_VAR,
+    GC_BUFFER
+} GcKind;
+
+typedef struct {
+    GcKind   kind;
+    StrId    name;          /* first label / VAR / BUFFER name           */
+    int      entries;       /* IR instructions removed (GC_CODE)         */
+    int64_t  size;          /* BUFFER bytes (GC_BUFFER)                  */
+} GcDropped;
+
+typedef struct {
+    GcDropped *dropped;     /* what was removed, in IR order             */
+    int        count;
+    int        capacity;
+    int        removed;     /* IR entries removed in total (incl. labels) */
+    int        strings;     /* string literals only dead code loaded     */
+
+    /* Filled in by the caller when it measures the saving */
+    int        bytes_before;/* code + data + bss without the GC          */
+    int        bytes_after; /* ... with it                                */
+} GcStats;
+
+/* =========================================================================
+ *  Public API
+ * ========================================================================= */
+
+/*
+ * gc_imports()
+ *   Removes unreachable imported code and unreferenced imported data
+ *   from `ir` in place and returns the new instruction count.  `stats`
+ *   may be NULL; otherwise it must be released with gc_free_stats().
+ *   On allocation failure the IR is left unchanged.
+ */
+int gc_imports(Instruction *ir, int ir_count, const StrPool *strs,
+               GcStats *stats);
+
+/*
+ * gc_print_report()
+ *   Prints one [GC] line per dropped function, VAR and BUFFER, then the
+ *   totals (and the bytes saved when the caller measured them).
+ */
+void gc_print_report(const GcStats *stats, const StrPool *strs,
+                     UaDiag *diag);
+
+/*
+ * gc_free_stats()
+ *   Releases the list held by `stats`.  Safe on a zeroed GcStats.
+ */
+void gc_free_stats(GcStats *stats);
+
+#endif /* UA_GC_H */
@@ -0,0 +1,438 @@
+/*
+ * =============================================================================
+ *  UA - Unified Assembler
+ *  Precompiled Import Cache
+ *
+ *  File:    impcache.c
+ *  Purpose: On-disk entry format, validation and memory mapping.  See
+ *           impcache.h for the overview.
+ *
+ *  Entry file  <dir>/<16 hex digits of the key hash>.uac, little-endian:
+ *
+ *      0   "UAIC"              magic
+ *      4   u32 version         IMPCACHE_FORMAT
+ *      8   u32 key_len         key (compiler version + caller's key)
+ *      12  u32 dep_count
+ *      16  u32 macro_count
+ *      20  u32 line_count
+ *      24  u64 text_len
+ *      32  key bytes
+ *          deps:   u32 imported, u32 path_len, i64 size, i64 mtime,
+ *                  u64 hash, path bytes, NUL
+ *          macros: name NUL value NUL
+ *          lines:  u32 line, u32 file, u32 src_line
+ *          text bytes, NUL
+ *
+ *  The key is stored in full and compared, so a hash collision is a miss.
+ *
+ *  License: MIT
+ * =============================================================================
+ */
+
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE         /* stat(), mmap() with -std=c99 on glibc */
+#endif
+
+#include "impcache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "ua.h"                 /* UA_VERSION */
+
+#ifdef _WIN32
+    #include <windows.h>
+    #include <direct.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
+#define IMPCACHE_FORMAT   2
+#define IMPCACHE_HEADER   32
+#define IMPCACHE_DEP_SIZE 32    /* fixed part of a dep record            */
+#define IMPCACHE_RUN_SIZE 12    /* line run record                       */
+#define IMPCACHE_PATH_MAX 1024
+
+/* =========================================================================
+ *  Little-endian fields
+ * ========================================================================= */
+static uint64_t ic_get(const uint8_t *p, int n)
+{
+    uint64_t v = 0;
+    for (int i = n - 1; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+
+static void ic_put(uint8_t *p, uint64_t v, int n)
+{
+    for (int i = 0; i < n; i++) { p[i] = (uint8_t)v; v >>= 8; }
+}
+
+/* =========================================================================
+ *  Hashing and file identity
+ * ========================================================================= */
+uint64_t impcache_hash(const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    uint64_t h = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001B3ULL;
+    }
+    return h;
+}
+
+int impcache_file_info(const char *path, int64_t *size, int64_t *mtime)
+{
+    struct stat st;
+    if (stat(path, &st) != 0) return -1;
+    *size  = (int64_t)st.st_size;
+    *mtime = (int64_t)st.st_mtime;
+    if (*mtime >= (int64_t)time(NULL) - 1) *mtime = -1;
+    return 0;
+}
+
+/* Content hash of a whole file; -1 if it cannot be read */
+static int ic_hash_file(const char *path, uint64_t *hash)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return -1;
+
+    uint64_t h = 0xCBF29CE484222325ULL;
+    uint8_t  buf[8192];
+    size_t   n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            h ^= buf[i];
+            h *= 0x100000001B3ULL;
+        }
+    }
+    int err = ferror(fp);
+    fclose(fp);
+    if (err) return -1;
+    *hash = h;
+    return 0;
+}
+
+/* Compiler version + caller's key: entries never outlive a compiler change */
+static char* ic_full_key(const char *key, size_t *len)
+{
+    size_t vlen = strlen(UA_VERSION);
+    size_t klen = strlen(key);
+    char  *full = (char *)malloc(vlen + 1 + klen + 1);
+    if (!full) return NULL;
+    memcpy(full, UA_VERSION, vlen);
+    full[vlen] = '\n';
+    memcpy(full + vlen + 1, key, klen + 1);
+    *len = vlen + 1 + klen;
+    return full;
+}
+
+static int ic_entry_path(const char *dir, const char *full, size_t len,
+                         char *out, size_t out_size)
+{
+    int n = snprintf(out, out_size, "%s/%016llx.uac", dir,
+                     (unsigned long long)impcache_hash(full, len));
+    return (n < 0 || (size_t)n >= out_size) ? -1 : 0;
+}
+
+/* =========================================================================
+ *  Platform layer  —  map a file read-only, unmap, create a directory
+ * ========================================================================= */
+static void* ic_os_map(const char *path, size_t *size)
+{
+#ifdef _WIN32
+    HANDLE f = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (f == INVALID_HANDLE_VALUE) return NULL;
+    LARGE_INTEGER li;
+    if (!GetFileSizeEx(f, &li) || li.QuadPart <= 0) {
+        CloseHandle(f);
+        return NULL;
+    }
+    HANDLE m = CreateFileMappingA(f, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(f);
+    if (!m) return NULL;
+    void *p = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(m);
+    if (!p) return NULL;
+    *size = (size_t)li.QuadPart;
+    return p;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return NULL;
+    }
+    void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return NULL;
+    *size = (size_t)st.st_size;
+    return p;
+#endif
+}
+
+static void ic_os_unmap(void *p, size_t size)
+{
+#ifdef _WIN32
+    (void)size;
+    UnmapViewOfFile(p);
+#else
+    munmap(p, size);
+#endif
+}
+
+static void ic_os_mkdir(const char *dir)
+{
+#ifdef _WIN32
+    _mkdir(dir);
+#else
+    mkdir(dir, 0777);
+#endif
+}
+
+static unsigned long ic_os_pid(void)
+{
+#ifdef _WIN32
+    return (unsigned long)GetCurrentProcessId();
+#else
+    return (unsigned long)getpid();
+#endif
+}
+
+/* =========================================================================
+ *  impcache_load()
+ * ========================================================================= */
+
+/* Parse the mapped entry into `e`; 0 if well-formed and made for `full` */
+static int ic_parse(const uint8_t *b, size_t size, const char *full,
+                    size_t full_len, ImpCacheEntry *e)
+{
+    if (size < IMPCACHE_HEADER || memcmp(b, "UAIC", 4) != 0 ||
+        ic_get(b + 4, 4) != IMPCACHE_FORMAT)
+        return -1;
+
+    uint64_t key_len  = ic_get(b + 8, 4);
+    uint64_t ndeps    = ic_get(b + 12, 4);
+    uint64_t nmacros  = ic_get(b + 16, 4);
+    uint64_t nlines   = ic_get(b + 20, 4);
+    uint64_t text_len = ic_get(b + 24, 8);
+    size_t   pos      = IMPCACHE_HEADER;
+
+    if (key_len != full_len || size - pos < key_len ||
+        memcmp(b + pos, full, full_len) != 0)
+        return -1;
+    pos += key_len;
+
+    /* Every dep and macro takes at least 2 bytes: counts are bounded */
+    if (ndeps == 0 || ndeps > size || nmacros > size) return -1;
+    e->deps   = (ImpCacheDep *)calloc((size_t)ndeps, sizeof(ImpCacheDep));
+    e->macros = (ImpCacheMacro *)calloc((size_t)nmacros + 1,
+                                        sizeof(ImpCacheMacro));
+    if (!e->deps || !e->macros) return -1;
+
+    for (uint64_t d = 0; d < ndeps; d++) {
+        if (size - pos < IMPCACHE_DEP_SIZE) return -1;
+        ImpCacheDep *dep = &e->deps[d];
+        uint64_t plen = ic_get(b + pos + 4, 4);
+        dep->imported = (int)ic_get(b + pos, 4);
+        dep->size     = (int64_t)ic_get(b + pos + 8, 8);
+        dep->mtime    = (int64_t)ic_get(b + pos + 16, 8);
+        dep->hash     = ic_get(b + pos + 24, 8);
+        pos += IMPCACHE_DEP_SIZE;
+        if (size - pos < plen + 1 || b[pos + plen] != '\0') return -1;
+        dep->path = (const char *)b + pos;
+        pos += plen + 1;
+    }
+    e->dep_count = (int)ndeps;
+
+    for (uint64_t m = 0; m < nmacros; m++) {
+        const char *s[2];
+        for (int k = 0; k < 2; k++) {
+            const uint8_t *nul = (const uint8_t *)memchr(b + pos, '\0',
+                                                         size - pos);
+            if (!nul) return -1;
+            s[k] = (const char *)b + pos;
+            pos  = (size_t)(nul - b) + 1;
+        }
+        e->macros[m].name  = s[0];
+        e->macros[m].value = s[1];
+    }
+    e->macro_count = (int)nmacros;
+
+    if ((size - pos) / IMPCACHE_RUN_SIZE < nlines) return -1;
+    e->lines = (LineRun *)calloc((size_t)nlines + 1, sizeof(LineRun));
+    if (!e->lines) return -1;
+    for (uint64_t r = 0; r < nlines; r++) {
+        LineRun *run  = &e->lines[r];
+        run->line     = (int)ic_get(b + pos, 4);
+        run->file     = (int)ic_get(b + pos + 4, 4);
+        run->src_line = (int)ic_get(b + pos + 8, 4);
+        if (run->file >= e->dep_count || !e->deps[run->file].imported)
+            return -1;
+        pos += IMPCACHE_RUN_SIZE;
+    }
+    e->line_count = (int)nlines;
+
+    if (size - pos < text_len + 1 || b[pos + text_len] != '\0') return -1;
+    e->text     = (const char *)b + pos;
+    e->text_len = (size_t)text_len;
+    return 0;
+}
+
+/* Every file the entry was made from still has the content it had */
+static int ic_deps_current(const ImpCacheEntry *e)
+{
+    for (int d = 0; d < e->dep_count; d++) {
+        const ImpCacheDep *dep = &e->deps[d];
+        if (!dep->imported) continue;
+
+        int64_t  size, mtime;
+        uint64_t hash;
+        if (impcache_file_info(dep->path, &size, &mtime) != 0 ||
+            size != dep->size)
+            return 0;
+        if (mtime >= 0 && mtime == dep->mtime) continue;
+        if (ic_hash_file(dep->path, &hash) != 0 || hash != dep->hash)
+            return 0;
+    }
+    return 1;
+}
+
+int impcache_load(const char *dir, const char *key, ImpCacheEntry *e)
+{
+    memset(e, 0, sizeof(*e));
+
+    size_t full_len;
+    char  *full = ic_full_key(key, &full_len);
+    if (!full) return -1;
+
+    char path[IMPCACHE_PATH_MAX];
+    if (ic_entry_path(dir, full, full_len, path, sizeof(path)) != 0) {
+        free(full);
+        return -1;
+    }
+
+    e->map = ic_os_map(path, &e->map_size);
+    int ok = e->map != NULL &&
+             ic_parse((const uint8_t *)e->map, e->map_size, full, full_len,
+                      e) == 0 &&
+             ic_deps_current(e);
+    free(full);
+    if (!ok) {
+        impcache_release(e);
+        return -1;
+    }
+    return 0;
+}
+
+void impcache_release(ImpCacheEntry *e)
+{
+    if (e->map) ic_os_unmap(e->map, e->map_size);
+    free(e->deps);
+    free(e->macros);
+    free(e->lines);
+    memset(e, 0, sizeof(*e));
+}
+
+/* =========================================================================
+ *  impcache_store()
+ * ========================================================================= */
+static int ic_write(FILE *fp, const void *p, size_t n)
+{
+    return fwrite(p, 1, n, fp) == n ? 0 : -1;
+}
+
+static int ic_write_entry(FILE *fp, const char *full, size_t full_len,
+                          const ImpCacheEntry *e)
+{
+    uint8_t hdr[IMPCACHE_HEADER];
+    memcpy(hdr, "UAIC", 4);
+    ic_put(hdr + 4,  IMPCACHE_FORMAT, 4);
+    ic_put(hdr + 8,  full_len, 4);
+    ic_put(hdr + 12, (uint64_t)e->dep_count, 4);
+    ic_put(hdr + 16, (uint64_t)e->macro_count, 4);
+    ic_put(hdr + 20, (uint64_t)e->line_count, 4);
+    ic_put(hdr + 24, e->text_len, 8);
+    if (ic_write(fp, hdr, sizeof(hdr)) != 0 ||
+        ic_write(fp, full, full_len) != 0)
+        return -1;
+
+    for (int d = 0; d < e->dep_count; d++) {
+        const ImpCacheDep *dep = &e->deps[d];
+        size_t  plen = strlen(dep->path);
+        uint8_t rec[IMPCACHE_DEP_SIZE];
+        ic_put(rec,      (uint64_t)(dep->imported != 0), 4);
+        ic_put(rec + 4,  plen, 4);
+        ic_put(rec + 8,  (uint64_t)dep->size, 8);
+        ic_put(rec + 16, (uint64_t)dep->mtime, 8);
+        ic_put(rec + 24, dep->hash, 8);
+        if (ic_write(fp, rec, sizeof(rec)) != 0 ||
+            ic_write(fp, dep->path, plen + 1) != 0)
+            return -1;
+    }
+    for (int m = 0; m < e->macro_count; m++) {
+        if (ic_write(fp, e->macros[m].name,
+                     strlen(e->macros[m].name) + 1) != 0 ||
+            ic_write(fp, e->macros[m].value,
+                     strlen(e->macros[m].value) + 1) != 0)
+            return -1;
+    }
+    for (int r = 0; r < e->line_count; r++) {
+        uint8_t rec[IMPCACHE_RUN_SIZE];
+        ic_put(rec,     (uint64_t)e->lines[r].line, 4);
+        ic_put(rec + 4, (uint64_t)e->lines[r].file, 4);
+        ic_put(rec + 8, (uint64_t)e->lines[r].src_line, 4);
+        if (ic_write(fp, rec, sizeof(rec)) != 0)
+            return -1;
+    }
+    if (ic_write(fp, e->text, e->text_len) != 0 ||
+        ic_write(fp, "", 1) != 0)
+        return -1;
+    return 0;
+}
+
+int impcache_store(const char *dir, const char *key, const ImpCacheEntry *e)
+{
+    size_t full_len;
+    char  *full = ic_full_key(key, &full_len);
+    if (!full) return -1;
+
+    char path[IMPCACHE_PATH_MAX];
+    char tmp[IMPCACHE_PATH_MAX + 64];
+    if (ic_entry_path(dir, full, full_len, path, sizeof(path)) != 0) {
+        free(full);
+        return -1;
+    }
+    /* Unique per process and per thread (the caller's entry) */
+    snprintf(tmp, sizeof(tmp), "%s.%lu.%llx.tmp", path, ic_os_pid(),
+             (unsigned long long)(uintptr_t)e);
+
+    FILE *fp = fopen(tmp, "wb");
+    if (!fp) {
+        ic_os_mkdir(dir);
+        fp = fopen(tmp, "wb");
+    }
+    if (!fp) {
+        free(full);
+        return -1;
+    }
+    int rc = ic_write_entry(fp, full, full_len, e);
+    if (fclose(fp) != 0) rc = -1;
+    free(full);
+
+    /* Atomic on POSIX; on Windows an existing entry (written by another
+     * compilation from the same inputs) is kept. */
+    if (rc != 0 || rename(tmp, path) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * =============================================================================
+ *  UA - Unified Assembler
+ *  Precompiled Import Cache
+ *
+ *  File:    impcache.h
+ *  Purpose: Keep the precompiler's output for an @IMPORTed file on disk,
+ *           so that a build compiling many small programs against the
+ *           same std_* / hw_* libraries preprocesses each library once.
+ *
+ *  An entry holds what importing one file contributes to a compilation:
+ *  the preprocessed, namespace-prefixed text with its line map, the
+ *  @DEFINEs it adds and the files it imported or skipped as already
+ *  imported.  The precompiler builds the key from everything that text
+ *  depends on — the resolved path, -arch, -sys, the namespace and every
+ *  @DEFINE active at the @IMPORT — and the cache file is named after its
+ *  hash.
+ *
+ *  A hit is memory-mapped and accepted only while every file it was made
+ *  from is unchanged: same size and mtime, or else the same content hash.
+ *  A file read within a second of its last modification is recorded
+ *  without an mtime and always hashed, since a second write in that
+ *  second would leave the mtime as it was.
+ *
+ *  Entries are written to a temporary file and renamed into place, so
+ *  concurrent compilations sharing a cache directory never read a
+ *  partial entry.  Any I/O problem is a miss, never an error.
+ *
+ *  The IR is not cached: it is built once per program, with string ids
+ *  assigned across the main file and all of its imports together.
+ *
+ *  License: MIT
+ * =============================================================================
+ */
+
+#ifndef UA_IMPCACHE_H
+#define UA_IMPCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "linemap.h"    /* LineRun */
+
+/* =========================================================================
+ *  Entry contents
+ * ========================================================================= */
+typedef struct {
+    const char *path;       /* normalised path as the precompiler sees it */
+    int         imported;   /* 1 = read by this import, 0 = skipped as
+                               already imported                           */
+    int64_t     size;       /* file identity when it was read (imported)  */
+    int64_t     mtime;
+    uint64_t    hash;       /* impcache_hash() of its content             */
+} ImpCacheDep;
+
+typedef struct {
+    const char *name;
+    const char *value;
+} ImpCacheMacro;
+
+typedef struct {
+    ImpCacheDep   *deps;    /* deps[0] is the imported file itself        */
+    int            dep_count;
+    ImpCacheMacro *macros;  /* @DEFINEs the import adds, in order         */
+    int            macro_count;
+    const char    *text;    /* text to splice in (not NUL-terminated)     */
+    size_t         text_len;
+    LineRun       *lines;   /* where its lines came from: `line` counts
+                               from 1 at the start of the text, `file`
+                               indexes deps[]                             */
+    int            line_count;
+
+    /* Set by impcache_load(): the mapping the pointers above refer to */
+    void          *map;
+    size_t         map_size;
+} ImpCacheEntry;
+
+/* =========================================================================
+ *  Public API
+ * ========================================================================= */
+
+/*
+ * impcache_hash()
+ *   64-bit FNV-1a of `len` bytes — the content hash stored for each file.
+ */
+uint64_t impcache_hash(const void *data, size_t len);
+
+/*
+ * impcache_file_info()
+ *   Size and modification time of `path`; the mtime is -1 when the file
+ *   was modified in the last second.  Returns 0, or -1 if the file cannot
+ *   be examined.  Taken before the file is read, so that a later write
+ *   always differs from what the cache recorded.
+ */
+int impcache_file_info(const char *path, int64_t *size, int64_t *mtime);
+
+/*
+ * impcache_load()
+ *   Looks up `key` in directory `dir`.  On a hit whose files are all
+ *   unchanged, fills in `e` (pointing into a read-only mapping of the
+ *   entry) and returns 0; `e` must then be released with
+ *   impcache_release().  Returns -1 on a miss.
+ */
+int impcache_load(const char *dir, const char *key, ImpCacheEntry *e);
+
+/*
+ * impcache_release()
+ *   Unmaps an entry returned by impcache_load().
+ */
+void impcache_release(ImpCacheEntry *e);
+
+/*
+ * impcache_store()
+ *   Writes `e` under `key` into `dir` (created if missing).  The map
+ *   fields are ignored.  Returns 0, or -1 if nothing was written.
+ */
+int impcache_store(const char *dir, const char *key, const ImpCacheEntry *e);
+
+#endif /* UA_IMPCACHE_H */
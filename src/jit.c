@@ -0,0 +1,440 @@
+/*
+ * =============================================================================
+ *  UA - Unified Assembler
+ *  JIT Engine
+ *
+ *  File:    jit.c
+ *  Purpose: Pooled W^X executable arena, module cache and call thunk.
+ *           See jit.h for the overview.
+ *
+ *  Module placement inside a chunk (P = page size):
+ *
+ *      page k          page k+1 ...            page m ...
+ *      [ pad | code .................. ][ data ...... | bss ]
+ *        0xCC                            ^ base + code_size, P-aligned
+ *      \_____________ RX ______________/ \_______ RW _______/
+ *
+ *  License: MIT
+ * =============================================================================
+ */
+
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE         /* MAP_ANONYMOUS with -std=c99 on glibc */
+#endif
+
+#include "jit.h"
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64)
+    #define JIT_HOST_X64  1
+#else
+    #define JIT_HOST_X64  0
+#endif
+
+/* =========================================================================
+ *  Constants
+ * ========================================================================= */
+#define JIT_CHUNK_SIZE  (256u * 1024u)  /* default chunk mapping          */
+#define JIT_PAD_BYTE    0xCC            /* INT3 in front of module code   */
+
+/* =========================================================================
+ *  Arena structures
+ * ========================================================================= */
+typedef struct JitChunk {
+    uint8_t         *base;
+    size_t           size;      /* bytes mapped (multiple of the page size) */
+    size_t           used;      /* bytes handed out (multiple of the page)  */
+    struct JitChunk *next;
+} JitChunk;
+
+struct JitModule {
+    uint8_t     *base;          /* address of offset 0 of the CodeBuffer  */
+    int          size;
+    int          code_size;
+    int          bss_size;      /* zero bytes mapped after the data       */
+    uint64_t     hash;
+    uint8_t     *init;          /* bytes after the code as loaded; the
+                                   live copy changes with every SET       */
+    SymbolTable  labels;
+    JitModule   *next;
+};
+
+struct JitArena {
+    size_t       page;
+    JitChunk    *chunks;
+    JitModule   *modules;
+    const void  *thunk;         /* regs/entry trampoline (RX)             */
+};
+
+/* =========================================================================
+ *  Platform layer  —  map RW, flip to RX, unmap
+ * ========================================================================= */
+static size_t jit_os_page_size(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return (size_t)si.dwPageSize;
+#else
+    long p = sysconf(_SC_PAGESIZE);
+    return p > 0 ? (size_t)p : 4096u;
+#endif
+}
+
+static uint8_t* jit_os_map(size_t size)
+{
+#ifdef _WIN32
+    void *p = VirtualAlloc(NULL, (SIZE_T)size, MEM_COMMIT | MEM_RESERVE,
+                           PAGE_READWRITE);
+    if (!p) {
+        fprintf(stderr, "Error: VirtualAlloc failed (err %lu).\n",
+                GetLastError());
+        return NULL;
+    }
+    return (uint8_t *)p;
+#else
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    return (uint8_t *)p;
+#endif
+}
+
+static int jit_os_seal(uint8_t *addr, size_t size)
+{
+#ifdef _WIN32
+    DWORD old;
+    if (!VirtualProtect(addr, (SIZE_T)size, PAGE_EXECUTE_READ, &old)) {
+        fprintf(stderr, "Error: VirtualProtect failed (err %lu).\n",
+                GetLastError());
+        return -1;
+    }
+    FlushInstructionCache(GetCurrentProcess(), addr, (SIZE_T)size);
+    return 0;
+#else
+    if (mprotect(addr, size, PROT_READ | PROT_EXEC) != 0) {
+        perror("mprotect");
+        return -1;
+    }
+    return 0;
+#endif
+}
+
+static void jit_os_unmap(uint8_t *addr, size_t size)
+{
+#ifdef _WIN32
+    (void)size;
+    VirtualFree(addr, 0, MEM_RELEASE);
+#else
+    munmap(addr, size);
+#endif
+}
+
+/* =========================================================================
+ *  Chunk allocation  —  hands out page-aligned RW spans
+ * ========================================================================= */
+static uint8_t* jit_alloc_pages(JitArena *jit, size_t span)
+{
+    JitChunk *c;
+    for (c = jit->chunks; c; c = c->next) {
+        if (c->size - c->used >= span) break;
+    }
+    if (!c) {
+        size_t size = span > JIT_CHUNK_SIZE ? span : JIT_CHUNK_SIZE;
+        c = (JitChunk *)malloc(sizeof(JitChunk));
+        if (!c) return NULL;
+        c->base = jit_os_map(size);
+        if (!c->base) { free(c); return NULL; }
+        c->size = size;
+        c->used = 0;
+        c->next = jit->chunks;
+        jit->chunks = c;
+    }
+    uint8_t *p = c->base + c->used;
+    c->used += span;
+    return p;
+}
+
+static size_t jit_round_up(size_t n, size_t page)
+{
+    return (n + page - 1) / page * page;
+}
+
+/* =========================================================================
+ *  Call thunk  —  int64_t thunk(int64_t regs[8], const void *entry)
+ *
+ *  Saves the callee-saved registers of the host ABI, keeps `regs` in R12
+ *  and `entry` in R13 (UA code never touches R12-R15 in JIT output),
+ *  loads RAX..RDI except RSP, calls, and stores them back.
+ * ========================================================================= */
+typedef int64_t (*JitThunk)(int64_t *regs, const void *entry);
+
+static void jit_emit_regs(CodeBuffer *buf, uint8_t opcode)
+{
+    /* MOV r64, [R12+8*n]  (8B)  /  MOV [R12+8*n], r64  (89) */
+    for (int r = 0; r < JIT_REG_COUNT; r++) {
+        if (r == 4) continue;                   /* RSP */
+        emit_byte(buf, 0x49);                   /* REX.W + REX.B (R12) */
+        emit_byte(buf, opcode);
+        emit_byte(buf, (uint8_t)(0x44 | (r << 3)));   /* [base+disp8] */
+        emit_byte(buf, 0x24);                   /* SIB: base = R12    */
+        emit_byte(buf, (uint8_t)(r * 8));
+    }
+}
+
+static CodeBuffer* jit_build_thunk(void)
+{
+#ifdef _WIN32
+    static const uint8_t save[]    = { 0x53, 0x55, 0x56, 0x57,   /* rbx rbp rsi rdi */
+                                       0x41, 0x54, 0x41, 0x55,   /* r12 r13         */
+                                       0x41, 0x56, 0x41, 0x57 }; /* r14 r15         */
+    static const uint8_t args[]    = { 0x49, 0x89, 0xCC,         /* mov r12, rcx    */
+                                       0x49, 0x89, 0xD5 };       /* mov r13, rdx    */
+    static const uint8_t frame     = 0x28;                       /* align + shadow  */
+    static const uint8_t restore[] = { 0x41, 0x5F, 0x41, 0x5E,
+                                       0x41, 0x5D, 0x41, 0x5C,
+                                       0x5F, 0x5E, 0x5D, 0x5B, 0xC3 };
+#else
+    static const uint8_t save[]    = { 0x53, 0x55,               /* rbx rbp         */
+                                       0x41, 0x54, 0x41, 0x55,   /* r12 r13         */
+                                       0x41, 0x56, 0x41, 0x57 }; /* r14 r15         */
+    static const uint8_t args[]    = { 0x49, 0x89, 0xFC,         /* mov r12, rdi    */
+                                       0x49, 0x89, 0xF5 };       /* mov r13, rsi    */
+    static const uint8_t frame     = 0x08;                       /* align           */
+    static const uint8_t restore[] = { 0x41, 0x5F, 0x41, 0x5E,
+                                       0x41, 0x5D, 0x41, 0x5C,
+                                       0x5D, 0x5B, 0xC3 };
+#endif
+    /* Running out of memory while emitting unwinds to here */
+    UaDiag  diag;
+    jmp_buf bail;
+    diag_init(&diag, stderr);
+    if (setjmp(bail) != 0) {
+        diag_free(&diag);
+        return NULL;
+    }
+    diag.bail = &bail;
+
+    CodeBuffer *buf = create_code_buffer(&diag);
+    if (!buf) {
+        diag_free(&diag);
+        return NULL;
+    }
+    diag_own(&diag, &buf, codebuf_drop);
+    emit_bytes(buf, save, (int)sizeof(save));
+    emit_bytes(buf, args, (int)sizeof(args));
+    emit_byte(buf, 0x48); emit_byte(buf, 0x83);         /* sub rsp, frame */
+    emit_byte(buf, 0xEC); emit_byte(buf, frame);
+    jit_emit_regs(buf, 0x8B);                           /* load R0-R7     */
+    emit_byte(buf, 0x41); emit_byte(buf, 0xFF);         /* call r13       */
+    emit_byte(buf, 0xD5);
+    jit_emit_regs(buf, 0x89);                           /* store R0-R7    */
+    emit_byte(buf, 0x48); emit_byte(buf, 0x83);         /* add rsp, frame */
+    emit_byte(buf, 0xC4); emit_byte(buf, frame);
+    emit_bytes(buf, restore, (int)sizeof(restore));
+    diag_free(&diag);
+    codebuf_set_diag(buf, NULL);
+    return buf;
+}
+
+/* =========================================================================
+ *  jit_create() / jit_destroy()
+ * ========================================================================= */
+JitArena* jit_create(void)
+{
+    if (!JIT_HOST_X64) {
+        fprintf(stderr, "Error: the JIT needs an x86-64 host.\n");
+        return NULL;
+    }
+
+    JitArena *jit = (JitArena *)calloc(1, sizeof(JitArena));
+    if (!jit) {
+        fprintf(stderr, "UA JIT: out of memory\n");
+        return NULL;
+    }
+    jit->page = jit_os_page_size();
+
+    CodeBuffer *thunk = jit_build_thunk();
+    uint8_t    *mem   = NULL;
+    size_t      span  = 0;
+    if (thunk) {
+        span = jit_round_up((size_t)thunk->size, jit->page);
+        mem  = jit_alloc_pages(jit, span);
+    }
+    if (!mem) {
+        fprintf(stderr, "UA JIT: cannot allocate the call thunk\n");
+        free_code_buffer(thunk);
+        jit_destroy(jit);
+        return NULL;
+    }
+    memset(mem, JIT_PAD_BYTE, span);
+    memcpy(mem, thunk->bytes, (size_t)thunk->size);
+    free_code_buffer(thunk);
+    if (jit_os_seal(mem, span) != 0) {
+        jit_destroy(jit);
+        return NULL;
+    }
+    jit->thunk = mem;
+    return jit;
+}
+
+void jit_destroy(JitArena *jit)
+{
+    if (!jit) return;
+    for (JitModule *m = jit->modules; m; ) {
+        JitModule *next = m->next;
+        symtab_free(&m->labels);
+        free(m->init);
+        free(m);
+        m = next;
+    }
+    for (JitChunk *c = jit->chunks; c; ) {
+        JitChunk *next = c->next;
+        jit_os_unmap(c->base, c->size);
+        free(c);
+        c = next;
+    }
+    free(jit);
+}
+
+/* =========================================================================
+ *  jit_load()
+ * ========================================================================= */
+static uint64_t jit_hash(const uint8_t *data, int size)
+{
+    uint64_t h = 0xCBF29CE484222325ull;         /* FNV-1a, 64-bit */
+    for (int i = 0; i < size; i++) {
+        h ^= data[i];
+        h *= 0x100000001B3ull;
+    }
+    return h;
+}
+
+/* Copy the code labels into the module; -1 if memory runs out */
+static int jit_copy_labels(JitModule *mod, const CodeBuffer *code)
+{
+    UaDiag  diag;
+    jmp_buf bail;
+    diag_init(&diag, stderr);
+    if (setjmp(bail) != 0) {
+        diag_free(&diag);
+        return -1;
+    }
+    diag.bail = &bail;
+
+    symtab_init(&mod->labels, &diag);
+    diag_own(&diag, &mod->labels, symtab_drop);
+    for (int i = 0; i < code->labels.count; i++) {
+        symtab_add(&mod->labels, code->labels.entries[i].name,
+                   code->labels.entries[i].address);
+    }
+    diag_free(&diag);
+    mod->labels.names.diag = NULL;
+    return 0;
+}
+
+JitModule* jit_load(JitArena *jit, const CodeBuffer *code)
+{
+    if (!code || code->size == 0) {
+        fprintf(stderr, "Error: no code to execute.\n");
+        return NULL;
+    }
+    if (code->pe_iat_count > 0) {
+        fprintf(stderr, "Error: Win32 runtime stubs need the PE loader; "
+                "JIT code must be built without -sys win32.\n");
+        return NULL;
+    }
+
+    int code_size = code->code_size;
+    if (code_size <= 0 || code_size > code->size) code_size = code->size;
+    size_t init_size = (size_t)(code->size - code_size);
+
+    /* Code cache: identical bytes map to the module already loaded.  The
+     * code pages are read-only, but the data pages are not, so the data
+     * is compared with the copy taken when the module was loaded. */
+    uint64_t hash = jit_hash(code->bytes, code->size);
+    for (JitModule *m = jit->modules; m; m = m->next) {
+        if (m->hash == hash && m->size == code->size &&
+            m->code_size == code_size && m->bss_size == code->bss_size &&
+            memcmp(m->base, code->bytes, (size_t)code_size) == 0 &&
+            (init_size == 0 ||
+             memcmp(m->init, code->bytes + code_size, init_size) == 0))
+            return m;
+    }
+
+    /* Shift the module so its data starts on a page boundary */
+    size_t lead  = (jit->page - (size_t)code_size % jit->page) % jit->page;
+    size_t rx    = lead + (size_t)code_size;
+    size_t span  = jit_round_up(lead + (size_t)code->size
+                                + (size_t)code->bss_size, jit->page);
+
+    JitModule *mod  = (JitModule *)malloc(sizeof(JitModule));
+    uint8_t   *init = init_size ? (uint8_t *)malloc(init_size) : NULL;
+    uint8_t   *mem  = (mod && (init || init_size == 0))
+                    ? jit_alloc_pages(jit, span) : NULL;
+    if (!mem) {
+        fprintf(stderr, "UA JIT: out of memory\n");
+        free(init);
+        free(mod);
+        return NULL;
+    }
+    if (init) memcpy(init, code->bytes + code_size, init_size);
+
+    memset(mem, JIT_PAD_BYTE, lead);
+    memcpy(mem + lead, code->bytes, (size_t)code->size);
+    memset(mem + lead + code->size, 0, span - lead - (size_t)code->size);
+    if (jit_os_seal(mem, rx) != 0) {
+        free(init);
+        free(mod);
+        return NULL;
+    }
+
+    mod->base      = mem + lead;
+    mod->size      = code->size;
+    mod->code_size = code_size;
+    mod->bss_size  = code->bss_size;
+    mod->hash      = hash;
+    mod->init      = init;
+    if (jit_copy_labels(mod, code) != 0) {
+        free(init);
+        free(mod);                      /* its pages stay with the arena */
+        return NULL;
+    }
+    mod->next    = jit->modules;
+    jit->modules = mod;
+    return mod;
+}
+
+/* =========================================================================
+ *  jit_lookup() / jit_call()
+ * ========================================================================= */
+void* jit_lookup(const JitModule *mod, const char *label)
+{
+    if (!label) return mod->base;
+    int off = symtab_lookup(&mod->labels, label);
+    if (off < 0 || off >= mod->code_size) return NULL;
+    return mod->base + off;
+}
+
+int64_t jit_call(const JitArena *jit, const void *entry,
+                 int64_t regs[JIT_REG_COUNT])
+{
+    /* memcpy avoids ISO C object->function-pointer cast warning */
+    JitThunk thunk;
+    memcpy(&thunk, &jit->thunk, sizeof(thunk));
+    return thunk(regs, entry);
+}
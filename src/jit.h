@@ -0,0 +1,78 @@
+/*
+ * =============================================================================
+ *  UA - Unified Assembler
+ *  JIT Engine
+ *
+ *  File:    jit.h
+ *  Purpose: Load x86-64 CodeBuffers into executable memory once and call
+ *           any of their labels many times from the host process.
+ *
+ *  Design:  A JitArena owns a pool of page-aligned chunks.  Each loaded
+ *           module is copied into fresh read/write pages; the pages that
+ *           hold instructions are then switched to read/execute, and the
+ *           pages that hold the module's VARs, BUFFERs and strings stay
+ *           read/write.  No page is ever writable and executable at the
+ *           same time (W^X).  The module is placed so that its data
+ *           starts exactly on a page boundary, which keeps the
+ *           RIP-relative layout produced by the back-end intact.
+ *
+ *           Calls go through a small thunk that saves the host's
+ *           callee-saved registers, loads UA R0-R7 from an array, calls
+ *           the entry point and stores R0-R7 back.  Loading a buffer that
+ *           is already in the arena returns the existing module (code
+ *           cache), so repeated loads cost a hash and a compare.
+ *
+ *  Host:    x86-64 only (Windows, Linux, macOS).  jit_create() returns
+ *           NULL elsewhere.
+ *
+ *  License: MIT
+ * =============================================================================
+ */
+
+#ifndef UA_JIT_H
+#define UA_JIT_H
+
+#include "codegen.h"    /* CodeBuffer */
+
+#include <stdint.h>
+
+#define JIT_REG_COUNT  8    /* UA R0-R7 passed to / returned from jit_call() */
+
+typedef struct JitArena  JitArena;
+typedef struct JitModule JitModule;
+
+/*
+ * jit_create() / jit_destroy()
+ *   Create an empty arena / unmap every module loaded into it.  Entry
+ *   pointers from the arena are invalid after jit_destroy().
+ *   jit_create() returns NULL (with a message on stderr) on failure.
+ */
+JitArena* jit_create(void);
+void      jit_destroy(JitArena *jit);
+
+/*
+ * jit_load()
+ *   Copies `code` into the arena and seals its code pages.  The buffer
+ *   can be freed afterwards.  Loading identical bytes again returns the
+ *   same module, which shares its VARs with the first load.
+ *   Returns NULL on failure.
+ */
+JitModule* jit_load(JitArena *jit, const CodeBuffer *code);
+
+/*
+ * jit_lookup()
+ *   Entry point for `label`, or the start of the module when `label` is
+ *   NULL.  Returns NULL if the label is not defined in the module.
+ */
+void* jit_lookup(const JitModule *mod, const char *label);
+
+/*
+ * jit_call()
+ *   Runs `entry` with UA registers R0-R7 taken from `regs` and writes
+ *   their final values back (R4 = RSP is neither loaded nor stored).
+ *   Returns R0.
+ */
+int64_t jit_call(const JitArena *jit, const void *entry,
+                 int64_t regs[JIT_REG_COUNT]);
+
+#endif /* UA_JIT_H */
@@ -163,15 +163,20 @@ static int parse_number(const char *text, int64_t *out)
 {
     char *end = NULL;
 
+    /* Hex, binary and unsigned decimal literals cover the full 64-bit
+     * pattern (0xFFFFFFFFFFFFFFFF == -1), so parse them unsigned. */
     if (text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) {
         /* Hexadecimal */
-        *out = (int64_t)strtoll(text, &end, 16);
+        *out = (int64_t)strtoull(text, &end, 16);
     } else if (text[0] == '0' && (text[1] == 'b' || text[1] == 'B')) {
         /* Binary — skip the "0b" prefix manually */
-        *out = (int64_t)strtoll(text + 2, &end, 2);
-    } else {
-        /* Decimal (may have leading '-') */
+        *out = (int64_t)strtoull(text + 2, &end, 2);
+    } else if (text[0] == '-') {
+        /* Negative decimal */
         *out = (int64_t)strtoll(text, &end, 10);
+    } else {
+        /* Decimal */
+        *out = (int64_t)strtoull(text, &end, 10);
     }
 
     /* Success only if the entire string was consumed */
@@ -181,14 +186,15 @@ static int parse_number(const char *text, int64_t *out)
 /* =========================================================================
  *  Helper: ensure the token array has room for at least one more entry
  * ========================================================================= */
-static Token* ensure_capacity(Token *tokens, int count, int *capacity)
+static Token* ensure_capacity(Token *tokens, int count, int *capacity,
+                              UaDiag *diag)
 {
     if (count < *capacity) return tokens;
 
     int new_cap = (*capacity) * 2;
     Token *tmp = (Token *)realloc(tokens, sizeof(Token) * (size_t)new_cap);
     if (!tmp) {
-        fprintf(stderr, "UA Lexer: out of memory (realloc failed)\n");
+        diag_printf(diag, "UA Lexer: out of memory (realloc failed)\n");
         free(tokens);
         return NULL;
     }
@@ -200,11 +206,12 @@ static Token* ensure_capacity(Token *tokens, int count, int *capacity)
  *  Helper: create and append a token
  * ========================================================================= */
 static Token make_token(UaTokenType type, const char *text, int64_t value,
-                        int line, int column)
+                        const char *file, int line, int column)
 {
     Token t;
     t.type   = type;
     t.value  = value;
+    t.file   = file;
     t.line   = line;
     t.column = column;
 
@@ -217,6 +224,17 @@ static Token make_token(UaTokenType type, const char *text, int64_t value,
     return t;
 }
 
+/* =========================================================================
+ *  Helper: original file and line of line `text_line` of the input
+ * ========================================================================= */
+static void locate_line(const LineMap *lines, int text_line,
+                        const char **file, int *line)
+{
+    int f = 0;
+    *line = lines ? linemap_lookup(lines, text_line, &f) : text_line;
+    *file = (lines && f < lines->file_count) ? lines->files[f] : "<input>";
+}
+
 /* =========================================================================
  *  token_type_name()  —  human-readable token type strings
  * ========================================================================= */
@@ -257,7 +275,8 @@ const char* token_type_name(UaTokenType type)
  *         - otherwise    → unknown
  *    4. After scanning, append TOKEN_EOF.
  * ========================================================================= */
-Token* tokenize(const char *source_code, int *token_count)
+Token* tokenize(const char *source_code, const LineMap *lines,
+                int *token_count, UaDiag *diag)
 {
     if (!source_code || !token_count) return NULL;
 
@@ -266,14 +285,17 @@ Token* tokenize(const char *source_code, int *token_count)
 
     Token *tokens = (Token *)malloc(sizeof(Token) * (size_t)capacity);
     if (!tokens) {
-        fprintf(stderr, "UA Lexer: out of memory (initial malloc)\n");
+        diag_printf(diag, "UA Lexer: out of memory (initial malloc)\n");
         *token_count = 0;
         return NULL;
     }
 
     const char *p   = source_code;
-    int line        = 1;
+    int text_line   = 1;        /* line in source_code                  */
+    int line        = 1;        /* ... and where it came from           */
+    const char *file;
     int col         = 1;
+    locate_line(lines, text_line, &file, &line);
 
     while (*p != '\0') {
 
@@ -287,12 +309,14 @@ Token* tokenize(const char *source_code, int *token_count)
 
         /* ---- Newline -------------------------------------------------- */
         if (*p == '\n') {
-            tokens = ensure_capacity(tokens, count, &capacity);
+            tokens = ensure_capacity(tokens, count, &capacity, diag);
             if (!tokens) { *token_count = 0; return NULL; }
 
-            tokens[count++] = make_token(TOKEN_NEWLINE, "\\n", 0, line, col);
+            tokens[count++] = make_token(TOKEN_NEWLINE, "\\n", 0,
+                                         file, line, col);
             p++;
-            line++;
+            text_line++;
+            locate_line(lines, text_line, &file, &line);
             col = 1;
             continue;
         }
@@ -312,20 +336,20 @@ Token* tokenize(const char *source_code, int *token_count)
             memcpy(buf, start, len);
             buf[len] = '\0';
 
-            tokens = ensure_capacity(tokens, count, &capacity);
+            tokens = ensure_capacity(tokens, count, &capacity, diag);
             if (!tokens) { *token_count = 0; return NULL; }
 
             tokens[count++] = make_token(TOKEN_COMMENT, buf, 0,
-                                         line, start_col);
+                                         file, line, start_col);
             continue;           /* don't consume the '\n' here */
         }
 
         /* ---- Comma ---------------------------------------------------- */
         if (*p == ',') {
-            tokens = ensure_capacity(tokens, count, &capacity);
+            tokens = ensure_capacity(tokens, count, &capacity, diag);
             if (!tokens) { *token_count = 0; return NULL; }
 
-            tokens[count++] = make_token(TOKEN_COMMA, ",", 0, line, col);
+            tokens[count++] = make_token(TOKEN_COMMA, ",", 0, file, line, col);
             p++;
             col++;
             continue;
@@ -363,24 +387,24 @@ Token* tokenize(const char *source_code, int *token_count)
             if (*p == '"') {
                 p++;  col++;   /* consume closing quote */
             } else {
-                fprintf(stderr, "UA Lexer: warning: unterminated string "
-                        "literal at line %d, col %d\n", line, start_col);
+                diag_printf(diag, "UA Lexer: warning: unterminated string "
+                            "literal at %s:%d, col %d\n", file, line, start_col);
             }
 
-            tokens = ensure_capacity(tokens, count, &capacity);
+            tokens = ensure_capacity(tokens, count, &capacity, diag);
             if (!tokens) { *token_count = 0; return NULL; }
 
             tokens[count++] = make_token(TOKEN_STRING, buf, 0,
-                                         line, start_col);
+                                         file, line, start_col);
             continue;
         }
 
         /* ---- Colon (standalone — labels handled below) ---------------- */
         if (*p == ':') {
-            tokens = ensure_capacity(tokens, count, &capacity);
+            tokens = ensure_capacity(tokens, count, &capacity, diag);
             if (!tokens) { *token_count = 0; return NULL; }
 
-            tokens[count++] = make_token(TOKEN_COLON, ":", 0, line, col);
+            tokens[count++] = make_token(TOKEN_COLON, ":", 0, file, line, col);
             p++;
             col++;
             continue;
@@ -388,10 +412,11 @@ Token* tokenize(const char *source_code, int *token_count)
 
         /* ---- Left parenthesis ----------------------------------------- */
         if (*p == '(') {
-            tokens = ensure_capacity(tokens, count, &capacity);
+            tokens = ensure_capacity(tokens, count, &capacity, diag);
             if (!tokens) { *token_count = 0; return NULL; }
 
-            tokens[count++] = make_token(TOKEN_LPAREN, "(", 0, line, col);
+            tokens[count++] = make_token(TOKEN_LPAREN, "(", 0,
+                                         file, line, col);
             p++;
             col++;
             continue;
@@ -399,10 +424,11 @@ Token* tokenize(const char *source_code, int *token_count)
 
         /* ---- Right parenthesis ---------------------------------------- */
         if (*p == ')') {
-            tokens = ensure_capacity(tokens, count, &capacity);
+            tokens = ensure_capacity(tokens, count, &capacity, diag);
             if (!tokens) { *token_count = 0; return NULL; }
 
-            tokens[count++] = make_token(TOKEN_RPAREN, ")", 0, line, col);
+            tokens[count++] = make_token(TOKEN_RPAREN, ")", 0,
+                                         file, line, col);
             p++;
             col++;
             continue;
@@ -434,15 +460,16 @@ Token* tokenize(const char *source_code, int *token_count)
             int64_t val = 0;
             UaTokenType ttype = TOKEN_NUMBER;
             if (!parse_number(buf, &val)) {
-                fprintf(stderr, "UA Lexer: warning: invalid number '%s' "
-                        "at line %d, col %d\n", buf, line, start_col);
+                diag_printf(diag, "UA Lexer: warning: invalid number '%s' "
+                            "at %s:%d, col %d\n", buf, file, line, start_col);
                 ttype = TOKEN_UNKNOWN;
             }
 
-            tokens = ensure_capacity(tokens, count, &capacity);
+            tokens = ensure_capacity(tokens, count, &capacity, diag);
             if (!tokens) { *token_count = 0; return NULL; }
 
-            tokens[count++] = make_token(ttype, buf, val, line, start_col);
+            tokens[count++] = make_token(ttype, buf, val,
+                                         file, line, start_col);
             continue;
         }
 
@@ -495,34 +522,36 @@ Token* tokenize(const char *source_code, int *token_count)
                 }
             }
 
-            tokens = ensure_capacity(tokens, count, &capacity);
+            tokens = ensure_capacity(tokens, count, &capacity, diag);
             if (!tokens) { *token_count = 0; return NULL; }
 
-            tokens[count++] = make_token(ttype, buf, val, line, start_col);
+            tokens[count++] = make_token(ttype, buf, val,
+                                         file, line, start_col);
             continue;
         }
 
         /* ---- Unknown character ---------------------------------------- */
         {
             char buf[2] = { *p, '\0' };
-            fprintf(stderr, "UA Lexer: warning: unknown character '%c' "
-                    "(0x%02X) at line %d, col %d\n",
-                    *p, (unsigned char)*p, line, col);
+            diag_printf(diag, "UA Lexer: warning: unknown character '%c' "
+                        "(0x%02X) at %s:%d, col %d\n",
+                        *p, (unsigned char)*p, file, line, col);
 
-            tokens = ensure_capacity(tokens, count, &capacity);
+            tokens = ensure_capacity(tokens, count, &capacity, diag);
             if (!tokens) { *token_count = 0; return NULL; }
 
-            tokens[count++] = make_token(TOKEN_UNKNOWN, buf, 0, line, col);
+            tokens[count++] = make_token(TOKEN_UNKNOWN, buf, 0,
+                                         file, line, col);
             p++;
             col++;
         }
     }
 
     /* ---- Append EOF sentinel ------------------------------------------ */
-    tokens = ensure_capacity(tokens, count, &capacity);
+    tokens = ensure_capacity(tokens, count, &capacity, diag);
     if (!tokens) { *token_count = 0; return NULL; }
 
-    tokens[count++] = make_token(TOKEN_EOF, "<EOF>", 0, line, col);
+    tokens[count++] = make_token(TOKEN_EOF, "<EOF>", 0, file, line, col);
 
     *token_count = count;
     return tokens;
@@ -22,6 +22,9 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#include "diag.h"       /* UaDiag */
+#include "linemap.h"    /* LineMap */
+
 /* -------------------------------------------------------------------------
  * Token Types
  * -------------------------------------------------------------------------
@@ -58,7 +61,8 @@ typedef enum {
  *   - its type
  *   - a copy of the source lexeme (null-terminated)
  *   - its numeric value (meaningful only for TOKEN_NUMBER / TOKEN_REGISTER)
- *   - source location for error reporting
+ *   - source location for error reporting: the original file and line,
+ *     when the lexer was given the precompiler's line map
  * ------------------------------------------------------------------------- */
 #define UA_MAX_TOKEN_LEN  128  /* Maximum characters in a single lexeme */
 
@@ -66,6 +70,7 @@ typedef struct {
     UaTokenType type;
     char        text[UA_MAX_TOKEN_LEN];  /* Human-readable lexeme           */
     int64_t     value;                    /* Numeric payload (if applicable) */
+    const char *file;                     /* source file (LineMap.files)     */
     int         line;                     /* 1-based source line             */
     int         column;                   /* 1-based source column           */
 } Token;
@@ -81,12 +86,18 @@ typedef struct {
  *
  *   Parameters:
  *     source_code  – null-terminated assembly source text.
+ *     lines        – where each line of `source_code` came from (see
+ *                    preprocess()), or NULL: lines are then numbered as
+ *                    they are and the file is "<input>".  Tokens point at
+ *                    its file names, so it must outlive them.
  *     token_count  – [out] receives the number of tokens (including EOF).
+ *     diag         – sink for warnings (NULL = stderr).
  *
  *   Returns:
  *     Pointer to a heap-allocated Token array, or NULL on allocation failure.
  * ------------------------------------------------------------------------- */
-Token* tokenize(const char *source_code, int *token_count);
+Token* tokenize(const char *source_code, const LineMap *lines,
+                int *token_count, UaDiag *diag);
 
 /* -------------------------------------------------------------------------
  * token_type_name()
@@ -0,0 +1,111 @@
+/*
+ * =============================================================================
+ *  UA - Unified Assembler
+ *  Source Line Map
+ *
+ *  File:    linemap.c
+ *  Purpose: Building and querying the output-line → source-line runs.
+ *           See linemap.h for the overview.
+ *
+ *  License: MIT
+ * =============================================================================
+ */
+
+#include "linemap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* =========================================================================
+ *  linemap_init() / linemap_free()
+ * ========================================================================= */
+void linemap_init(LineMap *map)
+{
+    memset(map, 0, sizeof(*map));
+}
+
+void linemap_free(LineMap *map)
+{
+    for (int i = 0; i < map->file_count; i++)
+        free(map->files[i]);
+    free(map->files);
+    free(map->runs);
+    linemap_init(map);
+}
+
+/* =========================================================================
+ *  linemap_file()
+ * ========================================================================= */
+int linemap_file(LineMap *map, const char *path)
+{
+    for (int i = 0; i < map->file_count; i++) {
+        if (strcmp(map->files[i], path) == 0) return i;
+    }
+
+    if (map->file_count == map->file_cap) {
+        int    cap = map->file_cap ? map->file_cap * 2 : 8;
+        char **f   = (char **)realloc(map->files,
+                                      (size_t)cap * sizeof(char *));
+        if (!f) return -1;
+        map->files    = f;
+        map->file_cap = cap;
+    }
+    size_t len  = strlen(path) + 1;
+    char  *copy = (char *)malloc(len);
+    if (!copy) return -1;
+    memcpy(copy, path, len);
+    map->files[map->file_count] = copy;
+    return map->file_count++;
+}
+
+/* =========================================================================
+ *  linemap_add()
+ * ========================================================================= */
+int linemap_add(LineMap *map, int line, int file, int src_line)
+{
+    if (map->run_count > 0) {
+        LineRun *last = &map->runs[map->run_count - 1];
+        if (last->file == file &&
+            src_line - last->src_line == line - last->line)
+            return 0;                           /* continues the run */
+        if (last->line == line) {
+            map->run_count--;                   /* replaced before use */
+            return linemap_add(map, line, file, src_line);
+        }
+    }
+
+    if (map->run_count == map->run_cap) {
+        int      cap = map->run_cap ? map->run_cap * 2 : 16;
+        LineRun *r   = (LineRun *)realloc(map->runs,
+                                          (size_t)cap * sizeof(LineRun));
+        if (!r) return -1;
+        map->runs    = r;
+        map->run_cap = cap;
+    }
+    LineRun *run  = &map->runs[map->run_count++];
+    run->line     = line;
+    run->file     = file;
+    run->src_line = src_line;
+    return 0;
+}
+
+/* =========================================================================
+ *  linemap_lookup()
+ * ========================================================================= */
+int linemap_lookup(const LineMap *map, int line, int *file)
+{
+    /* Last run starting at or before `line` */
+    int lo = 0, hi = map ? map->run_count : 0;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (map->runs[mid].line <= line) lo = mid + 1;
+        else                             hi = mid;
+    }
+    if (lo == 0) {
+        *file = 0;
+        return line;
+    }
+    const LineRun *run = &map->runs[lo - 1];
+    *file = run->file;
+    return run->src_line + (line - run->line);
+}
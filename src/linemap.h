@@ -0,0 +1,80 @@
+/*
+ * =============================================================================
+ *  UA - Unified Assembler
+ *  Source Line Map
+ *
+ *  File:    linemap.h
+ *  Purpose: Say where each line of the precompiler's output came from, so
+ *           that tokens, IR instructions and every message about them name
+ *           the original file and line — also inside @IMPORTed libraries.
+ *
+ *  preprocess() returns one flat text: the main file with its directives
+ *  blanked, then the imported files.  The map is a list of runs, each
+ *  starting at an output line: from there on, output lines follow one
+ *  another in a single source file until the next run.  A file needs a
+ *  new run only where an import is spliced in and where it resumes, so
+ *  the map stays small however long the program is.
+ *
+ *  File names are kept once, in the map; tokens and instructions point at
+ *  them, so the map must outlive the IR built from its text.
+ *
+ *  License: MIT
+ * =============================================================================
+ */
+
+#ifndef UA_LINEMAP_H
+#define UA_LINEMAP_H
+
+/* =========================================================================
+ *  Types
+ * ========================================================================= */
+typedef struct {
+    int line;               /* first output line of the run (1-based)    */
+    int file;               /* index into LineMap.files                  */
+    int src_line;           /* its line in that file (1-based)           */
+} LineRun;
+
+typedef struct {
+    char    **files;        /* files[0] = the main file                  */
+    int       file_count;
+    int       file_cap;
+    LineRun  *runs;         /* ascending `line`                          */
+    int       run_count;
+    int       run_cap;
+} LineMap;
+
+/* =========================================================================
+ *  Public API
+ * ========================================================================= */
+
+/*
+ * linemap_init() / linemap_free()
+ *   Initialise an empty map / release its files and runs.
+ */
+void linemap_init(LineMap *map);
+void linemap_free(LineMap *map);
+
+/*
+ * linemap_file()
+ *   Index of `path` in map->files, adding it if necessary.  Returns -1
+ *   when out of memory.
+ */
+int linemap_file(LineMap *map, const char *path);
+
+/*
+ * linemap_add()
+ *   Output lines from `line` on come from line `src_line` of file `file`
+ *   onwards.  `line` must not be below that of the last run; a run that
+ *   only continues the last one is not stored.  Returns 0, or -1 when out
+ *   of memory.
+ */
+int linemap_add(LineMap *map, int line, int file, int src_line);
+
+/*
+ * linemap_lookup()
+ *   Source line of output line `line`; its file index goes to *file.
+ *   Lines before the first run map to themselves in file 0.
+ */
+int linemap_lookup(const LineMap *map, int line, int *file);
+
+#endif /* UA_LINEMAP_H */
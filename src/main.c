@@ -6,19 +6,47 @@
  *  File:    main.c
  *  Purpose: CLI compiler driver with JIT support.
  *
- *   Usage:  ua <input.ua> -arch <arch> [-o output] [-sys system] [--run]
+ *   Usage:  ua <input.ua> -arch <arch> [-o output] [-sys system] [-O1|-O2]
+ *              [--run [--entry label]] [-q|-v|--trace-codegen] [--hexdump]
+ *              [--sim [--entry label] [--sim-cycles N]] [--gc-report]
+ *              [--import-cache dir] [-g]
+ *           ua <input.ua|@list>... -arch <arch>[,<arch>...] [--jobs N]
+ *              [-o outdir] [-sys system] [-O1|-O2]
  *
  *   -o      Output file path      (default: a.out)
  *   -arch   Target architecture   (mcs51 | x86 | x86_32 | arm | arm64 | riscv) [mandatory]
  *   -sys    Target OS / system    (baremetal | win32 | linux | macos)            [stored]
+ *   -O1     Peephole-optimise the IR before code generation  (default -O0)
+ *   -O2     -O1 + keep VARs in spare registers (x86, arm64, riscv)
  *   --run   JIT-execute the code  (x86 only, skips .bin write)
+ *   --entry JIT / --sim entry label (default: first byte of the code)
+ *   --sim   Run mcs51 code on the cycle-counting simulator (sim_8051.c)
+ *           and print registers, cycles and a per-label profile
+ *   --sim-cycles  Simulator cycle budget (default 1000000)
+ *   --jobs  Batch mode: worker threads (default: one per CPU)
+ *   --gc-report  List the imported functions and data that no code
+ *           reaches (dropped from the output) and the bytes saved
+ *   --import-cache  Directory for preprocessed @IMPORT files, reused by
+ *           later compilations while the library files are unchanged
+ *   -g      ELF output: add a DWARF line table (source file and line of
+ *           the code) next to the symbol table every ELF carries
+ *   -q      Errors and warnings only      -v  Phase details (tables, segments)
+ *   --trace-codegen  One line per instruction the backend translates
+ *   --hexdump        Dump the generated code to stderr
+ *
+ *  Batch mode (several inputs, several archs, or --jobs) compiles every
+ *  input for every arch on a thread pool (batch.c) and writes
+ *  <outdir>/<stem>.<arch><ext>.  @list names a file of input paths, one
+ *  per line ('#' starts a comment).
  *
  *  Pipeline:
- *   Parse Args -> Read File -> Precompiler -> Lexer -> Parser
- *      -> Backend (arch-specific) -> Write .bin  OR  JIT execute -> Cleanup
+ *   Parse Args -> Read File -> ua_compile() (Precompiler .. Emitter, ua.c)
+ *      -> Write output  OR  JIT execute  OR  simulate -> Cleanup
  *
- *  Build:  gcc -std=c99 -Wall -Wextra -pedantic -o ua.exe \
- *              main.c lexer.c parser.c codegen.c precompiler.c \
+ *  Build:  gcc -std=c99 -Wall -Wextra -pedantic -pthread -o ua.exe \
+ *              main.c ua.c diag.c batch.c lexer.c parser.c codegen.c strpool.c \
+ *              precompiler.c impcache.c linemap.c optimizer.c gc.c \
+ *              regalloc.c jit.c sim_8051.c \
  *              backend_8051.c backend_x86_64.c backend_x86_32.c \
  *              backend_arm.c backend_arm64.c backend_risc_v.c \
  *              emitter_pe.c emitter_elf.c emitter_macho.c
@@ -31,332 +59,36 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
-#include "lexer.h"
-#include "parser.h"
-#include "codegen.h"
-#include "backend_8051.h"
-#include "backend_x86_64.h"
-#include "backend_x86_32.h"
-#include "backend_arm.h"
-#include "backend_arm64.h"
-#include "backend_risc_v.h"
-#include "emitter_pe.h"
-#include "emitter_elf.h"
-#include "emitter_macho.h"
-#include "precompiler.h"
-
-#define UA_VERSION "26.0.2-ALPHA"
-
-/* Forward declaration — used by compliance tables before full definition */
-static int str_casecmp_portable(const char *a, const char *b);
-
-/* =========================================================================
- *  Opcode Compliance — Architecture / System validation tables
- *
- *  Each opcode carries two bitmasks:
- *    arch_mask  —  which architectures support the instruction
- *    sys_mask   —  which systems/OS targets support the instruction
- *
- *  If an instruction has  arch_mask == UA_AALL  and  sys_mask == UA_SALL,
- *  it is universal and accepted everywhere.  When new architecture-specific
- *  opcodes are added, restrict the masks accordingly.
- *
- *  The validation pass runs after parsing, before backend dispatch.
- * ========================================================================= */
-
-/* Architecture bitmask flags */
-#define UA_AX86     0x01u   /* x86-64                  */
-#define UA_AX86_32  0x02u   /* x86-32 (IA-32)          */
-#define UA_AARM     0x04u   /* ARM (ARMv7-A)           */
-#define UA_AARM64   0x08u   /* ARM64 (AArch64)         */
-#define UA_ARISCV   0x10u   /* RISC-V (RV64I+M)        */
-#define UA_AMCS51   0x20u   /* 8051 / MCS-51           */
-#define UA_AALL     0x3Fu   /* All architectures       */
-
-/* System/OS bitmask flags */
-#define UA_SBARE    0x01u   /* baremetal (no OS)       */
-#define UA_SWIN32   0x02u   /* Windows (win32)         */
-#define UA_SLINUX   0x04u   /* Linux                   */
-#define UA_SMACOS   0x08u   /* macOS                   */
-#define UA_SALL     0x0Fu   /* All systems             */
-
-typedef struct {
-    unsigned int arch_mask;     /* supported architectures                   */
-    unsigned int sys_mask;      /* supported systems                         */
-} OpcodeCompliance;
-
-/*
- * Compliance table — indexed by Opcode enum.
- *
- * All 37 existing opcodes are universal (UA_AALL, UA_SALL).
- * When architecture-specific instructions are introduced, restrict the
- * masks here.  The SYS opcode is restricted to non-baremetal systems
- * on architectures that require an OS for syscall support.
- *
- * NOTE: OP_SYS uses native syscall instructions (SYSCALL, SVC, ECALL)
- *       which are valid even on baremetal firmware (calling into firmware
- *       supervisor mode), so it is kept universal.
- */
-static const OpcodeCompliance OPCODE_COMPLIANCE[OP_COUNT] = {
-    /* Data movement                                                        */
-    [OP_MOV]    = { UA_AALL,  UA_SALL  },
-    [OP_LDI]    = { UA_AALL,  UA_SALL  },
-    [OP_LOAD]   = { UA_AALL,  UA_SALL  },
-    [OP_STORE]  = { UA_AALL,  UA_SALL  },
-
-    /* Arithmetic                                                           */
-    [OP_ADD]    = { UA_AALL,  UA_SALL  },
-    [OP_SUB]    = { UA_AALL,  UA_SALL  },
-    [OP_MUL]    = { UA_AALL,  UA_SALL  },
-    [OP_DIV]    = { UA_AALL,  UA_SALL  },
-
-    /* Bitwise                                                              */
-    [OP_AND]    = { UA_AALL,  UA_SALL  },
-    [OP_OR]     = { UA_AALL,  UA_SALL  },
-    [OP_XOR]    = { UA_AALL,  UA_SALL  },
-    [OP_NOT]    = { UA_AALL,  UA_SALL  },
-    [OP_SHL]    = { UA_AALL,  UA_SALL  },
-    [OP_SHR]    = { UA_AALL,  UA_SALL  },
-
-    /* Comparison / control flow                                            */
-    [OP_CMP]    = { UA_AALL,  UA_SALL  },
-    [OP_JMP]    = { UA_AALL,  UA_SALL  },
-    [OP_JZ]     = { UA_AALL,  UA_SALL  },
-    [OP_JNZ]    = { UA_AALL,  UA_SALL  },
-    [OP_JL]     = { UA_AALL,  UA_SALL  },
-    [OP_JG]     = { UA_AALL,  UA_SALL  },
-    [OP_CALL]   = { UA_AALL,  UA_SALL  },
-    [OP_RET]    = { UA_AALL,  UA_SALL  },
-
-    /* Stack                                                                */
-    [OP_PUSH]   = { UA_AALL,  UA_SALL  },
-    [OP_POP]    = { UA_AALL,  UA_SALL  },
-
-    /* Increment / Decrement                                                */
-    [OP_INC]    = { UA_AALL,  UA_SALL  },
-    [OP_DEC]    = { UA_AALL,  UA_SALL  },
-
-    /* Software Interrupt                                                   */
-    [OP_INT]    = { UA_AALL,  UA_SALL  },
-
-    /* Variables                                                            */
-    [OP_VAR]    = { UA_AALL,  UA_SALL  },
-    [OP_SET]    = { UA_AALL,  UA_SALL  },
-    [OP_GET]    = { UA_AALL,  UA_SALL  },
-
-    /* String / Byte / Syscall                                              */
-    [OP_LDS]    = { UA_AALL,  UA_SALL  },
-    [OP_LOADB]  = { UA_AALL,  UA_SALL  },
-    [OP_STOREB] = { UA_AALL,  UA_SALL  },
-    [OP_SYS]    = { UA_AALL,  UA_SALL  },
-
-    /* Buffer allocation                                                    */
-    [OP_BUFFER] = { UA_AALL,  UA_SALL  },
-
-    /* Miscellaneous                                                        */
-    [OP_NOP]    = { UA_AALL,  UA_SALL  },
-    [OP_HLT]    = { UA_AALL,  UA_SALL  },
-
-    /* --- Architecture-specific opcodes ---------------------------------- */
-    /* x86 family (x86_32 & x86_64) */
-    [OP_CPUID]  = { UA_AX86 | UA_AX86_32,            UA_SALL  },
-    [OP_RDTSC]  = { UA_AX86 | UA_AX86_32,            UA_SALL  },
-    [OP_BSWAP]  = { UA_AX86 | UA_AX86_32,            UA_SALL  },
-    [OP_PUSHA]  = { UA_AX86_32,                       UA_SALL  },
-    [OP_POPA]   = { UA_AX86_32,                       UA_SALL  },
-
-    /* 8051 exclusive */
-    [OP_DJNZ]   = { UA_AMCS51,                        UA_SALL  },
-    [OP_CJNE]   = { UA_AMCS51,                        UA_SALL  },
-    [OP_SETB]   = { UA_AMCS51,                        UA_SALL  },
-    [OP_CLR]    = { UA_AMCS51,                        UA_SALL  },
-    [OP_RETI]   = { UA_AMCS51,                        UA_SALL  },
-
-    /* ARM & ARM64 + RISC-V for WFI */
-    [OP_WFI]    = { UA_AARM | UA_AARM64 | UA_ARISCV,  UA_SALL  },
-    [OP_DMB]    = { UA_AARM | UA_AARM64,              UA_SALL  },
-
-    /* RISC-V exclusive */
-    [OP_EBREAK] = { UA_ARISCV,                        UA_SALL  },
-    [OP_FENCE]  = { UA_ARISCV,                        UA_SALL  },
-
-    /* Assembler directives — universal */
-    [OP_ORG]    = { UA_AALL,                           UA_SALL  },
-};
-
-/* -------------------------------------------------------------------------
- *  resolve_arch_mask()  —  map an architecture string to its bitmask
- * --------------------------------------------------------------------- */
-static unsigned int resolve_arch_mask(const char *arch)
-{
-    if (str_casecmp_portable(arch, "x86") == 0)        return UA_AX86;
-    if (str_casecmp_portable(arch, "x86_32") == 0 ||
-        str_casecmp_portable(arch, "ia32") == 0)       return UA_AX86_32;
-    if (str_casecmp_portable(arch, "arm") == 0)         return UA_AARM;
-    if (str_casecmp_portable(arch, "arm64") == 0 ||
-        str_casecmp_portable(arch, "aarch64") == 0)     return UA_AARM64;
-    if (str_casecmp_portable(arch, "riscv") == 0 ||
-        str_casecmp_portable(arch, "rv64") == 0)        return UA_ARISCV;
-    if (str_casecmp_portable(arch, "mcs51") == 0)       return UA_AMCS51;
-    return 0;
-}
-
-/* -------------------------------------------------------------------------
- *  resolve_sys_mask()  —  map a system string to its bitmask
- *  Returns UA_SBARE when sys is NULL (baremetal target).
- * --------------------------------------------------------------------- */
-static unsigned int resolve_sys_mask(const char *sys)
-{
-    if (!sys)                                           return UA_SBARE;
-    if (str_casecmp_portable(sys, "baremetal") == 0)    return UA_SBARE;
-    if (str_casecmp_portable(sys, "win32") == 0)        return UA_SWIN32;
-    if (str_casecmp_portable(sys, "linux") == 0)        return UA_SLINUX;
-    if (str_casecmp_portable(sys, "macos") == 0 ||
-        str_casecmp_portable(sys, "darwin") == 0)       return UA_SMACOS;
-    return 0;
-}
-
-/* -------------------------------------------------------------------------
- *  arch_name_from_mask()  —  human-readable list of supported archs
- * --------------------------------------------------------------------- */
-static void arch_names_from_mask(unsigned int mask, char *buf, int size)
-{
-    buf[0] = '\0';
-    int pos = 0;
-    struct { unsigned int bit; const char *name; } map[] = {
-        { UA_AX86,    "x86"    },
-        { UA_AX86_32, "x86_32" },
-        { UA_AARM,    "arm"    },
-        { UA_AARM64,  "arm64"  },
-        { UA_ARISCV,  "riscv"  },
-        { UA_AMCS51,  "mcs51"  },
-    };
-    for (int i = 0; i < 6; i++) {
-        if (mask & map[i].bit) {
-            if (pos > 0 && pos < size - 2) {
-                buf[pos++] = ',';
-                buf[pos++] = ' ';
-            }
-            int nlen = (int)strlen(map[i].name);
-            if (pos + nlen < size - 1) {
-                memcpy(buf + pos, map[i].name, (size_t)nlen);
-                pos += nlen;
-            }
-        }
-    }
-    buf[pos] = '\0';
-}
-
-/* -------------------------------------------------------------------------
- *  sys_names_from_mask()  —  human-readable list of supported systems
- * --------------------------------------------------------------------- */
-static void sys_names_from_mask(unsigned int mask, char *buf, int size)
-{
-    buf[0] = '\0';
-    int pos = 0;
-    struct { unsigned int bit; const char *name; } map[] = {
-        { UA_SBARE,  "baremetal" },
-        { UA_SWIN32, "win32"     },
-        { UA_SLINUX, "linux"     },
-        { UA_SMACOS, "macos"     },
-    };
-    for (int i = 0; i < 4; i++) {
-        if (mask & map[i].bit) {
-            if (pos > 0 && pos < size - 2) {
-                buf[pos++] = ',';
-                buf[pos++] = ' ';
-            }
-            int nlen = (int)strlen(map[i].name);
-            if (pos + nlen < size - 1) {
-                memcpy(buf + pos, map[i].name, (size_t)nlen);
-                pos += nlen;
-            }
-        }
-    }
-    buf[pos] = '\0';
-}
-
-/* -------------------------------------------------------------------------
- *  validate_opcode_compliance()
- *
- *  Walk every IR instruction and verify that its opcode is supported by
- *  the target architecture and system.  Returns 0 on success, -1 on
- *  failure (diagnostics printed to stderr).
- * --------------------------------------------------------------------- */
-static int validate_opcode_compliance(const Instruction *ir, int ir_count,
-                                      const char *arch, const char *sys)
-{
-    unsigned int arch_bit = resolve_arch_mask(arch);
-    unsigned int sys_bit  = resolve_sys_mask(sys);
-    int errors = 0;
-
-    for (int i = 0; i < ir_count; i++) {
-        if (ir[i].is_label) continue;   /* labels have no opcode */
-
-        Opcode op = ir[i].opcode;
-        if (op < 0 || op >= OP_COUNT) continue;  /* safety guard */
-
-        const OpcodeCompliance *c = &OPCODE_COMPLIANCE[op];
-
-        /* Check architecture support */
-        if (arch_bit != 0 && !(c->arch_mask & arch_bit)) {
-            char supported[128];
-            arch_names_from_mask(c->arch_mask, supported,
-                                (int)sizeof(supported));
-            fprintf(stderr,
-                    "\n  UA Compliance Error\n"
-                    "  -------------------\n"
-                    "  Line %d: opcode '%s' is not supported on "
-                    "architecture '%s'\n"
-                    "  Supported architectures: %s\n\n",
-                    ir[i].line, opcode_name(op), arch, supported);
-            errors++;
-        }
-
-        /* Check system support */
-        if (sys_bit != 0 && !(c->sys_mask & sys_bit)) {
-            char supported[128];
-            sys_names_from_mask(c->sys_mask, supported,
-                               (int)sizeof(supported));
-            fprintf(stderr,
-                    "\n  UA Compliance Error\n"
-                    "  -------------------\n"
-                    "  Line %d: opcode '%s' is not supported on "
-                    "system '%s'\n"
-                    "  Supported systems: %s\n\n",
-                    ir[i].line, opcode_name(op),
-                    sys ? sys : "baremetal", supported);
-            errors++;
-        }
-    }
-
-    if (errors > 0) {
-        fprintf(stderr, "[Compliance] %d opcode violation(s) found.\n",
-                errors);
-        return -1;
-    }
-
-    return 0;
-}
-
-/* =========================================================================
- *  Platform-specific JIT headers
- * ========================================================================= */
-#ifdef _WIN32
-    #include <windows.h>
-#else
-    #include <sys/mman.h>
-#endif
+#include "ua.h"
+#include "diag.h"
+#include "jit.h"
+#include "sim_8051.h"
+#include "batch.h"
 
 /* =========================================================================
  *  Configuration – populated by argument parsing
  * ========================================================================= */
 typedef struct {
     const char *input_file;     /* Path to .ua source file (mandatory)   */
+    const char **inputs;        /* Every input / @list argument, in order */
+    int         input_count;
+    int         input_cap;
     const char *output_file;    /* Path to output binary    (default a.out) */
+    int         output_set;     /* 1 = -o given (batch: output directory) */
+    int         jobs;           /* --jobs N  (0 = one per CPU)            */
     const char *arch;           /* Target architecture      (mandatory)   */
     const char *sys;            /* Target OS / system       (optional)    */
     int         run;            /* 1 = JIT execute, 0 = write .bin        */
+    const char *entry;          /* JIT / sim entry label (NULL = offset 0) */
+    int         sim;            /* 1 = run on the 8051 simulator          */
+    unsigned long long sim_cycles; /* --sim-cycles budget                 */
+    int         verbosity;      /* -q / -v / --trace-codegen (diag.h)     */
+    int         hexdump;        /* 1 = --hexdump the generated code       */
+    int         gc_report;      /* 1 = --gc-report                        */
+    const char *import_cache;   /* --import-cache directory (NULL = off)  */
+    int         debug_info;     /* 1 = -g                                 */
+    int         opt_level;      /* 0 = none, 1 = IR peephole pass,
+                                   2 = + VAR register allocation          */
     char        exe_dir[1024];  /* Directory of compiler executable       */
 } Config;
 
@@ -368,24 +100,63 @@ static void usage(const char *progname)
     fprintf(stderr,
         "UA - Unified Assembler\n\n"
         "Usage:\n"
-        "  %s <input.ua> -arch <architecture> [-o <output>] [-sys <system>] [--run]\n\n"
+        "  %s <input.ua> -arch <architecture> [-o <output>] [-sys <system>] [-O1|-O2]\n"
+        "     [--run [--entry <label>]] [--sim [--sim-cycles <n>]]\n"
+        "  %s <input.ua|@list>... -arch <arch>[,<arch>...] [--jobs <n>] [-o <dir>] ...\n\n"
         "Required:\n"
         "  <input.ua>       Path to the UA source file\n"
         "  -arch <arch>      Target architecture: mcs51, x86, x86_32, arm, arm64, riscv\n\n"
         "Optional:\n"
         "  -o <output>       Output file path (default: a.out)\n"
         "  -sys <system>     Target system:  baremetal, win32, linux, macos\n"
+        "  -O0, -O1, -O2     Optimisation level (default: -O0; -O1 = IR peephole,\n"
+        "                    -O2 = -O1 + VARs in registers on x86, arm64, riscv)\n"
         "  --run             JIT-execute the generated code (x86 only)\n"
-        "  -v, --version     Print version information and exit\n\n"
+        "  --entry <label>   Start --run / --sim at <label> instead of the first byte\n"
+        "  --sim             Simulate mcs51 code: cycles, registers, per-label profile\n"
+        "  --sim-cycles <n>  Stop the simulation after <n> machine cycles\n"
+        "                    (default: 1000000; not halting by then fails)\n"
+        "  --jobs <n>        Compile in batch mode on <n> threads (default: CPUs)\n"
+        "  --gc-report       List unreferenced imported code and data that was\n"
+        "                    dropped, and the bytes saved\n"
+        "  --import-cache <dir>  Reuse preprocessed @IMPORT files kept in <dir>\n"
+        "  -g                Add DWARF source lines to ELF output (-sys linux)\n"
+        "  -q, --quiet       Print errors and warnings only\n"
+        "  -v, --verbose     Also print phase details (symbols, segments, stats)\n"
+        "  --trace-codegen   Also print every instruction the backend translates\n"
+        "  --hexdump         Dump the generated code to stderr\n"
+        "  --version         Print version information and exit\n\n"
         "Example:\n"
         "  %s program.ua -arch x86 --run\n"
         "  %s program.ua -arch mcs51 -o program.bin\n"
+        "  %s program.ua -arch mcs51 --sim\n"
         "  %s program.ua -arch arm64 -sys macos -o program\n"
-        "  %s program.ua -arch riscv -sys linux -o program.elf\n",
-        progname, progname, progname, progname, progname);
+        "  %s program.ua -arch riscv -sys linux -o program.elf\n"
+        "  %s @sources.txt -arch x86,arm64,riscv -sys linux --jobs 8 -o build\n",
+        progname, progname, progname, progname, progname, progname, progname,
+        progname);
     exit(EXIT_FAILURE);
 }
 
+/* =========================================================================
+ *  add_input()  –  append an input path (or @list argument) to the Config
+ * ========================================================================= */
+static void add_input(Config *cfg, const char *path)
+{
+    if (cfg->input_count == cfg->input_cap) {
+        int new_cap = cfg->input_cap ? cfg->input_cap * 2 : 16;
+        const char **tmp = (const char **)realloc((void *)cfg->inputs,
+                                     (size_t)new_cap * sizeof(const char *));
+        if (!tmp) {
+            fprintf(stderr, "Error: out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+        cfg->inputs    = tmp;
+        cfg->input_cap = new_cap;
+    }
+    cfg->inputs[cfg->input_count++] = path;
+}
+
 /* =========================================================================
  *  parse_args()  –  parse argc/argv into a Config struct
  *
@@ -396,10 +167,24 @@ static int parse_args(int argc, char *argv[], Config *cfg)
 {
     /* Defaults */
     cfg->input_file  = NULL;
+    cfg->inputs      = NULL;
+    cfg->input_count = 0;
+    cfg->input_cap   = 0;
     cfg->output_file = "a.out";
+    cfg->output_set  = 0;
+    cfg->jobs        = -1;
     cfg->arch        = NULL;
     cfg->sys         = NULL;
     cfg->run         = 0;
+    cfg->entry       = NULL;
+    cfg->sim         = 0;
+    cfg->sim_cycles  = 1000000ULL;
+    cfg->verbosity   = DIAG_NORMAL;
+    cfg->hexdump     = 0;
+    cfg->gc_report   = 0;
+    cfg->import_cache = NULL;
+    cfg->debug_info  = 0;
+    cfg->opt_level   = 0;
     cfg->exe_dir[0]  = '\0';
 
     if (argc < 2) {
@@ -433,6 +218,7 @@ static int parse_args(int argc, char *argv[], Config *cfg)
                 usage(argv[0]);
             }
             cfg->output_file = argv[++i];
+            cfg->output_set  = 1;
         }
         else if (strcmp(argv[i], "-arch") == 0) {
             if (i + 1 >= argc) {
@@ -451,8 +237,79 @@ static int parse_args(int argc, char *argv[], Config *cfg)
         else if (strcmp(argv[i], "--run") == 0) {
             cfg->run = 1;
         }
+        else if (strcmp(argv[i], "--entry") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --entry requires a label name.\n");
+                usage(argv[0]);
+            }
+            cfg->entry = argv[++i];
+        }
+        else if (strcmp(argv[i], "--sim") == 0) {
+            cfg->sim = 1;
+        }
+        else if (strcmp(argv[i], "--sim-cycles") == 0) {
+            char *end = NULL;
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --sim-cycles requires a cycle count.\n");
+                usage(argv[0]);
+            }
+            unsigned long long n = strtoull(argv[++i], &end, 0);
+            if (*argv[i] == '\0' || *argv[i] == '-' || *end != '\0' || n == 0) {
+                fprintf(stderr, "Error: invalid cycle count '%s'.\n", argv[i]);
+                usage(argv[0]);
+            }
+            cfg->sim_cycles = n;
+        }
+        else if (strcmp(argv[i], "--jobs") == 0 || strcmp(argv[i], "-j") == 0) {
+            char *end = NULL;
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --jobs requires a thread count.\n");
+                usage(argv[0]);
+            }
+            long n = strtol(argv[++i], &end, 10);
+            if (*argv[i] == '\0' || *end != '\0' || n < 0 || n > 1024) {
+                fprintf(stderr, "Error: invalid thread count '%s'.\n", argv[i]);
+                usage(argv[0]);
+            }
+            cfg->jobs = (int)n;
+        }
+        else if (strcmp(argv[i], "-O0") == 0) {
+            cfg->opt_level = 0;
+        }
+        else if (strcmp(argv[i], "-O1") == 0) {
+            cfg->opt_level = 1;
+        }
+        else if (strcmp(argv[i], "-O2") == 0) {
+            cfg->opt_level = 2;
+        }
+        else if (strcmp(argv[i], "-q") == 0 ||
+                 strcmp(argv[i], "--quiet") == 0) {
+            cfg->verbosity = DIAG_QUIET;
+        }
         else if (strcmp(argv[i], "-v") == 0 ||
-                 strcmp(argv[i], "--version") == 0) {
+                 strcmp(argv[i], "--verbose") == 0) {
+            cfg->verbosity = DIAG_VERBOSE;
+        }
+        else if (strcmp(argv[i], "--trace-codegen") == 0) {
+            cfg->verbosity = DIAG_TRACE;
+        }
+        else if (strcmp(argv[i], "--hexdump") == 0) {
+            cfg->hexdump = 1;
+        }
+        else if (strcmp(argv[i], "--gc-report") == 0) {
+            cfg->gc_report = 1;
+        }
+        else if (strcmp(argv[i], "--import-cache") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --import-cache requires a directory.\n");
+                usage(argv[0]);
+            }
+            cfg->import_cache = argv[++i];
+        }
+        else if (strcmp(argv[i], "-g") == 0) {
+            cfg->debug_info = 1;
+        }
+        else if (strcmp(argv[i], "--version") == 0) {
             printf("UA - Unified Assembler v%s\n", UA_VERSION);
             exit(EXIT_SUCCESS);
         }
@@ -460,21 +317,15 @@ static int parse_args(int argc, char *argv[], Config *cfg)
             fprintf(stderr, "Error: unknown option '%s'.\n", argv[i]);
             usage(argv[0]);
         }
-        /* ---- positional: input file ----------------------------------- */
+        /* ---- positional: input file or @list -------------------------- */
         else {
-            if (cfg->input_file != NULL) {
-                fprintf(stderr,
-                    "Error: multiple input files specified ('%s' and '%s').\n",
-                    cfg->input_file, argv[i]);
-                usage(argv[0]);
-            }
-            cfg->input_file = argv[i];
+            add_input(cfg, argv[i]);
         }
         i++;
     }
 
     /* ---- validate mandatory fields ------------------------------------ */
-    if (cfg->input_file == NULL) {
+    if (cfg->input_count == 0) {
         fprintf(stderr, "Error: no input file specified.\n");
         usage(argv[0]);
     }
@@ -539,6 +390,56 @@ static char* read_file(const char *filename)
     return buffer;
 }
 
+/* =========================================================================
+ *  expand_input_lists()  –  replace each @list argument by the paths it names
+ *
+ *  One path per line; blank lines and lines starting with '#' are skipped.
+ *  The list buffers stay allocated for the life of the process.
+ *  Returns 0 on success, non-zero on failure (diagnostic printed).
+ * ========================================================================= */
+static int expand_input_lists(Config *cfg)
+{
+    const char **args = cfg->inputs;
+    int          argn = cfg->input_count;
+
+    cfg->inputs      = NULL;
+    cfg->input_count = 0;
+    cfg->input_cap   = 0;
+
+    for (int a = 0; a < argn; a++) {
+        if (args[a][0] != '@') {
+            add_input(cfg, args[a]);
+            continue;
+        }
+        char *list = read_file(args[a] + 1);
+        if (!list) {
+            free((void *)args);
+            return 1;
+        }
+        char *line = list;
+        while (*line) {
+            char *end = line;
+            while (*end && *end != '\n') end++;
+            char *next = *end ? end + 1 : end;
+            /* trim CR / trailing blanks and leading blanks */
+            while (end > line && (end[-1] == '\r' || end[-1] == ' ' ||
+                                  end[-1] == '\t'))
+                end--;
+            *end = '\0';
+            while (*line == ' ' || *line == '\t') line++;
+            if (*line && *line != '#') add_input(cfg, line);
+            line = next;
+        }
+    }
+    free((void *)args);
+
+    if (cfg->input_count == 0) {
+        fprintf(stderr, "Error: no input files in the list.\n");
+        return 1;
+    }
+    return 0;
+}
+
 /* =========================================================================
  *  write_binary()  –  write raw bytes to a file in binary mode
  *
@@ -566,111 +467,190 @@ static int write_binary(const char *filename, const uint8_t *data, int size)
 }
 
 /* =========================================================================
- *  str_casecmp_portable()  –  case-insensitive string compare (ANSI C)
- * ========================================================================= */
-static int str_casecmp_portable(const char *a, const char *b)
-{
-    while (*a && *b) {
-        char ca = *a, cb = *b;
-        if (ca >= 'A' && ca <= 'Z') ca += 32;
-        if (cb >= 'A' && cb <= 'Z') cb += 32;
-        if (ca != cb) return ca - cb;
-        a++; b++;
-    }
-    return (unsigned char)*a - (unsigned char)*b;
-}
-
-/* =========================================================================
- *  JIT Execution  –  allocate RWX memory, copy code, call as function
- *
- *  The generated x86-64 code ends with RET (C3), so calling the buffer
- *  as a void->int64 function is safe.  RAX holds the return value.
+ *  JIT Execution  –  load into a W^X arena and call an entry point
  *
- *  Platform:
- *    Windows — VirtualAlloc  (PAGE_EXECUTE_READWRITE)
- *    POSIX   — mmap          (PROT_READ | PROT_WRITE | PROT_EXEC)
+ *  The generated x86-64 code ends with RET (C3), so the entry can be
+ *  called like a function; jit_call() returns R0 (RAX).  See jit.h.
  * ========================================================================= */
-typedef int64_t (*JitFunc)(void);
-
-static int execute_jit(const CodeBuffer *code)
+static int execute_jit(const CodeBuffer *code, const char *entry, int quiet)
 {
-    if (!code || code->size == 0) {
-        fprintf(stderr, "Error: no code to execute.\n");
+    JitArena *jit = jit_create();
+    if (!jit) return 1;
+
+    JitModule *mod = jit_load(jit, code);
+    if (!mod) {
+        jit_destroy(jit);
         return 1;
     }
-
-#ifdef _WIN32
-    /* ---------- Windows ------------------------------------------------ */
-    void *exec_mem = VirtualAlloc(
-        NULL,
-        (SIZE_T)code->size,
-        MEM_COMMIT | MEM_RESERVE,
-        PAGE_EXECUTE_READWRITE);
-
-    if (!exec_mem) {
-        fprintf(stderr, "Error: VirtualAlloc failed (err %lu).\n",
-                GetLastError());
+    void *func = jit_lookup(mod, entry);
+    if (!func) {
+        fprintf(stderr, "Error: entry label '%s' is not defined.\n", entry);
+        jit_destroy(jit);
         return 1;
     }
 
-    memcpy(exec_mem, code->bytes, (size_t)code->size);
+    if (!quiet)
+        fprintf(stderr,
+            "\n  ┌──────────────────────────────────────┐\n"
+            "  │  JIT: Entering generated x86-64 code │\n"
+            "  └──────────────────────────────────────┘\n\n");
 
-    fprintf(stderr,
-        "\n  ┌──────────────────────────────────────┐\n"
-        "  │  JIT: Entering generated x86-64 code │\n"
-        "  └──────────────────────────────────────┘\n\n");
-
-    /* memcpy avoids ISO C object->function-pointer cast warning */
-    JitFunc func;
-    memcpy(&func, &exec_mem, sizeof(func));
-    int64_t result = func();
+    int64_t regs[JIT_REG_COUNT] = { 0 };
+    int64_t result = jit_call(jit, func, regs);
 
-    fprintf(stderr,
-        "\n  ┌──────────────────────────────────────┐\n"
-        "  │  JIT: Returned from generated code   │\n"
-        "  └──────────────────────────────────────┘\n");
+    if (!quiet)
+        fprintf(stderr,
+            "\n  ┌──────────────────────────────────────┐\n"
+            "  │  JIT: Returned from generated code   │\n"
+            "  └──────────────────────────────────────┘\n");
     fprintf(stderr, "  RAX (R0) = %lld  (0x%llX)\n\n",
             (long long)result, (unsigned long long)result);
 
-    VirtualFree(exec_mem, 0, MEM_RELEASE);
-
-#else
-    /* ---------- POSIX (Linux / macOS) ---------------------------------- */
-    void *exec_mem = mmap(
-        NULL,
-        (size_t)code->size,
-        PROT_READ | PROT_WRITE | PROT_EXEC,
-        MAP_PRIVATE | MAP_ANONYMOUS,
-        -1, 0);
+    jit_destroy(jit);
+    return 0;
+}
 
-    if (exec_mem == MAP_FAILED) {
-        perror("mmap");
+/* =========================================================================
+ *  8051 Simulation  –  run the image on the MCS-51 simulator
+ *
+ *  Prints R0 (as --run does), the register / SFR state, the cycle count
+ *  and the per-label profile.  Fails on a fault, or if the program has
+ *  not halted within the cycle budget.  See sim_8051.h.
+ * ========================================================================= */
+static int execute_sim(const CodeBuffer *code, const char *entry,
+                       unsigned long long max_cycles, int quiet)
+{
+    Sim8051 *sim = sim8051_create(code);
+    if (!sim) return 1;
+    if (entry && sim8051_set_entry(sim, code, entry) != 0) {
+        fprintf(stderr, "Error: entry label '%s' is not defined.\n", entry);
+        sim8051_destroy(sim);
         return 1;
     }
 
-    memcpy(exec_mem, code->bytes, (size_t)code->size);
+    Sim8051Stop stop = sim8051_run(sim, max_cycles);
+
+    int rc = 0;
+    switch (stop) {
+    case SIM8051_HALTED:
+        if (!quiet)
+            fprintf(stderr, "\n[8051 sim] Halted at 0x%04X\n", sim->pc);
+        break;
+    case SIM8051_LIMIT:
+        fprintf(stderr, "\n[8051 sim] Did not halt within %llu cycles "
+                        "(PC 0x%04X)\n", max_cycles, sim->pc);
+        rc = 1;
+        break;
+    case SIM8051_FAULT:
+        fprintf(stderr, "\n[8051 sim] Fault: %s\n", sim->fault);
+        rc = 1;
+        break;
+    }
+    if (!quiet) {
+        sim8051_print_state(sim, stderr);
+        sim8051_print_profile(sim, code, stderr);
+    }
+    fprintf(stderr, "  R0 = %d  (0x%02X), %llu cycles\n\n",
+            sim8051_reg(sim, 0), sim8051_reg(sim, 0),
+            (unsigned long long)sim->cycles);
+
+    sim8051_destroy(sim);
+    return rc;
+}
 
-    fprintf(stderr,
-        "\n  ┌──────────────────────────────────────┐\n"
-        "  │  JIT: Entering generated x86-64 code │\n"
-        "  └──────────────────────────────────────┘\n\n");
+/* =========================================================================
+ *  same_stem()  –  do two paths share their file name without extension?
+ * ========================================================================= */
+static int same_stem(const char *a, const char *b)
+{
+    const char *sa = a, *sb = b;
+    for (const char *p = a; *p; p++) if (*p == '/' || *p == '\\') sa = p + 1;
+    for (const char *p = b; *p; p++) if (*p == '/' || *p == '\\') sb = p + 1;
+    const char *da = strrchr(sa, '.'), *db = strrchr(sb, '.');
+    size_t la = (da && da != sa) ? (size_t)(da - sa) : strlen(sa);
+    size_t lb = (db && db != sb) ? (size_t)(db - sb) : strlen(sb);
+    return la == lb && memcmp(sa, sb, la) == 0;
+}
 
-    /* memcpy avoids ISO C object->function-pointer cast warning */
-    JitFunc func;
-    memcpy(&func, &exec_mem, sizeof(func));
-    int64_t result = func();
+/* =========================================================================
+ *  run_batch()  –  every input x every -arch on a worker pool (batch.c)
+ * ========================================================================= */
+static int run_batch(const Config *cfg)
+{
+    /* ---- split the comma-separated -arch list ------------------------- */
+    char arch_buf[256];
+    const char *archs[16];
+    int arch_count = 0;
+    snprintf(arch_buf, sizeof(arch_buf), "%s", cfg->arch);
+    for (char *tok = strtok(arch_buf, ","); tok; tok = strtok(NULL, ",")) {
+        if (arch_count == (int)(sizeof(archs) / sizeof(archs[0]))) {
+            fprintf(stderr, "Error: too many architectures in -arch.\n");
+            return EXIT_FAILURE;
+        }
+        archs[arch_count++] = tok;
+    }
+    if (arch_count == 0) {
+        fprintf(stderr, "Error: -arch is required.\n");
+        return EXIT_FAILURE;
+    }
 
-    fprintf(stderr,
-        "\n  ┌──────────────────────────────────────┐\n"
-        "  │  JIT: Returned from generated code   │\n"
-        "  └──────────────────────────────────────┘\n");
-    fprintf(stderr, "  RAX (R0) = %lld  (0x%llX)\n\n",
-            (long long)result, (unsigned long long)result);
+    /* ---- outputs are named after the input stem: refuse clashes ------ */
+    for (int i = 0; i < cfg->input_count; i++) {
+        for (int j = i + 1; j < cfg->input_count; j++) {
+            if (same_stem(cfg->inputs[i], cfg->inputs[j])) {
+                fprintf(stderr, "Error: '%s' and '%s' would write the same "
+                                "output files.\n",
+                        cfg->inputs[i], cfg->inputs[j]);
+                return EXIT_FAILURE;
+            }
+        }
+    }
 
-    munmap(exec_mem, (size_t)code->size);
-#endif
+    int count = cfg->input_count * arch_count;
+    BatchJob *jobs = (BatchJob *)calloc((size_t)count, sizeof(BatchJob));
+    if (!jobs) {
+        fprintf(stderr, "Error: out of memory.\n");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < cfg->input_count; i++) {
+        for (int a = 0; a < arch_count; a++) {
+            jobs[i * arch_count + a].input = cfg->inputs[i];
+            jobs[i * arch_count + a].arch  = archs[a];
+        }
+    }
 
-    return 0;
+    const char *out_dir = cfg->output_set ? cfg->output_file : ".";
+    int threads = cfg->jobs > 0 ? cfg->jobs : batch_cpu_count();
+
+    if (cfg->verbosity >= DIAG_NORMAL) {
+        fprintf(stderr, "UA - Unified Assembler (batch)\n");
+        fprintf(stderr, "  Inputs : %d\n", cfg->input_count);
+        fprintf(stderr, "  Arch   : %s\n", cfg->arch);
+        if (cfg->sys)
+            fprintf(stderr, "  System : %s\n", cfg->sys);
+        fprintf(stderr, "  Output : %s\n", out_dir);
+        fprintf(stderr, "  Jobs   : %d on up to %d threads\n\n", count, threads);
+    }
+
+    ua_options base;
+    memset(&base, 0, sizeof(base));
+    base.sys       = cfg->sys;
+    base.opt_level = cfg->opt_level;
+    base.lib_dir   = cfg->exe_dir;
+    base.verbosity = cfg->verbosity;
+    base.gc_report = cfg->gc_report;
+    base.import_cache = cfg->import_cache;
+    base.debug_info = cfg->debug_info;
+
+    BatchStats stats;
+    int failed = batch_run(jobs, count, threads, &base, out_dir, stderr,
+                           &stats);
+    if (cfg->verbosity >= DIAG_NORMAL)
+        batch_print_stats(&stats, stderr);
+
+    batch_free(jobs, count);
+    free(jobs);
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 /* =========================================================================
@@ -682,15 +662,46 @@ int main(int argc, char *argv[])
     Config cfg;
     parse_args(argc, argv, &cfg);
 
-    fprintf(stderr, "UA - Unified Assembler\n");
-    fprintf(stderr, "  Input  : %s\n", cfg.input_file);
-    fprintf(stderr, "  Output : %s\n", cfg.output_file);
-    fprintf(stderr, "  Arch   : %s\n", cfg.arch);
-    if (cfg.sys)
-        fprintf(stderr, "  System : %s\n", cfg.sys);
-    if (cfg.run)
-        fprintf(stderr, "  Mode   : JIT execute\n");
-    fprintf(stderr, "\n");
+    int batch = cfg.input_count > 1 || cfg.jobs >= 0 ||
+                strchr(cfg.arch, ',') != NULL;
+    for (int i = 0; i < cfg.input_count; i++) {
+        if (cfg.inputs[i][0] == '@') batch = 1;
+    }
+    if (batch) {
+        if (cfg.run || cfg.sim || cfg.entry || cfg.hexdump) {
+            fprintf(stderr, "Error: --run, --sim, --entry and --hexdump take "
+                            "a single input and architecture.\n");
+            return EXIT_FAILURE;
+        }
+        if (expand_input_lists(&cfg) != 0) {
+            return EXIT_FAILURE;
+        }
+        int rc = run_batch(&cfg);
+        free((void *)cfg.inputs);
+        return rc;
+    }
+    cfg.input_file = cfg.inputs[0];
+    free((void *)cfg.inputs);
+
+    if (cfg.sim && (cfg.run || ua_casecmp(cfg.arch, "mcs51") != 0)) {
+        fprintf(stderr, "Error: --sim runs -arch mcs51 code only "
+                        "(use --run for x86).\n");
+        return EXIT_FAILURE;
+    }
+
+    if (cfg.verbosity >= DIAG_NORMAL) {
+        fprintf(stderr, "UA - Unified Assembler\n");
+        fprintf(stderr, "  Input  : %s\n", cfg.input_file);
+        fprintf(stderr, "  Output : %s\n", cfg.output_file);
+        fprintf(stderr, "  Arch   : %s\n", cfg.arch);
+        if (cfg.sys)
+            fprintf(stderr, "  System : %s\n", cfg.sys);
+        if (cfg.run)
+            fprintf(stderr, "  Mode   : JIT execute\n");
+        if (cfg.sim)
+            fprintf(stderr, "  Mode   : 8051 simulation\n");
+        fprintf(stderr, "\n");
+    }
 
     /* --- 2. Read source file ------------------------------------------- */
     char *source = read_file(cfg.input_file);
@@ -698,7 +709,7 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    /* --- 2b. Precompiler ----------------------------------------------- */
+    /* --- 3. Compile (precompiler .. emitter, see ua.c) ---------------- */
     char base_dir[1024];
     {
         const char *last_sep = NULL;
@@ -714,311 +725,78 @@ int main(int argc, char *argv[])
             base_dir[0] = '.'; base_dir[1] = '\0';
         }
     }
-    char *preprocessed = preprocess(source, cfg.arch, cfg.sys,
-                                    base_dir, cfg.input_file,
-                                    cfg.exe_dir);
-    if (!preprocessed) {
-        fprintf(stderr, "Error: preprocessing failed.\n");
-        free(source);
-        return EXIT_FAILURE;
-    }
-    fprintf(stderr, "[Precompiler] Done\n");
 
-    /* --- 3. Lexer ------------------------------------------------------ */
-    int token_count = 0;
-    Token *tokens = tokenize(preprocessed, &token_count);
-    if (!tokens) {
-        fprintf(stderr, "Error: tokenization failed.\n");
-        free(preprocessed);
+    ua_options opt;
+    memset(&opt, 0, sizeof(opt));
+    opt.arch        = cfg.arch;
+    opt.sys         = cfg.sys;
+    opt.opt_level   = cfg.opt_level;
+    opt.jit         = cfg.run;
+    opt.label_entry = (cfg.entry != NULL);
+    opt.filename    = cfg.input_file;
+    opt.base_dir    = base_dir;
+    opt.lib_dir     = cfg.exe_dir;
+    opt.diag_stream = stderr;
+    opt.verbosity   = cfg.verbosity;
+    opt.gc_report   = cfg.gc_report;
+    opt.import_cache = cfg.import_cache;
+    opt.debug_info  = cfg.debug_info;
+
+    ua_result res;
+    if (ua_compile(&opt, source, &res) != 0) {
+        ua_result_free(&res);
         free(source);
         return EXIT_FAILURE;
     }
-    fprintf(stderr, "[Lexer]  %d tokens\n", token_count);
-
-    /* --- 4. Parser ----------------------------------------------------- */
-    int ir_count = 0;
-    Instruction *ir = parse(tokens, token_count, &ir_count);
-    if (!ir) {
-        fprintf(stderr, "Error: parsing failed.\n");
-        free(tokens);
-        free(preprocessed);
-        free(source);
-        return EXIT_FAILURE;
-    }
-    fprintf(stderr, "[Parser] %d IR instructions\n", ir_count);
+    free(source);
 
-    /* --- 4b. Opcode compliance validation ------------------------------ */
-    if (validate_opcode_compliance(ir, ir_count, cfg.arch, cfg.sys) != 0) {
-        fprintf(stderr, "Error: opcode compliance check failed.\n");
-        free_instructions(ir);
-        free(tokens);
-        free(preprocessed);
-        free(source);
-        return EXIT_FAILURE;
+    if (cfg.hexdump) {
+        fprintf(stderr, "\n");
+        hexdump(stderr, res.code->bytes, res.code->size);
     }
-    fprintf(stderr, "[Compliance] All opcodes valid for %s", cfg.arch);
-    if (cfg.sys) fprintf(stderr, " / %s", cfg.sys);
-    fprintf(stderr, "\n");
 
-    /* --- 5. Backend (architecture-specific code generation) ------------- */
+    /* --- 4. JIT execute  OR  simulate  OR  write the output file ------- */
     int rc = EXIT_SUCCESS;
 
-    if (str_casecmp_portable(cfg.arch, "mcs51") == 0) {
-        /* ---- MCS-51 / 8051 backend ------------------------------------ */
-        if (cfg.run) {
-            fprintf(stderr, "Error: --run is only supported for -arch x86.\n");
+    if (cfg.run) {
+        if (execute_jit(res.code, cfg.entry,
+                        cfg.verbosity < DIAG_NORMAL) != 0) {
             rc = EXIT_FAILURE;
-        } else {
-            CodeBuffer *code = generate_8051(ir, ir_count);
-            if (!code) {
-                fprintf(stderr, "Error: 8051 code generation failed.\n");
-                rc = EXIT_FAILURE;
-            } else {
-                fprintf(stderr, "\n");
-                hexdump(code->bytes, code->size);
-
-                if (write_binary(cfg.output_file, code->bytes, code->size) != 0) {
-                    rc = EXIT_FAILURE;
-                } else {
-                    fprintf(stderr, "\nWrote %d bytes to %s\n",
-                            code->size, cfg.output_file);
-                }
-                free_code_buffer(code);
-            }
         }
-    }
-    else if (str_casecmp_portable(cfg.arch, "x86") == 0) {
-        /* ---- x86-64 backend ------------------------------------------- */
-        CodeBuffer *code = generate_x86_64(ir, ir_count, cfg.sys);
-        if (!code) {
-            fprintf(stderr, "Error: x86-64 code generation failed.\n");
+    } else if (cfg.sim) {
+        if (execute_sim(res.code, cfg.entry, cfg.sim_cycles,
+                        cfg.verbosity < DIAG_NORMAL) != 0) {
             rc = EXIT_FAILURE;
-        } else {
-            fprintf(stderr, "\n");
-            hexdump(code->bytes, code->size);
-
-            if (cfg.run) {
-                /* JIT execute */
-                if (execute_jit(code) != 0) {
-                    rc = EXIT_FAILURE;
-                }
-            }
-            else if (cfg.sys != NULL &&
-                     str_casecmp_portable(cfg.sys, "win32") == 0) {
-                /* Emit PE executable */
-                const char *pe_out = cfg.output_file;
-                if (strcmp(pe_out, "a.out") == 0) {
-                    pe_out = "a.exe";
-                }
-                if (emit_pe_exe(pe_out, code) != 0) {
-                    rc = EXIT_FAILURE;
-                }
-            }
-            else if (cfg.sys != NULL &&
-                     str_casecmp_portable(cfg.sys, "linux") == 0) {
-                /* Emit ELF executable */
-                const char *elf_out = cfg.output_file;
-                if (strcmp(elf_out, "a.out") == 0) {
-                    elf_out = "a.elf";
-                }
-                if (emit_elf_exe(elf_out, code) != 0) {
-                    rc = EXIT_FAILURE;
-                }
-            }
-            else {
-                /* Write raw binary */
-                if (write_binary(cfg.output_file, code->bytes, code->size) != 0) {
-                    rc = EXIT_FAILURE;
-                } else {
-                    fprintf(stderr, "\nWrote %d bytes to %s\n",
-                            code->size, cfg.output_file);
-                }
-            }
-            free_code_buffer(code);
-        }
-    }
-    else if (str_casecmp_portable(cfg.arch, "x86_32") == 0 ||
-             str_casecmp_portable(cfg.arch, "ia32") == 0) {
-        /* ---- x86-32 (IA-32) backend ---------------------------------- */
-        if (cfg.run) {
-            fprintf(stderr, "Error: --run is only supported for -arch x86.\n");
-            rc = EXIT_FAILURE;
-        } else {
-            CodeBuffer *code = generate_x86_32(ir, ir_count);
-            if (!code) {
-                fprintf(stderr, "Error: x86-32 code generation failed.\n");
-                rc = EXIT_FAILURE;
-            } else {
-                fprintf(stderr, "\n");
-                hexdump(code->bytes, code->size);
-
-                if (cfg.sys != NULL &&
-                    str_casecmp_portable(cfg.sys, "win32") == 0) {
-                    const char *pe_out = cfg.output_file;
-                    if (strcmp(pe_out, "a.out") == 0) {
-                        pe_out = "a.exe";
-                    }
-                    if (emit_pe_exe(pe_out, code) != 0) {
-                        rc = EXIT_FAILURE;
-                    }
-                }
-                else if (cfg.sys != NULL &&
-                         str_casecmp_portable(cfg.sys, "linux") == 0) {
-                    const char *elf_out = cfg.output_file;
-                    if (strcmp(elf_out, "a.out") == 0) {
-                        elf_out = "a.elf";
-                    }
-                    if (emit_elf_exe(elf_out, code) != 0) {
-                        rc = EXIT_FAILURE;
-                    }
-                }
-                else {
-                    if (write_binary(cfg.output_file, code->bytes, code->size) != 0) {
-                        rc = EXIT_FAILURE;
-                    } else {
-                        fprintf(stderr, "\nWrote %d bytes to %s\n",
-                                code->size, cfg.output_file);
-                    }
-                }
-                free_code_buffer(code);
-            }
-        }
-    }
-    else if (str_casecmp_portable(cfg.arch, "arm") == 0) {
-        /* ---- ARM (ARMv7-A) backend ------------------------------------ */
-        if (cfg.run) {
-            fprintf(stderr, "Error: --run is only supported for -arch x86.\n");
-            rc = EXIT_FAILURE;
-        } else {
-            CodeBuffer *code = generate_arm(ir, ir_count);
-            if (!code) {
-                fprintf(stderr, "Error: ARM code generation failed.\n");
-                rc = EXIT_FAILURE;
-            } else {
-                fprintf(stderr, "\n");
-                hexdump(code->bytes, code->size);
-
-                if (cfg.sys != NULL &&
-                    str_casecmp_portable(cfg.sys, "linux") == 0) {
-                    const char *elf_out = cfg.output_file;
-                    if (strcmp(elf_out, "a.out") == 0) {
-                        elf_out = "a.elf";
-                    }
-                    if (emit_elf_exe(elf_out, code) != 0) {
-                        rc = EXIT_FAILURE;
-                    }
-                }
-                else {
-                    if (write_binary(cfg.output_file, code->bytes, code->size) != 0) {
-                        rc = EXIT_FAILURE;
-                    } else {
-                        fprintf(stderr, "\nWrote %d bytes to %s\n",
-                                code->size, cfg.output_file);
-                    }
-                }
-                free_code_buffer(code);
-            }
         }
-    }
-    else if (str_casecmp_portable(cfg.arch, "arm64") == 0 ||
-             str_casecmp_portable(cfg.arch, "aarch64") == 0) {
-        /* ---- ARM64 / AArch64 backend --------------------------------- */
-        if (cfg.run) {
-            fprintf(stderr, "Error: --run is only supported for -arch x86.\n");
-            rc = EXIT_FAILURE;
-        } else {
-            CodeBuffer *code = generate_arm64(ir, ir_count);
-            if (!code) {
-                fprintf(stderr, "Error: ARM64 code generation failed.\n");
-                rc = EXIT_FAILURE;
-            } else {
-                fprintf(stderr, "\n");
-                hexdump(code->bytes, code->size);
-
-                if (cfg.sys != NULL &&
-                    (str_casecmp_portable(cfg.sys, "macos") == 0 ||
-                     str_casecmp_portable(cfg.sys, "darwin") == 0)) {
-                    /* Emit Mach-O executable */
-                    const char *macho_out = cfg.output_file;
-                    if (strcmp(macho_out, "a.out") == 0) {
-                        macho_out = "a.macho";
-                    }
-                    if (emit_macho_exe(macho_out, code) != 0) {
-                        rc = EXIT_FAILURE;
-                    }
-                }
-                else if (cfg.sys != NULL &&
-                         str_casecmp_portable(cfg.sys, "linux") == 0) {
-                    /* Emit ELF executable */
-                    const char *elf_out = cfg.output_file;
-                    if (strcmp(elf_out, "a.out") == 0) {
-                        elf_out = "a.elf";
-                    }
-                    if (emit_elf_exe(elf_out, code) != 0) {
-                        rc = EXIT_FAILURE;
-                    }
-                }
-                else {
-                    if (write_binary(cfg.output_file, code->bytes, code->size) != 0) {
-                        rc = EXIT_FAILURE;
-                    } else {
-                        fprintf(stderr, "\nWrote %d bytes to %s\n",
-                                code->size, cfg.output_file);
-                    }
-                }
-                free_code_buffer(code);
-            }
+    } else {
+        const char *out    = cfg.output_file;
+        const char *prefix = "\n";
+        switch (res.format) {
+        case UA_FORMAT_PE:
+            if (strcmp(out, "a.out") == 0) out = "a.exe";
+            prefix = "[PE] ";
+            break;
+        case UA_FORMAT_ELF:
+            if (strcmp(out, "a.out") == 0) out = "a.elf";
+            prefix = "[ELF] ";
+            break;
+        case UA_FORMAT_MACHO:
+            if (strcmp(out, "a.out") == 0) out = "a.macho";
+            prefix = "[Mach-O] ";
+            break;
+        case UA_FORMAT_RAW:
+            break;
         }
-    }
-    else if (str_casecmp_portable(cfg.arch, "riscv") == 0 ||
-             str_casecmp_portable(cfg.arch, "rv64") == 0) {
-        /* ---- RISC-V (RV64I+M) backend -------------------------------- */
-        if (cfg.run) {
-            fprintf(stderr, "Error: --run is only supported for -arch x86.\n");
+        if (write_binary(out, res.image, res.image_size) != 0) {
             rc = EXIT_FAILURE;
-        } else {
-            CodeBuffer *code = generate_risc_v(ir, ir_count);
-            if (!code) {
-                fprintf(stderr, "Error: RISC-V code generation failed.\n");
-                rc = EXIT_FAILURE;
-            } else {
-                fprintf(stderr, "\n");
-                hexdump(code->bytes, code->size);
-
-                if (cfg.sys != NULL &&
-                    str_casecmp_portable(cfg.sys, "linux") == 0) {
-                    /* Emit ELF executable */
-                    const char *elf_out = cfg.output_file;
-                    if (strcmp(elf_out, "a.out") == 0) {
-                        elf_out = "a.elf";
-                    }
-                    if (emit_elf_exe(elf_out, code) != 0) {
-                        rc = EXIT_FAILURE;
-                    }
-                }
-                else {
-                    if (write_binary(cfg.output_file, code->bytes, code->size) != 0) {
-                        rc = EXIT_FAILURE;
-                    } else {
-                        fprintf(stderr, "\nWrote %d bytes to %s\n",
-                                code->size, cfg.output_file);
-                    }
-                }
-                free_code_buffer(code);
-            }
+        } else if (cfg.verbosity >= DIAG_NORMAL) {
+            fprintf(stderr, "%sWrote %d bytes to %s\n",
+                    prefix, res.image_size, out);
         }
     }
-    else {
-        fprintf(stderr, "Error: unknown architecture '%s'.\n", cfg.arch);
-        fprintf(stderr, "Supported architectures: mcs51, x86, x86_32, arm, arm64, riscv\n");
-        rc = EXIT_FAILURE;
-    }
 
-    /* --- 6. Cleanup ---------------------------------------------------- */
-    free_instructions(ir);
-    free(tokens);
-    free(preprocessed);
-    free(source);
+    /* --- 5. Cleanup ---------------------------------------------------- */
+    ua_result_free(&res);
 
     return rc;
 }
@@ -0,0 +1,301 @@
+/*
+ * =============================================================================
+ *  UA - Unified Assembler
+ *  IR Peephole Optimizer
+ *
+ *  File:    optimizer.c
+ *  Purpose: Table-driven peephole rules over the parsed IR (-O1).
+ *
+ *  Each rule inspects the instruction at index i (plus the entries that
+ *  immediately follow it) and returns a bitmask of entries to delete,
+ *  bit k selecting ir[i + k].  Labels are IR entries too, so a window
+ *  never spans a jump target.  Deleted entries are compacted out after
+ *  every pass, and passes repeat until nothing more matches.
+ *
+ *  License: MIT
+ * =============================================================================
+ */
+
+#include "optimizer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+/* =========================================================================
+ *  Constants
+ * ========================================================================= */
+#define PEEP_MAX_PASSES     16
+#define PEEP_COND_SCAN      32     /* entries searched for the next CMP   */
+
+/* Architecture masks for rule applicability */
+#define PEEP_A_X86      0x01
+#define PEEP_A_X86_32   0x02
+#define PEEP_A_ARM      0x04
+#define PEEP_A_ARM64    0x08
+#define PEEP_A_RISCV    0x10
+#define PEEP_A_MCS51    0x20
+#define PEEP_A_ALL      0x3F
+
+/* =========================================================================
+ *  Rule table types
+ * ========================================================================= */
+typedef unsigned (*PeepMatchFn)(const Instruction *ir, int i, int n);
+
+typedef struct {
+    const char  *name;          /* short id shown in the statistics       */
+    const char  *pattern;       /* human-readable before -> after          */
+    unsigned     archs;         /* architectures the rule is valid for     */
+    unsigned     cond_archs;    /* archs where deleting the matched entry
+                                   may change the branch condition state  */
+    PeepMatchFn  match;
+} PeepRule;
+
+/* =========================================================================
+ *  Operand helpers
+ * ========================================================================= */
+static int is_reg(const Operand *op)
+{
+    return op->type == OPERAND_REGISTER;
+}
+
+static int is_imm(const Operand *op, int64_t val)
+{
+    return op->type == OPERAND_IMMEDIATE && op->data.imm == val;
+}
+
+static int is_op(const Instruction *inst, Opcode op)
+{
+    return !inst->is_label && inst->opcode == op;
+}
+
+/* ADD/SUB/OR/XOR with a zero right-hand side leave Rd unchanged */
+static int is_zero_identity_alu(Opcode op)
+{
+    return op == OP_ADD || op == OP_SUB || op == OP_OR || op == OP_XOR;
+}
+
+/* =========================================================================
+ *  Rules
+ * ========================================================================= */
+
+/* MOV Rx, Rx  ->  (removed) */
+static unsigned peep_mov_self(const Instruction *ir, int i, int n)
+{
+    (void)n;
+    const Instruction *a = &ir[i];
+    if (is_op(a, OP_MOV) && is_reg(&a->operands[0]) &&
+        is_reg(&a->operands[1]) &&
+        a->operands[0].data.reg == a->operands[1].data.reg)
+        return 0x1;
+    return 0;
+}
+
+/* PUSH Rx ; POP Rx  ->  (removed) */
+static unsigned peep_push_pop(const Instruction *ir, int i, int n)
+{
+    if (i + 1 >= n) return 0;
+    const Instruction *a = &ir[i], *b = &ir[i + 1];
+    if (is_op(a, OP_PUSH) && is_op(b, OP_POP) &&
+        is_reg(&a->operands[0]) && is_reg(&b->operands[0]) &&
+        a->operands[0].data.reg == b->operands[0].data.reg)
+        return 0x3;
+    return 0;
+}
+
+/* LDI Rx, 0 ; ADD|SUB|OR|XOR Ry, Rx   ->  LDI Rx, 0
+ * ADD|SUB|OR|XOR|SHL|SHR Ry, 0        ->  (removed)                      */
+static unsigned peep_alu_zero(const Instruction *ir, int i, int n)
+{
+    const Instruction *a = &ir[i];
+    if (!a->is_label && a->operand_count == 2 && is_imm(&a->operands[1], 0) &&
+        (is_zero_identity_alu(a->opcode) ||
+         a->opcode == OP_SHL || a->opcode == OP_SHR))
+        return 0x1;
+
+    if (i + 1 >= n) return 0;
+    const Instruction *b = &ir[i + 1];
+    if (is_op(a, OP_LDI) && is_imm(&a->operands[1], 0) &&
+        !b->is_label && is_zero_identity_alu(b->opcode) &&
+        is_reg(&b->operands[1]) &&
+        b->operands[1].data.reg == a->operands[0].data.reg)
+        return 0x2;
+    return 0;
+}
+
+/* JMP L ; [other labels] ; L:  ->  L: */
+static unsigned peep_jmp_next(const Instruction *ir, int i, int n)
+{
+    const Instruction *a = &ir[i];
+    if (!is_op(a, OP_JMP) || a->operands[0].type != OPERAND_LABEL_REF)
+        return 0;
+    for (int j = i + 1; j < n && ir[j].is_label; j++) {
+        if (ir[j].label_id == a->operands[0].data.label_id)
+            return 0x1;
+    }
+    return 0;
+}
+
+/* AND Rx, y ; CMP Rx, 0  ->  AND Rx, y
+ * AND already sets ZF/SF from the result and clears CF/OF, exactly as
+ * CMP Rx, 0 would, so this is only valid on the x86 backends. */
+static unsigned peep_and_cmp0(const Instruction *ir, int i, int n)
+{
+    if (i + 1 >= n) return 0;
+    const Instruction *a = &ir[i], *b = &ir[i + 1];
+    if (is_op(a, OP_AND) && is_op(b, OP_CMP) &&
+        is_reg(&b->operands[0]) && is_imm(&b->operands[1], 0) &&
+        a->operands[0].data.reg == b->operands[0].data.reg)
+        return 0x2;
+    return 0;
+}
+
+static const PeepRule PEEP_RULES[] = {
+    { "mov-self",  "MOV Rx, Rx -> -",
+      PEEP_A_ALL, PEEP_A_MCS51, peep_mov_self },
+    { "push-pop",  "PUSH Rx ; POP Rx -> -",
+      PEEP_A_ALL, 0, peep_push_pop },
+    { "alu-zero",  "OP Ry, 0 | LDI Rx, 0 ; OP Ry, Rx -> LDI Rx, 0",
+      PEEP_A_ALL, PEEP_A_ALL, peep_alu_zero },
+    { "jmp-next",  "JMP L ; L: -> L:",
+      PEEP_A_ALL, 0, peep_jmp_next },
+    { "and-cmp0",  "AND Rx, y ; CMP Rx, 0 -> AND Rx, y",
+      PEEP_A_X86 | PEEP_A_X86_32, 0, peep_and_cmp0 },
+};
+
+#define PEEP_RULE_COUNT  ((int)(sizeof(PEEP_RULES) / sizeof(PEEP_RULES[0])))
+
+/* =========================================================================
+ *  peep_arch_mask()  –  map an -arch name to its PEEP_A_* bit
+ * ========================================================================= */
+static int peep_name_eq(const char *a, const char *b)
+{
+    while (*a && *b) {
+        if (tolower((unsigned char)*a) != tolower((unsigned char)*b))
+            return 0;
+        a++; b++;
+    }
+    return *a == *b;
+}
+
+static unsigned peep_arch_mask(const char *arch)
+{
+    if (!arch)                           return 0;
+    if (peep_name_eq(arch, "x86"))       return PEEP_A_X86;
+    if (peep_name_eq(arch, "x86_32"))    return PEEP_A_X86_32;
+    if (peep_name_eq(arch, "arm"))       return PEEP_A_ARM;
+    if (peep_name_eq(arch, "arm64"))     return PEEP_A_ARM64;
+    if (peep_name_eq(arch, "riscv"))     return PEEP_A_RISCV;
+    if (peep_name_eq(arch, "mcs51"))     return PEEP_A_MCS51;
+    return 0;
+}
+
+/* =========================================================================
+ *  peep_cond_dead()
+ *    Returns 1 if the branch condition state (flags, the RISC-V compare
+ *    register, or A on the 8051) is rewritten by a CMP before anything
+ *    can observe it, scanning forward from index `from`.  Straight-line
+ *    data operations and labels are skipped; any branch, call, return or
+ *    architecture-specific instruction ends the scan as "live".
+ * ========================================================================= */
+static int peep_cond_dead(const Instruction *ir, int from, int n)
+{
+    int limit = from + PEEP_COND_SCAN;
+    if (limit > n) limit = n;
+
+    for (int j = from; j < limit; j++) {
+        if (ir[j].is_label) continue;
+        switch (ir[j].opcode) {
+        case OP_CMP:
+            return 1;
+        case OP_LDI: case OP_MOV: case OP_LOAD: case OP_STORE:
+        case OP_LOADB: case OP_STOREB: case OP_LDS:
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+        case OP_AND: case OP_OR: case OP_XOR: case OP_NOT:
+        case OP_SHL: case OP_SHR: case OP_INC: case OP_DEC:
+        case OP_PUSH: case OP_POP: case OP_NOP:
+        case OP_VAR: case OP_SET: case OP_GET: case OP_BUFFER:
+            continue;
+        default:
+            return 0;
+        }
+    }
+    return 0;
+}
+
+/* =========================================================================
+ *  peephole_optimize()
+ * ========================================================================= */
+int peephole_optimize(Instruction *ir, int ir_count, const char *arch,
+                      PeepholeStats *stats)
+{
+    PeepholeStats local;
+    if (!stats) stats = &local;
+    memset(stats, 0, sizeof(*stats));
+
+    unsigned amask = peep_arch_mask(arch);
+    int n = ir_count;
+
+    while (stats->passes < PEEP_MAX_PASSES) {
+        int removed = 0;
+        int out = 0;
+        int i = 0;
+        stats->passes++;
+
+        while (i < n) {
+            unsigned kill = 0;
+            int      span = 1;
+
+            if (!ir[i].is_label) {
+                for (int r = 0; r < PEEP_RULE_COUNT; r++) {
+                    const PeepRule *rule = &PEEP_RULES[r];
+                    if (!(rule->archs & amask)) continue;
+
+                    unsigned m = rule->match(ir, i, n);
+                    if (!m) continue;
+
+                    int width = 0;
+                    for (unsigned t = m; t; t >>= 1) width++;
+                    if ((rule->cond_archs & amask) &&
+                        !peep_cond_dead(ir, i + width, n))
+                        continue;
+
+                    stats->hits[r]++;
+                    kill = m;
+                    span = width;
+                    break;
+                }
+            }
+
+            /* Copy the survivors of this window down to `out` */
+            for (int k = 0; k < span; k++) {
+                if (kill & (1u << k)) {
+                    removed++;
+                    continue;
+                }
+                if (out != i + k) ir[out] = ir[i + k];
+                out++;
+            }
+            i += span;
+        }
+
+        n = out;
+        stats->removed += removed;
+        if (removed == 0) break;
+    }
+
+    return n;
+}
+
+/* =========================================================================
+ *  peephole_print_stats()
+ * ========================================================================= */
+void peephole_print_stats(const PeepholeStats *stats, UaDiag *diag)
+{
+    diag_log(diag, DIAG_NORMAL, "[Peephole] %d IR entries removed (%d pass%s)\n",
+             stats->removed, stats->passes, stats->passes == 1 ? "" : "es");
+    for (int r = 0; r < PEEP_RULE_COUNT; r++) {
+        diag_log(diag, DIAG_VERBOSE, "[Peephole]   %-9s %4d   %s\n",
+                 PEEP_RULES[r].name, stats->hits[r], PEEP_RULES[r].pattern);
+    }
+}
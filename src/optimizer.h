@@ -0,0 +1,64 @@
+/*
+ * =============================================================================
+ *  UA - Unified Assembler
+ *  IR Peephole Optimizer
+ *
+ *  File:    optimizer.h
+ *  Purpose: Optional (-O1) clean-up pass over the architecture-neutral IR.
+ *           Runs after parse() and before opcode compliance validation,
+ *           removing redundant sequences left behind by macro expansion
+ *           and library code.
+ *
+ *  Rules (see PEEP_RULES in optimizer.c):
+ *    mov-self    MOV Rx, Rx                      ->  (removed)
+ *    push-pop    PUSH Rx ; POP Rx                ->  (removed)
+ *    alu-zero    LDI Rx, 0 ; ADD|SUB|OR|XOR Ry, Rx  ->  LDI Rx, 0
+ *                ADD|SUB|OR|XOR|SHL|SHR Ry, 0    ->  (removed)
+ *    jmp-next    JMP L ; L:                      ->  L:
+ *    and-cmp0    AND Rx, y ; CMP Rx, 0           ->  AND Rx, y   (x86 only)
+ *
+ *  A rule that deletes an instruction which may change the branch
+ *  condition state (flags, or the accumulator on the 8051) only fires
+ *  when a CMP is reached before the next conditional jump or control
+ *  transfer.
+ *
+ *  License: MIT
+ * =============================================================================
+ */
+
+#ifndef UA_OPTIMIZER_H
+#define UA_OPTIMIZER_H
+
+#include "parser.h"
+
+/* =========================================================================
+ *  Statistics
+ * ========================================================================= */
+#define PEEP_MAX_RULES  16
+
+typedef struct {
+    int hits[PEEP_MAX_RULES];   /* matches per rule (PEEP_RULES order)   */
+    int removed;                /* IR entries removed in total           */
+    int passes;                 /* passes run until nothing changed      */
+} PeepholeStats;
+
+/* =========================================================================
+ *  Public API
+ * ========================================================================= */
+
+/*
+ * peephole_optimize()
+ *   Rewrites `ir` in place and returns the new instruction count.
+ *   `arch` selects architecture-specific rules (same names as -arch).
+ *   `stats` may be NULL.
+ */
+int peephole_optimize(Instruction *ir, int ir_count, const char *arch,
+                      PeepholeStats *stats);
+
+/*
+ * peephole_print_stats()
+ *   Prints the per-rule hit counters to `diag`.
+ */
+void peephole_print_stats(const PeepholeStats *stats, UaDiag *diag);
+
+#endif /* UA_OPTIMIZER_H */
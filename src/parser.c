@@ -15,8 +15,8 @@
  *    instruction ::= opcode operand_list
  *    operand_list::= (depends on opcode — see grammar table below)
  *
- *  Grammar violations produce a formatted diagnostic on stderr and
- *  terminate the process with exit(1).
+ *  Grammar violations produce a formatted diagnostic on the UaDiag sink
+ *  and abandon the parse through diag_fatal().
  *
  *  License: MIT
  * =============================================================================
@@ -220,36 +220,37 @@ static const OpcodeShape OPCODE_SHAPES[OP_COUNT] = {
 /* =========================================================================
  *  Error reporting
  * =========================================================================
- *  All syntax errors print a GCC-style diagnostic, then abort.
+ *  All syntax errors print a GCC-style diagnostic, then abort the parse
+ *  (diag_fatal() frees the IR built so far and unwinds to ua_compile()).
  * ========================================================================= */
 
 /* Variadic-like error using a fixed format for consistency. */
-static void syntax_error(const Token *tok, const char *msg)
+static void syntax_error(UaDiag *diag, const Token *tok, const char *msg)
 {
-    fprintf(stderr,
-            "\n"
-            "  UA Syntax Error\n"
-            "  -----------------\n"
-            "  Line %d, Column %d: %s\n"
-            "  Near token: '%s' (%s)\n\n",
-            tok->line, tok->column, msg,
-            tok->text, token_type_name(tok->type));
-    exit(1);
+    diag_printf(diag,
+                "\n"
+                "  UA Syntax Error\n"
+                "  -----------------\n"
+                "  %s, Line %d, Column %d: %s\n"
+                "  Near token: '%s' (%s)\n\n",
+                tok->file, tok->line, tok->column, msg,
+                tok->text, token_type_name(tok->type));
+    diag_fatal(diag);
 }
 
-static void syntax_error_expected(const Token *tok,
+static void syntax_error_expected(UaDiag *diag, const Token *tok,
                                   const char *expected,
                                   const char *context)
 {
-    fprintf(stderr,
-            "\n"
-            "  UA Syntax Error\n"
-            "  -----------------\n"
-            "  Line %d, Column %d: expected %s %s\n"
-            "  Got: '%s' (%s)\n\n",
-            tok->line, tok->column, expected, context,
-            tok->text, token_type_name(tok->type));
-    exit(1);
+    diag_printf(diag,
+                "\n"
+                "  UA Syntax Error\n"
+                "  -----------------\n"
+                "  %s, Line %d, Column %d: expected %s %s\n"
+                "  Got: '%s' (%s)\n\n",
+                tok->file, tok->line, tok->column, expected, context,
+                tok->text, token_type_name(tok->type));
+    diag_fatal(diag);
 }
 
 /* =========================================================================
@@ -365,7 +366,7 @@ static int is_line_terminator(const Token *t)
  *  Helper: ensure the IR array has room for one more instruction
  * ========================================================================= */
 static Instruction* ensure_ir_capacity(Instruction *ir, int count,
-                                       int *capacity)
+                                       int *capacity, UaDiag *diag)
 {
     if (count < *capacity) return ir;
 
@@ -373,7 +374,7 @@ static Instruction* ensure_ir_capacity(Instruction *ir, int count,
     Instruction *tmp = (Instruction *)realloc(
         ir, sizeof(Instruction) * (size_t)new_cap);
     if (!tmp) {
-        fprintf(stderr, "UA Parser: out of memory (realloc failed)\n");
+        diag_printf(diag, "UA Parser: out of memory (realloc failed)\n");
         free(ir);
         return NULL;
     }
@@ -384,12 +385,13 @@ static Instruction* ensure_ir_capacity(Instruction *ir, int count,
 /* =========================================================================
  *  Helper: initialise an Instruction to a clean default state
  * ========================================================================= */
-static Instruction make_empty_instruction(int line, int col)
+static Instruction make_empty_instruction(const Token *tok)
 {
     Instruction inst;
     memset(&inst, 0, sizeof(inst));
-    inst.line   = line;
-    inst.column = col;
+    inst.file   = tok->file;
+    inst.line   = tok->line;
+    inst.column = tok->column;
     return inst;
 }
 
@@ -400,8 +402,9 @@ static Instruction make_empty_instruction(int line, int col)
  *  OPERAND_LABEL_REF, or OPERAND_REG_OR_IMM).  The function validates the
  *  actual token against the expectation and fills `out`.
  * ========================================================================= */
-static void build_operand(const Token *tok, OperandType expected,
-                          const char *opcode_str, Operand *out)
+static void build_operand(UaDiag *diag, const Token *tok,
+                          OperandType expected, const char *opcode_str,
+                          StrPool *strings, Operand *out)
 {
     /* --- Register ------------------------------------------------------- */
     if (tok->type == TOKEN_REGISTER) {
@@ -410,7 +413,7 @@ static void build_operand(const Token *tok, OperandType expected,
             snprintf(msg, sizeof(msg),
                      "for '%s': expected an immediate or label, got register",
                      opcode_str);
-            syntax_error(tok, msg);
+            syntax_error(diag, tok, msg);
         }
         out->type     = OPERAND_REGISTER;
         out->data.reg = (int)tok->value;
@@ -424,7 +427,7 @@ static void build_operand(const Token *tok, OperandType expected,
             snprintf(msg, sizeof(msg),
                      "for '%s': expected a register, got immediate value",
                      opcode_str);
-            syntax_error(tok, msg);
+            syntax_error(diag, tok, msg);
         }
         out->type     = OPERAND_IMMEDIATE;
         out->data.imm = tok->value;
@@ -439,11 +442,10 @@ static void build_operand(const Token *tok, OperandType expected,
                      "for '%s': expected a register or immediate, "
                      "got label reference '%s'",
                      opcode_str, tok->text);
-            syntax_error(tok, msg);
+            syntax_error(diag, tok, msg);
         }
-        out->type = OPERAND_LABEL_REF;
-        strncpy(out->data.label, tok->text, UA_MAX_LABEL_LEN - 1);
-        out->data.label[UA_MAX_LABEL_LEN - 1] = '\0';
+        out->type          = OPERAND_LABEL_REF;
+        out->data.label_id = strpool_intern(strings, tok->text);
         return;
     }
 
@@ -458,7 +460,7 @@ static void build_operand(const Token *tok, OperandType expected,
         }
         char msg[256];
         snprintf(msg, sizeof(msg), "for '%s': expected %s", opcode_str, wanted);
-        syntax_error_expected(tok, wanted, msg);
+        syntax_error_expected(diag, tok, wanted, msg);
     }
 }
 
@@ -476,8 +478,10 @@ static void build_operand(const Token *tok, OperandType expected,
  * ========================================================================= */
 
 Instruction* parse(const Token *tokens, int token_count,
-                   int *instruction_count)
+                   int *instruction_count, StrPool *strings, UaDiag *diag)
 {
+    if (!strings) return NULL;
+    strpool_init(strings, diag); /* always initialised, even on failure */
     if (!tokens || !instruction_count) return NULL;
 
     int capacity = INITIAL_IR_CAPACITY;
@@ -486,10 +490,11 @@ Instruction* parse(const Token *tokens, int token_count,
     Instruction *ir = (Instruction *)malloc(
         sizeof(Instruction) * (size_t)capacity);
     if (!ir) {
-        fprintf(stderr, "UA Parser: out of memory (initial malloc)\n");
+        diag_printf(diag, "UA Parser: out of memory (initial malloc)\n");
         *instruction_count = 0;
         return NULL;
     }
+    diag_own(diag, &ir, diag_free_ptr);     /* a syntax error frees it */
 
     int pos = 0;
 
@@ -507,13 +512,12 @@ Instruction* parse(const Token *tokens, int token_count,
 
         /* ---- Label or function definition ----------------------------- */
         if (cur->type == TOKEN_LABEL) {
-            ir = ensure_ir_capacity(ir, count, &capacity);
+            ir = ensure_ir_capacity(ir, count, &capacity, diag);
             if (!ir) { *instruction_count = 0; return NULL; }
 
-            Instruction inst = make_empty_instruction(cur->line, cur->column);
+            Instruction inst = make_empty_instruction(cur);
             inst.is_label = 1;
-            strncpy(inst.label_name, cur->text, UA_MAX_LABEL_LEN - 1);
-            inst.label_name[UA_MAX_LABEL_LEN - 1] = '\0';
+            inst.label_id = strpool_intern(strings, cur->text);
 
             pos++;  /* consume the label token */
 
@@ -536,21 +540,19 @@ Instruction* parse(const Token *tokens, int token_count,
                             snprintf(msg, sizeof(msg),
                                      "in function '%s' parameter list: "
                                      "expected parameter name",
-                                     inst.label_name);
-                            syntax_error(t, msg);
+                                     cur->text);
+                            syntax_error(diag, t, msg);
                         }
                         if (inst.param_count >= MAX_FUNC_PARAMS) {
                             char msg[256];
                             snprintf(msg, sizeof(msg),
                                      "function '%s' exceeds maximum of %d "
                                      "parameters",
-                                     inst.label_name, MAX_FUNC_PARAMS);
-                            syntax_error(t, msg);
+                                     cur->text, MAX_FUNC_PARAMS);
+                            syntax_error(diag, t, msg);
                         }
-                        strncpy(inst.param_names[inst.param_count],
-                                t->text, UA_MAX_LABEL_LEN - 1);
-                        inst.param_names[inst.param_count]
-                            [UA_MAX_LABEL_LEN - 1] = '\0';
+                        inst.param_ids[inst.param_count] =
+                            strpool_intern(strings, t->text);
                         inst.param_count++;
                         pos++;
 
@@ -568,8 +570,8 @@ Instruction* parse(const Token *tokens, int token_count,
                     char msg[256];
                     snprintf(msg, sizeof(msg),
                              "in function '%s': expected ')' after "
-                             "parameter list", inst.label_name);
-                    syntax_error(t, msg);
+                             "parameter list", cur->text);
+                    syntax_error(diag, t, msg);
                 }
                 pos++;  /* consume ')' */
             }
@@ -589,10 +591,10 @@ Instruction* parse(const Token *tokens, int token_count,
         if (cur->type == TOKEN_OPCODE) {
             Opcode op;
             if (!lookup_opcode(cur->text, &op)) {
-                syntax_error(cur, "unknown opcode (internal error)");
+                syntax_error(diag, cur, "unknown opcode (internal error)");
             }
 
-            Instruction inst = make_empty_instruction(cur->line, cur->column);
+            Instruction inst = make_empty_instruction(cur);
             inst.is_label      = 0;
             inst.opcode        = op;
 
@@ -607,13 +609,12 @@ Instruction* parse(const Token *tokens, int token_count,
                 const Token *name_tok = peek(tokens, pos, token_count);
                 if (name_tok->type != TOKEN_IDENTIFIER &&
                     name_tok->type != TOKEN_LABEL_REF) {
-                    syntax_error_expected(name_tok, "variable name",
+                    syntax_error_expected(diag, name_tok, "variable name",
                                           "after 'VAR'");
                 }
                 inst.operands[0].type = OPERAND_LABEL_REF;
-                strncpy(inst.operands[0].data.label,
-                        name_tok->text, UA_MAX_LABEL_LEN - 1);
-                inst.operands[0].data.label[UA_MAX_LABEL_LEN - 1] = '\0';
+                inst.operands[0].data.label_id =
+                    strpool_intern(strings, name_tok->text);
                 inst.operand_count = 1;
                 pos++;
 
@@ -628,7 +629,7 @@ Instruction* parse(const Token *tokens, int token_count,
                         inst.operand_count = 2;
                         pos++;
                     } else {
-                        syntax_error_expected(val_tok,
+                        syntax_error_expected(diag, val_tok,
                             "initial value (number)",
                             "after 'VAR name,'");
                     }
@@ -646,25 +647,24 @@ Instruction* parse(const Token *tokens, int token_count,
                 const Token *name_tok = peek(tokens, pos, token_count);
                 if (name_tok->type != TOKEN_IDENTIFIER &&
                     name_tok->type != TOKEN_LABEL_REF) {
-                    syntax_error_expected(name_tok, "buffer name",
+                    syntax_error_expected(diag, name_tok, "buffer name",
                                           "after 'BUFFER'");
                 }
                 inst.operands[0].type = OPERAND_LABEL_REF;
-                strncpy(inst.operands[0].data.label,
-                        name_tok->text, UA_MAX_LABEL_LEN - 1);
-                inst.operands[0].data.label[UA_MAX_LABEL_LEN - 1] = '\0';
+                inst.operands[0].data.label_id =
+                    strpool_intern(strings, name_tok->text);
                 pos++;
 
                 const Token *comma = peek(tokens, pos, token_count);
                 if (comma->type != TOKEN_COMMA) {
-                    syntax_error_expected(comma, "','",
+                    syntax_error_expected(diag, comma, "','",
                                           "after 'BUFFER name'");
                 }
                 pos++;
 
                 const Token *size_tok = peek(tokens, pos, token_count);
                 if (size_tok->type != TOKEN_NUMBER) {
-                    syntax_error_expected(size_tok, "size (number)",
+                    syntax_error_expected(diag, size_tok, "size (number)",
                                           "for 'BUFFER name, size'");
                 }
                 inst.operands[1].type     = OPERAND_IMMEDIATE;
@@ -684,18 +684,17 @@ Instruction* parse(const Token *tokens, int token_count,
                 const Token *name_tok = peek(tokens, pos, token_count);
                 if (name_tok->type != TOKEN_IDENTIFIER &&
                     name_tok->type != TOKEN_LABEL_REF) {
-                    syntax_error_expected(name_tok, "variable name",
+                    syntax_error_expected(diag, name_tok, "variable name",
                                           "after 'SET'");
                 }
                 inst.operands[0].type = OPERAND_LABEL_REF;
-                strncpy(inst.operands[0].data.label,
-                        name_tok->text, UA_MAX_LABEL_LEN - 1);
-                inst.operands[0].data.label[UA_MAX_LABEL_LEN - 1] = '\0';
+                inst.operands[0].data.label_id =
+                    strpool_intern(strings, name_tok->text);
                 pos++;
 
                 const Token *comma = peek(tokens, pos, token_count);
                 if (comma->type != TOKEN_COMMA) {
-                    syntax_error_expected(comma, "','", "after SET name");
+                    syntax_error_expected(diag, comma, "','", "after SET name");
                 }
                 pos++;
 
@@ -707,7 +706,7 @@ Instruction* parse(const Token *tokens, int token_count,
                     inst.operands[1].type     = OPERAND_IMMEDIATE;
                     inst.operands[1].data.imm = val_tok->value;
                 } else {
-                    syntax_error_expected(val_tok,
+                    syntax_error_expected(diag, val_tok,
                         "register or immediate",
                         "for 'SET name, value'");
                 }
@@ -725,7 +724,7 @@ Instruction* parse(const Token *tokens, int token_count,
             if (op == OP_GET) {
                 const Token *reg_tok = peek(tokens, pos, token_count);
                 if (reg_tok->type != TOKEN_REGISTER) {
-                    syntax_error_expected(reg_tok, "register",
+                    syntax_error_expected(diag, reg_tok, "register",
                                           "after 'GET'");
                 }
                 inst.operands[0].type     = OPERAND_REGISTER;
@@ -734,20 +733,19 @@ Instruction* parse(const Token *tokens, int token_count,
 
                 const Token *comma = peek(tokens, pos, token_count);
                 if (comma->type != TOKEN_COMMA) {
-                    syntax_error_expected(comma, "','", "after GET Rd");
+                    syntax_error_expected(diag, comma, "','", "after GET Rd");
                 }
                 pos++;
 
                 const Token *name_tok = peek(tokens, pos, token_count);
                 if (name_tok->type != TOKEN_IDENTIFIER &&
                     name_tok->type != TOKEN_LABEL_REF) {
-                    syntax_error_expected(name_tok, "variable name",
+                    syntax_error_expected(diag, name_tok, "variable name",
                                           "for 'GET Rd, name'");
                 }
                 inst.operands[1].type = OPERAND_LABEL_REF;
-                strncpy(inst.operands[1].data.label,
-                        name_tok->text, UA_MAX_LABEL_LEN - 1);
-                inst.operands[1].data.label[UA_MAX_LABEL_LEN - 1] = '\0';
+                inst.operands[1].data.label_id =
+                    strpool_intern(strings, name_tok->text);
                 inst.operand_count = 2;
                 pos++;
 
@@ -763,7 +761,7 @@ Instruction* parse(const Token *tokens, int token_count,
             if (op == OP_LDS) {
                 const Token *reg_tok = peek(tokens, pos, token_count);
                 if (reg_tok->type != TOKEN_REGISTER) {
-                    syntax_error_expected(reg_tok, "register",
+                    syntax_error_expected(diag, reg_tok, "register",
                                           "after 'LDS'");
                 }
                 inst.operands[0].type     = OPERAND_REGISTER;
@@ -772,19 +770,18 @@ Instruction* parse(const Token *tokens, int token_count,
 
                 const Token *comma = peek(tokens, pos, token_count);
                 if (comma->type != TOKEN_COMMA) {
-                    syntax_error_expected(comma, "','", "after LDS Rd");
+                    syntax_error_expected(diag, comma, "','", "after LDS Rd");
                 }
                 pos++;
 
                 const Token *str_tok = peek(tokens, pos, token_count);
                 if (str_tok->type != TOKEN_STRING) {
-                    syntax_error_expected(str_tok, "string literal",
+                    syntax_error_expected(diag, str_tok, "string literal",
                                           "for 'LDS Rd, \"...\"'");
                 }
                 inst.operands[1].type = OPERAND_STRING;
-                strncpy(inst.operands[1].data.string,
-                        str_tok->text, UA_MAX_LABEL_LEN - 1);
-                inst.operands[1].data.string[UA_MAX_LABEL_LEN - 1] = '\0';
+                inst.operands[1].data.string_id =
+                    strpool_intern(strings, str_tok->text);
                 inst.operand_count = 2;
                 pos++;
 
@@ -800,18 +797,17 @@ Instruction* parse(const Token *tokens, int token_count,
                 /* Consume the label/identifier operand */
                 const Token *label_tok = peek(tokens, pos, token_count);
                 if (is_line_terminator(label_tok)) {
-                    syntax_error(label_tok,
+                    syntax_error(diag, label_tok,
                                  "'CALL' expects a label or function name");
                 }
                 if (label_tok->type != TOKEN_IDENTIFIER &&
                     label_tok->type != TOKEN_LABEL_REF) {
-                    syntax_error_expected(label_tok,
+                    syntax_error_expected(diag, label_tok,
                         "label or function name", "after 'CALL'");
                 }
                 inst.operands[0].type = OPERAND_LABEL_REF;
-                strncpy(inst.operands[0].data.label,
-                        label_tok->text, UA_MAX_LABEL_LEN - 1);
-                inst.operands[0].data.label[UA_MAX_LABEL_LEN - 1] = '\0';
+                inst.operands[0].data.label_id =
+                    strpool_intern(strings, label_tok->text);
                 inst.operand_count = 1;
                 pos++;
 
@@ -836,32 +832,29 @@ Instruction* parse(const Token *tokens, int token_count,
                                 char msg[256];
                                 snprintf(msg, sizeof(msg),
                                     "CALL '%s': too many arguments (max %d)",
-                                    inst.operands[0].data.label,
-                                    MAX_FUNC_PARAMS);
-                                syntax_error(t, msg);
+                                    label_tok->text, MAX_FUNC_PARAMS);
+                                syntax_error(diag, t, msg);
                             }
                             /* Store arg name so backends can handle it */
+                            char arg[32];
                             if (t->type == TOKEN_REGISTER) {
                                 /* Encode register as "Rn" string */
-                                snprintf(
-                                    inst.param_names[inst.param_count],
-                                    UA_MAX_LABEL_LEN, "R%d",
-                                    (int)t->value);
+                                snprintf(arg, sizeof(arg), "R%d",
+                                         (int)t->value);
+                                inst.param_ids[inst.param_count] =
+                                    strpool_intern(strings, arg);
                             } else if (t->type == TOKEN_NUMBER) {
                                 /* Encode immediate as "#nnn" string */
-                                snprintf(
-                                    inst.param_names[inst.param_count],
-                                    UA_MAX_LABEL_LEN, "#%lld",
-                                    (long long)t->value);
+                                snprintf(arg, sizeof(arg), "#%lld",
+                                         (long long)t->value);
+                                inst.param_ids[inst.param_count] =
+                                    strpool_intern(strings, arg);
                             } else if (t->type == TOKEN_IDENTIFIER) {
                                 /* Variable reference as argument */
-                                strncpy(
-                                    inst.param_names[inst.param_count],
-                                    t->text, UA_MAX_LABEL_LEN - 1);
-                                inst.param_names[inst.param_count]
-                                    [UA_MAX_LABEL_LEN - 1] = '\0';
+                                inst.param_ids[inst.param_count] =
+                                    strpool_intern(strings, t->text);
                             } else {
-                                syntax_error_expected(t,
+                                syntax_error_expected(diag, t,
                                     "register, number, or variable",
                                     "in function argument list");
                             }
@@ -881,8 +874,8 @@ Instruction* parse(const Token *tokens, int token_count,
                         char msg[256];
                         snprintf(msg, sizeof(msg),
                             "CALL '%s': expected ')' after argument list",
-                            inst.operands[0].data.label);
-                        syntax_error(t, msg);
+                            label_tok->text);
+                        syntax_error(diag, t, msg);
                     }
                     pos++;  /* consume ')' */
                 }
@@ -905,7 +898,7 @@ Instruction* parse(const Token *tokens, int token_count,
                             snprintf(ctx, sizeof(ctx),
                                      "after operand %d of '%s'",
                                      i, opcode_name(op));
-                            syntax_error_expected(comma, "','", ctx);
+                            syntax_error_expected(diag, comma, "','", ctx);
                         }
                         pos++;
                     }
@@ -917,11 +910,12 @@ Instruction* parse(const Token *tokens, int token_count,
                                  "'%s' expects %d operand(s), but only "
                                  "%d given",
                                  opcode_name(op), shape->count, i);
-                        syntax_error(operand_tok, msg);
+                        syntax_error(diag, operand_tok, msg);
                     }
 
-                    build_operand(operand_tok, shape->shape[i],
-                                  opcode_name(op), &inst.operands[i]);
+                    build_operand(diag, operand_tok, shape->shape[i],
+                                  opcode_name(op), strings,
+                                  &inst.operands[i]);
                     pos++;
                 }
             }
@@ -936,11 +930,11 @@ Instruction* parse(const Token *tokens, int token_count,
                              "unexpected token after '%s' instruction "
                              "(expected end of line)",
                              opcode_name(op));
-                    syntax_error(after, msg);
+                    syntax_error(diag, after, msg);
                 }
             }
 
-            ir = ensure_ir_capacity(ir, count, &capacity);
+            ir = ensure_ir_capacity(ir, count, &capacity, diag);
             if (!ir) { *instruction_count = 0; return NULL; }
             ir[count++] = inst;
 
@@ -976,17 +970,14 @@ Instruction* parse(const Token *tokens, int token_count,
 
                 if (is_def) {
                     /* ---- Function definition: ident(params): ---------- */
-                    ir = ensure_ir_capacity(ir, count, &capacity);
+                    ir = ensure_ir_capacity(ir, count, &capacity, diag);
                     if (!ir) { *instruction_count = 0; return NULL; }
 
-                    Instruction inst = make_empty_instruction(
-                        cur->line, cur->column);
+                    Instruction inst = make_empty_instruction(cur);
                     inst.is_label    = 1;
                     inst.is_function = 1;
                     inst.param_count = 0;
-                    strncpy(inst.label_name, cur->text,
-                            UA_MAX_LABEL_LEN - 1);
-                    inst.label_name[UA_MAX_LABEL_LEN - 1] = '\0';
+                    inst.label_id = strpool_intern(strings, cur->text);
                     pos += 2;  /* consume identifier + '(' */
 
                     const Token *t = peek(tokens, pos, token_count);
@@ -999,21 +990,19 @@ Instruction* parse(const Token *tokens, int token_count,
                                 snprintf(msg, sizeof(msg),
                                          "in function '%s' parameter list: "
                                          "expected parameter name",
-                                         inst.label_name);
-                                syntax_error(t, msg);
+                                         cur->text);
+                                syntax_error(diag, t, msg);
                             }
                             if (inst.param_count >= MAX_FUNC_PARAMS) {
                                 char msg[256];
                                 snprintf(msg, sizeof(msg),
                                          "function '%s' exceeds maximum "
                                          "of %d parameters",
-                                         inst.label_name, MAX_FUNC_PARAMS);
-                                syntax_error(t, msg);
+                                         cur->text, MAX_FUNC_PARAMS);
+                                syntax_error(diag, t, msg);
                             }
-                            strncpy(inst.param_names[inst.param_count],
-                                    t->text, UA_MAX_LABEL_LEN - 1);
-                            inst.param_names[inst.param_count]
-                                [UA_MAX_LABEL_LEN - 1] = '\0';
+                            inst.param_ids[inst.param_count] =
+                                strpool_intern(strings, t->text);
                             inst.param_count++;
                             pos++;
 
@@ -1030,8 +1019,8 @@ Instruction* parse(const Token *tokens, int token_count,
                         char msg[256];
                         snprintf(msg, sizeof(msg),
                                  "in function '%s': expected ')' after "
-                                 "parameter list", inst.label_name);
-                        syntax_error(t, msg);
+                                 "parameter list", cur->text);
+                        syntax_error(diag, t, msg);
                     }
                     pos++;  /* consume ')' */
 
@@ -1052,14 +1041,12 @@ Instruction* parse(const Token *tokens, int token_count,
                 }
 
                 /* ---- Function call: identifier(args) ---- */
-                Instruction inst = make_empty_instruction(
-                    cur->line, cur->column);
+                Instruction inst = make_empty_instruction(cur);
                 inst.is_label = 0;
                 inst.opcode   = OP_CALL;
                 inst.operands[0].type = OPERAND_LABEL_REF;
-                strncpy(inst.operands[0].data.label,
-                        cur->text, UA_MAX_LABEL_LEN - 1);
-                inst.operands[0].data.label[UA_MAX_LABEL_LEN - 1] = '\0';
+                inst.operands[0].data.label_id =
+                    strpool_intern(strings, cur->text);
                 inst.operand_count = 1;
                 inst.is_function = 1;
                 inst.param_count = 0;
@@ -1073,25 +1060,24 @@ Instruction* parse(const Token *tokens, int token_count,
                             char msg[256];
                             snprintf(msg, sizeof(msg),
                                 "Call '%s': too many arguments (max %d)",
-                                inst.operands[0].data.label,
-                                MAX_FUNC_PARAMS);
-                            syntax_error(t, msg);
+                                cur->text, MAX_FUNC_PARAMS);
+                            syntax_error(diag, t, msg);
                         }
+                        char arg[32];
                         if (t->type == TOKEN_REGISTER) {
-                            snprintf(inst.param_names[inst.param_count],
-                                     UA_MAX_LABEL_LEN, "R%d",
-                                     (int)t->value);
+                            snprintf(arg, sizeof(arg), "R%d", (int)t->value);
+                            inst.param_ids[inst.param_count] =
+                                strpool_intern(strings, arg);
                         } else if (t->type == TOKEN_NUMBER) {
-                            snprintf(inst.param_names[inst.param_count],
-                                     UA_MAX_LABEL_LEN, "#%lld",
+                            snprintf(arg, sizeof(arg), "#%lld",
                                      (long long)t->value);
+                            inst.param_ids[inst.param_count] =
+                                strpool_intern(strings, arg);
                         } else if (t->type == TOKEN_IDENTIFIER) {
-                            strncpy(inst.param_names[inst.param_count],
-                                    t->text, UA_MAX_LABEL_LEN - 1);
-                            inst.param_names[inst.param_count]
-                                [UA_MAX_LABEL_LEN - 1] = '\0';
+                            inst.param_ids[inst.param_count] =
+                                strpool_intern(strings, t->text);
                         } else {
-                            syntax_error_expected(t,
+                            syntax_error_expected(diag, t,
                                 "register, number, or variable",
                                 "in function argument list");
                         }
@@ -1111,12 +1097,12 @@ Instruction* parse(const Token *tokens, int token_count,
                     char msg[256];
                     snprintf(msg, sizeof(msg),
                         "Call '%s': expected ')'",
-                        inst.operands[0].data.label);
-                    syntax_error(t, msg);
+                        cur->text);
+                    syntax_error(diag, t, msg);
                 }
                 pos++;
 
-                ir = ensure_ir_capacity(ir, count, &capacity);
+                ir = ensure_ir_capacity(ir, count, &capacity, diag);
                 if (!ir) { *instruction_count = 0; return NULL; }
                 ir[count++] = inst;
 
@@ -1130,7 +1116,7 @@ Instruction* parse(const Token *tokens, int token_count,
         }
 
         /* ---- Anything else is a syntax error -------------------------- */
-        syntax_error(cur, "expected an opcode, label, or function call");
+        syntax_error(diag, cur, "expected an opcode, label, or function call");
     }
 
     *instruction_count = count;
@@ -1140,7 +1126,8 @@ Instruction* parse(const Token *tokens, int token_count,
 /* =========================================================================
  *  free_instructions()
  * ========================================================================= */
-void free_instructions(Instruction *instructions)
+void free_instructions(Instruction *instructions, StrPool *strings)
 {
     free(instructions);     /* safe even if NULL */
+    if (strings) strpool_free(strings);
 }
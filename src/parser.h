@@ -22,6 +22,7 @@
 #define UA_PARSER_H
 
 #include "lexer.h"      /* Token, UaTokenType */
+#include "strpool.h"    /* StrPool, StrId */
 #include <stdint.h>
 
 /* =========================================================================
@@ -133,16 +134,18 @@ typedef enum {
  *  Operand Structure
  * =========================================================================
  *  A tagged union: `type` selects which field of `data` is active.
+ *  Names and string literals are interned in the program's StrPool; the
+ *  operand only stores the 32-bit ID (see strpool_get()).
  * ========================================================================= */
-#define UA_MAX_LABEL_LEN  128  /* Max label name length */
+#define UA_MAX_LABEL_LEN  128  /* Max label name length (lexer tokens) */
 
 typedef struct {
     OperandType type;
     union {
         int      reg;                       /* Register number (0-15)      */
         int64_t  imm;                       /* Immediate value             */
-        char     label[UA_MAX_LABEL_LEN];  /* Label name                  */
-        char     string[UA_MAX_LABEL_LEN]; /* String literal (LDS)        */
+        StrId    label_id;                  /* Label name (interned)       */
+        StrId    string_id;                 /* String literal (LDS)        */
     } data;
 } Operand;
 
@@ -152,7 +155,7 @@ typedef struct {
  *  Represents one fully-parsed assembly instruction (or a label definition).
  *
  *  - `is_label`:  if non-zero, this "instruction" is actually a label
- *                 definition and `label_name` holds its name.
+ *                 definition and `label_id` holds its (interned) name.
  *                 `opcode` and `operands` are unused in that case.
  *
  *  - Otherwise:   `opcode` + up to MAX_OPERANDS operands describe
@@ -164,20 +167,21 @@ typedef struct {
 typedef struct {
     /* --- Label-only entry ----------------------------------------------- */
     int     is_label;                       /* 1 = label def, 0 = instr    */
-    char    label_name[UA_MAX_LABEL_LEN];  /* Label text (if is_label)    */
+    StrId   label_id;                       /* Label text (if is_label)    */
 
     /* --- Function definition -------------------------------------------- */
     int     is_function;                    /* 1 = func def with params    */
     int     param_count;                    /* Number of parameters        */
-    char    param_names[MAX_FUNC_PARAMS][UA_MAX_LABEL_LEN];
+    StrId   param_ids[MAX_FUNC_PARAMS];     /* Parameter / argument names  */
 
     /* --- Instruction data ----------------------------------------------- */
     Opcode  opcode;                         /* Which operation             */
     Operand operands[MAX_OPERANDS];         /* Operand slots               */
     int     operand_count;                  /* How many are used (0-3)     */
 
-    /* --- Source location (for diagnostics) ------------------------------ */
-    int     line;
+    /* --- Source location (for diagnostics and debug info) --------------- */
+    const char *file;                       /* original file (Token.file)  */
+    int     line;                           /* ... and line in that file   */
     int     column;
 } Instruction;
 
@@ -188,25 +192,31 @@ typedef struct {
  * parse()
  *   Consumes the token array produced by tokenize() and returns a
  *   heap-allocated array of Instruction structs.  Grammar violations
- *   cause a formatted error message on stderr followed by exit(1).
+ *   print a formatted error message to `diag` and end in diag_fatal().
  *
  *   Parameters:
  *     tokens            – token array from the lexer.
  *     token_count       – number of tokens (including EOF).
  *     instruction_count – [out] receives the number of IR instructions.
+ *     strings           – [out] always initialised by parse(); receives
+ *                         every label name, variable name and string
+ *                         literal referenced by the IR.
+ *     diag              – sink for diagnostics (NULL = stderr + exit).
  *
  *   Returns:
  *     Pointer to a heap-allocated Instruction array, or NULL on alloc
- *     failure.  The caller must free it with free_instructions().
+ *     failure.  The caller must free it (and `strings`) with
+ *     free_instructions().
  * ------------------------------------------------------------------------- */
 Instruction* parse(const Token *tokens, int token_count,
-                   int *instruction_count);
+                   int *instruction_count, StrPool *strings, UaDiag *diag);
 
 /* -------------------------------------------------------------------------
  * free_instructions()
- *   Frees the array returned by parse().  Safe to call with NULL.
+ *   Frees the array returned by parse() together with its string pool.
+ *   Safe to call with NULL.
  * ------------------------------------------------------------------------- */
-void free_instructions(Instruction *instructions);
+void free_instructions(Instruction *instructions, StrPool *strings);
 
 /* -------------------------------------------------------------------------
  * opcode_name()
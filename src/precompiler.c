@@ -24,6 +24,7 @@
  *  │    2. Conditional nesting tracked with active_depth / total_depth      │
  *  │    3. @IMPORT triggers recursive preprocessing of the imported file    │
  *  │    4. Blank lines emitted for directives to preserve line numbering    │
+ *  │    5. A line map records the file and line of every output line       │
  *  └──────────────────────────────────────────────────────────────────────────┘
  *
  *  License: MIT
@@ -32,10 +33,14 @@
 
 #include "precompiler.h"
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "impcache.h"
+#include "linemap.h"
+
 /* =========================================================================
  *  Compile-time limits
  * ========================================================================= */
@@ -45,9 +50,6 @@
 #define PP_MAX_PATH_LEN       1024  /* Max file path length                  */
 #define PP_MAX_DIRECTIVE_LEN  32    /* Max directive keyword length           */
 #define PP_INITIAL_BUF_CAP    4096  /* Initial output-buffer capacity        */
-#define PP_MAX_DEFINES        512   /* Max @DEFINE macro entries             */
-#define PP_MAX_DEFINE_NAME    64    /* Max macro name length                 */
-#define PP_MAX_DEFINE_VALUE   64    /* Max macro value length                */
 
 /* =========================================================================
  *  Dynamic string buffer
@@ -55,11 +57,18 @@
  *  Grows by doubling.  All append operations return 0 on success, -1 on
  *  out-of-memory.  The caller detaches the data pointer via strbuf_detach()
  *  and later free()s it.
+ *
+ *  An output buffer also records where its lines came from (`lines`, with
+ *  file ids of PPState.lines); the newlines are counted lazily, up to
+ *  wherever a line is next looked up.
  * ========================================================================= */
 typedef struct {
-    char *data;
-    int   size;
-    int   capacity;
+    char   *data;
+    int     size;
+    int     capacity;
+    int     counted;            /* data[0 .. counted) scanned for '\n'   */
+    int     newlines;           /* newlines found there                  */
+    LineMap lines;              /* source of each line (runs only)       */
 } StrBuf;
 
 static int strbuf_init(StrBuf *sb)
@@ -68,6 +77,9 @@ static int strbuf_init(StrBuf *sb)
     if (!sb->data) return -1;
     sb->size     = 0;
     sb->capacity = PP_INITIAL_BUF_CAP;
+    sb->counted  = 0;
+    sb->newlines = 0;
+    linemap_init(&sb->lines);
     return 0;
 }
 
@@ -103,6 +115,38 @@ static void strbuf_free(StrBuf *sb)
     sb->data     = NULL;
     sb->size     = 0;
     sb->capacity = 0;
+    linemap_free(&sb->lines);
+}
+
+/* 1-based number of the line that the next appended text starts on */
+static int strbuf_line(StrBuf *sb)
+{
+    const char *p   = sb->data + sb->counted;
+    const char *end = sb->data + sb->size;
+    while ((p = (const char *)memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        sb->newlines++;
+        p++;
+    }
+    sb->counted = sb->size;
+    return sb->newlines + 1;
+}
+
+/* The text appended next comes from line `src_line` of file `file` on */
+static int strbuf_map(StrBuf *sb, int file, int src_line)
+{
+    return linemap_add(&sb->lines, strbuf_line(sb), file, src_line);
+}
+
+/* Take over the runs of text that was appended at line `base` */
+static int strbuf_map_runs(StrBuf *sb, int base, const LineRun *runs,
+                           int count)
+{
+    for (int i = 0; i < count; i++) {
+        if (linemap_add(&sb->lines, base + runs[i].line - 1, runs[i].file,
+                        runs[i].src_line) != 0)
+            return -1;
+    }
+    return 0;
 }
 
 /* =========================================================================
@@ -201,24 +245,24 @@ static void pp_extract_dir(const char *path, char *dir, int dir_size)
 
 /* =========================================================================
  *  Read an entire file into a heap-allocated string.
- *  Returns NULL on failure (diagnostic printed to stderr).
+ *  Returns NULL on failure (diagnostic printed to `diag`).
  * ========================================================================= */
-static char* pp_read_file(const char *path)
+static char* pp_read_file(const char *path, UaDiag *diag)
 {
     FILE *fp = fopen(path, "rb");
     if (!fp) {
-        fprintf(stderr, "[Precompiler] Error: cannot open '%s': ", path);
-        perror(NULL);
+        diag_printf(diag, "[Precompiler] Error: cannot open '%s': %s\n",
+                    path, strerror(errno));
         return NULL;
     }
     if (fseek(fp, 0, SEEK_END) != 0) {
-        fprintf(stderr, "[Precompiler] Error: fseek failed on '%s'\n", path);
+        diag_printf(diag, "[Precompiler] Error: fseek failed on '%s'\n", path);
         fclose(fp);
         return NULL;
     }
     long length = ftell(fp);
     if (length < 0) {
-        fprintf(stderr, "[Precompiler] Error: ftell failed on '%s'\n", path);
+        diag_printf(diag, "[Precompiler] Error: ftell failed on '%s'\n", path);
         fclose(fp);
         return NULL;
     }
@@ -226,8 +270,8 @@ static char* pp_read_file(const char *path)
 
     char *buf = (char *)malloc((size_t)length + 1);
     if (!buf) {
-        fprintf(stderr, "[Precompiler] Error: out of memory reading '%s'\n",
-                path);
+        diag_printf(diag, "[Precompiler] Error: out of memory reading '%s'\n",
+                    path);
         fclose(fp);
         return NULL;
     }
@@ -238,100 +282,204 @@ static char* pp_read_file(const char *path)
 }
 
 /* =========================================================================
- *  Macro definition table  (@DEFINE name value)
+ *  Identifier characters
+ * ========================================================================= */
+
+/* Is 'c' a valid identifier character?  (letter, digit, underscore) */
+static int pp_is_ident_char(char c)
+{
+    return (c >= 'A' && c <= 'Z') ||
+           (c >= 'a' && c <= 'z') ||
+           (c >= '0' && c <= '9') ||
+           c == '_';
+}
+
+/* Can 'c' start an identifier?  (letter, underscore) */
+static int pp_is_ident_start(char c)
+{
+    return (c >= 'A' && c <= 'Z') ||
+           (c >= 'a' && c <= 'z') ||
+           c == '_';
+}
+
+/* =========================================================================
+ *  Name set  —  open addressing over (pointer, length) keys
  *
- *  Shared across the PPState so that macros defined in imported files
- *  are visible to the importer.
+ *  Indexes the @DEFINE table and an imported file's labels.  Keys are
+ *  not copied and must outlive the set.  Linear probing in a power-of-
+ *  two table that is kept at most half full; every slot caches its
+ *  key's hash and length, so bytes are compared only for a likely match.
  * ========================================================================= */
 typedef struct {
-    char name[PP_MAX_DEFINE_NAME];
-    char value[PP_MAX_DEFINE_VALUE];
-} PPMacro;
+    const char *name;           /* NULL = empty slot                   */
+    int         len;
+    uint32_t    hash;
+    int         value;          /* caller's payload (>= 0)             */
+} PPSlot;
 
 typedef struct {
-    PPMacro entries[PP_MAX_DEFINES];
+    PPSlot *slots;
+    int     cap;                /* 0 or a power of two                 */
     int     count;
-} PPMacroTable;
+} PPNameSet;
+
+static uint32_t pp_hash(const char *s, int len)
+{
+    uint32_t h = 2166136261u;                  /* FNV-1a */
+    for (int i = 0; i < len; i++) {
+        h ^= (uint8_t)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
 
-/* Forward declarations (defined later, needed by pp_expand_macros) */
-static int pp_is_ident_char(char c);
-static int pp_is_ident_start(char c);
+static void pp_set_init(PPNameSet *set)
+{
+    set->slots = NULL;
+    set->cap   = 0;
+    set->count = 0;
+}
 
-static void pp_macro_init(PPMacroTable *mt) { mt->count = 0; }
+static void pp_set_free(PPNameSet *set)
+{
+    free(set->slots);
+    pp_set_init(set);
+}
 
-static int pp_macro_add(PPMacroTable *mt, const char *name, int nlen,
-                        const char *value, int vlen,
-                        const char *filename, int line_num)
+/* Payload stored for `name`, or -1 if it is not in the set */
+static int pp_set_find(const PPNameSet *set, const char *name, int len)
 {
-    if (mt->count >= PP_MAX_DEFINES) {
-        fprintf(stderr,
-                "[Precompiler] %s:%d: @DEFINE limit exceeded (max %d)\n",
-                filename, line_num, PP_MAX_DEFINES);
-        return -1;
+    if (set->count == 0) return -1;
+    uint32_t h    = pp_hash(name, len);
+    uint32_t mask = (uint32_t)set->cap - 1;
+    for (uint32_t i = h & mask; set->slots[i].name; i = (i + 1) & mask) {
+        const PPSlot *sl = &set->slots[i];
+        if (sl->hash == h && sl->len == len &&
+            memcmp(sl->name, name, (size_t)len) == 0)
+            return sl->value;
     }
-    if (nlen >= PP_MAX_DEFINE_NAME) nlen = PP_MAX_DEFINE_NAME - 1;
-    if (vlen >= PP_MAX_DEFINE_VALUE) vlen = PP_MAX_DEFINE_VALUE - 1;
-    memcpy(mt->entries[mt->count].name,  name,  (size_t)nlen);
-    mt->entries[mt->count].name[nlen]   = '\0';
-    memcpy(mt->entries[mt->count].value, value, (size_t)vlen);
-    mt->entries[mt->count].value[vlen]  = '\0';
-    mt->count++;
+    return -1;
+}
+
+static void pp_set_place(PPSlot *slots, int cap, const PPSlot *sl)
+{
+    uint32_t mask = (uint32_t)cap - 1;
+    uint32_t i    = sl->hash & mask;
+    while (slots[i].name) i = (i + 1) & mask;
+    slots[i] = *sl;
+}
+
+/* Add `name` unless present (the first payload stays).  0, or -1 on OOM. */
+static int pp_set_add(PPNameSet *set, const char *name, int len, int value)
+{
+    if (pp_set_find(set, name, len) >= 0) return 0;
+
+    if (2 * (set->count + 1) > set->cap) {
+        int     cap   = set->cap ? set->cap * 2 : 64;
+        PPSlot *slots = (PPSlot *)calloc((size_t)cap, sizeof(PPSlot));
+        if (!slots) return -1;
+        for (int i = 0; i < set->cap; i++) {
+            if (set->slots[i].name)
+                pp_set_place(slots, cap, &set->slots[i]);
+        }
+        free(set->slots);
+        set->slots = slots;
+        set->cap   = cap;
+    }
+
+    PPSlot sl;
+    sl.name  = name;
+    sl.len   = len;
+    sl.hash  = pp_hash(name, len);
+    sl.value = value;
+    pp_set_place(set->slots, set->cap, &sl);
+    set->count++;
     return 0;
 }
 
-/* Perform token-boundary-aware macro expansion on a single line.
- * Writes the expanded line into *out*.  Returns 0 on success, -1 on OOM.
+/* =========================================================================
+ *  Macro definition table  (@DEFINE name value)
  *
- * A macro NAME is replaced only when it appears as a whole token:
- *   - preceded by start-of-string or a non-identifier character
- *   - followed by end-of-string or a non-identifier character
- * This prevents replacing partial words (e.g., "TMOD_VAL" when "TMOD" is defined).
- */
-static int pp_expand_macros(const PPMacroTable *mt,
-                            const char *line, int line_len,
-                            StrBuf *out)
+ *  Shared across the PPState so that macros defined in imported files
+ *  are visible to the importer.  Entries are kept in definition order;
+ *  the index maps a name to its first definition, which is the one that
+ *  expands.
+ * ========================================================================= */
+typedef struct {
+    char *name;                 /* heap copies, NUL-terminated         */
+    char *value;
+    int   name_len;
+    int   value_len;
+} PPMacro;
+
+typedef struct {
+    PPMacro  *entries;
+    int       count;
+    int       capacity;
+    PPNameSet index;            /* name -> entries[] index             */
+} PPMacroTable;
+
+static void pp_macro_init(PPMacroTable *mt)
 {
-    if (mt->count == 0) {
-        /* Fast path: no macros defined */
-        return strbuf_append(out, line, line_len);
+    mt->entries  = NULL;
+    mt->count    = 0;
+    mt->capacity = 0;
+    pp_set_init(&mt->index);
+}
+
+static void pp_macro_free(PPMacroTable *mt)
+{
+    for (int i = 0; i < mt->count; i++) {
+        free(mt->entries[i].name);
+        free(mt->entries[i].value);
     }
+    free(mt->entries);
+    pp_set_free(&mt->index);
+    pp_macro_init(mt);
+}
 
-    const char *p   = line;
-    const char *end = line + line_len;
+static char* pp_strndup(const char *s, int len)
+{
+    char *dup = (char *)malloc((size_t)len + 1);
+    if (dup) {
+        memcpy(dup, s, (size_t)len);
+        dup[len] = '\0';
+    }
+    return dup;
+}
 
-    while (p < end) {
-        /* If current character can start an identifier, try matching macros */
-        if (pp_is_ident_start(*p)) {
-            const char *id_start = p;
-            while (p < end && pp_is_ident_char(*p)) p++;
-            int id_len = (int)(p - id_start);
-
-            /* Search macro table for a match */
-            int replaced = 0;
-            for (int m = 0; m < mt->count; m++) {
-                int nlen = (int)strlen(mt->entries[m].name);
-                if (nlen == id_len &&
-                    memcmp(mt->entries[m].name, id_start, (size_t)id_len) == 0) {
-                    /* Match — emit the replacement value */
-                    int vlen = (int)strlen(mt->entries[m].value);
-                    if (strbuf_append(out, mt->entries[m].value, vlen) != 0)
-                        return -1;
-                    replaced = 1;
-                    break;
-                }
-            }
-            if (!replaced) {
-                /* No match — emit the original identifier */
-                if (strbuf_append(out, id_start, id_len) != 0)
-                    return -1;
-            }
-        } else {
-            /* Non-identifier character — emit as-is */
-            if (strbuf_append_char(out, *p) != 0) return -1;
-            p++;
-        }
+static int pp_macro_add(PPMacroTable *mt, const char *name, int nlen,
+                        const char *value, int vlen,
+                        const char *filename, int line_num,
+                        UaDiag *diag)
+{
+    if (mt->count == mt->capacity) {
+        int      cap = mt->capacity ? mt->capacity * 2 : 64;
+        PPMacro *e   = (PPMacro *)realloc(mt->entries,
+                                          (size_t)cap * sizeof(PPMacro));
+        if (!e) goto oom;
+        mt->entries  = e;
+        mt->capacity = cap;
+    }
+
+    PPMacro *m = &mt->entries[mt->count];
+    m->name      = pp_strndup(name, nlen);
+    m->value     = pp_strndup(value, vlen);
+    m->name_len  = nlen;
+    m->value_len = vlen;
+    if (!m->name || !m->value ||
+        pp_set_add(&mt->index, m->name, nlen, mt->count) != 0) {
+        free(m->name);
+        free(m->value);
+        goto oom;
     }
+    mt->count++;
     return 0;
+
+oom:
+    diag_printf(diag, "[Precompiler] %s:%d: out of memory for @DEFINE\n",
+                filename, line_num);
+    return -1;
 }
 
 /* =========================================================================
@@ -344,16 +492,37 @@ typedef struct {
     char       *imported[PP_MAX_IMPORTS];       /* normalised import paths  */
     int         import_count;
     PPMacroTable macros;                        /* @DEFINE table            */
+    LineMap     *lines;                         /* file names of the runs   */
+    UaDiag      *diag;                          /* message sink             */
+
+    /* Import cache (impcache.h) — only used when cache_dir is set */
+    const char  *cache_dir;
+    ImpCacheDep  files[PP_MAX_IMPORTS];         /* identity of imported[i]
+                                                   when read (size -1 =
+                                                   unknown)                 */
+    char       **skipped;                       /* every import skipped as
+                                                   already imported         */
+    int          skip_count;
+    int          skip_cap;
+    int          dummies;                       /* @DUMMY messages printed  */
 } PPState;
 
 static void pp_state_init(PPState *st, const char *arch, const char *sys,
-                          const char *exe_dir)
+                          const char *exe_dir, const char *cache_dir,
+                          LineMap *lines, UaDiag *diag)
 {
     st->arch         = arch;
     st->sys          = sys;
     st->exe_dir      = exe_dir;
+    st->lines        = lines;
+    st->diag         = diag;
     st->import_count = 0;
     pp_macro_init(&st->macros);
+    st->cache_dir    = (cache_dir && *cache_dir) ? cache_dir : NULL;
+    st->skipped      = NULL;
+    st->skip_count   = 0;
+    st->skip_cap     = 0;
+    st->dummies      = 0;
 }
 
 static void pp_state_free(PPState *st)
@@ -361,6 +530,12 @@ static void pp_state_free(PPState *st)
     for (int i = 0; i < st->import_count; i++)
         free(st->imported[i]);
     st->import_count = 0;
+    for (int i = 0; i < st->skip_count; i++)
+        free(st->skipped[i]);
+    free(st->skipped);
+    st->skipped    = NULL;
+    st->skip_count = 0;
+    pp_macro_free(&st->macros);
 }
 
 static int pp_was_imported(const PPState *st, const char *path)
@@ -374,20 +549,39 @@ static int pp_was_imported(const PPState *st, const char *path)
 static int pp_mark_imported(PPState *st, const char *path)
 {
     if (st->import_count >= PP_MAX_IMPORTS) {
-        fprintf(stderr,
-                "[Precompiler] Error: import limit exceeded (max %d files)\n",
-                PP_MAX_IMPORTS);
+        diag_printf(st->diag,
+                    "[Precompiler] Error: import limit exceeded (max %d files)\n",
+                    PP_MAX_IMPORTS);
         return -1;
     }
     st->imported[st->import_count] = pp_strdup(path);
     if (!st->imported[st->import_count]) {
-        fprintf(stderr, "[Precompiler] Error: out of memory\n");
+        diag_printf(st->diag, "[Precompiler] Error: out of memory\n");
         return -1;
     }
+    st->files[st->import_count].size = -1;
     st->import_count++;
     return 0;
 }
 
+/* Remember an import skipped as already imported: a cache entry made
+ * while it happened is only valid where it would be skipped again. */
+static int pp_log_skip(PPState *st, const char *path)
+{
+    if (st->skip_count == st->skip_cap) {
+        int    cap = st->skip_cap ? st->skip_cap * 2 : 16;
+        char **s   = (char **)realloc(st->skipped,
+                                      (size_t)cap * sizeof(char *));
+        if (!s) return -1;
+        st->skipped  = s;
+        st->skip_cap = cap;
+    }
+    st->skipped[st->skip_count] = pp_strdup(path);
+    if (!st->skipped[st->skip_count]) return -1;
+    st->skip_count++;
+    return 0;
+}
+
 /* =========================================================================
  *  Namespace prefixing for @IMPORT
  *
@@ -396,35 +590,229 @@ static int pp_mark_imported(PPState *st, const char *path)
  *  E.g., importing "math.ua" makes its label "add:" accessible as
  *  "math.add" and its function "sum(x,y):" become "math.sum(x,y)".
  *
- *  Algorithm:
- *    Pass 1: Collect all label definitions from the preprocessed text.
- *    Pass 2: Replace every standalone occurrence of a collected label
- *            name with "prefix.name" (unless already qualified with .).
+ *  Labels may be used before they are defined, so whether an identifier
+ *  needs the prefix is only known at the end of the file.  The single
+ *  scan that expands macros (pp_emit_line) therefore records where each
+ *  unqualified identifier landed in the output — a candidate — and the
+ *  lines that define a label.  pp_ns_resolve() then copies the output
+ *  to its destination, inserting "prefix." before every candidate that
+ *  names one of the file's labels.
+ *
+ *  A candidate is an identifier not preceded by '.' (already qualified)
+ *  or by a digit (part of a numeric literal such as 0xFF).  Candidates
+ *  of a nested import that named none of its labels are handed to the
+ *  importing file, where they may name one of its own.
  * ========================================================================= */
-
-#define PP_MAX_NS_LABELS 256    /* Max labels per imported file              */
-#define PP_MAX_NS_NAME   128    /* Max identifier length in namespace logic  */
+typedef struct {
+    int off;                    /* offset in the file's output          */
+    int len;
+} PPSpan;
 
 typedef struct {
-    char names[PP_MAX_NS_LABELS][PP_MAX_NS_NAME];
-    int  count;
-} NSLabelTable;
+    PPSpan *labels;             /* label / VAR / BUFFER definitions     */
+    int     label_count;
+    int     label_cap;
+    PPSpan *cands;              /* identifiers that may need the prefix */
+    int     cand_count;
+    int     cand_cap;
+} PPNamespace;
+
+static void pp_ns_init(PPNamespace *ns)
+{
+    memset(ns, 0, sizeof(*ns));
+}
 
-/* Is 'c' a valid identifier character?  (letter, digit, underscore) */
-static int pp_is_ident_char(char c)
+static void pp_ns_free(PPNamespace *ns)
 {
-    return (c >= 'A' && c <= 'Z') ||
-           (c >= 'a' && c <= 'z') ||
-           (c >= '0' && c <= '9') ||
-           c == '_';
+    free(ns->labels);
+    free(ns->cands);
+    pp_ns_init(ns);
 }
 
-/* Can 'c' start an identifier?  (letter, underscore) */
-static int pp_is_ident_start(char c)
+static int pp_span_push(PPSpan **arr, int *count, int *cap, int off, int len)
 {
-    return (c >= 'A' && c <= 'Z') ||
-           (c >= 'a' && c <= 'z') ||
-           c == '_';
+    if (*count == *cap) {
+        int     n = *cap ? *cap * 2 : 256;
+        PPSpan *a = (PPSpan *)realloc(*arr, (size_t)n * sizeof(PPSpan));
+        if (!a) return -1;
+        *arr = a;
+        *cap = n;
+    }
+    (*arr)[*count].off = off;
+    (*arr)[*count].len = len;
+    (*count)++;
+    return 0;
+}
+
+/* Record an identifier of `len` bytes about to be appended to `out` */
+static int pp_ns_candidate(PPNamespace *ns, const StrBuf *out, int len)
+{
+    if (out->size > 0) {
+        char prev = out->data[out->size - 1];
+        if (prev == '.' || (prev >= '0' && prev <= '9')) return 0;
+    }
+    return pp_span_push(&ns->cands, &ns->cand_count, &ns->cand_cap,
+                        out->size, len);
+}
+
+/* Record the candidates in out->data[start..] (text appended as-is) */
+static int pp_ns_scan(PPNamespace *ns, const StrBuf *out, int start)
+{
+    const char *text = out->data;
+    int i = start;
+    while (i < out->size) {
+        if (!pp_is_ident_start(text[i])) {
+            i++;
+            continue;
+        }
+        int id = i;
+        while (i < out->size && pp_is_ident_char(text[i])) i++;
+        if (id == 0 || (text[id - 1] != '.' &&
+                        !(text[id - 1] >= '0' && text[id - 1] <= '9'))) {
+            if (pp_span_push(&ns->cands, &ns->cand_count, &ns->cand_cap,
+                             id, i - id) != 0)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+/* Append text that is not macro-expanded (a macro value, an ORG line) */
+static int pp_emit_text(PPNamespace *ns, const char *text, int len,
+                        StrBuf *out)
+{
+    int start = out->size;
+    if (strbuf_append(out, text, len) != 0) return -1;
+    return ns ? pp_ns_scan(ns, out, start) : 0;
+}
+
+/* Emit one source line: a macro NAME is replaced only when it appears as
+ * a whole token, so "TMOD_VAL" is left alone when "TMOD" is defined, and
+ * a replacement value is not expanded again.  Inside an imported file
+ * (`ns` set) the identifiers are recorded as candidates on the way. */
+static int pp_emit_line(const PPMacroTable *mt, PPNamespace *ns,
+                        const char *line, int line_len, StrBuf *out)
+{
+    if (mt->count == 0 && !ns) {
+        /* Fast path: nothing to look up */
+        return strbuf_append(out, line, line_len);
+    }
+
+    const char *p   = line;
+    const char *end = line + line_len;
+
+    while (p < end) {
+        if (!pp_is_ident_start(*p)) {
+            const char *run = p;
+            while (p < end && !pp_is_ident_start(*p)) p++;
+            if (strbuf_append(out, run, (int)(p - run)) != 0) return -1;
+            continue;
+        }
+
+        const char *id_start = p;
+        while (p < end && pp_is_ident_char(*p)) p++;
+        int id_len = (int)(p - id_start);
+
+        int m = pp_set_find(&mt->index, id_start, id_len);
+        if (m >= 0) {
+            const PPMacro *mac = &mt->entries[m];
+            if (pp_emit_text(ns, mac->value, mac->value_len, out) != 0)
+                return -1;
+        } else {
+            if (ns && pp_ns_candidate(ns, out, id_len) != 0) return -1;
+            if (strbuf_append(out, id_start, id_len) != 0) return -1;
+        }
+    }
+    return 0;
+}
+
+/* Case-insensitive match of an identifier against an upper-case keyword */
+static int pp_ident_is(const char *id, int len, const char *kw)
+{
+    int i = 0;
+    for (; i < len && kw[i]; i++) {
+        char c = id[i];
+        if (c >= 'a' && c <= 'z') c = (char)(c - 'a' + 'A');
+        if (c != kw[i]) return 0;
+    }
+    return i == len && kw[i] == '\0';
+}
+
+/* Does the output line out->data[start..] define a name?
+ *
+ * A label definition is a line whose first non-whitespace content is
+ * an identifier followed (possibly after whitespace) by ':' or '(' —
+ * plain labels (start:) and function labels (add(x,y):) — and a VAR or
+ * BUFFER declaration defines the identifier after the keyword. */
+static int pp_ns_line_label(PPNamespace *ns, const StrBuf *out, int start)
+{
+    const char *s   = out->data + start;
+    const char *end = out->data + out->size;
+
+    while (s < end && (*s == ' ' || *s == '\t')) s++;
+    if (s >= end || !pp_is_ident_start(*s)) return 0;
+
+    const char *id_start = s;
+    while (s < end && pp_is_ident_char(*s)) s++;
+    int id_len = (int)(s - id_start);
+    while (s < end && (*s == ' ' || *s == '\t')) s++;
+
+    if (s < end && (*s == ':' || *s == '(')) {
+        return pp_span_push(&ns->labels, &ns->label_count, &ns->label_cap,
+                            (int)(id_start - out->data), id_len);
+    }
+    if (pp_ident_is(id_start, id_len, "VAR") ||
+        pp_ident_is(id_start, id_len, "BUFFER")) {
+        if (s < end && pp_is_ident_start(*s)) {
+            const char *name = s;
+            while (s < end && pp_is_ident_char(*s)) s++;
+            return pp_span_push(&ns->labels, &ns->label_count,
+                                &ns->label_cap,
+                                (int)(name - out->data), (int)(s - name));
+        }
+    }
+    return 0;
+}
+
+/* Append the file's output `text` to `target` with its labels prefixed.
+ * Candidates left unprefixed move to `parent` (the importing file's
+ * namespace) when there is one.  Returns 0, or -1 on OOM. */
+static int pp_ns_resolve(const PPNamespace *ns, const char *text, int len,
+                         const char *prefix, StrBuf *target,
+                         PPNamespace *parent)
+{
+    PPNameSet labels;
+    pp_set_init(&labels);
+    for (int i = 0; i < ns->label_count; i++) {
+        if (pp_set_add(&labels, text + ns->labels[i].off,
+                       ns->labels[i].len, i) != 0) {
+            pp_set_free(&labels);
+            return -1;
+        }
+    }
+
+    int prefix_len = (int)strlen(prefix);
+    int pos = 0;
+    int rc  = 0;
+    for (int c = 0; rc == 0 && c < ns->cand_count; c++) {
+        const PPSpan *cand = &ns->cands[c];
+        rc = strbuf_append(target, text + pos, cand->off - pos);
+        pos = cand->off;
+        if (rc != 0) break;
+
+        if (pp_set_find(&labels, text + cand->off, cand->len) >= 0) {
+            if (strbuf_append(target, prefix, prefix_len) != 0 ||
+                strbuf_append_char(target, '.') != 0)
+                rc = -1;
+        } else if (parent) {
+            rc = pp_span_push(&parent->cands, &parent->cand_count,
+                              &parent->cand_cap, target->size, cand->len);
+        }
+    }
+    if (rc == 0) rc = strbuf_append(target, text + pos, len - pos);
+
+    pp_set_free(&labels);
+    return rc;
 }
 
 /* Extract basename from a file path (without extension).
@@ -456,153 +844,281 @@ static void pp_extract_basename(const char *path,
     basename[len] = '\0';
 }
 
-/* Add a label name to the namespace table (de-duplicated). */
-static void ns_add_label(NSLabelTable *tbl, const char *name, int len)
+/* =========================================================================
+ *  Importing one file  (@IMPORT, once de-duplicated)
+ *
+ *  pp_import_file() preprocesses the file into a temporary buffer and
+ *  appends it, namespace-prefixed, to *target*; `parent` is the
+ *  namespace of the importing file (NULL for the main file).  With an
+ *  import cache,
+ *  pp_import_cached() serves the same text from an entry instead, or
+ *  turns what pp_import_file() did into a new one.
+ * ========================================================================= */
+static int pp_process(const char *source, const char *filename,
+                      PPState *state, const char *base_dir, int depth,
+                      StrBuf *output, StrBuf *deferred, PPNamespace *ns);
+
+static int pp_import_file(PPState *state, int slot, const char *resolved,
+                          const char *import_path, const char *ns_prefix,
+                          const char *filename, int line_num, int depth,
+                          StrBuf *target, PPNamespace *parent)
 {
-    if (tbl->count >= PP_MAX_NS_LABELS) return;
-    if (len <= 0 || len >= PP_MAX_NS_NAME) return;
-
-    /* Check for duplicates */
-    for (int i = 0; i < tbl->count; i++) {
-        if ((int)strlen(tbl->names[i]) == len &&
-            memcmp(tbl->names[i], name, (size_t)len) == 0)
-            return;
+    /* Identity for the cache, taken before the read (see impcache.h) */
+    ImpCacheDep *id = &state->files[slot];
+    if (state->cache_dir &&
+        impcache_file_info(resolved, &id->size, &id->mtime) != 0)
+        id->size = -1;
+
+    char *imp_src = pp_read_file(resolved, state->diag);
+    if (!imp_src) {
+        diag_printf(state->diag,
+                    "[Precompiler] %s:%d: failed to import '%s'\n",
+                    filename, line_num, import_path);
+        return -1;
+    }
+    if (state->cache_dir && id->size >= 0) {
+        size_t len = strlen(imp_src);
+        if ((int64_t)len == id->size)
+            id->hash = impcache_hash(imp_src, len);
+        else
+            id->size = -1;                  /* changed since, or has NULs */
     }
-    memcpy(tbl->names[tbl->count], name, (size_t)len);
-    tbl->names[tbl->count][len] = '\0';
-    tbl->count++;
+
+    /* Compute base dir for the imported file */
+    char imp_dir[PP_MAX_PATH_LEN];
+    pp_extract_dir(resolved, imp_dir, PP_MAX_PATH_LEN);
+
+    diag_log(state->diag, DIAG_NORMAL, "[Precompiler] Importing '%s'\n",
+             resolved);
+
+    /* ---- Namespace prefixing ------------------------------------------
+     * Process the imported file into a temporary buffer, noting its
+     * label definitions and identifiers, then copy it to the target
+     * with the namespace prefix applied. */
+    StrBuf imp_out;
+    if (strbuf_init(&imp_out) != 0) {
+        free(imp_src);
+        return -1;
+    }
+    PPNamespace ns;
+    pp_ns_init(&ns);
+
+    int rc = pp_process(imp_src, resolved, state, imp_dir, depth + 1,
+                        &imp_out, NULL, &ns);
+    free(imp_src);
+    int base = strbuf_line(target);
+    if (rc == 0)
+        rc = pp_ns_resolve(&ns, imp_out.data, imp_out.size, ns_prefix,
+                           target, parent);
+    if (rc == 0)
+        rc = strbuf_map_runs(target, base, imp_out.lines.runs,
+                             imp_out.lines.run_count);
+    pp_ns_free(&ns);
+    strbuf_free(&imp_out);
+    return rc;
 }
 
-/* Check if an identifier (given as pointer + length) is in the table. */
-static int ns_is_label(const NSLabelTable *tbl, const char *name, int len)
+/* Everything the imported text depends on besides the files themselves */
+static int pp_cache_key(const PPState *state, const char *resolved,
+                        const char *ns_prefix, StrBuf *key)
 {
-    for (int i = 0; i < tbl->count; i++) {
-        if ((int)strlen(tbl->names[i]) == len &&
-            memcmp(tbl->names[i], name, (size_t)len) == 0)
-            return 1;
+    const char *fields[5][2] = {
+        { "import ", resolved },
+        { "ns ",     ns_prefix },
+        { "arch ",   state->arch },
+        { "sys ",    state->sys     ? state->sys     : "-" },
+        { "lib ",    state->exe_dir ? state->exe_dir : "-" },
+    };
+    for (int f = 0; f < 5; f++) {
+        if (strbuf_append(key, fields[f][0], (int)strlen(fields[f][0])) != 0 ||
+            strbuf_append(key, fields[f][1], (int)strlen(fields[f][1])) != 0 ||
+            strbuf_append_char(key, '\n') != 0)
+            return -1;
     }
-    return 0;
+    for (int m = 0; m < state->macros.count; m++) {
+        const PPMacro *mac = &state->macros.entries[m];
+        if (strbuf_append(key, "define ", 7) != 0 ||
+            strbuf_append(key, mac->name, mac->name_len) != 0 ||
+            strbuf_append_char(key, ' ') != 0 ||
+            strbuf_append(key, mac->value, mac->value_len) != 0 ||
+            strbuf_append_char(key, '\n') != 0)
+            return -1;
+    }
+    return strbuf_append_char(key, '\0');
 }
 
-/* Pass 1: Collect all label definitions from preprocessed text.
- *
- * A label definition is a line whose first non-whitespace content is
- * an identifier followed (possibly after whitespace) by ':' or '('.
- * This catches both plain labels (start:) and function labels (add(x,y):).
- */
-static void ns_collect_labels(const char *text, NSLabelTable *tbl)
+/* Replay a cached import.  Returns 1 on a hit, 0 on a miss, -1 on error. */
+static int pp_cache_fetch(PPState *state, const char *key, int slot,
+                          const char *resolved, StrBuf *target,
+                          PPNamespace *parent)
 {
-    tbl->count = 0;
-    const char *p = text;
-
-    while (*p) {
-        const char *line = p;
-        while (*p && *p != '\n') p++;
-        int line_len = (int)(p - line);
-        if (*p == '\n') p++;
-
-        /* Skip leading whitespace */
-        const char *s = line;
-        while (s < line + line_len && (*s == ' ' || *s == '\t')) s++;
-
-        /* Check: identifier at start of trimmed line */
-        if (s < line + line_len && pp_is_ident_start(*s)) {
-            const char *id_start = s;
-            while (s < line + line_len && pp_is_ident_char(*s)) s++;
-            int id_len = (int)(s - id_start);
+    ImpCacheEntry e;
+    if (impcache_load(state->cache_dir, key, &e) != 0) {
+        diag_log(state->diag, DIAG_VERBOSE,
+                 "[Precompiler] No up-to-date cache entry for '%s'\n",
+                 resolved);
+        return 0;
+    }
 
-            /* Skip optional whitespace after identifier */
-            while (s < line + line_len && (*s == ' ' || *s == '\t')) s++;
+    /* Valid only where the same files would be read and skipped again */
+    int valid = e.deps[0].imported && strcmp(e.deps[0].path, resolved) == 0;
+    for (int d = 1; valid && d < e.dep_count; d++)
+        valid = pp_was_imported(state, e.deps[d].path) != e.deps[d].imported;
+    if (!valid) {
+        diag_log(state->diag, DIAG_VERBOSE,
+                 "[Precompiler] Cache entry for '%s' was made with other "
+                 "imports: not used\n", resolved);
+        impcache_release(&e);
+        return 0;
+    }
 
-            /* If followed by ':' or '(' → label definition */
-            if (s < line + line_len && (*s == ':' || *s == '(')) {
-                ns_add_label(tbl, id_start, id_len);
+    int rc = 1;
+    state->files[slot]      = e.deps[0];
+    state->files[slot].path = NULL;
+    diag_log(state->diag, DIAG_NORMAL, "[Precompiler] Importing '%s' (cached)\n",
+             resolved);
+
+    for (int d = 1; rc == 1 && d < e.dep_count; d++) {
+        if (!e.deps[d].imported) {
+            if (pp_log_skip(state, e.deps[d].path) != 0) {
+                diag_printf(state->diag, "[Precompiler] Error: out of memory\n");
+                rc = -1;
             }
-            /* Check for VAR declaration: "VAR name" -> collect name */
-            if (id_len == 3 &&
-                (id_start[0] == 'V' || id_start[0] == 'v') &&
-                (id_start[1] == 'A' || id_start[1] == 'a') &&
-                (id_start[2] == 'R' || id_start[2] == 'r')) {
-                /* Skip whitespace after VAR */
-                while (s < line + line_len &&
-                       (*s == ' ' || *s == '\t')) s++;
-                if (s < line + line_len && pp_is_ident_start(*s)) {
-                    const char *var_start = s;
-                    while (s < line + line_len &&
-                           pp_is_ident_char(*s)) s++;
-                    int var_len = (int)(s - var_start);
-                    ns_add_label(tbl, var_start, var_len);
-                }
-            }
-            /* Check for BUFFER declaration: "BUFFER name" -> collect name */
-            if (id_len == 6 &&
-                (id_start[0] == 'B' || id_start[0] == 'b') &&
-                (id_start[1] == 'U' || id_start[1] == 'u') &&
-                (id_start[2] == 'F' || id_start[2] == 'f') &&
-                (id_start[3] == 'F' || id_start[3] == 'f') &&
-                (id_start[4] == 'E' || id_start[4] == 'e') &&
-                (id_start[5] == 'R' || id_start[5] == 'r')) {
-                /* Skip whitespace after BUFFER */
-                while (s < line + line_len &&
-                       (*s == ' ' || *s == '\t')) s++;
-                if (s < line + line_len && pp_is_ident_start(*s)) {
-                    const char *buf_start = s;
-                    while (s < line + line_len &&
-                           pp_is_ident_char(*s)) s++;
-                    int buf_len = (int)(s - buf_start);
-                    ns_add_label(tbl, buf_start, buf_len);
-                }
-            }        }
+        } else if (pp_mark_imported(state, e.deps[d].path) != 0) {
+            rc = -1;
+        } else {
+            state->files[state->import_count - 1]      = e.deps[d];
+            state->files[state->import_count - 1].path = NULL;
+            diag_log(state->diag, DIAG_NORMAL,
+                     "[Precompiler] Importing '%s' (cached)\n",
+                     e.deps[d].path);
+        }
+    }
+    for (int m = 0; rc == 1 && m < e.macro_count; m++) {
+        if (pp_macro_add(&state->macros,
+                         e.macros[m].name, (int)strlen(e.macros[m].name),
+                         e.macros[m].value, (int)strlen(e.macros[m].value),
+                         resolved, 0, state->diag) != 0)
+            rc = -1;
+    }
+    int text_start = target->size;
+    int base       = strbuf_line(target);
+    if (rc == 1 && strbuf_append(target, e.text, (int)e.text_len) != 0)
+        rc = -1;
+    for (int r = 0; rc == 1 && r < e.line_count; r++) {
+        const LineRun *run = &e.lines[r];
+        int file = linemap_file(state->lines, e.deps[run->file].path);
+        if (file < 0 ||
+            linemap_add(&target->lines, base + run->line - 1, file,
+                        run->src_line) != 0)
+            rc = -1;
     }
+    /* The importing file may still prefix names the entry left bare */
+    if (rc == 1 && parent && pp_ns_scan(parent, target, text_start) != 0)
+        rc = -1;
+
+    impcache_release(&e);
+    return rc;
 }
 
-/* Pass 2: Re-emit text with all label references prefixed.
- *
- * For every identifier in the text that matches a collected label name
- * and is NOT already namespace-qualified (preceded by '.') and NOT
- * part of a numeric literal (preceded by a digit), emit "prefix.name"
- * instead of "name".
- *
- * Returns 0 on success, -1 on memory error. */
-static int ns_apply_prefix(const char *text, const char *prefix,
-                           const NSLabelTable *tbl, StrBuf *out)
+/* Store what importing imported[slot] contributed (text from text_start,
+ * which is line `base` of the target) */
+static void pp_cache_save(PPState *state, const char *key, int slot,
+                          int first_skip, int first_macro,
+                          const StrBuf *target, int text_start, int base)
 {
-    int prefix_len = (int)strlen(prefix);
-    const char *p  = text;
-
-    while (*p) {
-        /* If current char cannot start an identifier, emit it as-is */
-        if (!pp_is_ident_start(*p)) {
-            if (strbuf_append_char(out, *p) != 0) return -1;
-            p++;
-            continue;
-        }
-
-        /* Collect the full identifier */
-        const char *id_start = p;
-        while (*p && pp_is_ident_char(*p)) p++;
-        int id_len = (int)(p - id_start);
-
-        /* Determine if the identifier is already qualified or is part
-         * of a hex/numeric literal (e.g., 0xFF → 'x' starts ident). */
-        int skip_prefix = 0;
-        if (id_start > text) {
-            char prev = *(id_start - 1);
-            if (prev == '.' || (prev >= '0' && prev <= '9'))
-                skip_prefix = 1;
-        }
+    int nfiles  = state->import_count - slot;
+    int nmacros = state->macros.count - first_macro;
+    ImpCacheEntry e;
+    memset(&e, 0, sizeof(e));
+    e.deps   = (ImpCacheDep *)malloc((size_t)(nfiles + state->skip_count -
+                                              first_skip) *
+                                     sizeof(ImpCacheDep));
+    e.macros = (ImpCacheMacro *)malloc((size_t)(nmacros + 1) *
+                                       sizeof(ImpCacheMacro));
+    int ok = e.deps != NULL && e.macros != NULL;
+
+    for (int i = slot; ok && i < state->import_count; i++) {
+        ok = state->files[i].size >= 0;         /* identity known */
+        e.deps[e.dep_count]          = state->files[i];
+        e.deps[e.dep_count].path     = state->imported[i];
+        e.deps[e.dep_count].imported = 1;
+        e.dep_count++;
+    }
+    for (int k = first_skip; ok && k < state->skip_count; k++) {
+        int dup = 0;
+        for (int d = 0; d < e.dep_count && !dup; d++)
+            dup = strcmp(e.deps[d].path, state->skipped[k]) == 0;
+        if (dup) continue;                      /* read by this import */
+        memset(&e.deps[e.dep_count], 0, sizeof(ImpCacheDep));
+        e.deps[e.dep_count].path = state->skipped[k];
+        e.dep_count++;
+    }
+    for (int m = 0; ok && m < nmacros; m++) {
+        e.macros[m].name  = state->macros.entries[first_macro + m].name;
+        e.macros[m].value = state->macros.entries[first_macro + m].value;
+    }
+    e.macro_count = nmacros;
+    e.text        = target->data + text_start;
+    e.text_len    = (size_t)(target->size - text_start);
+
+    /* Runs relative to the text, their files as indexes into deps[] */
+    int first_run = target->lines.run_count;
+    while (first_run > 0 && target->lines.runs[first_run - 1].line >= base)
+        first_run--;
+    e.lines = (LineRun *)malloc((size_t)(target->lines.run_count -
+                                         first_run + 1) * sizeof(LineRun));
+    ok = ok && e.lines != NULL;
+    for (int r = first_run; ok && r < target->lines.run_count; r++) {
+        const LineRun *run  = &target->lines.runs[r];
+        const char    *path = state->lines->files[run->file];
+        int d = 0;
+        while (d < nfiles && strcmp(e.deps[d].path, path) != 0) d++;
+        ok = d < nfiles;
+        e.lines[e.line_count].line     = run->line - base + 1;
+        e.lines[e.line_count].file     = d;
+        e.lines[e.line_count].src_line = run->src_line;
+        e.line_count++;
+    }
 
-        /* Check if the identifier matches a known label */
-        if (!skip_prefix && ns_is_label(tbl, id_start, id_len)) {
-            if (strbuf_append(out, prefix, prefix_len) != 0) return -1;
-            if (strbuf_append_char(out, '.') != 0) return -1;
-        }
+    if (ok && impcache_store(state->cache_dir, key, &e) == 0)
+        diag_log(state->diag, DIAG_VERBOSE,
+                 "[Precompiler] Cached '%s'\n", state->imported[slot]);
+    free(e.deps);
+    free(e.macros);
+    free(e.lines);
+}
 
-        /* Emit the identifier itself */
-        if (strbuf_append(out, id_start, id_len) != 0) return -1;
+static int pp_import_cached(PPState *state, int slot, const char *resolved,
+                            const char *import_path, const char *ns_prefix,
+                            const char *filename, int line_num, int depth,
+                            StrBuf *target, PPNamespace *parent)
+{
+    StrBuf key;
+    if (strbuf_init(&key) != 0) return -1;
+
+    int rc = -1;
+    if (pp_cache_key(state, resolved, ns_prefix, &key) == 0)
+        rc = pp_cache_fetch(state, key.data, slot, resolved, target,
+                            parent);
+
+    if (rc == 0) {
+        int first_skip  = state->skip_count;
+        int first_macro = state->macros.count;
+        int dummies     = state->dummies;
+        int text_start  = target->size;
+        int base        = strbuf_line(target);
+
+        rc = pp_import_file(state, slot, resolved, import_path, ns_prefix,
+                            filename, line_num, depth, target, parent);
+        /* A file that prints @DUMMY messages is not cached: a hit would
+         * not print them. */
+        if (rc == 0 && state->dummies == dummies)
+            pp_cache_save(state, key.data, slot, first_skip, first_macro,
+                          target, text_start, base);
     }
-
-    return 0;
+    strbuf_free(&key);
+    return rc < 0 ? -1 : 0;
 }
 
 /* =========================================================================
@@ -624,12 +1140,13 @@ static int pp_process(const char *source,
                       const char *base_dir,
                       int         depth,
                       StrBuf     *output,
-                      StrBuf     *deferred)
+                      StrBuf     *deferred,
+                      PPNamespace *ns)
 {
     if (depth > PP_MAX_IMPORT_DEPTH) {
-        fprintf(stderr,
-                "[Precompiler] Error: @IMPORT nesting exceeds %d levels "
-                "(circular import?)\n", PP_MAX_IMPORT_DEPTH);
+        diag_printf(state->diag,
+                    "[Precompiler] Error: @IMPORT nesting exceeds %d levels "
+                    "(circular import?)\n", PP_MAX_IMPORT_DEPTH);
         return -1;
     }
 
@@ -638,6 +1155,14 @@ static int pp_process(const char *source,
     int line_num     = 1;
     const char *p    = source;
 
+    /* Every source line becomes one output line, unless an import's
+     * text is spliced in before it */
+    int file_id = linemap_file(state->lines, filename);
+    if (file_id < 0 || strbuf_map(output, file_id, 1) != 0) {
+        diag_printf(state->diag, "[Precompiler] Error: out of memory\n");
+        return -1;
+    }
+
     while (*p) {
         /* ---- Extract one source line ---------------------------------- */
         const char *line_start = p;
@@ -693,9 +1218,9 @@ static int pp_process(const char *source,
                     a++;
                 int alen = (int)(a - arg);
                 if (alen <= 0) {
-                    fprintf(stderr,
-                            "[Precompiler] %s:%d: @IF_ARCH requires "
-                            "an architecture name\n", filename, line_num);
+                    diag_printf(state->diag,
+                                "[Precompiler] %s:%d: @IF_ARCH requires "
+                                "an architecture name\n", filename, line_num);
                     return -1;
                 }
                 char arch_tok[64];
@@ -705,10 +1230,10 @@ static int pp_process(const char *source,
 
                 total_depth++;
                 if (total_depth > PP_MAX_COND_DEPTH) {
-                    fprintf(stderr,
-                            "[Precompiler] %s:%d: conditional nesting "
-                            "exceeds %d levels\n",
-                            filename, line_num, PP_MAX_COND_DEPTH);
+                    diag_printf(state->diag,
+                                "[Precompiler] %s:%d: conditional nesting "
+                                "exceeds %d levels\n",
+                                filename, line_num, PP_MAX_COND_DEPTH);
                     return -1;
                 }
                 if (is_active && pp_casecmp(arch_tok, state->arch) == 0)
@@ -727,9 +1252,9 @@ static int pp_process(const char *source,
                     a++;
                 int slen = (int)(a - arg);
                 if (slen <= 0) {
-                    fprintf(stderr,
-                            "[Precompiler] %s:%d: @IF_SYS requires "
-                            "a system name\n", filename, line_num);
+                    diag_printf(state->diag,
+                                "[Precompiler] %s:%d: @IF_SYS requires "
+                                "a system name\n", filename, line_num);
                     return -1;
                 }
                 char sys_tok[64];
@@ -739,10 +1264,10 @@ static int pp_process(const char *source,
 
                 total_depth++;
                 if (total_depth > PP_MAX_COND_DEPTH) {
-                    fprintf(stderr,
-                            "[Precompiler] %s:%d: conditional nesting "
-                            "exceeds %d levels\n",
-                            filename, line_num, PP_MAX_COND_DEPTH);
+                    diag_printf(state->diag,
+                                "[Precompiler] %s:%d: conditional nesting "
+                                "exceeds %d levels\n",
+                                filename, line_num, PP_MAX_COND_DEPTH);
                     return -1;
                 }
                 if (is_active &&
@@ -758,9 +1283,9 @@ static int pp_process(const char *source,
             else if (pp_casecmp(directive, "ENDIF") == 0) {
 
                 if (total_depth == 0) {
-                    fprintf(stderr,
-                            "[Precompiler] %s:%d: @ENDIF without matching "
-                            "@IF_ARCH or @IF_SYS\n", filename, line_num);
+                    diag_printf(state->diag,
+                                "[Precompiler] %s:%d: @ENDIF without matching "
+                                "@IF_ARCH or @IF_SYS\n", filename, line_num);
                     return -1;
                 }
                 if (active_depth == total_depth)
@@ -787,10 +1312,10 @@ static int pp_process(const char *source,
                         const char *qe = qs;
                         while (qe < line_end && *qe != '"') qe++;
                         if (qe >= line_end) {
-                            fprintf(stderr,
-                                    "[Precompiler] %s:%d: unterminated "
-                                    "quote in @IMPORT\n",
-                                    filename, line_num);
+                            diag_printf(state->diag,
+                                        "[Precompiler] %s:%d: unterminated "
+                                        "quote in @IMPORT\n",
+                                        filename, line_num);
                             return -1;
                         }
                         plen = (int)(qe - qs);
@@ -811,9 +1336,9 @@ static int pp_process(const char *source,
                     import_path[plen] = '\0';
 
                     if (plen == 0) {
-                        fprintf(stderr,
-                                "[Precompiler] %s:%d: @IMPORT requires "
-                                "a file path\n", filename, line_num);
+                        diag_printf(state->diag,
+                                    "[Precompiler] %s:%d: @IMPORT requires "
+                                    "a file path\n", filename, line_num);
                         return -1;
                     }
 
@@ -873,9 +1398,9 @@ static int pp_process(const char *source,
                         resolved[PP_MAX_PATH_LEN - 1] = '\0';
                     } else if (pp_resolve_path(base_dir, import_path,
                                         resolved, PP_MAX_PATH_LEN) != 0) {
-                        fprintf(stderr,
-                                "[Precompiler] %s:%d: import path "
-                                "too long\n", filename, line_num);
+                        diag_printf(state->diag,
+                                    "[Precompiler] %s:%d: import path "
+                                    "too long\n", filename, line_num);
                         return -1;
                     }
 
@@ -883,98 +1408,56 @@ static int pp_process(const char *source,
                     if (!pp_was_imported(state, resolved)) {
                         if (pp_mark_imported(state, resolved) != 0)
                             return -1;
-
-                        char *imp_src = pp_read_file(resolved);
-                        if (!imp_src) {
-                            fprintf(stderr,
-                                    "[Precompiler] %s:%d: failed to import "
-                                    "'%s'\n", filename, line_num, import_path);
-                            return -1;
-                        }
-
-                        /* Compute base dir for the imported file */
-                        char imp_dir[PP_MAX_PATH_LEN];
-                        pp_extract_dir(resolved, imp_dir, PP_MAX_PATH_LEN);
-
-                        fprintf(stderr,
-                                "[Precompiler] Importing '%s'\n", resolved);
-
-                        /* ---- Namespace prefixing ----------------------
-                         * Process the imported file into a temporary
-                         * buffer, then apply namespace prefix to all
-                         * label definitions and references. */
-                        StrBuf imp_out;
-                        if (strbuf_init(&imp_out) != 0) {
-                            free(imp_src);
-                            return -1;
-                        }
-
-                        int rc = pp_process(imp_src, resolved, state,
-                                            imp_dir, depth + 1, &imp_out,
-                                            NULL);
-                        free(imp_src);
-                        if (rc != 0) {
-                            strbuf_free(&imp_out);
-                            return rc;
-                        }
-
-                        /* Null-terminate the temp buffer for scanning */
-                        if (strbuf_append_char(&imp_out, '\0') != 0) {
-                            strbuf_free(&imp_out);
-                            return -1;
-                        }
+                        int slot = state->import_count - 1;
 
                         /* Extract basename for namespace prefix */
-                        char ns_prefix[PP_MAX_NS_NAME];
+                        char ns_prefix[PP_MAX_PATH_LEN];
                         pp_extract_basename(import_path,
                                             ns_prefix,
                                             (int)sizeof(ns_prefix));
 
-                        /* Collect label definitions and apply prefix */
-                        NSLabelTable labels;
-                        ns_collect_labels(imp_out.data, &labels);
-
                         /* At depth 0, imported code is deferred to run
                          * after the main program so that the PE/ELF
                          * entry point lands on the first user instruction. */
                         StrBuf *import_target =
                             (depth == 0 && deferred) ? deferred : output;
 
-                        if (labels.count > 0) {
-                            /* Apply namespace prefix to all refs */
-                            if (ns_apply_prefix(imp_out.data,
-                                                ns_prefix,
-                                                &labels, import_target) != 0) {
-                                strbuf_free(&imp_out);
-                                return -1;
-                            }
-                        } else {
-                            /* No labels — append as-is (exclude NUL) */
-                            if (strbuf_append(import_target, imp_out.data,
-                                              imp_out.size - 1) != 0) {
-                                strbuf_free(&imp_out);
-                                return -1;
-                            }
-                        }
-                        strbuf_free(&imp_out);
+                        int rc = state->cache_dir
+                            ? pp_import_cached(state, slot, resolved,
+                                               import_path, ns_prefix,
+                                               filename, line_num, depth,
+                                               import_target, ns)
+                            : pp_import_file(state, slot, resolved,
+                                             import_path, ns_prefix,
+                                             filename, line_num, depth,
+                                             import_target, ns);
+                        if (rc != 0) return rc;
                     } else {
-                        fprintf(stderr,
-                                "[Precompiler] %s:%d: '%s' already imported "
-                                "— skipped\n", filename, line_num,
-                                import_path);
+                        diag_log(state->diag, DIAG_NORMAL,
+                                 "[Precompiler] %s:%d: '%s' already imported "
+                                 "— skipped\n", filename, line_num,
+                                 import_path);
+                        if (state->cache_dir &&
+                            pp_log_skip(state, resolved) != 0) {
+                            diag_printf(state->diag,
+                                        "[Precompiler] Error: out of memory\n");
+                            return -1;
+                        }
                     }
 
                     /* Blank line for the @IMPORT directive itself */
-                    if (strbuf_append_char(output, '\n') != 0) return -1;
+                    if (strbuf_map(output, file_id, line_num) != 0 ||
+                        strbuf_append_char(output, '\n') != 0)
+                        return -1;
                 }
                 /* ---- @ARCH_ONLY <arch1>,<arch2>,... ------------------- */
                 else if (pp_casecmp(directive, "ARCH_ONLY") == 0) {
 
                     if (arg >= line_end || *arg == ';') {
-                        fprintf(stderr,
-                                "[Precompiler] %s:%d: @ARCH_ONLY requires "
-                                "at least one architecture name\n",
-                                filename, line_num);
+                        diag_printf(state->diag,
+                                    "[Precompiler] %s:%d: @ARCH_ONLY requires "
+                                    "at least one architecture name\n",
+                                    filename, line_num);
                         return -1;
                     }
 
@@ -1029,11 +1512,11 @@ static int pp_process(const char *source,
                             alen--;
                         allowed[alen] = '\0';
 
-                        fprintf(stderr,
-                                "[Precompiler] %s:%d: @ARCH_ONLY — "
-                                "current architecture '%s' is not in the "
-                                "supported set [%s]\n",
-                                filename, line_num, state->arch, allowed);
+                        diag_printf(state->diag,
+                                    "[Precompiler] %s:%d: @ARCH_ONLY — "
+                                    "current architecture '%s' is not in the "
+                                    "supported set [%s]\n",
+                                    filename, line_num, state->arch, allowed);
                         return -1;
                     }
 
@@ -1043,10 +1526,10 @@ static int pp_process(const char *source,
                 else if (pp_casecmp(directive, "SYS_ONLY") == 0) {
 
                     if (arg >= line_end || *arg == ';') {
-                        fprintf(stderr,
-                                "[Precompiler] %s:%d: @SYS_ONLY requires "
-                                "at least one system name\n",
-                                filename, line_num);
+                        diag_printf(state->diag,
+                                    "[Precompiler] %s:%d: @SYS_ONLY requires "
+                                    "at least one system name\n",
+                                    filename, line_num);
                         return -1;
                     }
 
@@ -1066,11 +1549,11 @@ static int pp_process(const char *source,
                             alen--;
                         allowed[alen] = '\0';
 
-                        fprintf(stderr,
-                                "[Precompiler] %s:%d: @SYS_ONLY — "
-                                "no -sys specified, but file requires "
-                                "one of [%s]\n",
-                                filename, line_num, allowed);
+                        diag_printf(state->diag,
+                                    "[Precompiler] %s:%d: @SYS_ONLY — "
+                                    "no -sys specified, but file requires "
+                                    "one of [%s]\n",
+                                    filename, line_num, allowed);
                         return -1;
                     }
 
@@ -1120,11 +1603,11 @@ static int pp_process(const char *source,
                             alen--;
                         allowed[alen] = '\0';
 
-                        fprintf(stderr,
-                                "[Precompiler] %s:%d: @SYS_ONLY — "
-                                "current system '%s' is not in the "
-                                "supported set [%s]\n",
-                                filename, line_num, state->sys, allowed);
+                        diag_printf(state->diag,
+                                    "[Precompiler] %s:%d: @SYS_ONLY — "
+                                    "current system '%s' is not in the "
+                                    "supported set [%s]\n",
+                                    filename, line_num, state->sys, allowed);
                         return -1;
                     }
 
@@ -1140,9 +1623,9 @@ static int pp_process(const char *source,
                         name_start++;
                     if (name_start >= line_end ||
                         !pp_is_ident_start(*name_start)) {
-                        fprintf(stderr,
-                                "[Precompiler] %s:%d: @DEFINE requires "
-                                "a name\n", filename, line_num);
+                        diag_printf(state->diag,
+                                    "[Precompiler] %s:%d: @DEFINE requires "
+                                    "a name\n", filename, line_num);
                         return -1;
                     }
                     const char *name_end = name_start;
@@ -1165,16 +1648,17 @@ static int pp_process(const char *source,
                         val_end--;
                     int vlen = (int)(val_end - val_start);
                     if (vlen <= 0) {
-                        fprintf(stderr,
-                                "[Precompiler] %s:%d: @DEFINE requires "
-                                "a value\n", filename, line_num);
+                        diag_printf(state->diag,
+                                    "[Precompiler] %s:%d: @DEFINE requires "
+                                    "a value\n", filename, line_num);
                         return -1;
                     }
 
                     if (pp_macro_add(&state->macros,
                                      name_start, nlen,
                                      val_start, vlen,
-                                     filename, line_num) != 0)
+                                     filename, line_num,
+                                     state->diag) != 0)
                         return -1;
 
                     /* No code emitted — just a blank line */
@@ -1194,15 +1678,16 @@ static int pp_process(const char *source,
                         msg_end--;
                     int msg_len = (int)(msg_end - msg);
 
+                    state->dummies++;
                     if (msg_len > 0) {
-                        fprintf(stderr,
-                                "[Precompiler] DUMMY %s:%d: %.*s\n",
-                                filename, line_num, msg_len, msg);
+                        diag_printf(state->diag,
+                                    "[Precompiler] DUMMY %s:%d: %.*s\n",
+                                    filename, line_num, msg_len, msg);
                     } else {
-                        fprintf(stderr,
-                                "[Precompiler] DUMMY %s:%d: "
-                                "(no implementation)\n",
-                                filename, line_num);
+                        diag_printf(state->diag,
+                                    "[Precompiler] DUMMY %s:%d: "
+                                    "(no implementation)\n",
+                                    filename, line_num);
                     }
 
                     /* No code emitted — just a blank line */
@@ -1222,25 +1707,26 @@ static int pp_process(const char *source,
                            *addr_end != '\r' && *addr_end != '\n')
                         addr_end++;
                     if (addr_start == addr_end) {
-                        fprintf(stderr,
-                                "[Precompiler] %s:%d: @ORG requires an "
-                                "address argument\n",
-                                filename, line_num);
+                        diag_printf(state->diag,
+                                    "[Precompiler] %s:%d: @ORG requires an "
+                                    "address argument\n",
+                                    filename, line_num);
                         return -1;
                     }
 
                     /* Emit as: ORG <address>   (for the parser) */
-                    if (strbuf_append(output, "ORG ", 4) != 0) return -1;
-                    if (strbuf_append(output, addr_start,
-                                      (int)(addr_end - addr_start)) != 0)
+                    if (pp_emit_text(ns, "ORG ", 4, output) != 0) return -1;
+                    if (pp_emit_text(ns, addr_start,
+                                     (int)(addr_end - addr_start),
+                                     output) != 0)
                         return -1;
                     if (strbuf_append_char(output, '\n') != 0) return -1;
                 }
                 /* ---- Unknown @-directive ------------------------------ */
                 else {
-                    fprintf(stderr,
-                            "[Precompiler] %s:%d: unknown directive '@%s'\n",
-                            filename, line_num, directive);
+                    diag_printf(state->diag,
+                                "[Precompiler] %s:%d: unknown directive '@%s'\n",
+                                filename, line_num, directive);
                     return -1;
                 }
             }
@@ -1254,14 +1740,12 @@ static int pp_process(const char *source,
          * ============================================================== */
         else if (is_active) {
             /* Expand @DEFINE macros, then emit */
-            if (state->macros.count > 0) {
-                if (pp_expand_macros(&state->macros,
-                                     line_start, line_len, output) != 0)
-                    return -1;
-            } else {
-                if (strbuf_append(output, line_start, line_len) != 0)
-                    return -1;
-            }
+            int line_off = output->size;
+            if (pp_emit_line(&state->macros, ns,
+                             line_start, line_len, output) != 0)
+                return -1;
+            if (ns && pp_ns_line_label(ns, output, line_off) != 0)
+                return -1;
             if (strbuf_append_char(output, '\n') != 0) return -1;
         }
         else {
@@ -1274,9 +1758,9 @@ static int pp_process(const char *source,
 
     /* ---- Check for unterminated @IF blocks ---------------------------- */
     if (total_depth != 0) {
-        fprintf(stderr,
-                "[Precompiler] %s: %d unterminated @IF block(s) — "
-                "missing @ENDIF\n", filename, total_depth);
+        diag_printf(state->diag,
+                    "[Precompiler] %s: %d unterminated @IF block(s) — "
+                    "missing @ENDIF\n", filename, total_depth);
         return -1;
     }
 
@@ -1291,19 +1775,26 @@ char* preprocess(const char *source,
                  const char *sys,
                  const char *base_dir,
                  const char *filename,
-                 const char *exe_dir)
+                 const char *exe_dir,
+                 const char *cache_dir,
+                 LineMap    *lines,
+                 UaDiag     *diag)
 {
     if (!source || !arch) {
-        fprintf(stderr, "[Precompiler] Error: NULL source or arch\n");
+        diag_printf(diag, "[Precompiler] Error: NULL source or arch\n");
         return NULL;
     }
 
+    LineMap local_lines;
+    linemap_init(&local_lines);
+    if (!lines) lines = &local_lines;
+
     PPState state;
-    pp_state_init(&state, arch, sys, exe_dir);
+    pp_state_init(&state, arch, sys, exe_dir, cache_dir, lines, diag);
 
     StrBuf output;
     if (strbuf_init(&output) != 0) {
-        fprintf(stderr, "[Precompiler] Error: out of memory\n");
+        diag_printf(diag, "[Precompiler] Error: out of memory\n");
         return NULL;
     }
 
@@ -1312,7 +1803,7 @@ char* preprocess(const char *source,
      * instruction rather than inside a library function. */
     StrBuf deferred;
     if (strbuf_init(&deferred) != 0) {
-        fprintf(stderr, "[Precompiler] Error: out of memory\n");
+        diag_printf(diag, "[Precompiler] Error: out of memory\n");
         strbuf_free(&output);
         return NULL;
     }
@@ -1329,32 +1820,40 @@ char* preprocess(const char *source,
         }
     }
 
-    int rc = pp_process(source, file, &state, dir, 0, &output, &deferred);
+    int rc = pp_process(source, file, &state, dir, 0, &output, &deferred,
+                        NULL);
 
     pp_state_free(&state);
 
-    if (rc != 0) {
-        strbuf_free(&output);
-        strbuf_free(&deferred);
-        return NULL;
-    }
-
     /* Append deferred (imported) code after main code */
-    if (deferred.size > 0) {
-        if (strbuf_append(&output, deferred.data, deferred.size) != 0) {
-            strbuf_free(&output);
-            strbuf_free(&deferred);
-            return NULL;
-        }
+    if (rc == 0 && deferred.size > 0) {
+        int base = strbuf_line(&output);
+        if (strbuf_append(&output, deferred.data, deferred.size) != 0 ||
+            strbuf_map_runs(&output, base, deferred.lines.runs,
+                            deferred.lines.run_count) != 0)
+            rc = -1;
     }
     strbuf_free(&deferred);
 
     /* Null-terminate the output */
-    if (strbuf_append_char(&output, '\0') != 0) {
+    if (rc == 0 && strbuf_append_char(&output, '\0') != 0)
+        rc = -1;
+
+    if (rc != 0) {
         strbuf_free(&output);
+        linemap_free(&local_lines);
         return NULL;
     }
 
-    /* Detach — caller owns the memory now */
+    /* Detach — caller owns the memory (and the runs) now */
+    if (lines != &local_lines) {
+        free(lines->runs);
+        lines->runs      = output.lines.runs;
+        lines->run_count = output.lines.run_count;
+        lines->run_cap   = output.lines.run_cap;
+    } else {
+        free(output.lines.runs);
+    }
+    linemap_free(&local_lines);
     return output.data;
 }
@@ -25,6 +25,9 @@
 #ifndef UA_PRECOMPILER_H
 #define UA_PRECOMPILER_H
 
+#include "diag.h"       /* UaDiag */
+#include "linemap.h"    /* LineMap */
+
 /*
  *  preprocess()
  *
@@ -40,16 +43,26 @@
  *    filename  Name/path of the input file (used in diagnostic messages).
  *    exe_dir   Directory of the compiler executable (for resolving std_*
  *              library imports).  May be NULL if unknown.
+ *    cache_dir Directory of the precompiled import cache (impcache.h), or
+ *              NULL to preprocess every imported file.
+ *    lines     [out] Initialised LineMap that receives the file and line
+ *              each output line came from, or NULL.  It holds the file
+ *              names read so far even on failure; release it with
+ *              linemap_free().
+ *    diag      Sink for diagnostics (NULL = stderr).
  *
  *  Returns:
  *    Heap-allocated preprocessed source text — caller must free().
- *    Returns NULL on error (diagnostics are printed to stderr).
+ *    Returns NULL on error (diagnostics are printed to `diag`).
  */
 char* preprocess(const char *source,
                  const char *arch,
                  const char *sys,
                  const char *base_dir,
                  const char *filename,
-                 const char *exe_dir);
+                 const char *exe_dir,
+                 const char *cache_dir,
+                 LineMap    *lines,
+                 UaDiag     *diag);
 
 #endif /* UA_PRECOMPILER_H */
@@ -0,0 +1,452 @@
+/*
+ * =============================================================================
+ *  UA - Unified Assembler
+ *  Register Allocation for Named Variables
+ *
+ *  File:    regalloc.c
+ *  Purpose: Liveness analysis and linear-scan assignment of VARs to spare
+ *           physical registers (-O2).  See regalloc.h for the overview.
+ *
+ *  Live sets are bitsets over the VAR index, one per basic block.  The
+ *  live interval of a variable is the hull of every block it is live in,
+ *  so two variables only share a register when neither is live anywhere
+ *  in the other's range.  Using block granularity over-approximates the
+ *  interval a little but keeps the pass linear in the IR size.
+ *
+ *  License: MIT
+ * =============================================================================
+ */
+
+#include "regalloc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* =========================================================================
+ *  Constants
+ * ========================================================================= */
+#define RA_MAX_DEPTH   6        /* loop nesting levels counted in weights  */
+#define RA_NOT_VAR    -1        /* var_of[]: name is not a VAR             */
+#define RA_EXCLUDED   -2        /* var_of[]: VAR name also used otherwise  */
+
+typedef uint64_t RaWord;
+#define RA_WORD_BITS  64
+
+/* =========================================================================
+ *  Basic blocks
+ * ========================================================================= */
+typedef struct {
+    int first, last;            /* IR index range (inclusive)             */
+    int succ[2];                /* successor blocks, -1 = none            */
+    int to_ret;                 /* ends in RET/HLT: flows to return sites */
+    int ret_site;               /* starts right after a CALL              */
+} RaBlock;
+
+/* Label operand of a branch, or NULL */
+static const Operand* ra_branch_label(const Instruction *inst)
+{
+    if (inst->is_label) return NULL;
+    switch (inst->opcode) {
+        case OP_JMP: case OP_JZ: case OP_JNZ: case OP_JL: case OP_JG:
+        case OP_CALL: case OP_DJNZ: case OP_CJNE:
+            break;
+        default:
+            return NULL;
+    }
+    for (int k = inst->operand_count - 1; k >= 0; k--) {
+        if (inst->operands[k].type == OPERAND_LABEL_REF)
+            return &inst->operands[k];
+    }
+    return NULL;
+}
+
+static int ra_ends_block(const Instruction *inst)
+{
+    if (inst->is_label) return 0;
+    switch (inst->opcode) {
+        case OP_JMP: case OP_JZ: case OP_JNZ: case OP_JL: case OP_JG:
+        case OP_CALL: case OP_DJNZ: case OP_CJNE:
+        case OP_RET: case OP_RETI: case OP_HLT:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int ra_returns(const Instruction *inst)
+{
+    return !inst->is_label && (inst->opcode == OP_RET ||
+                               inst->opcode == OP_RETI ||
+                               inst->opcode == OP_HLT);
+}
+
+static int ra_clobbers(const Instruction *inst)
+{
+    return !inst->is_label && (inst->opcode == OP_SYS ||
+                               inst->opcode == OP_INT);
+}
+
+/* Variable referenced by a GET / SET entry, or RA_NOT_VAR */
+static int ra_access_var(const Instruction *inst, const int *var_of)
+{
+    if (inst->is_label) return RA_NOT_VAR;
+    if (inst->opcode == OP_GET) return var_of[inst->operands[1].data.label_id];
+    if (inst->opcode == OP_SET) return var_of[inst->operands[0].data.label_id];
+    return RA_NOT_VAR;
+}
+
+/* =========================================================================
+ *  Linear scan ordering
+ * ========================================================================= */
+typedef struct {
+    int start;
+    int var;
+} RaOrder;
+
+static int ra_order_cmp(const void *a, const void *b)
+{
+    const RaOrder *x = (const RaOrder *)a, *y = (const RaOrder *)b;
+    if (x->start != y->start) return x->start < y->start ? -1 : 1;
+    return x->var - y->var;
+}
+
+/* =========================================================================
+ *  regalloc_run()
+ * ========================================================================= */
+int regalloc_run(RegAlloc *ra, const Instruction *ir, int ir_count,
+                 const StrPool *strs, const RegPool *pool)
+{
+    memset(ra, 0, sizeof(*ra));
+
+    int    *var_of   = (int *)malloc((size_t)strs->count * sizeof(int));
+    int    *label_at = (int *)malloc((size_t)strs->count * sizeof(int));
+    int    *block_of = (int *)malloc(((size_t)ir_count + 1) * sizeof(int));
+    int    *depth    = (int *)calloc((size_t)ir_count + 2, sizeof(int));
+    int    *sys_upto = (int *)malloc(((size_t)ir_count + 1) * sizeof(int));
+    RaBlock *blocks  = (RaBlock *)malloc(((size_t)ir_count + 1) * sizeof(RaBlock));
+    ra->inst_reg     = (int *)malloc(((size_t)ir_count + 1) * sizeof(int));
+    if (!var_of || !label_at || !block_of || !depth || !sys_upto ||
+        !blocks || !ra->inst_reg) {
+        free(var_of); free(label_at); free(block_of); free(depth);
+        free(sys_upto); free(blocks);
+        regalloc_free(ra);
+        return -1;
+    }
+
+    /* --- Variables and labels ------------------------------------------ */
+    int has_org = 0, var_decls = 0;
+    for (int id = 0; id < strs->count; id++) {
+        var_of[id]   = RA_NOT_VAR;
+        label_at[id] = -1;
+    }
+    for (int i = 0; i < ir_count; i++) {
+        ra->inst_reg[i] = -1;
+        if (!ir[i].is_label && ir[i].opcode == OP_VAR) var_decls++;
+    }
+    ra->vars = (RegAllocVar *)calloc((size_t)var_decls + 1,
+                                     sizeof(RegAllocVar));
+    if (!ra->vars) {
+        free(var_of); free(label_at); free(block_of); free(depth);
+        free(sys_upto); free(blocks);
+        regalloc_free(ra);
+        return -1;
+    }
+
+    for (int i = 0; i < ir_count; i++) {
+        const Instruction *inst = &ir[i];
+        if (inst->is_label) {
+            if (label_at[inst->label_id] < 0) label_at[inst->label_id] = i;
+        } else if (inst->opcode == OP_VAR) {
+            StrId id = inst->operands[0].data.label_id;
+            if (var_of[id] != RA_NOT_VAR) continue;     /* first one wins */
+            RegAllocVar *rv = &ra->vars[ra->var_count];
+            var_of[id] = ra->var_count++;
+            rv->name  = id;
+            rv->init  = (inst->operand_count >= 2 &&
+                         inst->operands[1].type == OPERAND_IMMEDIATE)
+                        ? inst->operands[1].data.imm : 0;
+            rv->reg   = -1;
+            rv->slot  = -1;
+            rv->start = -1;
+            rv->end   = -1;
+        } else if (inst->opcode == OP_ORG) {
+            has_org = 1;
+        }
+    }
+
+    /* A name that is also a label or a BUFFER is not a plain variable:
+     * GET on it may mean "address of", so it stays in memory. */
+    for (int i = 0; i < ir_count; i++) {
+        const Instruction *inst = &ir[i];
+        StrId id;
+        if (inst->is_label)                   id = inst->label_id;
+        else if (inst->opcode == OP_BUFFER)   id = inst->operands[0].data.label_id;
+        else continue;
+        if (var_of[id] >= 0) var_of[id] = RA_EXCLUDED;
+    }
+
+    /* --- Basic blocks ---------------------------------------------------- */
+    int nb = 0;
+    for (int i = 0; i < ir_count; i++) {
+        int leader = (i == 0) || ir[i].is_label || ra_ends_block(&ir[i - 1]);
+        if (leader) {
+            if (nb > 0) blocks[nb - 1].last = i - 1;
+            blocks[nb].first    = i;
+            blocks[nb].succ[0]  = -1;
+            blocks[nb].succ[1]  = -1;
+            blocks[nb].to_ret   = 0;
+            blocks[nb].ret_site = (i > 0 && !ir[i - 1].is_label &&
+                                   ir[i - 1].opcode == OP_CALL);
+            nb++;
+        }
+        block_of[i] = nb - 1;
+    }
+    if (nb > 0) blocks[nb - 1].last = ir_count - 1;
+
+    for (int b = 0; b < nb; b++) {
+        const Instruction *end = &ir[blocks[b].last];
+        const Operand     *lbl = ra_branch_label(end);
+        int next   = (b + 1 < nb) ? b + 1 : -1;
+        int target = -1;
+        if (lbl && label_at[lbl->data.label_id] >= 0)
+            target = block_of[label_at[lbl->data.label_id]];
+
+        if (ra_returns(end)) {
+            blocks[b].to_ret = 1;
+        } else if (!end->is_label && end->opcode == OP_JMP) {
+            blocks[b].succ[0] = target;
+        } else if (lbl) {
+            /* Conditional branch, or CALL (which also resumes at b+1) */
+            blocks[b].succ[0] = target;
+            blocks[b].succ[1] = next;
+        } else {
+            blocks[b].succ[0] = next;
+        }
+    }
+
+    /* --- Loop depth and SYS positions ---------------------------------- */
+    for (int i = 0; i < ir_count; i++) {
+        const Operand *lbl = ra_branch_label(&ir[i]);
+        if (!lbl || ir[i].opcode == OP_CALL) continue;
+        int t = label_at[lbl->data.label_id];
+        if (t >= 0 && t <= i) {
+            depth[t]++;
+            depth[i + 1]--;
+        }
+    }
+    sys_upto[0] = 0;
+    for (int i = 0, d = 0; i < ir_count; i++) {
+        d += depth[i];
+        depth[i] = d;
+        sys_upto[i + 1] = sys_upto[i] + ra_clobbers(&ir[i]);
+    }
+
+    /* --- Liveness -------------------------------------------------------- */
+    int W = (ra->var_count + RA_WORD_BITS - 1) / RA_WORD_BITS;
+    if (W == 0) W = 1;
+    size_t set_bytes = (size_t)W * sizeof(RaWord);
+    RaWord *gen     = (RaWord *)calloc((size_t)nb + 1, set_bytes);
+    RaWord *kill    = (RaWord *)calloc((size_t)nb + 1, set_bytes);
+    RaWord *live_in = (RaWord *)calloc((size_t)nb + 1, set_bytes);
+    RaWord *live_out= (RaWord *)calloc((size_t)nb + 1, set_bytes);
+    RaWord *ret_live= (RaWord *)calloc(1, set_bytes);
+    RaOrder *order  = (RaOrder *)malloc(((size_t)ra->var_count + 1) * sizeof(RaOrder));
+    if (!gen || !kill || !live_in || !live_out || !ret_live || !order) {
+        free(gen); free(kill); free(live_in); free(live_out);
+        free(ret_live); free(order);
+        free(var_of); free(label_at); free(block_of); free(depth);
+        free(sys_upto); free(blocks);
+        regalloc_free(ra);
+        return -1;
+    }
+
+    for (int b = 0; b < nb; b++) {
+        RaWord *g = gen + (size_t)b * W, *k = kill + (size_t)b * W;
+        for (int i = blocks[b].first; i <= blocks[b].last; i++) {
+            int v = ra_access_var(&ir[i], var_of);
+            if (v < 0) continue;
+            RaWord bit = (RaWord)1 << (v % RA_WORD_BITS);
+            if (ir[i].opcode == OP_GET) {
+                if (!(k[v / RA_WORD_BITS] & bit)) g[v / RA_WORD_BITS] |= bit;
+            } else {
+                k[v / RA_WORD_BITS] |= bit;
+            }
+        }
+    }
+
+    int changed;
+    do {
+        changed = 0;
+        memset(ret_live, 0, set_bytes);
+        for (int b = 0; b < nb; b++) {
+            if (!blocks[b].ret_site) continue;
+            for (int w = 0; w < W; w++)
+                ret_live[w] |= live_in[(size_t)b * W + w];
+        }
+        for (int b = nb - 1; b >= 0; b--) {
+            RaWord *out = live_out + (size_t)b * W;
+            RaWord *in  = live_in  + (size_t)b * W;
+            for (int w = 0; w < W; w++) {
+                RaWord o = blocks[b].to_ret ? ret_live[w] : 0;
+                for (int s = 0; s < 2; s++) {
+                    if (blocks[b].succ[s] >= 0)
+                        o |= live_in[(size_t)blocks[b].succ[s] * W + w];
+                }
+                RaWord n = gen[(size_t)b * W + w] |
+                           (o & ~kill[(size_t)b * W + w]);
+                out[w] = o;
+                if (n != in[w]) {
+                    in[w] = n;
+                    changed = 1;
+                }
+            }
+        }
+    } while (changed);
+
+    /* --- Live intervals -------------------------------------------------- */
+    for (int b = 0; b < nb; b++) {
+        for (int w = 0; w < W; w++) {
+            RaWord live = live_in[(size_t)b * W + w] |
+                          live_out[(size_t)b * W + w];
+            while (live) {
+                int bit = 0;
+                while (!((live >> bit) & 1)) bit++;
+                live &= live - 1;
+                RegAllocVar *rv = &ra->vars[w * RA_WORD_BITS + bit];
+                if (rv->start < 0 || blocks[b].first < rv->start)
+                    rv->start = blocks[b].first;
+                if (blocks[b].last > rv->end)
+                    rv->end = blocks[b].last;
+            }
+        }
+    }
+    for (int i = 0; i < ir_count; i++) {
+        int v = ra_access_var(&ir[i], var_of);
+        if (v < 0) continue;
+        RegAllocVar *rv = &ra->vars[v];
+        int d = depth[i] < RA_MAX_DEPTH ? depth[i] : RA_MAX_DEPTH;
+        if (d < 0) d = 0;
+        rv->uses++;
+        rv->weight += (int64_t)1 << (3 * d);
+        if (rv->start < 0 || i < rv->start) rv->start = i;
+        if (i > rv->end) rv->end = i;
+    }
+    if (nb > 0) {
+        for (int v = 0; v < ra->var_count; v++) {
+            if (live_in[v / RA_WORD_BITS] & ((RaWord)1 << (v % RA_WORD_BITS)))
+                ra->vars[v].live_in = 1;
+        }
+    }
+
+    /* --- Linear scan ----------------------------------------------------- */
+    int n_order = 0;
+    for (int id = 0; id < strs->count; id++) {
+        int v = var_of[id];
+        if (v < 0 || ra->vars[v].uses == 0) continue;
+        if (ra->vars[v].live_in && has_org) continue;
+        order[n_order].start = ra->vars[v].start;
+        order[n_order].var   = v;
+        n_order++;
+    }
+    qsort(order, (size_t)n_order, sizeof(RaOrder), ra_order_cmp);
+
+    int owner[RA_MAX_POOL];
+    int pool_n = pool->count < RA_MAX_POOL ? pool->count : RA_MAX_POOL;
+    for (int s = 0; s < RA_MAX_POOL; s++) owner[s] = -1;
+
+    for (int k = 0; k < n_order; k++) {
+        RegAllocVar *cur = &ra->vars[order[k].var];
+
+        for (int s = 0; s < pool_n; s++) {
+            if (owner[s] >= 0 && ra->vars[owner[s]].end < cur->start)
+                owner[s] = -1;
+        }
+
+        unsigned allowed = (pool_n >= 32) ? ~0u : ((1u << pool_n) - 1);
+        if (sys_upto[cur->end + 1] - sys_upto[cur->start] > 0)
+            allowed &= ~pool->sys_clobber;
+
+        int pick = -1;
+        for (int s = 0; s < pool_n && pick < 0; s++) {
+            if ((allowed & (1u << s)) && owner[s] < 0) pick = s;
+        }
+        if (pick < 0) {
+            /* Pressure: evict the coldest overlapping variable, if colder */
+            int victim = -1;
+            for (int s = 0; s < pool_n; s++) {
+                if (!(allowed & (1u << s)) || owner[s] < 0) continue;
+                if (victim < 0 ||
+                    ra->vars[owner[s]].weight < ra->vars[owner[victim]].weight)
+                    victim = s;
+            }
+            if (victim >= 0 && ra->vars[owner[victim]].weight < cur->weight) {
+                RegAllocVar *old = &ra->vars[owner[victim]];
+                old->reg  = -1;
+                old->slot = -1;
+                ra->spilled++;
+                pick = victim;
+            } else {
+                ra->spilled++;
+                continue;
+            }
+        }
+        owner[pick] = order[k].var;
+        cur->slot   = pick;
+        cur->reg    = pool->regs[pick];
+    }
+
+    for (int v = 0; v < ra->var_count; v++) {
+        if (ra->vars[v].reg >= 0) ra->allocated++;
+    }
+    for (int i = 0; i < ir_count; i++) {
+        int v = ra_access_var(&ir[i], var_of);
+        if (v >= 0) ra->inst_reg[i] = ra->vars[v].reg;
+    }
+
+    free(gen); free(kill); free(live_in); free(live_out);
+    free(ret_live); free(order);
+    free(var_of); free(label_at); free(block_of); free(depth);
+    free(sys_upto); free(blocks);
+    return 0;
+}
+
+/* =========================================================================
+ *  regalloc_free() / regalloc_inst_reg()
+ * ========================================================================= */
+void regalloc_free(RegAlloc *ra)
+{
+    free(ra->vars);
+    free(ra->inst_reg);
+    memset(ra, 0, sizeof(*ra));
+}
+
+void regalloc_drop(void *ra)
+{
+    regalloc_free((RegAlloc *)ra);
+}
+
+int regalloc_inst_reg(const RegAlloc *ra, int i)
+{
+    if (!ra || !ra->inst_reg) return -1;
+    return ra->inst_reg[i];
+}
+
+/* =========================================================================
+ *  regalloc_print()
+ * ========================================================================= */
+void regalloc_print(const RegAlloc *ra, const StrPool *strs,
+                    const RegPool *pool, UaDiag *diag)
+{
+    diag_log(diag, DIAG_NORMAL, "[RegAlloc] %d of %d VAR%s in registers (%d spilled)\n",
+             ra->allocated, ra->var_count, ra->var_count == 1 ? "" : "s",
+             ra->spilled);
+    for (int v = 0; v < ra->var_count; v++) {
+        const RegAllocVar *rv = &ra->vars[v];
+        if (rv->reg < 0) continue;
+        diag_log(diag, DIAG_VERBOSE, "[RegAlloc]   %-16s %-4s IR %d-%d, %d use%s%s\n",
+                 strpool_get(strs, rv->name), pool->names[rv->slot],
+                 rv->start, rv->end, rv->uses, rv->uses == 1 ? "" : "s",
+                 rv->live_in ? ", loaded at entry" : "");
+    }
+}
@@ -0,0 +1,109 @@
+/*
+ * =============================================================================
+ *  UA - Unified Assembler
+ *  Register Allocation for Named Variables
+ *
+ *  File:    regalloc.h
+ *  Purpose: Optional (-O2) linear-scan allocation of VARs to spare physical
+ *           registers.  The analysis is architecture-neutral; each back-end
+ *           supplies a RegPool of registers that UA's R0-R7 mapping never
+ *           touches (R8-R15 on x86-64, X11-X15 on ARM64, t3-t6 on RISC-V)
+ *           and rewrites GET/SET of an allocated variable as a register move.
+ *
+ *  Steps:
+ *    1. Liveness   backward data-flow over basic blocks.  CALL edges go to
+ *                  the callee; RET/HLT edges go to every return site.
+ *    2. Intervals  one live interval per VAR, in IR order, covering every
+ *                  block where it is live plus each of its GET/SET entries.
+ *    3. Scan       intervals sorted by start get the first free register.
+ *                  Under pressure the interval with the lowest loop-weighted
+ *                  access count is spilled, i.e. stays in memory.
+ *
+ *  A variable that is live at entry (read before any SET on some path)
+ *  has its initial value loaded into the register by a prologue at
+ *  offset 0.  Programs using @ORG pin absolute addresses, so such
+ *  variables are left in memory there.
+ *
+ *  License: MIT
+ * =============================================================================
+ */
+
+#ifndef UA_REGALLOC_H
+#define UA_REGALLOC_H
+
+#include "parser.h"
+
+/* =========================================================================
+ *  Register pool  —  supplied by the back-end
+ * ========================================================================= */
+#define RA_MAX_POOL  16
+
+typedef struct {
+    const uint8_t     *regs;        /* physical register numbers, preferred first */
+    const char *const *names;       /* display names, parallel to regs[]          */
+    int                count;       /* entries in regs[] (<= RA_MAX_POOL)         */
+    unsigned           sys_clobber; /* bit k: regs[k] does not survive SYS / INT  */
+} RegPool;
+
+/* =========================================================================
+ *  Allocation result
+ * ========================================================================= */
+typedef struct {
+    StrId    name;          /* VAR name (interned)                       */
+    int64_t  init;          /* VAR initial value (0 if none)             */
+    int      reg;           /* physical register, or -1 = memory         */
+    int      slot;          /* index into RegPool.regs[], or -1          */
+    int      live_in;       /* live at entry: prologue loads `init`      */
+    int      start, end;    /* live interval (IR indexes), -1 = unused   */
+    int      uses;          /* number of GET / SET entries               */
+    int64_t  weight;        /* uses weighted by loop depth               */
+} RegAllocVar;
+
+typedef struct {
+    RegAllocVar *vars;      /* one entry per VAR declaration             */
+    int          var_count;
+    int         *inst_reg;  /* per IR entry: register for GET/SET, -1    */
+    int          allocated; /* VARs held in registers                    */
+    int          spilled;   /* candidates left in memory under pressure  */
+} RegAlloc;
+
+/* =========================================================================
+ *  Public API
+ * ========================================================================= */
+
+/*
+ * regalloc_run()
+ *   Analyses `ir` and assigns registers from `pool`.  The IR itself is
+ *   not modified.  Returns 0 on success, -1 on allocation failure (in
+ *   which case `ra` is left empty and every variable stays in memory).
+ */
+int regalloc_run(RegAlloc *ra, const Instruction *ir, int ir_count,
+                 const StrPool *strs, const RegPool *pool);
+
+/*
+ * regalloc_free()
+ *   Releases the arrays owned by `ra`.  Safe on a zeroed RegAlloc.
+ */
+void regalloc_free(RegAlloc *ra);
+
+/*
+ * regalloc_drop()
+ *   regalloc_free() as a DiagCleanup, for diag_own().
+ */
+void regalloc_drop(void *ra);
+
+/*
+ * regalloc_inst_reg()
+ *   Register that replaces the memory access of GET/SET entry `i`,
+ *   or -1.  `ra` may be NULL (allocation disabled).
+ */
+int regalloc_inst_reg(const RegAlloc *ra, int i);
+
+/*
+ * regalloc_print()
+ *   Prints the assignment as [RegAlloc] lines to `diag`.
+ */
+void regalloc_print(const RegAlloc *ra, const StrPool *strs,
+                    const RegPool *pool, UaDiag *diag);
+
+#endif /* UA_REGALLOC_H */
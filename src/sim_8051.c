@@ -0,0 +1,833 @@
+/*
+ * =============================================================================
+ *  UA - Unified Assembler
+ *  MCS-51 Instruction-Set Simulator
+ *
+ *  File:    sim_8051.c
+ *  Purpose: Interpreter, timers, interrupts and cycle profile for
+ *           -arch mcs51 code.  See sim_8051.h for the model.
+ *
+ *  Opcode decoding follows the regular layout of the MCS-51 opcode map:
+ *  in most rows the low nibble selects the operand (4 = #imm or A,
+ *  5 = direct, 6-7 = @R0/@R1, 8-F = R0-R7), so those rows share one
+ *  operand accessor; the irregular columns 0-3 are decoded one by one.
+ *
+ *  Machine cycles (12 clocks each) are the data-sheet figures:
+ *  4 for MUL/DIV, 2 for jumps, calls, returns, MOVC/MOVX, PUSH/POP,
+ *  INC DPTR and the direct-to-direct / direct,#imm forms, 1 otherwise.
+ *  The timers advance by an instruction's cycles after it executes.
+ *
+ *  License: MIT
+ * =============================================================================
+ */
+
+#include "sim_8051.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* =========================================================================
+ *  SFR addresses and PSW / control bits
+ * ========================================================================= */
+#define SFR_P0     0x80
+#define SFR_SP     0x81
+#define SFR_DPL    0x82
+#define SFR_DPH    0x83
+#define SFR_TCON   0x88
+#define SFR_TMOD   0x89
+#define SFR_TL0    0x8A
+#define SFR_TL1    0x8B
+#define SFR_TH0    0x8C
+#define SFR_TH1    0x8D
+#define SFR_P1     0x90
+#define SFR_SCON   0x98
+#define SFR_SBUF   0x99
+#define SFR_P2     0xA0
+#define SFR_IE     0xA8
+#define SFR_P3     0xB0
+#define SFR_IP     0xB8
+#define SFR_PSW    0xD0
+#define SFR_ACC    0xE0
+#define SFR_B      0xF0
+
+#define PSW_CY     0x80
+#define PSW_AC     0x40
+#define PSW_OV     0x04
+#define PSW_P      0x01
+
+#define TCON_TF1   0x80
+#define TCON_TR1   0x40
+#define TCON_TF0   0x20
+#define TCON_TR0   0x10
+
+#define SCON_TI    0x02
+#define SCON_RI    0x01
+
+#define IE_EA      0x80
+#define IE_ES      0x10
+#define IE_ET1     0x08
+#define IE_ET0     0x02
+
+#define SFR(s, a)  ((s)->sfr[(a) - 0x80])
+#define ACC(s)     SFR(s, SFR_ACC)
+#define PSW(s)     SFR(s, SFR_PSW)
+#define SP(s)      SFR(s, SFR_SP)
+
+/* =========================================================================
+ *  Memory access
+ * ========================================================================= */
+static uint8_t fetch(Sim8051 *s)
+{
+    return s->code[s->pc++];
+}
+
+static uint8_t *reg_ptr(Sim8051 *s, int n)
+{
+    return &s->iram[(PSW(s) & 0x18) | n];
+}
+
+uint8_t sim8051_reg(const Sim8051 *sim, int n)
+{
+    return sim->iram[(sim->sfr[SFR_PSW - 0x80] & 0x18) | (n & 7)];
+}
+
+static uint8_t rd_direct(const Sim8051 *s, uint8_t addr)
+{
+    return addr < 0x80 ? s->iram[addr] : s->sfr[addr - 0x80];
+}
+
+static void uart_put(Sim8051 *s, uint8_t byte)
+{
+    if (s->uart_len == s->uart_cap) {
+        int new_cap = s->uart_cap ? s->uart_cap * 2 : 64;
+        char *tmp = (char *)realloc(s->uart, (size_t)new_cap);
+        if (!tmp) return;           /* drop output, keep simulating */
+        s->uart     = tmp;
+        s->uart_cap = new_cap;
+    }
+    s->uart[s->uart_len++] = (char)byte;
+}
+
+static void wr_direct(Sim8051 *s, uint8_t addr, uint8_t v)
+{
+    if (addr < 0x80) {
+        s->iram[addr] = v;
+        return;
+    }
+    s->sfr[addr - 0x80] = v;
+    if (addr == SFR_SBUF) {
+        uart_put(s, v);
+        SFR(s, SFR_SCON) |= SCON_TI;    /* transmission is instantaneous */
+    } else if (addr == SFR_IE || addr == SFR_IP) {
+        s->irq_hold = 1;
+    }
+}
+
+/* Bit address -> byte address: 0x00-0x7F in RAM 0x20-0x2F, else SFRs */
+static uint8_t bit_byte(uint8_t bit)
+{
+    return bit < 0x80 ? (uint8_t)(0x20 + (bit >> 3)) : (uint8_t)(bit & 0xF8);
+}
+
+static int rd_bit(const Sim8051 *s, uint8_t bit)
+{
+    return (rd_direct(s, bit_byte(bit)) >> (bit & 7)) & 1;
+}
+
+static void wr_bit(Sim8051 *s, uint8_t bit, int v)
+{
+    uint8_t addr = bit_byte(bit);
+    uint8_t mask = (uint8_t)(1u << (bit & 7));
+    uint8_t old  = rd_direct(s, addr);
+    wr_direct(s, addr, v ? (uint8_t)(old | mask) : (uint8_t)(old & ~mask));
+}
+
+static int carry(const Sim8051 *s)
+{
+    return (s->sfr[SFR_PSW - 0x80] & PSW_CY) != 0;
+}
+
+static void set_flag(Sim8051 *s, uint8_t flag, int v)
+{
+    if (v) PSW(s) |= flag;
+    else   PSW(s) &= (uint8_t)~flag;
+}
+
+static void push(Sim8051 *s, uint8_t v)
+{
+    SP(s)++;
+    s->iram[SP(s)] = v;
+}
+
+static uint8_t pop(Sim8051 *s)
+{
+    uint8_t v = s->iram[SP(s)];
+    SP(s)--;
+    return v;
+}
+
+static uint16_t dptr(const Sim8051 *s)
+{
+    return (uint16_t)((s->sfr[SFR_DPH - 0x80] << 8) | s->sfr[SFR_DPL - 0x80]);
+}
+
+/*
+ * Operand of the regular columns: 5 = direct (`dir`), 6-7 = @R0/@R1,
+ * 8-F = R0-R7.
+ */
+static uint8_t opnd_read(Sim8051 *s, int lo, uint8_t dir)
+{
+    if (lo == 5) return rd_direct(s, dir);
+    if (lo < 8)  return s->iram[*reg_ptr(s, lo - 6)];
+    return *reg_ptr(s, lo - 8);
+}
+
+static void opnd_write(Sim8051 *s, int lo, uint8_t dir, uint8_t v)
+{
+    if (lo == 5)     wr_direct(s, dir, v);
+    else if (lo < 8) s->iram[*reg_ptr(s, lo - 6)] = v;
+    else             *reg_ptr(s, lo - 8) = v;
+}
+
+/* =========================================================================
+ *  ALU
+ * ========================================================================= */
+static void alu_add(Sim8051 *s, uint8_t v, int c)
+{
+    uint8_t  a = ACC(s);
+    unsigned r = (unsigned)a + v + (unsigned)c;
+    set_flag(s, PSW_CY, r > 0xFF);
+    set_flag(s, PSW_AC, (a & 0x0F) + (v & 0x0F) + c > 0x0F);
+    set_flag(s, PSW_OV, ((a ^ r) & (v ^ r) & 0x80) != 0);
+    ACC(s) = (uint8_t)r;
+}
+
+static void alu_subb(Sim8051 *s, uint8_t v)
+{
+    uint8_t  a = ACC(s);
+    int      c = carry(s);
+    unsigned r = (unsigned)a - v - (unsigned)c;
+    set_flag(s, PSW_CY, (int)a < (int)v + c);
+    set_flag(s, PSW_AC, (a & 0x0F) < (v & 0x0F) + c);
+    set_flag(s, PSW_OV, ((a ^ v) & (a ^ r) & 0x80) != 0);
+    ACC(s) = (uint8_t)r;
+}
+
+static void jump_rel(Sim8051 *s, uint8_t rel)
+{
+    s->pc = (uint16_t)(s->pc + (int8_t)rel);
+}
+
+/* =========================================================================
+ *  Timers 0 and 1  (T0/T1 pins idle: counter mode never counts)
+ * ========================================================================= */
+static void timer_tick(Sim8051 *s, int t)
+{
+    uint8_t  tmod = (uint8_t)(SFR(s, SFR_TMOD) >> (4 * t));
+    int      mode = tmod & 3;
+    uint8_t  tr   = t ? TCON_TR1 : TCON_TR0;
+    uint8_t  tf   = t ? TCON_TF1 : TCON_TF0;
+    uint8_t *tl   = &SFR(s, SFR_TL0 + t);
+    uint8_t *th   = &SFR(s, SFR_TH0 + t);
+
+    /* Timer 0 in mode 3: TH0 is a second 8-bit timer run by TR1 */
+    if (t == 0 && mode == 3 && (SFR(s, SFR_TCON) & TCON_TR1)) {
+        if (++*th == 0) SFR(s, SFR_TCON) |= TCON_TF1;
+    }
+    if (!(SFR(s, SFR_TCON) & tr) || (tmod & 0x04)) return;
+    if ((tmod & 0x08) && !(SFR(s, SFR_P3) & (t ? 0x08 : 0x04))) return;
+    /* Timer 1 keeps counting while timer 0 owns TF1, but sets no flag */
+    if (t == 1 && (SFR(s, SFR_TMOD) & 3) == 3) tf = 0;
+
+    switch (mode) {
+    case 0:                         /* 13-bit: TH + low 5 bits of TL */
+        if (((*tl + 1) & 0x1F) != 0) {
+            *tl = (uint8_t)((*tl & 0xE0) | ((*tl + 1) & 0x1F));
+        } else {
+            *tl &= 0xE0;
+            if (++*th == 0) SFR(s, SFR_TCON) |= tf;
+        }
+        break;
+    case 1:                         /* 16-bit */
+        if (++*tl == 0 && ++*th == 0) SFR(s, SFR_TCON) |= tf;
+        break;
+    case 2:                         /* 8-bit auto-reload from TH */
+        if (++*tl == 0) {
+            *tl = *th;
+            SFR(s, SFR_TCON) |= tf;
+        }
+        break;
+    default:                        /* mode 3 */
+        if (t == 0 && ++*tl == 0) SFR(s, SFR_TCON) |= tf;
+        break;                      /* timer 1 stops in mode 3 */
+    }
+}
+
+static void timers_advance(Sim8051 *s, int cycles)
+{
+    if (!(SFR(s, SFR_TCON) & (TCON_TR0 | TCON_TR1))) return;
+    for (int c = 0; c < cycles; c++) {
+        timer_tick(s, 0);
+        timer_tick(s, 1);
+    }
+}
+
+/* =========================================================================
+ *  Interrupts  —  timer 0 (0x0B), timer 1 (0x1B), serial (0x23)
+ * ========================================================================= */
+static const struct {
+    uint8_t ie_bit;
+    uint8_t vector;
+} irq_sources[] = {
+    { IE_ET0, 0x0B },
+    { IE_ET1, 0x1B },
+    { IE_ES,  0x23 },
+};
+
+static int irq_pending(const Sim8051 *s, int src)
+{
+    uint8_t tcon = s->sfr[SFR_TCON - 0x80];
+    switch (src) {
+    case 0:  return (tcon & TCON_TF0) != 0;
+    case 1:  return (tcon & TCON_TF1) != 0;
+    default: return (s->sfr[SFR_SCON - 0x80] & (SCON_TI | SCON_RI)) != 0;
+    }
+}
+
+/* Vectors to the highest-priority pending interrupt the current level
+ * allows.  Returns 1 if one was entered. */
+static int irq_enter(Sim8051 *s)
+{
+    uint8_t ie = SFR(s, SFR_IE);
+    if (!(ie & IE_EA) || (s->in_service & 2)) return 0;
+
+    int chosen = -1, high = 0;
+    for (int src = 0; src < 3; src++) {
+        if (!(ie & irq_sources[src].ie_bit) || !irq_pending(s, src)) continue;
+        int hi = (SFR(s, SFR_IP) & irq_sources[src].ie_bit) != 0;
+        if (hi && !high) { chosen = src; high = 1; }
+        else if (chosen < 0 && !s->in_service) chosen = src;
+    }
+    if (chosen < 0 || (!high && s->in_service)) return 0;
+
+    push(s, (uint8_t)(s->pc & 0xFF));
+    push(s, (uint8_t)(s->pc >> 8));
+    s->pc = irq_sources[chosen].vector;
+    s->in_service |= high ? 2 : 1;
+    if (chosen == 0) SFR(s, SFR_TCON) &= (uint8_t)~TCON_TF0;
+    if (chosen == 1) SFR(s, SFR_TCON) &= (uint8_t)~TCON_TF1;
+    return 1;
+}
+
+/* Could any enabled interrupt still fire?  (decides whether SJMP $ halts) */
+static int irq_possible(const Sim8051 *s)
+{
+    uint8_t ie   = s->sfr[SFR_IE - 0x80];
+    uint8_t tcon = s->sfr[SFR_TCON - 0x80];
+    if (!(ie & IE_EA)) return 0;
+    if ((ie & IE_ET0) && (tcon & (TCON_TR0 | TCON_TF0))) return 1;
+    if ((ie & IE_ET1) && (tcon & (TCON_TR1 | TCON_TF1))) return 1;
+    return (ie & IE_ES) && irq_pending(s, 2);
+}
+
+/* HLT (SJMP $) with nothing left to wake it, or RET from the entry */
+static int at_halt(const Sim8051 *s)
+{
+    uint8_t op = s->code[s->pc];
+    if (op == 0x80 && s->code[(uint16_t)(s->pc + 1)] == 0xFE)
+        return !irq_possible(s);
+    return op == 0x22 && s->sfr[SFR_SP - 0x80] == s->sp0;
+}
+
+/* =========================================================================
+ *  Create / destroy / entry
+ * ========================================================================= */
+Sim8051* sim8051_create(const CodeBuffer *code)
+{
+    if (code->size > (int)sizeof(((Sim8051 *)0)->code)) {
+        fprintf(stderr, "Error: %d-byte image does not fit in 8051 "
+                        "code memory (64 KB).\n", code->size);
+        return NULL;
+    }
+    Sim8051 *s = (Sim8051 *)calloc(1, sizeof(Sim8051));
+    if (s) {
+        s->pc_cycles = (uint64_t *)calloc(65536, sizeof(uint64_t));
+        s->pc_hits   = (uint64_t *)calloc(65536, sizeof(uint64_t));
+    }
+    if (!s || !s->pc_cycles || !s->pc_hits) {
+        fprintf(stderr, "Error: out of memory.\n");
+        sim8051_destroy(s);
+        return NULL;
+    }
+
+    memset(s->code, 0xFF, sizeof(s->code));     /* erased flash */
+    memcpy(s->code, code->bytes, (size_t)code->size);
+    s->code_size = code->size;
+
+    /* Reset state: ports high, SP = 07h, everything else 0 */
+    SFR(s, SFR_P0) = SFR(s, SFR_P1) = SFR(s, SFR_P2) = SFR(s, SFR_P3) = 0xFF;
+    SP(s)  = 0x07;
+    s->sp0 = 0x07;
+    return s;
+}
+
+void sim8051_destroy(Sim8051 *sim)
+{
+    if (!sim) return;
+    free(sim->pc_cycles);
+    free(sim->pc_hits);
+    free(sim->uart);
+    free(sim);
+}
+
+int sim8051_set_entry(Sim8051 *sim, const CodeBuffer *code, const char *label)
+{
+    int addr = symtab_lookup(&code->labels, label);
+    if (addr < 0) return -1;
+    sim->pc = (uint16_t)addr;
+    return 0;
+}
+
+/* =========================================================================
+ *  sim8051_step()
+ * ========================================================================= */
+int sim8051_step(Sim8051 *s)
+{
+    /* Interrupts are sampled between instructions: the hardware LCALL */
+    if (s->irq_hold) {
+        s->irq_hold = 0;
+    } else if (irq_enter(s)) {
+        s->pc_cycles[s->pc] += 2;
+        s->cycles += 2;
+        timers_advance(s, 2);
+        return 2;
+    }
+
+    if (at_halt(s)) return 0;
+
+    uint16_t pc0 = s->pc;
+    uint8_t  op  = s->code[pc0];
+
+    if ((int)pc0 >= s->code_size) {
+        snprintf(s->fault, sizeof(s->fault),
+                 "PC 0x%04X is outside the %d-byte program", pc0,
+                 s->code_size);
+        return -1;
+    }
+
+    s->pc++;
+    int lo  = op & 0x0F;
+    int cyc = 1;
+    uint8_t a, b, v;
+    uint16_t addr;
+
+    if (lo >= 4) {
+        /* ---- regular columns: #imm / direct / @Ri / Rn --------------- */
+        uint8_t dir = (lo == 5) ? fetch(s) : 0;
+        switch (op >> 4) {
+        case 0x0:                               /* INC */
+            if (lo == 4) ACC(s)++;
+            else opnd_write(s, lo, dir, (uint8_t)(opnd_read(s, lo, dir) + 1));
+            break;
+        case 0x1:                               /* DEC */
+            if (lo == 4) ACC(s)--;
+            else opnd_write(s, lo, dir, (uint8_t)(opnd_read(s, lo, dir) - 1));
+            break;
+        case 0x2:                               /* ADD A, src */
+            alu_add(s, lo == 4 ? fetch(s) : opnd_read(s, lo, dir), 0);
+            break;
+        case 0x3:                               /* ADDC A, src */
+            alu_add(s, lo == 4 ? fetch(s) : opnd_read(s, lo, dir), carry(s));
+            break;
+        case 0x4:                               /* ORL A, src */
+            ACC(s) |= lo == 4 ? fetch(s) : opnd_read(s, lo, dir);
+            break;
+        case 0x5:                               /* ANL A, src */
+            ACC(s) &= lo == 4 ? fetch(s) : opnd_read(s, lo, dir);
+            break;
+        case 0x6:                               /* XRL A, src */
+            ACC(s) ^= lo == 4 ? fetch(s) : opnd_read(s, lo, dir);
+            break;
+        case 0x7:                               /* MOV dst, #imm */
+            if (lo == 4) ACC(s) = fetch(s);
+            else {
+                opnd_write(s, lo, dir, fetch(s));
+                if (lo == 5) cyc = 2;
+            }
+            break;
+        case 0x8:
+            if (lo == 4) {                      /* DIV AB */
+                a = ACC(s);
+                b = SFR(s, SFR_B);
+                set_flag(s, PSW_CY, 0);
+                set_flag(s, PSW_OV, b == 0);
+                if (b) {
+                    ACC(s)        = (uint8_t)(a / b);
+                    SFR(s, SFR_B) = (uint8_t)(a % b);
+                }
+                cyc = 4;
+            } else if (lo == 5) {               /* MOV direct, direct */
+                v = rd_direct(s, dir);          /* 85 src dst */
+                wr_direct(s, fetch(s), v);
+                cyc = 2;
+            } else {                            /* MOV direct, @Ri / Rn */
+                v = opnd_read(s, lo, 0);
+                wr_direct(s, fetch(s), v);
+                cyc = 2;
+            }
+            break;
+        case 0x9:                               /* SUBB A, src */
+            alu_subb(s, lo == 4 ? fetch(s) : opnd_read(s, lo, dir));
+            break;
+        case 0xA:
+            if (lo == 4) {                      /* MUL AB */
+                unsigned r = (unsigned)ACC(s) * SFR(s, SFR_B);
+                ACC(s)        = (uint8_t)r;
+                SFR(s, SFR_B) = (uint8_t)(r >> 8);
+                set_flag(s, PSW_CY, 0);
+                set_flag(s, PSW_OV, r > 0xFF);
+                cyc = 4;
+            } else if (lo == 5) {               /* A5: reserved */
+                snprintf(s->fault, sizeof(s->fault),
+                         "reserved opcode 0xA5 at 0x%04X", pc0);
+                s->pc = pc0;
+                return -1;
+            } else {                            /* MOV @Ri / Rn, direct */
+                opnd_write(s, lo, 0, rd_direct(s, fetch(s)));
+                cyc = 2;
+            }
+            break;
+        case 0xB: {                             /* CJNE x, y, rel */
+            uint8_t x, y, rel;
+            if (lo == 4)      { x = ACC(s); y = fetch(s); }
+            else if (lo == 5) { x = ACC(s); y = rd_direct(s, dir); }
+            else              { x = opnd_read(s, lo, 0); y = fetch(s); }
+            rel = fetch(s);
+            set_flag(s, PSW_CY, x < y);
+            if (x != y) jump_rel(s, rel);
+            cyc = 2;
+            break;
+        }
+        case 0xC:
+            if (lo == 4) {                      /* SWAP A */
+                ACC(s) = (uint8_t)((ACC(s) << 4) | (ACC(s) >> 4));
+            } else {                            /* XCH A, src */
+                v = opnd_read(s, lo, dir);
+                opnd_write(s, lo, dir, ACC(s));
+                ACC(s) = v;
+            }
+            break;
+        case 0xD:
+            if (lo == 4) {                      /* DA A */
+                unsigned r = ACC(s);
+                if ((r & 0x0F) > 9 || (PSW(s) & PSW_AC)) r += 0x06;
+                if (r > 0xFF) set_flag(s, PSW_CY, 1);
+                if (((r >> 4) & 0x0F) > 9 || carry(s)) r += 0x60;
+                if (r > 0xFF) set_flag(s, PSW_CY, 1);
+                ACC(s) = (uint8_t)r;
+            } else if (lo == 6 || lo == 7) {    /* XCHD A, @Ri */
+                uint8_t *m = &s->iram[*reg_ptr(s, lo - 6)];
+                v = *m;
+                *m = (uint8_t)((v & 0xF0) | (ACC(s) & 0x0F));
+                ACC(s) = (uint8_t)((ACC(s) & 0xF0) | (v & 0x0F));
+            } else {                            /* DJNZ direct / Rn, rel */
+                v = (uint8_t)(opnd_read(s, lo, dir) - 1);
+                opnd_write(s, lo, dir, v);
+                uint8_t rel = fetch(s);
+                if (v) jump_rel(s, rel);
+                cyc = 2;
+            }
+            break;
+        case 0xE:                               /* CLR A / MOV A, src */
+            ACC(s) = lo == 4 ? 0 : opnd_read(s, lo, dir);
+            break;
+        default:                                /* CPL A / MOV dst, A */
+            if (lo == 4) ACC(s) = (uint8_t)~ACC(s);
+            else opnd_write(s, lo, dir, ACC(s));
+            break;
+        }
+    } else if (lo == 1) {
+        /* ---- AJMP / ACALL addr11 ------------------------------------- */
+        uint8_t low = fetch(s);
+        addr = (uint16_t)((s->pc & 0xF800) | ((op & 0xE0) << 3) | low);
+        if (op & 0x10) {
+            push(s, (uint8_t)(s->pc & 0xFF));
+            push(s, (uint8_t)(s->pc >> 8));
+        }
+        s->pc = addr;
+        cyc = 2;
+    } else {
+        /* ---- irregular columns 0, 2, 3 -------------------------------- */
+        uint8_t bit, rel;
+        cyc = 2;
+        switch (op) {
+        case 0x00: cyc = 1; break;                              /* NOP */
+        case 0x02: case 0x12:                                   /* LJMP / LCALL */
+            addr = (uint16_t)(fetch(s) << 8);
+            addr |= fetch(s);
+            if (op == 0x12) {
+                push(s, (uint8_t)(s->pc & 0xFF));
+                push(s, (uint8_t)(s->pc >> 8));
+            }
+            s->pc = addr;
+            break;
+        case 0x03:                                              /* RR A */
+            ACC(s) = (uint8_t)((ACC(s) >> 1) | (ACC(s) << 7));
+            cyc = 1;
+            break;
+        case 0x13:                                              /* RRC A */
+            a = ACC(s);
+            ACC(s) = (uint8_t)((a >> 1) | (carry(s) << 7));
+            set_flag(s, PSW_CY, a & 1);
+            cyc = 1;
+            break;
+        case 0x23:                                              /* RL A */
+            ACC(s) = (uint8_t)((ACC(s) << 1) | (ACC(s) >> 7));
+            cyc = 1;
+            break;
+        case 0x33:                                              /* RLC A */
+            a = ACC(s);
+            ACC(s) = (uint8_t)((a << 1) | carry(s));
+            set_flag(s, PSW_CY, a & 0x80);
+            cyc = 1;
+            break;
+        case 0x10: case 0x20: case 0x30:                        /* JBC/JB/JNB */
+            bit = fetch(s);
+            rel = fetch(s);
+            if (rd_bit(s, bit) == (op != 0x30)) {
+                if (op == 0x10) wr_bit(s, bit, 0);
+                jump_rel(s, rel);
+            }
+            break;
+        case 0x22: case 0x32:                                   /* RET / RETI */
+            addr = (uint16_t)(pop(s) << 8);
+            addr |= pop(s);
+            s->pc = addr;
+            if (op == 0x32) {
+                s->in_service &= (s->in_service & 2) ? 1 : 0;
+                s->irq_hold = 1;
+            }
+            break;
+        case 0x40: case 0x50: case 0x60: case 0x70: case 0x80: { /* JC..SJMP */
+            int take;
+            rel = fetch(s);
+            switch (op) {
+            case 0x40: take = carry(s);       break;
+            case 0x50: take = !carry(s);      break;
+            case 0x60: take = ACC(s) == 0;    break;
+            case 0x70: take = ACC(s) != 0;    break;
+            default:   take = 1;              break;
+            }
+            if (take) jump_rel(s, rel);
+            break;
+        }
+        case 0x42: case 0x52: case 0x62:                        /* xRL dir, A */
+        case 0x43: case 0x53: case 0x63:                        /* xRL dir, #  */
+            bit = fetch(s);                     /* direct address */
+            v = (op & 1) ? fetch(s) : ACC(s);
+            a = rd_direct(s, bit);
+            if (op < 0x50)      a |= v;
+            else if (op < 0x60) a &= v;
+            else                a ^= v;
+            wr_direct(s, bit, a);
+            if (!(op & 1)) cyc = 1;
+            break;
+        case 0x72: case 0x82: case 0xA0: case 0xB0:             /* C op bit */
+            bit = fetch(s);
+            v = (uint8_t)rd_bit(s, bit);
+            if (op == 0xA0 || op == 0xB0) v = !v;
+            if (op == 0x72 || op == 0xA0) set_flag(s, PSW_CY, carry(s) | v);
+            else                          set_flag(s, PSW_CY, carry(s) & v);
+            break;
+        case 0x73:                                              /* JMP @A+DPTR */
+            s->pc = (uint16_t)(dptr(s) + ACC(s));
+            break;
+        case 0x83:                                              /* MOVC A,@A+PC */
+            ACC(s) = s->code[(uint16_t)(s->pc + ACC(s))];
+            break;
+        case 0x93:                                              /* MOVC A,@A+DPTR */
+            ACC(s) = s->code[(uint16_t)(dptr(s) + ACC(s))];
+            break;
+        case 0x90:                                              /* MOV DPTR,#16 */
+            SFR(s, SFR_DPH) = fetch(s);
+            SFR(s, SFR_DPL) = fetch(s);
+            break;
+        case 0x92:                                              /* MOV bit, C */
+            wr_bit(s, fetch(s), carry(s));
+            break;
+        case 0xA2:                                              /* MOV C, bit */
+            set_flag(s, PSW_CY, rd_bit(s, fetch(s)));
+            cyc = 1;
+            break;
+        case 0xA3:                                              /* INC DPTR */
+            addr = (uint16_t)(dptr(s) + 1);
+            SFR(s, SFR_DPH) = (uint8_t)(addr >> 8);
+            SFR(s, SFR_DPL) = (uint8_t)addr;
+            break;
+        case 0xB2: case 0xC2: case 0xD2:                        /* CPL/CLR/SETB bit */
+            bit = fetch(s);
+            wr_bit(s, bit, op == 0xB2 ? !rd_bit(s, bit) : op == 0xD2);
+            cyc = 1;
+            break;
+        case 0xB3: case 0xC3: case 0xD3:                        /* CPL/CLR/SETB C */
+            set_flag(s, PSW_CY, op == 0xB3 ? !carry(s) : op == 0xD3);
+            cyc = 1;
+            break;
+        case 0xC0:                                              /* PUSH direct */
+            push(s, rd_direct(s, fetch(s)));
+            break;
+        case 0xD0:                                              /* POP direct */
+            bit = fetch(s);
+            wr_direct(s, bit, pop(s));
+            break;
+        case 0xE0:                                              /* MOVX A,@DPTR */
+            ACC(s) = s->xram[dptr(s)];
+            break;
+        case 0xE2: case 0xE3:                                   /* MOVX A,@Ri */
+            addr = (uint16_t)((SFR(s, SFR_P2) << 8) | *reg_ptr(s, op & 1));
+            ACC(s) = s->xram[addr];
+            break;
+        case 0xF0:                                              /* MOVX @DPTR,A */
+            s->xram[dptr(s)] = ACC(s);
+            break;
+        default:                                                /* F2/F3 */
+            addr = (uint16_t)((SFR(s, SFR_P2) << 8) | *reg_ptr(s, op & 1));
+            s->xram[addr] = ACC(s);
+            break;
+        }
+    }
+
+    /* PSW.P always holds the parity of ACC */
+    v = ACC(s);
+    v ^= (uint8_t)(v >> 4);
+    v ^= (uint8_t)(v >> 2);
+    v ^= (uint8_t)(v >> 1);
+    set_flag(s, PSW_P, v & 1);
+
+    s->pc_cycles[pc0] += (uint64_t)cyc;
+    s->pc_hits[pc0]++;
+    s->cycles += (uint64_t)cyc;
+    s->instructions++;
+    timers_advance(s, cyc);
+    return cyc;
+}
+
+Sim8051Stop sim8051_run(Sim8051 *sim, uint64_t max_cycles)
+{
+    while (sim->cycles < max_cycles) {
+        int cyc = sim8051_step(sim);
+        if (cyc == 0) return SIM8051_HALTED;
+        if (cyc < 0)  return SIM8051_FAULT;
+    }
+    return at_halt(sim) ? SIM8051_HALTED : SIM8051_LIMIT;
+}
+
+/* =========================================================================
+ *  Reports
+ * ========================================================================= */
+void sim8051_print_state(const Sim8051 *sim, FILE *out)
+{
+    const uint8_t *sfr = sim->sfr;
+
+    fprintf(out, "  R0-R7  ");
+    for (int n = 0; n < 8; n++) fprintf(out, " %02X", sim8051_reg(sim, n));
+    fprintf(out, "\n  A %02X  B %02X  PSW %02X  SP %02X  DPTR %04X  "
+                 "PC %04X\n",
+            sfr[SFR_ACC - 0x80], sfr[SFR_B - 0x80], sfr[SFR_PSW - 0x80],
+            sfr[SFR_SP - 0x80], dptr(sim), sim->pc);
+    fprintf(out, "  TMOD %02X  TCON %02X  TH0/TL0 %02X%02X  TH1/TL1 %02X%02X  "
+                 "IE %02X\n",
+            sfr[SFR_TMOD - 0x80], sfr[SFR_TCON - 0x80],
+            sfr[SFR_TH0 - 0x80], sfr[SFR_TL0 - 0x80],
+            sfr[SFR_TH1 - 0x80], sfr[SFR_TL1 - 0x80], sfr[SFR_IE - 0x80]);
+    fprintf(out, "  Cycles %llu  (%.1f us at %u MHz), %llu instructions\n",
+            (unsigned long long)sim->cycles,
+            (double)sim->cycles * 12e6 / SIM8051_CLOCK_HZ,
+            SIM8051_CLOCK_HZ / 1000000u,
+            (unsigned long long)sim->instructions);
+    if (sim->uart_len > 0) {
+        fprintf(out, "  UART   \"");
+        for (int i = 0; i < sim->uart_len; i++) {
+            unsigned char c = (unsigned char)sim->uart[i];
+            if (c >= 0x20 && c < 0x7F && c != '"' && c != '\\')
+                fputc(c, out);
+            else
+                fprintf(out, "\\x%02X", c);
+        }
+        fprintf(out, "\"\n");
+    }
+}
+
+typedef struct {
+    const char *name;
+    int         address;
+    uint64_t    hits;
+    uint64_t    cycles;
+} SimRegion;
+
+static int region_by_address(const void *a, const void *b)
+{
+    const SimRegion *ra = (const SimRegion *)a, *rb = (const SimRegion *)b;
+    return ra->address - rb->address;
+}
+
+static int region_by_cycles(const void *a, const void *b)
+{
+    const SimRegion *ra = (const SimRegion *)a, *rb = (const SimRegion *)b;
+    if (ra->cycles != rb->cycles) return ra->cycles < rb->cycles ? 1 : -1;
+    return ra->address - rb->address;
+}
+
+void sim8051_print_profile(const Sim8051 *sim, const CodeBuffer *code,
+                           FILE *out)
+{
+    const SymbolTable *labels = &code->labels;
+    SimRegion *reg = (SimRegion *)malloc(
+        (size_t)(labels->count + 1) * sizeof(SimRegion));
+    if (!reg) return;
+
+    /* One region per distinct label address, plus "(start)" for the code
+     * before the first label */
+    int n = 0, has_zero = 0;
+    for (int i = 0; i < labels->count; i++) {
+        reg[n].name    = labels->entries[i].name;
+        reg[n].address = labels->entries[i].address;
+        if (reg[n].address == 0) has_zero = 1;
+        n++;
+    }
+    if (!has_zero) {
+        reg[n].name    = "(start)";
+        reg[n].address = 0;
+        n++;
+    }
+    qsort(reg, (size_t)n, sizeof(SimRegion), region_by_address);
+    int u = 0;
+    for (int i = 0; i < n; i++) {
+        if (u > 0 && reg[u - 1].address == reg[i].address) continue;
+        reg[u++] = reg[i];
+    }
+    n = u;
+
+    for (int i = 0; i < n; i++) {
+        int end = (i + 1 < n) ? reg[i + 1].address : 65536;
+        reg[i].hits   = sim->pc_hits[reg[i].address];
+        reg[i].cycles = 0;
+        for (int a = reg[i].address; a < end; a++)
+            reg[i].cycles += sim->pc_cycles[a];
+    }
+    qsort(reg, (size_t)n, sizeof(SimRegion), region_by_cycles);
+
+    fprintf(out, "  Profile (machine cycles from each label to the next):\n");
+    fprintf(out, "    %-24s %6s %10s %12s %7s\n",
+            "label", "addr", "hits", "cycles", "share");
+    for (int i = 0; i < n; i++) {
+        if (reg[i].cycles == 0) continue;
+        fprintf(out, "    %-24s 0x%04X %10llu %12llu %6.1f%%\n",
+                reg[i].name, reg[i].address,
+                (unsigned long long)reg[i].hits,
+                (unsigned long long)reg[i].cycles,
+                sim->cycles ? 100.0 * (double)reg[i].cycles /
+                              (double)sim->cycles : 0.0);
+    }
+    free(reg);
+}
@@ -0,0 +1,123 @@
+/*
+ * =============================================================================
+ *  UA - Unified Assembler
+ *  MCS-51 Instruction-Set Simulator
+ *
+ *  File:    sim_8051.h
+ *  Purpose: Run generate_8051() output on the host, counting machine
+ *           cycles, so -arch mcs51 code can be measured and checked
+ *           without flashing hardware.
+ *
+ *  Model:   A classic 12-clock 8051 / 8052 (STC89C52RC):
+ *             - the whole MCS-51 instruction set with its data-sheet
+ *               machine-cycle counts (1, 2 or 4 per instruction)
+ *             - 256 bytes of internal RAM (R0-R7 banks, bit area, the
+ *               I8051_VAR_BASE variables, the stack; @Ri reaches the
+ *               upper 128 bytes), 64 KB of code and of external RAM
+ *             - ACC, B, PSW (with parity), SP, DPTR and the ports
+ *             - Timer 0 / Timer 1 in modes 0-3 (TMOD, TCON, THx, TLx)
+ *             - the timer and serial interrupts (IE, IP, two priority
+ *               levels); a byte written to SBUF is captured as UART
+ *               output and sets TI at once
+ *           External interrupt pins and the T0/T1 counter inputs stay
+ *           idle.
+ *
+ *  Run:     sim8051_run() executes until the program halts (HLT, i.e.
+ *           SJMP $ with no interrupt that could wake it, or a RET with
+ *           nothing on the stack it started with), faults (reserved
+ *           opcode, PC outside the loaded image) or uses up its cycle
+ *           budget.  Every executed instruction adds its cycles and one
+ *           hit to its own address; sim8051_print_profile() folds those
+ *           counters into per-label totals.
+ *
+ *  License: MIT
+ * =============================================================================
+ */
+
+#ifndef UA_SIM_8051_H
+#define UA_SIM_8051_H
+
+#include "codegen.h"    /* CodeBuffer, SymbolTable */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define SIM8051_CLOCK_HZ   12000000u    /* default crystal: 1 cycle = 1 us */
+
+/* Why sim8051_run() stopped */
+typedef enum {
+    SIM8051_HALTED = 0,     /* HLT or RET from the entry point            */
+    SIM8051_LIMIT,          /* cycle budget used up                       */
+    SIM8051_FAULT           /* reserved opcode / PC outside the image     */
+} Sim8051Stop;
+
+typedef struct Sim8051 {
+    uint8_t   code[65536];  /* program memory (image at 0, rest 0xFF)     */
+    uint8_t   iram[256];    /* internal RAM                               */
+    uint8_t   sfr[128];     /* SFRs 0x80-0xFF (direct addressing only)    */
+    uint8_t   xram[65536];  /* external data memory (MOVX)                */
+    int       code_size;    /* bytes loaded; executing past them faults   */
+
+    uint16_t  pc;
+    uint8_t   sp0;          /* SP at entry: a RET below it returns        */
+    int       in_service;   /* bit 0/1: a low/high priority ISR is active */
+    int       irq_hold;     /* no interrupt before the next instruction   */
+
+    uint64_t  cycles;       /* machine cycles executed                    */
+    uint64_t  instructions;
+    uint64_t *pc_cycles;    /* [65536] cycles spent at each address       */
+    uint64_t *pc_hits;      /* [65536] executions of each address         */
+
+    char     *uart;         /* bytes written to SBUF                      */
+    int       uart_len;
+    int       uart_cap;
+
+    char      fault[96];    /* reason for SIM8051_FAULT                   */
+} Sim8051;
+
+/*
+ * sim8051_create() / sim8051_destroy()
+ *   Reset a simulator and load `code->bytes` at address 0 / release it.
+ *   sim8051_create() returns NULL if the image does not fit in 64 KB or
+ *   memory runs out (message on stderr).
+ */
+Sim8051* sim8051_create(const CodeBuffer *code);
+void     sim8051_destroy(Sim8051 *sim);
+
+/*
+ * sim8051_set_entry()
+ *   Start at `label` (a label of `code`) instead of the reset vector.
+ *   Returns -1 if the label is not defined.
+ */
+int sim8051_set_entry(Sim8051 *sim, const CodeBuffer *code, const char *label);
+
+/*
+ * sim8051_step()
+ *   Executes one instruction (or enters one interrupt) and advances the
+ *   timers.  Returns its machine cycles, or -1 on a fault.
+ */
+int sim8051_step(Sim8051 *sim);
+
+/*
+ * sim8051_run()
+ *   Steps until the program halts, faults or has run `max_cycles`.
+ */
+Sim8051Stop sim8051_run(Sim8051 *sim, uint64_t max_cycles);
+
+/*
+ * sim8051_reg()
+ *   Value of R0-R7 in the current register bank.
+ */
+uint8_t sim8051_reg(const Sim8051 *sim, int n);
+
+/*
+ * sim8051_print_state() / sim8051_print_profile()
+ *   Registers, SFRs and totals / one line per label of `code` with its
+ *   hits (times its first instruction ran) and the cycles spent between
+ *   it and the next label, most expensive first.
+ */
+void sim8051_print_state(const Sim8051 *sim, FILE *out);
+void sim8051_print_profile(const Sim8051 *sim, const CodeBuffer *code,
+                           FILE *out);
+
+#endif /* UA_SIM_8051_H */
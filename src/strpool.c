@@ -0,0 +1,198 @@
+/*
+ * =============================================================================
+ *  UA - Unified Assembler
+ *  Shared String Interning
+ *
+ *  File:    strpool.c
+ *  Purpose: Implementation of the ID-based string pool.
+ *
+ *  License: MIT
+ * =============================================================================
+ */
+
+#include "strpool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* =========================================================================
+ *  Constants
+ * ========================================================================= */
+#define INITIAL_POOL_STRINGS   64
+#define INITIAL_POOL_SLOTS     128     /* must be a power of two        */
+#define STR_CHUNK_SIZE         16384   /* bytes per backing chunk       */
+
+struct StrChunk {
+    StrChunk *next;
+    size_t    used;
+    size_t    cap;
+    char      data[];
+};
+
+/* =========================================================================
+ *  Allocation helper  —  interning has no recovery path for running out
+ *  of memory, so raise it as a fatal error in one place.
+ * ========================================================================= */
+static void sp_out_of_memory(StrPool *pool)
+{
+    diag_printf(pool->diag, "UA strpool: out of memory\n");
+    diag_fatal(pool->diag);
+}
+
+static void *sp_xrealloc(StrPool *pool, void *ptr, size_t size)
+{
+    void *tmp = realloc(ptr, size);
+    if (!tmp) sp_out_of_memory(pool);
+    return tmp;
+}
+
+/* =========================================================================
+ *  strpool_hash()  —  FNV-1a, 32-bit
+ * ========================================================================= */
+uint32_t strpool_hash(const char *str)
+{
+    uint32_t h = 2166136261u;
+    while (*str) {
+        h ^= (uint8_t)*str++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* =========================================================================
+ *  strpool_init() / strpool_free()
+ * ========================================================================= */
+void strpool_init(StrPool *pool, UaDiag *diag)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->diag   = diag;
+    pool->strs   = (const char **)malloc(INITIAL_POOL_STRINGS *
+                                         sizeof(const char *));
+    pool->hashes = (uint32_t *)malloc(INITIAL_POOL_STRINGS *
+                                      sizeof(uint32_t));
+    pool->slots  = (StrId *)calloc(INITIAL_POOL_SLOTS, sizeof(StrId));
+    if (!pool->strs || !pool->hashes || !pool->slots) {
+        strpool_free(pool);
+        sp_out_of_memory(pool);
+    }
+    pool->capacity = INITIAL_POOL_STRINGS;
+    pool->slot_cap = INITIAL_POOL_SLOTS;
+
+    /* ID 0 is STR_NONE */
+    pool->strs[0]   = "";
+    pool->hashes[0] = 0;
+    pool->count     = 1;
+}
+
+void strpool_free(StrPool *pool)
+{
+    StrChunk *c = pool->chunks;
+    while (c) {
+        StrChunk *next = c->next;
+        free(c);
+        c = next;
+    }
+    free((void *)pool->strs);
+    free(pool->hashes);
+    free(pool->slots);
+    pool->strs     = NULL;
+    pool->hashes   = NULL;
+    pool->slots    = NULL;
+    pool->chunks   = NULL;
+    pool->count    = 0;
+    pool->capacity = 0;
+    pool->slot_cap = 0;
+}
+
+/* =========================================================================
+ *  Internal helpers
+ * ========================================================================= */
+
+/* Copy `len + 1` bytes of `str` into chunk storage. */
+static const char *strpool_store(StrPool *pool, const char *str, size_t len)
+{
+    StrChunk *c = pool->chunks;
+    if (!c || c->cap - c->used < len + 1) {
+        size_t cap = (len + 1 > STR_CHUNK_SIZE) ? len + 1 : STR_CHUNK_SIZE;
+        c = (StrChunk *)sp_xrealloc(pool, NULL, sizeof(StrChunk) + cap);
+        c->next = pool->chunks;
+        c->used = 0;
+        c->cap  = cap;
+        pool->chunks = c;
+    }
+    char *dst = c->data + c->used;
+    memcpy(dst, str, len + 1);
+    c->used += len + 1;
+    return dst;
+}
+
+/* Probe for `str`; returns the slot holding it or the empty slot where
+ * it would go. */
+static int strpool_probe(const StrPool *pool, const char *str, uint32_t h)
+{
+    int mask = pool->slot_cap - 1;
+    int i = (int)(h & (uint32_t)mask);
+    while (pool->slots[i] != STR_NONE) {
+        StrId id = pool->slots[i];
+        if (pool->hashes[id] == h && strcmp(pool->strs[id], str) == 0)
+            return i;
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static void strpool_grow_slots(StrPool *pool)
+{
+    int    new_cap   = pool->slot_cap * 2;
+    StrId *new_slots = (StrId *)calloc((size_t)new_cap, sizeof(StrId));
+    if (!new_slots) sp_out_of_memory(pool);
+    for (StrId id = 1; id < (StrId)pool->count; id++) {
+        int j = (int)(pool->hashes[id] & (uint32_t)(new_cap - 1));
+        while (new_slots[j] != STR_NONE) j = (j + 1) & (new_cap - 1);
+        new_slots[j] = id;
+    }
+    free(pool->slots);
+    pool->slots    = new_slots;
+    pool->slot_cap = new_cap;
+}
+
+/* =========================================================================
+ *  strpool_intern() / strpool_find() / strpool_get()
+ * ========================================================================= */
+StrId strpool_intern(StrPool *pool, const char *str)
+{
+    if (!str[0]) return STR_NONE;
+
+    uint32_t h = strpool_hash(str);
+    int slot = strpool_probe(pool, str, h);
+    if (pool->slots[slot] != STR_NONE) return pool->slots[slot];
+
+    if (pool->count >= pool->capacity) {
+        pool->strs   = (const char **)sp_xrealloc(pool, (void *)pool->strs,
+                           (size_t)pool->capacity * 2 * sizeof(const char *));
+        pool->hashes = (uint32_t *)sp_xrealloc(pool, pool->hashes,
+                           (size_t)pool->capacity * 2 * sizeof(uint32_t));
+        pool->capacity *= 2;
+    }
+
+    StrId id = (StrId)pool->count++;
+    pool->strs[id]    = strpool_store(pool, str, strlen(str));
+    pool->hashes[id]  = h;
+    pool->slots[slot] = id;
+
+    /* Keep the load factor at or below 1/2 */
+    if (pool->count * 2 > pool->slot_cap)
+        strpool_grow_slots(pool);
+    return id;
+}
+
+StrId strpool_find(const StrPool *pool, const char *str)
+{
+    if (!str[0]) return STR_NONE;
+    return pool->slots[strpool_probe(pool, str, strpool_hash(str))];
+}
+
+const char* strpool_get(const StrPool *pool, StrId id)
+{
+    return pool->strs[id];
+}
@@ -0,0 +1,88 @@
+/*
+ * =============================================================================
+ *  UA - Unified Assembler
+ *  Shared String Interning
+ *
+ *  File:    strpool.h
+ *  Purpose: String pool that maps every distinct name to a compact 32-bit
+ *           ID.  The parser interns label names, variable names and string
+ *           literals here, so the IR carries 4-byte IDs instead of inline
+ *           128-byte arrays.  The back-ends intern their symbol names here
+ *           as well.
+ *
+ *  Ownership:
+ *           Strings live in large chunks that are never moved, so the
+ *           pointer returned by strpool_get() stays valid until
+ *           strpool_free().  ID 0 (STR_NONE) is reserved for "no string"
+ *           and maps to "".
+ *
+ *  License: MIT
+ * =============================================================================
+ */
+
+#ifndef UA_STRPOOL_H
+#define UA_STRPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "diag.h"
+
+/* =========================================================================
+ *  Types
+ * ========================================================================= */
+typedef uint32_t StrId;
+
+#define STR_NONE  ((StrId)0)
+
+typedef struct StrChunk StrChunk;
+
+typedef struct {
+    const char **strs;      /* ID -> string (strs[0] == "")              */
+    uint32_t    *hashes;    /* ID -> cached hash                         */
+    int          count;     /* Number of IDs in use (incl. STR_NONE)     */
+    int          capacity;  /* Allocated length of strs[] / hashes[]     */
+    StrId       *slots;     /* Open-addressing hash index (0 = empty)    */
+    int          slot_cap;  /* Slot count (power of two)                 */
+    StrChunk    *chunks;    /* Backing storage for the string bytes      */
+    UaDiag      *diag;      /* where running out of memory is raised     */
+} StrPool;
+
+/* =========================================================================
+ *  Public API
+ * ========================================================================= */
+
+/*
+ * strpool_init() / strpool_free()
+ *   Initialise an empty pool that raises running out of memory on `diag`
+ *   (diag_fatal()) / release every string it owns.  A pool whose init
+ *   failed is left empty, so strpool_free() is always safe.
+ */
+void strpool_init(StrPool *pool, UaDiag *diag);
+void strpool_free(StrPool *pool);
+
+/*
+ * strpool_intern()
+ *   Returns the ID of `str`, adding it to the pool if necessary.
+ */
+StrId strpool_intern(StrPool *pool, const char *str);
+
+/*
+ * strpool_find()
+ *   Returns the ID of `str`, or STR_NONE if it was never interned.
+ */
+StrId strpool_find(const StrPool *pool, const char *str);
+
+/*
+ * strpool_get()
+ *   Returns the string for `id`.
+ */
+const char* strpool_get(const StrPool *pool, StrId id);
+
+/*
+ * strpool_hash()
+ *   The hash function used by the pool (FNV-1a, 32-bit).
+ */
+uint32_t strpool_hash(const char *str);
+
+#endif /* UA_STRPOOL_H */
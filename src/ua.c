@@ -0,0 +1,753 @@
+/*
+ * =============================================================================
+ *  UA - Unified Assembler
+ *  Library Interface (libua)
+ *
+ *  File:    ua.c
+ *  Purpose: The compile pipeline behind ua_compile(), shared by the CLI
+ *           (main.c) and programs that link libua directly.
+ *
+ *  Pipeline:
+ *   Precompiler -> Lexer -> Parser -> [Peephole] -> Compliance -> Import GC
+ *      -> Backend [+ VAR RegAlloc] (arch-specific) -> Emitter (PE/ELF/Mach-O)
+ *
+ *  Every phase reports through the job's UaDiag.  A fatal diagnostic —
+ *  out of memory included — releases what the failing phase registered
+ *  with diag_own() and longjmp()s back to ua_compile(), which frees what
+ *  the finished phases produced and returns -1.  The library never exits
+ *  its host.
+ *
+ *  Build (static library):
+ *     gcc -std=c99 -O2 -c lexer.c parser.c codegen.c strpool.c diag.c \
+ *         precompiler.c impcache.c linemap.c optimizer.c gc.c regalloc.c \
+ *         jit.c ua.c \
+ *         backend_8051.c backend_x86_64.c backend_x86_32.c \
+ *         backend_arm.c backend_arm64.c backend_risc_v.c \
+ *         emitter_pe.c emitter_elf.c emitter_macho.c
+ *     ar rcs libua.a *.o
+ *
+ *  License: MIT
+ * =============================================================================
+ */
+
+#include "ua.h"
+
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lexer.h"
+#include "parser.h"
+#include "optimizer.h"
+#include "gc.h"
+#include "precompiler.h"
+#include "backend_8051.h"
+#include "backend_x86_64.h"
+#include "backend_x86_32.h"
+#include "backend_arm.h"
+#include "backend_arm64.h"
+#include "backend_risc_v.h"
+#include "emitter_pe.h"
+#include "emitter_elf.h"
+#include "emitter_macho.h"
+
+/* =========================================================================
+ *  Opcode Compliance — Architecture / System validation tables
+ *
+ *  Each opcode carries two bitmasks:
+ *    arch_mask  —  which architectures support the instruction
+ *    sys_mask   —  which systems/OS targets support the instruction
+ *
+ *  If an instruction has  arch_mask == UA_AALL  and  sys_mask == UA_SALL,
+ *  it is universal and accepted everywhere.  When new architecture-specific
+ *  opcodes are added, restrict the masks accordingly.
+ *
+ *  The validation pass runs after parsing, before backend dispatch.
+ * ========================================================================= */
+
+/* Architecture bitmask flags */
+#define UA_AX86     0x01u   /* x86-64                  */
+#define UA_AX86_32  0x02u   /* x86-32 (IA-32)          */
+#define UA_AARM     0x04u   /* ARM (ARMv7-A)           */
+#define UA_AARM64   0x08u   /* ARM64 (AArch64)         */
+#define UA_ARISCV   0x10u   /* RISC-V (RV64I+M)        */
+#define UA_AMCS51   0x20u   /* 8051 / MCS-51           */
+#define UA_AALL     0x3Fu   /* All architectures       */
+
+/* System/OS bitmask flags */
+#define UA_SBARE    0x01u   /* baremetal (no OS)       */
+#define UA_SWIN32   0x02u   /* Windows (win32)         */
+#define UA_SLINUX   0x04u   /* Linux                   */
+#define UA_SMACOS   0x08u   /* macOS                   */
+#define UA_SALL     0x0Fu   /* All systems             */
+
+typedef struct {
+    unsigned int arch_mask;     /* supported architectures                   */
+    unsigned int sys_mask;      /* supported systems                         */
+} OpcodeCompliance;
+
+/*
+ * Compliance table — indexed by Opcode enum.
+ *
+ * All 37 existing opcodes are universal (UA_AALL, UA_SALL).
+ * When architecture-specific instructions are introduced, restrict the
+ * masks here.  The SYS opcode is restricted to non-baremetal systems
+ * on architectures that require an OS for syscall support.
+ *
+ * NOTE: OP_SYS uses native syscall instructions (SYSCALL, SVC, ECALL)
+ *       which are valid even on baremetal firmware (calling into firmware
+ *       supervisor mode), so it is kept universal.
+ */
+static const OpcodeCompliance OPCODE_COMPLIANCE[OP_COUNT] = {
+    /* Data movement                                                        */
+    [OP_MOV]    = { UA_AALL,  UA_SALL  },
+    [OP_LDI]    = { UA_AALL,  UA_SALL  },
+    [OP_LOAD]   = { UA_AALL,  UA_SALL  },
+    [OP_STORE]  = { UA_AALL,  UA_SALL  },
+
+    /* Arithmetic                                                           */
+    [OP_ADD]    = { UA_AALL,  UA_SALL  },
+    [OP_SUB]    = { UA_AALL,  UA_SALL  },
+    [OP_MUL]    = { UA_AALL,  UA_SALL  },
+    [OP_DIV]    = { UA_AALL,  UA_SALL  },
+
+    /* Bitwise                                                              */
+    [OP_AND]    = { UA_AALL,  UA_SALL  },
+    [OP_OR]     = { UA_AALL,  UA_SALL  },
+    [OP_XOR]    = { UA_AALL,  UA_SALL  },
+    [OP_NOT]    = { UA_AALL,  UA_SALL  },
+    [OP_SHL]    = { UA_AALL,  UA_SALL  },
+    [OP_SHR]    = { UA_AALL,  UA_SALL  },
+
+    /* Comparison / control flow                                            */
+    [OP_CMP]    = { UA_AALL,  UA_SALL  },
+    [OP_JMP]    = { UA_AALL,  UA_SALL  },
+    [OP_JZ]     = { UA_AALL,  UA_SALL  },
+    [OP_JNZ]    = { UA_AALL,  UA_SALL  },
+    [OP_JL]     = { UA_AALL,  UA_SALL  },
+    [OP_JG]     = { UA_AALL,  UA_SALL  },
+    [OP_CALL]   = { UA_AALL,  UA_SALL  },
+    [OP_RET]    = { UA_AALL,  UA_SALL  },
+
+    /* Stack                                                                */
+    [OP_PUSH]   = { UA_AALL,  UA_SALL  },
+    [OP_POP]    = { UA_AALL,  UA_SALL  },
+
+    /* Increment / Decrement                                                */
+    [OP_INC]    = { UA_AALL,  UA_SALL  },
+    [OP_DEC]    = { UA_AALL,  UA_SALL  },
+
+    /* Software Interrupt                                                   */
+    [OP_INT]    = { UA_AALL,  UA_SALL  },
+
+    /* Variables                                                            */
+    [OP_VAR]    = { UA_AALL,  UA_SALL  },
+    [OP_SET]    = { UA_AALL,  UA_SALL  },
+    [OP_GET]    = { UA_AALL,  UA_SALL  },
+
+    /* String / Byte / Syscall                                              */
+    [OP_LDS]    = { UA_AALL,  UA_SALL  },
+    [OP_LOADB]  = { UA_AALL,  UA_SALL  },
+    [OP_STOREB] = { UA_AALL,  UA_SALL  },
+    [OP_SYS]    = { UA_AALL,  UA_SALL  },
+
+    /* Buffer allocation                                                    */
+    [OP_BUFFER] = { UA_AALL,  UA_SALL  },
+
+    /* Miscellaneous                                                        */
+    [OP_NOP]    = { UA_AALL,  UA_SALL  },
+    [OP_HLT]    = { UA_AALL,  UA_SALL  },
+
+    /* --- Architecture-specific opcodes ---------------------------------- */
+    /* x86 family (x86_32 & x86_64) */
+    [OP_CPUID]  = { UA_AX86 | UA_AX86_32,            UA_SALL  },
+    [OP_RDTSC]  = { UA_AX86 | UA_AX86_32,            UA_SALL  },
+    [OP_BSWAP]  = { UA_AX86 | UA_AX86_32,            UA_SALL  },
+    [OP_PUSHA]  = { UA_AX86_32,                       UA_SALL  },
+    [OP_POPA]   = { UA_AX86_32,                       UA_SALL  },
+
+    /* 8051 exclusive */
+    [OP_DJNZ]   = { UA_AMCS51,                        UA_SALL  },
+    [OP_CJNE]   = { UA_AMCS51,                        UA_SALL  },
+    [OP_SETB]   = { UA_AMCS51,                        UA_SALL  },
+    [OP_CLR]    = { UA_AMCS51,                        UA_SALL  },
+    [OP_RETI]   = { UA_AMCS51,                        UA_SALL  },
+
+    /* ARM & ARM64 + RISC-V for WFI */
+    [OP_WFI]    = { UA_AARM | UA_AARM64 | UA_ARISCV,  UA_SALL  },
+    [OP_DMB]    = { UA_AARM | UA_AARM64,              UA_SALL  },
+
+    /* RISC-V exclusive */
+    [OP_EBREAK] = { UA_ARISCV,                        UA_SALL  },
+    [OP_FENCE]  = { UA_ARISCV,                        UA_SALL  },
+
+    /* Assembler directives — universal */
+    [OP_ORG]    = { UA_AALL,                           UA_SALL  },
+};
+
+/* -------------------------------------------------------------------------
+ *  resolve_arch_mask()  —  map an architecture string to its bitmask
+ * --------------------------------------------------------------------- */
+static unsigned int resolve_arch_mask(const char *arch)
+{
+    if (ua_casecmp(arch, "x86") == 0)        return UA_AX86;
+    if (ua_casecmp(arch, "x86_32") == 0 ||
+        ua_casecmp(arch, "ia32") == 0)       return UA_AX86_32;
+    if (ua_casecmp(arch, "arm") == 0)         return UA_AARM;
+    if (ua_casecmp(arch, "arm64") == 0 ||
+        ua_casecmp(arch, "aarch64") == 0)     return UA_AARM64;
+    if (ua_casecmp(arch, "riscv") == 0 ||
+        ua_casecmp(arch, "rv64") == 0)        return UA_ARISCV;
+    if (ua_casecmp(arch, "mcs51") == 0)       return UA_AMCS51;
+    return 0;
+}
+
+/* -------------------------------------------------------------------------
+ *  resolve_sys_mask()  —  map a system string to its bitmask
+ *  Returns UA_SBARE when sys is NULL (baremetal target).
+ * --------------------------------------------------------------------- */
+static unsigned int resolve_sys_mask(const char *sys)
+{
+    if (!sys)                                           return UA_SBARE;
+    if (ua_casecmp(sys, "baremetal") == 0)    return UA_SBARE;
+    if (ua_casecmp(sys, "win32") == 0)        return UA_SWIN32;
+    if (ua_casecmp(sys, "linux") == 0)        return UA_SLINUX;
+    if (ua_casecmp(sys, "macos") == 0 ||
+        ua_casecmp(sys, "darwin") == 0)       return UA_SMACOS;
+    return 0;
+}
+
+/* -------------------------------------------------------------------------
+ *  arch_name_from_mask()  —  human-readable list of supported archs
+ * --------------------------------------------------------------------- */
+static void arch_names_from_mask(unsigned int mask, char *buf, int size)
+{
+    buf[0] = '\0';
+    int pos = 0;
+    struct { unsigned int bit; const char *name; } map[] = {
+        { UA_AX86,    "x86"    },
+        { UA_AX86_32, "x86_32" },
+        { UA_AARM,    "arm"    },
+        { UA_AARM64,  "arm64"  },
+        { UA_ARISCV,  "riscv"  },
+        { UA_AMCS51,  "mcs51"  },
+    };
+    for (int i = 0; i < 6; i++) {
+        if (mask & map[i].bit) {
+            if (pos > 0 && pos < size - 2) {
+                buf[pos++] = ',';
+                buf[pos++] = ' ';
+            }
+            int nlen = (int)strlen(map[i].name);
+            if (pos + nlen < size - 1) {
+                memcpy(buf + pos, map[i].name, (size_t)nlen);
+                pos += nlen;
+            }
+        }
+    }
+    buf[pos] = '\0';
+}
+
+/* -------------------------------------------------------------------------
+ *  sys_names_from_mask()  —  human-readable list of supported systems
+ * --------------------------------------------------------------------- */
+static void sys_names_from_mask(unsigned int mask, char *buf, int size)
+{
+    buf[0] = '\0';
+    int pos = 0;
+    struct { unsigned int bit; const char *name; } map[] = {
+        { UA_SBARE,  "baremetal" },
+        { UA_SWIN32, "win32"     },
+        { UA_SLINUX, "linux"     },
+        { UA_SMACOS, "macos"     },
+    };
+    for (int i = 0; i < 4; i++) {
+        if (mask & map[i].bit) {
+            if (pos > 0 && pos < size - 2) {
+                buf[pos++] = ',';
+                buf[pos++] = ' ';
+            }
+            int nlen = (int)strlen(map[i].name);
+            if (pos + nlen < size - 1) {
+                memcpy(buf + pos, map[i].name, (size_t)nlen);
+                pos += nlen;
+            }
+        }
+    }
+    buf[pos] = '\0';
+}
+
+/* -------------------------------------------------------------------------
+ *  validate_opcode_compliance()
+ *
+ *  Walk every IR instruction and verify that its opcode is supported by
+ *  the target architecture and system.  Returns 0 on success, -1 on
+ *  failure (diagnostics printed to `diag`).
+ * --------------------------------------------------------------------- */
+static int validate_opcode_compliance(const Instruction *ir, int ir_count,
+                                      const char *arch, const char *sys,
+                                      UaDiag *diag)
+{
+    unsigned int arch_bit = resolve_arch_mask(arch);
+    unsigned int sys_bit  = resolve_sys_mask(sys);
+    int errors = 0;
+
+    for (int i = 0; i < ir_count; i++) {
+        if (ir[i].is_label) continue;   /* labels have no opcode */
+
+        Opcode op = ir[i].opcode;
+        if (op < 0 || op >= OP_COUNT) continue;  /* safety guard */
+
+        const OpcodeCompliance *c = &OPCODE_COMPLIANCE[op];
+
+        /* Check architecture support */
+        if (arch_bit != 0 && !(c->arch_mask & arch_bit)) {
+            char supported[128];
+            arch_names_from_mask(c->arch_mask, supported,
+                                (int)sizeof(supported));
+            diag_printf(diag,
+                    "\n  UA Compliance Error\n"
+                    "  -------------------\n"
+                    "  %s, Line %d: opcode '%s' is not supported on "
+                    "architecture '%s'\n"
+                    "  Supported architectures: %s\n\n",
+                    ir[i].file, ir[i].line, opcode_name(op), arch,
+                    supported);
+            errors++;
+        }
+
+        /* Check system support */
+        if (sys_bit != 0 && !(c->sys_mask & sys_bit)) {
+            char supported[128];
+            sys_names_from_mask(c->sys_mask, supported,
+                               (int)sizeof(supported));
+            diag_printf(diag,
+                    "\n  UA Compliance Error\n"
+                    "  -------------------\n"
+                    "  %s, Line %d: opcode '%s' is not supported on "
+                    "system '%s'\n"
+                    "  Supported systems: %s\n\n",
+                    ir[i].file, ir[i].line, opcode_name(op),
+                    sys ? sys : "baremetal", supported);
+            errors++;
+        }
+    }
+
+    if (errors > 0) {
+        diag_printf(diag, "[Compliance] %d opcode violation(s) found.\n",
+                errors);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* =========================================================================
+ *  ua_casecmp()  –  case-insensitive string compare (ANSI C)
+ * ========================================================================= */
+int ua_casecmp(const char *a, const char *b)
+{
+    while (*a && *b) {
+        char ca = *a, cb = *b;
+        if (ca >= 'A' && ca <= 'Z') ca += 32;
+        if (cb >= 'A' && cb <= 'Z') cb += 32;
+        if (ca != cb) return ca - cb;
+        a++; b++;
+    }
+    return (unsigned char)*a - (unsigned char)*b;
+}
+
+/* =========================================================================
+ *  Compile job  —  everything one ua_compile() call owns
+ *
+ *  Allocated on the heap so that its fields keep their values across the
+ *  longjmp() of a fatal diagnostic.
+ * ========================================================================= */
+typedef struct {
+    const ua_options *opt;
+    UaDiag        diag;
+    char         *preprocessed;
+    LineMap       lines;        /* source of each preprocessed line       */
+    Token        *tokens;
+    Instruction  *ir;
+    Instruction  *gc_ir;        /* IR before the import GC (--gc-report)  */
+    GcStats       gc;
+    StrPool       strings;
+    int           have_strings;
+    CodeBuffer   *code;
+    ua_format     format;
+    const ElfTarget *elf;
+    uint8_t      *image;
+    int           image_size;
+} UaJob;
+
+/* -------------------------------------------------------------------------
+ *  ua_select_format()  —  executable container for arch + sys
+ * --------------------------------------------------------------------- */
+static ua_format ua_select_format(unsigned int arch_bit, const char *sys,
+                                  int jit)
+{
+    if (jit || sys == NULL) return UA_FORMAT_RAW;
+    if (ua_casecmp(sys, "win32") == 0 &&
+        (arch_bit & (UA_AX86 | UA_AX86_32)))
+        return UA_FORMAT_PE;
+    if (ua_casecmp(sys, "linux") == 0 && !(arch_bit & UA_AMCS51))
+        return UA_FORMAT_ELF;
+    if ((ua_casecmp(sys, "macos") == 0 || ua_casecmp(sys, "darwin") == 0) &&
+        (arch_bit & UA_AARM64))
+        return UA_FORMAT_MACHO;
+    return UA_FORMAT_RAW;
+}
+
+/* -------------------------------------------------------------------------
+ *  ua_backend_name()  —  backend name used in messages
+ * --------------------------------------------------------------------- */
+static const char* ua_backend_name(unsigned int arch_bit)
+{
+    switch (arch_bit) {
+    case UA_AMCS51:  return "8051";
+    case UA_AX86:    return "x86-64";
+    case UA_AX86_32: return "x86-32";
+    case UA_AARM:    return "ARM";
+    case UA_AARM64:  return "ARM64";
+    case UA_ARISCV:  return "RISC-V";
+    default:         return "unknown";
+    }
+}
+
+/* -------------------------------------------------------------------------
+ *  ua_elf_target()  —  ELF description the backend gives for its ISA
+ * --------------------------------------------------------------------- */
+static const ElfTarget* ua_elf_target(unsigned int arch_bit)
+{
+    switch (arch_bit) {
+    case UA_AX86:    return elf_target_x86_64();
+    case UA_AX86_32: return elf_target_x86_32();
+    case UA_AARM:    return elf_target_arm();
+    case UA_AARM64:  return elf_target_arm64();
+    case UA_ARISCV:  return elf_target_risc_v();
+    default:         return NULL;
+    }
+}
+
+/* -------------------------------------------------------------------------
+ *  ua_generate()  —  run the backend selected by `arch_bit`
+ *
+ *  A backend registers its tables with the job's UaDiag as it builds
+ *  them; once it has returned they are its own business again.
+ * --------------------------------------------------------------------- */
+static CodeBuffer* ua_generate(UaJob *job, unsigned int arch_bit,
+                               int ir_count)
+{
+    const ua_options *opt = job->opt;
+    UaDiag *diag = &job->diag;
+
+    /* ELF maps code, strings and data as separate segments, with the
+     * code at a fixed address past the headers and start stub */
+    int seg_gap = 0, origin = 0;
+    if (job->format == UA_FORMAT_ELF) {
+        seg_gap = ELF_SEGMENT_GAP;
+        origin  = (int)elf_code_origin(job->elf);
+    }
+
+    CodeBuffer *code = NULL;
+    int mark = diag_owned(diag);
+    switch (arch_bit) {
+    case UA_AMCS51:
+        code = generate_8051(job->ir, ir_count, &job->strings, diag);
+        break;
+    case UA_AX86: {
+        /* R12-R15 are callee-saved: only a stand-alone executable may
+         * use them for VARs; JIT and raw code can be called from C.
+         * A label entry skips the entry prologue, so VARs stay in memory. */
+        int var_regs = X64_VARS_MEMORY;
+        if (opt->opt_level >= 2 && !opt->label_entry) {
+            var_regs = X64_VARS_SCRATCH;
+            if (job->format == UA_FORMAT_PE || job->format == UA_FORMAT_ELF)
+                var_regs = X64_VARS_PROCESS;
+        }
+        code = generate_x86_64(job->ir, ir_count, &job->strings, opt->sys,
+                               var_regs, seg_gap, diag);
+        break;
+    }
+    case UA_AX86_32:
+        code = generate_x86_32(job->ir, ir_count, &job->strings, seg_gap,
+                               origin, diag);
+        break;
+    case UA_AARM:
+        code = generate_arm(job->ir, ir_count, &job->strings, seg_gap,
+                            origin, diag);
+        break;
+    case UA_AARM64:
+        code = generate_arm64(job->ir, ir_count, &job->strings,
+                              opt->opt_level >= 2 && !opt->label_entry,
+                              seg_gap, origin, diag);
+        break;
+    case UA_ARISCV:
+        code = generate_risc_v(job->ir, ir_count, &job->strings,
+                               opt->opt_level >= 2 && !opt->label_entry,
+                               seg_gap, origin, diag);
+        break;
+    default:
+        break;
+    }
+    diag_release(diag, mark);
+    return code;
+}
+
+/* -------------------------------------------------------------------------
+ *  ua_mark_functions()  —  code labels that start a function
+ *
+ *  A label starts a function when it is defined with parameters, a CALL
+ *  names it, or it follows a RET or HLT, so that no code runs into it.
+ *  The ELF symbol table sizes each function up to the next one.
+ * --------------------------------------------------------------------- */
+static void ua_mark_functions(UaJob *job, int ir_count)
+{
+    CodeBuffer *code = job->code;
+    int after_return = 0;
+    for (int i = 0; i < ir_count; i++) {
+        const Instruction *inst = &job->ir[i];
+        StrId id;
+        if (inst->is_label && (inst->is_function || after_return)) {
+            id = inst->label_id;
+        } else if (!inst->is_label) {
+            after_return = inst->opcode == OP_RET || inst->opcode == OP_HLT;
+            if (inst->opcode != OP_CALL ||
+                inst->operands[0].type != OPERAND_LABEL_REF)
+                continue;
+            id = inst->operands[0].data.label_id;
+        } else {
+            continue;
+        }
+
+        const char *name = strpool_get(&job->strings, id);
+        int addr = symtab_lookup(&code->labels, name);
+        if (addr >= 0 && symtab_lookup(&code->functions, name) < 0)
+            symtab_add(&code->functions, name, addr);
+    }
+}
+
+/* -------------------------------------------------------------------------
+ *  ua_run()  —  the pipeline proper; returns 0 or -1
+ * --------------------------------------------------------------------- */
+static int ua_run(UaJob *job, const char *src)
+{
+    const ua_options *opt = job->opt;
+    UaDiag *diag = &job->diag;
+
+    unsigned int arch_bit = resolve_arch_mask(opt->arch);
+    if (arch_bit == 0) {
+        diag_printf(diag, "Error: unknown architecture '%s'.\n", opt->arch);
+        diag_printf(diag, "Supported architectures: mcs51, x86, x86_32, "
+                          "arm, arm64, riscv\n");
+        return -1;
+    }
+    if (opt->jit && arch_bit != UA_AX86) {
+        diag_printf(diag, "Error: JIT execution is only supported for "
+                          "-arch x86.\n");
+        return -1;
+    }
+    job->format = ua_select_format(arch_bit, opt->sys, opt->jit);
+    if (job->format == UA_FORMAT_ELF)
+        job->elf = ua_elf_target(arch_bit);
+
+    /* --- Precompiler --------------------------------------------------- */
+    job->preprocessed = preprocess(src, opt->arch, opt->sys,
+                                   opt->base_dir ? opt->base_dir : ".",
+                                   opt->filename, opt->lib_dir,
+                                   opt->import_cache, &job->lines, diag);
+    if (!job->preprocessed) {
+        diag_printf(diag, "Error: preprocessing failed.\n");
+        return -1;
+    }
+    diag_log(diag, DIAG_NORMAL, "[Precompiler] Done\n");
+
+    /* --- Lexer --------------------------------------------------------- */
+    int token_count = 0;
+    job->tokens = tokenize(job->preprocessed, &job->lines, &token_count,
+                           diag);
+    if (!job->tokens) {
+        diag_printf(diag, "Error: tokenization failed.\n");
+        return -1;
+    }
+    diag_log(diag, DIAG_NORMAL, "[Lexer]  %d tokens\n", token_count);
+
+    /* --- Parser -------------------------------------------------------- */
+    int ir_count = 0;
+    int mark = diag_owned(diag);
+    job->have_strings = 1;
+    job->ir = parse(job->tokens, token_count, &ir_count, &job->strings,
+                    diag);
+    diag_release(diag, mark);
+    if (!job->ir) {
+        diag_printf(diag, "Error: parsing failed.\n");
+        return -1;
+    }
+    diag_log(diag, DIAG_NORMAL, "[Parser] %d IR instructions\n", ir_count);
+
+    /* --- Peephole optimisation (-O1) ----------------------------------- */
+    if (opt->opt_level >= 1) {
+        PeepholeStats peep;
+        ir_count = peephole_optimize(job->ir, ir_count, opt->arch, &peep);
+        peephole_print_stats(&peep, diag);
+    }
+
+    /* --- Opcode compliance validation ---------------------------------- */
+    if (validate_opcode_compliance(job->ir, ir_count, opt->arch, opt->sys,
+                                   diag) != 0) {
+        diag_printf(diag, "Error: opcode compliance check failed.\n");
+        return -1;
+    }
+    diag_log(diag, DIAG_NORMAL, "[Compliance] All opcodes valid for %s%s%s\n",
+             opt->arch, opt->sys ? " / " : "", opt->sys ? opt->sys : "");
+
+    /* --- Unreferenced imported code ------------------------------------ */
+    int full_count = ir_count;
+    if (opt->label_entry) {
+        diag_log(diag, DIAG_VERBOSE, "[GC] Skipped: any label may be an "
+                                     "entry point\n");
+    } else {
+        if (opt->gc_report) {
+            job->gc_ir = (Instruction *)malloc((size_t)ir_count *
+                                               sizeof(Instruction) + 1);
+            if (job->gc_ir)
+                memcpy(job->gc_ir, job->ir,
+                       (size_t)ir_count * sizeof(Instruction));
+        }
+        ir_count = gc_imports(job->ir, ir_count, &job->strings, &job->gc);
+        if (job->gc.removed > 0)
+            diag_log(diag, DIAG_NORMAL, "[GC] %d unreferenced imported IR "
+                     "entries removed\n", job->gc.removed);
+    }
+
+    /* --- Backend ------------------------------------------------------- */
+    job->code = ua_generate(job, arch_bit, ir_count);
+    if (!job->code) {
+        diag_printf(diag, "Error: %s code generation failed.\n",
+                    ua_backend_name(arch_bit));
+        return -1;
+    }
+
+    /* --- GC report: measure the saving against the uncollected IR ------ */
+    if (opt->gc_report) {
+        if (opt->label_entry) {
+            diag_printf(diag, "[GC] Not run: --entry makes every label a "
+                              "possible entry point\n");
+        } else {
+            job->gc.bytes_after = job->code->size + job->code->bss_size;
+            job->gc.bytes_before = job->gc.bytes_after;
+            if (job->gc.removed > 0 && job->gc_ir) {
+                /* Same backend, quietly, on the IR as it was */
+                Instruction *pruned = job->ir;
+                int level = diag->level;
+                job->ir = job->gc_ir;
+                job->gc_ir = pruned;
+                diag->level = DIAG_QUIET;
+                CodeBuffer *full = ua_generate(job, arch_bit, full_count);
+                diag->level = level;
+                job->gc_ir = job->ir;
+                job->ir = pruned;
+                if (full) {
+                    job->gc.bytes_before = full->size + full->bss_size;
+                    free_code_buffer(full);
+                }
+            }
+            gc_print_report(&job->gc, &job->strings, diag);
+        }
+    }
+
+    /* --- Executable container ------------------------------------------ */
+    int rc = 0;
+    switch (job->format) {
+    case UA_FORMAT_PE:
+        rc = emit_pe_image(job->code, &job->image, &job->image_size, diag);
+        break;
+    case UA_FORMAT_ELF:
+        ua_mark_functions(job, ir_count);
+        rc = emit_elf_image(job->code, job->elf, opt->debug_info,
+                            &job->image, &job->image_size, diag);
+        break;
+    case UA_FORMAT_MACHO:
+        rc = emit_macho_image(job->code, &job->image, &job->image_size,
+                              diag);
+        break;
+    case UA_FORMAT_RAW:
+        /* A flat image has no loader to zero the bss: store it */
+        job->image      = job->code->bytes;
+        job->image_size = job->code->size;
+        if (job->code->bss_size > 0) {
+            job->image_size += job->code->bss_size;
+            job->image = (uint8_t *)calloc(1, (size_t)job->image_size);
+            if (!job->image) {
+                diag_printf(diag, "Error: out of memory.\n");
+                return -1;
+            }
+            memcpy(job->image, job->code->bytes, (size_t)job->code->size);
+        }
+        break;
+    }
+    return rc == 0 ? 0 : -1;
+}
+
+/* =========================================================================
+ *  ua_compile()
+ * ========================================================================= */
+int ua_compile(const ua_options *opt, const char *src, ua_result *res)
+{
+    memset(res, 0, sizeof(*res));
+
+    UaJob *job = (UaJob *)calloc(1, sizeof(UaJob));
+    if (!job) return -1;
+    job->opt = opt;
+    diag_init(&job->diag, opt->diag_stream);
+    job->diag.level = opt->verbosity;
+    linemap_init(&job->lines);
+
+    jmp_buf bail;
+    int rc = -1;
+    if (!opt->arch || !src) {
+        diag_printf(&job->diag, "Error: no architecture or source given.\n");
+    } else if (setjmp(bail) == 0) {
+        job->diag.bail = &bail;
+        rc = ua_run(job, src);
+    }
+    job->diag.bail = NULL;
+
+    /* Intermediate results are not needed once the code exists */
+    free(job->preprocessed);
+    free(job->tokens);
+    if (job->have_strings) free_instructions(job->ir, &job->strings);
+    free(job->gc_ir);
+    gc_free_stats(&job->gc);
+    linemap_free(&job->lines);
+
+    if (rc == 0) {
+        codebuf_set_diag(job->code, NULL);
+        res->code        = job->code;
+        res->format      = job->format;
+        res->image       = job->image;
+        res->image_size  = job->image_size;
+    } else {
+        if (job->image && (!job->code || job->image != job->code->bytes))
+            free(job->image);
+        free_code_buffer(job->code);
+    }
+    res->diagnostics = diag_take(&job->diag);
+    diag_free(&job->diag);
+    free(job);
+    return rc;
+}
+
+/* =========================================================================
+ *  ua_result_free()
+ * ========================================================================= */
+void ua_result_free(ua_result *res)
+{
+    if (!res) return;
+    if (res->image && (!res->code || res->image != res->code->bytes))
+        free(res->image);
+    free_code_buffer(res->code);
+    free(res->diagnostics);
+    memset(res, 0, sizeof(*res));
+}
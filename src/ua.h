@@ -0,0 +1,128 @@
+/*
+ * =============================================================================
+ *  UA - Unified Assembler
+ *  Library Interface (libua)
+ *
+ *  File:    ua.h
+ *  Purpose: Compile UA source held in memory to machine code without
+ *           spawning the `ua` executable.
+ *
+ *  ua_compile() runs the whole pipeline — precompiler, lexer, parser,
+ *  [peephole], opcode compliance, import GC, backend and executable
+ *  emitter — and returns the code, the output file image and every
+ *  message the pipeline printed.  It keeps no global state and never exits the
+ *  process: a fatal diagnostic ends the call with a non-zero result.
+ *  Independent calls may run concurrently on different threads.
+ *
+ *  Only @IMPORT reads files (relative to `base_dir`, or <lib_dir>/lib/
+ *  for standard-library names); with `import_cache` set, preprocessed
+ *  imports are also read from and written to that directory.
+ *  Running out of memory is a fatal diagnostic like any other, and a
+ *  failed call frees everything it allocated.
+ *
+ *  Example:
+ *
+ *      ua_options opt = { 0 };
+ *      ua_result  res;
+ *      opt.arch = "x86";
+ *      opt.sys  = "linux";
+ *      if (ua_compile(&opt, "LDI R0, 42\nHLT\n", &res) == 0)
+ *          fwrite(res.image, 1, (size_t)res.image_size, fp);
+ *      else
+ *          fputs(res.diagnostics, stderr);
+ *      ua_result_free(&res);
+ *
+ *  License: MIT
+ * =============================================================================
+ */
+
+#ifndef UA_UA_H
+#define UA_UA_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "codegen.h"    /* CodeBuffer */
+
+#define UA_VERSION "26.0.2-ALPHA"
+
+/* =========================================================================
+ *  Output container
+ * ========================================================================= */
+typedef enum {
+    UA_FORMAT_RAW = 0,      /* flat machine code (code->bytes)           */
+    UA_FORMAT_PE,           /* Windows PE executable  (-sys win32)       */
+    UA_FORMAT_ELF,          /* Linux ELF executable   (-sys linux)       */
+    UA_FORMAT_MACHO         /* macOS Mach-O executable (-sys macos)      */
+} ua_format;
+
+/* =========================================================================
+ *  Options  —  zero-initialise, then set at least `arch`
+ * ========================================================================= */
+typedef struct {
+    const char *arch;       /* mcs51 | x86 | x86_32 | arm | arm64 | riscv
+                               (aliases ia32, aarch64, rv64)  [required]  */
+    const char *sys;        /* baremetal | win32 | linux | macos, or NULL  */
+    int         opt_level;  /* 0 = none, 1 = IR peephole, 2 = + VAR regs  */
+
+    int         jit;        /* x86 only: code is for jit_load() — raw
+                               output, VARs never in callee-saved regs     */
+    int         label_entry;/* execution may start at a label other than
+                               offset 0 — VARs stay in memory, imported
+                               code is not garbage-collected               */
+    int         gc_report;  /* list the imported code and data the GC
+                               dropped and the bytes it saved              */
+    int         debug_info; /* ELF output: add a DWARF line table mapping
+                               the code to its source lines (-g)           */
+
+    const char *filename;   /* source name for messages  (NULL = <input>) */
+    const char *base_dir;   /* directory for @IMPORT paths  (NULL = ".")  */
+    const char *lib_dir;    /* directory holding lib/ for std imports
+                               (NULL = none)                               */
+    const char *import_cache;/* directory of preprocessed imports reused
+                               across compilations (NULL = off)            */
+
+    FILE       *diag_stream;/* write messages here as they happen instead
+                               of collecting them in ua_result             */
+    int         verbosity;  /* DIAG_QUIET (-1) .. DIAG_TRACE (2); 0 = one
+                               progress line per phase (see diag.h)        */
+} ua_options;
+
+/* =========================================================================
+ *  Result  —  release with ua_result_free()
+ * ========================================================================= */
+typedef struct {
+    CodeBuffer *code;       /* backend output, or NULL on failure         */
+    ua_format   format;     /* container that `image` holds               */
+    uint8_t    *image;      /* bytes of the output file (for RAW this is
+                               code->bytes, plus the zeroed bss if any)    */
+    int         image_size;
+    char       *diagnostics;/* everything the pipeline printed, NUL-
+                               terminated (NULL when diag_stream is set)   */
+} ua_result;
+
+/* =========================================================================
+ *  Public API
+ * ========================================================================= */
+
+/*
+ * ua_compile()
+ *   Compiles the NUL-terminated UA source `src` with `opt`.  `res` is
+ *   always filled in and must be released with ua_result_free().
+ *   Returns 0 on success, -1 on failure (details in res->diagnostics).
+ */
+int ua_compile(const ua_options *opt, const char *src, ua_result *res);
+
+/*
+ * ua_result_free()
+ *   Releases the code, image and diagnostics held by `res`.
+ */
+void ua_result_free(ua_result *res);
+
+/*
+ * ua_casecmp()
+ *   Case-insensitive ASCII string compare, as used for -arch / -sys names.
+ */
+int ua_casecmp(const char *a, const char *b);
+
+#endif /* UA_UA_H */
@@ -0,0 +1,65 @@
+/*
+ * =============================================================================
+ *  UA - Unified Assembler
+ *  JIT Code Cache Test
+ *
+ *  File:    jit_reload.c
+ *  Purpose: Host program linked against libua.  Loads a module whose
+ *           entry SETs a VAR, calls it, and loads the same CodeBuffer
+ *           again: the code cache must return the module already
+ *           loaded, which still holds the updated VAR.
+ *
+ *  Build:   gcc -std=c99 -Isrc -o jit_reload tests/jit_reload.c libua/libua.a
+ *  Exit:    0 on success, 1 on failure (x86-64 hosts only).
+ *
+ *  License: MIT
+ * =============================================================================
+ */
+
+#include <stdio.h>
+
+#include "diag.h"
+#include "jit.h"
+#include "ua.h"
+
+static const char *source =
+    "    VAR  c, 10\n"
+    "    GET  R0, c\n"
+    "    INC  R0\n"
+    "    SET  c, R0\n"
+    "    HLT\n";
+
+int main(void)
+{
+    ua_options opt = { 0 };
+    ua_result  res;
+    opt.arch      = "x86";
+    opt.jit       = 1;
+    opt.verbosity = DIAG_QUIET;
+    if (ua_compile(&opt, source, &res) != 0) {
+        fputs(res.diagnostics ? res.diagnostics : "compile failed\n", stderr);
+        ua_result_free(&res);
+        return 1;
+    }
+
+    JitArena *jit = jit_create();
+    if (!jit) {
+        ua_result_free(&res);
+        return 1;
+    }
+
+    int64_t    regs[JIT_REG_COUNT] = { 0 };
+    JitModule *m1 = jit_load(jit, res.code);
+    int64_t    r1 = m1 ? jit_call(jit, jit_lookup(m1, NULL), regs) : 0;
+    JitModule *m2 = jit_load(jit, res.code);
+    int64_t    r2 = m2 ? jit_call(jit, jit_lookup(m2, NULL), regs) : 0;
+
+    int ok = m1 && m1 == m2 && r1 == 11 && r2 == 12;
+    printf("first load:  R0 = %lld\n"
+           "second load: R0 = %lld, %s module\n",
+           (long long)r1, (long long)r2, m1 == m2 ? "same" : "new");
+
+    jit_destroy(jit);
+    ua_result_free(&res);
+    return ok ? 0 : 1;
+}